@@ -26,6 +26,6 @@
 
 namespace google_sky {
 
-int Asserter::DUMMY = 0;
+// Asserter is header only; this file keeps base.o in the library.
 
 }  // namespace google_sky
@@ -74,8 +74,7 @@ typedef unsigned long long uint64;
 //
 // Additionally, we define several similar checks for convenience below.
 #define CHECK(expression) \
-  google_sky::Asserter::DUMMY = \
-      google_sky::Asserter::GetInstance((expression), __FILE__, __LINE__)
+  google_sky::Asserter((expression), __FILE__, __LINE__)
 
 #define CHECK_EQ(a, b) CHECK((a) == (b))
 #define CHECK_NE(a, b) CHECK((a) != (b))
@@ -101,11 +100,25 @@ typedef unsigned long long uint64;
 #define ASSERT_IS_NUMBER(a) CHECK(!isnan(a) && !isinf(a)) \
     << "Input is a bad floating point number: " << a
 
+// Pi to double precision.  The libwcs headers define PI as a macro with the
+// same value, which takes the place of this where they come first.
+#ifndef PI
+const double PI = 3.1415926535897931;
+#endif
+
 // These are faster then pow().
 
 inline double Square(double x) { return x * x; }
 inline double Cube(double x) { return x * x * x; }
 
+// Rounds a double to the nearest int, with halves rounded up.
+inline int Round(double x) { return static_cast<int>(floor(x + 0.5)); }
+
+// Clamps value to lie within [low, high].
+inline int Clamp(int value, int low, int high) {
+  return value < low ? low : (value > high ? high : value);
+}
+
 // Floating point equality comparison function.  This is the preferred way to
 // check for equality among floating point numbers.
 //
@@ -126,39 +139,28 @@ inline bool FloatEqual(double a, double b, double max_relative_error,
 // user to print arbitrary messages in the event of an assertion failure.
 //
 // This class isn't designed to be used directly.  Instead, use the CHECK()
-// macro above.
+// macro above.  Each CHECK() creates its own temporary Asserter, so checks
+// may fail on several threads at once without mixing up their messages.
+// The temporary lives until the end of the full expression, so its
+// destructor runs after all of the << calls and is where a failed check dies.
 class Asserter {
  public:
-  ~Asserter() {}
-
-  // To avoid an instantiation for every CHECK(), this class is implemented as
-  // a singleton.  This method returns the only instance and sets the relevant
-  // metadata in a single statement.
-  inline static Asserter &GetInstance(bool expression, const char *file_name,
-                                      int line_number) {
-    static Asserter instance;
-    instance.expression_ = expression;
-    instance.file_name_ = file_name;
-    instance.line_number_ = line_number;
-    return instance;
-  }
+  inline Asserter(bool expression, const char *file_name, int line_number)
+      : expression_(expression), file_name_(file_name),
+        line_number_(line_number), stream_(NULL) {}
 
-  // This method is a weird hack to essentially overload return types.  This
-  // was done so that this class knows when it has finally received all of the
-  // input from multiple calls from the << operator.  This method is then
-  // called to evaluate the expression and either do nothing or die with the
+  // Evaluates the expression and either does nothing or dies with the
   // appropriate error message.
-  inline operator int() {
-    if (expression_) return 0;
+  inline ~Asserter() {
+    if (expression_) return;
     cout.flush();
     cerr.flush();
     cerr << "\n\n *** Check failed at " << file_name_ << " line "
          << line_number_ << " ***\n\n";
-    cerr << stream_.str();
+    if (stream_ != NULL) cerr << stream_->str();
     cerr << "\n\n";
     cerr.flush();
     exit(EXIT_FAILURE);
-    return 0;
   }
 
   // Generic implementation of the << operator.  Builds up the user's error
@@ -166,37 +168,39 @@ class Asserter {
   template <typename Type>
   inline Asserter& operator<<(Type value) {
     if (expression_) return *this;
-    stream_ << value;
+    stream() << value;
     return *this;
   }
 
   // Overloaded for float input to show more digits.
   inline Asserter& operator<<(float value) {
     if (expression_) return *this;
-    stream_ << setprecision(7) << value;
+    stream() << setprecision(7) << value;
     return *this;
   }
 
   // Overloaded for double input to show more digits.
   inline Asserter& operator<<(double value) {
     if (expression_) return *this;
-    stream_ << setprecision(15) << value;
+    stream() << setprecision(15) << value;
     return *this;
   }
 
-  // This value is only used to trigger operator int() above.  Yes, this is a
-  // fairly weird/ugly hack, but don't you love CHECK()?
-  static int DUMMY;
-
  private:
-  Asserter()
-      : line_number_(DUMMY),  // Avoid compiler warnings when CHECK isn't used.
-        stream_(stringstream::in | stringstream::out) {}
+  // The message stream is only created once a check has failed, which keeps
+  // passing checks as cheap as the old singleton.  It is never freed because
+  // a failed check always exits.
+  inline stringstream &stream() {
+    if (stream_ == NULL) {
+      stream_ = new stringstream(stringstream::in | stringstream::out);
+    }
+    return *stream_;
+  }
 
   bool expression_;
   const char *file_name_;
   int line_number_;
-  stringstream stream_;
+  stringstream *stream_;
 
   DISALLOW_COPY_AND_ASSIGN(Asserter);
 };
@@ -0,0 +1,322 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "batch.h"
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <cstdio>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <png.h>
+
+#include "fits.h"
+#include "string_util.h"
+
+namespace google_sky {
+
+namespace {
+
+// Runs one batch job, returning its memory to the budget when done.
+class BatchJobTask : public Task {
+ public:
+  BatchJobTask(const BatchJob &job, WcsProjection *wcs, int width,
+               int height, JobRunner *runner, MemoryBudget *budget,
+               int64 bytes, JobObserver *observer)
+      : job_(job), wcs_(wcs), width_(width), height_(height),
+        runner_(runner), budget_(budget), bytes_(bytes),
+        observer_(observer) {}
+
+  virtual ~BatchJobTask() {
+    delete wcs_;
+  }
+
+  virtual void Run() {
+    observer_->JobStarted(job_);
+    string error;
+    if (!runner_->Run(job_, *wcs_, width_, height_, &error) &&
+        error.empty()) {
+      error = "Unknown error";
+    }
+    budget_->Release(bytes_);
+    observer_->JobFinished(job_, error);
+  }
+
+ private:
+  BatchJob job_;
+  WcsProjection *wcs_;
+  int width_;
+  int height_;
+  JobRunner *runner_;
+  MemoryBudget *budget_;
+  int64 bytes_;
+  JobObserver *observer_;
+
+  DISALLOW_COPY_AND_ASSIGN(BatchJobTask);
+};
+
+}  // namespace
+
+string *FindJobField(const string &key, BatchJob *job) {
+  if (key == "fitsfile") return &job->fitsfile;
+  if (key == "imagefile") return &job->imagefile;
+  if (key == "maskfile") return &job->maskfile;
+  if (key == "outfile") return &job->outfile;
+  if (key == "kmlfile") return &job->kmlfile;
+  if (key == "name") return &job->name;
+  return NULL;
+}
+
+void SetJobDefaults(BatchJob *job) {
+  string prefix, extension;
+  StringSplitExtension(job->fitsfile, &prefix, &extension);
+  if (job->outfile.empty()) job->outfile = prefix + "_warped.png";
+  if (job->kmlfile.empty()) job->kmlfile = prefix + ".kml";
+  if (job->name.empty()) job->name = prefix;
+}
+
+string JobTileDirectory(const BatchJob &job) {
+  string prefix, extension;
+  StringSplitExtension(job.outfile, &prefix, &extension);
+  return prefix + "_tiles";
+}
+
+// A bad line stops being parsed at its first bad entry.
+bool ReadManifest(const string &filename, vector<BatchJob> *jobs,
+                  string *error) {
+  FILE *fp = fopen(filename.c_str(), "r");
+  if (!fp) {
+    *error = StringPrintf("Can't open manifest '%s'", filename.c_str());
+    return false;
+  }
+
+  char buffer[4096];
+  int line = 0;
+  while (fgets(buffer, sizeof(buffer), fp)) {
+    ++line;
+    string text(buffer);
+    size_t comment = text.find('#');
+    if (comment != string::npos) text.erase(comment);
+    vector<string> words;
+    StringSplitOnWhiteSpace(text, &words);
+    if (words.empty()) continue;
+
+    BatchJob job;
+    job.line = line;
+    for (size_t i = 0; job.error.empty() && i < words.size(); ++i) {
+      size_t equals = words[i].find('=');
+      string key = words[i].substr(0, equals);
+      string value = (equals == string::npos) ? "" :
+                     words[i].substr(equals + 1);
+      string *field = FindJobField(key, &job);
+      if (field == NULL || value.empty()) {
+        job.error = StringPrintf("Bad entry '%s' on line %d of '%s'",
+                                 words[i].c_str(), line, filename.c_str());
+      } else {
+        field->assign(value);
+      }
+    }
+    if (job.error.empty() && job.fitsfile.empty()) {
+      job.error = StringPrintf("No fitsfile on line %d of '%s'", line,
+                               filename.c_str());
+    }
+
+    SetJobDefaults(&job);
+    jobs->push_back(job);
+  }
+  bool success = !ferror(fp);
+  if (!success) {
+    *error = StringPrintf("Couldn't read manifest '%s'", filename.c_str());
+  }
+  fclose(fp);
+  return success;
+}
+
+bool ReadPngSize(const string &filename, int *width, int *height) {
+  FILE *fp = fopen(filename.c_str(), "rb");
+  if (!fp) return false;
+  uint8 header[24];
+  bool success = fread(header, 1, sizeof(header), fp) == sizeof(header) &&
+                 png_sig_cmp(header, 0, 8) == 0;
+  fclose(fp);
+  if (!success) return false;
+  *width = (header[16] << 24) | (header[17] << 16) | (header[18] << 8) |
+           header[19];
+  *height = (header[20] << 24) | (header[21] << 16) | (header[22] << 8) |
+            header[23];
+  return *width > 0 && *height > 0;
+}
+
+// Fits dies on files it can't parse, so the file is checked first.
+bool ReadJobHeader(const BatchJob &job, string *header, int *width,
+                   int *height, string *error) {
+  if (!job.error.empty()) {
+    *error = job.error;
+    return false;
+  }
+  if (!Fits::CheckImageHeader(job.fitsfile, error)) return false;
+  Fits::ReadImageHeader(job.fitsfile, header);
+  string problem;
+  if (!WcsProjection::HeaderHasWcs(*header, &problem)) {
+    *error = "No usable WCS in " + job.fitsfile + ": " + problem;
+    return false;
+  }
+
+  // AddImageDimensions() dies on headers without NAXIS or with only one of
+  // NAXIS1 and NAXIS2.
+  bool has_naxis1 = Fits::HeaderHasKeyword(*header, "NAXIS1");
+  if (!Fits::HeaderHasKeyword(*header, "NAXIS") ||
+      has_naxis1 != Fits::HeaderHasKeyword(*header, "NAXIS2")) {
+    *error = "Bad NAXIS keywords in " + job.fitsfile;
+    return false;
+  }
+  *width = Fits::HeaderReadKeywordInt(*header, "NAXIS1", 0);
+  *height = Fits::HeaderReadKeywordInt(*header, "NAXIS2", 0);
+  if (!job.imagefile.empty()) {
+    int image_width, image_height;
+    if (!ReadPngSize(job.imagefile, &image_width, &image_height)) {
+      *error = "Can't read PNG file " + job.imagefile;
+      return false;
+    }
+    if (*width == 0 && *height == 0) {
+      *width = image_width;
+      *height = image_height;
+    }
+    if (image_width != *width || image_height != *height) {
+      *error = StringPrintf("FITS and PNG image sizes disagree "
+                            "(FITS = %d x %d, PNG = %d x %d)", *width,
+                            *height, image_width, image_height);
+      return false;
+    }
+  }
+  if (*width <= 0 || *height <= 0) {
+    *error = "No image size in " + job.fitsfile;
+    return false;
+  }
+
+  Fits::AddImageDimensions(*width, *height, header);
+  return true;
+}
+
+const size_t HeaderCache::MAX_ENTRIES;
+
+bool HeaderCache::Lookup(const BatchJob &job, string *header, int *width,
+                         int *height) {
+  map<string, Entry>::iterator it = entries_.find(Key(job));
+  if (it == entries_.end()) return false;
+  if (it->second.stamp != Stamp(job)) {
+    Erase(it);
+    return false;
+  }
+  order_.splice(order_.end(), order_, it->second.position);
+  *header = it->second.header;
+  *width = it->second.width;
+  *height = it->second.height;
+  return true;
+}
+
+void HeaderCache::Insert(const BatchJob &job, const string &header,
+                         int width, int height) {
+  string key = Key(job);
+  map<string, Entry>::iterator it = entries_.find(key);
+  if (it != entries_.end()) Erase(it);
+  if (entries_.size() >= MAX_ENTRIES) {
+    Erase(entries_.find(order_.front()));
+  }
+  Entry &entry = entries_[key];
+  entry.stamp = Stamp(job);
+  entry.header = header;
+  entry.width = width;
+  entry.height = height;
+  entry.position = order_.insert(order_.end(), key);
+}
+
+string HeaderCache::Key(const BatchJob &job) {
+  return job.fitsfile + "\n" + job.imagefile;
+}
+
+string HeaderCache::Stamp(const BatchJob &job) {
+  string stamp;
+  const string *files[] = { &job.fitsfile, &job.imagefile };
+  for (int i = 0; i < 2; ++i) {
+    struct stat info;
+    if (files[i]->empty() || stat(files[i]->c_str(), &info) != 0) {
+      stamp += "-;";
+    } else {
+      StringAppendF(&stamp, "%ld.%ld;", static_cast<long>(info.st_size),
+                    static_cast<long>(info.st_mtime));
+    }
+  }
+  return stamp;
+}
+
+void HeaderCache::Erase(map<string, Entry>::iterator it) {
+  order_.erase(it->second.position);
+  entries_.erase(it);
+}
+
+BatchScheduler::BatchScheduler(JobRunner *runner, int num_threads,
+                               int64 memory_limit, HeaderCache *cache)
+    : runner_(runner), cache_(cache), budget_(memory_limit),
+      pool_(num_threads) {
+  CHECK(runner != NULL);
+}
+
+BatchScheduler::~BatchScheduler() {
+  // Nothing needed.
+}
+
+void BatchScheduler::Add(const BatchJob &job, JobObserver *observer) {
+  string header;
+  int width, height;
+  string error;
+  if (cache_ == NULL || !job.error.empty() ||
+      !cache_->Lookup(job, &header, &width, &height)) {
+    if (!ReadJobHeader(job, &header, &width, &height, &error)) {
+      observer->JobFinished(job, error);
+      return;
+    }
+    if (cache_ != NULL) cache_->Insert(job, header, width, height);
+  }
+  WcsProjection *wcs = WcsProjection::FromHeader(header);
+  observer->JobQueued(job);
+  int64 bytes = runner_->EstimateMemory(job, width, height);
+  budget_.Acquire(bytes);
+  pool_.Add(new BatchJobTask(job, wcs, width, height, runner_, &budget_,
+                             bytes, observer));
+}
+
+void BatchScheduler::Wait() {
+  pool_.Wait();
+}
+
+}  // namespace google_sky
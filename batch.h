@@ -0,0 +1,238 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// Defines the pieces of wcs2kml's --batch and --daemon modes that don't
+// depend on its flags: reading manifests, checking jobs, and scheduling
+// them on a thread pool within a memory budget
+
+#ifndef BATCH_H__
+#define BATCH_H__
+
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "base.h"
+#include "threadpool.h"
+#include "wcsprojection.h"
+
+namespace google_sky {
+
+// One job of a --batch manifest or a --daemon request.
+struct BatchJob {
+  BatchJob() : line(0), id("null") {}
+
+  int line;  // Line number in the manifest, for reporting.
+  string id;  // JSON text of the request id, echoed in --daemon responses.
+  string error;  // Why the manifest line is bad, or empty if it's usable.
+  string fitsfile;
+  string imagefile;
+  string maskfile;
+  string outfile;
+  string kmlfile;
+  string name;
+};
+
+// Returns a pointer to the field of job named key, or NULL if there is no
+// such field.
+string *FindJobField(const string &key, BatchJob *job);
+
+// Names the outputs of a job after its FITS file unless they were given.
+void SetJobDefaults(BatchJob *job);
+
+// Returns the directory that a job writes its tiles to when regionating,
+// which is named after its outfile.
+string JobTileDirectory(const BatchJob &job);
+
+// Reads a manifest of jobs.  Each line holds key=value pairs separated by
+// white space, where the keys are fitsfile (required), imagefile,
+// maskfile, outfile, kmlfile, and name.  Everything after a # is ignored.
+// A bad line still adds a job, with the problem in its error field, so
+// that it fails on its own.  Returns false with a description of the
+// problem in error only if the manifest can't be read.
+bool ReadManifest(const string &filename, vector<BatchJob> *jobs,
+                  string *error);
+
+// Reads the dimensions from the IHDR chunk at the start of a PNG file.
+// Returns false if the file isn't a PNG file.
+bool ReadPngSize(const string &filename, int *width, int *height);
+
+// Checks that the FITS file of a job has a usable WCS and finds the size of
+// its image.  On success header holds the FITS header with the image
+// dimensions added.  Returns false with a description of the problem in
+// error otherwise, including for files that aren't FITS files or are
+// truncated.
+bool ReadJobHeader(const BatchJob &job, string *header, int *width,
+                   int *height, string *error);
+
+// Class for keeping the checked headers of recent jobs
+//
+// A --daemon given the same files again doesn't have to reread them.
+// Entries are keyed by the input files and dropped when either file's size
+// or modification time changes, or when they are the least recently used
+// of more than MAX_ENTRIES.  The methods aren't thread safe.
+class HeaderCache {
+ public:
+  static const size_t MAX_ENTRIES = 256;
+
+  HeaderCache() : entries_(), order_() {
+    // Nothing needed.
+  }
+
+  ~HeaderCache() {
+    // Nothing needed.
+  }
+
+  // Looks up the header of a job.  Returns false if it isn't cached or is
+  // out of date.
+  bool Lookup(const BatchJob &job, string *header, int *width, int *height);
+
+  // Adds the header of a job, evicting the least recently used entry if
+  // the cache is full.
+  void Insert(const BatchJob &job, const string &header, int width,
+              int height);
+
+  // Returns the number of cached headers.
+  inline size_t size(void) const {
+    return entries_.size();
+  }
+
+ private:
+  struct Entry {
+    string stamp;
+    string header;
+    int width;
+    int height;
+    list<string>::iterator position;  // Position in order_.
+  };
+
+  // Entries keyed by input files.
+  map<string, Entry> entries_;
+
+  // Keys from least to most recently used.
+  list<string> order_;
+
+  static string Key(const BatchJob &job);
+
+  // Returns the sizes and modification times of the input files.
+  static string Stamp(const BatchJob &job);
+
+  void Erase(map<string, Entry>::iterator it);
+
+  DISALLOW_COPY_AND_ASSIGN(HeaderCache);
+};
+
+// Interface for reporting the progress of batch jobs.  Apart from
+// JobQueued(), the methods are called from the thread running the job.
+class JobObserver {
+ public:
+  virtual ~JobObserver() {
+    // Nothing needed.
+  }
+
+  // Called when a job has been checked and is waiting for memory.
+  virtual void JobQueued(const BatchJob &job) = 0;
+
+  // Called when a job starts running.
+  virtual void JobStarted(const BatchJob &job) = 0;
+
+  // Called when a job is done.  error is empty if the job succeeded.
+  virtual void JobFinished(const BatchJob &job, const string &error) = 0;
+};
+
+// Interface for the work of batch jobs
+class JobRunner {
+ public:
+  virtual ~JobRunner() {
+    // Nothing needed.
+  }
+
+  // Returns the most memory in bytes that running a job whose image is
+  // width x height holds at once.
+  virtual int64 EstimateMemory(const BatchJob &job, int width,
+                               int height) const = 0;
+
+  // Runs a job, given the WCS and size of its image.  Returns false with a
+  // description of the problem in error on failure.  Called from the
+  // pool's threads.
+  virtual bool Run(const BatchJob &job, const WcsProjection &wcs, int width,
+                   int height, string *error) = 0;
+};
+
+// Class for running batch jobs on a thread pool
+//
+// Add() checks each job's FITS header in the calling thread, so that bad
+// jobs fail without waiting for memory, and then hands the job to the pool
+// as soon as its estimated memory fits within the budget.  This overlaps
+// reading one image with warping others without running out of memory.
+// Jobs that fail, including those whose output can't be written, are
+// reported to their observer rather than stopping the others.
+//
+// Example Usage:
+//
+// BatchScheduler scheduler(&runner, ThreadPool::DefaultNumThreads(),
+//                          MemoryBudget::DefaultLimit(), NULL);
+// for (size_t i = 0; i < jobs.size(); ++i) {
+//   scheduler.Add(jobs[i], &observer);
+// }
+// scheduler.Wait();
+
+class BatchScheduler {
+ public:
+  // Creates a scheduler running the jobs with runner on num_threads
+  // threads within memory_limit bytes.  Headers are kept in cache unless it
+  // is NULL.  runner and cache must outlive the scheduler.
+  BatchScheduler(JobRunner *runner, int num_threads, int64 memory_limit,
+                 HeaderCache *cache);
+
+  ~BatchScheduler();
+
+  // Checks a job and queues it, blocking until its memory fits within the
+  // budget.  Bad jobs are passed straight to observer->JobFinished().
+  // observer must outlive the job.
+  void Add(const BatchJob &job, JobObserver *observer);
+
+  // Blocks until every queued job is done.
+  void Wait();
+
+ private:
+  JobRunner *runner_;
+  HeaderCache *cache_;
+  MemoryBudget budget_;
+  ThreadPool pool_;
+
+  // A BatchScheduler must be given a runner.
+  BatchScheduler();
+
+  DISALLOW_COPY_AND_ASSIGN(BatchScheduler);
+};
+
+}  // namespace google_sky
+
+#endif  // BATCH_H__
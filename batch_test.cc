@@ -0,0 +1,372 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include <cstdio>
+
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "base.h"
+#include "batch.h"
+#include "image.h"
+#include "string_util.h"
+#include "test_util.h"
+
+namespace google_sky {
+
+// Writes a FITS file holding just the header of a width x height image
+// with a WCS, or without one if has_wcs is false.
+void WriteFitsHeader(const string &filename, int width, int height,
+                     bool has_wcs) {
+  string header = StringPrintf("%-80s", "SIMPLE  =                    T");
+  header += StringPrintf("%-80s", "BITPIX  =                    8");
+  if (has_wcs) {
+    header += MakeHeader(150.0, 30.0, width, height, 0.001);
+  } else {
+    header += StringPrintf("NAXIS   = %20d%50s", 2, "");
+    header += StringPrintf("NAXIS1  = %20d%50s", width, "");
+    header += StringPrintf("NAXIS2  = %20d%50s", height, "");
+    header += StringPrintf("%-80s", "END");
+  }
+  header.resize(2880, ' ');
+  WriteFile(filename, header);
+}
+
+// Returns a job reading fitsfile.
+BatchJob MakeJob(int line, const string &fitsfile) {
+  BatchJob job;
+  job.line = line;
+  job.fitsfile = fitsfile;
+  SetJobDefaults(&job);
+  return job;
+}
+
+// Pretends to run jobs, recording how many run at once.  Jobs named "fail"
+// fail without saying why.
+class RecordingRunner : public JobRunner {
+ public:
+  RecordingRunner() : num_runs_(0), num_running_(0), max_running_(0) {
+    pthread_mutex_init(&mutex_, NULL);
+  }
+
+  virtual ~RecordingRunner() {
+    pthread_mutex_destroy(&mutex_);
+  }
+
+  virtual int64 EstimateMemory(const BatchJob &job, int width,
+                               int height) const {
+    return width * height;
+  }
+
+  virtual bool Run(const BatchJob &job, const WcsProjection &wcs, int width,
+                   int height, string *error) {
+    pthread_mutex_lock(&mutex_);
+    ++num_runs_;
+    ++num_running_;
+    max_running_ = max(max_running_, num_running_);
+    pthread_mutex_unlock(&mutex_);
+    usleep(10000);
+    pthread_mutex_lock(&mutex_);
+    --num_running_;
+    pthread_mutex_unlock(&mutex_);
+    return job.name != "fail";
+  }
+
+  int num_runs(void) const {
+    return num_runs_;
+  }
+
+  int max_running(void) const {
+    return max_running_;
+  }
+
+ private:
+  int num_runs_;
+  int num_running_;
+  int max_running_;
+  pthread_mutex_t mutex_;
+
+  DISALLOW_COPY_AND_ASSIGN(RecordingRunner);
+};
+
+// Records the progress reported for jobs.
+class RecordingObserver : public JobObserver {
+ public:
+  RecordingObserver() : num_queued_(0), num_started_(0), errors_() {
+    pthread_mutex_init(&mutex_, NULL);
+  }
+
+  virtual ~RecordingObserver() {
+    pthread_mutex_destroy(&mutex_);
+  }
+
+  virtual void JobQueued(const BatchJob &job) {
+    pthread_mutex_lock(&mutex_);
+    ++num_queued_;
+    pthread_mutex_unlock(&mutex_);
+  }
+
+  virtual void JobStarted(const BatchJob &job) {
+    pthread_mutex_lock(&mutex_);
+    ++num_started_;
+    pthread_mutex_unlock(&mutex_);
+  }
+
+  virtual void JobFinished(const BatchJob &job, const string &error) {
+    pthread_mutex_lock(&mutex_);
+    errors_[job.line] = error;
+    pthread_mutex_unlock(&mutex_);
+  }
+
+  int num_queued(void) const {
+    return num_queued_;
+  }
+
+  int num_started(void) const {
+    return num_started_;
+  }
+
+  // Returns the errors of the finished jobs keyed by line.
+  const map<int, string> &errors(void) const {
+    return errors_;
+  }
+
+ private:
+  int num_queued_;
+  int num_started_;
+  map<int, string> errors_;
+  pthread_mutex_t mutex_;
+
+  DISALLOW_COPY_AND_ASSIGN(RecordingObserver);
+};
+
+int Main(int argc, char **argv) {
+  {
+    cout << "Testing ReadManifest()... ";
+    const char *manifest = "batch_test_manifest.txt";
+    WriteFile(manifest,
+              "# A comment\n"
+              "fitsfile=a.fits outfile=a.png\n"
+              "\n"
+              "fitsfile=b.fits colour=red\n"
+              "outfile=c.png\n"
+              "fitsfile=\n"
+              "fitsfile=d.fits name=D  # Another comment\n");
+    vector<BatchJob> jobs;
+    string error;
+    ASSERT_TRUE(ReadManifest(manifest, &jobs, &error));
+    ASSERT_EQ(5, static_cast<int>(jobs.size()));
+
+    ASSERT_EQ(2, jobs[0].line);
+    ASSERT_TRUE(jobs[0].error.empty());
+    ASSERT_EQ("a.fits", jobs[0].fitsfile);
+    ASSERT_EQ("a.png", jobs[0].outfile);
+    ASSERT_EQ("a.kml", jobs[0].kmlfile);
+    ASSERT_EQ("a", jobs[0].name);
+    ASSERT_EQ("a_tiles", JobTileDirectory(jobs[0]));
+
+    // Bad lines become jobs that fail on their own.
+    ASSERT_EQ(4, jobs[1].line);
+    ASSERT_EQ(string("Bad entry 'colour=red' on line 4 of '") + manifest +
+              "'", jobs[1].error);
+    ASSERT_EQ(5, jobs[2].line);
+    ASSERT_EQ(string("No fitsfile on line 5 of '") + manifest + "'",
+              jobs[2].error);
+    ASSERT_EQ(6, jobs[3].line);
+    ASSERT_FALSE(jobs[3].error.empty());
+
+    ASSERT_EQ(7, jobs[4].line);
+    ASSERT_TRUE(jobs[4].error.empty());
+    ASSERT_EQ("d_warped.png", jobs[4].outfile);
+    ASSERT_EQ("D", jobs[4].name);
+
+    remove(manifest);
+    ASSERT_FALSE(ReadManifest(manifest, &jobs, &error));
+    ASSERT_FALSE(error.empty());
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing ReadJobHeader()... ";
+    const char *fitsfile = "batch_test.fits";
+    WriteFitsHeader(fitsfile, 40, 30, true);
+    BatchJob job = MakeJob(1, fitsfile);
+    string header;
+    int width = 0;
+    int height = 0;
+    string error;
+    ASSERT_TRUE(ReadJobHeader(job, &header, &width, &height, &error));
+    ASSERT_EQ(40, width);
+    ASSERT_EQ(30, height);
+
+    // The PNG file has to be the same size.
+    const char *imagefile = "batch_test.png";
+    Image image;
+    ASSERT_TRUE(image.Resize(20, 10, Image::RGBA));
+    ASSERT_TRUE(image.Write(imagefile));
+    ASSERT_TRUE(ReadPngSize(imagefile, &width, &height));
+    ASSERT_EQ(20, width);
+    ASSERT_EQ(10, height);
+    job.imagefile = imagefile;
+    ASSERT_FALSE(ReadJobHeader(job, &header, &width, &height, &error));
+    ASSERT_TRUE(StringStartsWith(error, "FITS and PNG image sizes disagree"));
+    ASSERT_FALSE(ReadPngSize(fitsfile, &width, &height));
+    remove(imagefile);
+
+    // Files that aren't complete FITS files fail instead of dying.
+    const char *badfile = "batch_test_bad.fits";
+    WriteFile(badfile, ReadFile(fitsfile).substr(0, 9));
+    ASSERT_FALSE(ReadJobHeader(MakeJob(1, badfile), &header, &width, &height,
+                               &error));
+    ASSERT_FALSE(error.empty());
+    WriteFile(badfile, ReadFile(fitsfile).substr(0, 800));
+    ASSERT_FALSE(ReadJobHeader(MakeJob(1, badfile), &header, &width, &height,
+                               &error));
+    ASSERT_EQ(string("Found EOF before END card in ") + badfile, error);
+    WriteFile(badfile, "Not a FITS file\n");
+    ASSERT_FALSE(ReadJobHeader(MakeJob(1, badfile), &header, &width, &height,
+                               &error));
+    ASSERT_FALSE(ReadJobHeader(MakeJob(1, "batch_test_missing.fits"),
+                               &header, &width, &height, &error));
+    ASSERT_EQ("Can't open FITS file batch_test_missing.fits", error);
+
+    WriteFitsHeader(badfile, 40, 30, false);
+    ASSERT_FALSE(ReadJobHeader(MakeJob(1, badfile), &header, &width, &height,
+                               &error));
+    ASSERT_TRUE(StringStartsWith(error, "No usable WCS in"));
+    remove(badfile);
+
+    // Bad manifest lines report their own error.
+    job = MakeJob(1, fitsfile);
+    job.error = "Bad line";
+    ASSERT_FALSE(ReadJobHeader(job, &header, &width, &height, &error));
+    ASSERT_EQ("Bad line", error);
+    remove(fitsfile);
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing HeaderCache... ";
+    const char *fitsfile = "batch_test.fits";
+    WriteFitsHeader(fitsfile, 40, 30, true);
+    BatchJob job = MakeJob(1, fitsfile);
+    HeaderCache cache;
+    string header;
+    int width, height;
+    ASSERT_FALSE(cache.Lookup(job, &header, &width, &height));
+    cache.Insert(job, "header", 40, 30);
+    ASSERT_TRUE(cache.Lookup(job, &header, &width, &height));
+    ASSERT_EQ("header", header);
+    ASSERT_EQ(40, width);
+    ASSERT_EQ(30, height);
+
+    // Changing the file drops its entry.
+    WriteFile(fitsfile, ReadFile(fitsfile) + string(2880, ' '));
+    ASSERT_FALSE(cache.Lookup(job, &header, &width, &height));
+    ASSERT_EQ(0, static_cast<int>(cache.size()));
+    remove(fitsfile);
+
+    // The least recently used entry is evicted when the cache is full.
+    int max_entries = static_cast<int>(HeaderCache::MAX_ENTRIES);
+    for (int i = 0; i < max_entries; ++i) {
+      cache.Insert(MakeJob(1, StringPrintf("batch_test_%d.fits", i)), "", 1,
+                   1);
+    }
+    ASSERT_TRUE(cache.Lookup(MakeJob(1, "batch_test_0.fits"), &header,
+                             &width, &height));
+    cache.Insert(MakeJob(1, "batch_test_new.fits"), "", 1, 1);
+    ASSERT_EQ(max_entries, static_cast<int>(cache.size()));
+    ASSERT_TRUE(cache.Lookup(MakeJob(1, "batch_test_0.fits"), &header,
+                             &width, &height));
+    ASSERT_FALSE(cache.Lookup(MakeJob(1, "batch_test_1.fits"), &header,
+                              &width, &height));
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing BatchScheduler... ";
+    const char *fitsfile = "batch_test.fits";
+    const char *badfile = "batch_test_bad.fits";
+    WriteFitsHeader(fitsfile, 10, 10, true);
+    WriteFile(badfile, ReadFile(fitsfile).substr(0, 800));
+
+    vector<BatchJob> jobs;
+    for (int i = 0; i < 4; ++i) {
+      jobs.push_back(MakeJob(i + 1, fitsfile));
+    }
+    jobs.push_back(MakeJob(5, badfile));
+    jobs.push_back(MakeJob(6, fitsfile));
+    jobs.back().error = "Bad line";
+    jobs.push_back(MakeJob(7, fitsfile));
+    jobs.back().name = "fail";
+
+    // Each job needs 100 bytes, so only one fits in the budget at a time.
+    RecordingRunner runner;
+    RecordingObserver observer;
+    HeaderCache cache;
+    {
+      BatchScheduler scheduler(&runner, 4, 150, &cache);
+      for (size_t i = 0; i < jobs.size(); ++i) {
+        scheduler.Add(jobs[i], &observer);
+      }
+      scheduler.Wait();
+    }
+    ASSERT_EQ(5, runner.num_runs());
+    ASSERT_EQ(1, runner.max_running());
+    ASSERT_EQ(5, observer.num_queued());
+    ASSERT_EQ(5, observer.num_started());
+    ASSERT_EQ(1, static_cast<int>(cache.size()));
+
+    const map<int, string> &errors = observer.errors();
+    ASSERT_EQ(7, static_cast<int>(errors.size()));
+    for (int line = 1; line <= 4; ++line) {
+      ASSERT_TRUE(errors.find(line)->second.empty());
+    }
+    ASSERT_EQ(string("Found EOF before END card in ") + badfile,
+              errors.find(5)->second);
+    ASSERT_EQ("Bad line", errors.find(6)->second);
+    ASSERT_EQ("Unknown error", errors.find(7)->second);
+    remove(fitsfile);
+    remove(badfile);
+    cout << "pass\n";
+  }
+
+  cout << "Passed\n";
+  return 0;
+}
+
+}  // namespace google_sky
+
+int main(int argc, char **argv) {
+  return google_sky::Main(argc, argv);
+}
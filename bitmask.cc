@@ -0,0 +1,218 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+#include "bitmask.h"
+
+#include <png.h>
+
+#include <cstdio>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "color.h"
+#include "image.h"
+
+namespace google_sky {
+
+namespace {
+
+// Threshold for keeping a pixel of a grayscale mask.
+static const int KEEP_THRESHOLD = 128;
+
+// Fills a BitMask with the rows of a PNG file.
+class BitMaskRowSink : public GrayscaleRowSink {
+ public:
+  explicit BitMaskRowSink(BitMask *mask) : mask_(mask) {
+    // Nothing needed.
+  }
+
+  virtual ~BitMaskRowSink() {
+    // Nothing needed.
+  }
+
+  virtual bool Start(int width, int height, bool is_binary) {
+    mask_->Resize(width, height);
+    return true;
+  }
+
+  virtual void SetRow(int j, const uint8 *gray) {
+    mask_->SetRowFromBytes(j, gray);
+  }
+
+ private:
+  BitMask *mask_;
+
+  DISALLOW_COPY_AND_ASSIGN(BitMaskRowSink);
+};
+
+}  // namespace
+
+void BitMask::Resize(int width, int height) {
+  CHECK_GTE(width, 0);
+  CHECK_GTE(height, 0);
+  width_ = width;
+  height_ = height;
+  words_per_row_ = (width + 63) / 64;
+  words_.assign(static_cast<size_t>(words_per_row_) * height, 0);
+  SetAll(true);
+}
+
+// Only the bits for pixels inside the row are set so that rows can be
+// compared and counted a word at a time.
+void BitMask::SetAll(bool value) {
+  if (words_per_row_ == 0) return;
+  uint64 last_word = 0;
+  if (value) {
+    int num_bits = width_ - (words_per_row_ - 1) * 64;
+    last_word = (num_bits == 64) ? ~static_cast<uint64>(0) :
+                (static_cast<uint64>(1) << num_bits) - 1;
+  }
+  for (int j = 0; j < height_; ++j) {
+    uint64 *row = GetMutableRow(j);
+    for (int w = 0; w < words_per_row_ - 1; ++w) {
+      row[w] = value ? ~static_cast<uint64>(0) : 0;
+    }
+    row[words_per_row_ - 1] = last_word;
+  }
+}
+
+long BitMask::CountSet() const {
+  long count = 0;
+  for (size_t w = 0; w < words_.size(); ++w) {
+    uint64 word = words_[w];
+    while (word) {
+      word &= word - 1;
+      ++count;
+    }
+  }
+  return count;
+}
+
+void BitMask::SetRowFromBytes(int j, const uint8 *values) {
+  uint64 *row = GetMutableRow(j);
+  for (int w = 0; w < words_per_row_; ++w) {
+    int first = w * 64;
+    int last = min(width_, first + 64);
+    uint64 word = 0;
+    for (int i = first; i < last; ++i) {
+      word |= static_cast<uint64>(values[i] >= KEEP_THRESHOLD) << (i - first);
+    }
+    row[w] = word;
+  }
+}
+
+void BitMask::FromImage(const Image &image) {
+  Resize(image.width(), image.height());
+  vector<uint8> gray(width_);
+  for (int j = 0; j < height_; ++j) {
+    RowToGrayscale(image.GetRow(j), width_, image.channels(), &gray[0]);
+    SetRowFromBytes(j, &gray[0]);
+  }
+}
+
+void BitMask::ToImage(Image *image) const {
+  CHECK(image->Resize(width_, height_, Image::GRAYSCALE))
+      << "Couldn't allocate image";
+  for (int j = 0; j < height_; ++j) {
+    uint8 *row = image->GetMutableRow(j);
+    for (int i = 0; i < width_; ++i) {
+      row[i] = Get(i, j) ? 255 : 0;
+    }
+  }
+}
+
+bool BitMask::Equals(const BitMask &mask) const {
+  return width_ == mask.width_ && height_ == mask.height_ &&
+         words_ == mask.words_;
+}
+
+bool BitMask::Read(const string &filename) {
+  BitMaskRowSink sink(this);
+  if (!ReadGrayscaleRows(filename, &sink)) {
+    Resize(0, 0);
+    return false;
+  }
+  return true;
+}
+
+// PNG packs 1 bit pixels with the first pixel in the highest bit of each
+// byte.
+bool BitMask::Write(const string &filename) const {
+  FILE *file_ptr = NULL;
+  png_structp png_ptr = NULL;
+  png_infop info_ptr = NULL;
+
+  // Inner scoping is used to prevent compiler errors for gotos, which are
+  // used as a simple forward jump for memory cleanup.
+  {
+    file_ptr = fopen(filename.c_str(), "wb");
+    if (!file_ptr) goto failure;
+
+    png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    if (!png_ptr) goto failure;
+
+    info_ptr = png_create_info_struct(png_ptr);
+    if (!info_ptr) goto failure;
+
+    if (setjmp(png_jmpbuf(png_ptr))) goto failure;
+
+    png_init_io(png_ptr, file_ptr);
+    png_set_IHDR(png_ptr, info_ptr, width_, height_, 1, PNG_COLOR_TYPE_GRAY,
+                 PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_BASE,
+                 PNG_FILTER_TYPE_BASE);
+    png_write_info(png_ptr, info_ptr);
+
+    vector<uint8> row((width_ + 7) / 8);
+    for (int j = 0; j < height_; ++j) {
+      fill(row.begin(), row.end(), 0);
+      for (int i = 0; i < width_; ++i) {
+        if (Get(i, j)) {
+          row[i >> 3] |= 0x80 >> (i & 7);
+        }
+      }
+      png_write_row(png_ptr, &row[0]);
+    }
+    png_write_end(png_ptr, info_ptr);
+
+    fclose(file_ptr);
+    png_destroy_write_struct(&png_ptr, &info_ptr);
+  }  // end inner scoping
+
+  return true;
+
+  // Handles memory cleanup for failed PNG writes.
+  failure:
+    png_infop *info_tmp = NULL;
+    if (info_ptr) info_tmp = &info_ptr;
+    if (png_ptr) png_destroy_write_struct(&png_ptr, info_tmp);
+    if (file_ptr) fclose(file_ptr);
+    return false;
+}
+
+}  // namespace google_sky
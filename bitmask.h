@@ -0,0 +1,166 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+// Defines the BitMask class, a compact mask with 1 bit per pixel
+
+#ifndef BITMASK_H__
+#define BITMASK_H__
+
+#include <string>
+#include <vector>
+
+#include "base.h"
+#include "image.h"
+
+namespace google_sky {
+
+// Class for storing a binary mask
+//
+// A grayscale mask image uses 1 byte per pixel only to store whether each
+// pixel is kept.  A BitMask stores 1 bit per pixel, packed into 64 bit words
+// one row at a time, and reads and writes PNG files a row at a time without
+// expanding them.
+//
+// Set bits are kept (opaque) and cleared bits are masked out (transparent),
+// matching mask images where 255 is opaque and 0 is transparent.  Grayscale
+// values are thresholded at 128.
+//
+// Rather than being copied into the alpha channel of an image, a BitMask can
+// be given to SkyProjection::set_mask() so that it is applied while
+// sampling the input image.
+//
+// Example Usage:
+//
+// BitMask mask;
+// CHECK(mask.Read("foo_mask.png"));
+// if (!mask.Get(10, 20)) {
+//   // Pixel (10, 20) is masked out.
+// }
+// mask.Set(10, 20, true);
+// CHECK(mask.Write("foo_mask_fixed.png"));
+
+class BitMask {
+ public:
+  // Creates an empty mask.  Use Resize() to allocate memory.
+  BitMask() : width_(0), height_(0), words_per_row_(0), words_() {
+    // Nothing needed.
+  }
+
+  ~BitMask() {
+    // Nothing needed.
+  }
+
+  // Resizes the mask to the given dimensions with every pixel kept.
+  void Resize(int width, int height);
+
+  // Sets every pixel to value.
+  void SetAll(bool value);
+
+  // Returns whether pixel (i, j) is kept.
+  inline bool Get(int i, int j) const {
+    CheckBounds(i, j);
+    return (GetRow(j)[i >> 6] >> (i & 63)) & 1;
+  }
+
+  // Sets whether pixel (i, j) is kept.
+  inline void Set(int i, int j, bool value) {
+    CheckBounds(i, j);
+    uint64 *word = GetMutableRow(j) + (i >> 6);
+    uint64 bit = static_cast<uint64>(1) << (i & 63);
+    if (value) {
+      *word |= bit;
+    } else {
+      *word &= ~bit;
+    }
+  }
+
+  // Returns the number of pixels that are kept.
+  long CountSet() const;
+
+  // Sets the mask from a mask image.  Pixels are kept if the first channel
+  // is at least 128, or for RGB(A) images if the average of the color
+  // channels is.
+  void FromImage(const Image &image);
+
+  // Creates a grayscale image with 255 for kept pixels and 0 otherwise.
+  void ToImage(Image *image) const;
+
+  // Reads a mask from a PNG file and returns whether the read was
+  // successful.  Color images are averaged like Image::ConvertToGrayscale()
+  // and any alpha channel is ignored.
+  bool Read(const string &filename);
+
+  // Writes the mask as a 1 bit grayscale PNG file and returns whether the
+  // write was successful.
+  bool Write(const string &filename) const;
+
+  // Sets row j from one byte per pixel, keeping pixels of at least 128.
+  void SetRowFromBytes(int j, const uint8 *values);
+
+  // Returns whether two masks have the same dimensions and values.
+  bool Equals(const BitMask &mask) const;
+
+  // Returns the width of the mask.
+  inline int width() const {
+    return width_;
+  }
+
+  // Returns the height of the mask.
+  inline int height() const {
+    return height_;
+  }
+
+ private:
+  int width_;
+  int height_;
+  int words_per_row_;
+
+  // Bits for each row, starting at pixel 0 in the lowest bit of the first
+  // word.  Unused bits at the end of each row are always 0.
+  vector<uint64> words_;
+
+  // Checks for valid indexes.  Dies on invalid indexes.
+  inline void CheckBounds(int i, int j) const {
+    CHECK(i >= 0 && i < width_) << "Invalid row pixel: " << i;
+    CHECK(j >= 0 && j < height_) << "Invalid column pixel: " << j;
+  }
+
+  // Returns the words of row j.
+  inline const uint64 *GetRow(int j) const {
+    return &words_[static_cast<size_t>(j) * words_per_row_];
+  }
+
+  inline uint64 *GetMutableRow(int j) {
+    return &words_[static_cast<size_t>(j) * words_per_row_];
+  }
+
+  DISALLOW_COPY_AND_ASSIGN(BitMask);
+};
+
+}  // namespace google_sky
+
+#endif  // BITMASK_H__
@@ -0,0 +1,204 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+#include <cstdio>
+#include <cstdlib>
+
+#include <iostream>
+
+#include "base.h"
+#include "bitmask.h"
+#include "image.h"
+
+// This mask is for a downsampled SDSS frame with a black border.
+static const char *PNG_MASK_FILENAME =
+    "testdata/fpC-001478-g3-0022_small_mask.png";
+
+namespace google_sky {
+
+// Records whether ReadGrayscaleRows() found a binary file.
+class BinaryRowSink : public GrayscaleRowSink {
+ public:
+  BinaryRowSink() : is_binary_(false) {
+    // Nothing needed.
+  }
+
+  virtual ~BinaryRowSink() {
+    // Nothing needed.
+  }
+
+  virtual bool Start(int width, int height, bool is_binary) {
+    is_binary_ = is_binary;
+    return true;
+  }
+
+  virtual void SetRow(int j, const uint8 *gray) {
+    // Nothing needed.
+  }
+
+  bool is_binary() const {
+    return is_binary_;
+  }
+
+ private:
+  bool is_binary_;
+
+  DISALLOW_COPY_AND_ASSIGN(BinaryRowSink);
+};
+
+int Main(int argc, char **argv) {
+  {
+    cout << "Testing Get() and Set()... ";
+
+    // Widths on either side of the 64 pixel word size.
+    int widths[] = {1, 63, 64, 65, 130};
+    for (int w = 0; w < 5; ++w) {
+      BitMask mask;
+      mask.Resize(widths[w], 3);
+      ASSERT_EQ(widths[w], mask.width());
+      ASSERT_EQ(3, mask.height());
+      ASSERT_TRUE(mask.CountSet() == widths[w] * 3);
+
+      mask.Set(widths[w] - 1, 1, false);
+      mask.Set(0, 2, false);
+      ASSERT_FALSE(mask.Get(widths[w] - 1, 1));
+      ASSERT_FALSE(mask.Get(0, 2));
+      ASSERT_TRUE(mask.Get(0, 0));
+      ASSERT_TRUE(mask.CountSet() == widths[w] * 3 - 2);
+
+      mask.Set(0, 2, true);
+      ASSERT_TRUE(mask.Get(0, 2));
+
+      mask.SetAll(false);
+      ASSERT_TRUE(mask.CountSet() == 0);
+      mask.SetAll(true);
+      ASSERT_TRUE(mask.CountSet() == widths[w] * 3);
+    }
+
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing FromImage() and ToImage()... ";
+
+    Image image;
+    ASSERT_TRUE(image.Resize(70, 5, Image::GRAYSCALE));
+    for (int j = 0; j < 5; ++j) {
+      for (int i = 0; i < 70; ++i) {
+        image.SetValue(i, j, 0, (i * 7 + j * 13) % 256);
+      }
+    }
+
+    BitMask mask;
+    mask.FromImage(image);
+    for (int j = 0; j < 5; ++j) {
+      for (int i = 0; i < 70; ++i) {
+        ASSERT_EQ(image.GetValue(i, j, 0) >= 128, mask.Get(i, j));
+      }
+    }
+
+    Image mask_image;
+    mask.ToImage(&mask_image);
+    ASSERT_TRUE(mask_image.colorspace() == Image::GRAYSCALE);
+    for (int j = 0; j < 5; ++j) {
+      for (int i = 0; i < 70; ++i) {
+        ASSERT_EQ(mask.Get(i, j) ? 255 : 0, mask_image.GetValue(i, j, 0));
+      }
+    }
+
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing Read()... ";
+
+    // Reading directly matches reading the whole image and converting it.
+    BitMask mask;
+    ASSERT_TRUE(mask.Read(PNG_MASK_FILENAME));
+
+    Image image;
+    ASSERT_TRUE(image.Read(PNG_MASK_FILENAME));
+    ASSERT_TRUE(image.ConvertToGrayscale());
+    BitMask true_mask;
+    true_mask.FromImage(image);
+    ASSERT_TRUE(mask.Equals(true_mask));
+    ASSERT_TRUE(mask.CountSet() > 0);
+    ASSERT_TRUE(mask.CountSet() < mask.width() * mask.height());
+
+    BitMask missing_mask;
+    ASSERT_FALSE(missing_mask.Read("testdata/does_not_exist.png"));
+
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing Write()... ";
+
+    const char *tmp_png = "tmp_bitmask.png";
+    BitMask mask;
+    mask.Resize(77, 9);
+    for (int j = 0; j < 9; ++j) {
+      for (int i = 0; i < 77; ++i) {
+        mask.Set(i, j, (i * 3 + j) % 5 != 0);
+      }
+    }
+    ASSERT_TRUE(mask.Write(tmp_png));
+
+    BitMask verify_mask;
+    ASSERT_TRUE(verify_mask.Read(tmp_png));
+    ASSERT_TRUE(mask.Equals(verify_mask));
+
+    // Other readers see 0 and 255.
+    Image image;
+    ASSERT_TRUE(image.Read(tmp_png));
+    ASSERT_TRUE(image.ConvertToGrayscale());
+    Image mask_image;
+    mask.ToImage(&mask_image);
+    ASSERT_TRUE(image.Equals(mask_image));
+
+    // Masks are written as 1 bit grayscale, which readers see as binary.
+    BinaryRowSink sink;
+    ASSERT_TRUE(ReadGrayscaleRows(tmp_png, &sink));
+    ASSERT_TRUE(sink.is_binary());
+    ASSERT_TRUE(ReadGrayscaleRows(PNG_MASK_FILENAME, &sink));
+    ASSERT_FALSE(sink.is_binary());
+
+    // Clean up.
+    ASSERT_TRUE(remove(tmp_png) == 0);
+
+    cout << "pass\n";
+  }
+
+  cout << "Passed\n";
+  return 0;
+}
+
+}  // namespace google_sky
+
+int main(int argc, char **argv) {
+  return google_sky::Main(argc, argv);
+}
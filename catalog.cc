@@ -0,0 +1,452 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "catalog.h"
+
+#include <cctype>
+#include <cmath>
+#include <cstring>
+
+#include "fits.h"
+#include "fitstable.h"
+#include "string_util.h"
+
+namespace {
+
+// Column names recognized as ra and dec, in lower case.
+const char *RA_NAMES[] = { "ra", "raj2000", "ra_j2000", "ra2000", "radeg",
+                           "ra_deg", "right_ascension", "rightascension",
+                           "alpha_j2000", NULL };
+const char *DEC_NAMES[] = { "dec", "dej2000", "decj2000", "dec_j2000",
+                            "dec2000", "decdeg", "dec_deg", "declination",
+                            "delta_j2000", NULL };
+
+// Number of FITS rows read at a time.
+const int ROWS_PER_READ = 1024;
+
+string ToLower(const string &value) {
+  string lower(value);
+  for (size_t i = 0; i < lower.size(); ++i) {
+    lower[i] = tolower(lower[i]);
+  }
+  return lower;
+}
+
+// Splits value, in units of which there are 60 sub-units, into whole units,
+// whole sub-units, and sub-sub-units truncated to the given number of
+// decimals, as for IAU designations.
+void Sexagesimal(double value, int decimals, int *units, int *minutes,
+                 double *seconds) {
+  double factor = pow(10.0, decimals);
+  google_sky::int64 ticks = static_cast<google_sky::int64>(
+      floor(value * 3600.0 * factor));
+  google_sky::int64 ticks_per_minute = static_cast<google_sky::int64>(
+      60.0 * factor);
+  *units = static_cast<int>(ticks / (60 * ticks_per_minute));
+  *minutes = static_cast<int>((ticks / ticks_per_minute) % 60);
+  *seconds = (ticks % ticks_per_minute) / factor;
+}
+
+}  // namespace
+
+namespace google_sky {
+
+// CatalogReader methods.
+CatalogReader::CatalogReader()
+    : ra_index_(-1),
+      dec_index_(-1),
+      name_index_(-1) {
+  // Nothing needed.
+}
+
+bool CatalogReader::FindColumns(const vector<string> &names) {
+  column_names_ = names;
+  ra_index_ = -1;
+  dec_index_ = -1;
+  name_index_ = -1;
+  for (int i = static_cast<int>(names.size()) - 1; i >= 0; --i) {
+    string name = ToLower(names[i]);
+    if (ra_column_.empty()) {
+      for (int k = 0; RA_NAMES[k] != NULL; ++k) {
+        if (name == RA_NAMES[k]) ra_index_ = i;
+      }
+    } else if (name == ToLower(ra_column_)) {
+      ra_index_ = i;
+    }
+    if (dec_column_.empty()) {
+      for (int k = 0; DEC_NAMES[k] != NULL; ++k) {
+        if (name == DEC_NAMES[k]) dec_index_ = i;
+      }
+    } else if (name == ToLower(dec_column_)) {
+      dec_index_ = i;
+    }
+    if (!name_column_.empty() && name == ToLower(name_column_)) {
+      name_index_ = i;
+    }
+  }
+
+  if (ra_index_ < 0) {
+    error_ = ra_column_.empty() ? "Can't find an ra column" :
+             StringPrintf("No column named '%s'", ra_column_.c_str());
+    return false;
+  }
+  if (dec_index_ < 0) {
+    error_ = dec_column_.empty() ? "Can't find a dec column" :
+             StringPrintf("No column named '%s'", dec_column_.c_str());
+    return false;
+  }
+  if (!name_column_.empty() && name_index_ < 0) {
+    error_ = StringPrintf("No column named '%s'", name_column_.c_str());
+    return false;
+  }
+  return true;
+}
+
+void CatalogReader::FillRecord(double ra, double dec,
+                               const vector<string> &values,
+                               CatalogRecord *record) const {
+  record->ra = ra;
+  record->dec = dec;
+
+  int ra_hours = 0, ra_minutes = 0, dec_degrees = 0, dec_minutes = 0;
+  double ra_seconds = 0.0, dec_seconds = 0.0;
+  char sign = dec < 0.0 ? '-' : '+';
+  if (!isnan(ra) && !isnan(dec)) {
+    Sexagesimal(ra / 15.0, 2, &ra_hours, &ra_minutes, &ra_seconds);
+    Sexagesimal(fabs(dec), 1, &dec_degrees, &dec_minutes, &dec_seconds);
+  }
+
+  record->name.clear();
+  if (name_index_ >= 0) {
+    record->name = values[name_index_];
+    StringStripLeadingAndTrailingWhiteSpace(&record->name);
+  }
+  if (record->name.empty()) {
+    if (!survey_name_.empty()) record->name = survey_name_ + " ";
+    StringAppendF(&record->name, "J%02d%02d%05.2f%c%02d%02d%04.1f",
+                  ra_hours, ra_minutes, ra_seconds, sign, dec_degrees,
+                  dec_minutes, dec_seconds);
+  }
+
+  record->description = "<table width='300' cellspacing='0' "
+                        "cellpadding='0'>\n";
+  for (size_t i = 0; i < values.size(); ++i) {
+    string value;
+    if (static_cast<int>(i) == ra_index_) {
+      value = StringPrintf("%02d<sup>h</sup>%02d<sup>m</sup>"
+                           "%05.2f<sup>s</sup>", ra_hours, ra_minutes,
+                           ra_seconds);
+    } else if (static_cast<int>(i) == dec_index_) {
+      value = StringPrintf("%c%02d<sup>d</sup>%02d<sup>m</sup>"
+                           "%04.1f<sup>s</sup>", sign, dec_degrees,
+                           dec_minutes, dec_seconds);
+    } else {
+      value = StringEscapeXml(values[i]);
+    }
+    StringAppendF(&record->description,
+                  "<tr><td align='center'>%s</td>"
+                  "<td align='center'>%s</td></tr>\n",
+                  StringEscapeXml(column_names_[i]).c_str(), value.c_str());
+  }
+  record->description += "</table>\n";
+}
+
+// CsvCatalogReader methods.
+CsvCatalogReader::CsvCatalogReader()
+    : fp_(NULL),
+      line_number_(0),
+      num_columns_(0) {
+  // Nothing needed.
+}
+
+CsvCatalogReader::~CsvCatalogReader() {
+  if (fp_ != NULL) fclose(fp_);
+}
+
+bool CsvCatalogReader::Open(const string &filename) {
+  filename_ = filename;
+  if (fp_ != NULL) fclose(fp_);
+  line_number_ = 0;
+  fp_ = fopen(filename.c_str(), "r");
+  if (fp_ == NULL) {
+    set_error(StringPrintf("Can't open catalog '%s'", filename.c_str()));
+    return false;
+  }
+
+  string line;
+  if (!ReadLine(&line)) {
+    set_error(StringPrintf("Catalog '%s' has no header line",
+                           filename.c_str()));
+    return false;
+  }
+  vector<string> names;
+  SplitLine(line, &names);
+  num_columns_ = names.size();
+  if (!FindColumns(names)) {
+    set_error(StringPrintf("%s in catalog '%s'", error().c_str(),
+                           filename.c_str()));
+    return false;
+  }
+  return true;
+}
+
+bool CsvCatalogReader::Next(CatalogRecord *record) {
+  string line;
+  if (fp_ == NULL || !ReadLine(&line)) return false;
+
+  vector<string> values;
+  SplitLine(line, &values);
+  if (static_cast<int>(values.size()) != num_columns_) {
+    set_error(StringPrintf("Line %d of '%s' has %d values instead of %d",
+                           line_number_, filename_.c_str(),
+                           static_cast<int>(values.size()), num_columns_));
+    return false;
+  }
+
+  double ra;
+  double dec;
+  if (!StringToDouble(values[ra_index()], &ra)) ra = NAN;
+  if (!StringToDouble(values[dec_index()], &dec)) dec = NAN;
+  FillRecord(ra, dec, values, record);
+  return true;
+}
+
+// Quotes group characters, including commas, into one value, and a pair of
+// quotes within quotes stands for a quote.
+void CsvCatalogReader::SplitLine(const string &line,
+                                 vector<string> *values) {
+  values->clear();
+  string value;
+  bool quoted = false;
+  bool was_quoted = false;
+  for (size_t i = 0; i <= line.size(); ++i) {
+    if (i == line.size() || (line[i] == ',' && !quoted)) {
+      if (!was_quoted) StringStripLeadingAndTrailingWhiteSpace(&value);
+      values->push_back(value);
+      value.clear();
+      was_quoted = false;
+    } else if (line[i] == '"') {
+      if (quoted && i + 1 < line.size() && line[i + 1] == '"') {
+        value += '"';
+        ++i;
+      } else {
+        quoted = !quoted;
+        was_quoted = true;
+      }
+    } else if (quoted || !was_quoted) {
+      value += line[i];
+    }
+  }
+}
+
+bool CsvCatalogReader::ReadLine(string *line) {
+  char buffer[4096];
+  while (true) {
+    line->clear();
+    bool found_end = false;
+    while (!found_end && fgets(buffer, sizeof(buffer), fp_) != NULL) {
+      line->append(buffer);
+      found_end = !line->empty() && (*line)[line->size() - 1] == '\n';
+    }
+    if (line->empty()) {
+      if (ferror(fp_)) {
+        set_error(StringPrintf("Couldn't read catalog '%s'",
+                               filename_.c_str()));
+      }
+      return false;
+    }
+    ++line_number_;
+    while (!line->empty() && ((*line)[line->size() - 1] == '\n' ||
+                              (*line)[line->size() - 1] == '\r')) {
+      line->erase(line->size() - 1);
+    }
+    string stripped(*line);
+    StringStripLeadingWhiteSpace(&stripped);
+    if (!stripped.empty() && stripped[0] != '#') return true;
+  }
+}
+
+// FitsCatalogReader methods.
+FitsCatalogReader::FitsCatalogReader()
+    : fp_(NULL),
+      row_size_(0),
+      num_rows_(0),
+      row_(0),
+      buffer_position_(0) {
+  // Nothing needed.
+}
+
+FitsCatalogReader::~FitsCatalogReader() {
+  if (fp_ != NULL) gzclose(fp_);
+}
+
+bool FitsCatalogReader::Open(const string &filename) {
+  filename_ = filename;
+  if (fp_ != NULL) gzclose(fp_);
+  columns_.clear();
+  buffer_.clear();
+  buffer_position_ = 0;
+  row_ = 0;
+
+  // The Fits methods die on files that can't be opened.
+  fp_ = gzopen(filename.c_str(), "rb");
+  if (fp_ == NULL) {
+    set_error(StringPrintf("Can't open catalog '%s'", filename.c_str()));
+    return false;
+  }
+  long offset;
+  string header;
+  if (!Fits::FindTableHdu(filename, &offset, &header)) {
+    set_error(StringPrintf("No BINTABLE extension in '%s'",
+                           filename.c_str()));
+    return false;
+  }
+
+  vector<FitsTable::Column> columns;
+  string parse_error;
+  if (!FitsTable::ParseColumns(header, &columns, &parse_error)) {
+    set_error(StringPrintf("%s in '%s'", parse_error.c_str(),
+                           filename.c_str()));
+    return false;
+  }
+  row_size_ = Fits::HeaderReadKeywordInt(header, "NAXIS1", 0);
+  num_rows_ = Fits::HeaderReadKeywordInt64(header, "NAXIS2", 0);
+  vector<string> names;
+  for (size_t i = 0; i < columns.size(); ++i) {
+    if (!FitsTable::IsReadable(columns[i].type) || columns[i].repeat == 0) {
+      continue;
+    }
+    columns_.push_back(columns[i]);
+    names.push_back(columns[i].name);
+  }
+  if (!FindColumns(names)) {
+    set_error(StringPrintf("%s in catalog '%s'", error().c_str(),
+                           filename.c_str()));
+    return false;
+  }
+  char ra_type = columns_[ra_index()].type;
+  char dec_type = columns_[dec_index()].type;
+  if (!FitsTable::IsNumeric(ra_type) || ra_type == 'L' ||
+      !FitsTable::IsNumeric(dec_type) || dec_type == 'L') {
+    set_error(StringPrintf("The ra and dec columns of '%s' must be numeric",
+                           filename.c_str()));
+    return false;
+  }
+
+  long data_offset = offset + Fits::PaddedHeaderSize(header);
+  if (gzseek(fp_, data_offset, SEEK_SET) != data_offset) {
+    set_error(StringPrintf("Can't seek to the table in '%s'",
+                           filename.c_str()));
+    return false;
+  }
+  return true;
+}
+
+bool FitsCatalogReader::Next(CatalogRecord *record) {
+  if (fp_ == NULL || row_ >= num_rows_) return false;
+
+  // Rows are read a block at a time.
+  if (buffer_position_ >= buffer_.size()) {
+    int64 num_rows = min(static_cast<int64>(ROWS_PER_READ),
+                         num_rows_ - row_);
+    buffer_.resize(num_rows * row_size_);
+    buffer_position_ = 0;
+    if (gzread(fp_, &buffer_[0], buffer_.size()) !=
+        static_cast<int>(buffer_.size())) {
+      set_error(StringPrintf("Table in '%s' is truncated",
+                             filename_.c_str()));
+      return false;
+    }
+  }
+  const uint8 *row = reinterpret_cast<const uint8 *>(buffer_.data() +
+                                                     buffer_position_);
+  buffer_position_ += row_size_;
+  ++row_;
+
+  vector<string> values(columns_.size());
+  for (size_t i = 0; i < columns_.size(); ++i) {
+    values[i] = FormatValue(columns_[i], row);
+  }
+  FillRecord(ReadNumber(columns_[ra_index()], row),
+             ReadNumber(columns_[dec_index()], row), values, record);
+  return true;
+}
+
+// Arrays are written with their values separated by spaces.
+string FitsCatalogReader::FormatValue(const FitsTable::Column &column,
+                                      const uint8 *row) {
+  const uint8 *data = row + column.offset;
+  if (column.type == 'A') {
+    string value(reinterpret_cast<const char *>(data), column.repeat);
+    value = value.substr(0, strlen(value.c_str()));
+    StringStripTrailingWhiteSpace(&value);
+    return value;
+  }
+
+  vector<double> numbers;
+  if (column.type == 'E' || column.type == 'D') {
+    numbers.resize(column.repeat);
+    FitsTable::DecodeDoubles(column, row, 0, 1, &numbers[0]);
+  }
+  string value;
+  int size = column.size / column.repeat;
+  for (int k = 0; k < column.repeat; ++k, data += size) {
+    if (k > 0) value += " ";
+    if (column.type == 'L') {
+      value += *data == 'T' ? "T" : (*data == 'F' ? "F" : "");
+    } else if (column.type == 'E' || column.type == 'D') {
+      StringAppendF(&value, column.type == 'E' ? "%.7g" : "%.15g",
+                    numbers[k]);
+    } else {
+      int64 raw;
+      Fits::DecodeIntegers(data, 8 * size, 1, 0, &raw);
+      if (column.type == 'K' && column.scale == 1.0 &&
+          column.zero == 9223372036854775808.0) {
+        // Unsigned 64 bit integers use a TZERO of 2^63, so wrap around.
+        StringAppendF(&value, "%llu",
+                      static_cast<uint64>(raw) + (1ULL << 63));
+      } else if (column.scale == 1.0 && column.zero == floor(column.zero)) {
+        // Other unsigned integers use a TZERO of 2^(bits - 1).
+        StringAppendF(&value, "%lld",
+                      raw + static_cast<int64>(column.zero));
+      } else {
+        StringAppendF(&value, "%.15g", column.zero + column.scale * raw);
+      }
+    }
+  }
+  return value;
+}
+
+double FitsCatalogReader::ReadNumber(const FitsTable::Column &column,
+                                     const uint8 *row) {
+  vector<double> values(column.repeat);
+  FitsTable::DecodeDoubles(column, row, 0, 1, &values[0]);
+  return values[0];
+}
+
+}  // namespace google_sky
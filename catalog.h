@@ -0,0 +1,267 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// Defines the CatalogReader classes for streaming sources from catalogs
+
+#ifndef CATALOG_H__
+#define CATALOG_H__
+
+#include <zlib.h>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "base.h"
+#include "fitstable.h"
+
+namespace google_sky {
+
+// One source of a catalog.  The description is an HTML table of every
+// column of the source.
+struct CatalogRecord {
+  double ra;
+  double dec;
+  string name;
+  string description;
+};
+
+// Base class for reading the sources of a catalog one at a time
+//
+// Readers stream their input, so catalogs of any size can be read in
+// constant memory.  The ra and dec columns are found by name (e.g. RA,
+// RAJ2000, or RA_DEG) unless they are set explicitly.  Each source is
+// named by the name column if one is set and otherwise by its IAU style
+// designation, e.g. "SDSS J123456.78+012345.6" for a survey named "SDSS".
+// Its description lists every column, with ra and dec in sexagesimal.
+//
+// Example Usage:
+//
+// CsvCatalogReader reader;
+// reader.set_survey_name("SDSS");
+// if (!reader.Open("sources.csv")) {
+//   fprintf(stderr, "%s\n", reader.error().c_str());
+// }
+// CatalogRecord record;
+// while (reader.Next(&record)) {
+//   ...
+// }
+// if (!reader.error().empty()) {
+//   fprintf(stderr, "%s\n", reader.error().c_str());
+// }
+
+class CatalogReader {
+ public:
+  CatalogReader();
+
+  virtual ~CatalogReader() {
+    // Nothing needed.
+  }
+
+  // Reads the next source into record.  Returns false at the end of the
+  // catalog or on an error, in which case error() describes it.
+  virtual bool Next(CatalogRecord *record) = 0;
+
+  // Returns a description of the last error, or an empty string if there
+  // was none.
+  inline const string &error(void) const {
+    return error_;
+  }
+
+  // Returns the column holding ra in degrees.
+  inline const string &ra_column(void) const {
+    return ra_column_;
+  }
+
+  // Sets the column holding ra in degrees, which is found by name by
+  // default.  This must be called before opening the catalog.
+  inline void set_ra_column(const string &ra_column) {
+    ra_column_ = ra_column;
+  }
+
+  // Returns the column holding dec in degrees.
+  inline const string &dec_column(void) const {
+    return dec_column_;
+  }
+
+  // Sets the column holding dec in degrees, which is found by name by
+  // default.  This must be called before opening the catalog.
+  inline void set_dec_column(const string &dec_column) {
+    dec_column_ = dec_column;
+  }
+
+  // Returns the column holding the names of the sources.
+  inline const string &name_column(void) const {
+    return name_column_;
+  }
+
+  // Sets the column holding the names of the sources.  By default the
+  // sources are given IAU style names.  This must be called before opening
+  // the catalog.
+  inline void set_name_column(const string &name_column) {
+    name_column_ = name_column;
+  }
+
+  // Returns the survey name that starts IAU style names.
+  inline const string &survey_name(void) const {
+    return survey_name_;
+  }
+
+  // Sets the survey name that starts IAU style names, empty by default.
+  inline void set_survey_name(const string &survey_name) {
+    survey_name_ = survey_name;
+  }
+
+ protected:
+  // Finds the ra, dec and name columns among names, the names of the
+  // columns of the catalog.  Returns false and sets the error if a column
+  // can't be found.
+  bool FindColumns(const vector<string> &names);
+
+  // Fills in record for a source at ra, dec with the given column values,
+  // which are in the order of the names given to FindColumns().
+  void FillRecord(double ra, double dec, const vector<string> &values,
+                  CatalogRecord *record) const;
+
+  // Returns the index of the ra, dec, or name column (-1 if there is no
+  // name column).
+  inline int ra_index(void) const {
+    return ra_index_;
+  }
+
+  inline int dec_index(void) const {
+    return dec_index_;
+  }
+
+  inline int name_index(void) const {
+    return name_index_;
+  }
+
+  inline void set_error(const string &error) {
+    error_ = error;
+  }
+
+ private:
+  string ra_column_;
+  string dec_column_;
+  string name_column_;
+  string survey_name_;
+  string error_;
+  vector<string> column_names_;
+  int ra_index_;
+  int dec_index_;
+  int name_index_;
+
+  DISALLOW_COPY_AND_ASSIGN(CatalogReader);
+};
+
+// Reads a catalog of comma separated values
+//
+// The first line holds the names of the columns and every following line
+// a source.  Values may be quoted with double quotes to hold commas, and
+// blank lines and lines starting with # are skipped.  Sources whose ra or
+// dec isn't a number get NaN coordinates.
+
+class CsvCatalogReader : public CatalogReader {
+ public:
+  CsvCatalogReader();
+
+  virtual ~CsvCatalogReader();
+
+  // Opens filename and reads the column names.  Returns false with a
+  // description of the problem in error() on failure.
+  bool Open(const string &filename);
+
+  virtual bool Next(CatalogRecord *record);
+
+  // Splits a line into its comma separated values.
+  static void SplitLine(const string &line, vector<string> *values);
+
+ private:
+  string filename_;
+  FILE *fp_;
+  int line_number_;
+  int num_columns_;
+
+  // Reads the next line that isn't blank or a comment.  Returns false at
+  // the end of the file.
+  bool ReadLine(string *line);
+
+  DISALLOW_COPY_AND_ASSIGN(CsvCatalogReader);
+};
+
+// Reads a catalog from the first BINTABLE extension of a FITS file
+//
+// Columns of logical (L), character (A), and integer or floating point
+// (B, I, J, K, E, D) values are read, with TSCAL and TZERO applied.  Other
+// columns, such as variable length arrays, are left out.  The file is read
+// through zlib, so it may be gzipped.  Every column is shown in the
+// descriptions, so whole rows are read; use FitsTable to read a few columns
+// of a large uncompressed table.
+
+class FitsCatalogReader : public CatalogReader {
+ public:
+  FitsCatalogReader();
+
+  virtual ~FitsCatalogReader();
+
+  // Opens filename and reads the header of its table.  Returns false with
+  // a description of the problem in error() on failure.
+  bool Open(const string &filename);
+
+  virtual bool Next(CatalogRecord *record);
+
+  // Returns the number of rows in the table.
+  inline int64 num_rows(void) const {
+    return num_rows_;
+  }
+
+ private:
+  string filename_;
+  gzFile fp_;
+  vector<FitsTable::Column> columns_;  // The columns that are read.
+  int row_size_;
+  int64 num_rows_;
+  int64 row_;
+  string buffer_;    // Rows read from the file but not yet returned.
+  size_t buffer_position_;
+
+  // Formats the value of column in row as a string.
+  static string FormatValue(const FitsTable::Column &column,
+                            const uint8 *row);
+
+  // Returns the first value of a numeric column in row.
+  static double ReadNumber(const FitsTable::Column &column,
+                           const uint8 *row);
+
+  DISALLOW_COPY_AND_ASSIGN(FitsCatalogReader);
+};
+
+}  // namespace google_sky
+
+#endif  // CATALOG_H__
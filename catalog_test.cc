@@ -0,0 +1,276 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "base.h"
+#include "catalog.h"
+#include "string_util.h"
+#include "test_util.h"
+
+namespace google_sky {
+
+// Pads a FITS header or data unit to a multiple of 2880 bytes.
+void PadBlock(char fill, string *unit) {
+  if (unit->size() % 2880 != 0) {
+    unit->append(2880 - unit->size() % 2880, fill);
+  }
+}
+
+// Appends the given cards to a FITS header.
+void AppendCards(const vector<string> &cards, string *header) {
+  for (size_t i = 0; i < cards.size(); ++i) {
+    *header += cards[i];
+    header->append(80 - cards[i].size(), ' ');
+  }
+}
+
+// Writes a FITS file with an empty primary HDU and a BINTABLE of three
+// sources with RA (D), DEC (E), NAME (8A), N (J), FLAG (L), and BITS (8X)
+// columns.
+void WriteTable(const string &filename) {
+  vector<string> cards;
+  cards.push_back("SIMPLE  =                    T");
+  cards.push_back("BITPIX  =                    8");
+  cards.push_back("NAXIS   =                    0");
+  cards.push_back("EXTEND  =                    T");
+  cards.push_back("END");
+  string contents;
+  AppendCards(cards, &contents);
+  PadBlock(' ', &contents);
+
+  cards.clear();
+  cards.push_back("XTENSION= 'BINTABLE'");
+  cards.push_back("BITPIX  =                    8");
+  cards.push_back("NAXIS   =                    2");
+  cards.push_back("NAXIS1  =                   26");
+  cards.push_back("NAXIS2  =                    3");
+  cards.push_back("PCOUNT  =                    0");
+  cards.push_back("GCOUNT  =                    1");
+  cards.push_back("TFIELDS =                    6");
+  cards.push_back("TTYPE1  = 'RA      '");
+  cards.push_back("TFORM1  = 'D       '");
+  cards.push_back("TTYPE2  = 'DEC     '");
+  cards.push_back("TFORM2  = 'E       '");
+  cards.push_back("TTYPE3  = 'NAME    '");
+  cards.push_back("TFORM3  = '8A      '");
+  cards.push_back("TTYPE4  = 'N       '");
+  cards.push_back("TFORM4  = 'J       '");
+  cards.push_back("TZERO4  =                  100");
+  cards.push_back("TTYPE5  = 'FLAG    '");
+  cards.push_back("TFORM5  = 'L       '");
+  cards.push_back("TTYPE6  = 'BITS    '");
+  cards.push_back("TFORM6  = '8X      '");
+  cards.push_back("END");
+  AppendCards(cards, &contents);
+  PadBlock(' ', &contents);
+
+  const double ras[] = { 187.5, 10.25, 359.0 };
+  const float decs[] = { -1.5f, 41.25f, 89.5f };
+  const char *names[] = { "first", "a<b", "" };
+  string data;
+  for (int i = 0; i < 3; ++i) {
+    AppendBigEndian(&ras[i], 8, &data);
+    AppendBigEndian(&decs[i], 4, &data);
+    string name(names[i]);
+    name.append(8 - name.size(), '\0');
+    data += name;
+    int32_t n = i;
+    AppendBigEndian(&n, 4, &data);
+    data.push_back(i % 2 == 0 ? 'T' : 'F');
+    data.push_back('\xff');
+  }
+  PadBlock('\0', &data);
+  WriteFile(filename, contents + data);
+}
+
+int Main(int argc, char **argv) {
+  {
+    cout << "Testing CsvCatalogReader::SplitLine()... ";
+    vector<string> values;
+    CsvCatalogReader::SplitLine("a, b ,c", &values);
+    ASSERT_EQ(3, values.size());
+    ASSERT_EQ("a", values[0]);
+    ASSERT_EQ("b", values[1]);
+    ASSERT_EQ("c", values[2]);
+
+    CsvCatalogReader::SplitLine("\"x, y\",\" z \",,\"say \"\"hi\"\"\"",
+                                &values);
+    ASSERT_EQ(4, values.size());
+    ASSERT_EQ("x, y", values[0]);
+    ASSERT_EQ(" z ", values[1]);
+    ASSERT_EQ("", values[2]);
+    ASSERT_EQ("say \"hi\"", values[3]);
+
+    CsvCatalogReader::SplitLine("", &values);
+    ASSERT_EQ(1, values.size());
+    ASSERT_EQ("", values[0]);
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing CsvCatalogReader... ";
+    WriteFile("catalog_test.csv",
+              "# A comment before the header.\n"
+              "id,RAJ2000,DEJ2000,mag\n"
+              "\n"
+              "1,187.5,-1.5,12.5\n"
+              "# A comment between sources.\n"
+              "2,10.25,41.25,<b>\r\n"
+              "3,bad,0,1\n");
+    CsvCatalogReader reader;
+    reader.set_survey_name("TEST");
+    ASSERT_TRUE(reader.Open("catalog_test.csv"));
+
+    CatalogRecord record;
+    ASSERT_TRUE(reader.Next(&record));
+    ASSERT_FLOAT_EQ(187.5, record.ra, 1e-12);
+    ASSERT_FLOAT_EQ(-1.5, record.dec, 1e-12);
+    ASSERT_EQ("TEST J123000.00-013000.0", record.name);
+    ASSERT_TRUE(StringContains(record.description,
+                               "12<sup>h</sup>30<sup>m</sup>"
+                               "00.00<sup>s</sup>"));
+    ASSERT_TRUE(StringContains(record.description,
+                               "-01<sup>d</sup>30<sup>m</sup>"
+                               "00.0<sup>s</sup>"));
+    ASSERT_TRUE(StringContains(record.description, ">mag<"));
+    ASSERT_TRUE(StringContains(record.description, ">12.5<"));
+
+    // Values are escaped and carriage returns are stripped.
+    ASSERT_TRUE(reader.Next(&record));
+    ASSERT_EQ("TEST J004100.00+411500.0", record.name);
+    ASSERT_TRUE(StringContains(record.description, ">&lt;b&gt;<"));
+
+    // Bad coordinates are returned as NaN for the caller to skip.
+    ASSERT_TRUE(reader.Next(&record));
+    ASSERT_TRUE(isnan(record.ra));
+    ASSERT_FALSE(reader.Next(&record));
+    ASSERT_EQ("", reader.error());
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing CsvCatalogReader columns... ";
+    WriteFile("catalog_test.csv",
+              "name,x,y\n"
+              "\"Star, bright\",1.0,2.0\n"
+              "extra,1.0,2.0,3.0\n");
+    CsvCatalogReader reader;
+    ASSERT_FALSE(reader.Open("catalog_test.csv"));
+    ASSERT_TRUE(StringContains(reader.error(), "ra column"));
+
+    reader.set_ra_column("X");
+    reader.set_dec_column("y");
+    reader.set_name_column("name");
+    ASSERT_TRUE(reader.Open("catalog_test.csv"));
+    CatalogRecord record;
+    ASSERT_TRUE(reader.Next(&record));
+    ASSERT_EQ("Star, bright", record.name);
+    ASSERT_FLOAT_EQ(2.0, record.dec, 1e-12);
+
+    // Lines with the wrong number of values are errors.
+    ASSERT_FALSE(reader.Next(&record));
+    ASSERT_TRUE(StringContains(reader.error(), "Line 3"));
+
+    ASSERT_FALSE(reader.Open("catalog_test_missing.csv"));
+    ASSERT_TRUE(StringContains(reader.error(), "Can't open"));
+    remove("catalog_test.csv");
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing FitsCatalogReader... ";
+    WriteTable("catalog_test.fits");
+    FitsCatalogReader reader;
+    reader.set_name_column("name");
+    ASSERT_TRUE(reader.Open("catalog_test.fits"));
+    ASSERT_EQ(3, reader.num_rows());
+
+    CatalogRecord record;
+    ASSERT_TRUE(reader.Next(&record));
+    ASSERT_FLOAT_EQ(187.5, record.ra, 1e-12);
+    ASSERT_FLOAT_EQ(-1.5, record.dec, 1e-6);
+    ASSERT_EQ("first", record.name);
+    ASSERT_TRUE(StringContains(record.description, ">100<"));
+    ASSERT_TRUE(StringContains(record.description, ">T<"));
+
+    // The bit column isn't shown.
+    ASSERT_FALSE(StringContains(record.description, "BITS"));
+
+    ASSERT_TRUE(reader.Next(&record));
+    ASSERT_EQ("a<b", record.name);
+    ASSERT_TRUE(StringContains(record.description, ">a&lt;b<"));
+    ASSERT_TRUE(StringContains(record.description, ">101<"));
+    ASSERT_TRUE(StringContains(record.description, ">F<"));
+
+    // Sources with a blank name are given IAU names.
+    ASSERT_TRUE(reader.Next(&record));
+    ASSERT_FLOAT_EQ(89.5, record.dec, 1e-6);
+    ASSERT_EQ("J235600.00+893000.0", record.name);
+    ASSERT_FALSE(reader.Next(&record));
+    ASSERT_EQ("", reader.error());
+
+    // Text columns can't hold coordinates.
+    FitsCatalogReader text_reader;
+    text_reader.set_ra_column("NAME");
+    ASSERT_FALSE(text_reader.Open("catalog_test.fits"));
+    ASSERT_TRUE(StringContains(text_reader.error(), "numeric"));
+    remove("catalog_test.fits");
+
+    // The table may follow image extensions, and gzipped files without
+    // tables are rejected.
+    FitsCatalogReader mef_reader;
+    mef_reader.set_ra_column("A");
+    mef_reader.set_dec_column("A");
+    ASSERT_TRUE(mef_reader.Open("testdata/fitsimage_test_mef.fits"));
+    ASSERT_EQ(3, mef_reader.num_rows());
+    int num_records = 0;
+    while (mef_reader.Next(&record)) ++num_records;
+    ASSERT_EQ(3, num_records);
+    ASSERT_EQ("", mef_reader.error());
+
+    FitsCatalogReader image_reader;
+    ASSERT_FALSE(image_reader.Open("testdata/fitsimage_test.fits.gz"));
+    ASSERT_TRUE(StringContains(image_reader.error(), "No BINTABLE"));
+    cout << "pass\n";
+  }
+
+  return 0;
+}
+
+}  // namespace google_sky
+
+int main(int argc, char **argv) {
+  return google_sky::Main(argc, argv);
+}
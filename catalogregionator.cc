@@ -0,0 +1,378 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "catalogregionator.h"
+
+#include <unistd.h>
+
+#include <cmath>
+#include <cstdio>
+
+#include "file_util.h"
+#include "kml.h"
+#include "string_util.h"
+#include "threadpool.h"
+
+namespace {
+
+const double DEG_TO_RAD = google_sky::PI / 180.0;
+const double RAD_TO_DEG = 180.0 / google_sky::PI;
+
+// Writes contents to filename.
+bool WriteFile(const string &filename, const string &contents) {
+  FILE *fp = fopen(filename.c_str(), "w");
+  if (fp == NULL) return false;
+  bool written = fwrite(contents.data(), 1, contents.size(), fp) ==
+                 contents.size();
+  return fclose(fp) == 0 && written;
+}
+
+// Writes a string preceded by its length.
+bool WriteString(const string &value, FILE *fp) {
+  int size = value.size();
+  return fwrite(&size, sizeof(size), 1, fp) == 1 &&
+         fwrite(value.data(), 1, value.size(), fp) == value.size();
+}
+
+// Reads a string written by WriteString().
+bool ReadString(FILE *fp, string *value) {
+  int size;
+  if (fread(&size, sizeof(size), 1, fp) != 1 || size < 0) return false;
+  value->resize(size);
+  return size == 0 || fread(&(*value)[0], 1, size, fp) ==
+                      static_cast<size_t>(size);
+}
+
+// Writes a source to a temporary file.
+bool WriteSource(const google_sky::CatalogRecord &source, FILE *fp) {
+  return fwrite(&source.ra, sizeof(source.ra), 1, fp) == 1 &&
+         fwrite(&source.dec, sizeof(source.dec), 1, fp) == 1 &&
+         WriteString(source.name, fp) && WriteString(source.description, fp);
+}
+
+// Makes the Region of a box shown between the given sizes in pixels.
+google_sky::KmlRegion MakeRegion(double west, double east, double south,
+                                 double north, int min_lod_pixels,
+                                 int max_lod_pixels) {
+  google_sky::KmlLatLonAltBox lat_lon_alt_box;
+  lat_lon_alt_box.north.set(north);
+  lat_lon_alt_box.south.set(south);
+  lat_lon_alt_box.east.set(east);
+  lat_lon_alt_box.west.set(west);
+
+  google_sky::KmlLod lod;
+  lod.min_lod_pixels.set(min_lod_pixels);
+  lod.max_lod_pixels.set(max_lod_pixels);
+
+  google_sky::KmlRegion region;
+  region.lat_lon_alt_box.set(lat_lon_alt_box);
+  region.lod.set(lod);
+  return region;
+}
+
+}  // namespace
+
+namespace google_sky {
+
+// Reads back the sources a node passed to one of its children.
+class CatalogRegionator::SpillReader : public CatalogReader {
+ public:
+  explicit SpillReader(const string &filename)
+      : filename_(filename), fp_(fopen(filename.c_str(), "rb")) {
+    if (fp_ == NULL) {
+      set_error(StringPrintf("Can't open temporary file '%s'",
+                             filename.c_str()));
+    }
+  }
+
+  virtual ~SpillReader() {
+    if (fp_ != NULL) fclose(fp_);
+  }
+
+  virtual bool Next(CatalogRecord *record) {
+    if (fp_ == NULL) return false;
+    if (fread(&record->ra, sizeof(record->ra), 1, fp_) != 1) {
+      if (!feof(fp_)) {
+        set_error(StringPrintf("Can't read temporary file '%s'",
+                               filename_.c_str()));
+      }
+      return false;
+    }
+    if (fread(&record->dec, sizeof(record->dec), 1, fp_) != 1 ||
+        !ReadString(fp_, &record->name) ||
+        !ReadString(fp_, &record->description)) {
+      set_error(StringPrintf("Temporary file '%s' is truncated",
+                             filename_.c_str()));
+      return false;
+    }
+    return true;
+  }
+
+ private:
+  string filename_;
+  FILE *fp_;
+
+  DISALLOW_COPY_AND_ASSIGN(SpillReader);
+};
+
+// Splits a child node from the file its parent wrote.
+class CatalogRegionator::NodeTask : public Task {
+ public:
+  NodeTask(CatalogRegionator *regionator, const Node &node,
+           ThreadPool *pool)
+      : regionator_(regionator), node_(node), pool_(pool) {
+    // Nothing needed.
+  }
+
+  virtual void Run() {
+    string filename = regionator_->MakeSpillFilename(node_);
+    if (!regionator_->HasError()) {
+      SpillReader reader(filename);
+      regionator_->SplitNode(node_, &reader, pool_);
+    }
+    unlink(filename.c_str());
+  }
+
+ private:
+  CatalogRegionator *regionator_;
+  Node node_;
+  ThreadPool *pool_;
+
+  DISALLOW_COPY_AND_ASSIGN(NodeTask);
+};
+
+const int CatalogRegionator::MAX_LEVEL;
+
+CatalogRegionator::CatalogRegionator()
+    : max_sources_per_node_(100),
+      min_lod_pixels_(128),
+      max_lod_pixels_(-1),
+      num_threads_(ThreadPool::DefaultNumThreads()),
+      output_directory_("catalog"),
+      root_kml_("catalog.kml"),
+      name_("Regionated Catalog"),
+      num_sources_(0),
+      num_skipped_(0),
+      num_nodes_(0) {
+  pthread_mutex_init(&mutex_, NULL);
+}
+
+CatalogRegionator::~CatalogRegionator() {
+  pthread_mutex_destroy(&mutex_);
+}
+
+bool CatalogRegionator::Regionate(CatalogReader *reader, string *error) {
+  num_sources_ = 0;
+  num_skipped_ = 0;
+  num_nodes_ = 0;
+  error_.clear();
+  if (!MakeDirectory(output_directory_)) {
+    *error = StringPrintf("Can't create directory '%s'",
+                          output_directory_.c_str());
+    return false;
+  }
+
+  // The root node is split here as the catalog is read, and the pool then
+  // splits its descendants until every node has been written.
+  Node root;
+  root.id = "0";
+  root.level = 0;
+  root.west = -180.0;
+  root.east = 180.0;
+  root.south = -90.0;
+  root.north = 90.0;
+  {
+    ThreadPool pool(num_threads_);
+    SplitNode(root, reader, &pool);
+    pool.Wait();
+  }
+
+  if (error_.empty() && !WriteRootKml()) {
+    error_ = StringPrintf("Couldn't write '%s'", root_kml_.c_str());
+  }
+  if (!error_.empty()) {
+    *error = error_;
+    return false;
+  }
+  return true;
+}
+
+bool CatalogRegionator::SplitNode(const Node &node, CatalogReader *input,
+                                  ThreadPool *pool) {
+  vector<CatalogRecord> sources;
+  Node children[4];
+  FILE *files[4] = { NULL, NULL, NULL, NULL };
+  bool written = true;
+  CatalogRecord source;
+  while (written && input->Next(&source)) {
+    // Only the root reads sources straight from the catalog.
+    if (node.level == 0) {
+      if (!isfinite(source.ra) || !isfinite(source.dec) ||
+          fabs(source.dec) > 90.0) {
+        ++num_skipped_;
+        continue;
+      }
+      source.ra = fmod(source.ra, 360.0);
+      if (source.ra < 0.0) source.ra += 360.0;
+      ++num_sources_;
+    }
+
+    if (static_cast<int>(sources.size()) < max_sources_per_node_ ||
+        node.level == MAX_LEVEL) {
+      sources.push_back(source);
+      continue;
+    }
+    Node child;
+    int index = FindChild(node, source.ra - 180.0, source.dec, &child);
+    children[index] = child;
+    if (files[index] == NULL) {
+      files[index] = fopen(MakeSpillFilename(children[index]).c_str(), "wb");
+      if (files[index] == NULL) {
+        written = false;
+        break;
+      }
+    }
+    written = WriteSource(source, files[index]);
+  }
+
+  vector<Node> linked;
+  for (int i = 0; i < 4; ++i) {
+    if (files[i] == NULL) continue;
+    if (fclose(files[i]) != 0) written = false;
+    linked.push_back(children[i]);
+  }
+  string error;
+  if (!written) {
+    error = StringPrintf("Couldn't write temporary files in '%s'",
+                         output_directory_.c_str());
+  } else if (!input->error().empty()) {
+    error = input->error();
+  } else if (sources.empty()) {
+    error = "The catalog has no sources with valid coordinates";
+  } else if (!WriteNodeKml(node, sources, linked)) {
+    error = StringPrintf("Couldn't write '%s/%s.kml'",
+                         output_directory_.c_str(), node.id.c_str());
+  }
+  if (!error.empty()) {
+    RecordError(error);
+    for (size_t i = 0; i < linked.size(); ++i) {
+      unlink(MakeSpillFilename(linked[i]).c_str());
+    }
+    return false;
+  }
+
+  pthread_mutex_lock(&mutex_);
+  ++num_nodes_;
+  pthread_mutex_unlock(&mutex_);
+  for (size_t i = 0; i < linked.size(); ++i) {
+    pool->Add(new NodeTask(this, linked[i], pool));
+  }
+  return true;
+}
+
+bool CatalogRegionator::WriteNodeKml(const Node &node,
+                                     const vector<CatalogRecord> &sources,
+                                     const vector<Node> &children) const {
+  Kml kml;
+  kml.region.set(MakeRegion(node.west, node.east, node.south, node.north,
+                            min_lod_pixels_, max_lod_pixels_));
+  for (size_t i = 0; i < sources.size(); ++i) {
+    KmlPoint point;
+    point.longitude.set(sources[i].ra - 180.0);
+    point.latitude.set(sources[i].dec);
+    KmlPlacemark placemark;
+    placemark.name.set(StringEscapeXml(sources[i].name));
+    placemark.description.set(StringEscapeXml(sources[i].description));
+    placemark.point.set(point);
+    kml.AddPlacemark(placemark);
+  }
+  for (size_t i = 0; i < children.size(); ++i) {
+    const Node &child = children[i];
+    KmlLink link;
+    link.href.set(child.id + ".kml");
+    KmlNetworkLink network_link;
+    network_link.name.set(child.id);
+    network_link.region.set(MakeRegion(child.west, child.east, child.south,
+                                       child.north, min_lod_pixels_,
+                                       max_lod_pixels_));
+    network_link.link.set(link);
+    kml.AddNetworkLink(network_link);
+  }
+  return WriteFile(output_directory_ + "/" + node.id + ".kml",
+                   kml.ToString());
+}
+
+// The root KML lives above the output directory and is always shown.
+bool CatalogRegionator::WriteRootKml(void) const {
+  KmlLink link;
+  link.href.set(output_directory_ + "/0.kml");
+  KmlNetworkLink network_link;
+  network_link.name.set(StringEscapeXml(name_));
+  network_link.region.set(MakeRegion(-180.0, 180.0, -90.0, 90.0, 0, -1));
+  network_link.link.set(link);
+  Kml kml;
+  kml.AddNetworkLink(network_link);
+  return WriteFile(root_kml_, kml.ToString());
+}
+
+// Nodes are split in half in longitude and into halves of equal area in
+// latitude.
+int CatalogRegionator::FindChild(const Node &node, double longitude,
+                                 double latitude, Node *child) {
+  double middle_longitude = 0.5 * (node.west + node.east);
+  double middle_latitude = RAD_TO_DEG * asin(
+      0.5 * (sin(node.south * DEG_TO_RAD) + sin(node.north * DEG_TO_RAD)));
+  int index = (longitude < middle_longitude ? 0 : 1) +
+              (latitude < middle_latitude ? 0 : 2);
+  child->id = StringPrintf("%s%d", node.id.c_str(), index);
+  child->level = node.level + 1;
+  child->west = index % 2 == 0 ? node.west : middle_longitude;
+  child->east = index % 2 == 0 ? middle_longitude : node.east;
+  child->south = index < 2 ? node.south : middle_latitude;
+  child->north = index < 2 ? middle_latitude : node.north;
+  return index;
+}
+
+string CatalogRegionator::MakeSpillFilename(const Node &node) const {
+  return output_directory_ + "/" + node.id + ".sources";
+}
+
+void CatalogRegionator::RecordError(const string &error) {
+  pthread_mutex_lock(&mutex_);
+  if (error_.empty()) error_ = error;
+  pthread_mutex_unlock(&mutex_);
+}
+
+bool CatalogRegionator::HasError(void) {
+  pthread_mutex_lock(&mutex_);
+  bool has_error = !error_.empty();
+  pthread_mutex_unlock(&mutex_);
+  return has_error;
+}
+
+}  // namespace google_sky
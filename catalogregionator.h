@@ -0,0 +1,256 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// Defines the CatalogRegionator class for regionating catalogs of sources
+
+#ifndef CATALOGREGIONATOR_H__
+#define CATALOGREGIONATOR_H__
+
+#include <pthread.h>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "base.h"
+#include "catalog.h"
+
+namespace google_sky {
+
+// Forward declarations.
+class ThreadPool;
+
+// Class for regionating a catalog of sources into KML Placemarks
+//
+// Like python/fits/fitsregionator.py, the sky is split into a quadtree of
+// nodes.  Each node keeps the first max_sources_per_node() sources that
+// fall in it, in catalog order, and passes the rest on to its four
+// children, which split the node at its middle longitude and at the
+// latitude that halves its area (where sin(dec) is halfway between its
+// values at the node's edges).  Sorting the catalog by brightness therefore
+// shows the brightest sources first.  Each node with sources is written as
+// a KML file holding its Placemarks and NetworkLinks to its children,
+// named by the path to it from the root, e.g. 0.kml, 01.kml, 012.kml.
+// Longitude is ra - 180, as for the other wcs2kml outputs.
+//
+// Sources are streamed rather than held in memory.  The root node reads
+// the catalog once, keeping its own sources and appending the rest to a
+// temporary file in the output directory for each child.  Each child is
+// then split the same way from its file on a ThreadPool, so independent
+// subtrees are built in parallel and only the sources of the nodes being
+// split are in memory.  Nodes at MAX_LEVEL keep all of their sources, so
+// many sources at one position don't recurse forever.
+//
+// Example Usage:
+//
+// FitsCatalogReader reader;
+// if (!reader.Open("sources.fits")) {
+//   fprintf(stderr, "%s\n", reader.error().c_str());
+// }
+// CatalogRegionator regionator;
+// regionator.set_output_directory("sources");
+// regionator.set_root_kml("sources.kml");
+// string error;
+// if (!regionator.Regionate(&reader, &error)) {
+//   fprintf(stderr, "%s\n", error.c_str());
+// }
+
+class CatalogRegionator {
+ public:
+  // The deepest level of the quadtree.  The root is level 0.
+  static const int MAX_LEVEL = 24;
+
+  // Creates a regionator of at most 100 sources per node writing to
+  // "catalog" and "catalog.kml".
+  CatalogRegionator();
+
+  ~CatalogRegionator();
+
+  // Regionates every source that reader returns.  Sources with invalid
+  // coordinates are skipped.  Returns false with a description of the
+  // problem in error if the catalog can't be read or a file can't be
+  // written.
+  bool Regionate(CatalogReader *reader, string *error);
+
+  // Returns the number of sources regionated by the last call to
+  // Regionate().
+  inline int64 num_sources(void) const {
+    return num_sources_;
+  }
+
+  // Returns the number of sources skipped by the last call to Regionate()
+  // because their ra or dec was invalid.
+  inline int64 num_skipped(void) const {
+    return num_skipped_;
+  }
+
+  // Returns the number of KML files written for nodes by the last call to
+  // Regionate().
+  inline int num_nodes(void) const {
+    return num_nodes_;
+  }
+
+  // Returns the largest number of sources kept by a node.
+  inline int max_sources_per_node(void) const {
+    return max_sources_per_node_;
+  }
+
+  // Sets the largest number of sources kept by a node, 100 by default.
+  inline void set_max_sources_per_node(int max_sources_per_node) {
+    CHECK_GT(max_sources_per_node, 0);
+    max_sources_per_node_ = max_sources_per_node;
+  }
+
+  // Returns the minimum size in pixels at which a node is shown.
+  inline int min_lod_pixels(void) const {
+    return min_lod_pixels_;
+  }
+
+  // Sets the minimum size in pixels at which a node is shown, 128 by
+  // default.
+  inline void set_min_lod_pixels(int min_lod_pixels) {
+    min_lod_pixels_ = min_lod_pixels;
+  }
+
+  // Returns the maximum size in pixels at which a node is shown.
+  inline int max_lod_pixels(void) const {
+    return max_lod_pixels_;
+  }
+
+  // Sets the maximum size in pixels at which a node is shown, -1 (no
+  // maximum) by default.
+  inline void set_max_lod_pixels(int max_lod_pixels) {
+    max_lod_pixels_ = max_lod_pixels;
+  }
+
+  // Returns the number of threads used to split nodes.
+  inline int num_threads(void) const {
+    return num_threads_;
+  }
+
+  // Sets the number of threads used to split nodes, which defaults to
+  // ThreadPool::DefaultNumThreads().
+  inline void set_num_threads(int num_threads) {
+    num_threads_ = num_threads;
+  }
+
+  // Returns the directory the node KML files are written to.
+  inline const string &output_directory(void) const {
+    return output_directory_;
+  }
+
+  // Sets the directory the node KML files are written to, "catalog" by
+  // default.
+  inline void set_output_directory(const string &output_directory) {
+    output_directory_ = output_directory;
+  }
+
+  // Returns the root KML file, which links to the root node.
+  inline const string &root_kml(void) const {
+    return root_kml_;
+  }
+
+  // Sets the root KML file, "catalog.kml" by default.
+  inline void set_root_kml(const string &root_kml) {
+    root_kml_ = root_kml;
+  }
+
+  // Returns the name of the link in the root KML file.
+  inline const string &name(void) const {
+    return name_;
+  }
+
+  // Sets the name of the link in the root KML file, "Regionated Catalog"
+  // by default.
+  inline void set_name(const string &name) {
+    name_ = name;
+  }
+
+ private:
+  // A node of the quadtree.
+  struct Node {
+    string id;
+    int level;
+    double west;
+    double east;
+    double south;
+    double north;
+  };
+
+  class NodeTask;
+  class SpillReader;
+
+  int max_sources_per_node_;
+  int min_lod_pixels_;
+  int max_lod_pixels_;
+  int num_threads_;
+  string output_directory_;
+  string root_kml_;
+  string name_;
+
+  // State of the current call to Regionate().
+  int64 num_sources_;
+  int64 num_skipped_;
+  int num_nodes_;
+  string error_;            // The first error found.
+  pthread_mutex_t mutex_;   // Guards num_nodes_ and error_.
+
+  // Reads the sources of node from input, keeping the first
+  // max_sources_per_node() and writing the rest to the files of the
+  // children they fall in, then writes the KML of node and schedules its
+  // children on pool.  Returns false and records the error on failure.
+  bool SplitNode(const Node &node, CatalogReader *input, ThreadPool *pool);
+
+  // Writes the KML file of node, which holds sources and links to
+  // children.
+  bool WriteNodeKml(const Node &node, const vector<CatalogRecord> &sources,
+                    const vector<Node> &children) const;
+
+  // Writes the root KML file.
+  bool WriteRootKml(void) const;
+
+  // Returns the child of node at longitude, latitude and its bounds in
+  // child (0 and 1 are south of 2 and 3, and 0 and 2 are west of 1 and 3).
+  static int FindChild(const Node &node, double longitude, double latitude,
+                       Node *child);
+
+  // Returns the file holding the sources passed to node by its parent.
+  string MakeSpillFilename(const Node &node) const;
+
+  // Records error if it is the first.
+  void RecordError(const string &error);
+
+  // Returns whether an error has been recorded.
+  bool HasError(void);
+
+  DISALLOW_COPY_AND_ASSIGN(CatalogRegionator);
+};
+
+}  // namespace google_sky
+
+#endif  // CATALOGREGIONATOR_H__
@@ -0,0 +1,220 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <dirent.h>
+#include <sys/types.h>
+
+#include <cmath>
+#include <cstdio>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "base.h"
+#include "catalog.h"
+#include "catalogregionator.h"
+#include "file_util.h"
+#include "string_util.h"
+#include "test_util.h"
+
+namespace google_sky {
+
+// Returns the sources it is given.
+class VectorReader : public CatalogReader {
+ public:
+  VectorReader() : position_(0) {
+    // Nothing needed.
+  }
+
+  void Add(double ra, double dec) {
+    CatalogRecord record;
+    record.ra = ra;
+    record.dec = dec;
+    record.name = StringPrintf("source %d",
+                               static_cast<int>(records_.size()));
+    record.description = "<b>&</b>";
+    records_.push_back(record);
+  }
+
+  virtual bool Next(CatalogRecord *record) {
+    if (position_ >= records_.size()) return false;
+    *record = records_[position_++];
+    return true;
+  }
+
+ private:
+  vector<CatalogRecord> records_;
+  size_t position_;
+};
+
+// Returns the number of times substring occurs in str.
+int CountOccurrences(const string &str, const string &substring) {
+  int count = 0;
+  for (size_t i = str.find(substring); i != string::npos;
+       i = str.find(substring, i + substring.size())) {
+    ++count;
+  }
+  return count;
+}
+
+// Returns the number of Placemarks in the KML files of directory and
+// removes the files and directory.  Sets the length of the longest node id
+// in max_id_length.
+int CountPlacemarksAndClean(const string &directory, int *max_id_length,
+                            int *num_spill_files) {
+  int num_placemarks = 0;
+  *max_id_length = 0;
+  *num_spill_files = 0;
+  DIR *dir = opendir(directory.c_str());
+  CHECK(dir != NULL);
+  vector<string> files;
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    string file(entry->d_name);
+    if (file == "." || file == "..") continue;
+    files.push_back(file);
+  }
+  closedir(dir);
+  for (size_t i = 0; i < files.size(); ++i) {
+    string path = directory + "/" + files[i];
+    if (StringEndsWith(files[i], ".kml")) {
+      num_placemarks += CountOccurrences(ReadFile(path), "<Placemark>");
+      *max_id_length = max(*max_id_length,
+                           static_cast<int>(files[i].size()) - 4);
+    } else {
+      ++*num_spill_files;
+    }
+    remove(path.c_str());
+  }
+  rmdir(directory.c_str());
+  return num_placemarks;
+}
+
+int Main(int argc, char **argv) {
+  {
+    cout << "Testing CatalogRegionator::Regionate()... ";
+    // Every source falls in node 02, west of ra = 180 and north of the
+    // equator, and the last 50 in its southeast child, 021, below dec = 30.
+    VectorReader reader;
+    for (int i = 0; i < 250; ++i) {
+      reader.Add(10.0 + 0.5 * i, 0.1 * i);
+    }
+    reader.Add(10.0, 95.0);
+    reader.Add(NAN, 10.0);
+
+    CatalogRegionator regionator;
+    regionator.set_output_directory("catalogregionator_test_nodes");
+    regionator.set_root_kml("catalogregionator_test.kml");
+    regionator.set_name("Test & Catalog");
+    regionator.set_num_threads(4);
+    string error;
+    ASSERT_TRUE(regionator.Regionate(&reader, &error));
+    ASSERT_EQ(250, regionator.num_sources());
+    ASSERT_EQ(2, regionator.num_skipped());
+    ASSERT_EQ(3, regionator.num_nodes());
+
+    string root = ReadFile("catalogregionator_test.kml");
+    ASSERT_TRUE(StringContains(root, "catalogregionator_test_nodes/0.kml"));
+    ASSERT_TRUE(StringContains(root, "Test &amp; Catalog"));
+
+    // Nodes keep the first sources in catalog order.
+    string kml = ReadFile("catalogregionator_test_nodes/0.kml");
+    ASSERT_EQ(100, CountOccurrences(kml, "<Placemark>"));
+    ASSERT_TRUE(StringContains(kml, "source 0<"));
+    ASSERT_TRUE(StringContains(kml, "source 99<"));
+    ASSERT_FALSE(StringContains(kml, "source 100<"));
+    ASSERT_TRUE(StringContains(kml, "<href>02.kml</href>"));
+    ASSERT_FALSE(StringContains(kml, "<href>00.kml</href>"));
+    ASSERT_TRUE(StringContains(kml, "&lt;b&gt;&amp;&lt;/b&gt;"));
+
+    // Children are split where they have equal areas.
+    kml = ReadFile("catalogregionator_test_nodes/02.kml");
+    ASSERT_EQ(100, CountOccurrences(kml, "<Placemark>"));
+    ASSERT_TRUE(StringContains(kml, "<href>021.kml</href>"));
+    ASSERT_TRUE(StringContains(kml, "<north>30.00000000000000</north>"));
+    kml = ReadFile("catalogregionator_test_nodes/021.kml");
+    ASSERT_EQ(50, CountOccurrences(kml, "<Placemark>"));
+    ASSERT_FALSE(StringContains(kml, "<NetworkLink>"));
+
+    int max_id_length;
+    int num_spill_files;
+    int num_placemarks = CountPlacemarksAndClean(
+        "catalogregionator_test_nodes", &max_id_length, &num_spill_files);
+    ASSERT_EQ(250, num_placemarks);
+    ASSERT_EQ(3, max_id_length);
+    ASSERT_EQ(0, num_spill_files);
+    remove("catalogregionator_test.kml");
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing CatalogRegionator::Regionate() limits... ";
+    // Sources at one position stop splitting at the deepest level.
+    VectorReader reader;
+    for (int i = 0; i < 30; ++i) {
+      reader.Add(123.0, -45.0);
+    }
+    CatalogRegionator regionator;
+    regionator.set_output_directory("catalogregionator_test_nodes");
+    regionator.set_root_kml("catalogregionator_test.kml");
+    regionator.set_max_sources_per_node(1);
+    regionator.set_num_threads(2);
+    string error;
+    ASSERT_TRUE(regionator.Regionate(&reader, &error));
+    ASSERT_EQ(CatalogRegionator::MAX_LEVEL + 1, regionator.num_nodes());
+
+    int max_id_length;
+    int num_spill_files;
+    int num_placemarks = CountPlacemarksAndClean(
+        "catalogregionator_test_nodes", &max_id_length, &num_spill_files);
+    ASSERT_EQ(30, num_placemarks);
+    ASSERT_EQ(CatalogRegionator::MAX_LEVEL + 1, max_id_length);
+    ASSERT_EQ(0, num_spill_files);
+    remove("catalogregionator_test.kml");
+
+    // Catalogs without valid sources are errors.
+    VectorReader empty_reader;
+    empty_reader.Add(0.0, -91.0);
+    ASSERT_FALSE(regionator.Regionate(&empty_reader, &error));
+    ASSERT_TRUE(StringContains(error, "no sources"));
+    num_placemarks = CountPlacemarksAndClean(
+        "catalogregionator_test_nodes", &max_id_length, &num_spill_files);
+    ASSERT_EQ(0, num_placemarks);
+    ASSERT_FALSE(FileExists("catalogregionator_test.kml"));
+    cout << "pass\n";
+  }
+
+  return 0;
+}
+
+}  // namespace google_sky
+
+int main(int argc, char **argv) {
+  return google_sky::Main(argc, argv);
+}
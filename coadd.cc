@@ -0,0 +1,251 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "coadd.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "image.h"
+
+namespace {
+
+// Samples within this many levels of the mean are never clipped, so pixels
+// whose samples barely differ keep them all.
+static const double MIN_CLIP_DISTANCE = 0.5;
+
+// Rounds a value to the nearest 8 bit level.
+inline google_sky::uint8 ToLevel(double value) {
+  if (value <= 0.0) return 0;
+  if (value >= 255.0) return 255;
+  return static_cast<google_sky::uint8>(value + 0.5);
+}
+
+}  // namespace
+
+namespace google_sky {
+
+// Only the state needed by the method is allocated.
+Coadd::Coadd(Method method, int width, int height)
+    : method_(method),
+      width_(width),
+      height_(height),
+      pass_(-1),
+      clip_sigma_(3.0),
+      clip_iterations_(2),
+      counts_(),
+      alphas_(),
+      sums_(),
+      squares_(),
+      clip_means_(),
+      clip_sigmas_(),
+      quantiles_() {
+  CHECK(width > 0 && height > 0) << "Bad co-add size " << width << " x "
+                                 << height;
+  size_t num_pixels = static_cast<size_t>(width) * height;
+  counts_.resize(num_pixels, 0);
+  alphas_.resize(num_pixels, 0);
+  if (method_ == MEDIAN) {
+    quantiles_.resize(3 * num_pixels);
+  } else {
+    sums_.resize(3 * num_pixels, 0.0);
+  }
+  if (method_ == SIGMA_CLIP) {
+    squares_.resize(3 * num_pixels, 0.0);
+  }
+}
+
+int Coadd::num_passes(void) const {
+  return method_ == SIGMA_CLIP ? clip_iterations_ + 1 : 1;
+}
+
+// Each pass after the first clips around the statistics of the pass before
+// it.  Pixels that lost every sample keep their earlier statistics.
+void Coadd::StartPass(int pass) {
+  CHECK_EQ(pass, pass_ + 1);
+  CHECK_LT(pass, num_passes());
+  pass_ = pass;
+  if (pass == 0) return;
+
+  if (clip_means_.empty()) {
+    clip_means_.resize(sums_.size(), 0.0f);
+    clip_sigmas_.resize(sums_.size(), -1.0f);
+  }
+  for (size_t k = 0; k < counts_.size(); ++k) {
+    if (counts_[k] == 0) continue;
+    for (size_t c = 3 * k; c < 3 * k + 3; ++c) {
+      clip_means_[c] = static_cast<float>(sums_[c]);
+      clip_sigmas_[c] = static_cast<float>(sqrt(squares_[c] / counts_[k]));
+      sums_[c] = 0.0;
+      squares_[c] = 0.0;
+    }
+    counts_[k] = 0;
+  }
+}
+
+void Coadd::Add(int i, int j, const uint8 *rgba) {
+  CHECK_GTE(pass_, 0) << "StartPass() wasn't called";
+  if (rgba[3] == 0) return;
+  size_t k = static_cast<size_t>(j) * width_ + i;
+  alphas_[k] = max(alphas_[k], rgba[3]);
+
+  if (method_ == MEAN) {
+    for (int c = 0; c < 3; ++c) {
+      sums_[3 * k + c] += rgba[c];
+    }
+  } else if (method_ == MEDIAN) {
+    for (int c = 0; c < 3; ++c) {
+      AddToQuantile(rgba[c], counts_[k], &quantiles_[3 * k + c]);
+    }
+  } else {
+    if (pass_ > 0) {
+      for (int c = 0; c < 3; ++c) {
+        float sigma = clip_sigmas_[3 * k + c];
+        if (sigma < 0.0f) return;
+        double distance = max(clip_sigma_ * sigma, MIN_CLIP_DISTANCE);
+        if (fabs(rgba[c] - clip_means_[3 * k + c]) > distance) return;
+      }
+    }
+    // Welford's running mean and variance.
+    int count = counts_[k] + 1;
+    for (int c = 0; c < 3; ++c) {
+      double &mean = sums_[3 * k + c];
+      double delta = rgba[c] - mean;
+      mean += delta / count;
+      squares_[3 * k + c] += delta * (rgba[c] - mean);
+    }
+  }
+  ++counts_[k];
+}
+
+void Coadd::ToImage(Image *image) const {
+  CHECK(image->Resize(width_, height_, Image::RGBA))
+      << "Couldn't resize co-add image";
+  for (int j = 0; j < height_; ++j) {
+    uint8 *out = image->GetMutableRow(j);
+    for (int i = 0; i < width_; ++i, out += 4) {
+      size_t k = static_cast<size_t>(j) * width_ + i;
+      int count = counts_[k];
+      bool has_clip = !clip_sigmas_.empty() && clip_sigmas_[3 * k] >= 0.0f;
+      if (count == 0 && !has_clip) {
+        out[0] = out[1] = out[2] = out[3] = 0;
+        continue;
+      }
+      for (int c = 0; c < 3; ++c) {
+        double value;
+        if (method_ == MEAN) {
+          value = sums_[3 * k + c] / count;
+        } else if (method_ == MEDIAN) {
+          value = GetMedian(quantiles_[3 * k + c], count);
+        } else if (count > 0) {
+          value = sums_[3 * k + c];
+        } else {
+          value = clip_means_[3 * k + c];
+        }
+        out[c] = ToLevel(value);
+      }
+      out[3] = alphas_[k];
+    }
+  }
+}
+
+// The P-square algorithm keeps 5 markers at the minimum, the 1/4, 1/2, and
+// 3/4 quantiles, and the maximum.  Each sample moves the markers above it
+// up by one position, and the middle markers are then nudged towards their
+// desired positions, adjusting their heights with a piecewise parabolic
+// fit of the neighboring markers.
+void Coadd::AddToQuantile(float value, int count, Quantile *quantile) {
+  float *heights = quantile->heights;
+  int *positions = quantile->positions;
+  if (count < NUM_MARKERS) {
+    // Insertion sort the first samples.
+    int k = count;
+    while (k > 0 && heights[k - 1] > value) {
+      heights[k] = heights[k - 1];
+      --k;
+    }
+    heights[k] = value;
+    positions[count] = count;
+    return;
+  }
+
+  // Find the cell holding the sample, extending the extremes if needed.
+  int cell;
+  if (value < heights[0]) {
+    heights[0] = value;
+    cell = 0;
+  } else if (value >= heights[NUM_MARKERS - 1]) {
+    heights[NUM_MARKERS - 1] = value;
+    cell = NUM_MARKERS - 2;
+  } else {
+    cell = 0;
+    while (value >= heights[cell + 1]) ++cell;
+  }
+  for (int m = cell + 1; m < NUM_MARKERS; ++m) {
+    ++positions[m];
+  }
+
+  // Desired positions of the markers for the median, now that there are
+  // count + 1 samples.
+  static const double fractions[NUM_MARKERS] = { 0.0, 0.25, 0.5, 0.75, 1.0 };
+  for (int m = 1; m < NUM_MARKERS - 1; ++m) {
+    double desired = fractions[m] * count;
+    double offset = desired - positions[m];
+    if ((offset >= 1.0 && positions[m + 1] - positions[m] > 1) ||
+        (offset <= -1.0 && positions[m - 1] - positions[m] < -1)) {
+      int d = offset > 0.0 ? 1 : -1;
+      double below = positions[m] - positions[m - 1];
+      double above = positions[m + 1] - positions[m];
+      double height = heights[m] + d / (below + above) *
+          ((below + d) * (heights[m + 1] - heights[m]) / above +
+           (above - d) * (heights[m] - heights[m - 1]) / below);
+      if (heights[m - 1] < height && height < heights[m + 1]) {
+        heights[m] = static_cast<float>(height);
+      } else {
+        // The parabola overshoots, so interpolate linearly instead.
+        heights[m] += d * (heights[m + d] - heights[m]) /
+                      (positions[m + d] - positions[m]);
+      }
+      positions[m] += d;
+    }
+  }
+}
+
+// With fewer than 5 samples the heights are the sorted samples themselves.
+float Coadd::GetMedian(const Quantile &quantile, int count) {
+  if (count >= NUM_MARKERS) {
+    return quantile.heights[NUM_MARKERS / 2];
+  }
+  if (count % 2 == 1) {
+    return quantile.heights[count / 2];
+  }
+  return 0.5f * (quantile.heights[count / 2 - 1] +
+                 quantile.heights[count / 2]);
+}
+
+}  // namespace google_sky
@@ -0,0 +1,177 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// Defines the Coadd class for stacking overlapping images pixel by pixel
+
+#ifndef COADD_H__
+#define COADD_H__
+
+#include <vector>
+
+#include "base.h"
+
+namespace google_sky {
+
+// Forward declarations.
+class Image;
+
+// Class for co-adding images that have been warped onto the same pixels
+//
+// Rather than drawing the top image over the others, a co-add combines
+// every sample of each pixel: their mean, their median, or their mean after
+// sigma clipping.  Samples are added one image at a time and only a fixed
+// amount of state is kept per pixel, so the stack of images is never held
+// in memory:
+//
+// MEAN keeps running sums and a count.
+// MEDIAN keeps a P-square streaming quantile estimate (Jain and Chlamtac,
+//   1985), which is exact for up to 5 samples and an approximation after.
+// SIGMA_CLIP keeps running means and variances.  The images are added once
+//   per pass (see num_passes()), and each pass after the first only keeps
+//   samples within clip_sigma() standard deviations of the previous pass's
+//   mean in every channel.
+//
+// Samples with an alpha of 0 are ignored.  The alpha of each output pixel is
+// the largest alpha of its samples.
+//
+// Example Usage:
+//
+// Coadd coadd(Coadd::SIGMA_CLIP, 256, 256);
+// for (int pass = 0; pass < coadd.num_passes(); ++pass) {
+//   coadd.StartPass(pass);
+//   for (...each image...) {
+//     coadd.Add(i, j, rgba);  // For each pixel (i, j) the image covers.
+//   }
+// }
+// Image stack;
+// coadd.ToImage(&stack);
+
+class Coadd {
+ public:
+  // Ways of combining the samples of a pixel.
+  enum Method {
+    MEAN = 0,
+    MEDIAN,
+    SIGMA_CLIP
+  };
+
+  // Creates an empty co-add of width x height pixels.
+  Coadd(Method method, int width, int height);
+
+  ~Coadd() {
+    // Nothing needed.
+  }
+
+  // Returns the number of times every image must be added, which is 1
+  // except for SIGMA_CLIP.
+  int num_passes(void) const;
+
+  // Starts pass number pass, counting from 0.  Passes must be started in
+  // order, and the first must be started before adding samples.
+  void StartPass(int pass);
+
+  // Adds an RGBA sample for pixel (i, j).
+  void Add(int i, int j, const uint8 *rgba);
+
+  // Returns the co-added pixels as an RGBA image.  Pixels without samples
+  // are transparent.
+  void ToImage(Image *image) const;
+
+  // Returns the number of standard deviations beyond which SIGMA_CLIP
+  // rejects samples.
+  inline double clip_sigma(void) const {
+    return clip_sigma_;
+  }
+
+  // Sets the number of standard deviations beyond which SIGMA_CLIP rejects
+  // samples, 3 by default.
+  inline void set_clip_sigma(double clip_sigma) {
+    clip_sigma_ = clip_sigma;
+  }
+
+  // Returns the number of times SIGMA_CLIP clips the samples.
+  inline int clip_iterations(void) const {
+    return clip_iterations_;
+  }
+
+  // Sets the number of times SIGMA_CLIP clips the samples, 2 by default.
+  inline void set_clip_iterations(int clip_iterations) {
+    CHECK_GTE(clip_iterations, 0);
+    clip_iterations_ = clip_iterations;
+  }
+
+ private:
+  // The number of markers of the P-square estimate.
+  static const int NUM_MARKERS = 5;
+
+  // State of one channel of one pixel for MEDIAN.  Until there are
+  // NUM_MARKERS samples, heights holds them in sorted order.
+  struct Quantile {
+    float heights[NUM_MARKERS];
+    int positions[NUM_MARKERS];
+  };
+
+  Method method_;
+  int width_;
+  int height_;
+  int pass_;
+  double clip_sigma_;
+  int clip_iterations_;
+
+  // Number of samples of each pixel (in this pass for SIGMA_CLIP).
+  vector<int> counts_;
+
+  // Largest alpha of the samples of each pixel.
+  vector<uint8> alphas_;
+
+  // Sums of each channel for MEAN, or running means for SIGMA_CLIP.
+  vector<double> sums_;
+
+  // Running sums of squared differences from the mean for SIGMA_CLIP.
+  vector<double> squares_;
+
+  // Means and standard deviations of the previous pass for SIGMA_CLIP.
+  vector<float> clip_means_;
+  vector<float> clip_sigmas_;
+
+  // P-square estimates of each channel for MEDIAN.
+  vector<Quantile> quantiles_;
+
+  // Adds a sample to a P-square median estimate with count earlier
+  // samples.
+  static void AddToQuantile(float value, int count, Quantile *quantile);
+
+  // Returns the median estimate from a Quantile with count samples.
+  static float GetMedian(const Quantile &quantile, int count);
+
+  DISALLOW_COPY_AND_ASSIGN(Coadd);
+};
+
+}  // namespace google_sky
+
+#endif  // COADD_H__
@@ -0,0 +1,135 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <cstdlib>
+
+#include <iostream>
+
+#include "base.h"
+#include "coadd.h"
+#include "image.h"
+
+namespace google_sky {
+
+// Adds a gray sample with the given level and alpha to pixel (i, j).
+void AddGray(int i, int j, uint8 level, uint8 alpha, Coadd *coadd) {
+  uint8 rgba[4] = { level, level, level, alpha };
+  coadd->Add(i, j, rgba);
+}
+
+int Main(int argc, char **argv) {
+  {
+    cout << "Testing MEAN... ";
+    Coadd coadd(Coadd::MEAN, 2, 1);
+    ASSERT_EQ(1, coadd.num_passes());
+    coadd.StartPass(0);
+    AddGray(0, 0, 10, 255, &coadd);
+    AddGray(0, 0, 20, 128, &coadd);
+    AddGray(0, 0, 200, 0, &coadd);  // Ignored.
+    AddGray(0, 0, 31, 255, &coadd);
+
+    Image image;
+    coadd.ToImage(&image);
+    ASSERT_TRUE(image.colorspace() == Image::RGBA);
+    ASSERT_EQ(2, image.width());
+    ASSERT_EQ(1, image.height());
+    const uint8 *pixel = image.GetRow(0);
+    ASSERT_EQ(20, pixel[0]);
+    ASSERT_EQ(20, pixel[2]);
+    ASSERT_EQ(255, pixel[3]);
+
+    // No samples.
+    ASSERT_EQ(0, pixel[7]);
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing MEDIAN... ";
+    Coadd coadd(Coadd::MEDIAN, 3, 1);
+    coadd.StartPass(0);
+
+    // Exact for few samples.
+    int levels[] = { 50, 10, 200, 30 };
+    for (int k = 0; k < 4; ++k) {
+      AddGray(0, 0, levels[k], 128, &coadd);
+      if (k < 3) AddGray(1, 0, levels[k], 128, &coadd);
+    }
+
+    // Close for many samples, despite outliers.
+    srand(1);
+    for (int k = 0; k < 1000; ++k) {
+      int level = k % 10 == 0 ? 255 : 100 + rand() % 21;
+      AddGray(2, 0, level, 255, &coadd);
+    }
+
+    Image image;
+    coadd.ToImage(&image);
+    const uint8 *pixel = image.GetRow(0);
+    ASSERT_EQ(40, pixel[0]);
+    ASSERT_EQ(128, pixel[3]);
+    ASSERT_EQ(50, pixel[4]);
+    ASSERT_TRUE(abs(pixel[8] - 111) <= 3);
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing SIGMA_CLIP... ";
+    Coadd coadd(Coadd::SIGMA_CLIP, 2, 1);
+    coadd.set_clip_sigma(2.0);
+    coadd.set_clip_iterations(2);
+    ASSERT_EQ(3, coadd.num_passes());
+
+    // One outlier among similar samples, and identical samples.
+    int levels[] = { 100, 102, 98, 101, 99, 100, 250 };
+    for (int pass = 0; pass < coadd.num_passes(); ++pass) {
+      coadd.StartPass(pass);
+      for (int k = 0; k < 7; ++k) {
+        AddGray(0, 0, levels[k], 255, &coadd);
+        AddGray(1, 0, 60, 200, &coadd);
+      }
+    }
+
+    Image image;
+    coadd.ToImage(&image);
+    const uint8 *pixel = image.GetRow(0);
+    ASSERT_EQ(100, pixel[0]);
+    ASSERT_EQ(255, pixel[3]);
+    ASSERT_EQ(60, pixel[4]);
+    ASSERT_EQ(200, pixel[7]);
+    cout << "pass\n";
+  }
+
+  cout << "Passed\n";
+  return 0;
+}
+
+}  // namespace google_sky
+
+int main(int argc, char **argv) {
+  return google_sky::Main(argc, argv);
+}
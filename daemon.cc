@@ -0,0 +1,259 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "daemon.h"
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "string_util.h"
+
+namespace google_sky {
+
+namespace {
+
+// Number of clients that can wait to connect.
+const int LISTEN_BACKLOG = 16;
+
+}  // namespace
+
+const size_t DaemonRequest::MAX_BYTES;
+
+bool ReadDaemonRequestLine(FILE *fp, size_t max_bytes, string *line,
+                           bool *too_long) {
+  line->clear();
+  *too_long = false;
+  char buffer[4096];
+  bool read_any = false;
+  while (fgets(buffer, sizeof(buffer), fp)) {
+    read_any = true;
+    size_t length = strlen(buffer);
+    bool ends_line = length > 0 && buffer[length - 1] == '\n';
+    if (ends_line) --length;
+    if (!*too_long) {
+      if (line->size() + length > max_bytes) {
+        *too_long = true;
+        line->clear();
+      } else {
+        line->append(buffer, length);
+      }
+    }
+    if (ends_line) return true;
+  }
+  return read_any;
+}
+
+bool ParseDaemonRequest(const string &line, DaemonRequest *request,
+                        string *error) {
+  *request = DaemonRequest();
+  JsonObject object;
+  if (!object.Parse(line, error)) {
+    *error = "Bad request: " + *error;
+    return false;
+  }
+  request->id = object.GetRaw("id");
+  request->job.id = request->id;
+
+  if (object.Has("command")) {
+    string command;
+    if (!object.GetString("command", &command)) {
+      *error = "\"command\" must be a string";
+      return false;
+    }
+    if (command != "shutdown") {
+      *error = "Unknown command '" + command + "'";
+      return false;
+    }
+    request->type = DaemonRequest::SHUTDOWN;
+    return true;
+  }
+
+  BatchJob *job = &request->job;
+  const char *keys[] = { "fitsfile", "imagefile", "maskfile", "outfile",
+                         "kmlfile", "name" };
+  for (int i = 0; i < 6; ++i) {
+    if (!object.Has(keys[i])) continue;
+    string *field = FindJobField(keys[i], job);
+    if (!object.GetString(keys[i], field) || field->empty()) {
+      *error = StringPrintf("\"%s\" must be a non-empty string", keys[i]);
+      return false;
+    }
+  }
+  if (job->fitsfile.empty()) {
+    *error = "No fitsfile in request";
+    return false;
+  }
+  SetJobDefaults(job);
+  return true;
+}
+
+DaemonResponder::DaemonResponder(int fd, bool regionate)
+    : fd_(fd), regionate_(regionate), broken_(false) {
+  pthread_mutex_init(&mutex_, NULL);
+}
+
+DaemonResponder::~DaemonResponder() {
+  pthread_mutex_destroy(&mutex_);
+}
+
+void DaemonResponder::Respond(const string &id, const string &status,
+                              const string &error) {
+  JsonObject response;
+  response.SetRaw("id", id);
+  response.SetString("status", status);
+  if (!error.empty()) response.SetString("error", error);
+  Write(response);
+}
+
+void DaemonResponder::JobQueued(const BatchJob &job) {
+  Respond(job.id, "queued", "");
+}
+
+void DaemonResponder::JobStarted(const BatchJob &job) {
+  Respond(job.id, "started", "");
+}
+
+void DaemonResponder::JobFinished(const BatchJob &job, const string &error) {
+  if (!error.empty()) {
+    Respond(job.id, "failed", error);
+    return;
+  }
+  JsonObject response;
+  response.SetRaw("id", job.id);
+  response.SetString("status", "done");
+  if (regionate_) {
+    response.SetString("directory", JobTileDirectory(job));
+  } else {
+    response.SetString("outfile", job.outfile);
+  }
+  response.SetString("kmlfile", job.kmlfile);
+  Write(response);
+}
+
+void DaemonResponder::Write(const JsonObject &response) {
+  string line = response.ToString() + "\n";
+  pthread_mutex_lock(&mutex_);
+  size_t written = 0;
+  while (!broken_ && written < line.size()) {
+    ssize_t n = write(fd_, line.data() + written, line.size() - written);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) {
+      broken_ = true;
+    } else {
+      written += n;
+    }
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+bool ServeDaemonRequests(FILE *fp, DaemonResponder *responder,
+                         BatchScheduler *scheduler) {
+  string line;
+  bool too_long;
+  while (ReadDaemonRequestLine(fp, DaemonRequest::MAX_BYTES, &line,
+                               &too_long)) {
+    if (too_long) {
+      responder->Respond("null", "failed", StringPrintf(
+          "Request is longer than %d bytes",
+          static_cast<int>(DaemonRequest::MAX_BYTES)));
+      continue;
+    }
+    StringStripLeadingAndTrailingWhiteSpace(&line);
+    if (line.empty()) continue;
+
+    DaemonRequest request;
+    string error;
+    if (!ParseDaemonRequest(line, &request, &error)) {
+      responder->Respond(request.id, "failed", error);
+      continue;
+    }
+    if (request.type == DaemonRequest::SHUTDOWN) {
+      scheduler->Wait();
+      responder->Respond(request.id, "shutdown", "");
+      return false;
+    }
+    scheduler->Add(request.job, responder);
+  }
+  scheduler->Wait();
+  return true;
+}
+
+int ListenOnSocket(const string &path, string *error) {
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  if (path.size() >= sizeof(address.sun_path)) {
+    *error = StringPrintf("Socket path '%s' is too long", path.c_str());
+    return -1;
+  }
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, path.c_str());
+
+  struct stat info;
+  if (lstat(path.c_str(), &info) == 0 && S_ISSOCK(info.st_mode)) {
+    unlink(path.c_str());
+  }
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 ||
+      bind(fd, reinterpret_cast<struct sockaddr *>(&address),
+           sizeof(address)) != 0 ||
+      listen(fd, LISTEN_BACKLOG) != 0) {
+    *error = StringPrintf("Can't listen on socket '%s': %s", path.c_str(),
+                          strerror(errno));
+    if (fd >= 0) close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+bool ServeDaemonClients(int listen_fd, bool regionate,
+                        BatchScheduler *scheduler, string *error) {
+  while (true) {
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0) {
+      if (errno == EINTR) continue;
+      *error = StringPrintf("accept() failed: %s", strerror(errno));
+      return false;
+    }
+    FILE *fp = fdopen(fd, "r");
+    CHECK(fp != NULL);
+    DaemonResponder responder(fd, regionate);
+    bool running = ServeDaemonRequests(fp, &responder, scheduler);
+    fclose(fp);
+    if (!running) return true;
+  }
+}
+
+}  // namespace google_sky
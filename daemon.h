@@ -0,0 +1,133 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// Defines the protocol and serving loop of wcs2kml's --daemon mode
+
+#ifndef DAEMON_H__
+#define DAEMON_H__
+
+#include <pthread.h>
+
+#include <cstdio>
+#include <string>
+
+#include "base.h"
+#include "batch.h"
+#include "json.h"
+
+namespace google_sky {
+
+// A parsed --daemon request.
+struct DaemonRequest {
+  // Longest request line in bytes, not counting the newline.  Longer lines
+  // are rejected without being kept in memory.
+  static const size_t MAX_BYTES = 65536;
+
+  enum Type {
+    JOB,
+    SHUTDOWN
+  };
+
+  DaemonRequest() : type(JOB), id("null"), job() {}
+
+  Type type;
+  string id;  // JSON text of the request id, echoed in the responses.
+  BatchJob job;  // The job of a JOB request.
+};
+
+// Reads a request line from fp, without the newline.  A line longer than
+// max_bytes is skipped up to its newline and returned empty with too_long
+// set.  Returns false at the end of the input.
+bool ReadDaemonRequestLine(FILE *fp, size_t max_bytes, string *line,
+                           bool *too_long);
+
+// Parses a request line, which is a JSON object with the same keys as a
+// --batch manifest line plus an optional id, or {"command": "shutdown"}.
+// Returns false with a description of the problem in error if the request
+// is bad, in which case request->id is still set if the line could be
+// parsed.
+bool ParseDaemonRequest(const string &line, DaemonRequest *request,
+                        string *error);
+
+// Class for writing --daemon responses, one JSON object per line
+//
+// Jobs report from the scheduler's threads, so writes are serialized.  Once
+// a write fails (e.g. the client went away) later responses are dropped.
+class DaemonResponder : public JobObserver {
+ public:
+  // Writes responses to fd.  Jobs that regionate report their tile
+  // directory instead of their outfile.
+  DaemonResponder(int fd, bool regionate);
+
+  virtual ~DaemonResponder();
+
+  // Writes a response with the given request id and status, plus error if
+  // it isn't empty.
+  void Respond(const string &id, const string &status, const string &error);
+
+  virtual void JobQueued(const BatchJob &job);
+  virtual void JobStarted(const BatchJob &job);
+  virtual void JobFinished(const BatchJob &job, const string &error);
+
+ private:
+  int fd_;
+  bool regionate_;
+  bool broken_;
+
+  // Guards fd_ and broken_.
+  pthread_mutex_t mutex_;
+
+  void Write(const JsonObject &response);
+
+  // A DaemonResponder must be given a file descriptor.
+  DaemonResponder();
+
+  DISALLOW_COPY_AND_ASSIGN(DaemonResponder);
+};
+
+// Serves requests read from fp, writing responses with responder, until the
+// input ends or a shutdown command arrives.  Jobs are handed to scheduler,
+// which runs them once they fit within its memory budget.  Returns false if
+// a shutdown was requested.
+bool ServeDaemonRequests(FILE *fp, DaemonResponder *responder,
+                         BatchScheduler *scheduler);
+
+// Opens a Unix domain socket listening at path, replacing a stale socket
+// left by an earlier daemon.  Returns the socket, or -1 with a description
+// of the problem in error.
+int ListenOnSocket(const string &path, string *error);
+
+// Serves the clients of listen_fd one at a time with ServeDaemonRequests()
+// until one of them sends a shutdown command.  Returns false with a
+// description of the problem in error if accepting a client fails.
+bool ServeDaemonClients(int listen_fd, bool regionate,
+                        BatchScheduler *scheduler, string *error);
+
+}  // namespace google_sky
+
+#endif  // DAEMON_H__
@@ -0,0 +1,249 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <cstdio>
+
+#include <iostream>
+#include <string>
+
+#include "base.h"
+#include "batch.h"
+#include "daemon.h"
+#include "string_util.h"
+#include "test_util.h"
+
+namespace google_sky {
+
+// A FITS header with a WCS but no image size, which the PNG file supplies.
+static const char *FITS_FILENAME = "testdata/fpC-001478-g3-0022_small.fits";
+static const char *PNG_FILENAME = "testdata/fpC-001478-g3-0022_small.png";
+
+// Runs jobs without doing anything.
+class NullRunner : public JobRunner {
+ public:
+  NullRunner() {}
+
+  virtual int64 EstimateMemory(const BatchJob &job, int width,
+                               int height) const {
+    return 0;
+  }
+
+  virtual bool Run(const BatchJob &job, const WcsProjection &wcs, int width,
+                   int height, string *error) {
+    return true;
+  }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(NullRunner);
+};
+
+// Opens filename for writing responses to, replacing its contents.
+int OpenResponseFile(const string &filename) {
+  int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRWXU);
+  ASSERT_TRUE(fd >= 0);
+  return fd;
+}
+
+int Main(int argc, char **argv) {
+  {
+    cout << "Testing ParseDaemonRequest()... ";
+    DaemonRequest request;
+    string error;
+    ASSERT_TRUE(ParseDaemonRequest(
+        "{\"id\": 7, \"fitsfile\": \"foo.fits\", \"imagefile\": \"foo.png\"}",
+        &request, &error));
+    ASSERT_TRUE(request.type == DaemonRequest::JOB);
+    ASSERT_EQ("7", request.id);
+    ASSERT_EQ("7", request.job.id);
+    ASSERT_EQ("foo.fits", request.job.fitsfile);
+    ASSERT_EQ("foo.png", request.job.imagefile);
+    ASSERT_EQ("foo_warped.png", request.job.outfile);
+    ASSERT_EQ("foo.kml", request.job.kmlfile);
+
+    ASSERT_TRUE(ParseDaemonRequest("{\"fitsfile\": \"foo.fits\"}", &request,
+                                   &error));
+    ASSERT_EQ("null", request.id);
+
+    ASSERT_TRUE(ParseDaemonRequest(
+        "{\"id\": \"last\", \"command\": \"shutdown\"}", &request, &error));
+    ASSERT_TRUE(request.type == DaemonRequest::SHUTDOWN);
+    ASSERT_EQ("\"last\"", request.id);
+
+    // Bad requests keep their id when it can be read.
+    ASSERT_FALSE(ParseDaemonRequest("{\"id\": 3, \"command\": \"restart\"}",
+                                    &request, &error));
+    ASSERT_EQ("3", request.id);
+    ASSERT_EQ("Unknown command 'restart'", error);
+    ASSERT_FALSE(ParseDaemonRequest("{\"command\": 1}", &request, &error));
+    ASSERT_EQ("\"command\" must be a string", error);
+    ASSERT_FALSE(ParseDaemonRequest("{\"id\": 4, \"fitsfile\": 5}", &request,
+                                    &error));
+    ASSERT_EQ("4", request.id);
+    ASSERT_EQ("\"fitsfile\" must be a non-empty string", error);
+    ASSERT_FALSE(ParseDaemonRequest("{\"fitsfile\": \"\"}", &request,
+                                    &error));
+    ASSERT_EQ("\"fitsfile\" must be a non-empty string", error);
+    ASSERT_FALSE(ParseDaemonRequest("{\"imagefile\": \"foo.png\"}", &request,
+                                    &error));
+    ASSERT_EQ("No fitsfile in request", error);
+
+    // Malformed JSON.
+    const char *malformed[] = { "fitsfile=foo.fits", "{\"fitsfile\": ",
+                                "{\"fitsfile\": [\"foo.fits\"]}",
+                                "{\"id\": 1} {\"id\": 2}" };
+    for (int i = 0; i < 4; ++i) {
+      ASSERT_FALSE(ParseDaemonRequest(malformed[i], &request, &error));
+      ASSERT_EQ("null", request.id);
+      ASSERT_TRUE(StringStartsWith(error, "Bad request: "));
+    }
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing ReadDaemonRequestLine()... ";
+    const char *filename = "daemon_test_requests.txt";
+    string long_line(10000, 'a');
+    WriteFile(filename, "short\n" + string(100, 'x') + "\n" + long_line +
+              "\nafter\nlast");
+    FILE *fp = fopen(filename, "r");
+    ASSERT_TRUE(fp != NULL);
+    string line;
+    bool too_long;
+    ASSERT_TRUE(ReadDaemonRequestLine(fp, 50, &line, &too_long));
+    ASSERT_EQ("short", line);
+    ASSERT_FALSE(too_long);
+
+    // Oversized lines are skipped whole, even across reads.
+    ASSERT_TRUE(ReadDaemonRequestLine(fp, 50, &line, &too_long));
+    ASSERT_TRUE(too_long);
+    ASSERT_TRUE(line.empty());
+    ASSERT_TRUE(ReadDaemonRequestLine(fp, 50, &line, &too_long));
+    ASSERT_TRUE(too_long);
+    ASSERT_TRUE(ReadDaemonRequestLine(fp, 50, &line, &too_long));
+    ASSERT_EQ("after", line);
+    ASSERT_FALSE(too_long);
+
+    // The last line doesn't need a newline.
+    ASSERT_TRUE(ReadDaemonRequestLine(fp, 50, &line, &too_long));
+    ASSERT_EQ("last", line);
+    ASSERT_FALSE(ReadDaemonRequestLine(fp, 50, &line, &too_long));
+    fclose(fp);
+
+    // Lines longer than the read buffer are put back together.
+    fp = fopen(filename, "r");
+    ASSERT_TRUE(ReadDaemonRequestLine(fp, 20000, &line, &too_long));
+    ASSERT_TRUE(ReadDaemonRequestLine(fp, 20000, &line, &too_long));
+    ASSERT_TRUE(ReadDaemonRequestLine(fp, 20000, &line, &too_long));
+    ASSERT_FALSE(too_long);
+    ASSERT_TRUE(line == long_line);
+    fclose(fp);
+    remove(filename);
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing ServeDaemonRequests()... ";
+    const char *requests = "daemon_test_requests.txt";
+    const char *responses = "daemon_test_responses.txt";
+    string job = StringPrintf("\"fitsfile\": \"%s\", \"imagefile\": \"%s\"",
+                              FITS_FILENAME, PNG_FILENAME);
+    WriteFile(requests,
+              string(DaemonRequest::MAX_BYTES + 1, ' ') + "\n" +
+              "garbage\n"
+              "\n"
+              "{\"id\": 1, " + job + "}\n"
+              "{\"id\": 2, \"fitsfile\": \"daemon_test_missing.fits\"}\n"
+              "{\"id\": 3, \"command\": \"shutdown\"}\n"
+              "{\"id\": 4, " + job + "}\n");
+
+    NullRunner runner;
+    int fd = OpenResponseFile(responses);
+    FILE *fp = fopen(requests, "r");
+    ASSERT_TRUE(fp != NULL);
+    {
+      BatchScheduler scheduler(&runner, 1, 1000, NULL);
+      DaemonResponder responder(fd, false);
+      ASSERT_FALSE(ServeDaemonRequests(fp, &responder, &scheduler));
+    }
+    fclose(fp);
+    close(fd);
+
+    string expected = StringPrintf(
+        "{\"id\":null,\"status\":\"failed\","
+        "\"error\":\"Request is longer than %d bytes\"}\n",
+        static_cast<int>(DaemonRequest::MAX_BYTES));
+    string actual = ReadFile(responses);
+    ASSERT_TRUE(StringStartsWith(actual, expected));
+    actual.erase(0, expected.size());
+    expected = "{\"id\":null,\"status\":\"failed\",\"error\":\"Bad request: ";
+    ASSERT_TRUE(StringStartsWith(actual, expected));
+    actual.erase(0, actual.find('\n') + 1);
+    expected =
+        "{\"id\":1,\"status\":\"queued\"}\n"
+        "{\"id\":1,\"status\":\"started\"}\n"
+        "{\"id\":1,\"status\":\"done\","
+        "\"outfile\":\"testdata/fpC-001478-g3-0022_small_warped.png\","
+        "\"kmlfile\":\"testdata/fpC-001478-g3-0022_small.kml\"}\n"
+        "{\"id\":2,\"status\":\"failed\","
+        "\"error\":\"Can't open FITS file daemon_test_missing.fits\"}\n"
+        "{\"id\":3,\"status\":\"shutdown\"}\n";
+    ASSERT_EQ(expected, actual);
+
+    // Jobs that regionate report their tile directory.
+    fd = OpenResponseFile(responses);
+    {
+      DaemonResponder responder(fd, true);
+      BatchJob regionated;
+      regionated.id = "5";
+      regionated.fitsfile = "foo.fits";
+      SetJobDefaults(&regionated);
+      responder.JobFinished(regionated, "");
+    }
+    close(fd);
+    ASSERT_EQ("{\"id\":5,\"status\":\"done\","
+              "\"directory\":\"foo_warped_tiles\","
+              "\"kmlfile\":\"foo.kml\"}\n", ReadFile(responses));
+    remove(requests);
+    remove(responses);
+    cout << "pass\n";
+  }
+
+  cout << "Passed\n";
+  return 0;
+}
+
+}  // namespace google_sky
+
+int main(int argc, char **argv) {
+  return google_sky::Main(argc, argv);
+}
@@ -0,0 +1,74 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "file_util.h"
+
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <cstdio>
+#include <string>
+
+namespace google_sky {
+
+bool MakeDirectory(const string &path) {
+  return mkdir(path.c_str(),
+               S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) == 0 ||
+         errno == EEXIST;
+}
+
+bool FileExists(const string &path) {
+  struct stat info;
+  return stat(path.c_str(), &info) == 0;
+}
+
+bool CopyFile(const string &from, const string &to) {
+  FILE *in = fopen(from.c_str(), "rb");
+  if (!in) return false;
+  string temporary = to + ".tmp";
+  FILE *out = fopen(temporary.c_str(), "wb");
+  if (!out) {
+    fclose(in);
+    return false;
+  }
+  char buffer[65536];
+  size_t n;
+  bool success = true;
+  while (success && (n = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+    success = fwrite(buffer, 1, n, out) == n;
+  }
+  if (ferror(in)) success = false;
+  fclose(in);
+  if (fclose(out) != 0) success = false;
+  if (success && rename(temporary.c_str(), to.c_str()) != 0) success = false;
+  if (!success) remove(temporary.c_str());
+  return success;
+}
+
+}  // namespace google_sky
@@ -0,0 +1,106 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <iostream>
+#include <string>
+
+#include "base.h"
+#include "file_util.h"
+
+namespace google_sky {
+
+int Main(int argc, char **argv) {
+  // Test MakeDirectory() and FileExists().
+  {
+    cout << "Testing MakeDirectory() and FileExists()... ";
+    ASSERT_TRUE(system("rm -rf file_util_test_dir") == 0);
+    ASSERT_FALSE(FileExists("file_util_test_dir"));
+    ASSERT_TRUE(MakeDirectory("file_util_test_dir"));
+    ASSERT_TRUE(FileExists("file_util_test_dir"));
+
+    // Making an existing directory succeeds, but making one inside a
+    // missing directory fails.
+    ASSERT_TRUE(MakeDirectory("file_util_test_dir"));
+    ASSERT_FALSE(MakeDirectory("file_util_test_dir/missing/child"));
+    ASSERT_FALSE(FileExists("file_util_test_dir/missing"));
+
+    FILE *fp = fopen("file_util_test_dir/file", "w");
+    ASSERT_TRUE(fp != NULL);
+    fclose(fp);
+    ASSERT_TRUE(FileExists("file_util_test_dir/file"));
+
+    ASSERT_TRUE(system("rm -rf file_util_test_dir") == 0);
+    cout << "pass\n";
+  }
+
+  // Test CopyFile().
+  {
+    cout << "Testing CopyFile()... ";
+    ASSERT_TRUE(system("rm -rf file_util_test_dir") == 0);
+    ASSERT_TRUE(MakeDirectory("file_util_test_dir"));
+    string contents(100000, 'x');
+    contents[12345] = '\0';
+    FILE *fp = fopen("file_util_test_dir/from", "wb");
+    ASSERT_TRUE(fp != NULL);
+    ASSERT_TRUE(fwrite(contents.data(), 1, contents.size(), fp) ==
+                contents.size());
+    fclose(fp);
+    ASSERT_TRUE(CopyFile("file_util_test_dir/from", "file_util_test_dir/to"));
+
+    string copy(contents.size() + 1, ' ');
+    fp = fopen("file_util_test_dir/to", "rb");
+    ASSERT_TRUE(fp != NULL);
+    ASSERT_TRUE(fread(&copy[0], 1, copy.size(), fp) == contents.size());
+    fclose(fp);
+    copy.resize(contents.size());
+    ASSERT_TRUE(copy == contents);
+
+    // A failed copy leaves the destination and no temporary file behind.
+    ASSERT_FALSE(CopyFile("file_util_test_dir/missing",
+                          "file_util_test_dir/to"));
+    ASSERT_FALSE(CopyFile("file_util_test_dir/from",
+                          "file_util_test_dir/missing/to"));
+    ASSERT_TRUE(FileExists("file_util_test_dir/to"));
+    ASSERT_FALSE(FileExists("file_util_test_dir/to.tmp"));
+
+    ASSERT_TRUE(system("rm -rf file_util_test_dir") == 0);
+    cout << "pass\n";
+  }
+
+  cout << "Passed\n";
+  return 0;
+}
+
+}  // namespace google_sky
+
+int main(int argc, char **argv) {
+  return google_sky::Main(argc, argv);
+}
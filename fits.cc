@@ -28,12 +28,17 @@
 
 #include "fits.h"
 
+#include <cmath>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 
 #include <string>
+#include <vector>
 
+#include <zlib.h>
+
+#include "fitscompression.h"
 #include "string_util.h"
 
 namespace {
@@ -43,12 +48,172 @@ static const int FITS_BLOCK_SIZE = 2880;
 static const int FITS_CARD_SIZE = 80;
 static const int FITS_KEYWORD_SIZE = 8;
 
+// Values start after the "= " in column 10 of a card.
+static const int FITS_VALUE_START = 10;
+
 // Returns whether a FITS card equals value, examining only characters up to
 // num_chars.
 bool CardEqual(const char *card, const char *value, int num_chars) {
   return strncmp(card, value, num_chars) == 0;
 }
 
+// Returns the index of the card for the given keyword or -1 if not found.
+int FindCard(const string &header, const string &keyword) {
+  CHECK_LTE(static_cast<int>(keyword.size()), FITS_KEYWORD_SIZE)
+      << "Invalid FITS keyword '" << keyword << "' (too long)";
+
+  // Keywords are left justified and padded with spaces to 8 characters.
+  string padded_keyword(keyword);
+  padded_keyword.resize(FITS_KEYWORD_SIZE, ' ');
+
+  for (int i = 0; i + FITS_KEYWORD_SIZE <= static_cast<int>(header.size());
+       i += FITS_CARD_SIZE) {
+    if (header.compare(i, FITS_KEYWORD_SIZE, padded_keyword) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// Returns the value portion of the card at index with any trailing comment
+// and surrounding whitespace removed.  String values are returned with their
+// quotes intact.
+string CardValue(const string &header, int index) {
+  int end = index + FITS_CARD_SIZE;
+  if (end > static_cast<int>(header.size())) {
+    end = header.size();
+  }
+  int start = index + FITS_VALUE_START;
+  if (start >= end) return "";
+
+  string value = header.substr(start, end - start);
+  google_sky::StringStripLeadingWhiteSpace(&value);
+
+  if (!value.empty() && value[0] == '\'') {
+    // Quotes inside of strings are escaped by doubling them.
+    size_t i = 1;
+    while (i < value.size()) {
+      if (value[i] == '\'') {
+        if (i + 1 < value.size() && value[i + 1] == '\'') {
+          i += 2;
+          continue;
+        }
+        break;
+      }
+      ++i;
+    }
+    return value.substr(0, i + 1);
+  }
+
+  size_t slash = value.find('/');
+  if (slash != string::npos) {
+    value = value.substr(0, slash);
+  }
+  google_sky::StringStripTrailingWhiteSpace(&value);
+  return value;
+}
+
+// Rounds size up to the next multiple of the FITS block size.
+long PadToBlock(long size) {
+  return ((size + FITS_BLOCK_SIZE - 1) / FITS_BLOCK_SIZE) * FITS_BLOCK_SIZE;
+}
+
+// Reads the header starting at offset from a file opened with gzopen() (which
+// reads uncompressed files too).  Only the cards up to END are read, so for
+// gzipped files just the blocks before and including the header are
+// inflated.  Returns false if offset is at the end of the file, leaving
+// error empty, or with a description of the problem in error if there is
+// no complete header at offset.
+bool TryReadHeaderFromStream(gzFile fp, const string &fits_filename,
+                             long offset, string *header, string *error) {
+  header->clear();
+  error->clear();
+
+  if (gzseek(fp, offset, SEEK_SET) != offset) {
+    *error = google_sky::StringPrintf(
+        "Can't seek to position %ld in FITS file %s", offset,
+        fits_filename.c_str());
+    return false;
+  }
+
+  // Buffer for holding each keyword entry in a FITS header.
+  char card[FITS_CARD_SIZE + 1];
+  card[FITS_CARD_SIZE] = '\0';
+
+  // Check first keyword.
+  int num_read = gzread(fp, card, FITS_CARD_SIZE);
+  if (num_read == 0 && gzeof(fp)) {
+    return false;
+  }
+  if (num_read != FITS_CARD_SIZE) {
+    *error = "Couldn't read from FITS file " + fits_filename;
+    return false;
+  }
+
+  if (!CardEqual(card, "SIMPLE", 6) && !CardEqual(card, "XTENSION", 8)) {
+    *error = google_sky::StringPrintf(
+        "Input file '%s' isn't a valid FITS file (or offset %ld isn't the "
+        "start of an HDU)", fits_filename.c_str(), offset);
+    return false;
+  }
+  header->append(card, FITS_CARD_SIZE);
+
+  // Read other keywords until END is found or EOF is reached.
+  while (true) {
+    num_read = gzread(fp, card, FITS_CARD_SIZE);
+    if (num_read != FITS_CARD_SIZE) {
+      if (gzeof(fp)) {
+        *error = "Found EOF before END card in " + fits_filename;
+      } else {
+        *error = "Unknown IO error in FITS file " + fits_filename;
+      }
+      return false;
+    }
+
+    header->append(card, FITS_CARD_SIZE);
+    if (CardEqual(card, "END", 3)) {
+      break;
+    }
+  }
+  return true;
+}
+
+// Like TryReadHeaderFromStream(), but dies on any error other than offset
+// being at the end of the file.
+bool ReadHeaderFromStream(gzFile fp, const string &fits_filename,
+                          long offset, string *header) {
+  string error;
+  if (TryReadHeaderFromStream(fp, fits_filename, offset, header, &error)) {
+    return true;
+  }
+  CHECK(error.empty()) << error;
+  return false;
+}
+
+// Returns whether header describes an image (see Fits::FindImageHdu()).
+bool IsImageHeader(const string &header) {
+  if (google_sky::FitsCompression::IsCompressedImage(header)) {
+    return true;
+  }
+
+  bool is_primary = CardEqual(header.c_str(), "SIMPLE", 6);
+  string xtension = google_sky::Fits::HeaderReadKeywordString(header,
+                                                              "XTENSION", "");
+  if (!is_primary && xtension != "IMAGE") {
+    return false;
+  }
+
+  return google_sky::Fits::HeaderReadKeywordInt(header, "NAXIS", 0) >= 2 &&
+         google_sky::Fits::HeaderReadKeywordInt(header, "NAXIS1", 0) > 0 &&
+         google_sky::Fits::HeaderReadKeywordInt(header, "NAXIS2", 0) > 0;
+}
+
+bool IsTableHeader(const string &header) {
+  return google_sky::Fits::HeaderReadKeywordString(header, "XTENSION", "") ==
+             "BINTABLE" &&
+         !google_sky::FitsCompression::IsCompressedImage(header);
+}
+
 }  // namespace
 
 namespace google_sky {
@@ -58,52 +223,208 @@ namespace google_sky {
 // such, this function will read the text from any file beginning with the
 // string 'SIMPLE' in chunks of size FITS_CARD_SIZE (FITS_BLOCK_SIZE = 36 *
 // FITS_CARD_SIZE) up to EOF or the string 'END' is found at the start of
-// the chunk.
+// the chunk.  Gzipped files are inflated on the fly.
 void Fits::ReadHeader(const string &fits_filename, long offset,
                       string *header) {
-  // Erase previous contents.
-  header->clear();
+  // Read header line by line.  zlib transparently handles files that aren't
+  // compressed.
+  gzFile fp = gzopen(fits_filename.c_str(), "rb");
+  CHECK(fp != NULL) << "Can't open FITS file " << fits_filename;
 
-  // Buffer for holding each keyword entry in a FITS header.
-  char *card = new char[FITS_CARD_SIZE + 1];
-  card[FITS_CARD_SIZE] = '\0';
+  CHECK(ReadHeaderFromStream(fp, fits_filename, offset, header))
+      << "Couldn't read from FITS file " << fits_filename;
+  gzclose(fp);
+}
+
+// Walks the HDUs in the file until one containing an image is found.
+bool Fits::FindImageHdu(const string &fits_filename, long *offset,
+                        string *header) {
+  vector<long> offsets;
+  vector<string> headers;
+  FindHdusInFile(fits_filename, IsImageHeader, 1, &offsets, &headers);
+  if (offsets.empty()) {
+    header->clear();
+    return false;
+  }
+
+  *offset = offsets[0];
+  header->assign(headers[0]);
+  return true;
+}
+
+// Walks the HDUs of an open stream until one containing an image is found.
+bool Fits::FindImageHdu(gzFile fp, const string &fits_filename, long *offset,
+                        string *header) {
+  vector<long> offsets;
+  vector<string> headers;
+  FindHdusInStream(fp, fits_filename, IsImageHeader, 1, &offsets, &headers);
+  if (offsets.empty()) {
+    header->clear();
+    return false;
+  }
+
+  *offset = offsets[0];
+  header->assign(headers[0]);
+  return true;
+}
+
+// Reads every header in the file in a single pass.
+void Fits::FindImageHdus(const string &fits_filename, vector<long> *offsets,
+                         vector<string> *headers) {
+  FindHdusInFile(fits_filename, IsImageHeader, -1, offsets, headers);
+}
+
+// Walks the HDUs in the file until one containing a table is found.
+bool Fits::FindTableHdu(const string &fits_filename, long *offset,
+                        string *header) {
+  vector<long> offsets;
+  vector<string> headers;
+  FindHdusInFile(fits_filename, IsTableHeader, 1, &offsets, &headers);
+  if (offsets.empty()) {
+    header->clear();
+    return false;
+  }
+
+  *offset = offsets[0];
+  header->assign(headers[0]);
+  return true;
+}
 
-  // Read header line by line.
-  FILE *fp = fopen(fits_filename.c_str(), "r");
+// Each HDU is a header followed by a data unit whose size is given by the
+// header, so only the headers need to be read.  The file is kept open
+// between HDUs so that gzipped files are inflated only once.
+void Fits::FindHdusInFile(const string &fits_filename,
+                          bool (*accept)(const string &header),
+                          int max_hdus, vector<long> *offsets,
+                          vector<string> *headers) {
+  gzFile fp = gzopen(fits_filename.c_str(), "rb");
   CHECK(fp != NULL) << "Can't open FITS file " << fits_filename;
+  FindHdusInStream(fp, fits_filename, accept, max_hdus, offsets, headers);
+  gzclose(fp);
+}
 
-  CHECK_EQ(fseek(fp, offset, SEEK_SET), 0)
-      << "Can't seek to position " << offset << " in FITS file "
-      << fits_filename;
+// The loop stops as soon as max_hdus headers are found, leaving the stream
+// just past the last header that was accepted.
+void Fits::FindHdusInStream(gzFile fp, const string &fits_filename,
+                            bool (*accept)(const string &header),
+                            int max_hdus, vector<long> *offsets,
+                            vector<string> *headers) {
+  offsets->clear();
+  headers->clear();
+
+  long position = 0;
+  string header;
+  while (max_hdus < 0 || static_cast<int>(offsets->size()) < max_hdus) {
+    if (!ReadHeaderFromStream(fp, fits_filename, position, &header)) {
+      break;
+    }
+    if (accept(header)) {
+      offsets->push_back(position);
+      headers->push_back(header);
+    }
+    position += PaddedHeaderSize(header) + PaddedDataSize(header);
+  }
+}
 
-  // Check first keyword.
-  int num_read = fread(card, sizeof(char), FITS_CARD_SIZE, fp);
-  CHECK_EQ(num_read, FITS_CARD_SIZE) << "Couldn't read from FITS file "
-                                     << fits_filename;
+// Reads the header for the image in the file, falling back on the primary
+// header for files that only carry a WCS.
+void Fits::ReadImageHeader(const string &fits_filename, string *header) {
+  long offset;
+  string image_header;
+  if (!FindImageHdu(fits_filename, &offset, &image_header)) {
+    ReadHeader(fits_filename, 0, header);
+    return;
+  }
 
-  CHECK(CardEqual(card, "SIMPLE", 6)) << "Input file '" << fits_filename
-                                      << "' isn't a valid FITS file";
-  header->append(card, FITS_CARD_SIZE);
+  if (FitsCompression::IsCompressedImage(image_header)) {
+    FitsCompression::ConvertHeader(image_header, header);
+  } else {
+    header->assign(image_header);
+  }
 
-  // Read other keywords until END is found or EOF is reached.
+  // Multi-extension files often keep the WCS in the primary header only.
+  if (offset > 0 && !HeaderHasKeyword(*header, "CTYPE1")) {
+    string primary_header;
+    ReadHeader(fits_filename, 0, &primary_header);
+    if (HeaderHasKeyword(primary_header, "CTYPE1")) {
+      InheritKeywords(primary_header, header);
+    }
+  }
+}
+
+// Repeats the walk of ReadImageHeader() without dying on bad headers.
+bool Fits::CheckImageHeader(const string &fits_filename, string *error) {
+  gzFile fp = gzopen(fits_filename.c_str(), "rb");
+  if (fp == NULL) {
+    *error = "Can't open FITS file " + fits_filename;
+    return false;
+  }
+
+  bool success = true;
+  long position = 0;
+  string header;
   while (true) {
-    num_read = fread(card, sizeof(char), FITS_CARD_SIZE, fp);
-    if (num_read != FITS_CARD_SIZE) {
-      if (feof(fp)) {
-        CHECK(false) << "Found EOF before END card in " << fits_filename;
-      } else {
-        CHECK(false) << "Unknown IO error in FITS file " << fits_filename;
+    if (!TryReadHeaderFromStream(fp, fits_filename, position, &header,
+                                 error)) {
+      if (error->empty() && position == 0) {
+        *error = "FITS file " + fits_filename + " is empty";
       }
-    }
-    
-    header->append(card, FITS_CARD_SIZE);
-    if (CardEqual(card, "END", 3)) {
+      success = error->empty();
       break;
     }
+    if (IsImageHeader(header)) break;
+    position += PaddedHeaderSize(header) + PaddedDataSize(header);
   }
+  gzclose(fp);
+  return success;
+}
 
-  delete[] card;
-  fclose(fp);
+// Follows the FITS INHERIT convention: every keyword of the primary header
+// that the extension lacks is copied in before END, except for the keywords
+// describing the primary data unit and commentary cards.
+void Fits::InheritKeywords(const string &primary_header, string *header) {
+  int end = FindCard(*header, "END");
+  CHECK_GTE(end, 0) << "Header lacks END keyword";
+
+  string inherited;
+  for (int i = 0; i + FITS_CARD_SIZE <= static_cast<int>(primary_header.size());
+       i += FITS_CARD_SIZE) {
+    string keyword = primary_header.substr(i, FITS_KEYWORD_SIZE);
+    StringStripTrailingWhiteSpace(&keyword);
+    if (keyword.empty() || keyword == "END" || keyword == "SIMPLE" ||
+        keyword == "BITPIX" || keyword == "EXTEND" ||
+        keyword == "COMMENT" || keyword == "HISTORY" ||
+        keyword.compare(0, 5, "NAXIS") == 0 ||
+        HeaderHasKeyword(*header, keyword)) {
+      continue;
+    }
+    inherited.append(primary_header, i, FITS_CARD_SIZE);
+  }
+  header->insert(end, inherited);
+}
+
+// Headers occupy a whole number of blocks on disk.
+long Fits::PaddedHeaderSize(const string &header) {
+  return PadToBlock(static_cast<long>(header.size()));
+}
+
+// Computes the data size using the formula from the FITS standard:
+// |BITPIX| / 8 * GCOUNT * (PCOUNT + NAXIS1 * NAXIS2 * ... * NAXISn).
+long Fits::PaddedDataSize(const string &header) {
+  int naxis = HeaderReadKeywordInt(header, "NAXIS", 0);
+  if (naxis <= 0) return 0;
+
+  int64 num_values = 1;
+  for (int i = 1; i <= naxis; ++i) {
+    num_values *= HeaderReadKeywordInt64(header, StringPrintf("NAXIS%d", i),
+                                         0);
+  }
+
+  int bitpix = HeaderReadKeywordInt(header, "BITPIX", 8);
+  int64 pcount = HeaderReadKeywordInt64(header, "PCOUNT", 0);
+  int64 gcount = HeaderReadKeywordInt64(header, "GCOUNT", 1);
+  int64 size = (abs(bitpix) / 8) * gcount * (pcount + num_values);
+  return PadToBlock(static_cast<long>(size));
 }
 
 // Adds NAXIS1 = image and NAXIS2 = height to the input header if they are
@@ -221,4 +542,169 @@ int Fits::HeaderReadKeywordInt(const string &header,
   return default_value;
 }
 
+// Reads a 64 bit integer keyword and returns its value or default_value if
+// not found.
+int64 Fits::HeaderReadKeywordInt64(const string &header,
+                                   const string &keyword,
+                                   int64 default_value) {
+  int index = FindCard(header, keyword);
+  if (index < 0) return default_value;
+  string value = CardValue(header, index);
+  if (value.empty()) return default_value;
+  return strtoll(value.c_str(), NULL, 10);
+}
+
+// Reads a floating point keyword and returns its value or default_value if
+// not found.  Fortran style exponents (1.0D+01) are accepted.
+double Fits::HeaderReadKeywordDouble(const string &header,
+                                     const string &keyword,
+                                     double default_value) {
+  int index = FindCard(header, keyword);
+  if (index < 0) return default_value;
+  string value = CardValue(header, index);
+  for (size_t i = 0; i < value.size(); ++i) {
+    if (value[i] == 'D' || value[i] == 'd') value[i] = 'E';
+  }
+  double result;
+  if (!StringToDouble(value, &result)) {
+    return default_value;
+  }
+  return result;
+}
+
+// Reads a logical keyword and returns its value or default_value if not
+// found.
+bool Fits::HeaderReadKeywordBool(const string &header,
+                                 const string &keyword,
+                                 bool default_value) {
+  int index = FindCard(header, keyword);
+  if (index < 0) return default_value;
+  string value = CardValue(header, index);
+  if (value == "T") {
+    return true;
+  } else if (value == "F") {
+    return false;
+  }
+  return default_value;
+}
+
+// Reads a string keyword and returns its value or default_value if not
+// found.
+string Fits::HeaderReadKeywordString(const string &header,
+                                     const string &keyword,
+                                     const string &default_value) {
+  int index = FindCard(header, keyword);
+  if (index < 0) return default_value;
+  string value = CardValue(header, index);
+  if (value.size() < 2 || value[0] != '\'') return default_value;
+
+  // Remove the quotes, unescape doubled quotes, and strip trailing spaces
+  // (which are not significant in FITS strings).
+  string result;
+  for (size_t i = 1; i + 1 < value.size(); ++i) {
+    result.push_back(value[i]);
+    if (value[i] == '\'' && value[i + 1] == '\'') ++i;
+  }
+  StringStripTrailingWhiteSpace(&result);
+  return result;
+}
+
+// Decodes big endian FITS pixels into floats.
+void Fits::DecodePixels(const uint8 *data, int bitpix, long num_values,
+                        double bscale, double bzero, bool has_blank,
+                        int64 blank, float *values) {
+  switch (bitpix) {
+    case 8:
+      for (long i = 0; i < num_values; ++i) {
+        int64 raw = data[i];
+        values[i] = (has_blank && raw == blank) ?
+                    NAN : static_cast<float>(bzero + bscale * raw);
+      }
+      break;
+    case 16:
+      for (long i = 0; i < num_values; ++i, data += 2) {
+        int16 raw = static_cast<int16>((data[0] << 8) | data[1]);
+        values[i] = (has_blank && raw == blank) ?
+                    NAN : static_cast<float>(bzero + bscale * raw);
+      }
+      break;
+    case 32:
+      for (long i = 0; i < num_values; ++i, data += 4) {
+        int raw = static_cast<int>((static_cast<uint>(data[0]) << 24) |
+                                   (static_cast<uint>(data[1]) << 16) |
+                                   (static_cast<uint>(data[2]) << 8) |
+                                   static_cast<uint>(data[3]));
+        values[i] = (has_blank && raw == blank) ?
+                    NAN : static_cast<float>(bzero + bscale * raw);
+      }
+      break;
+    case 64:
+      for (long i = 0; i < num_values; ++i, data += 8) {
+        uint64 bits = 0;
+        for (int k = 0; k < 8; ++k) bits = (bits << 8) | data[k];
+        int64 raw = static_cast<int64>(bits);
+        values[i] = (has_blank && raw == blank) ?
+                    NAN : static_cast<float>(bzero + bscale * raw);
+      }
+      break;
+    case -32:
+      for (long i = 0; i < num_values; ++i, data += 4) {
+        uint bits = (static_cast<uint>(data[0]) << 24) |
+                    (static_cast<uint>(data[1]) << 16) |
+                    (static_cast<uint>(data[2]) << 8) |
+                    static_cast<uint>(data[3]);
+        float raw;
+        memcpy(&raw, &bits, sizeof(raw));
+        values[i] = static_cast<float>(bzero + bscale * raw);
+      }
+      break;
+    case -64:
+      for (long i = 0; i < num_values; ++i, data += 8) {
+        uint64 bits = 0;
+        for (int k = 0; k < 8; ++k) bits = (bits << 8) | data[k];
+        double raw;
+        memcpy(&raw, &bits, sizeof(raw));
+        values[i] = static_cast<float>(bzero + bscale * raw);
+      }
+      break;
+    default:
+      CHECK(false) << "Invalid BITPIX value: " << bitpix;
+  }
+}
+
+void Fits::DecodeIntegers(const uint8 *data, int bitpix, long num_values,
+                          int64 bzero, int64 *values) {
+  switch (bitpix) {
+    case 8:
+      for (long i = 0; i < num_values; ++i) {
+        values[i] = bzero + data[i];
+      }
+      break;
+    case 16:
+      for (long i = 0; i < num_values; ++i, data += 2) {
+        values[i] = bzero + static_cast<int16>((data[0] << 8) | data[1]);
+      }
+      break;
+    case 32:
+      for (long i = 0; i < num_values; ++i, data += 4) {
+        values[i] = bzero + static_cast<int>(
+            (static_cast<uint>(data[0]) << 24) |
+            (static_cast<uint>(data[1]) << 16) |
+            (static_cast<uint>(data[2]) << 8) |
+            static_cast<uint>(data[3]));
+      }
+      break;
+    case 64:
+      for (long i = 0; i < num_values; ++i, data += 8) {
+        uint64 bits = 0;
+        for (int k = 0; k < 8; ++k) bits = (bits << 8) | data[k];
+        // Unsigned 64 bit images use a BZERO of 2^63, so wrap around.
+        values[i] = static_cast<int64>(static_cast<uint64>(bzero) + bits);
+      }
+      break;
+    default:
+      CHECK(false) << "Invalid integer BITPIX value: " << bitpix;
+  }
+}
+
 }  // namespace google_sky
@@ -86,6 +86,9 @@
 #define FITS_H__
 
 #include <string>
+#include <vector>
+
+#include <zlib.h>
 
 #include "base.h"
 
@@ -94,13 +97,15 @@ namespace google_sky {
 // Class for reading FITS files
 //
 // Currently the Fits class is a static class consisting of very basic
-// methods for reading FITS headers, checking for keywords, reading integer
-// keywords, and adding the NAXIS1 and NAXIS2 if not present (they are required
-// by WCS Tools to function properly).
+// methods for reading FITS headers, checking for keywords, reading
+// keywords, locating the HDU that holds an image, decoding raw pixel values,
+// and adding the NAXIS1 and NAXIS2 if not present (they are required by WCS
+// Tools to function properly).  See FitsImage for reading the pixels of an
+// image.
 //
 // A more sophisticated and proper class would be able to parse FITS headers
-// into a hashmap-like data structure and read image data.  Eventually this
-// class may be expanded to handle this.
+// into a hashmap-like data structure.  Eventually this class may be expanded
+// to handle this.
 //
 // Example Usage:
 //
@@ -110,14 +115,77 @@ namespace google_sky {
 //
 // // Adds in image dimensions if not present.
 // Fits::AddImageDimensions(width, height, &header);
+//
+// // Reads the header describing the first image in the file.  For
+// // tile-compressed images this is the equivalent uncompressed header.
+// Fits::ReadImageHeader("foo.fits.fz", &header);
 
 class Fits {
  public:
   // Reads the header from the given FITS file starting at offset and returns
-  // it in header.
+  // it in header.  The header may belong to the primary HDU or to an
+  // extension.
   static void ReadHeader(const string &fits_filename, long offset,
                          string *header);
 
+  // Finds the first HDU containing an image and returns the offset of its
+  // header in offset and the header itself in header.  An image is a primary
+  // HDU or IMAGE extension with NAXIS >= 2 or a tile-compressed image stored
+  // in a BINTABLE extension.  Returns false if there is no such HDU.
+  static bool FindImageHdu(const string &fits_filename, long *offset,
+                           string *header);
+
+  // Like FindImageHdu(), but walks the headers of a file already opened with
+  // gzopen() from its start.  The stream is left just past the END card of
+  // the image header, so the pixels can be read without inflating a gzipped
+  // file a second time.
+  static bool FindImageHdu(gzFile fp, const string &fits_filename,
+                           long *offset, string *header);
+
+  // Finds every HDU containing an image (as defined above) and returns the
+  // offsets of their headers in offsets and the headers in headers.  The
+  // headers are read in a single pass over the file, so callers that need
+  // several extensions (e.g. from a mosaic camera) should use this instead
+  // of calling ReadHeader() for each one.
+  static void FindImageHdus(const string &fits_filename,
+                            vector<long> *offsets, vector<string> *headers);
+
+  // Finds the first BINTABLE extension holding a table, as opposed to a
+  // tile-compressed image, and returns the offset of its header in offset
+  // and the header itself in header.  Returns false if there is no such
+  // HDU.
+  static bool FindTableHdu(const string &fits_filename, long *offset,
+                           string *header);
+
+  // Reads the header that describes the image in the given FITS file.  This
+  // is the header of the HDU found by FindImageHdu() or the primary header if
+  // the file holds no image (e.g. a header containing only a WCS).  Headers
+  // of tile-compressed images are converted to the header of the equivalent
+  // uncompressed image.  If the image is an extension without a WCS and the
+  // primary header has one, the primary header's keywords are inherited (see
+  // InheritKeywords()).
+  static void ReadImageHeader(const string &fits_filename, string *header);
+
+  // Checks that ReadImageHeader() can read the given file, i.e. that it
+  // can be opened and that every header up to the one describing the image
+  // is complete.  Returns false with a description of the problem in error
+  // otherwise.  The other methods die on such files, so callers that have
+  // to survive bad input (e.g. batch jobs) check first.
+  static bool CheckImageHeader(const string &fits_filename, string *error);
+
+  // Adds the keywords of primary_header that header lacks to the end of
+  // header, skipping the structural keywords (SIMPLE, BITPIX, NAXIS*,
+  // EXTEND) and commentary.  This is the FITS INHERIT convention.
+  static void InheritKeywords(const string &primary_header, string *header);
+
+  // Returns the number of bytes the given header occupies on disk, i.e. its
+  // length rounded up to a multiple of the FITS block size.
+  static long PaddedHeaderSize(const string &header);
+
+  // Returns the number of bytes occupied on disk by the data unit that
+  // follows the given header, including padding.
+  static long PaddedDataSize(const string &header);
+
   // Adds the image dimensions to header by adding cards for NAXIS1 and NAXIS2.
   // This function is safe to call if both NAXIS1 and NAXIS2 are already
   // present, but it will die if only NAXIS1 or NAXIS2 is present (this would
@@ -135,6 +203,41 @@ class Fits {
                                   const string &keyword,
                                   int default_value);
 
+  // Reads a 64 bit integer keyword.  Returns default_value if not found.
+  static int64 HeaderReadKeywordInt64(const string &header,
+                                      const string &keyword,
+                                      int64 default_value);
+
+  // Reads a floating point keyword.  Returns default_value if not found.
+  static double HeaderReadKeywordDouble(const string &header,
+                                        const string &keyword,
+                                        double default_value);
+
+  // Reads a logical keyword.  Returns default_value if not found.
+  static bool HeaderReadKeywordBool(const string &header,
+                                    const string &keyword,
+                                    bool default_value);
+
+  // Reads a string keyword with the quotes and trailing spaces removed.
+  // Returns default_value if not found.
+  static string HeaderReadKeywordString(const string &header,
+                                        const string &keyword,
+                                        const string &default_value);
+
+  // Decodes num_values big endian pixels of the type given by bitpix from
+  // data into values, computing value = bzero + bscale * raw.  Integer pixels
+  // equal to blank are set to NaN if has_blank is true.
+  static void DecodePixels(const uint8 *data, int bitpix, long num_values,
+                           double bscale, double bzero, bool has_blank,
+                           int64 blank, float *values);
+
+  // Decodes num_values big endian integers of the type given by bitpix (8,
+  // 16, 32, or 64) from data into values, computing value = bzero + raw
+  // exactly.  This is used for bit flags, which can be too large to
+  // represent exactly as floats.  Dies on floating point bitpix values.
+  static void DecodeIntegers(const uint8 *data, int bitpix, long num_values,
+                             int64 bzero, int64 *values);
+
  private:
   // For now Fits is a static only class, but this might change in the
   // future.
@@ -144,6 +247,19 @@ class Fits {
     // Nothing needed.
   }
 
+  // Reads the headers of up to max_hdus HDUs for which accept returns true
+  // (all of them if max_hdus is negative).
+  static void FindHdusInFile(const string &fits_filename,
+                             bool (*accept)(const string &header),
+                             int max_hdus, vector<long> *offsets,
+                             vector<string> *headers);
+
+  // Like FindHdusInFile(), but reads from an open stream.
+  static void FindHdusInStream(gzFile fp, const string &fits_filename,
+                               bool (*accept)(const string &header),
+                               int max_hdus, vector<long> *offsets,
+                               vector<string> *headers);
+
   DISALLOW_COPY_AND_ASSIGN(Fits);
 };
 
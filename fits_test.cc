@@ -27,9 +27,11 @@
 // POSSIBILITY OF SUCH DAMAGE.
 
 #include <cmath>
+#include <cstdio>
 
 #include <iostream>
 #include <string>
+#include <vector>
 
 #include "base.h"
 #include "fits.h"
@@ -94,6 +96,33 @@ static const char *FITS_HEADER_NAXIS =
 // This file has the 3 headers above stored in the first 3 successive blocks.
 static const char *FITS_FILENAME = "testdata/fits_test.fits";
 
+// A small 16 bit image with a WCS and its tile-compressed version, which
+// stores the image in a BINTABLE extension after an empty primary HDU.
+static const char *FITS_IMAGE_FILENAME = "testdata/fitsimage_test.fits";
+static const char *FITS_COMPRESSED_FILENAME =
+    "testdata/fitsimage_test_rice.fits.fz";
+static const char *FITS_GZIPPED_FILENAME = "testdata/fitsimage_test.fits.gz";
+
+// A multi-extension file with an empty primary HDU followed by a 16 bit
+// image, a binary table, a 4 x 3 image without a WCS and a 32 bit float image.
+static const char *FITS_MEF_FILENAME = "testdata/fitsimage_test_mef.fits";
+
+// Copies the first size bytes of a file to truncated_filename.
+void WriteTruncatedCopy(const string &filename, int size,
+                        const string &truncated_filename) {
+  vector<char> data(size);
+  FILE *in = fopen(filename.c_str(), "rb");
+  ASSERT_TRUE(in != NULL);
+  int num_read = static_cast<int>(fread(&data[0], 1, size, in));
+  fclose(in);
+  ASSERT_EQ(size, num_read);
+  FILE *out = fopen(truncated_filename.c_str(), "wb");
+  ASSERT_TRUE(out != NULL);
+  int num_written = static_cast<int>(fwrite(&data[0], 1, size, out));
+  fclose(out);
+  ASSERT_EQ(size, num_written);
+}
+
 int Main(int argc, char **argv) {
   {
     cout << "Testing ReadHeader()... ";
@@ -144,6 +173,188 @@ int Main(int argc, char **argv) {
     cout << "pass\n";
   }
 
+  {
+    cout << "Testing ReadHeader() for gzipped files... ";
+    string header;
+    string gzipped_header;
+    Fits::ReadHeader(FITS_IMAGE_FILENAME, 0, &header);
+    Fits::ReadHeader(FITS_GZIPPED_FILENAME, 0, &gzipped_header);
+    ASSERT_EQ(header, gzipped_header);
+
+    long offset = -1;
+    ASSERT_TRUE(Fits::FindImageHdu(FITS_GZIPPED_FILENAME, &offset,
+                                   &gzipped_header));
+    ASSERT_EQ(0, offset);
+    ASSERT_EQ(header, gzipped_header);
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing ReadKeywordString()... ";
+    string header;
+    Fits::ReadHeader(FITS_FILENAME, 0, &header);
+    ASSERT_EQ("An example str",
+              Fits::HeaderReadKeywordString(header, "STR", ""));
+    ASSERT_EQ("none", Fits::HeaderReadKeywordString(header, "FOO", "none"));
+    ASSERT_EQ("none",
+              Fits::HeaderReadKeywordString(header, "NAXIS", "none"));
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing ReadKeywordDouble()... ";
+    string header;
+    Fits::ReadHeader(FITS_IMAGE_FILENAME, 0, &header);
+    ASSERT_FLOAT_EQ(20.5, Fits::HeaderReadKeywordDouble(header, "CRPIX1", 0),
+                    1.0e-12);
+    ASSERT_FLOAT_EQ(2000.0,
+                    Fits::HeaderReadKeywordDouble(header, "EQUINOX", 0),
+                    1.0e-12);
+    ASSERT_FLOAT_EQ(-1.0, Fits::HeaderReadKeywordDouble(header, "FOO", -1.0),
+                    1.0e-12);
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing ReadKeywordBool()... ";
+    string header;
+    Fits::ReadHeader(FITS_FILENAME, 0, &header);
+    ASSERT_TRUE(Fits::HeaderReadKeywordBool(header, "SIMPLE", false));
+    ASSERT_TRUE(Fits::HeaderReadKeywordBool(header, "EXTEND", false));
+    ASSERT_FALSE(Fits::HeaderReadKeywordBool(header, "FOO", false));
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing FindImageHdu()... ";
+    long offset = -1;
+    string header;
+    ASSERT_TRUE(Fits::FindImageHdu(FITS_IMAGE_FILENAME, &offset, &header));
+    ASSERT_EQ(0, offset);
+    ASSERT_EQ(16, Fits::HeaderReadKeywordInt(header, "BITPIX", 0));
+
+    // The compressed image follows an empty primary HDU.
+    ASSERT_TRUE(Fits::FindImageHdu(FITS_COMPRESSED_FILENAME, &offset,
+                                   &header));
+    ASSERT_EQ(2880, offset);
+    ASSERT_EQ("BINTABLE",
+              Fits::HeaderReadKeywordString(header, "XTENSION", ""));
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing FindImageHdus()... ";
+    vector<long> offsets;
+    vector<string> headers;
+    Fits::FindImageHdus(FITS_MEF_FILENAME, &offsets, &headers);
+    ASSERT_EQ(3, static_cast<int>(offsets.size()));
+    ASSERT_EQ(3, static_cast<int>(headers.size()));
+    ASSERT_EQ(2880, offsets[0]);
+    ASSERT_EQ(14400, offsets[1]);
+    ASSERT_EQ(20160, offsets[2]);
+    ASSERT_EQ("SCI1", Fits::HeaderReadKeywordString(headers[0], "EXTNAME", ""));
+    ASSERT_EQ("NOWCS",
+              Fits::HeaderReadKeywordString(headers[1], "EXTNAME", ""));
+    ASSERT_EQ(-32, Fits::HeaderReadKeywordInt(headers[2], "BITPIX", 0));
+
+    string header;
+    Fits::ReadHeader(FITS_MEF_FILENAME, offsets[2], &header);
+    ASSERT_EQ(header, headers[2]);
+
+    // Plain images have a single image HDU.
+    Fits::FindImageHdus(FITS_IMAGE_FILENAME, &offsets, &headers);
+    ASSERT_EQ(1, static_cast<int>(offsets.size()));
+    ASSERT_EQ(0, offsets[0]);
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing FindTableHdu()... ";
+    long offset = -1;
+    string header;
+    ASSERT_TRUE(Fits::FindTableHdu(FITS_MEF_FILENAME, &offset, &header));
+    ASSERT_EQ(8640, offset);
+    ASSERT_EQ("TAB", Fits::HeaderReadKeywordString(header, "EXTNAME", ""));
+
+    // Tile-compressed images are stored in tables but aren't tables.
+    ASSERT_FALSE(Fits::FindTableHdu(FITS_COMPRESSED_FILENAME, &offset,
+                                    &header));
+    ASSERT_FALSE(Fits::FindTableHdu(FITS_IMAGE_FILENAME, &offset, &header));
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing ReadImageHeader()... ";
+    string header;
+    Fits::ReadImageHeader(FITS_COMPRESSED_FILENAME, &header);
+    ASSERT_EQ(16, Fits::HeaderReadKeywordInt(header, "BITPIX", 0));
+    ASSERT_EQ(40, Fits::HeaderReadKeywordInt(header, "NAXIS1", 0));
+    ASSERT_EQ(30, Fits::HeaderReadKeywordInt(header, "NAXIS2", 0));
+    ASSERT_FALSE(Fits::HeaderHasKeyword(header, "ZIMAGE"));
+    ASSERT_FALSE(Fits::HeaderHasKeyword(header, "TFORM1"));
+    ASSERT_TRUE(Fits::HeaderHasKeyword(header, "CRPIX1"));
+
+    // Files without an image fall back on the primary header.
+    Fits::ReadImageHeader(FITS_FILENAME, &header);
+    ASSERT_EQ(FITS_HEADER, header);
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing CheckImageHeader()... ";
+    string error;
+    ASSERT_TRUE(Fits::CheckImageHeader(FITS_FILENAME, &error));
+    ASSERT_TRUE(Fits::CheckImageHeader(FITS_COMPRESSED_FILENAME, &error));
+    ASSERT_TRUE(Fits::CheckImageHeader(FITS_GZIPPED_FILENAME, &error));
+    ASSERT_TRUE(Fits::CheckImageHeader(FITS_MEF_FILENAME, &error));
+    ASSERT_FALSE(Fits::CheckImageHeader("fits_test_missing.fits", &error));
+    ASSERT_FALSE(error.empty());
+
+    // The primary header ends in the middle.
+    const char *truncated = "fits_test_truncated.fits";
+    WriteTruncatedCopy(FITS_MEF_FILENAME, 9, truncated);
+    ASSERT_FALSE(Fits::CheckImageHeader(truncated, &error));
+    WriteTruncatedCopy(FITS_MEF_FILENAME, 200, truncated);
+    ASSERT_FALSE(Fits::CheckImageHeader(truncated, &error));
+
+    // The image extension's header ends in the middle.
+    WriteTruncatedCopy(FITS_MEF_FILENAME, 2880 + 1000, truncated);
+    ASSERT_FALSE(Fits::CheckImageHeader(truncated, &error));
+    ASSERT_EQ(string("Found EOF before END card in ") + truncated, error);
+
+    // Anything after the image's header isn't needed.
+    WriteTruncatedCopy(FITS_MEF_FILENAME, 2 * 2880, truncated);
+    ASSERT_TRUE(Fits::CheckImageHeader(truncated, &error));
+    remove(truncated);
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing PaddedDataSize()... ";
+    string header;
+    Fits::ReadHeader(FITS_IMAGE_FILENAME, 0, &header);
+    ASSERT_EQ(2880, Fits::PaddedHeaderSize(header));
+    ASSERT_EQ(2880, Fits::PaddedDataSize(header));  // 40 * 30 * 2 bytes.
+    Fits::ReadHeader(FITS_FILENAME, 0, &header);
+    ASSERT_EQ(167 * 2880, Fits::PaddedDataSize(header));  // 852 * 562 bytes.
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing DecodePixels()... ";
+    const uint8 data[] = {0x00, 0x01, 0xff, 0xfe, 0x80, 0x00};
+    float values[3];
+    Fits::DecodePixels(data, 16, 3, 2.0, 10.0, true, -32768, values);
+    ASSERT_FLOAT_EQ(12.0, values[0], 1.0e-6);
+    ASSERT_FLOAT_EQ(6.0, values[1], 1.0e-6);
+    ASSERT_TRUE(isnan(values[2]));
+
+    const uint8 float_data[] = {0x3f, 0xc0, 0x00, 0x00};
+    Fits::DecodePixels(float_data, -32, 1, 1.0, 0.0, false, 0, values);
+    ASSERT_FLOAT_EQ(1.5, values[0], 1.0e-6);
+    cout << "pass\n";
+  }
+
   cout << "Passed\n";
   return 0;
 }
@@ -0,0 +1,908 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+#include "fitscompression.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include <pthread.h>
+
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+#include "fits.h"
+#include "string_util.h"
+#include "threadpool.h"
+
+namespace google_sky {
+
+namespace {
+
+// Constants from the FITS tiled image compression convention.
+static const int N_RANDOM = 10000;
+static const int NULL_VALUE = -2147483647;
+static const int ZERO_VALUE = -2147483646;
+static const int FITS_CARD_SIZE = 80;
+static const int FITS_KEYWORD_SIZE = 8;
+
+// Ways in which floating point tiles may have been quantized.
+enum Quantization {
+  NO_DITHER,
+  SUBTRACTIVE_DITHER_1,
+  SUBTRACTIVE_DITHER_2
+};
+
+// Compression algorithms that can be decompressed.
+enum Algorithm {
+  RICE_1,
+  GZIP_1,
+  GZIP_2
+};
+
+// Location and type of a column in the binary table.
+struct Column {
+  Column() : offset(-1), type('\0'), is_descriptor(false),
+             is_64bit_descriptor(false) {}
+
+  // Returns whether the column is present in the table.
+  bool exists() const {
+    return offset >= 0;
+  }
+
+  int offset;                // Byte offset of the column within a row.
+  char type;                 // Data type (or element type for descriptors).
+  bool is_descriptor;        // Whether the column is a variable length array.
+  bool is_64bit_descriptor;  // Whether the descriptor is a Q rather than P.
+};
+
+// Returns the size in bytes of a binary table element of the given type.
+int TypeSize(char type) {
+  switch (type) {
+    case 'L': case 'A': case 'B': case 'X':
+      return 1;
+    case 'I':
+      return 2;
+    case 'J': case 'E':
+      return 4;
+    case 'K': case 'D': case 'C': case 'P':
+      return 8;
+    case 'M': case 'Q':
+      return 16;
+    default:
+      return -1;
+  }
+}
+
+// Parses a TFORM value such as "1PB(1024)" or "D".  The number of bytes the
+// column occupies in a row is returned in width.  Returns false for unknown
+// formats.
+bool ParseTform(const string &tform, Column *column, int *width) {
+  size_t i = 0;
+  int repeat = 0;
+  bool has_repeat = false;
+  while (i < tform.size() && tform[i] >= '0' && tform[i] <= '9') {
+    repeat = 10 * repeat + (tform[i] - '0');
+    has_repeat = true;
+    ++i;
+  }
+  if (!has_repeat) repeat = 1;
+  if (i >= tform.size()) return false;
+
+  char type = tform[i];
+  if (type == 'P' || type == 'Q') {
+    if (i + 1 >= tform.size()) return false;
+    column->is_descriptor = true;
+    column->is_64bit_descriptor = (type == 'Q');
+    column->type = tform[i + 1];
+  } else {
+    column->type = type;
+  }
+
+  int size = TypeSize(type);
+  if (size < 0) return false;
+  if (type == 'X') {
+    *width = (repeat + 7) / 8;
+  } else {
+    *width = repeat * size;
+  }
+  return true;
+}
+
+// Reads big endian integers.
+inline int ReadInt16(const uint8 *p) {
+  return static_cast<int16>((p[0] << 8) | p[1]);
+}
+
+inline int ReadInt32(const uint8 *p) {
+  return static_cast<int>((static_cast<uint>(p[0]) << 24) |
+                          (static_cast<uint>(p[1]) << 16) |
+                          (static_cast<uint>(p[2]) << 8) |
+                          static_cast<uint>(p[3]));
+}
+
+inline int64 ReadInt64(const uint8 *p) {
+  uint64 bits = 0;
+  for (int i = 0; i < 8; ++i) bits = (bits << 8) | p[i];
+  return static_cast<int64>(bits);
+}
+
+inline double ReadDouble(const uint8 *p) {
+  uint64 bits = static_cast<uint64>(ReadInt64(p));
+  double value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+// Reads the value of a numeric column as a double.
+double ReadColumnValue(const uint8 *row, const Column &column) {
+  const uint8 *p = row + column.offset;
+  switch (column.type) {
+    case 'B':
+      return p[0];
+    case 'I':
+      return ReadInt16(p);
+    case 'J':
+      return ReadInt32(p);
+    case 'K':
+      return static_cast<double>(ReadInt64(p));
+    case 'E': {
+      uint bits = static_cast<uint>(ReadInt32(p));
+      float value;
+      memcpy(&value, &bits, sizeof(value));
+      return value;
+    }
+    case 'D':
+      return ReadDouble(p);
+    default:
+      CHECK(false) << "Unsupported column type: " << column.type;
+      return 0.0;
+  }
+}
+
+// Reads a variable length array descriptor, returning the number of
+// elements and their offset from the start of the heap.
+void ReadDescriptor(const uint8 *row, const Column &column, int64 *count,
+                    int64 *offset) {
+  const uint8 *p = row + column.offset;
+  if (column.is_64bit_descriptor) {
+    *count = ReadInt64(p);
+    *offset = ReadInt64(p + 8);
+  } else {
+    *count = static_cast<uint>(ReadInt32(p));
+    *offset = static_cast<uint>(ReadInt32(p + 4));
+  }
+}
+
+// Returns the next byte of compressed data or 0 past the end.  The pointer is
+// always advanced so that overruns can be detected by the caller.
+inline uint NextByte(const uint8 **c, const uint8 *end) {
+  uint value = (*c < end) ? **c : 0;
+  ++(*c);
+  return value;
+}
+
+// Lookup tables shared by every decompression thread.  They are filled in
+// exactly once by InitTables() via pthread_once().
+static float random_values[N_RANDOM];
+static int nonzero_count[256];
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+// Fills in the lookup tables.
+void InitTables() {
+  // Pseudo-random numbers used for dithering.  This must match the sequence
+  // generated by CFITSIO exactly.
+  double a = 16807.0;
+  double m = 2147483647.0;
+  double seed = 1.0;
+  for (int i = 0; i < N_RANDOM; ++i) {
+    double temp = a * seed;
+    seed = temp - m * static_cast<int>(temp / m);
+    random_values[i] = static_cast<float>(seed / m);
+  }
+
+  // Number of bits needed to represent each byte value.
+  int num_bits = 8;
+  int k = 128;
+  for (int i = 255; i >= 0; ) {
+    for ( ; i >= k; --i) nonzero_count[i] = num_bits;
+    k /= 2;
+    --num_bits;
+  }
+}
+
+// Returns the table of pseudo-random numbers used for dithering.
+const float *RandomValues() {
+  pthread_once(&tables_once, InitTables);
+  return random_values;
+}
+
+// Inflates a gzipped tile of num_values values of size bytepix into raw,
+// undoing the byte shuffling of GZIP_2.  The output is big endian.
+bool GzipDecompressTile(const uint8 *bytes, int64 size, int bytepix,
+                        int num_values, Algorithm algorithm,
+                        vector<uint8> *raw) {
+  if (!FitsCompression::GzipDecompress(bytes, size, &(*raw)[0],
+                                       raw->size())) {
+    return false;
+  }
+
+  // GZIP_2 shuffles the bytes so that all of the most significant bytes
+  // come first.
+  if (algorithm == GZIP_2 && bytepix > 1) {
+    vector<uint8> shuffled(*raw);
+    for (int i = 0; i < num_values; ++i) {
+      for (int k = 0; k < bytepix; ++k) {
+        (*raw)[i * bytepix + k] = shuffled[k * num_values + i];
+      }
+    }
+  }
+  return true;
+}
+
+// State shared between the tasks decompressing a single image.
+struct CompressedImage {
+  const uint8 *table;   // Start of the binary table.
+  const uint8 *heap;    // Start of the heap.
+  long heap_size;       // Number of bytes in the heap.
+  int row_size;         // Bytes per table row (NAXIS1).
+
+  Column compressed_data;    // COMPRESSED_DATA column.
+  Column gzip_data;          // GZIP_COMPRESSED_DATA column (optional).
+  Column uncompressed_data;  // UNCOMPRESSED_DATA column (optional).
+  Column zscale;             // ZSCALE column (optional).
+  Column zzero;              // ZZERO column (optional).
+  Column zblank;             // ZBLANK column (optional).
+
+  Algorithm algorithm;
+  int block_size;        // Rice block size.
+  int bytepix;           // Bytes per integer pixel before compression.
+  int bitpix;            // ZBITPIX.
+  int width;             // ZNAXIS1.
+  int height;            // ZNAXIS2.
+  int tile_width;        // ZTILE1.
+  int tile_height;       // ZTILE2.
+  int tiles_per_row;     // Number of tiles along the first axis.
+  int first_tile;        // Table row of the first tile of the plane.
+
+  // Scaling used when the ZSCALE and ZZERO columns are absent.
+  double scale;
+  double zero;
+
+  // Null value used when the ZBLANK column is absent.
+  bool has_blank;
+  int64 blank;
+
+  Quantization quantization;
+  int dither_seed;       // ZDITHER0.
+
+  float *pixels;         // Output image.
+};
+
+// Decompresses the tiles in a range of table rows.
+class DecompressTilesTask : public Task {
+ public:
+  DecompressTilesTask(const CompressedImage *image, int first_row,
+                      int last_row, bool *success)
+      : image_(image), first_row_(first_row), last_row_(last_row),
+        success_(success) {
+    *success_ = true;
+  }
+
+  virtual void Run() {
+    for (int row = first_row_; row < last_row_; ++row) {
+      if (!DecompressTile(row)) {
+        fprintf(stderr, "Error decompressing tile %d\n", row + 1);
+        *success_ = false;
+        return;
+      }
+    }
+  }
+
+ private:
+  const CompressedImage *image_;
+  int first_row_;
+  int last_row_;
+  bool *success_;
+
+  // Decompresses the tile in the given table row into the output image.
+  bool DecompressTile(int row);
+
+  // Returns the compressed bytes for a tile from the given column or NULL if
+  // the column is absent or empty for this tile.
+  const uint8 *GetTileBytes(const uint8 *table_row, const Column &column,
+                            int64 *size) const;
+
+  DISALLOW_COPY_AND_ASSIGN(DecompressTilesTask);
+};
+
+const uint8 *DecompressTilesTask::GetTileBytes(const uint8 *table_row,
+                                               const Column &column,
+                                               int64 *size) const {
+  if (!column.exists()) return NULL;
+
+  int64 count, offset;
+  ReadDescriptor(table_row, column, &count, &offset);
+  *size = count * TypeSize(column.type);
+  if (count <= 0 || offset < 0 || offset + *size > image_->heap_size) {
+    return NULL;
+  }
+  return image_->heap + offset;
+}
+
+bool DecompressTilesTask::DecompressTile(int row) {
+  const CompressedImage &image = *image_;
+  const uint8 *table_row = image.table +
+                           static_cast<long>(row) * image.row_size;
+
+  // Determine the region of the image covered by this tile.
+  int tile = row - image.first_tile;
+  int x0 = (tile % image.tiles_per_row) * image.tile_width;
+  int y0 = (tile / image.tiles_per_row) * image.tile_height;
+  int nx = min(image.tile_width, image.width - x0);
+  int ny = min(image.tile_height, image.height - y0);
+  if (nx <= 0 || ny <= 0) return false;
+  int num_values = nx * ny;
+
+  double scale = image.scale;
+  double zero = image.zero;
+  if (image.zscale.exists()) scale = ReadColumnValue(table_row, image.zscale);
+  if (image.zzero.exists()) zero = ReadColumnValue(table_row, image.zzero);
+
+  bool has_blank = image.has_blank;
+  int64 blank = image.blank;
+  if (image.zblank.exists()) {
+    has_blank = true;
+    blank = static_cast<int64>(ReadColumnValue(table_row, image.zblank));
+  }
+
+  vector<float> values(num_values);
+  int64 size;
+  const uint8 *bytes = GetTileBytes(table_row, image.compressed_data, &size);
+
+  if (bytes != NULL && image.bitpix == 64) {
+    // 64 bit integers can only be gzipped.
+    vector<uint8> raw(static_cast<size_t>(num_values) * 8);
+    if (image.algorithm == RICE_1 ||
+        !GzipDecompressTile(bytes, size, 8, num_values, image.algorithm,
+                            &raw)) {
+      return false;
+    }
+    Fits::DecodePixels(&raw[0], image.bitpix, num_values, scale,
+                       zero, has_blank, blank, &values[0]);
+  } else if (bytes != NULL && image.bitpix < 0 && !image.zscale.exists()) {
+    // Losslessly compressed floating point values.
+    int bytepix = abs(image.bitpix) / 8;
+    vector<uint8> raw(static_cast<size_t>(num_values) * bytepix);
+    if (image.algorithm == RICE_1 ||
+        !GzipDecompressTile(bytes, size, bytepix, num_values,
+                            image.algorithm, &raw)) {
+      return false;
+    }
+    Fits::DecodePixels(&raw[0], image.bitpix, num_values, 1.0,
+                       0.0, false, 0, &values[0]);
+  } else if (bytes != NULL) {
+    // Quantized floating point tiles are always compressed as 4 byte
+    // integers.
+    bool is_quantized = image.bitpix < 0;
+    vector<int> ints(num_values);
+
+    if (image.algorithm == RICE_1) {
+      int bytepix = is_quantized ? 4 : image.bytepix;
+      if (!FitsCompression::RiceDecompress(
+              bytes, size, image.block_size, bytepix, num_values,
+              &ints[0])) {
+        return false;
+      }
+    } else {
+      int bytepix = is_quantized ? 4 : image.bitpix / 8;
+      vector<uint8> raw(static_cast<size_t>(num_values) * bytepix);
+      if (!GzipDecompressTile(bytes, size, bytepix, num_values,
+                              image.algorithm, &raw)) {
+        return false;
+      }
+      for (int i = 0; i < num_values; ++i) {
+        const uint8 *p = &raw[i * bytepix];
+        if (bytepix == 1) {
+          ints[i] = p[0];
+        } else if (bytepix == 2) {
+          ints[i] = ReadInt16(p);
+        } else {
+          ints[i] = ReadInt32(p);
+        }
+      }
+    }
+
+    if (is_quantized && image.quantization != NO_DITHER) {
+      const float *random_values = RandomValues();
+      int seed = (image.dither_seed + row - 1) % N_RANDOM;
+      if (seed < 0) seed += N_RANDOM;
+      int next = static_cast<int>(random_values[seed] * 500.0);
+
+      for (int i = 0; i < num_values; ++i) {
+        if (has_blank && ints[i] == blank) {
+          values[i] = NAN;
+        } else if (image.quantization == SUBTRACTIVE_DITHER_2 &&
+                   ints[i] == ZERO_VALUE) {
+          values[i] = 0.0;
+        } else {
+          values[i] = static_cast<float>(
+              (static_cast<double>(ints[i]) - random_values[next] + 0.5) *
+              scale + zero);
+        }
+
+        ++next;
+        if (next == N_RANDOM) {
+          ++seed;
+          if (seed == N_RANDOM) seed = 0;
+          next = static_cast<int>(random_values[seed] * 500.0);
+        }
+      }
+    } else {
+      for (int i = 0; i < num_values; ++i) {
+        if (has_blank && ints[i] == blank) {
+          values[i] = NAN;
+        } else {
+          values[i] = static_cast<float>(ints[i] * scale + zero);
+        }
+      }
+    }
+  } else if ((bytes = GetTileBytes(table_row, image.gzip_data, &size))
+             != NULL) {
+    // Tiles that couldn't be quantized are stored as gzipped raw values.
+    int bytepix = abs(image.bitpix) / 8;
+    vector<uint8> raw(static_cast<size_t>(num_values) * bytepix);
+    if (!GzipDecompressTile(bytes, size, bytepix, num_values, GZIP_1,
+                            &raw)) {
+      return false;
+    }
+    Fits::DecodePixels(&raw[0], image.bitpix, num_values, 1.0,
+                       0.0, false, 0, &values[0]);
+  } else if ((bytes = GetTileBytes(table_row, image.uncompressed_data,
+                                   &size)) != NULL) {
+    if (size < static_cast<int64>(num_values) * abs(image.bitpix) / 8) {
+      return false;
+    }
+    Fits::DecodePixels(bytes, image.bitpix, num_values, 1.0,
+                       0.0, false, 0, &values[0]);
+  } else {
+    return false;
+  }
+
+  // Copy the tile into the image.
+  for (int j = 0; j < ny; ++j) {
+    float *destination = image.pixels +
+                         static_cast<long>(y0 + j) * image.width + x0;
+    memcpy(destination, &values[j * nx], nx * sizeof(float));
+  }
+  return true;
+}
+
+// Returns whether the keyword should be dropped when converting a compressed
+// header to an image header.
+bool IsTableKeyword(const string &keyword) {
+  static const char *kTableKeywords[] = {
+    "XTENSION", "SIMPLE", "BITPIX", "PCOUNT", "GCOUNT", "TFIELDS", "THEAP",
+    "ZIMAGE", "ZBITPIX", "ZCMPTYPE", "ZQUANTIZ", "ZDITHER0", "ZSIMPLE",
+    "ZEXTEND", "ZBLOCKED", "ZTENSION", "ZPCOUNT", "ZGCOUNT", "ZHECKSUM",
+    "ZDATASUM", "CHECKSUM", "DATASUM", "END"
+  };
+  static const char *kTablePrefixes[] = {
+    "NAXIS", "TTYPE", "TFORM", "TUNIT", "TDIM", "TNULL", "TSCAL", "TZERO",
+    "ZNAXIS", "ZTILE", "ZNAME", "ZVAL"
+  };
+
+  for (size_t i = 0; i < sizeof(kTableKeywords) / sizeof(char *); ++i) {
+    if (keyword == kTableKeywords[i]) return true;
+  }
+  for (size_t i = 0; i < sizeof(kTablePrefixes) / sizeof(char *); ++i) {
+    if (StringStartsWith(keyword, kTablePrefixes[i])) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Returns a card containing an integer value.
+string IntCard(const string &keyword, int64 value, const string &comment) {
+  string card = StringPrintf("%-8s= %20lld / %-47s", keyword.c_str(),
+                             static_cast<long long>(value), comment.c_str());
+  card.resize(FITS_CARD_SIZE, ' ');
+  return card;
+}
+
+// Finds the column with the given name, returning false if the table
+// description is invalid.
+bool FindColumn(const string &header, const string &name, Column *column) {
+  int num_fields = Fits::HeaderReadKeywordInt(header, "TFIELDS", 0);
+  int offset = 0;
+  for (int i = 1; i <= num_fields; ++i) {
+    string tform = Fits::HeaderReadKeywordString(
+        header, StringPrintf("TFORM%d", i), "");
+    string ttype = Fits::HeaderReadKeywordString(
+        header, StringPrintf("TTYPE%d", i), "");
+
+    Column current;
+    int width;
+    if (!ParseTform(tform, &current, &width)) {
+      fprintf(stderr, "Unsupported column format '%s'\n", tform.c_str());
+      return false;
+    }
+
+    if (ttype == name) {
+      current.offset = offset;
+      *column = current;
+      return true;
+    }
+    offset += width;
+  }
+  return true;
+}
+
+}  // namespace
+
+bool FitsCompression::IsCompressedImage(const string &header) {
+  return Fits::HeaderReadKeywordString(header, "XTENSION", "") ==
+             "BINTABLE" &&
+         Fits::HeaderReadKeywordBool(header, "ZIMAGE", false);
+}
+
+// Builds the image header by writing the mandatory keywords from their Z
+// counterparts and then copying every card that doesn't describe the table.
+void FitsCompression::ConvertHeader(const string &compressed_header,
+                                    string *image_header) {
+  CHECK(IsCompressedImage(compressed_header))
+      << "Header doesn't describe a tile-compressed image";
+
+  string header;
+  string simple_card = StringPrintf("%-8s= %20s / %-47s", "SIMPLE", "T",
+                                    "Conforms to FITS standard");
+  simple_card.resize(FITS_CARD_SIZE, ' ');
+  header.append(simple_card);
+
+  int bitpix = Fits::HeaderReadKeywordInt(compressed_header, "ZBITPIX", 0);
+  header.append(IntCard("BITPIX", bitpix, "Bits per pixel"));
+
+  int naxis = Fits::HeaderReadKeywordInt(compressed_header, "ZNAXIS", 0);
+  header.append(IntCard("NAXIS", naxis, "Number of axes"));
+  for (int i = 1; i <= naxis; ++i) {
+    int64 length = Fits::HeaderReadKeywordInt64(
+        compressed_header, StringPrintf("ZNAXIS%d", i), 0);
+    header.append(IntCard(StringPrintf("NAXIS%d", i), length,
+                          StringPrintf("Length of axis %d", i)));
+  }
+
+  for (size_t i = 0; i + FITS_CARD_SIZE <= compressed_header.size();
+       i += FITS_CARD_SIZE) {
+    string keyword = compressed_header.substr(i, FITS_KEYWORD_SIZE);
+    StringStripTrailingWhiteSpace(&keyword);
+    if (!IsTableKeyword(keyword)) {
+      header.append(compressed_header, i, FITS_CARD_SIZE);
+    }
+  }
+
+  string end_card("END");
+  end_card.resize(FITS_CARD_SIZE, ' ');
+  header.append(end_card);
+  image_header->assign(header);
+}
+
+// Sets up the description of the table and heap and then splits the rows of
+// the table that hold the plane into contiguous chunks, one or more per
+// thread.
+bool FitsCompression::DecompressImage(const string &header,
+                                      const uint8 *data, long data_size,
+                                      int plane, int num_threads,
+                                      float *pixels) {
+  CompressedImage image;
+  image.table = data;
+  image.row_size = Fits::HeaderReadKeywordInt(header, "NAXIS1", 0);
+  int num_rows = Fits::HeaderReadKeywordInt(header, "NAXIS2", 0);
+  long table_size = static_cast<long>(image.row_size) * num_rows;
+  long heap_offset = Fits::HeaderReadKeywordInt64(header, "THEAP",
+                                                  table_size);
+  if (table_size > data_size || heap_offset > data_size) {
+    fprintf(stderr, "Compressed image data is truncated\n");
+    return false;
+  }
+  image.heap = data + heap_offset;
+  image.heap_size = data_size - heap_offset;
+
+  if (!FindColumn(header, "COMPRESSED_DATA", &image.compressed_data) ||
+      !FindColumn(header, "GZIP_COMPRESSED_DATA", &image.gzip_data) ||
+      !FindColumn(header, "UNCOMPRESSED_DATA", &image.uncompressed_data) ||
+      !FindColumn(header, "ZSCALE", &image.zscale) ||
+      !FindColumn(header, "ZZERO", &image.zzero) ||
+      !FindColumn(header, "ZBLANK", &image.zblank)) {
+    return false;
+  }
+  if (!image.compressed_data.exists() ||
+      !image.compressed_data.is_descriptor) {
+    fprintf(stderr, "Compressed image lacks a COMPRESSED_DATA column\n");
+    return false;
+  }
+
+  string algorithm = Fits::HeaderReadKeywordString(header, "ZCMPTYPE", "");
+  if (algorithm == "RICE_1" || algorithm == "RICE_ONE") {
+    image.algorithm = RICE_1;
+  } else if (algorithm == "GZIP_1") {
+    image.algorithm = GZIP_1;
+  } else if (algorithm == "GZIP_2") {
+    image.algorithm = GZIP_2;
+  } else {
+    fprintf(stderr, "Unsupported compression algorithm '%s'\n",
+            algorithm.c_str());
+    return false;
+  }
+
+  image.bitpix = Fits::HeaderReadKeywordInt(header, "ZBITPIX", 0);
+  image.width = Fits::HeaderReadKeywordInt(header, "ZNAXIS1", 0);
+  image.height = Fits::HeaderReadKeywordInt(header, "ZNAXIS2", 1);
+  image.tile_width = Fits::HeaderReadKeywordInt(header, "ZTILE1",
+                                                image.width);
+  image.tile_height = Fits::HeaderReadKeywordInt(header, "ZTILE2", 1);
+  if (image.width <= 0 || image.height <= 0 || image.tile_width <= 0 ||
+      image.tile_height <= 0) {
+    fprintf(stderr, "Invalid compressed image dimensions\n");
+    return false;
+  }
+  image.tiles_per_row = (image.width + image.tile_width - 1) /
+                        image.tile_width;
+  int tiles_per_column = (image.height + image.tile_height - 1) /
+                         image.tile_height;
+
+  // Planes of cubes must be tiled separately, which is the default.
+  int naxis = Fits::HeaderReadKeywordInt(header, "ZNAXIS", 2);
+  for (int i = 3; i <= naxis; ++i) {
+    if (Fits::HeaderReadKeywordInt(header, StringPrintf("ZTILE%d", i),
+                                   1) != 1) {
+      fprintf(stderr, "Tiles spanning several planes are not supported\n");
+      return false;
+    }
+  }
+  image.first_tile = plane * image.tiles_per_row * tiles_per_column;
+  if (plane < 0 ||
+      num_rows < image.first_tile + image.tiles_per_row * tiles_per_column) {
+    fprintf(stderr, "Compressed image has too few tiles\n");
+    return false;
+  }
+
+  // Compression parameters are given as ZNAMEi = name, ZVALi = value pairs.
+  image.block_size = 32;
+  image.bytepix = (image.bitpix > 0) ? min(image.bitpix / 8, 4) : 4;
+  for (int i = 1; ; ++i) {
+    string name = Fits::HeaderReadKeywordString(
+        header, StringPrintf("ZNAME%d", i), "");
+    if (name.empty()) break;
+    int value = Fits::HeaderReadKeywordInt(header, StringPrintf("ZVAL%d", i),
+                                           0);
+    if (name == "BLOCKSIZE") {
+      image.block_size = value;
+    } else if (name == "BYTEPIX") {
+      image.bytepix = value;
+    }
+  }
+
+  // Integer images keep BSCALE, BZERO, and BLANK in the header.
+  image.scale = Fits::HeaderReadKeywordDouble(header, "BSCALE", 1.0);
+  image.zero = Fits::HeaderReadKeywordDouble(header, "BZERO", 0.0);
+  if (image.bitpix > 0) {
+    image.has_blank = Fits::HeaderHasKeyword(header, "BLANK");
+    image.blank = Fits::HeaderReadKeywordInt64(header, "BLANK", 0);
+  } else {
+    image.has_blank = true;
+    image.blank = Fits::HeaderReadKeywordInt64(header, "ZBLANK", NULL_VALUE);
+  }
+
+  string quantization = Fits::HeaderReadKeywordString(header, "ZQUANTIZ",
+                                                      "NO_DITHER");
+  if (quantization == "SUBTRACTIVE_DITHER_1") {
+    image.quantization = SUBTRACTIVE_DITHER_1;
+  } else if (quantization == "SUBTRACTIVE_DITHER_2") {
+    image.quantization = SUBTRACTIVE_DITHER_2;
+  } else {
+    image.quantization = NO_DITHER;
+  }
+  image.dither_seed = Fits::HeaderReadKeywordInt(header, "ZDITHER0", 1);
+  image.pixels = pixels;
+
+  // Use a few chunks per thread so that uneven tiles balance out.
+  int num_tiles = image.tiles_per_row * tiles_per_column;
+  int num_chunks = min(num_tiles, max(num_threads, 1) * 4);
+  bool *success = new bool[num_chunks];
+  {
+    ThreadPool pool(num_threads);
+    for (int i = 0; i < num_chunks; ++i) {
+      int first_row = static_cast<int>(static_cast<int64>(num_tiles) * i /
+                                       num_chunks);
+      int last_row = static_cast<int>(static_cast<int64>(num_tiles) *
+                                      (i + 1) / num_chunks);
+      pool.Add(new DecompressTilesTask(&image, image.first_tile + first_row,
+                                       image.first_tile + last_row,
+                                       &success[i]));
+    }
+    pool.Wait();
+  }
+
+  bool all_succeeded = true;
+  for (int i = 0; i < num_chunks; ++i) {
+    all_succeeded = all_succeeded && success[i];
+  }
+  delete[] success;
+  return all_succeeded;
+}
+
+// This is a port of the Rice decoder in CFITSIO (ricecomp.c), generalized
+// over the number of bytes per pixel.  Each block of block_size differences
+// is preceded by a code giving the number of low order bits stored
+// verbatim (fs).  A code of 0 means every difference is 0, and the maximum
+// code means the differences are stored without compression.
+bool FitsCompression::RiceDecompress(const uint8 *input, int input_size,
+                                     int block_size, int bytepix,
+                                     int num_values, int *output) {
+  int fsbits, fsmax, bbits;
+  if (bytepix == 1) {
+    fsbits = 3;
+    fsmax = 6;
+  } else if (bytepix == 2) {
+    fsbits = 4;
+    fsmax = 14;
+  } else if (bytepix == 4) {
+    fsbits = 5;
+    fsmax = 25;
+  } else {
+    fprintf(stderr, "Invalid Rice BYTEPIX value: %d\n", bytepix);
+    return false;
+  }
+  bbits = 1 << fsbits;
+  if (input_size < bytepix + 1 || block_size <= 0) {
+    return false;
+  }
+
+  pthread_once(&tables_once, InitTables);
+
+  const uint8 *c = input;
+  const uint8 *end = input + input_size;
+
+  // The first value is stored verbatim in big endian order.
+  uint last_value = 0;
+  for (int i = 0; i < bytepix; ++i) {
+    last_value = (last_value << 8) | NextByte(&c, end);
+  }
+  uint value_mask = (bytepix == 4) ? 0xffffffffu : ((1u << (8 * bytepix)) - 1);
+
+  uint b = NextByte(&c, end);
+  int num_bits = 8;
+
+  for (int i = 0; i < num_values; ) {
+    // Read the code for the next block.
+    num_bits -= fsbits;
+    while (num_bits < 0) {
+      b = (b << 8) | NextByte(&c, end);
+      num_bits += 8;
+    }
+    int fs = static_cast<int>(b >> num_bits) - 1;
+    b &= (1u << num_bits) - 1;
+
+    int block_end = min(i + block_size, num_values);
+    if (fs < 0) {
+      // Low entropy case: all differences are 0.
+      for ( ; i < block_end; ++i) {
+        output[i] = last_value;
+      }
+    } else if (fs == fsmax) {
+      // High entropy case: differences are stored verbatim.
+      for ( ; i < block_end; ++i) {
+        int k = bbits - num_bits;
+        uint diff = (k < 32) ? (b << k) : 0;
+        for (k -= 8; k >= 0; k -= 8) {
+          b = NextByte(&c, end);
+          diff |= b << k;
+        }
+        if (num_bits > 0) {
+          b = NextByte(&c, end);
+          diff |= b >> (-k);
+          b &= (1u << num_bits) - 1;
+        } else {
+          b = 0;
+        }
+
+        // Undo the mapping of signed differences to unsigned values.
+        diff = (diff & 1) ? ~(diff >> 1) : (diff >> 1);
+        last_value = (diff + last_value) & value_mask;
+        output[i] = last_value;
+      }
+    } else {
+      // Normal case: differences are Rice coded.
+      for ( ; i < block_end; ++i) {
+        // Count the leading zeros.
+        while (b == 0) {
+          if (c > end) return false;
+          num_bits += 8;
+          b = NextByte(&c, end);
+        }
+        int num_zeros = num_bits - nonzero_count[b];
+        num_bits -= num_zeros + 1;
+
+        // Flip the leading one bit and read the remaining fs bits.
+        b ^= 1u << num_bits;
+        num_bits -= fs;
+        while (num_bits < 0) {
+          b = (b << 8) | NextByte(&c, end);
+          num_bits += 8;
+        }
+        uint diff = (static_cast<uint>(num_zeros) << fs) | (b >> num_bits);
+        b &= (1u << num_bits) - 1;
+
+        diff = (diff & 1) ? ~(diff >> 1) : (diff >> 1);
+        last_value = (diff + last_value) & value_mask;
+        output[i] = last_value;
+      }
+    }
+
+    if (c > end) {
+      fprintf(stderr, "Rice decompression hit end of compressed data\n");
+      return false;
+    }
+  }
+
+  // Sign extend the values.  Unsigned bytes are left alone to match the
+  // FITS convention for BITPIX = 8.
+  if (bytepix == 2) {
+    for (int i = 0; i < num_values; ++i) {
+      output[i] = static_cast<int16>(output[i]);
+    }
+  }
+  return true;
+}
+
+// Uses zlib's automatic header detection so that both zlib and gzip streams
+// are accepted.
+bool FitsCompression::GzipDecompress(const uint8 *input, int input_size,
+                                     uint8 *output, int output_size) {
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  if (inflateInit2(&stream, 15 + 32) != Z_OK) {
+    return false;
+  }
+
+  stream.next_in = const_cast<Bytef *>(input);
+  stream.avail_in = input_size;
+  stream.next_out = output;
+  stream.avail_out = output_size;
+
+  int status = inflate(&stream, Z_FINISH);
+  bool success = status == Z_STREAM_END &&
+                 static_cast<int>(stream.total_out) == output_size;
+  inflateEnd(&stream);
+  return success;
+}
+
+}  // namespace google_sky
@@ -0,0 +1,120 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// Defines the FitsCompression class for reading tile-compressed FITS images
+//
+// The tiled image compression convention (used by fpack and CFITSIO) stores
+// an image as a BINTABLE extension with ZIMAGE = T.  The image is divided
+// into rectangular tiles (by default each tile is a single row) and each
+// tile is compressed separately and stored as a variable length array in the
+// heap of the table.  The keywords describing the original image are
+// prefixed with Z, e.g. ZBITPIX, ZNAXIS1, and ZNAXIS2, and the shape of the
+// tiles is given by ZTILE1 and ZTILE2.
+//
+// Floating point images are quantized to integers before compression.  Each
+// tile then has its own scale and offset stored in the ZSCALE and ZZERO
+// columns, and the quantization may have been dithered with a pseudo-random
+// sequence (ZQUANTIZ = 'SUBTRACTIVE_DITHER_1') that must be reproduced
+// exactly in order to restore the values.
+//
+// Only the RICE_1, GZIP_1, and GZIP_2 algorithms are supported since these
+// account for nearly all fpack-ed survey data.  See
+// http://fits.gsfc.nasa.gov/registry/tilecompression.html for the full
+// convention.
+
+#ifndef FITSCOMPRESSION_H__
+#define FITSCOMPRESSION_H__
+
+#include <string>
+
+#include "base.h"
+
+namespace google_sky {
+
+// Class for decompressing tile-compressed FITS images
+//
+// This is a static only class.  Tiles are independent of one another, so
+// they are decompressed in parallel using a ThreadPool.  Callers normally
+// go through FitsImage rather than using this class directly.
+//
+// Example Usage:
+//
+// // Converts the header of a compressed image to that of the image.
+// string image_header;
+// if (FitsCompression::IsCompressedImage(header)) {
+//   FitsCompression::ConvertHeader(header, &image_header);
+// }
+//
+// // Decompresses the image given the raw bytes of the BINTABLE HDU.
+// float *pixels = new float[width * height];
+// CHECK(FitsCompression::DecompressImage(header, data, data_size, 0, 4,
+//                                        pixels));
+
+class FitsCompression {
+ public:
+  // Returns whether the given header describes a tile-compressed image.
+  static bool IsCompressedImage(const string &header);
+
+  // Converts the header of a tile-compressed image to the header of the
+  // equivalent uncompressed image by restoring the Z keywords and removing
+  // the keywords that describe the binary table.
+  static void ConvertHeader(const string &compressed_header,
+                            string *image_header);
+
+  // Decompresses the given plane (0 for 2 dimensional images) of the image
+  // in the data unit of a compressed HDU.  The data unit (table plus heap)
+  // must be data_size bytes long.  Pixels are returned as floats in FITS
+  // order (the first row is the bottom row of the image) with null pixels set
+  // to NaN.  Returns whether decompression was successful.
+  static bool DecompressImage(const string &header, const uint8 *data,
+                              long data_size, int plane, int num_threads,
+                              float *pixels);
+
+  // Decompresses num_values integers of size bytepix (1, 2, or 4) that were
+  // Rice compressed in blocks of block_size values.  Returns whether the
+  // compressed data was valid.
+  static bool RiceDecompress(const uint8 *input, int input_size,
+                             int block_size, int bytepix, int num_values,
+                             int *output);
+
+  // Inflates zlib or gzip compressed data, which must decompress to exactly
+  // output_size bytes.  Returns whether the compressed data was valid.
+  static bool GzipDecompress(const uint8 *input, int input_size,
+                             uint8 *output, int output_size);
+
+ private:
+  // FitsCompression is a static only class.
+  FitsCompression();
+  ~FitsCompression() {}
+
+  DISALLOW_COPY_AND_ASSIGN(FitsCompression);
+};
+
+}  // namespace google_sky
+
+#endif  // FITSCOMPRESSION_H__
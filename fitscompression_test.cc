@@ -0,0 +1,179 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <cmath>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+#include "base.h"
+#include "fits.h"
+#include "fitscompression.h"
+#include "fitsimage.h"
+
+namespace google_sky {
+
+// A 40 x 30 16 bit image compressed with RICE_1.
+static const char *FITS_RICE_FILENAME = "testdata/fitsimage_test_rice.fits.fz";
+
+// A 40 x 30 floating point image that was quantized with
+// SUBTRACTIVE_DITHER_1 and compressed with RICE_1, along with the values
+// CFITSIO restores from it.
+static const char *FITS_FLOAT_RICE_FILENAME =
+    "testdata/fitsimage_test_float_rice.fits.fz";
+static const char *FITS_FLOAT_FILENAME = "testdata/fitsimage_test_float.fits";
+
+// Reads the compressed HDU of the given file.
+void ReadCompressedHdu(const string &filename, string *header,
+                       vector<uint8> *data) {
+  long offset;
+  ASSERT_TRUE(Fits::FindImageHdu(filename, &offset, header));
+  long data_size = Fits::HeaderReadKeywordInt(*header, "NAXIS1", 0) *
+                   Fits::HeaderReadKeywordInt(*header, "NAXIS2", 0) +
+                   Fits::HeaderReadKeywordInt(*header, "PCOUNT", 0);
+  data->resize(data_size);
+
+  FILE *fp = fopen(filename.c_str(), "rb");
+  ASSERT_TRUE(fp != NULL);
+  int status = fseek(fp, offset + Fits::PaddedHeaderSize(*header),
+                     SEEK_SET);
+  ASSERT_EQ(0, status);
+  long num_read = fread(&(*data)[0], 1, data_size, fp);
+  ASSERT_EQ(data_size, num_read);
+  fclose(fp);
+}
+
+int Main(int argc, char **argv) {
+  {
+    cout << "Testing IsCompressedImage()... ";
+    string header;
+    Fits::ReadHeader(FITS_RICE_FILENAME, 0, &header);
+    ASSERT_FALSE(FitsCompression::IsCompressedImage(header));
+    Fits::ReadHeader(FITS_RICE_FILENAME, 2880, &header);
+    ASSERT_TRUE(FitsCompression::IsCompressedImage(header));
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing ConvertHeader()... ";
+    string header;
+    Fits::ReadHeader(FITS_FLOAT_RICE_FILENAME, 2880, &header);
+
+    string image_header;
+    FitsCompression::ConvertHeader(header, &image_header);
+    ASSERT_EQ(0, static_cast<int>(image_header.size()) % 80);
+    ASSERT_EQ(0, image_header.compare(0, 6, "SIMPLE"));
+    ASSERT_EQ(0, image_header.compare(image_header.size() - 80, 3, "END"));
+    ASSERT_EQ(-32, Fits::HeaderReadKeywordInt(image_header, "BITPIX", 0));
+    ASSERT_EQ(2, Fits::HeaderReadKeywordInt(image_header, "NAXIS", 0));
+    ASSERT_EQ(40, Fits::HeaderReadKeywordInt(image_header, "NAXIS1", 0));
+    ASSERT_EQ(30, Fits::HeaderReadKeywordInt(image_header, "NAXIS2", 0));
+    ASSERT_EQ("RA---TAN",
+              Fits::HeaderReadKeywordString(image_header, "CTYPE1", ""));
+    ASSERT_FALSE(Fits::HeaderHasKeyword(image_header, "XTENSION"));
+    ASSERT_FALSE(Fits::HeaderHasKeyword(image_header, "ZTILE1"));
+    ASSERT_FALSE(Fits::HeaderHasKeyword(image_header, "TTYPE1"));
+    ASSERT_FALSE(Fits::HeaderHasKeyword(image_header, "PCOUNT"));
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing DecompressImage()... ";
+    string header;
+    vector<uint8> data;
+    ReadCompressedHdu(FITS_FLOAT_RICE_FILENAME, &header, &data);
+
+    FitsImage expected;
+    ASSERT_TRUE(expected.Read(FITS_FLOAT_FILENAME));
+
+    // The dithered values must match CFITSIO exactly regardless of the
+    // number of threads used.
+    for (int num_threads = 1; num_threads <= 4; num_threads += 3) {
+      vector<float> pixels(40 * 30, 0.0);
+      ASSERT_TRUE(FitsCompression::DecompressImage(header, &data[0],
+                                                   data.size(), 0,
+                                                   num_threads, &pixels[0]));
+      for (int j = 0; j < 30; ++j) {
+        for (int i = 0; i < 40; ++i) {
+          ASSERT_EQ(expected.GetValue(i, j), pixels[j * 40 + i]);
+        }
+      }
+    }
+
+    // Truncated data fails cleanly.
+    vector<float> pixels(40 * 30);
+    ASSERT_FALSE(FitsCompression::DecompressImage(header, &data[0], 100, 0,
+                                                  1, &pixels[0]));
+
+    // The image has only one plane.
+    ASSERT_FALSE(FitsCompression::DecompressImage(header, &data[0],
+                                                  data.size(), 1, 1,
+                                                  &pixels[0]));
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing GzipDecompress()... ";
+    uint8 input[1000];
+    for (int i = 0; i < 1000; ++i) {
+      input[i] = static_cast<uint8>(i % 7);
+    }
+
+    uLongf compressed_size = compressBound(sizeof(input));
+    vector<uint8> compressed(compressed_size);
+    int status = compress(&compressed[0], &compressed_size, input,
+                          sizeof(input));
+    ASSERT_EQ(Z_OK, status);
+
+    uint8 output[1000];
+    ASSERT_TRUE(FitsCompression::GzipDecompress(&compressed[0],
+                                                compressed_size, output,
+                                                sizeof(output)));
+    for (int i = 0; i < 1000; ++i) {
+      ASSERT_EQ(input[i], output[i]);
+    }
+
+    // The output size must match exactly.
+    ASSERT_FALSE(FitsCompression::GzipDecompress(&compressed[0],
+                                                 compressed_size, output,
+                                                 500));
+    cout << "pass\n";
+  }
+
+  cout << "Passed\n";
+  return 0;
+}
+
+}  // namespace google_sky
+
+int main(int argc, char **argv) {
+  return google_sky::Main(argc, argv);
+}
@@ -0,0 +1,423 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+#include "fitsimage.h"
+
+#include <cmath>
+#include <cstdio>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+#include "fits.h"
+#include "fitscompression.h"
+#include "image.h"
+#include "string_util.h"
+#include "threadpool.h"
+
+namespace google_sky {
+
+namespace {
+
+// Parameters for sampling pixels in GetPercentileRange().  These match the
+// defaults in python/fitsimage.py.
+static const int NUM_SAMPLE_POINTS = 5000;
+static const int NUM_SAMPLES_PER_ROW = 250;
+
+// Maximum number of bytes of raw pixel data held in memory at once when
+// decoding uncompressed images.
+static const long READ_BUFFER_SIZE = 1 << 20;
+
+// Reads num_bytes from fp into data, splitting the read into pieces small
+// enough for gzread().  Returns whether all of the bytes were read.
+bool ReadBytes(gzFile fp, long num_bytes, uint8 *data) {
+  while (num_bytes > 0) {
+    int chunk_size = static_cast<int>(min(num_bytes, READ_BUFFER_SIZE));
+    if (gzread(fp, data, chunk_size) != chunk_size) {
+      return false;
+    }
+    data += chunk_size;
+    num_bytes -= chunk_size;
+  }
+  return true;
+}
+
+}  // namespace
+
+FitsImage::FitsImage()
+    : pixels_(NULL), width_(0), height_(0), plane_(0),
+      num_threads_(ThreadPool::DefaultNumThreads()),
+      null_transparent_(false), stream_(NULL) {
+  // Nothing needed.
+}
+
+FitsImage::~FitsImage() {
+  Clear();
+  CloseStream();
+}
+
+void FitsImage::Clear() {
+  delete[] pixels_;
+  pixels_ = NULL;
+  width_ = 0;
+  height_ = 0;
+  header_.clear();
+}
+
+gzFile FitsImage::OpenStream(const string &fits_filename) {
+  if (stream_ != NULL && stream_filename_ == fits_filename) {
+    return stream_;
+  }
+  CloseStream();
+  stream_ = gzopen(fits_filename.c_str(), "rb");
+  stream_filename_ = fits_filename;
+  if (stream_ == NULL) {
+    fprintf(stderr, "Can't open FITS file %s\n", fits_filename.c_str());
+  }
+  return stream_;
+}
+
+void FitsImage::CloseStream() {
+  if (stream_ != NULL) {
+    gzclose(stream_);
+    stream_ = NULL;
+  }
+}
+
+// Finds the first image HDU and reads it.  The headers are walked on the
+// same stream that the pixels are read from, so the data that follows the
+// image header is read without seeking back to the start of the file.
+bool FitsImage::Read(const string &fits_filename) {
+  Clear();
+
+  // Reading starts from the beginning of the file, so a fresh stream costs
+  // nothing and picks up files that changed since the last read.  Fits dies
+  // on files that can't be opened, so check for them here.
+  CloseStream();
+  gzFile fp = OpenStream(fits_filename);
+  if (fp == NULL) {
+    return false;
+  }
+
+  long offset;
+  string hdu_header;
+  if (!Fits::FindImageHdu(fp, fits_filename, &offset, &hdu_header)) {
+    fprintf(stderr, "No image found in FITS file %s\n",
+            fits_filename.c_str());
+    return false;
+  }
+  return ReadHdu(fits_filename, offset, hdu_header);
+}
+
+// Reads either the raw pixel values that follow the header or the whole
+// binary table and heap of a compressed image.  Files are read through zlib
+// so that gzipped files are inflated as they are read.  Raw pixel values
+// are decoded a block of rows at a time so that only the float image is held
+// in memory.
+bool FitsImage::ReadHdu(const string &fits_filename, long offset,
+                        const string &hdu_header) {
+  Clear();
+
+  gzFile fp = OpenStream(fits_filename);
+  if (fp == NULL) {
+    return false;
+  }
+  long data_offset = offset + Fits::PaddedHeaderSize(hdu_header);
+
+  bool is_compressed = FitsCompression::IsCompressedImage(hdu_header);
+  if (is_compressed) {
+    FitsCompression::ConvertHeader(hdu_header, &header_);
+  } else {
+    header_.assign(hdu_header);
+  }
+
+  int width = Fits::HeaderReadKeywordInt(header_, "NAXIS1", 0);
+  int height = Fits::HeaderReadKeywordInt(header_, "NAXIS2", 0);
+  int bitpix = Fits::HeaderReadKeywordInt(header_, "BITPIX", 0);
+  if (width <= 0 || height <= 0) {
+    fprintf(stderr, "Invalid image dimensions in %s\n",
+            fits_filename.c_str());
+    return false;
+  }
+
+  int num_planes = NumPlanes(header_);
+  if (plane_ < 0 || plane_ >= num_planes) {
+    fprintf(stderr, "Plane %d doesn't exist in %s (%d planes)\n", plane_,
+            fits_filename.c_str(), num_planes);
+    return false;
+  }
+
+  long num_pixels = static_cast<long>(width) * height;
+  try {
+    pixels_ = new float[num_pixels];
+  } catch (...) {
+    return false;
+  }
+  width_ = width;
+  height_ = height;
+
+  // Planes of uncompressed cubes follow one another in the data unit.
+  if (!is_compressed) {
+    data_offset += static_cast<long>(plane_) * num_pixels * (abs(bitpix) / 8);
+  }
+
+  bool success = gzseek(fp, data_offset, SEEK_SET) == data_offset;
+  if (success && is_compressed) {
+    long data_size = static_cast<long>(
+        Fits::HeaderReadKeywordInt(hdu_header, "NAXIS1", 0)) *
+        Fits::HeaderReadKeywordInt(hdu_header, "NAXIS2", 0) +
+        Fits::HeaderReadKeywordInt64(hdu_header, "PCOUNT", 0);
+    vector<uint8> data(data_size);
+    success = ReadBytes(fp, data_size, &data[0]) &&
+              FitsCompression::DecompressImage(
+                  hdu_header, &data[0], data_size, plane_,
+                  num_threads_, pixels_);
+  } else if (success) {
+    double bscale = Fits::HeaderReadKeywordDouble(header_, "BSCALE", 1.0);
+    double bzero = Fits::HeaderReadKeywordDouble(header_, "BZERO", 0.0);
+    bool has_blank = bitpix > 0 && Fits::HeaderHasKeyword(header_, "BLANK");
+    int64 blank = Fits::HeaderReadKeywordInt64(header_, "BLANK", 0);
+
+    long row_size = static_cast<long>(width) * (abs(bitpix) / 8);
+    int rows_per_read = static_cast<int>(max(1L, READ_BUFFER_SIZE /
+                                                 max(1L, row_size)));
+    vector<uint8> buffer(rows_per_read * row_size);
+
+    success = row_size > 0;
+    for (int row = 0; success && row < height; row += rows_per_read) {
+      int num_rows = min(rows_per_read, height - row);
+      success = ReadBytes(fp, num_rows * row_size, &buffer[0]);
+      if (success) {
+        Fits::DecodePixels(&buffer[0], bitpix,
+                           static_cast<long>(num_rows) * width, bscale,
+                           bzero, has_blank, blank,
+                           pixels_ + static_cast<long>(row) * width);
+      }
+    }
+  }
+
+  if (!success) {
+    fprintf(stderr, "Couldn't read image data from %s\n",
+            fits_filename.c_str());
+    Clear();
+    CloseStream();
+  }
+  return success;
+}
+
+// Follows the same steps as ReadHdu(), but decodes each block of rows into
+// integers and nulls the matching pixels instead of storing the values.
+bool FitsImage::ApplyQualityHdu(const string &fits_filename, long offset,
+                                const string &hdu_header, int64 bad_bits) {
+  CHECK(pixels_ != NULL) << "Image hasn't been read";
+
+  bool is_compressed = FitsCompression::IsCompressedImage(hdu_header);
+  string header;
+  if (is_compressed) {
+    FitsCompression::ConvertHeader(hdu_header, &header);
+  } else {
+    header.assign(hdu_header);
+  }
+
+  int width = Fits::HeaderReadKeywordInt(header, "NAXIS1", 0);
+  int height = Fits::HeaderReadKeywordInt(header, "NAXIS2", 0);
+  int bitpix = Fits::HeaderReadKeywordInt(header, "BITPIX", 0);
+  if (width != width_ || height != height_ ||
+      plane_ >= NumPlanes(header)) {
+    fprintf(stderr, "Data quality image in %s doesn't match the image\n",
+            fits_filename.c_str());
+    return false;
+  }
+  if (bitpix <= 0) {
+    fprintf(stderr, "Data quality image in %s doesn't hold integers\n",
+            fits_filename.c_str());
+    return false;
+  }
+
+  gzFile fp = OpenStream(fits_filename);
+  if (fp == NULL) {
+    return false;
+  }
+  long data_offset = offset + Fits::PaddedHeaderSize(hdu_header);
+  long num_pixels = static_cast<long>(width) * height;
+  if (!is_compressed) {
+    data_offset += static_cast<long>(plane_) * num_pixels * (bitpix / 8);
+  }
+
+  bool success = gzseek(fp, data_offset, SEEK_SET) == data_offset;
+  if (success && is_compressed) {
+    long data_size = static_cast<long>(
+        Fits::HeaderReadKeywordInt(hdu_header, "NAXIS1", 0)) *
+        Fits::HeaderReadKeywordInt(hdu_header, "NAXIS2", 0) +
+        Fits::HeaderReadKeywordInt64(hdu_header, "PCOUNT", 0);
+    vector<uint8> data(data_size);
+    vector<float> flags(num_pixels);
+    success = ReadBytes(fp, data_size, &data[0]) &&
+              FitsCompression::DecompressImage(
+                  hdu_header, &data[0], data_size, plane_,
+                  num_threads_, &flags[0]);
+    for (long k = 0; success && k < num_pixels; ++k) {
+      if (!isnan(flags[k]) && (static_cast<int64>(flags[k]) & bad_bits)) {
+        pixels_[k] = NAN;
+      }
+    }
+  } else if (success) {
+    // Unsigned 64 bit images have a BZERO of 2^63, which is the same as
+    // -2^63 once the sum wraps around.
+    double bzero_value = Fits::HeaderReadKeywordDouble(header, "BZERO", 0.0);
+    int64 bzero = (bzero_value >= 9223372036854775807.0) ?
+                  static_cast<int64>(static_cast<uint64>(1) << 63) :
+                  static_cast<int64>(bzero_value);
+    long row_size = static_cast<long>(width) * (bitpix / 8);
+    int rows_per_read = static_cast<int>(max(1L, READ_BUFFER_SIZE /
+                                                 max(1L, row_size)));
+    vector<uint8> buffer(rows_per_read * row_size);
+    vector<int64> flags(static_cast<size_t>(rows_per_read) * width);
+
+    for (int row = 0; success && row < height; row += rows_per_read) {
+      int num_rows = min(rows_per_read, height - row);
+      long num_values = static_cast<long>(num_rows) * width;
+      success = ReadBytes(fp, num_rows * row_size, &buffer[0]);
+      if (success) {
+        Fits::DecodeIntegers(&buffer[0], bitpix, num_values, bzero,
+                             &flags[0]);
+        float *pixels = pixels_ + static_cast<long>(row) * width;
+        for (long k = 0; k < num_values; ++k) {
+          if (flags[k] & bad_bits) {
+            pixels[k] = NAN;
+          }
+        }
+      }
+    }
+  }
+
+  if (!success) {
+    fprintf(stderr, "Couldn't read data quality image from %s\n",
+            fits_filename.c_str());
+    CloseStream();
+  }
+  return success;
+}
+
+// Planes are counted over every axis after the second.
+int FitsImage::NumPlanes(const string &image_header) {
+  int naxis = Fits::HeaderReadKeywordInt(image_header, "NAXIS", 0);
+  long num_planes = 1;
+  for (int i = 3; i <= naxis; ++i) {
+    num_planes *= Fits::HeaderReadKeywordInt(
+        image_header, StringPrintf("NAXIS%d", i), 1);
+  }
+  return static_cast<int>(num_planes);
+}
+
+// Samples a regular grid of pixels that includes the corners and edges of
+// the image, sorts the samples, and picks the values at the given
+// percentiles.
+void FitsImage::GetPercentileRange(double min_percent, double max_percent,
+                                   double *zmin, double *zmax) const {
+  CHECK(pixels_ != NULL) << "Image hasn't been read";
+
+  long num_points = NUM_SAMPLE_POINTS;
+  long num_pixels = static_cast<long>(width_) * height_;
+  if (num_points > num_pixels) {
+    num_points = num_pixels / 2;
+  }
+
+  int num_per_row = min(NUM_SAMPLES_PER_ROW, width_);
+  int num_per_column = static_cast<int>(
+      static_cast<double>(num_points) / num_per_row + 0.5);
+  num_per_column = max(1, min(num_per_column, height_));
+
+  double row_skip = (num_per_row > 1) ?
+                    static_cast<double>(width_ - 1) / (num_per_row - 1) : 0.0;
+  double column_skip = (num_per_column > 1) ?
+                       static_cast<double>(height_ - 1) /
+                       (num_per_column - 1) : 0.0;
+
+  vector<float> samples;
+  samples.reserve(num_per_row * num_per_column);
+  for (int i = 0; i < num_per_row; ++i) {
+    int x = static_cast<int>(i * row_skip + 0.5);
+    for (int j = 0; j < num_per_column; ++j) {
+      int y = static_cast<int>(j * column_skip + 0.5);
+      float value = GetValue(x, y);
+      if (!isnan(value)) {
+        samples.push_back(value);
+      }
+    }
+  }
+
+  if (samples.empty()) {
+    *zmin = 0.0;
+    *zmax = 1.0;
+    return;
+  }
+
+  sort(samples.begin(), samples.end());
+  int size = static_cast<int>(samples.size());
+  int min_index = static_cast<int>(min_percent / 100.0 * size);
+  int max_index = static_cast<int>(max_percent / 100.0 * size);
+  min_index = max(0, min(min_index, size - 1));
+  max_index = max(0, min(max_index, size - 1));
+  *zmin = samples[min_index];
+  *zmax = samples[max_index];
+}
+
+// Uses the same linear scaling as python/fitsimage.py.
+void FitsImage::ToImage(double zmin, double zmax, Image *image) const {
+  CHECK(pixels_ != NULL) << "Image hasn't been read";
+  CHECK(image->Resize(width_, height_, Image::RGBA))
+      << "Couldn't allocate image";
+
+  double range = zmax - zmin;
+  double factor = (range > 0.0) ? 255.0 / range : 0.0;
+
+  uint8 null_alpha = null_transparent_ ? 0 : 255;
+  for (int j = 0; j < height_; ++j) {
+    const float *row = pixels_ + static_cast<size_t>(j) * width_;
+    uint8 *out = image->GetMutableRow(height_ - 1 - j);
+    for (int i = 0; i < width_; ++i, out += 4) {
+      double value = row[i];
+      uint8 scaled = 0;
+      uint8 alpha = null_alpha;
+      if (!isnan(value)) {
+        value = max(zmin, min(zmax, value));
+        scaled = static_cast<uint8>((value - zmin) * factor + 0.5);
+        alpha = 255;
+      }
+      out[0] = scaled;
+      out[1] = scaled;
+      out[2] = scaled;
+      out[3] = alpha;
+    }
+  }
+}
+
+}  // namespace google_sky
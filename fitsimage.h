@@ -0,0 +1,233 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// Defines the FitsImage class for reading the pixels of FITS images
+//
+// FITS images store physical values (e.g. CCD counts) rather than colors, so
+// they must be scaled to 8 bits before they can be used as an overlay.
+// FitsImage reads the first image in a FITS file as floats, whether it is
+// stored uncompressed, gzipped, or tile-compressed, and converts it to an
+// Image using a linear scaling between two limits.  The limits are normally
+// chosen by a percentile cut that mirrors percentile_range() in
+// python/fitsimage.py.
+
+#ifndef FITSIMAGE_H__
+#define FITSIMAGE_H__
+
+#include <string>
+
+#include <zlib.h>
+
+#include "base.h"
+
+namespace google_sky {
+
+class Image;
+
+// Class for reading the pixel values of FITS images
+//
+// Pixels are stored in FITS order, i.e. pixel (0, 0) is the first pixel in
+// the file, which is the lower left corner of the image when displayed.
+// Null pixels (BLANK values or NaNs) are stored as NaN.  Pixels flagged in
+// a data quality (DQ) image can also be made null with ApplyQualityHdu().
+//
+// Example Usage:
+//
+// FitsImage fits_image;
+// CHECK(fits_image.Read("foo.fits.fz")) << "Couldn't read FITS image";
+//
+// // Scale the image using a percentile cut.
+// double zmin, zmax;
+// fits_image.GetPercentileRange(3.0, 99.5, &zmin, &zmax);
+//
+// // Null out pixels with bits 0 or 4 set in a DQ extension, and make null
+// // pixels transparent.
+// fits_image.ApplyQualityHdu("foo.fits.fz", dq_offset, dq_header, 0x11);
+// fits_image.set_null_transparent(true);
+//
+// Image image;
+// fits_image.ToImage(zmin, zmax, &image);
+// CHECK(image.Write("foo.png")) << "Couldn't write image";
+
+class FitsImage {
+ public:
+  // Creates an empty image.
+  FitsImage();
+
+  // Destructor.
+  ~FitsImage();
+
+  // Reads the first image in the given FITS file along with its header.
+  // Gzipped files (.fits.gz) are inflated while they are read without
+  // writing a temporary file.  Tile-compressed images are decompressed in
+  // parallel using num_threads() threads.  Only the plane given by plane()
+  // of images with more than 2 axes is read.  Returns whether the read was
+  // successful.
+  bool Read(const string &fits_filename);
+
+  // Reads the image in the HDU whose header starts at offset in the given
+  // file.  hdu_header must be the header of that HDU as returned by
+  // Fits::FindImageHdus(), which lets callers reading several extensions
+  // avoid rereading headers.  The file is kept open between calls with the
+  // same filename, so reading HDUs in file order (e.g. SCI and then DQ)
+  // inflates a gzipped file only once.  Returns whether the read was
+  // successful.
+  bool ReadHdu(const string &fits_filename, long offset,
+               const string &hdu_header);
+
+  // Makes pixels null wherever the data quality image in the HDU whose
+  // header starts at offset has any of bad_bits set.  The DQ image must
+  // have the same dimensions (and planes) as this image and integer pixels.
+  // Uncompressed DQ values are decoded exactly a block of rows at a time
+  // and folded straight into the pixels, so no mask image is ever stored.
+  // Tile-compressed DQ values are decompressed as floats and so are exact
+  // only below 2^24.  Call this after reading the image and before
+  // GetPercentileRange() so flagged pixels don't affect the scaling.
+  // Returns whether the DQ image was read.
+  bool ApplyQualityHdu(const string &fits_filename, long offset,
+                       const string &hdu_header, int64 bad_bits);
+
+  // Determines the values at the given percentiles (from 0 to 100) of a
+  // regular grid of sample pixels.  Null pixels are ignored.
+  void GetPercentileRange(double min_percent, double max_percent,
+                          double *zmin, double *zmax) const;
+
+  // Scales the image linearly so that zmin maps to 0 and zmax maps to 255
+  // and stores the result in image as RGBA.  The image is flipped so that
+  // the first row of the FITS image is the last row of the output, which is
+  // the orientation of images produced by fits2png.py.  Null pixels are
+  // black, and also transparent if null_transparent() is set, so the alpha
+  // mask is derived in the same loop as the scaling.
+  void ToImage(double zmin, double zmax, Image *image) const;
+
+  // Returns the value of pixel i, j (i is the column, j is the row).
+  inline float GetValue(int i, int j) const {
+    CHECK(i >= 0 && i < width_) << "Invalid row pixel: " << i;
+    CHECK(j >= 0 && j < height_) << "Invalid column pixel: " << j;
+    return pixels_[static_cast<size_t>(j) * width_ + i];
+  }
+
+  // Returns the image width.
+  inline int width() const {
+    return width_;
+  }
+
+  // Returns the image height.
+  inline int height() const {
+    return height_;
+  }
+
+  // Returns the header describing the image.  For tile-compressed images
+  // this is the header of the equivalent uncompressed image.
+  inline const string &header() const {
+    return header_;
+  }
+
+  // Returns the pixel values.
+  inline const float *pixels() const {
+    return pixels_;
+  }
+
+  // Returns the plane of a data cube that is read.  This is 0 (the first
+  // plane) by default.
+  inline int plane() const {
+    return plane_;
+  }
+
+  // Sets the plane of a data cube to read.  Planes are numbered from 0 over
+  // every axis after the second, in FITS order.
+  inline void set_plane(int plane) {
+    plane_ = plane;
+  }
+
+  // Returns the number of planes described by the given image header, which
+  // is the product of NAXIS3, NAXIS4, etc. (1 for 2 dimensional images).
+  static int NumPlanes(const string &image_header);
+
+  // Returns whether ToImage() makes null pixels transparent.  This is false
+  // by default.
+  inline bool null_transparent() const {
+    return null_transparent_;
+  }
+
+  // Sets whether ToImage() makes null pixels transparent.
+  inline void set_null_transparent(bool null_transparent) {
+    null_transparent_ = null_transparent;
+  }
+
+  // Returns the number of threads used for decompression.  This is
+  // ThreadPool::DefaultNumThreads() by default.
+  inline int num_threads() const {
+    return num_threads_;
+  }
+
+  // Sets the number of threads used for decompression.  Callers that read
+  // several images concurrently should set this to 1.
+  inline void set_num_threads(int num_threads) {
+    num_threads_ = num_threads;
+  }
+
+  // Deallocates the image and resets its size and header.
+  void Clear();
+
+ private:
+  // Image pixel values in FITS order.
+  float *pixels_;
+
+  // Image properties.
+  int width_;
+  int height_;
+  string header_;
+
+  // Plane of a data cube to read.
+  int plane_;
+
+  // Number of threads used for decompression.
+  int num_threads_;
+
+  // Whether ToImage() makes null pixels transparent.
+  bool null_transparent_;
+
+  // File opened by the last read, kept open so that later reads from the
+  // same file continue from the current position instead of reopening it.
+  gzFile stream_;
+  string stream_filename_;
+
+  // Returns a stream for the given file, reusing the open one if it is for
+  // the same file.  Returns NULL if the file can't be opened.
+  gzFile OpenStream(const string &fits_filename);
+
+  // Closes the stream, e.g. after a read error.
+  void CloseStream();
+
+  DISALLOW_COPY_AND_ASSIGN(FitsImage);
+};
+
+}  // namespace google_sky
+
+#endif  // FITSIMAGE_H__
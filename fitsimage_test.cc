@@ -0,0 +1,342 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <cmath>
+#include <cstdio>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+#include "base.h"
+#include "color.h"
+#include "fits.h"
+#include "fitsimage.h"
+#include "image.h"
+
+namespace google_sky {
+
+// A 40 x 30 16 bit image with a WCS and a 2 pixel border of zeros along the
+// first 2 rows and columns.  The .fz files contain the same image compressed
+// with RICE_1 and GZIP_1.
+static const char *FITS_FILENAME = "testdata/fitsimage_test.fits";
+static const char *FITS_RICE_FILENAME = "testdata/fitsimage_test_rice.fits.fz";
+static const char *FITS_GZIP_FILENAME = "testdata/fitsimage_test_gzip.fits.fz";
+
+// The uncompressed file above run through gzip.
+static const char *FITS_GZIPPED_FILENAME = "testdata/fitsimage_test.fits.gz";
+
+// A multi-extension file whose first and last image extensions hold the
+// image above as 16 bit integers and as 32 bit floats flipped vertically and
+// scaled by 0.5.
+static const char *FITS_MEF_FILENAME = "testdata/fitsimage_test_mef.fits";
+
+// An 8 x 6 x 4 cube cut from the image above with 100 * k added to plane k,
+// uncompressed and RICE_1 compressed with one plane per tile.
+static const char *FITS_CUBE_FILENAME = "testdata/fitsimage_test_cube.fits";
+static const char *FITS_CUBE_RICE_FILENAME =
+    "testdata/fitsimage_test_cube_rice.fits.fz";
+
+// An 8 x 6 SCI extension of 16 bit integers with a BLANK pixel at (2, 1)
+// followed by an unsigned 32 bit DQ extension with bit 0 set at (0, 0), bit
+// 31 at (3, 2), bit 2 at (5, 4), and bits 1 and 30 at (7, 5).
+static const char *FITS_DQ_FILENAME = "testdata/fitsimage_test_dq.fits";
+static const char *FITS_DQ_GZIPPED_FILENAME =
+    "/tmp/fitsimage_test_dq.fits.gz";
+
+// Returns whether two images have identical pixel values.
+bool PixelsEqual(const FitsImage &a, const FitsImage &b) {
+  if (a.width() != b.width() || a.height() != b.height()) return false;
+  for (int j = 0; j < a.height(); ++j) {
+    for (int i = 0; i < a.width(); ++i) {
+      if (a.GetValue(i, j) != b.GetValue(i, j)) return false;
+    }
+  }
+  return true;
+}
+
+int Main(int argc, char **argv) {
+  {
+    cout << "Testing Read()... ";
+    FitsImage image;
+    ASSERT_TRUE(image.Read(FITS_FILENAME));
+    ASSERT_EQ(40, image.width());
+    ASSERT_EQ(30, image.height());
+    ASSERT_TRUE(Fits::HeaderHasKeyword(image.header(), "CRPIX1"));
+    ASSERT_FLOAT_EQ(0.0, image.GetValue(0, 0), 1.0e-6);
+    ASSERT_FLOAT_EQ(0.0, image.GetValue(1, 5), 1.0e-6);
+    ASSERT_FLOAT_EQ(1124.0, image.GetValue(2, 5), 1.0e-6);
+    ASSERT_FLOAT_EQ(1134.0, image.GetValue(3, 5), 1.0e-6);
+    ASSERT_FALSE(image.Read("testdata/does_not_exist.fits"));
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing Read() for compressed images... ";
+    FitsImage image;
+    ASSERT_TRUE(image.Read(FITS_FILENAME));
+
+    FitsImage rice_image;
+    ASSERT_TRUE(rice_image.Read(FITS_RICE_FILENAME));
+    ASSERT_TRUE(PixelsEqual(image, rice_image));
+    ASSERT_EQ(16, Fits::HeaderReadKeywordInt(rice_image.header(), "BITPIX",
+                                             0));
+
+    FitsImage gzip_image;
+    ASSERT_TRUE(gzip_image.Read(FITS_GZIP_FILENAME));
+    ASSERT_TRUE(PixelsEqual(image, gzip_image));
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing Read() for gzipped files... ";
+    FitsImage image;
+    ASSERT_TRUE(image.Read(FITS_FILENAME));
+
+    FitsImage gzipped_image;
+    ASSERT_TRUE(gzipped_image.Read(FITS_GZIPPED_FILENAME));
+    ASSERT_TRUE(PixelsEqual(image, gzipped_image));
+    ASSERT_EQ(image.header(), gzipped_image.header());
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing ReadHdu()... ";
+    FitsImage image;
+    ASSERT_TRUE(image.Read(FITS_FILENAME));
+
+    vector<long> offsets;
+    vector<string> headers;
+    Fits::FindImageHdus(FITS_MEF_FILENAME, &offsets, &headers);
+    ASSERT_EQ(3, static_cast<int>(offsets.size()));
+
+    FitsImage first_image;
+    ASSERT_TRUE(first_image.ReadHdu(FITS_MEF_FILENAME, offsets[0],
+                                    headers[0]));
+    ASSERT_TRUE(PixelsEqual(image, first_image));
+
+    FitsImage last_image;
+    last_image.set_num_threads(1);
+    ASSERT_TRUE(last_image.ReadHdu(FITS_MEF_FILENAME, offsets[2],
+                                   headers[2]));
+    ASSERT_EQ(40, last_image.width());
+    ASSERT_EQ(30, last_image.height());
+    ASSERT_FLOAT_EQ(562.0, last_image.GetValue(2, 24), 1.0e-6);
+    ASSERT_EQ("SCI2", Fits::HeaderReadKeywordString(last_image.header(),
+                                                    "EXTNAME", ""));
+
+    FitsImage small_image;
+    ASSERT_TRUE(small_image.ReadHdu(FITS_MEF_FILENAME, offsets[1],
+                                    headers[1]));
+    ASSERT_EQ(4, small_image.width());
+    ASSERT_EQ(3, small_image.height());
+    ASSERT_FLOAT_EQ(11.0, small_image.GetValue(3, 2), 1.0e-6);
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing Read() for cube planes... ";
+    FitsImage image;
+    ASSERT_TRUE(image.Read(FITS_FILENAME));
+
+    const char *filenames[] = {FITS_CUBE_FILENAME, FITS_CUBE_RICE_FILENAME};
+    for (int f = 0; f < 2; ++f) {
+      FitsImage cube;
+      ASSERT_TRUE(cube.Read(filenames[f]));
+      ASSERT_EQ(4, FitsImage::NumPlanes(cube.header()));
+      ASSERT_EQ(8, cube.width());
+      ASSERT_EQ(6, cube.height());
+
+      for (int k = 0; k < 4; ++k) {
+        cube.set_plane(k);
+        ASSERT_TRUE(cube.Read(filenames[f]));
+        for (int j = 0; j < 6; ++j) {
+          for (int i = 0; i < 8; ++i) {
+            ASSERT_FLOAT_EQ(image.GetValue(i + 2, j + 5) + 100.0 * k,
+                            cube.GetValue(i, j), 1.0e-6);
+          }
+        }
+      }
+
+      cube.set_plane(4);
+      ASSERT_FALSE(cube.Read(filenames[f]));
+    }
+    ASSERT_EQ(1, FitsImage::NumPlanes(image.header()));
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing ApplyQualityHdu()... ";
+    vector<long> offsets;
+    vector<string> headers;
+    Fits::FindImageHdus(FITS_DQ_FILENAME, &offsets, &headers);
+    ASSERT_EQ(2, static_cast<int>(offsets.size()));
+
+    FitsImage image;
+    ASSERT_TRUE(image.ReadHdu(FITS_DQ_FILENAME, offsets[0], headers[0]));
+    ASSERT_TRUE(isnan(image.GetValue(2, 1)));
+    ASSERT_FLOAT_EQ(100.0, image.GetValue(0, 0), 1.0e-6);
+
+    // Bits 0 and 31.  Bit 31 is only exact if decoded as an integer.
+    int64 bad_bits = (static_cast<int64>(1) << 31) | 1;
+    ASSERT_TRUE(image.ApplyQualityHdu(FITS_DQ_FILENAME, offsets[1],
+                                      headers[1], bad_bits));
+    int num_null = 0;
+    for (int j = 0; j < image.height(); ++j) {
+      for (int i = 0; i < image.width(); ++i) {
+        if (isnan(image.GetValue(i, j))) ++num_null;
+      }
+    }
+    ASSERT_EQ(3, num_null);
+    ASSERT_TRUE(isnan(image.GetValue(0, 0)));
+    ASSERT_TRUE(isnan(image.GetValue(3, 2)));
+    ASSERT_FALSE(isnan(image.GetValue(5, 4)));
+    ASSERT_FALSE(isnan(image.GetValue(7, 5)));
+
+    ASSERT_TRUE(image.ApplyQualityHdu(FITS_DQ_FILENAME, offsets[1],
+                                      headers[1], 1 << 30));
+    ASSERT_TRUE(isnan(image.GetValue(7, 5)));
+
+    // The DQ image has to match the image.
+    FitsImage other_image;
+    ASSERT_TRUE(other_image.Read(FITS_FILENAME));
+    ASSERT_FALSE(other_image.ApplyQualityHdu(FITS_DQ_FILENAME, offsets[1],
+                                             headers[1], bad_bits));
+
+    // A gzipped copy is read on one stream, in order and out of order.
+    string contents;
+    gzFile in = gzopen(FITS_DQ_FILENAME, "rb");
+    ASSERT_TRUE(in != NULL);
+    char buffer[4096];
+    int num_read;
+    while ((num_read = gzread(in, buffer, sizeof(buffer))) > 0) {
+      contents.append(buffer, num_read);
+    }
+    gzclose(in);
+    gzFile out = gzopen(FITS_DQ_GZIPPED_FILENAME, "wb");
+    ASSERT_TRUE(out != NULL);
+    gzwrite(out, contents.data(), contents.size());
+    gzclose(out);
+
+    FitsImage gzipped_image;
+    ASSERT_TRUE(gzipped_image.Read(FITS_DQ_GZIPPED_FILENAME));
+    ASSERT_TRUE(gzipped_image.ApplyQualityHdu(FITS_DQ_GZIPPED_FILENAME,
+                                              offsets[1], headers[1],
+                                              bad_bits));
+    ASSERT_TRUE(isnan(gzipped_image.GetValue(3, 2)));
+    ASSERT_FALSE(isnan(gzipped_image.GetValue(7, 5)));
+    ASSERT_TRUE(gzipped_image.ReadHdu(FITS_DQ_GZIPPED_FILENAME, offsets[0],
+                                      headers[0]));
+    ASSERT_FALSE(isnan(gzipped_image.GetValue(3, 2)));
+    ASSERT_FLOAT_EQ(100.0, gzipped_image.GetValue(0, 0), 1.0e-6);
+    remove(FITS_DQ_GZIPPED_FILENAME);
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing GetPercentileRange()... ";
+    FitsImage image;
+    ASSERT_TRUE(image.Read(FITS_FILENAME));
+
+    double zmin, zmax;
+    image.GetPercentileRange(0.0, 100.0, &zmin, &zmax);
+    ASSERT_FLOAT_EQ(0.0, zmin, 1.0e-6);
+    ASSERT_FLOAT_EQ(2011.0, zmax, 1.0e-6);
+
+    image.GetPercentileRange(50.0, 50.0, &zmin, &zmax);
+    ASSERT_FLOAT_EQ(zmin, zmax, 1.0e-6);
+    ASSERT_TRUE(zmin > 0.0 && zmin < 2011.0);
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing ToImage()... ";
+    FitsImage fits_image;
+    ASSERT_TRUE(fits_image.Read(FITS_FILENAME));
+
+    Image image;
+    fits_image.ToImage(0.0, 2011.0, &image);
+    ASSERT_EQ(40, image.width());
+    ASSERT_EQ(30, image.height());
+    ASSERT_EQ(4, image.channels());
+
+    // The first FITS row is the last row of the image.
+    Color pixel(4);
+    image.GetPixel(2, 24, &pixel);
+    uint8 expected = static_cast<uint8>(1124.0 * 255.0 / 2011.0 + 0.5);
+    ASSERT_EQ(expected, pixel.GetChannel(0));
+    ASSERT_EQ(expected, pixel.GetChannel(1));
+    ASSERT_EQ(expected, pixel.GetChannel(2));
+    ASSERT_EQ(255, pixel.GetChannel(3));
+
+    image.GetPixel(0, 29, &pixel);
+    ASSERT_EQ(0, pixel.GetChannel(0));
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing ToImage() with transparent null pixels... ";
+    vector<long> offsets;
+    vector<string> headers;
+    Fits::FindImageHdus(FITS_DQ_FILENAME, &offsets, &headers);
+    FitsImage fits_image;
+    ASSERT_TRUE(fits_image.ReadHdu(FITS_DQ_FILENAME, offsets[0],
+                                   headers[0]));
+    ASSERT_TRUE(fits_image.ApplyQualityHdu(FITS_DQ_FILENAME, offsets[1],
+                                           headers[1], 1));
+
+    // Null pixels are opaque black by default.
+    Image image;
+    fits_image.ToImage(100.0, 570.0, &image);
+    ASSERT_EQ(255, image.GetValue(2, 4, 3));
+
+    fits_image.set_null_transparent(true);
+    fits_image.ToImage(100.0, 570.0, &image);
+    for (int j = 0; j < fits_image.height(); ++j) {
+      for (int i = 0; i < fits_image.width(); ++i) {
+        bool is_null = isnan(fits_image.GetValue(i, j));
+        ASSERT_EQ(is_null ? 0 : 255,
+                  image.GetValue(i, image.height() - 1 - j, 3));
+      }
+    }
+    ASSERT_EQ(0, image.GetValue(2, 4, 3));
+    ASSERT_EQ(0, image.GetValue(0, 5, 3));
+    cout << "pass\n";
+  }
+
+  cout << "Passed\n";
+  return 0;
+}
+
+}  // namespace google_sky
+
+int main(int argc, char **argv) {
+  return google_sky::Main(argc, argv);
+}
@@ -0,0 +1,432 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#include <string>
+#include <vector>
+
+#include "base.h"
+#include "fits.h"
+#include "fitstable.h"
+#include "string_util.h"
+
+namespace {
+
+// The byte swaps below are written as shifts of whole words, which
+// compilers turn into byte swap instructions, and each type has its own
+// loop so that nothing is decided per value.
+inline google_sky::uint16 LoadBigEndian16(const google_sky::uint8 *data) {
+  return static_cast<google_sky::uint16>((data[0] << 8) | data[1]);
+}
+
+inline google_sky::uint LoadBigEndian32(const google_sky::uint8 *data) {
+  google_sky::uint value;
+  memcpy(&value, data, sizeof(value));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  return value;
+#else
+  return (value >> 24) | ((value >> 8) & 0xff00) |
+         ((value << 8) & 0xff0000) | (value << 24);
+#endif
+}
+
+inline google_sky::uint64 LoadBigEndian64(const google_sky::uint8 *data) {
+  return (static_cast<google_sky::uint64>(LoadBigEndian32(data)) << 32) |
+         LoadBigEndian32(data + 4);
+}
+
+// Returns the number of bytes of one value of a readable TFORM type.
+int TypeSize(char type) {
+  switch (type) {
+    case 'L': case 'A': case 'B': return 1;
+    case 'I': return 2;
+    case 'J': case 'E': return 4;
+    case 'K': case 'D': return 8;
+    default: return 0;
+  }
+}
+
+// Returns the number of bytes a column of a TFORM type takes in a row, or
+// -1 for unknown types.
+int FieldSize(char type, int repeat) {
+  switch (type) {
+    case 'X': return (repeat + 7) / 8;
+    case 'C': case 'P': return 8 * repeat;
+    case 'M': case 'Q': return 16 * repeat;
+    default:
+      return TypeSize(type) == 0 ? -1 : TypeSize(type) * repeat;
+  }
+}
+
+string ToLower(const string &value) {
+  string lower(value);
+  for (size_t i = 0; i < lower.size(); ++i) {
+    lower[i] = tolower(lower[i]);
+  }
+  return lower;
+}
+
+}  // namespace
+
+namespace google_sky {
+
+// FitsTable methods.
+FitsTable::FitsTable()
+    : num_rows_(0),
+      row_size_(0),
+      map_(NULL),
+      map_size_(0),
+      data_(NULL) {
+  // Nothing needed.
+}
+
+FitsTable::~FitsTable() {
+  Close();
+}
+
+bool FitsTable::Open(const string &filename, string *error) {
+  Close();
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    *error = StringPrintf("Can't open '%s'", filename.c_str());
+    return false;
+  }
+  struct stat info;
+  uint8 magic[2] = { 0, 0 };
+  if (fstat(fd, &info) != 0 || read(fd, magic, 2) < 0) {
+    close(fd);
+    *error = StringPrintf("Can't read '%s'", filename.c_str());
+    return false;
+  }
+  if (magic[0] == 0x1f && magic[1] == 0x8b) {
+    close(fd);
+    *error = StringPrintf("'%s' is compressed, so its table can't be "
+                          "mapped", filename.c_str());
+    return false;
+  }
+
+  long offset;
+  string header;
+  if (!Fits::FindTableHdu(filename, &offset, &header)) {
+    close(fd);
+    *error = StringPrintf("No BINTABLE extension in '%s'", filename.c_str());
+    return false;
+  }
+  if (!ParseColumns(header, &columns_, error)) {
+    close(fd);
+    columns_.clear();
+    *error = StringPrintf("%s in '%s'", error->c_str(), filename.c_str());
+    return false;
+  }
+  row_size_ = Fits::HeaderReadKeywordInt(header, "NAXIS1", 0);
+  num_rows_ = Fits::HeaderReadKeywordInt64(header, "NAXIS2", 0);
+
+  int64 data_offset = offset + Fits::PaddedHeaderSize(header);
+  int64 data_end = data_offset + num_rows_ * row_size_;
+  if (data_end > info.st_size) {
+    close(fd);
+    Close();
+    *error = StringPrintf("Table in '%s' is truncated", filename.c_str());
+    return false;
+  }
+
+  // Mappings start at a page boundary, so map from the page holding the
+  // first row.
+  if (data_end > data_offset) {
+    int64 page_size = sysconf(_SC_PAGESIZE);
+    int64 map_offset = data_offset - data_offset % page_size;
+    map_size_ = static_cast<size_t>(data_end - map_offset);
+    map_ = mmap(NULL, map_size_, PROT_READ, MAP_SHARED, fd, map_offset);
+    if (map_ == MAP_FAILED) {
+      map_ = NULL;
+      close(fd);
+      Close();
+      *error = StringPrintf("Can't map '%s': %s", filename.c_str(),
+                            strerror(errno));
+      return false;
+    }
+    madvise(map_, map_size_, MADV_SEQUENTIAL);
+    data_ = static_cast<const uint8 *>(map_) + (data_offset - map_offset);
+  }
+  close(fd);
+  return true;
+}
+
+void FitsTable::Close(void) {
+  if (map_ != NULL) munmap(map_, map_size_);
+  map_ = NULL;
+  map_size_ = 0;
+  data_ = NULL;
+  columns_.clear();
+  num_rows_ = 0;
+  row_size_ = 0;
+}
+
+int FitsTable::FindColumn(const string &name) const {
+  string lower = ToLower(name);
+  for (size_t i = 0; i < columns_.size(); ++i) {
+    if (ToLower(columns_[i].name) == lower) return i;
+  }
+  return -1;
+}
+
+bool FitsTable::IsNumeric(char type) {
+  return IsReadable(type) && type != 'A';
+}
+
+bool FitsTable::IsReadable(char type) {
+  return TypeSize(type) > 0;
+}
+
+void FitsTable::ReadDoubles(int column, int64 first_row, int num_rows,
+                            double *values) const {
+  CHECK(column >= 0 && column < static_cast<int>(columns_.size()));
+  CHECK(first_row >= 0 && num_rows >= 0 &&
+        first_row + num_rows <= num_rows_);
+  if (num_rows == 0) return;
+  DecodeDoubles(columns_[column], data_ + first_row * row_size_, row_size_,
+                num_rows, values);
+}
+
+void FitsTable::ReadStrings(int column, int64 first_row, int num_rows,
+                            vector<string> *values) const {
+  CHECK(column >= 0 && column < static_cast<int>(columns_.size()));
+  CHECK(first_row >= 0 && num_rows >= 0 &&
+        first_row + num_rows <= num_rows_);
+  const Column &field = columns_[column];
+  CHECK_EQ(field.type, 'A') << "Column " << field.name
+                            << " doesn't hold characters";
+  values->resize(num_rows);
+  const uint8 *row = data_ + first_row * row_size_ + field.offset;
+  for (int i = 0; i < num_rows; ++i, row += row_size_) {
+    const char *value = reinterpret_cast<const char *>(row);
+    const void *end = memchr(value, '\0', field.repeat);
+    size_t length = end == NULL ? field.repeat :
+                    static_cast<const char *>(end) - value;
+    while (length > 0 && value[length - 1] == ' ') --length;
+    (*values)[i].assign(value, length);
+  }
+}
+
+void FitsTable::ReleaseRows(int64 end_row) const {
+  if (map_ == NULL || end_row <= 0) return;
+  end_row = min(end_row, num_rows_);
+  const uint8 *start = static_cast<const uint8 *>(map_);
+  int64 page_size = sysconf(_SC_PAGESIZE);
+  int64 size = (data_ - start) + end_row * row_size_;
+  size -= size % page_size;
+  if (size > 0) madvise(map_, size, MADV_DONTNEED);
+}
+
+bool FitsTable::ParseColumns(const string &header, vector<Column> *columns,
+                             string *error) {
+  columns->clear();
+  int row_size = Fits::HeaderReadKeywordInt(header, "NAXIS1", 0);
+  int num_fields = Fits::HeaderReadKeywordInt(header, "TFIELDS", 0);
+  int offset = 0;
+  for (int i = 1; i <= num_fields; ++i) {
+    string form = Fits::HeaderReadKeywordString(
+        header, StringPrintf("TFORM%d", i), "");
+    size_t type_position = 0;
+    while (type_position < form.size() && isdigit(form[type_position])) {
+      ++type_position;
+    }
+    Column column;
+    column.type = type_position < form.size() ?
+                  toupper(form[type_position]) : ' ';
+    column.repeat = type_position == 0 ? 1 :
+                    atoi(form.substr(0, type_position).c_str());
+    column.size = FieldSize(column.type, column.repeat);
+    if (column.size < 0) {
+      *error = StringPrintf("Bad TFORM%d '%s'", i, form.c_str());
+      return false;
+    }
+    column.offset = offset;
+    column.scale = Fits::HeaderReadKeywordDouble(
+        header, StringPrintf("TSCAL%d", i), 1.0);
+    column.zero = Fits::HeaderReadKeywordDouble(
+        header, StringPrintf("TZERO%d", i), 0.0);
+    column.name = Fits::HeaderReadKeywordString(
+        header, StringPrintf("TTYPE%d", i), StringPrintf("COL%d", i));
+    columns->push_back(column);
+    offset += column.size;
+  }
+  if (offset != row_size) {
+    *error = StringPrintf("Columns of the table take %d bytes instead of "
+                          "NAXIS1 = %d", offset, row_size);
+    return false;
+  }
+  return true;
+}
+
+void FitsTable::DecodeDoubles(const Column &column, const uint8 *rows,
+                              int row_size, int num_rows, double *values) {
+  CHECK(IsNumeric(column.type)) << "Column " << column.name
+                                << " isn't numeric";
+  int repeat = column.repeat;
+  double scale = column.scale;
+  double zero = column.zero;
+  const uint8 *row = rows + column.offset;
+  switch (column.type) {
+    case 'L':
+      for (int i = 0; i < num_rows; ++i, row += row_size) {
+        for (int k = 0; k < repeat; ++k) {
+          *values++ = row[k] == 'T' ? 1.0 : (row[k] == 'F' ? 0.0 : NAN);
+        }
+      }
+      break;
+    case 'B':
+      for (int i = 0; i < num_rows; ++i, row += row_size) {
+        for (int k = 0; k < repeat; ++k) {
+          *values++ = zero + scale * row[k];
+        }
+      }
+      break;
+    case 'I':
+      for (int i = 0; i < num_rows; ++i, row += row_size) {
+        for (int k = 0; k < repeat; ++k) {
+          *values++ = zero + scale *
+                      static_cast<int16>(LoadBigEndian16(row + 2 * k));
+        }
+      }
+      break;
+    case 'J':
+      for (int i = 0; i < num_rows; ++i, row += row_size) {
+        for (int k = 0; k < repeat; ++k) {
+          *values++ = zero + scale *
+                      static_cast<int>(LoadBigEndian32(row + 4 * k));
+        }
+      }
+      break;
+    case 'K':
+      for (int i = 0; i < num_rows; ++i, row += row_size) {
+        for (int k = 0; k < repeat; ++k) {
+          *values++ = zero + scale *
+                      static_cast<double>(static_cast<int64>(
+                          LoadBigEndian64(row + 8 * k)));
+        }
+      }
+      break;
+    case 'E':
+      for (int i = 0; i < num_rows; ++i, row += row_size) {
+        for (int k = 0; k < repeat; ++k) {
+          uint bits = LoadBigEndian32(row + 4 * k);
+          float value;
+          memcpy(&value, &bits, sizeof(value));
+          *values++ = zero + scale * value;
+        }
+      }
+      break;
+    case 'D':
+      for (int i = 0; i < num_rows; ++i, row += row_size) {
+        for (int k = 0; k < repeat; ++k) {
+          uint64 bits = LoadBigEndian64(row + 8 * k);
+          double value;
+          memcpy(&value, &bits, sizeof(value));
+          *values++ = zero + scale * value;
+        }
+      }
+      break;
+  }
+}
+
+// FitsTableIterator methods.
+FitsTableIterator::FitsTableIterator(const FitsTable *table,
+                                     const vector<int> &columns,
+                                     int batch_size)
+    : table_(table),
+      columns_(columns),
+      batch_size_(batch_size),
+      first_row_(0),
+      num_rows_(0),
+      doubles_(columns.size()),
+      strings_(columns.size()) {
+  CHECK_GT(batch_size, 0);
+  for (size_t i = 0; i < columns_.size(); ++i) {
+    CHECK(columns_[i] >= 0 &&
+          columns_[i] < static_cast<int>(table->columns().size()));
+    CHECK(FitsTable::IsReadable(table->columns()[columns_[i]].type))
+        << "Column " << table->columns()[columns_[i]].name
+        << " can't be read";
+  }
+}
+
+FitsTableIterator::~FitsTableIterator() {
+  // Nothing needed.
+}
+
+bool FitsTableIterator::Next(void) {
+  first_row_ += num_rows_;
+  table_->ReleaseRows(first_row_);
+  if (first_row_ >= table_->num_rows()) {
+    num_rows_ = 0;
+    return false;
+  }
+  num_rows_ = static_cast<int>(min(static_cast<int64>(batch_size_),
+                                   table_->num_rows() - first_row_));
+  for (size_t i = 0; i < columns_.size(); ++i) {
+    const FitsTable::Column &column = table_->columns()[columns_[i]];
+    if (column.type == 'A') {
+      table_->ReadStrings(columns_[i], first_row_, num_rows_, &strings_[i]);
+    } else {
+      doubles_[i].resize(static_cast<size_t>(num_rows_) * column.repeat);
+      table_->ReadDoubles(columns_[i], first_row_, num_rows_,
+                          &doubles_[i][0]);
+    }
+  }
+  return true;
+}
+
+const double *FitsTableIterator::doubles(int i) const {
+  CHECK(i >= 0 && i < static_cast<int>(columns_.size()));
+  CHECK(table_->columns()[columns_[i]].type != 'A')
+      << "Column " << table_->columns()[columns_[i]].name
+      << " holds characters";
+  return doubles_[i].empty() ? NULL : &doubles_[i][0];
+}
+
+const vector<string> &FitsTableIterator::strings(int i) const {
+  CHECK(i >= 0 && i < static_cast<int>(columns_.size()));
+  CHECK_EQ(table_->columns()[columns_[i]].type, 'A')
+      << "Column " << table_->columns()[columns_[i]].name
+      << " doesn't hold characters";
+  return strings_[i];
+}
+
+}  // namespace google_sky
@@ -0,0 +1,214 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// Defines the FitsTable class for reading columns of FITS binary tables
+
+#ifndef FITSTABLE_H__
+#define FITSTABLE_H__
+
+#include <string>
+#include <vector>
+
+#include "base.h"
+
+namespace google_sky {
+
+// Class for reading selected columns of a FITS BINTABLE extension
+//
+// A binary table stores its rows one after another, each holding a fixed
+// size field for every column, so reading a few columns of a wide table
+// through a stream still reads every byte of it.  FitsTable instead maps
+// the data unit of the table into memory and decodes only the columns that
+// are asked for, straight from the mapped rows.  Only the pages holding
+// those rows are read from disk, and rows that have been decoded can be
+// released, so the memory used doesn't grow with the size of the table.
+//
+// Columns of logical (L), character (A), and integer or floating point
+// (B, I, J, K, E, D) values can be read.  Numbers are decoded as doubles
+// with TSCAL and TZERO applied, and logical values as 1, 0, or NaN if
+// undefined.  Other columns, such as bits (X) and variable length arrays,
+// are listed but can't be read.  Since the file is mapped, it can't be
+// gzipped.
+//
+// Example Usage:
+//
+// FitsTable table;
+// string error;
+// if (!table.Open("sources.fits", &error)) {
+//   fprintf(stderr, "%s\n", error.c_str());
+// }
+// vector<int> columns;
+// columns.push_back(table.FindColumn("RA"));
+// columns.push_back(table.FindColumn("DEC"));
+// FitsTableIterator batch(&table, columns, 4096);
+// while (batch.Next()) {
+//   const double *ra = batch.doubles(0);
+//   const double *dec = batch.doubles(1);
+//   for (int i = 0; i < batch.num_rows(); ++i) {
+//     Plot(ra[i], dec[i]);
+//   }
+// }
+
+class FitsTable {
+ public:
+  // A column of the table.
+  struct Column {
+    string name;   // TTYPE, or COL<n> if there is none.
+    char type;     // The TFORM type letter.
+    int repeat;    // Number of values in each row.
+    int offset;    // Offset of the field within a row in bytes.
+    int size;      // Size of the field in bytes.
+    double scale;  // TSCAL
+    double zero;   // TZERO
+  };
+
+  FitsTable();
+
+  ~FitsTable();
+
+  // Maps the first BINTABLE extension of filename.  Returns false with a
+  // description of the problem in error if the file can't be read or has
+  // no table that can be mapped.
+  bool Open(const string &filename, string *error);
+
+  // Unmaps the table.
+  void Close(void);
+
+  // Returns the number of rows in the table.
+  inline int64 num_rows(void) const {
+    return num_rows_;
+  }
+
+  // Returns the size of a row in bytes.
+  inline int row_size(void) const {
+    return row_size_;
+  }
+
+  // Returns the columns of the table.
+  inline const vector<Column> &columns(void) const {
+    return columns_;
+  }
+
+  // Returns the index of the column with the given name, ignoring case, or
+  // -1 if there is none.
+  int FindColumn(const string &name) const;
+
+  // Returns whether columns of the given type can be read as doubles.
+  static bool IsNumeric(char type);
+
+  // Returns whether columns of the given type can be read.
+  static bool IsReadable(char type);
+
+  // Decodes num_rows rows of a numeric column starting at first_row into
+  // values, which must hold num_rows * repeat values.
+  void ReadDoubles(int column, int64 first_row, int num_rows,
+                   double *values) const;
+
+  // Reads num_rows rows of a character column starting at first_row into
+  // values, without trailing spaces.
+  void ReadStrings(int column, int64 first_row, int num_rows,
+                   vector<string> *values) const;
+
+  // Tells the operating system that the rows before end_row won't be read
+  // again, so that their memory can be reclaimed.
+  void ReleaseRows(int64 end_row) const;
+
+  // Parses the columns described by a BINTABLE header and checks that
+  // they fill its rows.  Returns false with a description of the problem
+  // in error if the header is invalid.
+  static bool ParseColumns(const string &header, vector<Column> *columns,
+                           string *error);
+
+  // Decodes num_rows rows of a numeric column from rows, which are
+  // row_size bytes apart, into values.
+  static void DecodeDoubles(const Column &column, const uint8 *rows,
+                            int row_size, int num_rows, double *values);
+
+ private:
+  vector<Column> columns_;
+  int64 num_rows_;
+  int row_size_;
+  void *map_;         // The mapping, which starts at a page boundary.
+  size_t map_size_;
+  const uint8 *data_; // The first row within the mapping.
+
+  DISALLOW_COPY_AND_ASSIGN(FitsTable);
+};
+
+// Class for reading selected columns of a FitsTable in batches of rows
+//
+// Each call to Next() decodes the next batch of rows of the columns given
+// to the constructor, numeric columns as doubles and character columns as
+// strings, and releases the rows of the previous batch.  Values are
+// accessed by the position of their column in the list given to the
+// constructor.
+
+class FitsTableIterator {
+ public:
+  // Iterates over batches of batch_size rows of the given columns of
+  // table, which must outlive the iterator.
+  FitsTableIterator(const FitsTable *table, const vector<int> &columns,
+                    int batch_size);
+
+  ~FitsTableIterator();
+
+  // Decodes the next batch of rows.  Returns false after the last row.
+  bool Next(void);
+
+  // Returns the index of the first row of the batch.
+  inline int64 first_row(void) const {
+    return first_row_;
+  }
+
+  // Returns the number of rows in the batch.
+  inline int num_rows(void) const {
+    return num_rows_;
+  }
+
+  // Returns the values of the ith numeric column of the batch, repeat
+  // values for each row.
+  const double *doubles(int i) const;
+
+  // Returns the values of the ith character column of the batch.
+  const vector<string> &strings(int i) const;
+
+ private:
+  const FitsTable *table_;
+  vector<int> columns_;
+  int batch_size_;
+  int64 first_row_;
+  int num_rows_;
+  vector<vector<double> > doubles_;
+  vector<vector<string> > strings_;
+
+  DISALLOW_COPY_AND_ASSIGN(FitsTableIterator);
+};
+
+}  // namespace google_sky
+
+#endif  // FITSTABLE_H__
@@ -0,0 +1,291 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <cmath>
+#include <cstdio>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+#include "base.h"
+#include "fitstable.h"
+#include "string_util.h"
+#include "test_util.h"
+
+namespace google_sky {
+
+// Appends the given cards to a FITS header padded to 2880 bytes.
+void AppendHeader(const vector<string> &cards, string *contents) {
+  for (size_t i = 0; i < cards.size(); ++i) {
+    *contents += cards[i];
+    contents->append(80 - cards[i].size(), ' ');
+  }
+  contents->append("END");
+  contents->append(2880 - contents->size() % 2880, ' ');
+}
+
+// Returns a FITS file with an empty primary HDU and a BINTABLE of
+// num_rows rows with columns of every readable type and one of bits.
+string MakeTable(int num_rows) {
+  vector<string> cards;
+  cards.push_back("SIMPLE  =                    T");
+  cards.push_back("BITPIX  =                    8");
+  cards.push_back("NAXIS   =                    0");
+  cards.push_back("EXTEND  =                    T");
+  string contents;
+  AppendHeader(cards, &contents);
+
+  cards.clear();
+  cards.push_back("XTENSION= 'BINTABLE'");
+  cards.push_back("BITPIX  =                    8");
+  cards.push_back("NAXIS   =                    2");
+  cards.push_back("NAXIS1  =                   40");
+  cards.push_back(StringPrintf("NAXIS2  = %20d", num_rows));
+  cards.push_back("PCOUNT  =                    0");
+  cards.push_back("GCOUNT  =                    1");
+  cards.push_back("TFIELDS =                    9");
+  cards.push_back("TTYPE1  = 'RA'");
+  cards.push_back("TFORM1  = 'D'");
+  cards.push_back("TTYPE2  = 'Dec'");
+  cards.push_back("TFORM2  = 'E'");
+  cards.push_back("TTYPE3  = 'NAME'");
+  cards.push_back("TFORM3  = '6A'");
+  cards.push_back("TTYPE4  = 'COUNTS'");
+  cards.push_back("TFORM4  = '2J'");
+  cards.push_back("TSCAL4  =                  0.5");
+  cards.push_back("TZERO4  =                   10");
+  cards.push_back("TTYPE5  = 'ID'");
+  cards.push_back("TFORM5  = 'K'");
+  cards.push_back("TTYPE6  = 'FLAG'");
+  cards.push_back("TFORM6  = 'L'");
+  cards.push_back("TTYPE7  = 'BITS'");
+  cards.push_back("TFORM7  = '12X'");
+  cards.push_back("TTYPE8  = 'SHORT'");
+  cards.push_back("TFORM8  = 'I'");
+  cards.push_back("TZERO8  =                32768");
+  cards.push_back("TTYPE9  = 'BYTE'");
+  cards.push_back("TFORM9  = '1B'");
+  AppendHeader(cards, &contents);
+
+  string data;
+  for (int i = 0; i < num_rows; ++i) {
+    double ra = 0.5 * i;
+    float dec = -0.25f * i;
+    AppendBigEndian(&ra, 8, &data);
+    AppendBigEndian(&dec, 4, &data);
+    string name = StringPrintf("s%d", i);
+    name.append(6 - name.size(), i % 2 == 0 ? ' ' : '\0');
+    data += name;
+    int counts[2] = { i, -i };
+    AppendBigEndian(&counts[0], 4, &data);
+    AppendBigEndian(&counts[1], 4, &data);
+    int64 id = 10000000000LL + i;
+    AppendBigEndian(&id, 8, &data);
+    data.push_back(i % 3 == 0 ? 'T' : (i % 3 == 1 ? 'F' : '\0'));
+    data.append(2, '\xff');
+    int16 value = static_cast<int16>(i - 32768);
+    AppendBigEndian(&value, 2, &data);
+    data.push_back(static_cast<char>(200 + i % 50));
+  }
+  if (data.size() % 2880 != 0) data.append(2880 - data.size() % 2880, '\0');
+  return contents + data;
+}
+
+int Main(int argc, char **argv) {
+  {
+    cout << "Testing FitsTable::Open()... ";
+    WriteFile("fitstable_test.fits", MakeTable(5));
+    FitsTable table;
+    string error;
+    ASSERT_TRUE(table.Open("fitstable_test.fits", &error));
+    ASSERT_EQ(5, table.num_rows());
+    ASSERT_EQ(40, table.row_size());
+    ASSERT_EQ(9, table.columns().size());
+
+    const FitsTable::Column &counts = table.columns()[3];
+    ASSERT_EQ("COUNTS", counts.name);
+    ASSERT_EQ('J', counts.type);
+    ASSERT_EQ(2, counts.repeat);
+    ASSERT_EQ(18, counts.offset);
+    ASSERT_EQ(8, counts.size);
+    ASSERT_FLOAT_EQ(0.5, counts.scale, 1e-12);
+    ASSERT_FLOAT_EQ(10.0, counts.zero, 1e-12);
+    ASSERT_EQ(2, table.columns()[6].size);
+
+    ASSERT_EQ(1, table.FindColumn("dec"));
+    ASSERT_EQ(0, table.FindColumn("Ra"));
+    ASSERT_EQ(-1, table.FindColumn("MAG"));
+    ASSERT_TRUE(FitsTable::IsNumeric('L'));
+    ASSERT_FALSE(FitsTable::IsNumeric('A'));
+    ASSERT_TRUE(FitsTable::IsReadable('A'));
+    ASSERT_FALSE(FitsTable::IsReadable('X'));
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing FitsTable::ReadDoubles()... ";
+    FitsTable table;
+    string error;
+    ASSERT_TRUE(table.Open("fitstable_test.fits", &error));
+    double values[10];
+    table.ReadDoubles(0, 1, 4, values);
+    ASSERT_FLOAT_EQ(0.5, values[0], 1e-12);
+    ASSERT_FLOAT_EQ(2.0, values[3], 1e-12);
+    table.ReadDoubles(1, 0, 5, values);
+    ASSERT_FLOAT_EQ(-1.0, values[4], 1e-12);
+
+    // Arrays hold repeat values for each row, scaled.
+    table.ReadDoubles(3, 2, 2, values);
+    ASSERT_FLOAT_EQ(11.0, values[0], 1e-12);
+    ASSERT_FLOAT_EQ(9.0, values[1], 1e-12);
+    ASSERT_FLOAT_EQ(11.5, values[2], 1e-12);
+    ASSERT_FLOAT_EQ(8.5, values[3], 1e-12);
+
+    table.ReadDoubles(4, 4, 1, values);
+    ASSERT_FLOAT_EQ(10000000004.0, values[0], 1e-3);
+    table.ReadDoubles(5, 0, 3, values);
+    ASSERT_FLOAT_EQ(1.0, values[0], 1e-12);
+    ASSERT_FLOAT_EQ(0.0, values[1], 1e-12);
+    ASSERT_TRUE(isnan(values[2]));
+
+    // Unsigned shorts and bytes.
+    table.ReadDoubles(7, 3, 1, values);
+    ASSERT_FLOAT_EQ(3.0, values[0], 1e-12);
+    table.ReadDoubles(8, 4, 1, values);
+    ASSERT_FLOAT_EQ(204.0, values[0], 1e-12);
+
+    vector<string> names;
+    table.ReadStrings(2, 0, 2, &names);
+    ASSERT_EQ(2, names.size());
+    ASSERT_EQ("s0", names[0]);
+    ASSERT_EQ("s1", names[1]);
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing FitsTableIterator... ";
+    WriteFile("fitstable_test.fits", MakeTable(1000));
+    FitsTable table;
+    string error;
+    ASSERT_TRUE(table.Open("fitstable_test.fits", &error));
+    vector<int> columns;
+    columns.push_back(table.FindColumn("NAME"));
+    columns.push_back(table.FindColumn("COUNTS"));
+    columns.push_back(table.FindColumn("RA"));
+    FitsTableIterator batch(&table, columns, 300);
+    int num_batches = 0;
+    int64 num_rows = 0;
+    double ra_sum = 0.0;
+    while (batch.Next()) {
+      ASSERT_EQ(num_rows, batch.first_row());
+      const vector<string> &names = batch.strings(0);
+      const double *counts = batch.doubles(1);
+      const double *ra = batch.doubles(2);
+      ASSERT_EQ(static_cast<size_t>(batch.num_rows()), names.size());
+      for (int i = 0; i < batch.num_rows(); ++i) {
+        int64 row = batch.first_row() + i;
+        ASSERT_EQ(StringPrintf("s%lld", row), names[i]);
+        ASSERT_FLOAT_EQ(10.0 + 0.5 * row, counts[2 * i], 1e-9);
+        ASSERT_FLOAT_EQ(10.0 - 0.5 * row, counts[2 * i + 1], 1e-9);
+        ra_sum += ra[i];
+      }
+      num_rows += batch.num_rows();
+      ++num_batches;
+    }
+    ASSERT_EQ(4, num_batches);
+    ASSERT_EQ(1000, num_rows);
+    ASSERT_FLOAT_EQ(0.5 * 999 * 1000 / 2, ra_sum, 1e-6);
+    ASSERT_FALSE(batch.Next());
+
+    // An empty selection still counts rows.
+    FitsTableIterator empty(&table, vector<int>(), 512);
+    ASSERT_TRUE(empty.Next());
+    ASSERT_EQ(512, empty.num_rows());
+    ASSERT_TRUE(empty.Next());
+    ASSERT_EQ(488, empty.num_rows());
+    ASSERT_FALSE(empty.Next());
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing FitsTable errors... ";
+    FitsTable table;
+    string error;
+    ASSERT_FALSE(table.Open("fitstable_test_missing.fits", &error));
+    ASSERT_TRUE(StringContains(error, "Can't open"));
+
+    // Tables in files with images are found after them.
+    ASSERT_TRUE(table.Open("testdata/fitsimage_test_mef.fits", &error));
+    ASSERT_EQ(3, table.num_rows());
+    double values[3];
+    table.ReadDoubles(0, 0, 3, values);
+    ASSERT_FLOAT_EQ(0.0, values[0], 1e-12);
+    ASSERT_FLOAT_EQ(2.0, values[2], 1e-12);
+
+    ASSERT_FALSE(table.Open("testdata/fitsimage_test.fits", &error));
+    ASSERT_TRUE(StringContains(error, "No BINTABLE"));
+    ASSERT_EQ(0, table.num_rows());
+
+    // Gzipped files can't be mapped.
+    string contents = MakeTable(5);
+    gzFile fp = gzopen("fitstable_test.fits.gz", "wb");
+    CHECK(fp != NULL);
+    gzwrite(fp, contents.data(), contents.size());
+    gzclose(fp);
+    ASSERT_FALSE(table.Open("fitstable_test.fits.gz", &error));
+    ASSERT_TRUE(StringContains(error, "compressed"));
+    remove("fitstable_test.fits.gz");
+
+    // The data unit must hold every row.
+    WriteFile("fitstable_test.fits", contents.substr(0, 2 * 2880 + 100));
+    ASSERT_FALSE(table.Open("fitstable_test.fits", &error));
+    ASSERT_TRUE(StringContains(error, "truncated"));
+
+    // The columns must fill the rows.
+    string naxis1 = "NAXIS1  =                   40";
+    size_t position = contents.find(naxis1);
+    contents.replace(position, naxis1.size(),
+                     "NAXIS1  =                   41");
+    WriteFile("fitstable_test.fits", contents);
+    ASSERT_FALSE(table.Open("fitstable_test.fits", &error));
+    ASSERT_TRUE(StringContains(error, "NAXIS1 = 41"));
+    remove("fitstable_test.fits");
+    cout << "pass\n";
+  }
+
+  return 0;
+}
+
+}  // namespace google_sky
+
+int main(int argc, char **argv) {
+  return google_sky::Main(argc, argv);
+}
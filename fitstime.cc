@@ -0,0 +1,220 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+#include "fitstime.h"
+
+#include <cmath>
+#include <cstdio>
+
+#include <string>
+#include <vector>
+
+#include "fits.h"
+#include "string_util.h"
+
+namespace google_sky {
+
+namespace {
+
+// MJD of 1970-01-01, the epoch used by DaysFromCivil().
+static const int MJD_UNIX_EPOCH = 40587;
+
+// Difference between Julian Dates and Modified Julian Dates.
+static const double JD_MJD_OFFSET = 2400000.5;
+
+static const double SECONDS_PER_DAY = 86400.0;
+
+// Returns the number of days from 1970-01-01 to the given date in the
+// proleptic Gregorian calendar.  This is H. Hinnant's days_from_civil().
+int DaysFromCivil(int year, int month, int day) {
+  year -= (month <= 2) ? 1 : 0;
+  int era = (year >= 0 ? year : year - 399) / 400;
+  int year_of_era = year - era * 400;
+  int day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  int day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 +
+                   day_of_year;
+  return era * 146097 + day_of_era - 719468;
+}
+
+// Inverse of DaysFromCivil().
+void CivilFromDays(int days, int *year, int *month, int *day) {
+  days += 719468;
+  int era = (days >= 0 ? days : days - 146096) / 146097;
+  int day_of_era = days - era * 146097;
+  int year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 -
+                     day_of_era / 146096) / 365;
+  int day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 -
+                                  year_of_era / 100);
+  int month_index = (5 * day_of_year + 2) / 153;
+  *day = day_of_year - (153 * month_index + 2) / 5 + 1;
+  *month = month_index + (month_index < 10 ? 3 : -9);
+  *year = year_of_era + era * 400 + (*month <= 2 ? 1 : 0);
+}
+
+// Returns the number of days in the given unit of CUNIT3 or 0 if the unit
+// isn't a unit of time.
+double DaysPerUnit(const string &unit) {
+  if (unit.empty() || unit == "s") {
+    return 1.0 / SECONDS_PER_DAY;
+  } else if (unit == "min") {
+    return 60.0 / SECONDS_PER_DAY;
+  } else if (unit == "h") {
+    return 3600.0 / SECONDS_PER_DAY;
+  } else if (unit == "d") {
+    return 1.0;
+  } else if (unit == "a" || unit == "yr") {
+    return 365.25;
+  }
+  return 0.0;
+}
+
+// Finds the reference epoch for elapsed times.
+bool GetReferenceMjd(const string &header, double *mjd) {
+  if (Fits::HeaderHasKeyword(header, "MJDREF")) {
+    *mjd = Fits::HeaderReadKeywordDouble(header, "MJDREF", 0.0);
+    return true;
+  }
+  if (Fits::HeaderHasKeyword(header, "MJDREFI")) {
+    *mjd = Fits::HeaderReadKeywordDouble(header, "MJDREFI", 0.0) +
+           Fits::HeaderReadKeywordDouble(header, "MJDREFF", 0.0);
+    return true;
+  }
+  if (Fits::HeaderHasKeyword(header, "JDREF")) {
+    *mjd = Fits::HeaderReadKeywordDouble(header, "JDREF", 0.0) -
+           JD_MJD_OFFSET;
+    return true;
+  }
+  if (FitsTime::DateTimeToMjd(
+          Fits::HeaderReadKeywordString(header, "DATEREF", ""), mjd)) {
+    return true;
+  }
+  if (Fits::HeaderHasKeyword(header, "MJD-OBS")) {
+    *mjd = Fits::HeaderReadKeywordDouble(header, "MJD-OBS", 0.0);
+    return true;
+  }
+  return FitsTime::DateTimeToMjd(
+      Fits::HeaderReadKeywordString(header, "DATE-OBS", ""), mjd);
+}
+
+}  // namespace
+
+// Uses the linear WCS of the third axis.  Absolute time axes (MJD, JD)
+// don't need a reference epoch.
+bool FitsTime::GetPlaneTimes(const string &header, int num_planes,
+                             vector<double> *mjds) {
+  mjds->clear();
+  string ctype = Fits::HeaderReadKeywordString(header, "CTYPE3", "");
+  double crval = Fits::HeaderReadKeywordDouble(header, "CRVAL3", 0.0);
+  double crpix = Fits::HeaderReadKeywordDouble(header, "CRPIX3", 1.0);
+  double cdelt = Fits::HeaderReadKeywordDouble(
+      header, "CDELT3", Fits::HeaderReadKeywordDouble(header, "CD3_3", 1.0));
+
+  double zero;
+  double days_per_unit;
+  if (ctype == "MJD") {
+    zero = 0.0;
+    days_per_unit = 1.0;
+  } else if (ctype == "JD") {
+    zero = -JD_MJD_OFFSET;
+    days_per_unit = 1.0;
+  } else if (ctype == "TIME" || ctype == "UTC" || ctype == "TAI" ||
+             ctype == "TT" || ctype == "TDB" || ctype == "GPS" ||
+             ctype == "LOCAL") {
+    days_per_unit = DaysPerUnit(
+        Fits::HeaderReadKeywordString(header, "CUNIT3", ""));
+    if (days_per_unit == 0.0 || !GetReferenceMjd(header, &zero)) {
+      return false;
+    }
+  } else {
+    return false;
+  }
+
+  mjds->resize(num_planes);
+  for (int k = 0; k < num_planes; ++k) {
+    double value = crval + (k + 1 - crpix) * cdelt;
+    (*mjds)[k] = zero + value * days_per_unit;
+  }
+  return true;
+}
+
+// Rounds to the nearest millisecond first so that carries propagate into
+// the date.
+string FitsTime::MjdToDateTime(double mjd) {
+  double days = floor(mjd);
+  long milliseconds = static_cast<long>(
+      floor((mjd - days) * SECONDS_PER_DAY * 1000.0 + 0.5));
+  if (milliseconds >= static_cast<long>(SECONDS_PER_DAY * 1000.0)) {
+    days += 1.0;
+    milliseconds = 0;
+  }
+
+  int year, month, day;
+  CivilFromDays(static_cast<int>(days) - MJD_UNIX_EPOCH, &year, &month,
+                &day);
+  int seconds = static_cast<int>(milliseconds / 1000);
+  string date_time = StringPrintf("%04d-%02d-%02dT%02d:%02d:%02d", year,
+                                  month, day, seconds / 3600,
+                                  (seconds / 60) % 60, seconds % 60);
+  if (milliseconds % 1000 != 0) {
+    date_time.append(StringPrintf(".%03ld", milliseconds % 1000));
+  }
+  date_time.append("Z");
+  return date_time;
+}
+
+bool FitsTime::DateTimeToMjd(const string &date_time, double *mjd) {
+  int year, month, day;
+  int length = 0;
+  if (sscanf(date_time.c_str(), "%4d-%2d-%2d%n", &year, &month, &day,
+             &length) != 3 || length != 10 || month < 1 || month > 12 ||
+      day < 1 || day > 31) {
+    return false;
+  }
+
+  int hours = 0;
+  int minutes = 0;
+  double seconds = 0.0;
+  string rest = date_time.substr(length);
+  if (!rest.empty() && rest[rest.size() - 1] == 'Z') {
+    rest.resize(rest.size() - 1);
+  }
+  if (!rest.empty()) {
+    int time_length = 0;
+    if (sscanf(rest.c_str(), "T%2d:%2d:%lf%n", &hours, &minutes, &seconds,
+               &time_length) != 3 ||
+        time_length != static_cast<int>(rest.size()) || hours > 23 ||
+        minutes > 59 || seconds < 0.0 || seconds >= 61.0) {
+      return false;
+    }
+  }
+
+  *mjd = DaysFromCivil(year, month, day) + MJD_UNIX_EPOCH +
+         (hours * 3600.0 + minutes * 60.0 + seconds) / SECONDS_PER_DAY;
+  return true;
+}
+
+}  // namespace google_sky
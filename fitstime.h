@@ -0,0 +1,96 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+// Defines the FitsTime class for the time axis of FITS data cubes
+//
+// Time-series data cubes store one image per plane along the third axis,
+// which is described by the usual WCS keywords (CTYPE3, CRVAL3, CRPIX3,
+// CDELT3, CUNIT3).  The world coordinate of a time axis is either an MJD or
+// JD (CTYPE3 = 'MJD' or 'JD') or an elapsed time (CTYPE3 = 'TIME', 'UTC',
+// 'TAI', 'TT', etc.) relative to a reference epoch given by MJDREF,
+// JDREF, DATEREF, MJD-OBS, or DATE-OBS, in that order of preference.  See
+// Rots et al. 2015, A&A 574, A36 for the full convention -- only the common
+// cases are handled here.
+
+#ifndef FITSTIME_H__
+#define FITSTIME_H__
+
+#include <string>
+#include <vector>
+
+#include "base.h"
+
+namespace google_sky {
+
+// Class for converting between FITS times and KML times
+//
+// This is a static only class.  Times are represented as Modified Julian
+// Dates (MJD) and written as XML dateTime strings for KML.  No distinction
+// is made between time scales (UTC, TAI, TT), so times may be off by up to
+// about a minute for non-UTC data.
+//
+// Example Usage:
+//
+// // Find the time of each plane of a cube.
+// vector<double> mjds;
+// if (FitsTime::GetPlaneTimes(header, num_planes, &mjds)) {
+//   string begin = FitsTime::MjdToDateTime(mjds[0]);
+// }
+
+class FitsTime {
+ public:
+  // Finds the time of each of the num_planes planes along the third axis of
+  // the image described by header.  Returns false if the header doesn't
+  // describe a time axis with a reference epoch.
+  static bool GetPlaneTimes(const string &header, int num_planes,
+                            vector<double> *mjds);
+
+  // Converts an MJD to an XML dateTime string such as
+  // "2008-01-02T03:04:05Z".  Fractional seconds are included to the nearest
+  // millisecond when they are nonzero.
+  static string MjdToDateTime(double mjd);
+
+  // Parses a FITS date (YYYY-MM-DD or YYYY-MM-DDThh:mm:ss[.sss], with an
+  // optional trailing Z) into an MJD.  Returns whether the date was valid.
+  static bool DateTimeToMjd(const string &date_time, double *mjd);
+
+ private:
+  // Never created.
+  FitsTime() {
+    // Nothing needed.
+  }
+
+  ~FitsTime() {
+    // Nothing needed.
+  }
+
+  DISALLOW_COPY_AND_ASSIGN(FitsTime);
+};
+
+}  // namespace google_sky
+
+#endif  // FITSTIME_H__
@@ -0,0 +1,133 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+#include <cmath>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "base.h"
+#include "fits.h"
+#include "fitstime.h"
+
+namespace google_sky {
+
+// An 8 x 6 x 4 cube with planes 30 seconds apart starting at DATE-OBS.
+static const char *FITS_CUBE_FILENAME = "testdata/fitsimage_test_cube.fits";
+
+// One millisecond in days.
+static const double MILLISECOND = 1.0 / 86400000.0;
+
+// Returns an 80 character header card.
+string Card(const string &card) {
+  string padded(card);
+  padded.resize(80, ' ');
+  return padded;
+}
+
+int Main(int argc, char **argv) {
+  {
+    cout << "Testing MjdToDateTime()... ";
+    ASSERT_EQ("1858-11-17T00:00:00Z", FitsTime::MjdToDateTime(0.0));
+    ASSERT_EQ("2000-01-01T12:00:00Z", FitsTime::MjdToDateTime(51544.5));
+    ASSERT_EQ("2008-01-02T03:04:05Z",
+              FitsTime::MjdToDateTime(54467.0 + 11045.0 / 86400.0));
+    ASSERT_EQ("2008-01-02T03:04:05.250Z",
+              FitsTime::MjdToDateTime(54467.0 + 11045.25 / 86400.0));
+
+    // Rounding up to midnight carries into the date.
+    ASSERT_EQ("2008-03-01T00:00:00Z",
+              FitsTime::MjdToDateTime(54526.0 - 0.1 * MILLISECOND));
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing DateTimeToMjd()... ";
+    double mjd;
+    ASSERT_TRUE(FitsTime::DateTimeToMjd("2000-01-01T12:00:00", &mjd));
+    ASSERT_FLOAT_EQ(51544.5, mjd, MILLISECOND);
+    ASSERT_TRUE(FitsTime::DateTimeToMjd("2008-01-02T03:04:05.25Z", &mjd));
+    ASSERT_FLOAT_EQ(54467.0 + 11045.25 / 86400.0, mjd, MILLISECOND);
+    ASSERT_TRUE(FitsTime::DateTimeToMjd("1858-11-17", &mjd));
+    ASSERT_FLOAT_EQ(0.0, mjd, MILLISECOND);
+    ASSERT_FALSE(FitsTime::DateTimeToMjd("", &mjd));
+    ASSERT_FALSE(FitsTime::DateTimeToMjd("02/01/08", &mjd));
+    ASSERT_FALSE(FitsTime::DateTimeToMjd("2008-13-01", &mjd));
+    ASSERT_FALSE(FitsTime::DateTimeToMjd("2008-01-02T03:04", &mjd));
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing GetPlaneTimes()... ";
+    string header;
+    Fits::ReadHeader(FITS_CUBE_FILENAME, 0, &header);
+    vector<double> mjds;
+    ASSERT_TRUE(FitsTime::GetPlaneTimes(header, 4, &mjds));
+    ASSERT_EQ(4, static_cast<int>(mjds.size()));
+    ASSERT_EQ("2008-01-02T03:04:05Z", FitsTime::MjdToDateTime(mjds[0]));
+    ASSERT_EQ("2008-01-02T03:05:35Z", FitsTime::MjdToDateTime(mjds[3]));
+
+    // Absolute times need no reference epoch.
+    string mjd_header = Card("CTYPE3  = 'MJD     '") +
+                        Card("CRVAL3  =              54467.5") +
+                        Card("CRPIX3  =                  2.0") +
+                        Card("CDELT3  =                 0.25") +
+                        Card("END");
+    ASSERT_TRUE(FitsTime::GetPlaneTimes(mjd_header, 3, &mjds));
+    ASSERT_FLOAT_EQ(54467.25, mjds[0], MILLISECOND);
+    ASSERT_FLOAT_EQ(54467.75, mjds[2], MILLISECOND);
+
+    // Elapsed times relative to MJDREF in other units.
+    string time_header = Card("CTYPE3  = 'TIME    '") +
+                         Card("CUNIT3  = 'h       '") +
+                         Card("CRVAL3  =                  6.0") +
+                         Card("MJDREF  =              54467.0") +
+                         Card("END");
+    ASSERT_TRUE(FitsTime::GetPlaneTimes(time_header, 2, &mjds));
+    ASSERT_EQ("2008-01-02T06:00:00Z", FitsTime::MjdToDateTime(mjds[0]));
+    ASSERT_EQ("2008-01-02T07:00:00Z", FitsTime::MjdToDateTime(mjds[1]));
+
+    // Elapsed times need a reference epoch, and other axes aren't times.
+    string no_epoch_header = Card("CTYPE3  = 'TIME    '") + Card("END");
+    ASSERT_FALSE(FitsTime::GetPlaneTimes(no_epoch_header, 2, &mjds));
+    string wave_header = Card("CTYPE3  = 'WAVE    '") +
+                         Card("MJDREF  =              54467.0") +
+                         Card("END");
+    ASSERT_FALSE(FitsTime::GetPlaneTimes(wave_header, 2, &mjds));
+    cout << "pass\n";
+  }
+
+  cout << "Passed\n";
+  return 0;
+}
+
+}  // namespace google_sky
+
+int main(int argc, char **argv) {
+  return google_sky::Main(argc, argv);
+}
@@ -0,0 +1,467 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "geotiff.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <map>
+
+#include "string_util.h"
+#include "threadpool.h"
+
+namespace {
+
+// TIFF field types.
+const int SHORT = 3;
+const int LONG = 4;
+const int DOUBLE = 12;
+const int LONG8 = 16;
+
+// Appends value to out as a little-endian integer of size bytes.
+void AppendInteger(google_sky::int64 value, int size, string *out) {
+  for (int k = 0; k < size; ++k) {
+    out->push_back(static_cast<char>((value >> (8 * k)) & 0xff));
+  }
+}
+
+// The fields of an IFD, which are written in order of tag.
+class Ifd {
+ public:
+  void AddShorts(int tag, const vector<int> &values) {
+    string *data = Add(tag, SHORT, values.size());
+    for (size_t i = 0; i < values.size(); ++i) {
+      AppendInteger(values[i], 2, data);
+    }
+  }
+
+  void AddShort(int tag, int value) {
+    AddShorts(tag, vector<int>(1, value));
+  }
+
+  void AddLong(int tag, google_sky::int64 value) {
+    AppendInteger(value, 4, Add(tag, LONG, 1));
+  }
+
+  // Adds offsets or byte counts, which are 64 bit in BigTIFF.
+  void AddOffsets(int tag, const vector<google_sky::int64> &values,
+                  bool big) {
+    string *data = Add(tag, big ? LONG8 : LONG, values.size());
+    for (size_t i = 0; i < values.size(); ++i) {
+      AppendInteger(values[i], big ? 8 : 4, data);
+    }
+  }
+
+  void AddDoubles(int tag, const vector<double> &values) {
+    string *data = Add(tag, DOUBLE, values.size());
+    for (size_t i = 0; i < values.size(); ++i) {
+      google_sky::int64 bits;
+      memcpy(&bits, &values[i], sizeof(bits));
+      AppendInteger(bits, 8, data);
+    }
+  }
+
+  // Appends the IFD to out, where it starts at byte offset start in the
+  // file.  Values that don't fit in their entry follow the entries.  next
+  // is the offset of the next IFD, or 0 if this is the last.
+  void Append(google_sky::int64 start, google_sky::int64 next, bool big,
+              string *out) const {
+    int count_size = big ? 8 : 2;
+    int entry_size = big ? 20 : 12;
+    int value_size = big ? 8 : 4;
+    google_sky::int64 values_start = start + count_size +
+                                     entry_size * fields_.size() +
+                                     value_size;
+    string entries;
+    string values;
+    AppendInteger(fields_.size(), count_size, &entries);
+    for (map<int, Field>::const_iterator it = fields_.begin();
+         it != fields_.end(); ++it) {
+      const Field &field = it->second;
+      AppendInteger(it->first, 2, &entries);
+      AppendInteger(field.type, 2, &entries);
+      AppendInteger(field.count, value_size, &entries);
+      if (static_cast<int>(field.data.size()) <= value_size) {
+        entries += field.data;
+        entries.append(value_size - field.data.size(), '\0');
+      } else {
+        // Keep values on 8 byte boundaries.
+        AppendInteger(values_start + values.size(), value_size, &entries);
+        values += field.data;
+        values.append((8 - values.size() % 8) % 8, '\0');
+      }
+    }
+    AppendInteger(next, value_size, &entries);
+    out->append(entries);
+    out->append(values);
+  }
+
+  // Returns the number of bytes that Append() writes.
+  google_sky::int64 Size(bool big) const {
+    string out;
+    Append(0, 0, big, &out);
+    return out.size();
+  }
+
+ private:
+  struct Field {
+    int type;
+    google_sky::int64 count;
+    string data;  // Little-endian values.
+  };
+
+  map<int, Field> fields_;
+
+  string *Add(int tag, int type, google_sky::int64 count) {
+    Field *field = &fields_[tag];
+    field->type = type;
+    field->count = count;
+    field->data.clear();
+    return &field->data;
+  }
+};
+
+// Returns the number of tiles of tile_size pixels covering image.
+int CountTiles(const google_sky::Image &image, int tile_size) {
+  return ((image.width() + tile_size - 1) / tile_size) *
+         ((image.height() + tile_size - 1) / tile_size);
+}
+
+// Fills in the fields of the IFD of a level of image, which has tiles at
+// the given offsets with the given sizes.
+void FillIfd(const google_sky::Image &image, int level, int tile_size,
+             const vector<google_sky::int64> &offsets,
+             const vector<google_sky::int64> &byte_counts, bool big,
+             Ifd *ifd) {
+  int channels = image.channels();
+  ifd->AddLong(254, level > 0 ? 1 : 0);            // NewSubfileType
+  ifd->AddLong(256, image.width());                // ImageWidth
+  ifd->AddLong(257, image.height());               // ImageLength
+  ifd->AddShorts(258, vector<int>(channels, 8));   // BitsPerSample
+  ifd->AddShort(259, 8);                           // Compression: Deflate
+  ifd->AddShort(262, channels >= 3 ? 2 : 1);       // Photometric
+  ifd->AddShort(277, channels);                    // SamplesPerPixel
+  ifd->AddShort(284, 1);                           // PlanarConfiguration
+  ifd->AddShort(317, 2);                           // Predictor: horizontal
+  ifd->AddLong(322, tile_size);                    // TileWidth
+  ifd->AddLong(323, tile_size);                    // TileLength
+  ifd->AddOffsets(324, offsets, big);              // TileOffsets
+  ifd->AddOffsets(325, byte_counts, big);          // TileByteCounts
+  if (channels == 2 || channels == 4) {
+    ifd->AddShort(338, 2);                         // ExtraSamples: alpha
+  }
+}
+
+// Halves image into overview, rounding odd sizes up.  Each pixel averages
+// a block of 2 x 2 pixels, weighting colors by alpha if there is an alpha
+// channel.
+void Downsample(const google_sky::Image &image,
+                google_sky::Image *overview) {
+  int channels = image.channels();
+  bool has_alpha = channels == 2 || channels == 4;
+  int color_channels = has_alpha ? channels - 1 : channels;
+  CHECK(overview->Resize((image.width() + 1) / 2, (image.height() + 1) / 2,
+                         image.colorspace()));
+  for (int j = 0; j < overview->height(); ++j) {
+    google_sky::uint8 *out = overview->GetMutableRow(j);
+    for (int i = 0; i < overview->width(); ++i, out += channels) {
+      int num_pixels = 0;
+      int weight = 0;
+      int sums[3] = { 0, 0, 0 };
+      for (int y = 2 * j; y < min(2 * j + 2, image.height()); ++y) {
+        const google_sky::uint8 *row = image.GetRow(y);
+        for (int x = 2 * i; x < min(2 * i + 2, image.width()); ++x) {
+          const google_sky::uint8 *pixel = row + channels * x;
+          int alpha = has_alpha ? pixel[channels - 1] : 1;
+          for (int c = 0; c < color_channels; ++c) {
+            sums[c] += pixel[c] * alpha;
+          }
+          weight += alpha;
+          ++num_pixels;
+        }
+      }
+      for (int c = 0; c < color_channels; ++c) {
+        out[c] = weight == 0 ? 0 : static_cast<google_sky::uint8>(
+            (sums[c] + weight / 2) / weight);
+      }
+      if (has_alpha) {
+        out[channels - 1] = static_cast<google_sky::uint8>(
+            (weight + num_pixels / 2) / num_pixels);
+      }
+    }
+  }
+}
+
+}  // namespace
+
+namespace google_sky {
+
+// Compresses one tile of an image.
+class GeoTiffWriter::CompressTask : public Task {
+ public:
+  CompressTask(const Image &image, int tile_size, int compression_level,
+               int x, int y, string *data)
+      : image_(image), tile_size_(tile_size),
+        compression_level_(compression_level), x_(x), y_(y), data_(data) {
+    // Nothing needed.
+  }
+
+  virtual void Run() {
+    // Tiles on the right and bottom edges are padded with zeros.
+    int channels = image_.channels();
+    int row_size = tile_size_ * channels;
+    string tile(static_cast<size_t>(row_size) * tile_size_, '\0');
+    int x_start = x_ * tile_size_;
+    int y_start = y_ * tile_size_;
+    int copy_size = min(tile_size_, image_.width() - x_start) * channels;
+    int height = min(tile_size_, image_.height() - y_start);
+    for (int j = 0; j < height; ++j) {
+      memcpy(&tile[j * row_size], image_.GetRow(y_start + j) +
+             x_start * channels, copy_size);
+    }
+
+    // Store each sample as the difference from the one to its left, which
+    // compresses much better for smooth images.
+    for (int j = 0; j < tile_size_; ++j) {
+      uint8 *row = reinterpret_cast<uint8 *>(&tile[j * row_size]);
+      for (int k = row_size - 1; k >= channels; --k) {
+        row[k] -= row[k - channels];
+      }
+    }
+
+    uLongf size = compressBound(tile.size());
+    data_->resize(size);
+    int status = compress2(reinterpret_cast<Bytef *>(&(*data_)[0]), &size,
+                           reinterpret_cast<const Bytef *>(tile.data()),
+                           tile.size(), compression_level_);
+    CHECK_EQ(status, Z_OK) << "Couldn't compress tile";
+    data_->resize(size);
+  }
+
+ private:
+  const Image &image_;
+  int tile_size_;
+  int compression_level_;
+  int x_;
+  int y_;
+  string *data_;
+
+  DISALLOW_COPY_AND_ASSIGN(CompressTask);
+};
+
+GeoTiffWriter::GeoTiffWriter()
+    : tile_size_(256),
+      compression_level_(6),
+      num_threads_(ThreadPool::DefaultNumThreads()),
+      big_tiff_(false),
+      x_scale_(1.0),
+      y_scale_(-1.0),
+      x_origin_(0.0),
+      y_origin_(0.0) {
+  // Nothing needed.
+}
+
+void GeoTiffWriter::SetWorldTransform(double x_scale, double y_scale,
+                                      double x_origin, double y_origin) {
+  x_scale_ = x_scale;
+  y_scale_ = y_scale;
+  x_origin_ = x_origin;
+  y_origin_ = y_origin;
+}
+
+int GeoTiffWriter::CountLevels(int width, int height, int tile_size) {
+  int num_levels = 1;
+  while (width > tile_size || height > tile_size) {
+    width = (width + 1) / 2;
+    height = (height + 1) / 2;
+    ++num_levels;
+  }
+  return num_levels;
+}
+
+bool GeoTiffWriter::Write(const Image &image, const string &filename,
+                          string *error) const {
+  if (image.width() == 0 || image.height() == 0) {
+    *error = StringPrintf("Can't write empty image to '%s'",
+                          filename.c_str());
+    return false;
+  }
+
+  // Each overview halves the level before it.
+  vector<const Image *> levels(1, &image);
+  vector<Image *> overviews;
+  int num_levels = CountLevels(image.width(), image.height(), tile_size_);
+  for (int level = 1; level < num_levels; ++level) {
+    Image *overview = new Image;
+    Downsample(*levels.back(), overview);
+    overviews.push_back(overview);
+    levels.push_back(overview);
+  }
+
+  bool written = WriteLevels(levels, filename, error);
+  for (size_t i = 0; i < overviews.size(); ++i) {
+    delete overviews[i];
+  }
+  return written;
+}
+
+bool GeoTiffWriter::WriteLevels(const vector<const Image *> &levels,
+                                const string &filename,
+                                string *error) const {
+  vector<vector<int64> > offsets(levels.size());
+  vector<vector<int64> > byte_counts(levels.size());
+  int64 max_tiles_size = 0;
+  int64 max_tile_size = compressBound(static_cast<uLong>(tile_size_) *
+                                      tile_size_ * levels[0]->channels());
+  for (size_t i = 0; i < levels.size(); ++i) {
+    int num_tiles = CountTiles(*levels[i], tile_size_);
+    offsets[i].resize(num_tiles, 0);
+    byte_counts[i].resize(num_tiles, 0);
+    max_tiles_size += num_tiles * max_tile_size;
+  }
+
+  // Offsets must be 64 bit if the file could reach 4 GB.
+  string header;
+  MakeHeader(levels, offsets, byte_counts, true, &header);
+  bool big = big_tiff_ || header.size() + max_tiles_size > 0xffffffffLL;
+  MakeHeader(levels, offsets, byte_counts, big, &header);
+
+  FILE *fp = fopen(filename.c_str(), "wb");
+  if (!fp) {
+    *error = StringPrintf("Can't open '%s' for writing", filename.c_str());
+    return false;
+  }
+
+  // Leave room for the header and IFDs, which are written once the tiles
+  // are, and then write the tiles of the smallest overview first, so that
+  // a reader zooming in fetches from increasing offsets.
+  int64 position = header.size();
+  bool written = fwrite(string(header.size(), '\0').data(), 1,
+                        header.size(), fp) == header.size();
+  for (int i = levels.size() - 1; written && i >= 0; --i) {
+    written = WriteTiles(*levels[i], fp, &position, &offsets[i],
+                         &byte_counts[i]);
+  }
+  if (written) {
+    MakeHeader(levels, offsets, byte_counts, big, &header);
+    rewind(fp);
+    written = fwrite(header.data(), 1, header.size(), fp) == header.size();
+  }
+  if (fclose(fp) != 0) written = false;
+  if (!written) {
+    *error = StringPrintf("Couldn't write '%s'", filename.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool GeoTiffWriter::WriteTiles(const Image &image, FILE *fp,
+                               int64 *position, vector<int64> *offsets,
+                               vector<int64> *byte_counts) const {
+  int tiles_across = (image.width() + tile_size_ - 1) / tile_size_;
+  int num_tiles = CountTiles(image, tile_size_);
+  offsets->clear();
+  byte_counts->clear();
+
+  // Compress a batch of tiles in parallel and then write them in order.
+  ThreadPool pool(num_threads_);
+  int batch_size = 8 * pool.num_threads();
+  vector<string> batch(batch_size);
+  for (int first = 0; first < num_tiles; first += batch_size) {
+    int end = min(first + batch_size, num_tiles);
+    for (int i = first; i < end; ++i) {
+      pool.Add(new CompressTask(image, tile_size_, compression_level_,
+                                i % tiles_across, i / tiles_across,
+                                &batch[i - first]));
+    }
+    pool.Wait();
+    for (int i = first; i < end; ++i) {
+      const string &data = batch[i - first];
+      if (fwrite(data.data(), 1, data.size(), fp) != data.size()) {
+        return false;
+      }
+      offsets->push_back(*position);
+      byte_counts->push_back(data.size());
+      *position += data.size();
+    }
+  }
+  return true;
+}
+
+void GeoTiffWriter::MakeHeader(const vector<const Image *> &levels,
+                               const vector<vector<int64> > &offsets,
+                               const vector<vector<int64> > &byte_counts,
+                               bool big, string *header) const {
+  // Little-endian byte order, then the version and the offset of the
+  // first IFD, which follows the header.
+  header->assign("II");
+  if (big) {
+    AppendInteger(43, 2, header);
+    AppendInteger(8, 2, header);
+    AppendInteger(0, 2, header);
+    AppendInteger(16, 8, header);
+  } else {
+    AppendInteger(42, 2, header);
+    AppendInteger(8, 4, header);
+  }
+
+  vector<Ifd> ifds(levels.size());
+  for (size_t i = 0; i < levels.size(); ++i) {
+    FillIfd(*levels[i], i, tile_size_, offsets[i], byte_counts[i], big,
+            &ifds[i]);
+  }
+
+  // ModelTransformationTag: the world file's affine transformation as a
+  // 4 x 4 matrix from pixel (i, j) to (longitude, latitude).
+  double transform[16] = { x_scale_, 0.0, 0.0, x_origin_,
+                           0.0, y_scale_, 0.0, y_origin_,
+                           0.0, 0.0, 0.0, 0.0,
+                           0.0, 0.0, 0.0, 1.0 };
+  ifds[0].AddDoubles(34264, vector<double>(transform, transform + 16));
+
+  // GeoKeyDirectoryTag: version 1.1.0 with 4 keys, a geographic model
+  // (GTModelTypeGeoKey), pixels that are points (GTRasterTypeGeoKey),
+  // EPSG:4326 (GeographicTypeGeoKey) and degrees (GeogAngularUnitsGeoKey).
+  int keys[20] = { 1, 1, 0, 4,
+                   1024, 0, 1, 2,
+                   1025, 0, 1, 2,
+                   2048, 0, 1, 4326,
+                   2054, 0, 1, 9102 };
+  ifds[0].AddShorts(34735, vector<int>(keys, keys + 20));
+
+  for (size_t i = 0; i < ifds.size(); ++i) {
+    int64 start = header->size();
+    int64 next = i + 1 < ifds.size() ? start + ifds[i].Size(big) : 0;
+    ifds[i].Append(start, next, big, header);
+  }
+}
+
+}  // namespace google_sky
@@ -0,0 +1,188 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// Defines the GeoTiffWriter class for writing tiled GeoTIFF files
+
+#ifndef GEOTIFF_H__
+#define GEOTIFF_H__
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "base.h"
+#include "image.h"
+
+namespace google_sky {
+
+// Class for writing a warped image as a cloud-optimized GeoTIFF
+//
+// A single PNG and world file has to be decoded in full to see any part of
+// it.  GeoTiffWriter instead writes a tiled TIFF whose tiles are Deflate
+// compressed (with horizontal differencing) independently, followed by
+// overviews that each halve the level before until the image fits in a
+// tile.  The header and every IFD come first, then the tiles of the
+// smallest overview through to those of the full image, so a reader can
+// find any window at any zoom from the first few KB of the file and fetch
+// just the tiles it needs with range requests.
+//
+// The full image IFD carries GeoTIFF tags for the lat-lon grid made by
+// SkyProjection: a ModelTransformationTag holding the same affine
+// transformation as its world file (longitude = ra - 180, so the pixel
+// size along x is negative) and a GeoKeyDirectoryTag for geographic
+// EPSG:4326 coordinates with pixel-is-point rasters, since the world file
+// gives the centers of pixels.  Files too large for 32 bit offsets are
+// written as BigTIFF.
+//
+// Tiles are compressed in parallel and written in batches, so only the
+// image, its overviews and a batch of compressed tiles are in memory.
+//
+// Example Usage:
+//
+// SkyProjection projection(image, wcs);
+// Image warped_image;
+// projection.WarpImage(&warped_image);
+// double x_scale, y_scale, x_origin, y_origin;
+// projection.GetWorldTransform(&x_scale, &y_scale, &x_origin, &y_origin);
+//
+// GeoTiffWriter writer;
+// writer.SetWorldTransform(x_scale, y_scale, x_origin, y_origin);
+// string error;
+// if (!writer.Write(warped_image, "warped.tif", &error)) {
+//   fprintf(stderr, "%s\n", error.c_str());
+// }
+
+class GeoTiffWriter {
+ public:
+  // Creates a writer of 256 pixel tiles with one pixel per degree.
+  GeoTiffWriter();
+
+  ~GeoTiffWriter() {
+    // Nothing needed.
+  }
+
+  // Sets the georeferencing of the image, as returned by
+  // SkyProjection::GetWorldTransform(): the pixel sizes in degrees along x
+  // and y and the longitude and latitude of the center of pixel (0, 0).
+  void SetWorldTransform(double x_scale, double y_scale, double x_origin,
+                         double y_origin);
+
+  // Writes image, which may have 1 to 4 channels, to filename.  Returns
+  // false with a description of the problem in error if the file can't be
+  // written.
+  bool Write(const Image &image, const string &filename,
+             string *error) const;
+
+  // Returns the number of levels, the full image plus its overviews,
+  // written for an image of the given size with tiles of tile_size pixels.
+  static int CountLevels(int width, int height, int tile_size);
+
+  // Returns the side length of the tiles in pixels.
+  inline int tile_size(void) const {
+    return tile_size_;
+  }
+
+  // Sets the side length of the tiles in pixels, 256 by default.  TIFF
+  // requires a multiple of 16.
+  inline void set_tile_size(int tile_size) {
+    CHECK(tile_size > 0 && tile_size % 16 == 0)
+        << "Bad tile size " << tile_size;
+    tile_size_ = tile_size;
+  }
+
+  // Returns the zlib compression level of the tiles.
+  inline int compression_level(void) const {
+    return compression_level_;
+  }
+
+  // Sets the zlib compression level of the tiles, from 1 (fastest) to 9
+  // (smallest), 6 by default.
+  inline void set_compression_level(int compression_level) {
+    CHECK(compression_level >= 1 && compression_level <= 9)
+        << "Bad compression level " << compression_level;
+    compression_level_ = compression_level;
+  }
+
+  // Returns the number of threads used to compress tiles.
+  inline int num_threads(void) const {
+    return num_threads_;
+  }
+
+  // Sets the number of threads used to compress tiles, which defaults to
+  // ThreadPool::DefaultNumThreads().
+  inline void set_num_threads(int num_threads) {
+    num_threads_ = num_threads;
+  }
+
+  // Returns whether BigTIFF is written even for files that don't need it.
+  inline bool big_tiff(void) const {
+    return big_tiff_;
+  }
+
+  // Sets whether BigTIFF is written even for files that don't need it,
+  // false by default.
+  inline void set_big_tiff(bool big_tiff) {
+    big_tiff_ = big_tiff;
+  }
+
+ private:
+  class CompressTask;
+
+  int tile_size_;
+  int compression_level_;
+  int num_threads_;
+  bool big_tiff_;
+  double x_scale_;
+  double y_scale_;
+  double x_origin_;
+  double y_origin_;
+
+  // Writes levels, the image followed by its overviews, to filename.
+  bool WriteLevels(const vector<const Image *> &levels,
+                   const string &filename, string *error) const;
+
+  // Compresses the tiles of image in parallel and appends them to fp,
+  // which is at byte offset *position, recording the offset and size of
+  // each tile.  Returns false if the tiles can't be written.
+  bool WriteTiles(const Image &image, FILE *fp, int64 *position,
+                  vector<int64> *offsets, vector<int64> *byte_counts) const;
+
+  // Makes the TIFF header and the IFDs of levels, which have tiles at the
+  // given offsets with the given sizes.  Its size doesn't depend on the
+  // offsets and sizes.
+  void MakeHeader(const vector<const Image *> &levels,
+                  const vector<vector<int64> > &offsets,
+                  const vector<vector<int64> > &byte_counts, bool big,
+                  string *header) const;
+
+  DISALLOW_COPY_AND_ASSIGN(GeoTiffWriter);
+};
+
+}  // namespace google_sky
+
+#endif  // GEOTIFF_H__
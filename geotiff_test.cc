@@ -0,0 +1,266 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <zlib.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "base.h"
+#include "geotiff.h"
+#include "image.h"
+#include "test_util.h"
+
+namespace google_sky {
+
+// The fields of an IFD by tag, with every value converted to a double.
+typedef map<int, vector<double> > Fields;
+
+// Reads a little-endian integer of size bytes at offset in file.
+int64 ReadInteger(const string &file, int64 offset, int size) {
+  ASSERT_TRUE(offset + size <= static_cast<int64>(file.size()));
+  int64 value = 0;
+  for (int k = size - 1; k >= 0; --k) {
+    value = (value << 8) | static_cast<uint8>(file[offset + k]);
+  }
+  return value;
+}
+
+// Reads every IFD of a little-endian TIFF or BigTIFF file, also returning
+// where each IFD starts.
+void ReadIfds(const string &file, bool big, vector<Fields> *ifds,
+              vector<int64> *starts) {
+  ASSERT_TRUE(file.substr(0, 2) == "II");
+  ASSERT_EQ(big ? 43 : 42, static_cast<int>(ReadInteger(file, 2, 2)));
+  int value_size = big ? 8 : 4;
+  int64 start = ReadInteger(file, big ? 8 : 4, value_size);
+  while (start != 0) {
+    starts->push_back(start);
+    ifds->push_back(Fields());
+    Fields *fields = &ifds->back();
+    int64 count = ReadInteger(file, start, big ? 8 : 2);
+    int64 entry = start + (big ? 8 : 2);
+    for (int64 i = 0; i < count; ++i, entry += big ? 20 : 12) {
+      int tag = ReadInteger(file, entry, 2);
+      int type = ReadInteger(file, entry + 2, 2);
+      int64 n = ReadInteger(file, entry + 4, value_size);
+      int size = type == 3 ? 2 : (type == 4 ? 4 : 8);
+      int64 data = entry + 4 + value_size;
+      if (n * size > value_size) data = ReadInteger(file, data, value_size);
+      vector<double> *values = &(*fields)[tag];
+      for (int64 k = 0; k < n; ++k) {
+        int64 bits = ReadInteger(file, data + k * size, size);
+        if (type == 12) {
+          double value;
+          memcpy(&value, &bits, sizeof(value));
+          values->push_back(value);
+        } else {
+          values->push_back(static_cast<double>(bits));
+        }
+      }
+    }
+    start = ReadInteger(file, entry, value_size);
+  }
+}
+
+// Decompresses tile index of a level and undoes the horizontal
+// differencing.
+string ReadTile(const string &file, const Fields &fields, int index) {
+  int tile_size = fields.find(322)->second[0];
+  int channels = fields.find(277)->second[0];
+  ASSERT_EQ(tile_size, static_cast<int>(fields.find(323)->second[0]));
+  ASSERT_EQ(8, static_cast<int>(fields.find(259)->second[0]));
+  ASSERT_EQ(2, static_cast<int>(fields.find(317)->second[0]));
+  int64 offset = fields.find(324)->second[index];
+  int64 byte_count = fields.find(325)->second[index];
+  string tile(tile_size * tile_size * channels, '\0');
+  uLongf size = tile.size();
+  ASSERT_EQ(Z_OK, uncompress(reinterpret_cast<Bytef *>(&tile[0]), &size,
+                             reinterpret_cast<const Bytef *>(
+                                 file.data() + offset), byte_count));
+  ASSERT_EQ(tile.size(), size);
+  int row_size = tile_size * channels;
+  for (int j = 0; j < tile_size; ++j) {
+    uint8 *row = reinterpret_cast<uint8 *>(&tile[j * row_size]);
+    for (int k = channels; k < row_size; ++k) {
+      row[k] += row[k - channels];
+    }
+  }
+  return tile;
+}
+
+int Main(int argc, char **argv) {
+  {
+    cout << "Testing CountLevels()... ";
+    ASSERT_EQ(1, GeoTiffWriter::CountLevels(256, 256, 256));
+    ASSERT_EQ(1, GeoTiffWriter::CountLevels(10, 200, 256));
+    ASSERT_EQ(2, GeoTiffWriter::CountLevels(257, 10, 256));
+    ASSERT_EQ(3, GeoTiffWriter::CountLevels(600, 300, 256));
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing Write()... ";
+    Image image;
+    ASSERT_TRUE(image.Resize(600, 300, Image::RGBA));
+    for (int j = 0; j < image.height(); ++j) {
+      for (int i = 0; i < image.width(); ++i) {
+        image.SetValue(i, j, 0, i % 256);
+        image.SetValue(i, j, 1, j % 256);
+        image.SetValue(i, j, 2, (i + j) % 256);
+        image.SetValue(i, j, 3, i < 100 ? 0 : 255);
+      }
+    }
+
+    GeoTiffWriter writer;
+    writer.set_num_threads(3);
+    writer.SetWorldTransform(-0.01, -0.02, 30.0, 45.0);
+    string error;
+    ASSERT_TRUE(writer.Write(image, "geotiff_test.tif", &error));
+    string file = ReadFile("geotiff_test.tif");
+
+    // The full image is followed by overviews of 300 x 150 and 75 x 38.
+    vector<Fields> ifds;
+    vector<int64> starts;
+    ReadIfds(file, false, &ifds, &starts);
+    ASSERT_EQ(3, static_cast<int>(ifds.size()));
+    ASSERT_EQ(8, static_cast<int>(starts[0]));
+    int widths[3] = { 600, 300, 150 };
+    int heights[3] = { 300, 150, 75 };
+    int num_tiles[3] = { 6, 2, 1 };
+    for (int i = 0; i < 3; ++i) {
+      ASSERT_EQ(widths[i], static_cast<int>(ifds[i][256][0]));
+      ASSERT_EQ(heights[i], static_cast<int>(ifds[i][257][0]));
+      ASSERT_EQ(i == 0 ? 0 : 1, static_cast<int>(ifds[i][254][0]));
+      ASSERT_EQ(4, static_cast<int>(ifds[i][277][0]));
+      ASSERT_EQ(2, static_cast<int>(ifds[i][338][0]));
+      ASSERT_EQ(num_tiles[i], static_cast<int>(ifds[i][324].size()));
+      ASSERT_EQ(num_tiles[i], static_cast<int>(ifds[i][325].size()));
+    }
+
+    // The IFDs come before every tile, and the tiles of the smallest
+    // overview come first.
+    ASSERT_TRUE(starts[2] < ifds[2][324][0]);
+    ASSERT_TRUE(ifds[2][324][0] < ifds[1][324][0]);
+    ASSERT_TRUE(ifds[1][324][1] < ifds[0][324][0]);
+    ASSERT_EQ(static_cast<int64>(file.size()),
+              static_cast<int64>(ifds[0][324][5] + ifds[0][325][5]));
+
+    // Only the full image is georeferenced.
+    vector<double> &transform = ifds[0][34264];
+    ASSERT_EQ(16, static_cast<int>(transform.size()));
+    ASSERT_FLOAT_EQ(-0.01, transform[0], 1.0e-15);
+    ASSERT_FLOAT_EQ(30.0, transform[3], 1.0e-15);
+    ASSERT_FLOAT_EQ(-0.02, transform[5], 1.0e-15);
+    ASSERT_FLOAT_EQ(45.0, transform[7], 1.0e-15);
+    vector<double> &keys = ifds[0][34735];
+    ASSERT_EQ(20, static_cast<int>(keys.size()));
+    ASSERT_EQ(2048, static_cast<int>(keys[12]));
+    ASSERT_EQ(4326, static_cast<int>(keys[15]));
+    ASSERT_TRUE(ifds[1].find(34264) == ifds[1].end());
+
+    // Tile (1, 1) holds pixels from (256, 256), padded with zeros.
+    string tile = ReadTile(file, ifds[0], 4);
+    const uint8 *pixel = reinterpret_cast<const uint8 *>(
+        tile.data() + 4 * (20 * 256 + 10));
+    ASSERT_EQ(266 % 256, static_cast<int>(pixel[0]));
+    ASSERT_EQ(276 % 256, static_cast<int>(pixel[1]));
+    ASSERT_EQ(542 % 256, static_cast<int>(pixel[2]));
+    ASSERT_EQ(255, static_cast<int>(pixel[3]));
+    pixel = reinterpret_cast<const uint8 *>(tile.data() + 4 * (50 * 256));
+    ASSERT_EQ(0, static_cast<int>(pixel[3]));
+
+    // Overview pixels average blocks of 2 x 2 pixels weighted by alpha.
+    tile = ReadTile(file, ifds[1], 0);
+    pixel = reinterpret_cast<const uint8 *>(tile.data() + 4 * (5 * 256 + 60));
+    ASSERT_EQ((120 + 121 + 120 + 121 + 2) / 4, static_cast<int>(pixel[0]));
+    ASSERT_EQ((10 + 10 + 11 + 11 + 2) / 4, static_cast<int>(pixel[1]));
+    ASSERT_EQ(255, static_cast<int>(pixel[3]));
+    pixel = reinterpret_cast<const uint8 *>(tile.data() + 4 * (5 * 256 + 10));
+    ASSERT_EQ(0, static_cast<int>(pixel[0]));
+    ASSERT_EQ(0, static_cast<int>(pixel[3]));
+
+    ASSERT_TRUE(system("rm -f geotiff_test.tif") == 0);
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing Write() of BigTIFF... ";
+    Image image;
+    ASSERT_TRUE(image.Resize(40, 20, Image::GRAYSCALE));
+    for (int j = 0; j < image.height(); ++j) {
+      for (int i = 0; i < image.width(); ++i) {
+        image.SetValue(i, j, 0, 3 * i + j);
+      }
+    }
+
+    GeoTiffWriter writer;
+    writer.set_tile_size(16);
+    writer.set_big_tiff(true);
+    string error;
+    ASSERT_TRUE(writer.Write(image, "geotiff_test.tif", &error));
+    string file = ReadFile("geotiff_test.tif");
+    vector<Fields> ifds;
+    vector<int64> starts;
+    ReadIfds(file, true, &ifds, &starts);
+    ASSERT_EQ(16, static_cast<int>(starts[0]));
+    ASSERT_EQ(GeoTiffWriter::CountLevels(40, 20, 16),
+              static_cast<int>(ifds.size()));
+    ASSERT_EQ(6, static_cast<int>(ifds[0][324].size()));
+    ASSERT_EQ(1, static_cast<int>(ifds[0][262][0]));
+    ASSERT_TRUE(ifds[0].find(338) == ifds[0].end());
+
+    // Tile (2, 1) holds pixels from (32, 16).
+    string tile = ReadTile(file, ifds[0], 5);
+    ASSERT_EQ(3 * 33 + 18, static_cast<int>(static_cast<uint8>(
+        tile[2 * 16 + 1])));
+    ASSERT_EQ(0, static_cast<int>(tile[2 * 16 + 8]));
+
+    ASSERT_FALSE(writer.Write(image, "no_such_directory/geotiff_test.tif",
+                              &error));
+    ASSERT_TRUE(error.find("no_such_directory") != string::npos);
+
+    ASSERT_TRUE(system("rm -f geotiff_test.tif") == 0);
+    cout << "pass\n";
+  }
+
+  cout << "Passed\n";
+  return 0;
+}
+
+}  // namespace google_sky
+
+int main(int argc, char **argv) {
+  return google_sky::Main(argc, argv);
+}
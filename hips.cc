@@ -0,0 +1,643 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "hips.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <ctime>
+
+#include "file_util.h"
+#include "imagecache.h"
+#include "mosaic.h"
+#include "string_util.h"
+#include "threadpool.h"
+#include "wcsprojection.h"
+
+namespace {
+
+// Blended pixels with at least this weight come out fully opaque, so no
+// image below them needs to be sampled.
+static const float OPAQUE_WEIGHT = 1.0f - 0.5f / 255.0f;
+
+// The circles around images are padded by this many pixels to cover the
+// edge pixels.
+static const double BOUNDS_PADDING_PIXELS = 1.0;
+
+// The circles around tiles are grown by this factor since the edges of
+// HEALPix pixels are curved.
+static const double TILE_RADIUS_FACTOR = 1.1;
+
+// The order whose tiles go in the Allsky file, unless max_order is lower.
+static const int ALLSKY_ORDER = 3;
+
+// The side length of the tiles in the Allsky file.
+static const int ALLSKY_TILE_WIDTH = 64;
+
+// Ring and longitude offsets of the 12 base HEALPix pixels, in units of
+// the base pixel size, as in the HEALPix library.
+static const int JRLL[12] = { 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4 };
+static const int JPLL[12] = { 1, 3, 5, 7, 0, 2, 4, 6, 1, 3, 5, 7 };
+
+// Finds the unit vector of ra, dec.
+void ToVector(double ra, double dec, double *v) {
+  double to_radians = PI / 180.0;
+  double cos_dec = cos(dec * to_radians);
+  v[0] = cos_dec * cos(ra * to_radians);
+  v[1] = cos_dec * sin(ra * to_radians);
+  v[2] = sin(dec * to_radians);
+}
+
+// Returns the angle in degrees between two unit vectors.
+double Angle(const double *a, const double *b) {
+  double dot = a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+  return acos(max(-1.0, min(1.0, dot))) * (180.0 / PI);
+}
+
+// Returns the NESTED index within a base pixel of (ix, iy), which has the
+// bits of ix in the even positions and those of iy in the odd ones.
+google_sky::int64 Interleave(google_sky::int64 ix, google_sky::int64 iy) {
+  google_sky::int64 index = 0;
+  for (int bit = 0; bit < 31; ++bit) {
+    index |= ((ix >> bit) & 1) << (2 * bit);
+    index |= ((iy >> bit) & 1) << (2 * bit + 1);
+  }
+  return index;
+}
+
+// Inverts Interleave().
+void Deinterleave(google_sky::int64 index, google_sky::int64 *ix,
+                  google_sky::int64 *iy) {
+  *ix = 0;
+  *iy = 0;
+  for (int bit = 0; bit < 31; ++bit) {
+    *ix |= ((index >> (2 * bit)) & 1) << bit;
+    *iy |= ((index >> (2 * bit + 1)) & 1) << bit;
+  }
+}
+
+// Finds the position of point (x, y) of base pixel face, where x and y run
+// from 0 to 1.  This follows xyf2loc() of the HEALPix library.
+void FaceToRaDec(int face, double x, double y, double *ra, double *dec) {
+  double jr = JRLL[face] - x - y;
+  double nr;
+  double z;
+  double sin_theta;
+  if (jr < 1.0) {
+    nr = jr;
+    double tmp = nr * nr / 3.0;
+    z = 1.0 - tmp;
+    sin_theta = sqrt(tmp * (2.0 - tmp));
+  } else if (jr > 3.0) {
+    nr = 4.0 - jr;
+    double tmp = nr * nr / 3.0;
+    z = tmp - 1.0;
+    sin_theta = sqrt(tmp * (2.0 - tmp));
+  } else {
+    nr = 1.0;
+    z = (2.0 - jr) * 2.0 / 3.0;
+    sin_theta = sqrt((1.0 - z) * (1.0 + z));
+  }
+
+  double tmp = JPLL[face] * nr + x - y;
+  if (tmp < 0.0) tmp += 8.0;
+  if (tmp >= 8.0) tmp -= 8.0;
+  double phi = nr < 1.0e-15 ? 0.0 : (0.25 * PI * tmp) / nr;
+  *ra = phi * (180.0 / PI);
+  *dec = atan2(z, sin_theta) * (180.0 / PI);
+}
+
+}  // namespace
+
+namespace google_sky {
+
+// Warps and writes one tile of the finest order.
+class Hips::LeafTask : public Task {
+ public:
+  LeafTask(const Hips *hips, int64 npix, const vector<int> *indexes,
+           ImageCache *cache, BuildStatus *status)
+      : hips_(hips), npix_(npix), indexes_(indexes), cache_(cache),
+        status_(status) {}
+
+  virtual void Run() {
+    if (status_->failed()) return;
+    Image tile;
+    string error;
+    if (!hips_->RenderTileFromImages(npix_, *indexes_, cache_, &tile,
+                                     &error)) {
+      status_->Fail(error);
+      return;
+    }
+    // A tile may only be reached by the circle around an image.
+    if (tile.AlphaIsEverywhere(0)) return;
+    if (!hips_->WriteTile(hips_->max_order_, npix_, TileSet(), &tile,
+                          &error)) {
+      status_->Fail(error);
+      return;
+    }
+    status_->AddTile(npix_);
+  }
+
+ private:
+  const Hips *hips_;
+  int64 npix_;
+  const vector<int> *indexes_;
+  ImageCache *cache_;
+  BuildStatus *status_;
+
+  DISALLOW_COPY_AND_ASSIGN(LeafTask);
+};
+
+const int Hips::MAX_ORDER;
+
+Hips::Hips(MosaicImageReader *reader)
+    : reader_(reader),
+      images_(),
+      tile_width_(512),
+      max_order_(3),
+      image_origin_(SkyProjection::LOWER_LEFT),
+      num_threads_(ThreadPool::DefaultNumThreads()),
+      cache_bytes_(MemoryBudget::DefaultLimit()),
+      output_directory_("hips"),
+      title_("wcs2kml survey"),
+      creator_did_("ivo://unknown/wcs2kml") {
+  // Nothing needed.
+}
+
+Hips::~Hips() {
+  for (size_t i = 0; i < images_.size(); ++i) {
+    delete images_[i].wcs;
+  }
+}
+
+// The circle is centered on the central pixel and reaches the farthest of
+// a number of points along the edges.
+void Hips::AddImage(WcsProjection *wcs, int width, int height) {
+  CHECK(wcs != NULL);
+  Input input;
+  input.wcs = wcs;
+  input.width = width;
+  input.height = height;
+
+  double x = 0.5 * (width + 1);
+  double y = 0.5 * (height + 1);
+  double ra, dec, ra_x, dec_x, ra_y, dec_y;
+  wcs->ToRaDec(x, y, &ra, &dec);
+  wcs->ToRaDec(x + 1.0, y, &ra_x, &dec_x);
+  wcs->ToRaDec(x, y + 1.0, &ra_y, &dec_y);
+  ToVector(ra, dec, input.center);
+  double v_x[3], v_y[3];
+  ToVector(ra_x, dec_x, v_x);
+  ToVector(ra_y, dec_y, v_y);
+  input.pixel_scale = sqrt(Angle(input.center, v_x) *
+                           Angle(input.center, v_y));
+
+  static const int EDGE_POINTS = 16;
+  input.radius = 0.0;
+  for (int k = 0; k <= EDGE_POINTS; ++k) {
+    double f = static_cast<double>(k) / EDGE_POINTS;
+    double points[4][2] = { { 0.5 + f * width, 0.5 },
+                            { 0.5 + f * width, height + 0.5 },
+                            { 0.5, 0.5 + f * height },
+                            { width + 0.5, 0.5 + f * height } };
+    for (int p = 0; p < 4; ++p) {
+      double v[3];
+      wcs->ToRaDec(points[p][0], points[p][1], &ra, &dec);
+      ToVector(ra, dec, v);
+      input.radius = max(input.radius, Angle(input.center, v));
+    }
+  }
+  input.radius += BOUNDS_PADDING_PIXELS * input.pixel_scale;
+
+  images_.push_back(input);
+}
+
+// HEALPix pixels of order k are sqrt(pi / 3) / 2^k radians across.
+int Hips::FindNativeOrder(void) const {
+  CHECK(!images_.empty()) << "Survey has no images";
+  vector<double> scales;
+  for (size_t i = 0; i < images_.size(); ++i) {
+    scales.push_back(images_[i].pixel_scale);
+  }
+  nth_element(scales.begin(), scales.begin() + scales.size() / 2,
+              scales.end());
+  double scale = scales[scales.size() / 2];
+  if (!(scale > 0.0)) return 0;
+
+  double base = sqrt(PI / 3.0) * (180.0 / PI);
+  double order = log(base / (tile_width_ * scale)) / log(2.0);
+  return max(0, min(static_cast<int>(ceil(order - 1.0e-9)), MAX_ORDER));
+}
+
+// Each order is finished before the next coarser one starts.  The Allsky
+// file is made from the tiles of its order once they exist.
+bool Hips::Build(string *error) const {
+  if (images_.empty()) {
+    *error = "The survey has no images";
+    return false;
+  }
+  if (!MakeDirectory(output_directory_)) {
+    *error = "Cannot create output directory " + output_directory_;
+    return false;
+  }
+
+  TileImages tile_images;
+  FindTileImages(&tile_images);
+
+  ThreadPool pool(num_threads_);
+  TileSet tiles;
+  {
+    ImageCache cache(reader_, cache_bytes_);
+    BuildStatus status;
+    for (TileImages::const_iterator it = tile_images.begin();
+         it != tile_images.end(); ++it) {
+      pool.Add(new LeafTask(this, it->first, &it->second, &cache, &status));
+    }
+    pool.Wait();
+    if (status.failed()) {
+      *error = status.error();
+      return false;
+    }
+    tiles = status.tiles();
+  }
+
+  int allsky_order = min(ALLSKY_ORDER, max_order_);
+  TileSet allsky_tiles = tiles;
+  for (int order = max_order_ - 1; order >= 0; --order) {
+    map<int64, TileSet> parents;
+    for (TileSet::const_iterator it = tiles.begin(); it != tiles.end();
+         ++it) {
+      parents[*it / 4].insert(*it);
+    }
+    if (!BuildParentTiles(this, order, parents, &pool, &tiles, error)) {
+      return false;
+    }
+    if (order == allsky_order) allsky_tiles = tiles;
+  }
+
+  return WriteAllsky(allsky_order, allsky_tiles, error) &&
+         WriteProperties(error);
+}
+
+bool Hips::RenderTile(int64 npix, Image *tile, string *error) const {
+  CHECK(npix >= 0 && npix < NumTiles(max_order_)) << "Bad tile " << npix;
+  TileImages tile_images;
+  FindTileImages(&tile_images);
+  ImageCache cache(reader_, cache_bytes_);
+  TileImages::const_iterator it = tile_images.find(npix);
+  return RenderTileFromImages(
+      npix, it == tile_images.end() ? vector<int>() : it->second, &cache,
+      tile, error);
+}
+
+void Hips::PixelToRaDec(int order, int64 npix, double x, double y,
+                        double *ra, double *dec) {
+  int64 nside = static_cast<int64>(1) << order;
+  int face = static_cast<int>(npix >> (2 * order));
+  int64 ix, iy;
+  Deinterleave(npix & (nside * nside - 1), &ix, &iy);
+  FaceToRaDec(face, (ix + x) / nside, (iy + y) / nside, ra, dec);
+}
+
+// This follows loc2pix() of the HEALPix library, which splits the sky into
+// the equatorial belt and the polar caps.
+int64 Hips::RaDecToPixel(int order, double ra, double dec) {
+  int64 nside = static_cast<int64>(1) << order;
+  double z = sin(dec * (PI / 180.0));
+  double za = fabs(z);
+  double tt = fmod(ra / 90.0, 4.0);
+  if (tt < 0.0) tt += 4.0;
+
+  int face;
+  int64 ix, iy;
+  if (za <= 2.0 / 3.0) {
+    double temp1 = nside * (0.5 + tt);
+    double temp2 = nside * (z * 0.75);
+    int64 jp = static_cast<int64>(temp1 - temp2);
+    int64 jm = static_cast<int64>(temp1 + temp2);
+    int64 ifp = jp >> order;
+    int64 ifm = jm >> order;
+    if (ifp == ifm) {
+      face = static_cast<int>(ifp | 4);
+    } else if (ifp < ifm) {
+      face = static_cast<int>(ifp);
+    } else {
+      face = static_cast<int>(ifm + 8);
+    }
+    ix = jm & (nside - 1);
+    iy = nside - (jp & (nside - 1)) - 1;
+  } else {
+    int ntt = min(3, static_cast<int>(tt));
+    double tp = tt - ntt;
+    double tmp = nside * sqrt(3.0 * (1.0 - za));
+    int64 jp = min(static_cast<int64>(tp * tmp), nside - 1);
+    int64 jm = min(static_cast<int64>((1.0 - tp) * tmp), nside - 1);
+    if (z >= 0.0) {
+      face = ntt;
+      ix = nside - jm - 1;
+      iy = nside - jp - 1;
+    } else {
+      face = ntt + 8;
+      ix = jp;
+      iy = jm;
+    }
+  }
+  return (static_cast<int64>(face) << (2 * order)) + Interleave(ix, iy);
+}
+
+string Hips::MakeTilePath(int order, int64 npix) {
+  return StringPrintf("Norder%d/Dir%lld/Npix%lld.png", order,
+                      (npix / 10000) * 10000, npix);
+}
+
+// Tiles are found from coarse to fine: only the children of a tile that
+// overlaps an image's circle can overlap it.
+void Hips::FindTileImages(TileImages *tile_images) const {
+  TileImages candidates;
+  vector<int> all;
+  for (int k = 0; k < num_images(); ++k) {
+    all.push_back(k);
+  }
+  for (int64 npix = 0; npix < NumTiles(0); ++npix) {
+    candidates[npix] = all;
+  }
+
+  for (int order = 0; order <= max_order_; ++order) {
+    TileImages overlapping;
+    for (TileImages::const_iterator it = candidates.begin();
+         it != candidates.end(); ++it) {
+      double ra, dec, center[3];
+      PixelToRaDec(order, it->first, 0.5, 0.5, &ra, &dec);
+      ToVector(ra, dec, center);
+      double radius = 0.0;
+      for (int k = 0; k < 9; ++k) {
+        double v[3];
+        PixelToRaDec(order, it->first, 0.5 * (k % 3), 0.5 * (k / 3), &ra,
+                     &dec);
+        ToVector(ra, dec, v);
+        radius = max(radius, Angle(center, v));
+      }
+      radius *= TILE_RADIUS_FACTOR;
+
+      vector<int> indexes;
+      for (size_t k = 0; k < it->second.size(); ++k) {
+        const Input &image = images_[it->second[k]];
+        if (Angle(center, image.center) <= radius + image.radius) {
+          indexes.push_back(it->second[k]);
+        }
+      }
+      if (!indexes.empty()) overlapping[it->first] = indexes;
+    }
+
+    if (order == max_order_) {
+      tile_images->swap(overlapping);
+      return;
+    }
+    candidates.clear();
+    for (TileImages::const_iterator it = overlapping.begin();
+         it != overlapping.end(); ++it) {
+      for (int c = 0; c < 4; ++c) {
+        candidates[4 * it->first + c] = it->second;
+      }
+    }
+  }
+}
+
+// Pixel (i, j) of a tile is the HEALPix pixel whose coordinates within the
+// tile's base pixel are (x, y) = (tile x * width + j, tile y * width + i),
+// i.e. rows run from the south corner towards the east corner and columns
+// towards the west corner, as in the HiPS standard.  Images are composited
+// front to back as for Mosaic, skipping pixels outside their circles.
+// Tiles are rendered on several threads at once, so each samples the images
+// through its own copies of their WCS.
+bool Hips::RenderTileFromImages(int64 npix, const vector<int> &indexes,
+                                ImageCache *cache, Image *tile,
+                                string *error) const {
+  int size = tile_width_;
+  int64 nside = static_cast<int64>(1) << max_order_;
+  int face = static_cast<int>(npix >> (2 * max_order_));
+  int64 tile_x, tile_y;
+  Deinterleave(npix & (nside * nside - 1), &tile_x, &tile_y);
+  double scale = 1.0 / (static_cast<double>(nside) * size);
+
+  int num_pixels = size * size;
+  vector<double> ras(num_pixels);
+  vector<double> decs(num_pixels);
+  vector<double> vectors(3 * num_pixels);
+  for (int j = 0; j < size; ++j) {
+    for (int i = 0; i < size; ++i) {
+      int k = j * size + i;
+      FaceToRaDec(face, (tile_x * size + j + 0.5) * scale,
+                  (tile_y * size + i + 0.5) * scale, &ras[k], &decs[k]);
+      ToVector(ras[k], decs[k], &vectors[3 * k]);
+    }
+  }
+
+  vector<float> sums(4 * num_pixels, 0.0f);
+  WcsProjectionCopies copies;
+  for (int n = static_cast<int>(indexes.size()) - 1; n >= 0; --n) {
+    const Input &input = images_[indexes[n]];
+    const Image *image = cache->Acquire(indexes[n], error);
+    if (image == NULL) return false;
+    if (image->width() != input.width || image->height() != input.height) {
+      *error = StringPrintf("Image %d is %d x %d but should be %d x %d",
+                            indexes[n], image->width(), image->height(),
+                            input.width, input.height);
+      cache->Release(indexes[n]);
+      return false;
+    }
+    const WcsProjection &wcs = copies.Add(*input.wcs);
+
+    double cos_radius = cos(min(input.radius, 180.0) * (PI / 180.0));
+    for (int k = 0; k < num_pixels; ++k) {
+      float *sum = &sums[4 * k];
+      if (sum[3] >= OPAQUE_WEIGHT) continue;
+      const double *v = &vectors[3 * k];
+      if (v[0] * input.center[0] + v[1] * input.center[1] +
+          v[2] * input.center[2] < cos_radius) {
+        continue;
+      }
+      int m, p;
+      if (!Mosaic::FindImagePixel(wcs, input.width, input.height,
+                                  image_origin_, ras[k], decs[k], &m, &p)) {
+        continue;
+      }
+      const uint8 *value = image->GetRow(p) + 4 * m;
+      if (value[3] == 0) continue;
+      float weight = (value[3] / 255.0f) * (1.0f - sum[3]);
+      sum[0] += weight * value[0];
+      sum[1] += weight * value[1];
+      sum[2] += weight * value[2];
+      sum[3] += weight;
+    }
+    cache->Release(indexes[n]);
+  }
+
+  tile->Resize(size, size, Image::RGBA);
+  for (int j = 0; j < size; ++j) {
+    uint8 *out = tile->GetMutableRow(j);
+    const float *sum = &sums[4 * j * size];
+    for (int i = 0; i < size; ++i, out += 4, sum += 4) {
+      if (sum[3] <= 0.0f) {
+        out[0] = out[1] = out[2] = out[3] = 0;
+        continue;
+      }
+      for (int c = 0; c < 3; ++c) {
+        out[c] = static_cast<uint8>(min(255, Round(sum[c] / sum[3])));
+      }
+      out[3] = static_cast<uint8>(min(255, Round(255.0f * sum[3])));
+    }
+  }
+  return true;
+}
+
+int Hips::GetTileSize(void) const {
+  return tile_width_;
+}
+
+string Hips::GetTileFilename(int order, const int64 &npix) const {
+  return output_directory_ + "/" + MakeTilePath(order, npix);
+}
+
+// Several threads may create the same directory at once, which is
+// harmless.
+bool Hips::WriteTile(int order, const int64 &npix, const TileSet &children,
+                     Image *tile, string *error) const {
+  string order_directory = StringPrintf("%s/Norder%d",
+                                        output_directory_.c_str(), order);
+  string directory = StringPrintf("%s/Dir%lld", order_directory.c_str(),
+                                  (npix / 10000) * 10000);
+  if (!MakeDirectory(order_directory) || !MakeDirectory(directory)) {
+    *error = "Cannot create output directory " + directory;
+    return false;
+  }
+  return WriteTileImage(GetTileFilename(order, npix), tile, error);
+}
+
+// Tile npix goes in column npix % columns and row npix / columns, where
+// there are as many columns as the square root of the number of tiles,
+// rounded down.
+bool Hips::WriteAllsky(int order, const TileSet &tiles, string *error) const {
+  int thumb = min(ALLSKY_TILE_WIDTH, tile_width_);
+  int64 num_tiles = NumTiles(order);
+  int columns = static_cast<int>(sqrt(static_cast<double>(num_tiles)));
+  int rows = static_cast<int>((num_tiles + columns - 1) / columns);
+  Image allsky;
+  allsky.Resize(columns * thumb, rows * thumb, Image::RGBA);
+  allsky.SetAllValues(0);
+
+  for (TileSet::const_iterator it = tiles.begin(); it != tiles.end(); ++it) {
+    string filename = GetTileFilename(order, *it);
+    Image tile;
+    if (!tile.Read(filename) || !tile.ConvertToRGBA()) {
+      *error = "Can't read tile " + filename;
+      return false;
+    }
+    while (tile.width() > thumb) {
+      Image half;
+      half.Resize(tile.width() / 2, tile.height() / 2, Image::RGBA);
+      half.SetAllValues(0);
+      Mosaic::DownsampleInto(tile, 0, 0, &half);
+      tile.Resize(half.width(), half.height(), Image::RGBA);
+      for (int j = 0; j < half.height(); ++j) {
+        memcpy(tile.GetMutableRow(j), half.GetRow(j), 4 * half.width());
+      }
+    }
+
+    int x = static_cast<int>(*it % columns) * thumb;
+    int y = static_cast<int>(*it / columns) * thumb;
+    for (int j = 0; j < thumb; ++j) {
+      memcpy(allsky.GetMutableRow(y + j) + 4 * x, tile.GetRow(j), 4 * thumb);
+    }
+  }
+
+  string filename = StringPrintf("%s/Norder%d/Allsky.png",
+                                 output_directory_.c_str(), order);
+  if (!allsky.Write(filename)) {
+    *error = "Can't write " + filename;
+    return false;
+  }
+  return true;
+}
+
+// Keys are padded to line up as in the examples of the standard.  The
+// initial view is centered on the first image.
+bool Hips::WriteProperties(string *error) const {
+  double x = images_[0].center[0];
+  double y = images_[0].center[1];
+  double z = images_[0].center[2];
+  double ra = atan2(y, x) * (180.0 / PI);
+  if (ra < 0.0) ra += 360.0;
+  double dec = atan2(z, sqrt(x * x + y * y)) * (180.0 / PI);
+  double fov = min(180.0, max(2.0 * images_[0].radius, 1.0 / 60.0));
+  double pixel_scale = sqrt(PI / 3.0) * (180.0 / PI) /
+                       (static_cast<double>(tile_width_) *
+                        (static_cast<int64>(1) << max_order_));
+
+  time_t now = time(NULL);
+  struct tm utc;
+  gmtime_r(&now, &utc);
+  char date[32];
+  strftime(date, sizeof(date), "%Y-%m-%dT%H:%MZ", &utc);
+
+  vector<pair<string, string> > keys;
+  keys.push_back(make_pair("creator_did", creator_did_));
+  keys.push_back(make_pair("obs_title", title_));
+  keys.push_back(make_pair("dataproduct_type", "image"));
+  keys.push_back(make_pair("hips_version", "1.4"));
+  keys.push_back(make_pair("hips_builder", "wcs2kml"));
+  keys.push_back(make_pair("hips_release_date", date));
+  keys.push_back(make_pair("hips_status", "public master clonableOnce"));
+  keys.push_back(make_pair("hips_frame", "equatorial"));
+  keys.push_back(make_pair("hips_order", StringPrintf("%d", max_order_)));
+  keys.push_back(make_pair("hips_order_min", "0"));
+  keys.push_back(make_pair("hips_tile_width",
+                           StringPrintf("%d", tile_width_)));
+  keys.push_back(make_pair("hips_tile_format", "png"));
+  keys.push_back(make_pair("hips_pixel_scale",
+                           StringPrintf("%.6g", pixel_scale)));
+  keys.push_back(make_pair("hips_initial_ra", StringPrintf("%.6f", ra)));
+  keys.push_back(make_pair("hips_initial_dec", StringPrintf("%.6f", dec)));
+  keys.push_back(make_pair("hips_initial_fov", StringPrintf("%.6g", fov)));
+
+  string filename = output_directory_ + "/properties";
+  FILE *fp = fopen(filename.c_str(), "w");
+  if (!fp) {
+    *error = "Can't open file " + filename + " for writing";
+    return false;
+  }
+  for (size_t i = 0; i < keys.size(); ++i) {
+    fprintf(fp, "%-20s = %s\n", keys[i].first.c_str(),
+            keys[i].second.c_str());
+  }
+  fclose(fp);
+  return true;
+}
+
+}  // namespace google_sky
@@ -0,0 +1,301 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// Defines the Hips class for writing images as IVOA HiPS tiles
+
+#ifndef HIPS_H__
+#define HIPS_H__
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "base.h"
+#include "image.h"
+#include "skyprojection.h"
+#include "tilepyramid.h"
+
+namespace google_sky {
+
+// Forward declarations.
+class ImageCache;
+class MosaicImageReader;
+class ThreadPool;
+class WcsProjection;
+
+// Class for warping images onto Hierarchical Progressive Survey tiles
+//
+// Lat-lon tiles waste pixels near the poles, where a whole row of tiles
+// covers a sliver of sky.  HiPS (IVOA Recommendation, version 1.0) tiles
+// the sky with HEALPix instead, whose pixels all cover the same area.  At
+// order k the sky is split into 12 * 4^k tiles, numbered in the HEALPix
+// NESTED scheme, and each tile is an image of tile_width() x tile_width()
+// HEALPix pixels of order k + log2(tile_width()).
+//
+// Tiles of the finest order (max_order()) are warped from the images whose
+// bounding circles overlap them, sampling each pixel center through the
+// images' WcsProjections, with images added later drawn on top as for a
+// Mosaic.  Each coarser order is then made by downsampling the order below
+// it.  Tiles are made in parallel and tiles that no image covers aren't
+// written.  The output directory gets the standard layout:
+//
+// properties                  Description of the survey.
+// Norder<k>/Dir<d>/Npix<n>.png  Tile n of order k, with d = n rounded down
+//                               to a multiple of 10000.
+// Norder<k>/Allsky.png        Every tile of order min(3, max_order()) at
+//                             64 x 64 pixels, for previews.
+//
+// Example Usage:
+//
+// // reader reads the pixels of each image when they are needed.
+// Hips hips(&reader);
+// for (int i = 0; i < num_images; ++i) {
+//   hips.AddImage(WcsProjection::FromHeader(headers[i]), widths[i],
+//                 heights[i]);
+// }
+// hips.set_max_order(hips.FindNativeOrder());
+// hips.set_output_directory("survey");
+//
+// string error;
+// if (!hips.Build(&error)) {
+//   fprintf(stderr, "%s\n", error.c_str());
+// }
+
+class Hips : public TilePyramidWriter<int64> {
+ public:
+  // The finest tile order allowed, which keeps HEALPix pixels of 512 pixel
+  // tiles within order 29.
+  static const int MAX_ORDER = 20;
+
+  // Creates an empty survey whose images are read with reader, which must
+  // outlive the survey.
+  explicit Hips(MosaicImageReader *reader);
+
+  // Deletes the WCS of each image.
+  ~Hips();
+
+  // Adds an image of the given size placed on the sky by wcs.  The survey
+  // takes ownership of wcs.  Images added later are drawn on top of those
+  // added earlier.
+  void AddImage(WcsProjection *wcs, int width, int height);
+
+  // Returns the number of images added.
+  inline int num_images(void) const {
+    return static_cast<int>(images_.size());
+  }
+
+  // Returns the coarsest order whose pixels are no larger than the pixels
+  // of the median image.
+  int FindNativeOrder(void) const;
+
+  // Warps the images onto the tiles of max_order(), builds the coarser
+  // orders, and writes the tiles, the Allsky file, and the properties
+  // file.  Returns false with a description of the problem in error if an
+  // image can't be read or a file can't be written.
+  bool Build(string *error) const;
+
+  // Renders tile npix of max_order() from the images overlapping it.  The
+  // tile is transparent wherever no image covers it.  Returns false with a
+  // description of the problem in error if an image can't be read.
+  bool RenderTile(int64 npix, Image *tile, string *error) const;
+
+  // Returns the number of tiles (or HEALPix pixels) of order.
+  static inline int64 NumTiles(int order) {
+    return static_cast<int64>(12) << (2 * order);
+  }
+
+  // Returns the position of point (x, y) of HEALPix pixel npix of order,
+  // where x and y run from 0 to 1 across the pixel from its south corner
+  // towards its east and west corners.  (0.5, 0.5) is its center.
+  static void PixelToRaDec(int order, int64 npix, double x, double y,
+                           double *ra, double *dec);
+
+  // Returns the HEALPix pixel of order containing ra, dec.
+  static int64 RaDecToPixel(int order, double ra, double dec);
+
+  // Returns the name of the file of tile npix of order relative to the
+  // output directory, e.g. "Norder3/Dir0/Npix312.png".
+  static string MakeTilePath(int order, int64 npix);
+
+  // Returns the side length of the tiles in pixels.
+  inline int tile_width(void) const {
+    return tile_width_;
+  }
+
+  // Sets the side length of the tiles in pixels, 512 by default.  It must
+  // be a power of 2 of at most 512.
+  inline void set_tile_width(int tile_width) {
+    CHECK(tile_width > 1 && tile_width <= 512 &&
+          (tile_width & (tile_width - 1)) == 0)
+        << "Bad tile width " << tile_width;
+    tile_width_ = tile_width;
+  }
+
+  // Returns the finest tile order.
+  inline int max_order(void) const {
+    return max_order_;
+  }
+
+  // Sets the finest tile order, 3 by default.
+  inline void set_max_order(int max_order) {
+    CHECK(max_order >= 0 && max_order <= MAX_ORDER)
+        << "Bad HiPS order " << max_order;
+    max_order_ = max_order;
+  }
+
+  // Returns the origin of the pixels of the images.
+  inline SkyProjection::ImageOrigin image_origin(void) const {
+    return image_origin_;
+  }
+
+  // Sets the origin of the pixels of the images, LOWER_LEFT by default as
+  // for FITS images.  See SkyProjection::ImageOrigin.
+  inline void set_image_origin(SkyProjection::ImageOrigin image_origin) {
+    image_origin_ = image_origin;
+  }
+
+  // Returns the number of threads used by Build().
+  inline int num_threads(void) const {
+    return num_threads_;
+  }
+
+  // Sets the number of threads used by Build(), which defaults to
+  // ThreadPool::DefaultNumThreads().
+  inline void set_num_threads(int num_threads) {
+    num_threads_ = num_threads;
+  }
+
+  // Returns the most memory in bytes used for the images being warped.
+  inline int64 cache_bytes(void) const {
+    return cache_bytes_;
+  }
+
+  // Sets the most memory in bytes used for the images being warped, which
+  // defaults to MemoryBudget::DefaultLimit().
+  inline void set_cache_bytes(int64 cache_bytes) {
+    cache_bytes_ = cache_bytes;
+  }
+
+  // Returns the directory the survey is written to.
+  inline const string &output_directory(void) const {
+    return output_directory_;
+  }
+
+  // Sets the directory the survey is written to, "hips" by default.
+  inline void set_output_directory(const string &output_directory) {
+    output_directory_ = output_directory;
+  }
+
+  // Returns the title of the survey.
+  inline const string &title(void) const {
+    return title_;
+  }
+
+  // Sets the title of the survey (obs_title) shown by viewers.
+  inline void set_title(const string &title) {
+    title_ = title;
+  }
+
+  // Returns the IVOA identifier of the survey.
+  inline const string &creator_did(void) const {
+    return creator_did_;
+  }
+
+  // Sets the IVOA identifier of the survey (creator_did), which should be
+  // unique, e.g. "ivo://example.org/P/survey/g".
+  inline void set_creator_did(const string &creator_did) {
+    creator_did_ = creator_did;
+  }
+
+ private:
+  class LeafTask;
+
+  // Tiles of one order.
+  typedef set<int64> TileSet;
+
+  // Collects the tiles written by an order of Build() and the first error.
+  typedef TileBuildStatus<int64> BuildStatus;
+
+  // Images overlapping each tile of max_order_, in the order they were
+  // added.
+  typedef map<int64, vector<int> > TileImages;
+
+  // An image of the survey and the circle around it.
+  struct Input {
+    WcsProjection *wcs;
+    int width;
+    int height;
+    double center[3];     // Unit vector of the center.
+    double radius;        // Degrees from the center to the farthest edge.
+    double pixel_scale;   // Degrees per pixel near the center.
+  };
+
+  MosaicImageReader *reader_;
+  vector<Input> images_;
+
+  int tile_width_;
+  int max_order_;
+  SkyProjection::ImageOrigin image_origin_;
+  int num_threads_;
+  int64 cache_bytes_;
+  string output_directory_;
+  string title_;
+  string creator_did_;
+
+  // Finds the tiles of max_order_ that each image's circle overlaps.
+  void FindTileImages(TileImages *tile_images) const;
+
+  // Renders tile npix of max_order_ from the given images, reading them
+  // through cache.
+  bool RenderTileFromImages(int64 npix, const vector<int> &indexes,
+                            ImageCache *cache, Image *tile,
+                            string *error) const;
+
+  virtual int GetTileSize(void) const;
+
+  virtual string GetTileFilename(int order, const int64 &npix) const;
+
+  // Writes tile npix of order, creating its directory if needed.  The
+  // children aren't needed.
+  virtual bool WriteTile(int order, const int64 &npix,
+                         const TileSet &children, Image *tile,
+                         string *error) const;
+
+  // Writes the Allsky file of order from the tiles in tiles.
+  bool WriteAllsky(int order, const TileSet &tiles, string *error) const;
+
+  // Writes the properties file.
+  bool WriteProperties(string *error) const;
+
+  DISALLOW_COPY_AND_ASSIGN(Hips);
+};
+
+}  // namespace google_sky
+
+#endif  // HIPS_H__
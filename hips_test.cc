@@ -0,0 +1,273 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "base.h"
+#include "file_util.h"
+#include "hips.h"
+#include "image.h"
+#include "mosaic.h"
+#include "string_util.h"
+#include "test_util.h"
+#include "wcsprojection.h"
+
+namespace google_sky {
+
+// Finds the pixel (i, j) of the tile of order containing ra, dec for tiles
+// of the given width, which must be a power of 2.
+int64 FindTilePixel(int order, int tile_width, double ra, double dec,
+                    int *i, int *j) {
+  int bits = 0;
+  while ((1 << bits) < tile_width) ++bits;
+  int64 pixel = Hips::RaDecToPixel(order + bits, ra, dec);
+  int64 index = pixel & ((static_cast<int64>(1) << (2 * bits)) - 1);
+  *i = 0;
+  *j = 0;
+  for (int bit = 0; bit < bits; ++bit) {
+    *j |= static_cast<int>((index >> (2 * bit)) & 1) << bit;
+    *i |= static_cast<int>((index >> (2 * bit + 1)) & 1) << bit;
+  }
+  return pixel >> (2 * bits);
+}
+
+int Main(int argc, char **argv) {
+  // Test the HEALPix geometry.
+  {
+    cout << "Testing PixelToRaDec() and RaDecToPixel()... ";
+    ASSERT_TRUE(Hips::NumTiles(0) == 12);
+    ASSERT_TRUE(Hips::NumTiles(3) == 768);
+
+    // Base pixel 0 is centered at ra = 45, dec = asin(2 / 3), with its
+    // south corner on the equator and its north corner at the pole.
+    double ra, dec;
+    Hips::PixelToRaDec(0, 0, 0.5, 0.5, &ra, &dec);
+    ASSERT_FLOAT_EQ(45.0, ra, 1.0e-9);
+    ASSERT_FLOAT_EQ(asin(2.0 / 3.0) * 180.0 / PI, dec, 1.0e-9);
+    Hips::PixelToRaDec(0, 0, 0.0, 0.0, &ra, &dec);
+    ASSERT_FLOAT_EQ(45.0, ra, 1.0e-9);
+    ASSERT_TRUE(fabs(dec) < 1.0e-9);
+    Hips::PixelToRaDec(0, 0, 1.0, 0.0, &ra, &dec);
+    ASSERT_FLOAT_EQ(90.0, ra, 1.0e-9);
+    Hips::PixelToRaDec(0, 0, 1.0, 1.0, &ra, &dec);
+    ASSERT_FLOAT_EQ(90.0, dec, 1.0e-9);
+    Hips::PixelToRaDec(0, 4, 0.5, 0.5, &ra, &dec);
+    ASSERT_TRUE(fabs(ra) < 1.0e-9 && fabs(dec) < 1.0e-9);
+    ASSERT_TRUE(Hips::RaDecToPixel(0, 45.0, 40.0) == 0);
+    ASSERT_TRUE(Hips::RaDecToPixel(0, 225.0, -40.0) == 10);
+
+    // Pixel centers map back to their pixels at every order, in the
+    // equatorial belt and in the polar caps.
+    int orders[] = { 0, 3, 10, 17 };
+    for (int o = 0; o < 4; ++o) {
+      int64 num_tiles = Hips::NumTiles(orders[o]);
+      for (int k = 0; k < 1000; ++k) {
+        int64 npix = (num_tiles / 1000) * k + k % 12;
+        Hips::PixelToRaDec(orders[o], npix, 0.5, 0.5, &ra, &dec);
+        ASSERT_TRUE(Hips::RaDecToPixel(orders[o], ra, dec) == npix);
+      }
+    }
+
+    ASSERT_TRUE(Hips::MakeTilePath(3, 312) == "Norder3/Dir0/Npix312.png");
+    ASSERT_TRUE(Hips::MakeTilePath(9, 123456) ==
+                "Norder9/Dir120000/Npix123456.png");
+    cout << "pass\n";
+  }
+
+  // Test FindNativeOrder().
+  {
+    cout << "Testing FindNativeOrder()... ";
+    SolidImageReader reader;
+    Hips hips(&reader);
+
+    // Order 9 has 512 pixel tiles with pixels of 0.8", order 8 of 1.6".
+    double arcsec = 1.0 / 3600.0;
+    hips.AddImage(WcsProjection::FromHeader(
+        MakeHeader(10.0, 20.0, 100, 100, arcsec)), 100, 100);
+    ASSERT_EQ(9, hips.FindNativeOrder());
+    hips.set_tile_width(256);
+    ASSERT_EQ(10, hips.FindNativeOrder());
+    cout << "pass\n";
+  }
+
+  // Test RenderTile().
+  {
+    cout << "Testing RenderTile()... ";
+    SolidImageReader reader;
+    Hips hips(&reader);
+    hips.set_tile_width(16);
+    hips.set_max_order(5);
+
+    // Opaque red under half transparent blue, offset by half a degree.
+    reader.Add(100, 100, 255, 0, 0, 255);
+    hips.AddImage(WcsProjection::FromHeader(
+        MakeHeader(10.0, 20.0, 100, 100, 0.01)), 100, 100);
+    reader.Add(100, 100, 0, 0, 255, 128);
+    hips.AddImage(WcsProjection::FromHeader(
+        MakeHeader(10.5, 20.0, 100, 100, 0.01)), 100, 100);
+
+    int i, j;
+    int64 npix = FindTilePixel(5, 16, 9.7, 20.0, &i, &j);
+    Image tile;
+    string error;
+    ASSERT_TRUE(hips.RenderTile(npix, &tile, &error));
+    ASSERT_EQ(16, tile.width());
+    ASSERT_TRUE(tile.colorspace() == Image::RGBA);
+    const uint8 *pixel = tile.GetRow(j) + 4 * i;
+    ASSERT_EQ(255, pixel[0]);
+    ASSERT_EQ(255, pixel[3]);
+
+    ASSERT_TRUE(FindTilePixel(5, 16, 10.2, 20.0, &i, &j) == npix);
+    pixel = tile.GetRow(j) + 4 * i;
+    ASSERT_TRUE(abs(pixel[0] - 127) <= 1);
+    ASSERT_TRUE(abs(pixel[2] - 128) <= 1);
+    ASSERT_EQ(255, pixel[3]);
+
+    ASSERT_TRUE(FindTilePixel(5, 16, 9.2, 19.8, &i, &j) == npix);
+    pixel = tile.GetRow(j) + 4 * i;
+    ASSERT_EQ(0, pixel[3]);
+    cout << "pass\n";
+  }
+
+  // Test Build().
+  {
+    cout << "Testing Build()... ";
+    ASSERT_TRUE(system("rm -rf hips_test_survey") == 0);
+    SolidImageReader reader;
+    Hips hips(&reader);
+    hips.set_tile_width(16);
+    hips.set_max_order(4);
+    hips.set_num_threads(4);
+    hips.set_cache_bytes(0);
+    hips.set_output_directory("hips_test_survey");
+    hips.set_title("Test survey");
+
+    // A green image near the north pole.
+    reader.Add(200, 200, 0, 255, 0, 255);
+    hips.AddImage(WcsProjection::FromHeader(
+        MakeHeader(30.0, 88.0, 200, 200, 0.02)), 200, 200);
+    string error;
+    ASSERT_TRUE(hips.Build(&error));
+
+    int i, j;
+    int64 npix = FindTilePixel(4, 16, 30.0, 88.0, &i, &j);
+    string leaf = "hips_test_survey/" + Hips::MakeTilePath(4, npix);
+    ASSERT_TRUE(FileExists(leaf));
+    ASSERT_TRUE(FileExists("hips_test_survey/" +
+                           Hips::MakeTilePath(0, npix >> 8)));
+    ASSERT_FALSE(FileExists("hips_test_survey/" +
+                            Hips::MakeTilePath(0, 4)));
+
+    // Each order is downsampled from the one below it.
+    Image tile;
+    npix = FindTilePixel(2, 16, 30.0, 88.0, &i, &j);
+    ASSERT_TRUE(tile.Read("hips_test_survey/" + Hips::MakeTilePath(2, npix)));
+    ASSERT_TRUE(tile.ConvertToRGBA());
+    const uint8 *pixel = tile.GetRow(j) + 4 * i;
+    ASSERT_EQ(255, pixel[1]);
+    ASSERT_EQ(255, pixel[3]);
+
+    // The Allsky file has 27 columns of 16 pixel tiles of order 3.
+    ASSERT_TRUE(tile.Read("hips_test_survey/Norder3/Allsky.png"));
+    ASSERT_EQ(27 * 16, tile.width());
+    ASSERT_EQ(29 * 16, tile.height());
+    npix = FindTilePixel(3, 16, 30.0, 88.0, &i, &j);
+    pixel = tile.GetRow(static_cast<int>(npix / 27) * 16 + j) +
+            4 * (static_cast<int>(npix % 27) * 16 + i);
+    ASSERT_EQ(255, pixel[1]);
+
+    string properties = ReadFile("hips_test_survey/properties");
+    ASSERT_TRUE(StringContains(properties, "obs_title            = "
+                                           "Test survey\n"));
+    ASSERT_TRUE(StringContains(properties, "hips_order           = 4\n"));
+    ASSERT_TRUE(StringContains(properties,
+                               "hips_tile_width      = 16\n"));
+    ASSERT_TRUE(StringContains(properties, "hips_frame           = "
+                                           "equatorial\n"));
+
+    // Failing to read an image fails the build.
+    reader.Add(100, 100, 0, 0, 0, -1);
+    hips.AddImage(WcsProjection::FromHeader(
+        MakeHeader(90.0, 0.0, 100, 100, 0.01)), 100, 100);
+    ASSERT_FALSE(hips.Build(&error));
+    ASSERT_TRUE(error == "Can't read image 1");
+
+    ASSERT_TRUE(system("rm -rf hips_test_survey") == 0);
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing Build() with several threads... ";
+    ASSERT_TRUE(system("rm -rf hips_test_serial hips_test_parallel") == 0);
+
+    // Overlapping images make each leaf tile read several of them, and each
+    // image spans several tiles that render at the same time.
+    GradientImageReader reader;
+    vector<string> headers;
+    for (int k = 0; k < 4; ++k) {
+      reader.Add(200, 200);
+      headers.push_back(MakeHeader(30.0 + 0.5 * k, 10.0 + 0.3 * k, 200, 200,
+                                   0.01));
+    }
+    const char *directories[2] = { "hips_test_serial", "hips_test_parallel" };
+    for (int pass = 0; pass < 2; ++pass) {
+      Hips hips(&reader);
+      hips.set_tile_width(64);
+      hips.set_max_order(6);
+      hips.set_num_threads(pass == 0 ? 1 : 8);
+      hips.set_cache_bytes(0);
+      hips.set_output_directory(directories[pass]);
+      for (size_t k = 0; k < headers.size(); ++k) {
+        hips.AddImage(WcsProjection::FromHeader(headers[k]), 200, 200);
+      }
+      string error;
+      ASSERT_TRUE(hips.Build(&error));
+    }
+
+    // Every tile matches the one rendered on a single thread.
+    ASSERT_TRUE(system("diff -r -x properties hips_test_serial "
+                       "hips_test_parallel > /dev/null") == 0);
+    ASSERT_TRUE(system("rm -rf hips_test_serial hips_test_parallel") == 0);
+    cout << "pass\n";
+  }
+
+  cout << "Passed\n";
+  return 0;
+}
+
+}  // namespace google_sky
+
+int main(int argc, char **argv) {
+  return google_sky::Main(argc, argv);
+}
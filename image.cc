@@ -30,8 +30,11 @@
 
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 
 #include <stdexcept>
+#include <string>
+#include <vector>
 
 namespace google_sky {
 
@@ -398,6 +401,23 @@ bool Image::Equals(const Image &image) const {
   return true;
 }
 
+bool Image::AlphaIsEverywhere(uint8 alpha) const {
+  if (colorspace_ != GRAYSCALE_PLUS_ALPHA && colorspace_ != RGBA) {
+    return alpha == 255;
+  }
+
+  size_t num_pixels = static_cast<size_t>(width_) *
+                      static_cast<size_t>(height_);
+  const uint8 *value = pixels_ + channels_ - 1;
+  for (size_t i = 0; i < num_pixels; ++i, value += channels_) {
+    if (*value != alpha) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
 // Reads an image from file.
 bool Image::Read(const string &filename) {
   FILE *file_ptr = NULL;
@@ -507,28 +527,172 @@ bool Image::Read(const string &filename) {
     return false;
 }
 
-// Writes an image to file.
-bool Image::Write(const string &filename) const {
+// Reads the PNG a row at a time, converted to 8 bit gray or RGB values.
+bool ReadGrayscaleRows(const string &filename, GrayscaleRowSink *sink) {
   FILE *file_ptr = NULL;
   png_structp png_ptr = NULL;
   png_infop info_ptr = NULL;
+  png_infop end_info = NULL;
+  bool is_interlaced = false;
 
   // Inner scoping is used to prevent compiler errors for gotos, which are
   // used as a simple forward jump for memory cleanup.
   {
-    file_ptr = fopen(filename.c_str(), "wb");
+    file_ptr = fopen(filename.c_str(), "rb");
     if (!file_ptr) goto failure;
 
-    png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    png_byte header[8];
+    int num_read = fread(header, sizeof(png_byte), 8, file_ptr);
+    if (num_read != 8) goto failure;
+    if (png_sig_cmp(header, 0, 8)) goto failure;
+
+    png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
     if (!png_ptr) goto failure;
 
     info_ptr = png_create_info_struct(png_ptr);
     if (!info_ptr) goto failure;
 
+    end_info = png_create_info_struct(png_ptr);
+    if (!end_info) goto failure;
+
     if (setjmp(png_jmpbuf(png_ptr))) goto failure;
 
-    // Use standard libpng IO routines.
+    rewind(file_ptr);
     png_init_io(png_ptr, file_ptr);
+    png_read_info(png_ptr, info_ptr);
+
+    int width = png_get_image_width(png_ptr, info_ptr);
+    int height = png_get_image_height(png_ptr, info_ptr);
+    int color_type = png_get_color_type(png_ptr, info_ptr);
+    int bit_depth = png_get_bit_depth(png_ptr, info_ptr);
+    bool is_binary = color_type == PNG_COLOR_TYPE_GRAY && bit_depth == 1;
+    if (!sink->Start(width, height, is_binary)) goto failure;
+
+    if (png_get_interlace_type(png_ptr, info_ptr) != PNG_INTERLACE_NONE) {
+      is_interlaced = true;
+      goto failure;
+    }
+
+    if (color_type == PNG_COLOR_TYPE_PALETTE) {
+      png_set_palette_to_rgb(png_ptr);
+    } else if (bit_depth < 8) {
+      png_set_expand_gray_1_2_4_to_8(png_ptr);
+    }
+    if (bit_depth > 8) {
+      png_set_strip_16(png_ptr);
+    }
+    png_set_strip_alpha(png_ptr);
+    png_read_update_info(png_ptr, info_ptr);
+
+    int channels = png_get_channels(png_ptr, info_ptr);
+    if (channels != 1 && channels != 3) goto failure;
+
+    vector<uint8> row(static_cast<size_t>(width) * channels);
+    vector<uint8> gray(width);
+    for (int j = 0; j < height; ++j) {
+      png_read_row(png_ptr, &row[0], NULL);
+      RowToGrayscale(&row[0], width, channels, &gray[0]);
+      sink->SetRow(j, &gray[0]);
+    }
+    png_read_end(png_ptr, end_info);
+
+    fclose(file_ptr);
+    png_destroy_read_struct(&png_ptr, &info_ptr, &end_info);
+  }  // end inner scoping
+
+  return true;
+
+  // Handles memory cleanup for failed PNG reads.
+  failure:
+    png_infop *info_tmp = NULL;
+    png_infop *end_tmp = NULL;
+    if (info_ptr) info_tmp = &info_ptr;
+    if (end_info) end_tmp = &end_info;
+    if (png_ptr) png_destroy_read_struct(&png_ptr, info_tmp, end_tmp);
+    if (file_ptr) fclose(file_ptr);
+
+    if (is_interlaced) {
+      Image image;
+      if (!image.Read(filename)) return false;
+      vector<uint8> gray(image.width());
+      for (int j = 0; j < image.height(); ++j) {
+        RowToGrayscale(image.GetRow(j), image.width(), image.channels(),
+                       &gray[0]);
+        sink->SetRow(j, &gray[0]);
+      }
+      return true;
+    }
+    return false;
+}
+
+void RowToGrayscale(const uint8 *row, int width, int channels, uint8 *gray) {
+  if (channels == 1) {
+    memcpy(gray, row, width);
+  } else if (channels == 2) {
+    for (int i = 0; i < width; ++i) {
+      gray[i] = row[2 * i];
+    }
+  } else {
+    for (int i = 0; i < width; ++i) {
+      const uint8 *pixel = row + i * channels;
+      gray[i] = static_cast<uint8>((pixel[0] + pixel[1] + pixel[2]) / 3.0);
+    }
+  }
+}
+
+// Writes an image to file.
+bool Image::Write(const string &filename) const {
+  FILE *file_ptr = fopen(filename.c_str(), "wb");
+  if (!file_ptr) return false;
+  bool success = WritePng(NULL, NULL, file_ptr);
+  if (fclose(file_ptr) != 0) success = false;
+  return success;
+}
+
+namespace {
+
+// libpng output function that appends to the string given as the io pointer.
+void AppendPngData(png_structp png_ptr, png_bytep data, png_size_t length) {
+  string *png = static_cast<string *>(png_get_io_ptr(png_ptr));
+  png->append(reinterpret_cast<const char *>(data), length);
+}
+
+// libpng flush function for strings, which have nothing to flush.
+void FlushPngData(png_structp png_ptr) {
+  // Nothing needed.
+}
+
+}  // namespace
+
+// Encodes the image as PNG in memory.
+bool Image::WriteToString(string *png) const {
+  png->clear();
+  return WritePng(AppendPngData, FlushPngData, png);
+}
+
+// Writes the image as PNG.  With a NULL write_function, io is a FILE * and
+// the standard libpng IO routines are used.
+bool Image::WritePng(png_rw_ptr write_function, png_flush_ptr flush_function,
+                     void *io) const {
+  png_structp png_ptr = NULL;
+  png_infop info_ptr = NULL;
+
+  // Inner scoping is used to prevent compiler errors for gotos, which are
+  // used as a simple forward jump for memory cleanup.
+  {
+    png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    if (!png_ptr) goto failure;
+
+    info_ptr = png_create_info_struct(png_ptr);
+    if (!info_ptr) goto failure;
+
+    if (setjmp(png_jmpbuf(png_ptr))) goto failure;
+
+    if (write_function == NULL) {
+      png_init_io(png_ptr, static_cast<FILE *>(io));
+    } else {
+      png_set_write_fn(png_ptr, io, write_function, flush_function);
+    }
 
     int color_type;
     if (colorspace_ == GRAYSCALE) {
@@ -571,7 +735,6 @@ bool Image::Write(const string &filename) const {
     png_write_end(png_ptr, info_ptr);
 
     // Clean up successful write resources.
-    fclose(file_ptr);
     delete[] rows;
     png_destroy_write_struct(&png_ptr, &info_ptr);
   }  // end inner scoping
@@ -583,7 +746,6 @@ bool Image::Write(const string &filename) const {
     png_infop *info_tmp = NULL;
     if (info_ptr) info_tmp = &info_ptr;
     if (png_ptr) png_destroy_write_struct(&png_ptr, info_tmp);
-    if (file_ptr) fclose(file_ptr);
     return false;
 }
 
@@ -159,6 +159,20 @@ class Image {
     position[channel] = value;
   }
 
+  // Returns a pointer to the first channel of the first pixel in row j.  The
+  // row holds width() * channels() values.  This is for loops that touch
+  // every pixel, where GetPixel() and SetPixel() are too slow.
+  inline const uint8 *GetRow(int j) const {
+    CheckBounds(0, j);
+    return GetConstPixelPosition(0, j);
+  }
+
+  // Non-const version of the above.
+  inline uint8 *GetMutableRow(int j) {
+    CheckBounds(0, j);
+    return GetPixelPosition(0, j);
+  }
+
   // Converts an image to grayscale and returns whether the operation was
   // successful.
   bool ConvertToGrayscale();
@@ -179,6 +193,10 @@ class Image {
   // the same properties and every pixel value must be the same.
   bool Equals(const Image &image) const;
 
+  // Returns whether every pixel has the given alpha.  Pixels of images
+  // without an alpha channel are opaque, i.e. have an alpha of 255.
+  bool AlphaIsEverywhere(uint8 alpha) const;
+
   // Reads an image from the given filename.  All images are converted to
   // RGBA colorspace with 8 bits per channel.
   bool Read(const string &filename);
@@ -186,6 +204,9 @@ class Image {
   // Writes an image to the given filename.
   bool Write(const string &filename) const;
 
+  // Encodes an image as PNG into png, replacing its contents.
+  bool WriteToString(string *png) const;
+
   // Returns the image width.
   inline int width() const {
     return width_;
@@ -241,9 +262,41 @@ class Image {
     return position;
   }
 
+  // Writes the image as PNG with the given libpng output function.  io is
+  // passed to write_function through png_get_io_ptr().
+  bool WritePng(png_rw_ptr write_function, png_flush_ptr flush_function,
+                void *io) const;
+
   DISALLOW_COPY_AND_ASSIGN(Image);
 };
 
+// Interface for receiving the rows of a PNG file from ReadGrayscaleRows().
+class GrayscaleRowSink {
+ public:
+  virtual ~GrayscaleRowSink() {
+    // Nothing needed.
+  }
+
+  // Called once before any rows with the size of the image and whether it
+  // is stored as 1 bit grayscale, so that every value is 0 or 255.
+  // Returning false stops the read.
+  virtual bool Start(int width, int height, bool is_binary) = 0;
+
+  // Called for each row from the top down with width 8 bit gray values.
+  virtual void SetRow(int j, const uint8 *gray) = 0;
+};
+
+// Reads a PNG file a row at a time as 8 bit grayscale, so that the whole
+// image is never expanded to RGBA.  Color pixels are averaged like
+// Image::ConvertToGrayscale() and any alpha channel is ignored.  Interlaced
+// files can't be read a row at a time and are read with Image::Read()
+// instead.  Returns whether the read was successful.
+bool ReadGrayscaleRows(const string &filename, GrayscaleRowSink *sink);
+
+// Converts a row of width pixels with the given number of channels to 8 bit
+// grayscale like Image::ConvertToGrayscale(), ignoring any alpha channel.
+void RowToGrayscale(const uint8 *row, int width, int channels, uint8 *gray);
+
 }  // namespace google_sky
 
 #endif  // IMAGE_H__
@@ -26,7 +26,10 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
+#include <cstdio>
+
 #include <iostream>
+#include <string>
 
 #include "base.h"
 #include "color.h"
@@ -62,6 +65,39 @@ void MakeCheckerBoard(Image *image, int width, int height,
   }
 }
 
+// Collects the rows from ReadGrayscaleRows() into a grayscale image.
+class ImageRowSink : public GrayscaleRowSink {
+ public:
+  explicit ImageRowSink(Image *image) : image_(image), is_binary_(false) {
+    // Nothing needed.
+  }
+
+  virtual ~ImageRowSink() {
+    // Nothing needed.
+  }
+
+  virtual bool Start(int width, int height, bool is_binary) {
+    is_binary_ = is_binary;
+    return image_->Resize(width, height, Image::GRAYSCALE);
+  }
+
+  virtual void SetRow(int j, const uint8 *gray) {
+    for (int i = 0; i < image_->width(); ++i) {
+      image_->SetValue(i, j, 0, gray[i]);
+    }
+  }
+
+  bool is_binary() const {
+    return is_binary_;
+  }
+
+ private:
+  Image *image_;
+  bool is_binary_;
+
+  DISALLOW_COPY_AND_ASSIGN(ImageRowSink);
+};
+
 int Main(int argc, char **argv) {
   {
     cout << "Testing Resize() and accessors... ";
@@ -277,6 +313,34 @@ int Main(int argc, char **argv) {
 
     cout << "pass\n";
   }
+
+  {
+    cout << "Testing AlphaIsEverywhere()... ";
+
+    Image image;
+    ASSERT_TRUE(image.Resize(4, 3, Image::RGBA));
+    image.SetAllValues(0);
+    ASSERT_TRUE(image.AlphaIsEverywhere(0));
+    ASSERT_FALSE(image.AlphaIsEverywhere(255));
+    image.SetValue(3, 2, 3, 255);
+    ASSERT_FALSE(image.AlphaIsEverywhere(0));
+    ASSERT_TRUE(image.SetAllValuesInChannel(3, 255));
+    ASSERT_TRUE(image.AlphaIsEverywhere(255));
+
+    ASSERT_TRUE(image.Resize(4, 3, Image::GRAYSCALE_PLUS_ALPHA));
+    image.SetAllValues(7);
+    ASSERT_TRUE(image.AlphaIsEverywhere(7));
+    image.SetValue(0, 0, 0, 8);
+    ASSERT_TRUE(image.AlphaIsEverywhere(7));
+    image.SetValue(0, 0, 1, 8);
+    ASSERT_FALSE(image.AlphaIsEverywhere(7));
+
+    ASSERT_TRUE(image.Resize(4, 3, Image::RGB));
+    ASSERT_TRUE(image.AlphaIsEverywhere(255));
+    ASSERT_FALSE(image.AlphaIsEverywhere(0));
+
+    cout << "pass\n";
+  }
   
   {
     cout << "Testing Read() and Write()... ";
@@ -325,6 +389,72 @@ int Main(int argc, char **argv) {
     cout << "pass\n";
   }
 
+  {
+    cout << "Testing WriteToString()... ";
+
+    // The PNG encoded in memory is the same as the one written to file.
+    Image image;
+    MakeCheckerBoard(&image, 7, 4, Image::RGBA);
+    const char *tmp_png = "tmp.png";
+    ASSERT_TRUE(image.Write(tmp_png));
+    FILE *fp = fopen(tmp_png, "rb");
+    ASSERT_TRUE(fp != NULL);
+    string file_png;
+    char buffer[1024];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+      file_png.append(buffer, n);
+    }
+    fclose(fp);
+
+    string png = "old contents";
+    ASSERT_TRUE(image.WriteToString(&png));
+    ASSERT_TRUE(png == file_png);
+
+    // Clean up.
+    ASSERT_TRUE(remove(tmp_png) == 0);
+
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing ReadGrayscaleRows()... ";
+
+    // Reading a row at a time matches reading the whole image and
+    // converting it, for every colorspace.
+    const char *tmp_png = "tmp.png";
+    Image::Colorspace colorspaces[] = {Image::GRAYSCALE,
+                                       Image::GRAYSCALE_PLUS_ALPHA,
+                                       Image::RGB, Image::RGBA};
+    for (int k = 0; k < 4; ++k) {
+      Image image;
+      MakeCheckerBoard(&image, 9, 6, colorspaces[k]);
+      Color pixel(image.channels());
+      image.GetPixel(2, 3, &pixel);
+      pixel.SetChannel(0, 100);
+      image.SetPixel(2, 3, pixel);
+      ASSERT_TRUE(image.Write(tmp_png));
+
+      Image expected;
+      ASSERT_TRUE(expected.Read(tmp_png));
+      ASSERT_TRUE(expected.ConvertToGrayscale());
+      Image gray;
+      ImageRowSink sink(&gray);
+      ASSERT_TRUE(ReadGrayscaleRows(tmp_png, &sink));
+      ASSERT_TRUE(gray.Equals(expected));
+      ASSERT_FALSE(sink.is_binary());
+    }
+
+    Image gray;
+    ImageRowSink sink(&gray);
+    ASSERT_FALSE(ReadGrayscaleRows("testdata/does_not_exist.png", &sink));
+
+    // Clean up.
+    ASSERT_TRUE(remove(tmp_png) == 0);
+
+    cout << "pass\n";
+  }
+
   cout << "Passed\n";
   return 0;
 }
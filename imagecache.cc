@@ -0,0 +1,128 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "imagecache.h"
+
+#include "image.h"
+#include "mosaic.h"
+#include "string_util.h"
+
+namespace google_sky {
+
+ImageCache::ImageCache(MosaicImageReader *reader, int64 limit)
+    : reader_(reader), limit_(limit), size_(0), entries_(), unused_() {
+  CHECK_EQ(pthread_mutex_init(&mutex_, NULL), 0);
+  CHECK_EQ(pthread_cond_init(&loaded_, NULL), 0);
+}
+
+ImageCache::~ImageCache() {
+  for (map<int, Entry>::iterator it = entries_.begin(); it != entries_.end();
+       ++it) {
+    delete it->second.image;
+  }
+  pthread_cond_destroy(&loaded_);
+  pthread_mutex_destroy(&mutex_);
+}
+
+// An entry without an image marks an image being read by another thread.
+const Image *ImageCache::Acquire(int index, string *error) {
+  pthread_mutex_lock(&mutex_);
+  map<int, Entry>::iterator it = entries_.find(index);
+  while (it != entries_.end() && it->second.image == NULL) {
+    pthread_cond_wait(&loaded_, &mutex_);
+    it = entries_.find(index);
+  }
+  if (it != entries_.end()) {
+    if (it->second.users++ == 0) unused_.erase(it->second.position);
+    const Image *image = it->second.image;
+    pthread_mutex_unlock(&mutex_);
+    return image;
+  }
+
+  // Mark the image as being read.
+  entries_[index];
+  pthread_mutex_unlock(&mutex_);
+
+  Image *image = new Image();
+  bool success = reader_->ReadImage(index, image, error);
+  if (success && image->colorspace() != Image::RGBA) {
+    *error = StringPrintf("Image %d isn't RGBA", index);
+    success = false;
+  }
+
+  pthread_mutex_lock(&mutex_);
+  if (!success) {
+    delete image;
+    image = NULL;
+    entries_.erase(index);
+  } else {
+    Entry &entry = entries_[index];
+    entry.image = image;
+    entry.users = 1;
+    size_ += Size(*image);
+    Evict();
+  }
+  pthread_cond_broadcast(&loaded_);
+  pthread_mutex_unlock(&mutex_);
+  return image;
+}
+
+void ImageCache::Release(int index) {
+  pthread_mutex_lock(&mutex_);
+  Entry &entry = entries_[index];
+  CHECK_GT(entry.users, 0);
+  if (--entry.users == 0) {
+    entry.position = unused_.insert(unused_.end(), index);
+    Evict();
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+int64 ImageCache::size(void) {
+  pthread_mutex_lock(&mutex_);
+  int64 size = size_;
+  pthread_mutex_unlock(&mutex_);
+  return size;
+}
+
+int64 ImageCache::Size(const Image &image) {
+  return static_cast<int64>(image.width()) * image.height() *
+         image.channels();
+}
+
+void ImageCache::Evict(void) {
+  while (size_ > limit_ && !unused_.empty()) {
+    map<int, Entry>::iterator it = entries_.find(unused_.front());
+    unused_.pop_front();
+    size_ -= Size(*it->second.image);
+    delete it->second.image;
+    entries_.erase(it);
+  }
+}
+
+}  // namespace google_sky
@@ -0,0 +1,123 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// Defines the ImageCache class for sharing images read on demand
+
+#ifndef IMAGECACHE_H__
+#define IMAGECACHE_H__
+
+#include <pthread.h>
+
+#include <list>
+#include <map>
+#include <string>
+
+#include "base.h"
+
+namespace google_sky {
+
+// Forward declarations.
+class Image;
+class MosaicImageReader;
+
+// Class for keeping images read through a MosaicImageReader in memory
+//
+// Tiles of a mosaic are warped roughly in order, so neighbouring tiles,
+// which mostly overlap the same images, usually find them already read.
+// Images in use are pinned; the others are evicted least recently used
+// first once the cache holds more than its limit.  Images are read outside
+// of the lock so that several can be read at once, and a thread wanting an
+// image that another thread is reading waits for it.  All methods are
+// thread safe.
+//
+// Example Usage:
+//
+// ImageCache cache(&reader, 1 << 30);
+// string error;
+// const Image *image = cache.Acquire(3, &error);
+// if (image != NULL) {
+//   ...use image...
+//   cache.Release(3);
+// }
+
+class ImageCache {
+ public:
+  // Creates an empty cache of the images of reader, which must outlive the
+  // cache, holding up to limit bytes of images that aren't in use.
+  ImageCache(MosaicImageReader *reader, int64 limit);
+
+  ~ImageCache();
+
+  // Returns image index, reading it if needed, and pins it until Release()
+  // is called.  Returns NULL with a description of the problem in error if
+  // the image can't be read or isn't RGBA.
+  const Image *Acquire(int index, string *error);
+
+  // Unpins an image returned by Acquire().
+  void Release(int index);
+
+  // Returns the number of bytes of images held.
+  int64 size(void);
+
+ private:
+  // A cached image, which is NULL while it is being read.
+  struct Entry {
+    Entry() : image(NULL), users(0), position() {}
+
+    Image *image;
+    int users;
+    list<int>::iterator position;  // Position in unused_ if users is 0.
+  };
+
+  MosaicImageReader *reader_;
+  int64 limit_;
+  int64 size_;
+  map<int, Entry> entries_;
+
+  // Images that aren't pinned, from least to most recently used.
+  list<int> unused_;
+
+  // Guards size_, entries_, and unused_.
+  pthread_mutex_t mutex_;
+
+  // Signaled when an image has been read (or failed to be).
+  pthread_cond_t loaded_;
+
+  // Returns the number of bytes of pixels of image.
+  static int64 Size(const Image &image);
+
+  // Deletes unpinned images until the cache fits within its limit.  The
+  // caller must hold mutex_.
+  void Evict(void);
+
+  DISALLOW_COPY_AND_ASSIGN(ImageCache);
+};
+
+}  // namespace google_sky
+
+#endif  // IMAGECACHE_H__
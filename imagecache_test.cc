@@ -0,0 +1,132 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "base.h"
+#include "image.h"
+#include "imagecache.h"
+#include "mosaic.h"
+#include "string_util.h"
+
+namespace google_sky {
+
+// Reads 10 x 10 images whose pixels are all their index, counting reads.
+// Image 13 can't be read and image 14 is RGB.
+class CountingImageReader : public MosaicImageReader {
+ public:
+  CountingImageReader() : reads_(20, 0) {}
+
+  virtual bool ReadImage(int index, Image *image, string *error) {
+    ++reads_[index];
+    if (index == 13) {
+      *error = StringPrintf("Can't read image %d", index);
+      return false;
+    }
+    image->Resize(10, 10, index == 14 ? Image::RGB : Image::RGBA);
+    image->SetAllValues(index);
+    return true;
+  }
+
+  int reads(int index) const {
+    return reads_[index];
+  }
+
+ private:
+  vector<int> reads_;
+
+  DISALLOW_COPY_AND_ASSIGN(CountingImageReader);
+};
+
+int Main(int argc, char **argv) {
+  {
+    cout << "Testing Acquire() and Release()... ";
+    CountingImageReader reader;
+
+    // Room for 2 images of 400 bytes.
+    ImageCache cache(&reader, 800);
+    string error;
+    const Image *image = cache.Acquire(1, &error);
+    ASSERT_TRUE(image != NULL);
+    ASSERT_EQ(1, image->GetRow(0)[0]);
+    ASSERT_TRUE(cache.Acquire(1, &error) == image);
+    ASSERT_EQ(1, reader.reads(1));
+    cache.Release(1);
+    cache.Release(1);
+
+    // Image 1 is the least recently used once 2 and 3 are read.
+    ASSERT_TRUE(cache.Acquire(2, &error) != NULL);
+    cache.Release(2);
+    ASSERT_TRUE(cache.Acquire(3, &error) != NULL);
+    cache.Release(3);
+    ASSERT_TRUE(cache.size() == 800);
+    ASSERT_TRUE(cache.Acquire(2, &error) != NULL);
+    cache.Release(2);
+    ASSERT_EQ(1, reader.reads(2));
+    ASSERT_TRUE(cache.Acquire(1, &error) != NULL);
+    ASSERT_EQ(2, reader.reads(1));
+
+    // Pinned images are kept beyond the limit.
+    ASSERT_TRUE(cache.Acquire(4, &error) != NULL);
+    ASSERT_TRUE(cache.Acquire(5, &error) != NULL);
+    ASSERT_TRUE(cache.size() == 1200);
+    cache.Release(1);
+    cache.Release(4);
+    cache.Release(5);
+    ASSERT_TRUE(cache.size() == 800);
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing failures... ";
+    CountingImageReader reader;
+    ImageCache cache(&reader, 800);
+    string error;
+    ASSERT_TRUE(cache.Acquire(13, &error) == NULL);
+    ASSERT_TRUE(error == "Can't read image 13");
+    ASSERT_TRUE(cache.Acquire(14, &error) == NULL);
+    ASSERT_TRUE(error == "Image 14 isn't RGBA");
+
+    // Failures aren't cached.
+    ASSERT_TRUE(cache.Acquire(13, &error) == NULL);
+    ASSERT_EQ(2, reader.reads(13));
+    ASSERT_TRUE(cache.size() == 0);
+    cout << "pass\n";
+  }
+
+  cout << "Passed\n";
+  return 0;
+}
+
+}  // namespace google_sky
+
+int main(int argc, char **argv) {
+  return google_sky::Main(argc, argv);
+}
@@ -0,0 +1,265 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+#include "json.h"
+
+#include <cstdlib>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "string_util.h"
+
+namespace google_sky {
+
+namespace {
+
+// Reads JSON values from text, keeping track of the current position.
+class JsonReader {
+ public:
+  explicit JsonReader(const string &text) : text_(text), position_(0) {}
+
+  // Skips white space and returns whether the end of the text was reached.
+  bool AtEnd() {
+    while (position_ < text_.size() &&
+           (text_[position_] == ' ' || text_[position_] == '\t' ||
+            text_[position_] == '\n' || text_[position_] == '\r')) {
+      ++position_;
+    }
+    return position_ >= text_.size();
+  }
+
+  // Consumes the given character if it comes next.
+  bool Consume(char c) {
+    if (AtEnd() || text_[position_] != c) return false;
+    ++position_;
+    return true;
+  }
+
+  // Reads a string and returns its unescaped value.
+  bool ReadString(string *value) {
+    if (!Consume('"')) return false;
+    value->clear();
+    while (position_ < text_.size()) {
+      char c = text_[position_++];
+      if (c == '"') return true;
+      if (static_cast<unsigned char>(c) < 0x20) return false;
+      if (c != '\\') {
+        value->push_back(c);
+        continue;
+      }
+      if (position_ >= text_.size()) return false;
+      c = text_[position_++];
+      switch (c) {
+        case '"': value->push_back('"'); break;
+        case '\\': value->push_back('\\'); break;
+        case '/': value->push_back('/'); break;
+        case 'b': value->push_back('\b'); break;
+        case 'f': value->push_back('\f'); break;
+        case 'n': value->push_back('\n'); break;
+        case 'r': value->push_back('\r'); break;
+        case 't': value->push_back('\t'); break;
+        case 'u': {
+          if (position_ + 4 > text_.size()) return false;
+          char *end;
+          string hex = text_.substr(position_, 4);
+          long code = strtol(hex.c_str(), &end, 16);
+          if (*end != '\0') return false;
+          position_ += 4;
+          AppendUtf8(code, value);
+          break;
+        }
+        default:
+          return false;
+      }
+    }
+    return false;
+  }
+
+  // Reads any value other than an object or array and returns its JSON
+  // text.
+  bool ReadValue(string *json) {
+    if (AtEnd()) return false;
+    size_t start = position_;
+    if (text_[position_] == '"') {
+      string value;
+      if (!ReadString(&value)) return false;
+    } else if (text_.compare(position_, 4, "true") == 0 ||
+               text_.compare(position_, 4, "null") == 0) {
+      position_ += 4;
+    } else if (text_.compare(position_, 5, "false") == 0) {
+      position_ += 5;
+    } else {
+      const char *begin = text_.c_str() + position_;
+      char *end;
+      strtod(begin, &end);
+      if (end == begin || *begin == '+' || *begin == '.') return false;
+      position_ += end - begin;
+    }
+    json->assign(text_, start, position_ - start);
+    return true;
+  }
+
+ private:
+  const string &text_;
+  size_t position_;
+
+  // Appends a code point below 0x10000 as UTF-8.
+  static void AppendUtf8(long code, string *value) {
+    if (code < 0x80) {
+      value->push_back(static_cast<char>(code));
+    } else if (code < 0x800) {
+      value->push_back(static_cast<char>(0xc0 | (code >> 6)));
+      value->push_back(static_cast<char>(0x80 | (code & 0x3f)));
+    } else {
+      value->push_back(static_cast<char>(0xe0 | (code >> 12)));
+      value->push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3f)));
+      value->push_back(static_cast<char>(0x80 | (code & 0x3f)));
+    }
+  }
+};
+
+}  // namespace
+
+bool JsonObject::Parse(const string &text, string *error) {
+  values_.clear();
+  keys_.clear();
+
+  JsonReader reader(text);
+  if (!reader.Consume('{')) {
+    *error = "Expected '{'";
+    return false;
+  }
+  if (!reader.Consume('}')) {
+    do {
+      string key;
+      if (!reader.ReadString(&key)) {
+        *error = "Expected a member name";
+        return false;
+      }
+      if (!reader.Consume(':')) {
+        *error = "Expected ':' after \"" + key + "\"";
+        return false;
+      }
+      string json;
+      if (!reader.ReadValue(&json)) {
+        *error = "Bad value for \"" + key + "\"";
+        return false;
+      }
+      SetRaw(key, json);
+    } while (reader.Consume(','));
+    if (!reader.Consume('}')) {
+      *error = "Expected ',' or '}'";
+      return false;
+    }
+  }
+  if (!reader.AtEnd()) {
+    *error = "Unexpected text after the object";
+    return false;
+  }
+  return true;
+}
+
+bool JsonObject::Has(const string &key) const {
+  return values_.find(key) != values_.end();
+}
+
+bool JsonObject::GetString(const string &key, string *value) const {
+  map<string, string>::const_iterator it = values_.find(key);
+  if (it == values_.end() || it->second.empty() || it->second[0] != '"') {
+    return false;
+  }
+  JsonReader reader(it->second);
+  return reader.ReadString(value);
+}
+
+bool JsonObject::GetNumber(const string &key, double *value) const {
+  map<string, string>::const_iterator it = values_.find(key);
+  if (it == values_.end()) return false;
+  return StringToDouble(it->second, value);
+}
+
+string JsonObject::GetRaw(const string &key) const {
+  map<string, string>::const_iterator it = values_.find(key);
+  if (it == values_.end()) return "null";
+  return it->second;
+}
+
+void JsonObject::SetString(const string &key, const string &value) {
+  SetRaw(key, Quote(value));
+}
+
+// Uses enough digits that doubles survive a round trip.
+void JsonObject::SetNumber(const string &key, double value) {
+  SetRaw(key, StringPrintf("%.17g", value));
+}
+
+void JsonObject::SetBool(const string &key, bool value) {
+  SetRaw(key, value ? "true" : "false");
+}
+
+void JsonObject::SetRaw(const string &key, const string &json) {
+  if (!Has(key)) keys_.push_back(key);
+  values_[key] = json;
+}
+
+string JsonObject::ToString() const {
+  string json = "{";
+  for (size_t i = 0; i < keys_.size(); ++i) {
+    if (i > 0) json += ",";
+    json += Quote(keys_[i]);
+    json += ":";
+    json += values_.find(keys_[i])->second;
+  }
+  json += "}";
+  return json;
+}
+
+string JsonObject::Quote(const string &value) {
+  string quoted = "\"";
+  for (size_t i = 0; i < value.size(); ++i) {
+    unsigned char c = value[i];
+    switch (c) {
+      case '"': quoted += "\\\""; break;
+      case '\\': quoted += "\\\\"; break;
+      case '\n': quoted += "\\n"; break;
+      case '\r': quoted += "\\r"; break;
+      case '\t': quoted += "\\t"; break;
+      default:
+        if (c < 0x20) {
+          StringAppendF(&quoted, "\\u%04x", c);
+        } else {
+          quoted.push_back(c);
+        }
+    }
+  }
+  quoted += "\"";
+  return quoted;
+}
+
+}  // namespace google_sky
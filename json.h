@@ -0,0 +1,122 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+// Defines the JsonObject class for reading and writing flat JSON objects
+
+#ifndef JSON_H__
+#define JSON_H__
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "base.h"
+
+namespace google_sky {
+
+// Class for flat JSON objects
+//
+// This handles the small messages passed between wcs2kml and other
+// programs: a single object whose values are strings, numbers, booleans, or
+// null.  Nested objects and arrays aren't supported.  Values are kept as
+// text, and strings are stored unescaped.  Escapes of characters outside of
+// ASCII (\uXXXX) are written out as UTF-8.
+//
+// Example Usage:
+//
+// JsonObject request;
+// string error;
+// if (!request.Parse("{\"fitsfile\": \"foo.fits\", \"id\": 7}", &error)) {
+//   // Report error.
+// }
+// string fitsfile;
+// request.GetString("fitsfile", &fitsfile);
+//
+// JsonObject response;
+// response.SetRaw("id", request.GetRaw("id"));
+// response.SetString("status", "done");
+// string line = response.ToString();  // {"id":7,"status":"done"}
+
+class JsonObject {
+ public:
+  JsonObject() : values_(), keys_() {
+    // Nothing needed.
+  }
+
+  ~JsonObject() {
+    // Nothing needed.
+  }
+
+  // Parses text, which must hold exactly one flat object, replacing the
+  // current contents.  Returns false with a description of the problem in
+  // error if text isn't a valid flat object.
+  bool Parse(const string &text, string *error);
+
+  // Returns whether the object has the given key.
+  bool Has(const string &key) const;
+
+  // Gets the value of a string member.  Returns false if there is no such
+  // member or if it isn't a string.
+  bool GetString(const string &key, string *value) const;
+
+  // Gets the value of a numeric member.  Returns false if there is no such
+  // member or if it isn't a number.
+  bool GetNumber(const string &key, double *value) const;
+
+  // Returns the JSON text of a member's value (e.g. "\"foo\"" or "7"), or
+  // "null" if there is no such member.  This passes values such as request
+  // ids through unchanged.
+  string GetRaw(const string &key) const;
+
+  // Sets a member to a string, number, or boolean.  Members are written in
+  // the order they were first set.
+  void SetString(const string &key, const string &value);
+  void SetNumber(const string &key, double value);
+  void SetBool(const string &key, bool value);
+
+  // Sets a member to the given JSON text, which must be a valid value.
+  void SetRaw(const string &key, const string &json);
+
+  // Returns the object as a single line of JSON.
+  string ToString() const;
+
+  // Returns value as a quoted and escaped JSON string.
+  static string Quote(const string &value);
+
+ private:
+  // Values as JSON text, keyed by member name.
+  map<string, string> values_;
+
+  // Member names in the order they were added.
+  vector<string> keys_;
+
+  DISALLOW_COPY_AND_ASSIGN(JsonObject);
+};
+
+}  // namespace google_sky
+
+#endif  // JSON_H__
@@ -0,0 +1,136 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+#include <iostream>
+#include <string>
+
+#include "base.h"
+#include "json.h"
+
+namespace google_sky {
+
+int Main(int argc, char **argv) {
+  {
+    cout << "Testing Parse()... ";
+
+    JsonObject object;
+    string error;
+    ASSERT_TRUE(object.Parse(
+        " {\"fitsfile\" : \"a \\\"b\\\"\\\\c.fits\", \"id\": 7,\n"
+        "  \"scale\": -1.5e2, \"regionate\": true, \"note\": null} ",
+        &error));
+
+    string value;
+    ASSERT_TRUE(object.GetString("fitsfile", &value));
+    ASSERT_TRUE(value == "a \"b\"\\c.fits");
+    ASSERT_FALSE(object.GetString("id", &value));
+    ASSERT_FALSE(object.GetString("missing", &value));
+
+    double number;
+    ASSERT_TRUE(object.GetNumber("scale", &number));
+    ASSERT_TRUE(number == -150.0);
+    ASSERT_FALSE(object.GetNumber("fitsfile", &number));
+
+    ASSERT_TRUE(object.Has("note"));
+    ASSERT_FALSE(object.Has("missing"));
+    ASSERT_TRUE(object.GetRaw("id") == "7");
+    ASSERT_TRUE(object.GetRaw("regionate") == "true");
+    ASSERT_TRUE(object.GetRaw("missing") == "null");
+
+    // Escapes outside of ASCII become UTF-8.
+    ASSERT_TRUE(object.Parse("{\"s\": \"\\u0041\\u00e9\\u20ac\\n\"}", &error));
+    ASSERT_TRUE(object.GetString("s", &value));
+    ASSERT_TRUE(value == "A\xc3\xa9\xe2\x82\xac\n");
+
+    // Parsing replaces the previous contents.
+    ASSERT_TRUE(object.Parse("{}", &error));
+    ASSERT_FALSE(object.Has("s"));
+
+    cout << "pass\n";
+  }
+  {
+    cout << "Testing Parse() errors... ";
+
+    const char *bad[] = {
+      "",
+      "[1]",
+      "{\"a\" 1}",
+      "{\"a\": }",
+      "{\"a\": 1,}",
+      "{\"a\": 1",
+      "{\"a\": {\"b\": 1}}",
+      "{\"a\": [1]}",
+      "{\"a\": \"unterminated}",
+      "{\"a\": \"\\q\"}",
+      "{\"a\": tru}",
+      "{\"a\": 1} extra",
+    };
+    for (int i = 0; i < static_cast<int>(sizeof(bad) / sizeof(bad[0])); ++i) {
+      JsonObject object;
+      string error;
+      ASSERT_FALSE(object.Parse(bad[i], &error));
+      ASSERT_FALSE(error.empty());
+    }
+
+    cout << "pass\n";
+  }
+  {
+    cout << "Testing ToString()... ";
+
+    JsonObject object;
+    object.SetRaw("id", "\"job-1\"");
+    object.SetString("status", "failed");
+    object.SetString("error", "bad \"file\"\n\x01");
+    object.SetNumber("progress", 0.5);
+    object.SetBool("cached", false);
+    object.SetString("status", "done");
+    ASSERT_TRUE(object.ToString() ==
+                "{\"id\":\"job-1\",\"status\":\"done\","
+                "\"error\":\"bad \\\"file\\\"\\n\\u0001\","
+                "\"progress\":0.5,\"cached\":false}");
+
+    // The output parses back to the same values.
+    JsonObject parsed;
+    string error;
+    ASSERT_TRUE(parsed.Parse(object.ToString(), &error));
+    string value;
+    ASSERT_TRUE(parsed.GetString("error", &value));
+    ASSERT_TRUE(value == "bad \"file\"\n\x01");
+    ASSERT_TRUE(parsed.ToString() == object.ToString());
+
+    cout << "pass\n";
+  }
+
+  cout << "Passed\n";
+  return 0;
+}
+
+}  // namespace google_sky
+
+int main(int argc, char **argv) {
+  return google_sky::Main(argc, argv);
+}
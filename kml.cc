@@ -34,7 +34,6 @@
 namespace {
 
 const string TWO_SPACES("  ");
-const double PI = 3.1415926535897931;
 const double TINY_FLOAT_VALUE = 1.0e-8;
 const double RADIUS_EARTH = 6378135.0;       // in meters
 const double VIEWABLE_ANGULAR_SCALE = 50.0;  // in degrees
@@ -156,6 +155,21 @@ string KmlLookAt::ToString(int indent_level) const {
   return xml;
 }
 
+// KmlTimeSpan methods.
+string KmlTimeSpan::ToString(int indent_level) const {
+  CHECK(begin.has_value() || end.has_value()) << "No begin or end value";
+  string xml;
+  AppendTag(&xml, "<TimeSpan>", indent_level);
+  if (begin.has_value()) {
+    xml.append(CreateKml(begin, "begin", indent_level + 1));
+  }
+  if (end.has_value()) {
+    xml.append(CreateKml(end, "end", indent_level + 1));
+  }
+  AppendTag(&xml, "</TimeSpan>", indent_level);
+  return xml;
+}
+
 // KmlLod methods.
 string KmlLod::ToString(int indent_level) const {
   CHECK(min_lod_pixels.has_value()) << "No min_lod_pixels value";
@@ -212,6 +226,9 @@ string KmlGroundOverlay::ToString(int indent_level) const {
   if (name.has_value()) {
     xml.append(CreateKml(name, "name", indent_level + 1));
   }
+  if (time_span.has_value()) {
+    xml.append(time_span.get().ToString(indent_level + 1));
+  }
   if (draw_order.has_value()) {
     xml.append(CreateKml(draw_order, "drawOrder", indent_level + 1));
   }
@@ -212,6 +212,17 @@ class KmlLookAt {
   KmlField<double> range;
 };
 
+// <TimeSpan> class
+// Required fields: at least one of begin or end
+// Times are given as XML dateTime strings, e.g. "2008-01-02T03:04:05Z".
+class KmlTimeSpan {
+ public:
+  // NB: Compiler generated ctor, dtor, and copy functions are fine.
+  string ToString(int indent_level) const;
+  KmlField<string> begin;
+  KmlField<string> end;
+};
+
 // <Lod> class
 // Required fields: min_lod_pixels, max_lod_pixels
 class KmlLod {
@@ -277,6 +288,7 @@ class KmlGroundOverlay {
   void FromBoundingBox(const BoundingBox &bounding_box);
   
   KmlField<string> name;
+  KmlField<KmlTimeSpan> time_span;
   KmlField<int> draw_order;
   KmlField<KmlIcon> icon;
   KmlField<KmlLatLonBox> lat_lon_box;
@@ -57,6 +57,12 @@ static const char *GROUND_OVERLAY =
     "</Document>\n"
     "</kml>\n";
 
+static const char *TIME_SPAN =
+    "<TimeSpan>\n"
+    "  <begin>2008-01-02T03:04:05Z</begin>\n"
+    "  <end>2008-01-02T03:04:15Z</end>\n"
+    "</TimeSpan>\n";
+
 static const char *ROOT_KML =
     "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
     "<kml xmlns=\"http://earth.google.com/kml/2.2\" hint=\"target=sky\">\n"
@@ -257,6 +263,15 @@ int Main(int argc, char **argv) {
 
     cout << "pass\n";
   }
+
+  {
+    cout << "Testing TimeSpan... ";
+    KmlTimeSpan time_span;
+    time_span.begin.set("2008-01-02T03:04:05Z");
+    time_span.end.set("2008-01-02T03:04:15Z");
+    ASSERT_EQ(TIME_SPAN, time_span.ToString(0));
+    cout << "pass\n";
+  }
   
   {
     cout << "Testing root KML as generated by Regionator... ";
@@ -28,10 +28,308 @@
 
 #include "mask.h"
 
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <vector>
+
 namespace google_sky {
 
+namespace {
+
+// Packs the channels of a color (at most 4) into an integer in the same
+// byte order as the pixels of an Image.
+uint PackPixel(const Color &color) {
+  CHECK_LTE(color.channels(), 4) << "Too many channels to pack";
+  uint8 bytes[4] = {0, 0, 0, 0};
+  for (int i = 0; i < color.channels(); ++i) {
+    bytes[i] = color.GetChannel(i);
+  }
+  uint packed;
+  memcpy(&packed, bytes, 4);
+  return packed;
+}
+
+// Returns whether every channel of pixel is within tolerance of color.
+inline bool IsNear(const uint8 *pixel, const uint8 *color, int channels,
+                   int tolerance) {
+  for (int c = 0; c < channels; ++c) {
+    if (abs(static_cast<int>(pixel[c]) - color[c]) > tolerance) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// A horizontal run of masked out pixels whose neighbors in the rows above
+// and below still need to be checked.
+struct Span {
+  Span(int left, int right, int row) : left(left), right(right), row(row) {}
+
+  int left;   // First pixel.
+  int right;  // Last pixel.
+  int row;
+};
+
+// State for the scanline fill in Mask::CreateFloodMask().
+class FloodFill {
+ public:
+  FloodFill(const Image &image, const Color &color, int tolerance,
+            Image *mask)
+      : image_(image), channels_(image.channels()), tolerance_(tolerance),
+        mask_(mask) {
+    for (int c = 0; c < channels_; ++c) {
+      color_[c] = color.GetChannel(c);
+    }
+  }
+
+  // Fills the background reachable from pixel (i, j) if it's unfilled
+  // background.
+  void Fill(int i, int j) {
+    if (IsUnfilled(i, j)) {
+      FillSpan(i, j);
+      Drain();
+    }
+  }
+
+ private:
+  const Image &image_;
+  int channels_;
+  int tolerance_;
+  uint8 color_[4];
+  Image *mask_;
+  vector<Span> stack_;
+
+  // Returns whether pixel (i, j) is background that hasn't been filled.
+  inline bool IsUnfilled(int i, int j) const {
+    return mask_->GetRow(j)[i] != 0 &&
+           IsNear(image_.GetRow(j) + i * channels_, color_, channels_,
+                  tolerance_);
+  }
+
+  // Fills the whole span of unfilled background containing (i, j), queues
+  // it, and returns its last pixel.
+  int FillSpan(int i, int j) {
+    int width = image_.width();
+    int left = i;
+    while (left > 0 && IsUnfilled(left - 1, j)) --left;
+    int right = i;
+    while (right + 1 < width && IsUnfilled(right + 1, j)) ++right;
+
+    memset(mask_->GetMutableRow(j) + left, 0, right - left + 1);
+    stack_.push_back(Span(left, right, j));
+    return right;
+  }
+
+  // Checks the pixels next to each queued span for more background.  Each
+  // pixel is filled at most once and the rows next to a span are scanned
+  // only over its length, so the total work is linear in the number of
+  // pixels.
+  void Drain() {
+    while (!stack_.empty()) {
+      Span span = stack_.back();
+      stack_.pop_back();
+      for (int dj = -1; dj <= 1; dj += 2) {
+        int j = span.row + dj;
+        if (j < 0 || j >= image_.height()) continue;
+        for (int i = span.left; i <= span.right; ++i) {
+          if (IsUnfilled(i, j)) {
+            i = FillSpan(i, j);
+          }
+        }
+      }
+    }
+  }
+
+  DISALLOW_COPY_AND_ASSIGN(FloodFill);
+};
+
+// Number of rectangles whose union approximates a disk.
+static const int NUM_DISK_RECTANGLES = 4;
+
+// Width of the column strips filtered at once, which bounds the memory
+// used by the vertical pass.
+static const int COLUMN_STRIP_WIDTH = 1024;
+
+// Takes the minimum of two mask values.  Pixels outside of the mask are 255
+// so that they never win.
+struct MinOp {
+  inline uint8 operator()(uint8 a, uint8 b) const {
+    return a < b ? a : b;
+  }
+  static inline uint8 outside() {
+    return 255;
+  }
+};
+
+// Takes the maximum of two mask values.  Pixels outside of the mask are 0.
+struct MaxOp {
+  inline uint8 operator()(uint8 a, uint8 b) const {
+    return a > b ? a : b;
+  }
+  static inline uint8 outside() {
+    return 0;
+  }
+};
+
+// Applies op over a centered window of 2 * radius + 1 values to every value
+// of line with the van Herk/Gil-Werman algorithm.  The padded line is split
+// into blocks the size of the window, and each window is then covered by a
+// suffix of one block and a prefix of the next, so every value costs 3
+// operations whatever the radius.  Values are count apart in data, which
+// lets the same code run along rows and along columns.
+//
+// The line is processed width values at a time: value k of the line is the
+// width bytes starting at data + k * stride.  Along a column each value is a
+// strip of a row, so the inner loops run over contiguous bytes.  padded,
+// prefix, and suffix are scratch space.
+template <class Op>
+void FilterLine(int radius, int length, int width, int stride,
+                vector<uint8> *padded, vector<uint8> *prefix,
+                vector<uint8> *suffix, uint8 *data) {
+  Op op;
+  int window = 2 * radius + 1;
+  int padded_length = length + 2 * radius;
+  size_t size = static_cast<size_t>(padded_length) * width;
+  padded->assign(size, Op::outside());
+  prefix->resize(size);
+  suffix->resize(size);
+
+  for (int k = 0; k < length; ++k) {
+    memcpy(&(*padded)[static_cast<size_t>(k + radius) * width],
+           data + static_cast<size_t>(k) * stride, width);
+  }
+
+  for (int start = 0; start < padded_length; start += window) {
+    int end = min(start + window, padded_length);
+    uint8 *p = &(*padded)[0];
+    uint8 *g = &(*prefix)[0];
+    uint8 *h = &(*suffix)[0];
+
+    memcpy(g + static_cast<size_t>(start) * width,
+           p + static_cast<size_t>(start) * width, width);
+    for (int k = start + 1; k < end; ++k) {
+      const uint8 *previous = g + static_cast<size_t>(k - 1) * width;
+      const uint8 *value = p + static_cast<size_t>(k) * width;
+      uint8 *out = g + static_cast<size_t>(k) * width;
+      for (int x = 0; x < width; ++x) {
+        out[x] = op(previous[x], value[x]);
+      }
+    }
+
+    memcpy(h + static_cast<size_t>(end - 1) * width,
+           p + static_cast<size_t>(end - 1) * width, width);
+    for (int k = end - 2; k >= start; --k) {
+      const uint8 *next = h + static_cast<size_t>(k + 1) * width;
+      const uint8 *value = p + static_cast<size_t>(k) * width;
+      uint8 *out = h + static_cast<size_t>(k) * width;
+      for (int x = 0; x < width; ++x) {
+        out[x] = op(next[x], value[x]);
+      }
+    }
+  }
+
+  // The window for value k spans padded values k to k + window - 1.
+  for (int k = 0; k < length; ++k) {
+    const uint8 *h = &(*suffix)[static_cast<size_t>(k) * width];
+    const uint8 *g = &(*prefix)[static_cast<size_t>(k + window - 1) * width];
+    uint8 *out = data + static_cast<size_t>(k) * stride;
+    for (int x = 0; x < width; ++x) {
+      out[x] = op(h[x], g[x]);
+    }
+  }
+}
+
+// Applies op over a rectangle spanning radius_x pixels to either side
+// horizontally and radius_y vertically to a width x height grayscale mask.
+// Rectangles are separable, so this filters each row and then each column.
+template <class Op>
+void FilterRectangle(int radius_x, int radius_y, int width, int height,
+                     uint8 *data) {
+  vector<uint8> padded;
+  vector<uint8> prefix;
+  vector<uint8> suffix;
+
+  if (radius_x > 0) {
+    for (int j = 0; j < height; ++j) {
+      FilterLine<Op>(radius_x, width, 1, 1, &padded, &prefix, &suffix,
+                     data + static_cast<size_t>(j) * width);
+    }
+  }
+
+  if (radius_y > 0) {
+    for (int x = 0; x < width; x += COLUMN_STRIP_WIDTH) {
+      int strip_width = min(COLUMN_STRIP_WIDTH, width - x);
+      FilterLine<Op>(radius_y, height, strip_width, width, &padded, &prefix,
+                     &suffix, data + x);
+    }
+  }
+}
+
+// Applies op over the structuring element.  A disk is the union of
+// rectangles inscribed in it, and filtering over a union is the same op
+// applied to the results for each rectangle.
+template <class Op>
+void Filter(Mask::StructuringElement element, int radius_x, int radius_y,
+            Image *mask) {
+  CHECK_EQ(mask->channels(), 1);
+  CHECK_GTE(radius_x, 0);
+  CHECK_GTE(radius_y, 0);
+  int width = mask->width();
+  int height = mask->height();
+  if (width == 0 || height == 0) return;
+  uint8 *data = mask->GetMutableRow(0);
+
+  if (element == Mask::RECTANGLE) {
+    FilterRectangle<Op>(radius_x, radius_y, width, height, data);
+    return;
+  }
+  CHECK(element == Mask::DISK) << "Unknown structuring element";
+
+  // Rectangles reaching out to evenly spaced angles around the quadrant.
+  vector<pair<int, int> > rectangles;
+  for (int k = 0; k < NUM_DISK_RECTANGLES; ++k) {
+    double angle = (k + 0.5) * M_PI / (2 * NUM_DISK_RECTANGLES);
+    pair<int, int> radii(static_cast<int>(floor(radius_x * cos(angle) + 0.5)),
+                         static_cast<int>(floor(radius_y * sin(angle) + 0.5)));
+    if (find(rectangles.begin(), rectangles.end(), radii) ==
+        rectangles.end()) {
+      rectangles.push_back(radii);
+    }
+  }
+
+  Op op;
+  size_t size = static_cast<size_t>(width) * height;
+  vector<uint8> original(data, data + size);
+  vector<uint8> filtered;
+  FilterRectangle<Op>(rectangles[0].first, rectangles[0].second, width,
+                      height, data);
+  for (size_t r = 1; r < rectangles.size(); ++r) {
+    filtered = original;
+    FilterRectangle<Op>(rectangles[r].first, rectangles[r].second, width,
+                        height, &filtered[0]);
+    for (size_t k = 0; k < size; ++k) {
+      data[k] = op(data[k], filtered[k]);
+    }
+  }
+}
+
+}  // namespace
+
 // Automatically creates a mask by masking out edge pixels of color
 // mask_out_color.
+//
+// A pixel is masked out if it lies in a run of mask_out_color that reaches
+// the left, right, top, or bottom edge of the image.  Rather than walking
+// in from each edge (2 of which walk columns against the row-major
+// layout), every row is compared against the packed color once, top to
+// bottom.  The left and right runs are found from the row's matches, and
+// each column carries the row of its first mismatch (which ends the run from
+// the top) and one past its last mismatch (which starts the run from the
+// bottom).  The bottom runs are only known after the last row, so they are
+// cleared in a final pass over the bottom rows of the mask.
 void Mask::CreateMask(const Image &image, const Color &mask_out_color,
                       Image *mask) {
   CHECK_GT(image.width(), 0);
@@ -41,68 +339,113 @@ void Mask::CreateMask(const Image &image, const Color &mask_out_color,
       << "Mask out color should have " << image.channels() << " channels (has "
       << mask_out_color.channels() << ")";
 
-  // Create a mask that is completely opaque.
+  // Each row of the mask starts out opaque.
   CHECK(mask->Resize(image.width(), image.height(), Image::GRAYSCALE))
       << "Can't create mask";
-  CHECK(mask->SetAllValuesInChannel(0, 255))
-      << "Can't set alpha channel";
-
-  // To create the mask, we perform 4 passes on the input image, first 2
-  // horizontally then 2 vertically.  On each pass, we mask out all pixels
-  // from the outer edge of the image to the first pixel that doesn't equal
-  // mask_out_color.
-  Color pixel(image.channels());
-  Color transparent(1);
-
-  // Horizontal pass, x increasing.
-  for (int j = 0; j < image.height(); ++j) {
-    for (int i = 0; i < image.width(); ++i) {
-      image.GetPixel(i, j, &pixel);
-      if (!pixel.Equals(mask_out_color)) {
-        break;
-      } else {
-        mask->SetPixel(i, j, transparent);
+
+  int width = image.width();
+  int height = image.height();
+  int channels = image.channels();
+
+  // Pixels are packed into 32 bits, so each comparison is a single integer
+  // compare that the compiler can vectorize.
+  uint key = PackPixel(mask_out_color);
+
+  vector<uint8> matches(width);
+  vector<int> top_end(width, height);    // First mismatch from the top.
+  vector<int> bottom_start(width, 0);    // One past the last mismatch.
+  int num_top_runs = width;              // Columns still in their top run.
+
+  for (int j = 0; j < height; ++j) {
+    const uint8 *row = image.GetRow(j);
+    if (channels == 4) {
+      for (int i = 0; i < width; ++i) {
+        uint value;
+        memcpy(&value, row + 4 * i, 4);
+        matches[i] = (value == key);
+      }
+    } else {
+      for (int i = 0; i < width; ++i) {
+        uint value = 0;
+        memcpy(&value, row + channels * i, channels);
+        matches[i] = (value == key);
       }
     }
-  }
 
-  // Horizontal pass, x decreasing.
-  for (int j = 0; j < image.height(); ++j) {
-    for (int i = image.width() - 1; i >= 0; --i) {
-      image.GetPixel(i, j, &pixel);
-      if (!pixel.Equals(mask_out_color)) {
-        break;
-      } else {
-        mask->SetPixel(i, j, transparent);
+    // Runs from the left and right edges.
+    int left_end = 0;
+    while (left_end < width && matches[left_end]) ++left_end;
+    int right_start = width;
+    while (right_start > left_end && matches[right_start - 1]) --right_start;
+
+    uint8 *mask_row = mask->GetMutableRow(j);
+    memset(mask_row, 255, width);
+    memset(mask_row, 0, left_end);
+    memset(mask_row + right_start, 0, width - right_start);
+
+    // Runs from the top edge end at the first mismatch in each column.
+    if (num_top_runs > 0) {
+      for (int i = 0; i < width; ++i) {
+        if (top_end[i] == height) {
+          if (matches[i]) {
+            mask_row[i] = 0;
+          } else {
+            top_end[i] = j;
+            --num_top_runs;
+          }
+        }
       }
     }
-  }
 
-  // Vertical pass, y increasing.
-  for (int i = 0; i < image.width(); ++i) {
-    for (int j = 0; j < image.height(); ++j) {
-      image.GetPixel(i, j, &pixel);
-      if (!pixel.Equals(mask_out_color)) {
-        break;
-      } else {
-        mask->SetPixel(i, j, transparent);
-      }
+    for (int i = 0; i < width; ++i) {
+      bottom_start[i] = matches[i] ? bottom_start[i] : j + 1;
     }
   }
 
-  // Vertical pass, y decreasing.
-  for (int i = 0; i < image.width(); ++i) {
-    for (int j = image.height() - 1; j >= 0; --j) {
-      image.GetPixel(i, j, &pixel);
-      if (!pixel.Equals(mask_out_color)) {
-        break;
-      } else {
-        mask->SetPixel(i, j, transparent);
+  // Runs from the bottom edge start after the last mismatch in each column.
+  int first_row = height;
+  for (int i = 0; i < width; ++i) {
+    first_row = min(first_row, bottom_start[i]);
+  }
+  for (int j = first_row; j < height; ++j) {
+    uint8 *mask_row = mask->GetMutableRow(j);
+    for (int i = 0; i < width; ++i) {
+      if (j >= bottom_start[i]) {
+        mask_row[i] = 0;
       }
     }
   }
 }
 
+// Seeds a span-based scanline fill from every pixel on the image edges.
+// Spans are kept on an explicit stack rather than recursing, so deep or
+// convoluted regions can't overflow the call stack.
+void Mask::CreateFloodMask(const Image &image, const Color &mask_out_color,
+                           int tolerance, Image *mask) {
+  CHECK_GT(image.width(), 0);
+  CHECK_GT(image.height(), 0);
+  CHECK_EQ(mask_out_color.channels(), image.channels())
+      << "Mask out color should have " << image.channels() << " channels (has "
+      << mask_out_color.channels() << ")";
+  CHECK_LTE(image.channels(), 4) << "Too many channels";
+
+  CHECK(mask->Resize(image.width(), image.height(), Image::GRAYSCALE))
+      << "Can't create mask";
+  mask->SetAllValues(255);
+
+  int width = image.width();
+  int height = image.height();
+  FloodFill flood_fill(image, mask_out_color, tolerance, mask);
+  for (int i = 0; i < width; ++i) {
+    flood_fill.Fill(i, 0);
+    flood_fill.Fill(i, height - 1);
+  }
+  for (int j = 0; j < height; ++j) {
+    flood_fill.Fill(0, j);
+    flood_fill.Fill(width - 1, j);
+  }
+}
+
 // Uses the input mask to set the alpha channel of the underlying image.
 void Mask::SetAlphaChannelFromMask(const Image &mask, Image *image) {
   CHECK_GT(image->width(), 0);
@@ -120,14 +463,37 @@ void Mask::SetAlphaChannelFromMask(const Image &mask, Image *image) {
     CHECK(false) << "No alpha channel in image";
   }
 
-  Color alpha(1);
-
-  for (int i = 0; i < image->width(); ++i) {
-    for (int j = 0; j < image->height(); ++j) {
-      mask.GetPixel(i, j, &alpha);
-      image->SetValue(i, j, alpha_index, alpha.GetChannel(0));
+  // Rows are copied in memory order.
+  int channels = image->channels();
+  for (int j = 0; j < image->height(); ++j) {
+    const uint8 *alpha = mask.GetRow(j);
+    uint8 *row = image->GetMutableRow(j) + alpha_index;
+    for (int i = 0; i < image->width(); ++i) {
+      row[i * channels] = alpha[i];
     }
   }
 }
 
+void Mask::Erode(StructuringElement element, int radius_x, int radius_y,
+                 Image *mask) {
+  Filter<MinOp>(element, radius_x, radius_y, mask);
+}
+
+void Mask::Dilate(StructuringElement element, int radius_x, int radius_y,
+                  Image *mask) {
+  Filter<MaxOp>(element, radius_x, radius_y, mask);
+}
+
+void Mask::Open(StructuringElement element, int radius_x, int radius_y,
+                Image *mask) {
+  Erode(element, radius_x, radius_y, mask);
+  Dilate(element, radius_x, radius_y, mask);
+}
+
+void Mask::Close(StructuringElement element, int radius_x, int radius_y,
+                 Image *mask) {
+  Dilate(element, radius_x, radius_y, mask);
+  Erode(element, radius_x, radius_y, mask);
+}
+
 }  // namespace google_sky
@@ -55,6 +55,13 @@ namespace google_sky {
 // mask_out_color.SetChannel(2, blue);
 // Mask::CreateMask(image, mask_out_color, &mask);
 //
+// // Alternatively, remove all background connected to the edges, allowing
+// // each channel to differ from the color by up to 2.
+// Mask::CreateFloodMask(image, mask_out_color, 2, &mask);
+//
+// // Shrink the kept area of the mask by 10 pixels with a round element.
+// Mask::Erode(Mask::DISK, 10, 10, &mask);
+//
 // // Applies the created mask to the input image.  The alpha channel of image
 // // is overwritten with the values from mask.  The mask must be grayscale
 // // or this function dies.
@@ -62,18 +69,59 @@ namespace google_sky {
 
 class Mask {
  public:
+  // Shapes of structuring elements for morphology.  DISK is approximated by
+  // the union of a few rectangles inscribed in it, and is an ellipse when
+  // the x and y radii differ.
+  enum StructuringElement {
+    RECTANGLE = 0,
+    DISK
+  };
+
   ~Mask() {
     // Nothing needed.
   }
 
-  // Creates a mask from the input image by making 4 simple passes
-  // from each image edge to the first pixel that doesn't contain color
-  // mask_out_color (which have the same number of channels as image).  All
-  // pixels from the edge to this point are masked out.  The returned mask is
-  // grayscale.
+  // Creates a mask from the input image by masking out the pixels from each
+  // image edge (left, right, top, and bottom) to the first pixel that
+  // doesn't contain color mask_out_color (which must have the same number of
+  // channels as image).  The image is read in a single pass over its rows.
+  // The returned mask is grayscale.
   static void CreateMask(const Image &image, const Color &mask_out_color,
                          Image *mask);
   
+  // Creates a mask from the input image by masking out every pixel that is
+  // connected to an edge of the image through pixels whose channels are all
+  // within tolerance of mask_out_color (which must have the same number of
+  // channels as image).  Unlike CreateMask(), this also removes concave
+  // areas of background such as corners behind bright stars.  Pixels are
+  // connected to the 4 pixels next to them.  The fill runs in time linear in
+  // the number of pixels.  The returned mask is grayscale.
+  static void CreateFloodMask(const Image &image, const Color &mask_out_color,
+                              int tolerance, Image *mask);
+
+  // Replaces each pixel of a grayscale mask with the minimum over the
+  // structuring element centered on it, which shrinks the kept (nonzero)
+  // area and grows the masked out area.  The element spans radius_x pixels
+  // to either side horizontally and radius_y vertically.  This uses the van
+  // Herk/Gil-Werman algorithm, so the cost doesn't depend on the radii.
+  // Pixels outside of the mask don't affect the result.
+  static void Erode(StructuringElement element, int radius_x, int radius_y,
+                    Image *mask);
+
+  // Like Erode(), but takes the maximum, which grows the kept area.
+  static void Dilate(StructuringElement element, int radius_x, int radius_y,
+                     Image *mask);
+
+  // Erodes and then dilates the mask, removing kept areas smaller than the
+  // structuring element.
+  static void Open(StructuringElement element, int radius_x, int radius_y,
+                   Image *mask);
+
+  // Dilates and then erodes the mask, filling masked out areas smaller than
+  // the structuring element.
+  static void Close(StructuringElement element, int radius_x, int radius_y,
+                    Image *mask);
+
   // Sets the alpha channel of image using the values from the given mask.
   // Dies if mask contains more than 1 channel, if image doesn't have an
   // alpha channel, or if mask and image don't have the same dimensions.
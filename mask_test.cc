@@ -26,13 +26,51 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
 #include <iostream>
+#include <vector>
 
 #include "base.h"
 #include "mask.h"
 
 namespace google_sky {
 
+// Creates a mask the slow way by walking in from each edge of the image.
+void CreateReferenceMask(const Image &image, const Color &mask_out_color,
+                         Image *mask) {
+  ASSERT_TRUE(mask->Resize(image.width(), image.height(), Image::GRAYSCALE));
+  ASSERT_TRUE(mask->SetAllValuesInChannel(0, 255));
+
+  Color pixel(image.channels());
+  for (int j = 0; j < image.height(); ++j) {
+    for (int i = 0; i < image.width(); ++i) {
+      image.GetPixel(i, j, &pixel);
+      if (!pixel.Equals(mask_out_color)) break;
+      mask->SetValue(i, j, 0, 0);
+    }
+    for (int i = image.width() - 1; i >= 0; --i) {
+      image.GetPixel(i, j, &pixel);
+      if (!pixel.Equals(mask_out_color)) break;
+      mask->SetValue(i, j, 0, 0);
+    }
+  }
+  for (int i = 0; i < image.width(); ++i) {
+    for (int j = 0; j < image.height(); ++j) {
+      image.GetPixel(i, j, &pixel);
+      if (!pixel.Equals(mask_out_color)) break;
+      mask->SetValue(i, j, 0, 0);
+    }
+    for (int j = image.height() - 1; j >= 0; --j) {
+      image.GetPixel(i, j, &pixel);
+      if (!pixel.Equals(mask_out_color)) break;
+      mask->SetValue(i, j, 0, 0);
+    }
+  }
+}
+
 // These files are for a downsampled SDSS frame with a black border to test
 // automasking that is known to properly project.
 static const char *PNG_FILENAME = "testdata/fpC-001478-g3-0022_small.png";
@@ -42,6 +80,65 @@ static const char *PNG_MASK_TEST_FILENAME = "testdata/mask_test.png";
 static const char *PNG_MASK_TRUE_FILENAME =
     "testdata/mask_test_transparent.png";
 
+// Creates a flood mask the slow way with a breadth first search.
+void CreateReferenceFloodMask(const Image &image, const Color &color,
+                              int tolerance, Image *mask) {
+  ASSERT_TRUE(mask->Resize(image.width(), image.height(), Image::GRAYSCALE));
+  ASSERT_TRUE(mask->SetAllValuesInChannel(0, 255));
+
+  vector<int> queue;
+  for (int j = 0; j < image.height(); ++j) {
+    for (int i = 0; i < image.width(); ++i) {
+      if (i == 0 || j == 0 || i == image.width() - 1 ||
+          j == image.height() - 1) {
+        queue.push_back(j * image.width() + i);
+      }
+    }
+  }
+
+  Color pixel(image.channels());
+  for (size_t k = 0; k < queue.size(); ++k) {
+    int i = queue[k] % image.width();
+    int j = queue[k] / image.width();
+    if (mask->GetValue(i, j, 0) == 0) continue;
+    image.GetPixel(i, j, &pixel);
+    bool is_near = true;
+    for (int c = 0; c < image.channels(); ++c) {
+      is_near = is_near && abs(pixel.GetChannel(c) -
+                               color.GetChannel(c)) <= tolerance;
+    }
+    if (!is_near) continue;
+
+    mask->SetValue(i, j, 0, 0);
+    if (i > 0) queue.push_back(queue[k] - 1);
+    if (i < image.width() - 1) queue.push_back(queue[k] + 1);
+    if (j > 0) queue.push_back(queue[k] - image.width());
+    if (j < image.height() - 1) queue.push_back(queue[k] + image.width());
+  }
+}
+
+// Filters a mask the slow way by visiting every pixel of a rectangle around
+// each pixel, taking the minimum if erode is set and the maximum otherwise.
+void ReferenceFilterRectangle(const Image &mask, int radius_x, int radius_y,
+                              bool erode, Image *filtered) {
+  ASSERT_TRUE(filtered->Resize(mask.width(), mask.height(),
+                               Image::GRAYSCALE));
+  for (int j = 0; j < mask.height(); ++j) {
+    for (int i = 0; i < mask.width(); ++i) {
+      int value = erode ? 255 : 0;
+      for (int y = max(0, j - radius_y);
+           y <= min(mask.height() - 1, j + radius_y); ++y) {
+        for (int x = max(0, i - radius_x);
+             x <= min(mask.width() - 1, i + radius_x); ++x) {
+          int sample = mask.GetValue(x, y, 0);
+          value = erode ? min(value, sample) : max(value, sample);
+        }
+      }
+      filtered->SetValue(i, j, 0, value);
+    }
+  }
+}
+
 int Main(int argc, char **argv) {
   {
     cout << "Testing CreateMask()... ";
@@ -67,6 +164,230 @@ int Main(int argc, char **argv) {
     cout << "pass\n";
   }
   
+  {
+    cout << "Testing CreateMask() against edge walking... ";
+
+    // Random images where most pixels are the mask color, so that there are
+    // long and ragged runs from every edge.
+    srand(12345);
+    for (int trial = 0; trial < 50; ++trial) {
+      Image image;
+      int width = 1 + rand() % 40;
+      int height = 1 + rand() % 40;
+      Image::Colorspace colorspace = (trial % 2 == 0) ? Image::RGBA :
+                                                         Image::RGB;
+      ASSERT_TRUE(image.Resize(width, height, colorspace));
+      Color color(image.channels());
+      Color mask_out_color(image.channels());
+      mask_out_color.SetAllChannels(7);
+      for (int j = 0; j < height; ++j) {
+        for (int i = 0; i < width; ++i) {
+          if (rand() % 10 < 8) {
+            image.SetPixel(i, j, mask_out_color);
+          } else {
+            color.SetAllChannels(7);
+            color.SetChannel(rand() % image.channels(), rand() % 7);
+            image.SetPixel(i, j, color);
+          }
+        }
+      }
+
+      Image mask;
+      Mask::CreateMask(image, mask_out_color, &mask);
+      Image true_mask;
+      CreateReferenceMask(image, mask_out_color, &true_mask);
+      ASSERT_TRUE(mask.Equals(true_mask));
+    }
+
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing CreateFloodMask()... ";
+
+    // A bright ring on a black background with a notch cut into its right
+    // side, which connects the inside of the ring to the background outside.
+    // Neither the notch nor the inside is reachable in a straight line from
+    // an edge.  The top row is slightly brighter than black.
+    Image image;
+    ASSERT_TRUE(image.Resize(20, 20, Image::RGBA));
+    Color black(4);
+    black.SetChannels(0, 3, 0);
+    black.SetChannel(3, 255);
+    Color nearly_black(4);
+    nearly_black.SetChannels(0, 3, 2);
+    nearly_black.SetChannel(3, 255);
+    Color white(4);
+    white.SetAllChannels(255);
+    for (int j = 0; j < 20; ++j) {
+      for (int i = 0; i < 20; ++i) {
+        bool on_ring = i >= 4 && i < 16 && j >= 4 && j < 16 &&
+                       !(i >= 6 && i < 14 && j >= 6 && j < 14);
+        bool in_notch = i >= 14 && j >= 9 && j < 11;
+        if (on_ring && !in_notch) {
+          image.SetPixel(i, j, white);
+        } else if (j == 0) {
+          image.SetPixel(i, j, nearly_black);
+        } else {
+          image.SetPixel(i, j, black);
+        }
+      }
+    }
+
+    Image mask;
+    Mask::CreateFloodMask(image, black, 2, &mask);
+    ASSERT_EQ(0, mask.GetValue(0, 0, 0));
+    ASSERT_EQ(255, mask.GetValue(4, 4, 0));
+    ASSERT_EQ(0, mask.GetValue(13, 9, 0));   // Through the notch.
+    ASSERT_EQ(0, mask.GetValue(7, 7, 0));    // Inside the ring.
+
+    // Edge walking stops at the nearly black top row and can't reach inside
+    // the ring.
+    Mask::CreateMask(image, black, &mask);
+    ASSERT_EQ(255, mask.GetValue(3, 0, 0));
+    ASSERT_EQ(255, mask.GetValue(7, 7, 0));
+
+    // Without tolerance the top row stays, but the rest is still reached.
+    Mask::CreateFloodMask(image, black, 0, &mask);
+    ASSERT_EQ(255, mask.GetValue(0, 0, 0));
+    ASSERT_EQ(0, mask.GetValue(0, 1, 0));
+    ASSERT_EQ(0, mask.GetValue(7, 7, 0));
+
+    // Random images with many concave regions.
+    srand(54321);
+    for (int trial = 0; trial < 50; ++trial) {
+      int width = 1 + rand() % 40;
+      int height = 1 + rand() % 40;
+      ASSERT_TRUE(image.Resize(width, height, Image::RGB));
+      Color color(3);
+      for (int j = 0; j < height; ++j) {
+        for (int i = 0; i < width; ++i) {
+          color.SetAllChannels(rand() % 10 < 6 ? rand() % 4 : 100);
+          image.SetPixel(i, j, color);
+        }
+      }
+
+      Color mask_out_color(3);
+      mask_out_color.SetAllChannels(1);
+      int tolerance = trial % 3;
+      Image true_mask;
+      Mask::CreateFloodMask(image, mask_out_color, tolerance, &mask);
+      CreateReferenceFloodMask(image, mask_out_color, tolerance, &true_mask);
+      ASSERT_TRUE(mask.Equals(true_mask));
+    }
+
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing Erode() and Dilate() with rectangles... ";
+
+    // Radii from 0 to past the size of the mask, including windows that are
+    // wider than the column strips.
+    srand(54321);
+    for (int trial = 0; trial < 40; ++trial) {
+      int width = 1 + rand() % 30;
+      int height = 1 + rand() % 30;
+      if (trial == 0) width = 1100;
+      Image mask;
+      ASSERT_TRUE(mask.Resize(width, height, Image::GRAYSCALE));
+      for (int j = 0; j < height; ++j) {
+        for (int i = 0; i < width; ++i) {
+          mask.SetValue(i, j, 0, (rand() % 4 == 0) ? rand() % 256 : 255);
+        }
+      }
+      int radius_x = rand() % 35;
+      int radius_y = rand() % 35;
+
+      Image eroded;
+      ReferenceFilterRectangle(mask, radius_x, radius_y, true, &eroded);
+      Image dilated;
+      ReferenceFilterRectangle(mask, radius_x, radius_y, false, &dilated);
+
+      Image filtered;
+      ASSERT_TRUE(filtered.Resize(width, height, Image::GRAYSCALE));
+      memcpy(filtered.GetMutableRow(0), mask.GetRow(0), width * height);
+      Mask::Erode(Mask::RECTANGLE, radius_x, radius_y, &filtered);
+      ASSERT_TRUE(filtered.Equals(eroded));
+
+      memcpy(filtered.GetMutableRow(0), mask.GetRow(0), width * height);
+      Mask::Dilate(Mask::RECTANGLE, radius_x, radius_y, &filtered);
+      ASSERT_TRUE(filtered.Equals(dilated));
+    }
+
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing Dilate() with a disk... ";
+
+    // Dilating a single kept pixel draws the structuring element.
+    int radius = 10;
+    int size = 2 * radius + 5;
+    int center = size / 2;
+    Image mask;
+    ASSERT_TRUE(mask.Resize(size, size, Image::GRAYSCALE));
+    mask.SetAllValues(0);
+    mask.SetValue(center, center, 0, 255);
+    Mask::Dilate(Mask::DISK, radius, radius, &mask);
+
+    for (int j = 0; j < size; ++j) {
+      for (int i = 0; i < size; ++i) {
+        int dx = i - center;
+        int dy = j - center;
+        double distance = sqrt(static_cast<double>(dx * dx + dy * dy));
+        // The element is symmetric and lies between disks slightly smaller
+        // and larger than the radius.
+        ASSERT_EQ(mask.GetValue(i, j, 0),
+                  mask.GetValue(2 * center - i, 2 * center - j, 0));
+        ASSERT_EQ(mask.GetValue(i, j, 0), mask.GetValue(j, i, 0));
+        if (distance <= radius - 1.5) {
+          ASSERT_EQ(255, mask.GetValue(i, j, 0));
+        }
+        if (distance > radius + 1) {
+          ASSERT_EQ(0, mask.GetValue(i, j, 0));
+        }
+      }
+    }
+    ASSERT_EQ(255, mask.GetValue(center + radius, center, 0));
+    ASSERT_EQ(0, mask.GetValue(center + radius, center + radius, 0));
+
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing Open() and Close()... ";
+
+    // A kept square with a small hole, and a small kept speck.
+    Image mask;
+    ASSERT_TRUE(mask.Resize(40, 40, Image::GRAYSCALE));
+    mask.SetAllValues(0);
+    for (int j = 5; j < 25; ++j) {
+      for (int i = 5; i < 25; ++i) {
+        mask.SetValue(i, j, 0, 255);
+      }
+    }
+    mask.SetValue(15, 15, 0, 0);
+    mask.SetValue(32, 32, 0, 255);
+
+    Image opened;
+    ASSERT_TRUE(opened.Resize(40, 40, Image::GRAYSCALE));
+    memcpy(opened.GetMutableRow(0), mask.GetRow(0), 40 * 40);
+    Mask::Open(Mask::DISK, 2, 2, &opened);
+    ASSERT_EQ(0, opened.GetValue(32, 32, 0));
+    ASSERT_EQ(255, opened.GetValue(10, 10, 0));
+
+    Image closed;
+    ASSERT_TRUE(closed.Resize(40, 40, Image::GRAYSCALE));
+    memcpy(closed.GetMutableRow(0), mask.GetRow(0), 40 * 40);
+    Mask::Close(Mask::DISK, 2, 2, &closed);
+    ASSERT_EQ(255, closed.GetValue(15, 15, 0));
+    ASSERT_EQ(255, closed.GetValue(32, 32, 0));
+    ASSERT_EQ(0, closed.GetValue(2, 2, 0));
+
+    cout << "pass\n";
+  }
+
   {
     cout << "Testing SetAlphaChannelFromMask()... ";
 
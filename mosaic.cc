@@ -0,0 +1,732 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "mosaic.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+#include "boundingbox.h"
+#include "coadd.h"
+#include "file_util.h"
+#include "imagecache.h"
+#include "kml.h"
+#include "string_util.h"
+#include "threadpool.h"
+#include "wcsprojection.h"
+#include "xyzpyramid.h"
+
+namespace {
+
+// Blended pixels with at least this weight come out fully opaque, so no
+// image below them needs to be sampled.
+static const float OPAQUE_WEIGHT = 1.0f - 0.5f / 255.0f;
+
+// Bounding boxes are found from the centers of the edge pixels, so they
+// are padded by this many pixels to cover the edge pixels themselves.
+static const double BOUNDS_PADDING_PIXELS = 1.0;
+
+// Returns the angle in degrees between two points on the sky.
+double AngularDistance(double ra1, double dec1, double ra2, double dec2) {
+  double to_radians = PI / 180.0;
+  double sin_dec = sin(0.5 * (dec2 - dec1) * to_radians);
+  double sin_ra = sin(0.5 * (ra2 - ra1) * to_radians);
+  double a = sin_dec * sin_dec +
+             cos(dec1 * to_radians) * cos(dec2 * to_radians) * sin_ra * sin_ra;
+  return 2.0 * asin(min(1.0, sqrt(a))) / to_radians;
+}
+
+}  // namespace
+
+namespace google_sky {
+
+// Warps and writes one tile of the finest level.
+class Mosaic::LeafTask : public Task {
+ public:
+  LeafTask(const Mosaic *mosaic, int x, int y, const vector<int> *indexes,
+           ImageCache *cache, BuildStatus *status)
+      : mosaic_(mosaic), x_(x), y_(y), indexes_(indexes), cache_(cache),
+        status_(status) {}
+
+  virtual void Run() {
+    if (status_->failed()) return;
+    Image tile;
+    string error;
+    if (!mosaic_->RenderTileFromImages(x_, y_, *indexes_, cache_, &tile,
+                                       &error)) {
+      status_->Fail(error);
+      return;
+    }
+    // A tile may only be reached by the padding of bounding boxes.
+    if (tile.AlphaIsEverywhere(0)) return;
+    pair<int, int> key(y_, x_);
+    if (!mosaic_->WriteTile(mosaic_->max_level_, key, TileSet(), &tile,
+                            &error)) {
+      status_->Fail(error);
+      return;
+    }
+    status_->AddTile(key);
+  }
+
+ private:
+  const Mosaic *mosaic_;
+  int x_;
+  int y_;
+  const vector<int> *indexes_;
+  ImageCache *cache_;
+  BuildStatus *status_;
+
+  DISALLOW_COPY_AND_ASSIGN(LeafTask);
+};
+
+const int Mosaic::MAX_LEVEL;
+
+Mosaic::Mosaic(MosaicImageReader *reader)
+    : reader_(reader),
+      images_(),
+      tile_size_(256),
+      max_level_(0),
+      image_origin_(SkyProjection::LOWER_LEFT),
+      num_threads_(ThreadPool::DefaultNumThreads()),
+      combine_(BLEND),
+      clip_sigma_(3.0),
+      clip_iterations_(2),
+      cache_bytes_(MemoryBudget::DefaultLimit()),
+      filename_prefix_("tile"),
+      output_directory_("tiles"),
+      root_kml_("root.kml"),
+      xyz_directory_(),
+      draw_tile_borders_(false),
+      min_lod_pixels_(128),
+      max_lod_pixels_(-1),
+      top_level_draw_order_(0) {
+  // Nothing needed.
+}
+
+Mosaic::~Mosaic() {
+  for (size_t i = 0; i < images_.size(); ++i) {
+    delete images_[i].wcs;
+  }
+}
+
+// Records the padded bounding box of the image.  Images over a pole cover
+// every ra near it.
+void Mosaic::AddImage(WcsProjection *wcs, int width, int height) {
+  CHECK(width > 0 && height > 0) << "Bad image size " << width << " x "
+                                 << height;
+  Input input;
+  input.wcs = wcs;
+  input.width = width;
+  input.height = height;
+
+  // Measure the pixel size from a pixel at the center of the image.
+  double x = 0.5 * (width + 1);
+  double y = 0.5 * (height + 1);
+  double ra, dec, ra_x, dec_x, ra_y, dec_y;
+  wcs->ToRaDec(x, y, &ra, &dec);
+  wcs->ToRaDec(x + 1.0, y, &ra_x, &dec_x);
+  wcs->ToRaDec(x, y + 1.0, &ra_y, &dec_y);
+  input.pixel_scale = sqrt(AngularDistance(ra, dec, ra_x, dec_x) *
+                           AngularDistance(ra, dec, ra_y, dec_y));
+
+  BoundingBox bounding_box(*wcs, width, height);
+  bounding_box.GetMonotonicRaBounds(&input.ra_min, &input.ra_max);
+  bounding_box.GetDecBounds(&input.dec_min, &input.dec_max);
+
+  double padding = BOUNDS_PADDING_PIXELS * input.pixel_scale;
+  input.dec_min = max(input.dec_min - padding, -90.0);
+  input.dec_max = min(input.dec_max + padding, 90.0);
+  double cos_dec = cos(max(fabs(input.dec_min), fabs(input.dec_max)) *
+                       (PI / 180.0));
+  double ra_padding = padding / max(cos_dec, 1.0e-6);
+  input.ra_min -= ra_padding;
+  input.ra_max += ra_padding;
+  if (input.ra_min < 0.0) {
+    input.ra_min += 360.0;
+    input.ra_max += 360.0;
+  }
+  if (bounding_box.crosses_north_pole() || bounding_box.crosses_south_pole() ||
+      input.ra_max - input.ra_min >= 360.0) {
+    input.ra_min = 0.0;
+    input.ra_max = 360.0;
+  }
+  if (bounding_box.crosses_north_pole()) input.dec_max = 90.0;
+  if (bounding_box.crosses_south_pole()) input.dec_min = -90.0;
+
+  images_.push_back(input);
+}
+
+// Levels halve the pixel size, so the level needed is the base 2 log of
+// the ratio of the level 0 pixel size to the image pixel size.
+int Mosaic::FindNativeLevel(void) const {
+  CHECK(!images_.empty()) << "Mosaic has no images";
+  vector<double> scales;
+  for (size_t i = 0; i < images_.size(); ++i) {
+    scales.push_back(images_[i].pixel_scale);
+  }
+  nth_element(scales.begin(), scales.begin() + scales.size() / 2,
+              scales.end());
+  double scale = scales[scales.size() / 2];
+  if (!(scale > 0.0)) return 0;
+
+  double level = log(180.0 / (tile_size_ * scale)) / log(2.0);
+  return Clamp(static_cast<int>(ceil(level - 1.0e-9)), 0, MAX_LEVEL);
+}
+
+// Warps the finest level tile by tile and then builds each coarser level
+// from the level below it.  Each level is finished before the next starts.
+bool Mosaic::Build(string *error) const {
+  if (images_.empty()) {
+    *error = "The mosaic has no images";
+    return false;
+  }
+  if (!MakeDirectory(output_directory_)) {
+    *error = "Cannot create output directory " + output_directory_;
+    return false;
+  }
+
+  TileImages tile_images;
+  FindTileImages(&tile_images);
+
+  ThreadPool pool(num_threads_);
+  TileSet tiles;
+  if (!BuildLeaves(tile_images, &pool, &tiles, error) ||
+      !BuildAncestors(false, &pool, &tiles, error)) {
+    return false;
+  }
+  return WriteRootKml(tiles, error);
+}
+
+// The tiles to warp are those that a new image overlaps.  Their other
+// images are warped too, so blending and co-adding come out as they would
+// from Build().
+bool Mosaic::Insert(int first_image, string *error) const {
+  CHECK(first_image >= 0 && first_image <= num_images())
+      << "Bad first image " << first_image;
+  if (first_image == num_images()) return true;
+  if (!MakeDirectory(output_directory_)) {
+    *error = "Cannot create output directory " + output_directory_;
+    return false;
+  }
+
+  TileImages tile_images;
+  FindTileImages(&tile_images);
+  for (TileImages::iterator it = tile_images.begin();
+       it != tile_images.end();) {
+    if (it->second.back() < first_image) {
+      tile_images.erase(it++);
+    } else {
+      ++it;
+    }
+  }
+
+  // The level 0 tiles written before.
+  TileSet old_tiles;
+  for (int x = 0; x < NumColumns(0); ++x) {
+    if (FileExists(GetTileFilename(0, make_pair(0, x)))) {
+      old_tiles.insert(make_pair(0, x));
+    }
+  }
+
+  ThreadPool pool(num_threads_);
+  TileSet tiles;
+  if (!BuildLeaves(tile_images, &pool, &tiles, error) ||
+      !BuildAncestors(true, &pool, &tiles, error)) {
+    return false;
+  }
+  if (includes(old_tiles.begin(), old_tiles.end(), tiles.begin(),
+               tiles.end())) {
+    return true;
+  }
+  tiles.insert(old_tiles.begin(), old_tiles.end());
+  return WriteRootKml(tiles, error);
+}
+
+bool Mosaic::BuildLeaves(const TileImages &tile_images, ThreadPool *pool,
+                         TileSet *tiles, string *error) const {
+  ImageCache cache(reader_, cache_bytes_);
+  BuildStatus status;
+  for (TileImages::const_iterator it = tile_images.begin();
+       it != tile_images.end(); ++it) {
+    pool->Add(new LeafTask(this, it->first.second, it->first.first,
+                           &it->second, &cache, &status));
+  }
+  pool->Wait();
+  if (status.failed()) {
+    *error = status.error();
+    return false;
+  }
+  *tiles = status.tiles();
+  return true;
+}
+
+// Each tile of a level is the parent of the tiles of the level below whose
+// coordinates halve to its own.
+bool Mosaic::BuildAncestors(bool keep_existing, ThreadPool *pool,
+                            TileSet *tiles, string *error) const {
+  for (int level = max_level_ - 1; level >= 0; --level) {
+    map<pair<int, int>, TileSet> parents;
+    for (TileSet::const_iterator it = tiles->begin(); it != tiles->end();
+         ++it) {
+      parents[make_pair(it->first / 2, it->second / 2)].insert(*it);
+    }
+    if (keep_existing) {
+      for (map<pair<int, int>, TileSet>::iterator it = parents.begin();
+           it != parents.end(); ++it) {
+        for (int k = 0; k < 4; ++k) {
+          int child_x = 2 * it->first.second + k % 2;
+          int child_y = 2 * it->first.first + k / 2;
+          if (FileExists(GetTileFilename(level + 1,
+                                         make_pair(child_y, child_x)))) {
+            it->second.insert(make_pair(child_y, child_x));
+          }
+        }
+      }
+    }
+
+    if (!BuildParentTiles(this, level, parents, pool, tiles, error)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Only the images whose bounding boxes overlap the tile are sampled.
+bool Mosaic::RenderTile(int x, int y, Image *tile, string *error) const {
+  CHECK(x >= 0 && x < NumColumns(max_level_) && y >= 0 &&
+        y < NumRows(max_level_)) << "Bad tile " << x << ", " << y;
+  vector<int> indexes;
+  for (int k = 0; k < num_images(); ++k) {
+    int i1, i2, j1, j2;
+    if (FindPixelRange(images_[k], x, y, &i1, &i2, &j1, &j2)) {
+      indexes.push_back(k);
+    }
+  }
+  ImageCache cache(reader_, cache_bytes_);
+  return RenderTileFromImages(x, y, indexes, &cache, tile, error);
+}
+
+// The pixel centers of FITS images are at integer coordinates counting
+// from 1.
+bool Mosaic::FindImagePixel(const WcsProjection &wcs, int width, int height,
+                            SkyProjection::ImageOrigin origin, double ra,
+                            double dec, int *m, int *n) {
+  double x;
+  double y;
+  if (!wcs.ToPixel(ra, dec, &x, &y)) {
+    return false;
+  }
+  x -= 1.0;
+  if (origin == SkyProjection::LOWER_LEFT) {
+    y = height - y;
+  } else {
+    y -= 1.0;
+  }
+  *m = min(Round(x), width - 1);
+  *n = min(Round(y), height - 1);
+  return *m >= 0 && *n >= 0;
+}
+
+// Each 2 x 2 block of the child is averaged with colors weighted by alpha.
+void Mosaic::DownsampleInto(const Image &child, int offset_x, int offset_y,
+                            Image *tile) {
+  int half = child.width() / 2;
+  for (int j = 0; j < half; ++j) {
+    const uint8 *row1 = child.GetRow(2 * j);
+    const uint8 *row2 = child.GetRow(2 * j + 1);
+    uint8 *out = tile->GetMutableRow(offset_y + j) + 4 * offset_x;
+    for (int i = 0; i < half; ++i) {
+      const uint8 *pixels[4] = { row1 + 8 * i, row1 + 8 * i + 4,
+                                 row2 + 8 * i, row2 + 8 * i + 4 };
+      int alpha = 0;
+      int sums[3] = { 0, 0, 0 };
+      for (int k = 0; k < 4; ++k) {
+        alpha += pixels[k][3];
+        for (int c = 0; c < 3; ++c) {
+          sums[c] += pixels[k][c] * pixels[k][3];
+        }
+      }
+      if (alpha == 0) continue;
+      for (int c = 0; c < 3; ++c) {
+        out[4 * i + c] = static_cast<uint8>((sums[c] + alpha / 2) / alpha);
+      }
+      out[4 * i + 3] = static_cast<uint8>((alpha + 2) / 4);
+    }
+  }
+}
+
+void Mosaic::GetTileBounds(int level, int x, int y, double *ra_min,
+                           double *ra_max, double *dec_min,
+                           double *dec_max) {
+  double size = 180.0 / NumRows(level);
+  *ra_max = 360.0 - x * size;
+  *ra_min = *ra_max - size;
+  *dec_max = 90.0 - y * size;
+  *dec_min = *dec_max - size;
+}
+
+string Mosaic::MakeFilenamePrefix(int level, int x, int y) const {
+  return StringPrintf("%s_%d_%d_%d", filename_prefix_.c_str(), level, x, y);
+}
+
+// A bounding box that passes ra = 360 is split into the part before 360 and
+// the part after 0.
+void Mosaic::FindTileImages(TileImages *tile_images) const {
+  int num_columns = NumColumns(max_level_);
+  int num_rows = NumRows(max_level_);
+  double size = 180.0 / num_rows;
+  for (int k = 0; k < num_images(); ++k) {
+    const Input &image = images_[k];
+    int y1 = Clamp(static_cast<int>(floor((90.0 - image.dec_max) / size)),
+                   0, num_rows - 1);
+    int y2 = Clamp(static_cast<int>(floor((90.0 - image.dec_min) / size)),
+                   0, num_rows - 1);
+
+    double ranges[2][2] = { { image.ra_min, min(image.ra_max, 360.0) },
+                            { 0.0, image.ra_max - 360.0 } };
+    for (int r = 0; r < 2; ++r) {
+      if (ranges[r][1] < ranges[r][0]) continue;
+      int x1 = Clamp(static_cast<int>(floor((360.0 - ranges[r][1]) / size)),
+                     0, num_columns - 1);
+      int x2 = Clamp(static_cast<int>(floor((360.0 - ranges[r][0]) / size)),
+                     0, num_columns - 1);
+      for (int y = y1; y <= y2; ++y) {
+        for (int x = x1; x <= x2; ++x) {
+          vector<int> &indexes = (*tile_images)[make_pair(y, x)];
+          if (indexes.empty() || indexes.back() != k) indexes.push_back(k);
+        }
+      }
+    }
+  }
+}
+
+// The tile covers ra from ra_max - size to ra_max, which is compared with
+// the image's range both as is and shifted by 360 since the image's range
+// may pass 360.
+bool Mosaic::FindPixelRange(const Input &image, int x, int y, int *i1,
+                            int *i2, int *j1, int *j2) const {
+  double ra_min, ra_max, dec_min, dec_max;
+  GetTileBounds(max_level_, x, y, &ra_min, &ra_max, &dec_min, &dec_max);
+  double pixel = (ra_max - ra_min) / tile_size_;
+  int last = tile_size_ - 1;
+  if (image.dec_max < dec_min || image.dec_min > dec_max) return false;
+  *j1 = Clamp(static_cast<int>(floor((dec_max - image.dec_max) / pixel)),
+              0, last);
+  *j2 = Clamp(static_cast<int>(floor((dec_max - image.dec_min) / pixel)),
+              0, last);
+
+  *i1 = tile_size_;
+  *i2 = -1;
+  for (double shift = 0.0; shift <= 360.0; shift += 360.0) {
+    double low = max(ra_min + shift, image.ra_min);
+    double high = min(ra_max + shift, image.ra_max);
+    if (low > high) continue;
+    *i1 = min(*i1, Clamp(static_cast<int>(floor((ra_max + shift - high) /
+                                                pixel)), 0, last));
+    *i2 = max(*i2, Clamp(static_cast<int>(floor((ra_max + shift - low) /
+                                                pixel)), 0, last));
+  }
+  return *i1 <= *i2;
+}
+
+// Images are composited front to back, so the top image is sampled first
+// and pixels stop being sampled once they are opaque.  Colors are summed
+// premultiplied by alpha.  Tiles are rendered on several threads at once,
+// so each samples the images through its own copies of their WCS.
+bool Mosaic::RenderTileFromImages(int x, int y, const vector<int> &indexes,
+                                  ImageCache *cache, Image *tile,
+                                  string *error) const {
+  if (combine_ != BLEND) {
+    return CoaddTileFromImages(x, y, indexes, cache, tile, error);
+  }
+  double ra_min, ra_max, dec_min, dec_max;
+  GetTileBounds(max_level_, x, y, &ra_min, &ra_max, &dec_min, &dec_max);
+  double pixel = (ra_max - ra_min) / tile_size_;
+  vector<float> sums(4 * tile_size_ * tile_size_, 0.0f);
+  WcsProjectionCopies copies;
+
+  for (int k = static_cast<int>(indexes.size()) - 1; k >= 0; --k) {
+    const Input &input = images_[indexes[k]];
+    int i1, i2, j1, j2;
+    if (!FindPixelRange(input, x, y, &i1, &i2, &j1, &j2)) continue;
+    const Image *image = AcquireImage(indexes[k], cache, error);
+    if (image == NULL) return false;
+    const WcsProjection &wcs = copies.Add(*input.wcs);
+
+    for (int j = j1; j <= j2; ++j) {
+      double dec = dec_max - (j + 0.5) * pixel;
+      float *sum = &sums[4 * (j * tile_size_ + i1)];
+      for (int i = i1; i <= i2; ++i, sum += 4) {
+        if (sum[3] >= OPAQUE_WEIGHT) continue;
+        double ra = ra_max - (i + 0.5) * pixel;
+        int m, n;
+        if (!FindImagePixel(wcs, input.width, input.height, image_origin_,
+                            ra, dec, &m, &n)) {
+          continue;
+        }
+        const uint8 *value = image->GetRow(n) + 4 * m;
+        if (value[3] == 0) continue;
+        float weight = (value[3] / 255.0f) * (1.0f - sum[3]);
+        sum[0] += weight * value[0];
+        sum[1] += weight * value[1];
+        sum[2] += weight * value[2];
+        sum[3] += weight;
+      }
+    }
+    cache->Release(indexes[k]);
+  }
+
+  tile->Resize(tile_size_, tile_size_, Image::RGBA);
+  for (int j = 0; j < tile_size_; ++j) {
+    uint8 *out = tile->GetMutableRow(j);
+    const float *sum = &sums[4 * j * tile_size_];
+    for (int i = 0; i < tile_size_; ++i, out += 4, sum += 4) {
+      if (sum[3] <= 0.0f) {
+        out[0] = out[1] = out[2] = out[3] = 0;
+        continue;
+      }
+      for (int c = 0; c < 3; ++c) {
+        out[c] = static_cast<uint8>(min(255, Round(sum[c] / sum[3])));
+      }
+      out[3] = static_cast<uint8>(min(255, Round(255.0f * sum[3])));
+    }
+  }
+  return true;
+}
+
+// The images are sampled at the same pixel centers as for blending, once
+// per pass of the co-add.  Only the Coadd's state for the one tile is kept
+// between images.
+bool Mosaic::CoaddTileFromImages(int x, int y, const vector<int> &indexes,
+                                 ImageCache *cache, Image *tile,
+                                 string *error) const {
+  double ra_min, ra_max, dec_min, dec_max;
+  GetTileBounds(max_level_, x, y, &ra_min, &ra_max, &dec_min, &dec_max);
+  double pixel = (ra_max - ra_min) / tile_size_;
+  Coadd::Method method = Coadd::MEAN;
+  if (combine_ == MEDIAN) {
+    method = Coadd::MEDIAN;
+  } else if (combine_ == SIGMA_CLIP) {
+    method = Coadd::SIGMA_CLIP;
+  }
+  Coadd coadd(method, tile_size_, tile_size_);
+  coadd.set_clip_sigma(clip_sigma_);
+  coadd.set_clip_iterations(clip_iterations_);
+  WcsProjectionCopies copies;
+  for (size_t k = 0; k < indexes.size(); ++k) {
+    copies.Add(*images_[indexes[k]].wcs);
+  }
+
+  for (int pass = 0; pass < coadd.num_passes(); ++pass) {
+    coadd.StartPass(pass);
+    for (size_t k = 0; k < indexes.size(); ++k) {
+      const Input &input = images_[indexes[k]];
+      int i1, i2, j1, j2;
+      if (!FindPixelRange(input, x, y, &i1, &i2, &j1, &j2)) continue;
+      const Image *image = AcquireImage(indexes[k], cache, error);
+      if (image == NULL) return false;
+
+      for (int j = j1; j <= j2; ++j) {
+        double dec = dec_max - (j + 0.5) * pixel;
+        for (int i = i1; i <= i2; ++i) {
+          double ra = ra_max - (i + 0.5) * pixel;
+          int m, n;
+          if (FindImagePixel(copies[k], input.width, input.height,
+                             image_origin_, ra, dec, &m, &n)) {
+            coadd.Add(i, j, image->GetRow(n) + 4 * m);
+          }
+        }
+      }
+      cache->Release(indexes[k]);
+    }
+  }
+  coadd.ToImage(tile);
+  return true;
+}
+
+const Image *Mosaic::AcquireImage(int index, ImageCache *cache,
+                                  string *error) const {
+  const Input &input = images_[index];
+  const Image *image = cache->Acquire(index, error);
+  if (image == NULL) return NULL;
+  if (image->width() != input.width || image->height() != input.height) {
+    *error = StringPrintf("Image %d is %d x %d but should be %d x %d",
+                          index, image->width(), image->height(),
+                          input.width, input.height);
+    cache->Release(index);
+    return NULL;
+  }
+  return image;
+}
+
+int Mosaic::GetTileSize(void) const {
+  return tile_size_;
+}
+
+string Mosaic::GetTileFilename(int level, const pair<int, int> &key) const {
+  return output_directory_ + "/" +
+         MakeFilenamePrefix(level, key.second, key.first) + ".png";
+}
+
+bool Mosaic::WriteTile(int level, const pair<int, int> &key,
+                       const TileSet &children, Image *tile,
+                       string *error) const {
+  int x = key.second;
+  int y = key.first;
+  string prefix = output_directory_ + "/" + MakeFilenamePrefix(level, x, y);
+  if (!WriteTileImage(prefix + ".png", tile, error)) return false;
+  if (!xyz_directory_.empty() &&
+      !XyzPyramid::LinkTile(prefix + ".png", xyz_directory_, level, x, y,
+                            error)) {
+    return false;
+  }
+
+  Kml kml;
+  MakeTileKml(level, x, y, children, &kml);
+  FILE *fp = fopen((prefix + ".kml").c_str(), "w");
+  if (!fp) {
+    *error = "Can't open file " + prefix + ".kml for writing";
+    return false;
+  }
+  fprintf(fp, "%s", kml.ToString().c_str());
+  fclose(fp);
+  return true;
+}
+
+// Tiles line up with the 0-360 boundary, so their bounds never wrap.
+void Mosaic::MakeTileKml(int level, int x, int y, const TileSet &children,
+                         Kml *kml) const {
+  double ra_min, ra_max, dec_min, dec_max;
+  GetTileBounds(level, x, y, &ra_min, &ra_max, &dec_min, &dec_max);
+  double east = ra_max - 180.0;
+  double west = ra_min - 180.0;
+
+  KmlLatLonAltBox lat_lon_alt_box;
+  lat_lon_alt_box.north.set(dec_max);
+  lat_lon_alt_box.south.set(dec_min);
+  lat_lon_alt_box.east.set(east);
+  lat_lon_alt_box.west.set(west);
+
+  KmlLod lod;
+  if (level == 0) {
+    lod.min_lod_pixels.set(0);
+    lod.max_lod_pixels.set(-1);
+  } else {
+    lod.min_lod_pixels.set(min_lod_pixels_);
+    lod.max_lod_pixels.set(max_lod_pixels_);
+  }
+
+  KmlRegion region;
+  region.lat_lon_alt_box.set(lat_lon_alt_box);
+  region.lod.set(lod);
+
+  KmlIcon icon;
+  icon.href.set(MakeFilenamePrefix(level, x, y) + ".png");
+
+  KmlGroundOverlay ground_overlay;
+  ground_overlay.draw_order.set(level + top_level_draw_order_);
+  ground_overlay.icon.set(icon);
+  ground_overlay.lat_lon_box.set(lat_lon_alt_box);
+
+  kml->region.set(region);
+  kml->AddGroundOverlay(ground_overlay);
+
+  if (draw_tile_borders_) {
+    KmlLineString line_string;
+    line_string.AddCoordinate(east, dec_max);
+    line_string.AddCoordinate(west, dec_max);
+    line_string.AddCoordinate(west, dec_min);
+    line_string.AddCoordinate(east, dec_min);
+    line_string.AddCoordinate(east, dec_max);
+
+    KmlPlacemark placemark;
+    placemark.line_string.set(line_string);
+    kml->AddPlacemark(placemark);
+  }
+
+  for (TileSet::const_iterator it = children.begin(); it != children.end();
+       ++it) {
+    kml->AddNetworkLink(MakeNetworkLink(level + 1, it->second, it->first));
+  }
+}
+
+KmlNetworkLink Mosaic::MakeNetworkLink(int level, int x, int y) const {
+  double ra_min, ra_max, dec_min, dec_max;
+  GetTileBounds(level, x, y, &ra_min, &ra_max, &dec_min, &dec_max);
+
+  KmlLatLonAltBox lat_lon_alt_box;
+  lat_lon_alt_box.north.set(dec_max);
+  lat_lon_alt_box.south.set(dec_min);
+  lat_lon_alt_box.east.set(ra_max - 180.0);
+  lat_lon_alt_box.west.set(ra_min - 180.0);
+
+  KmlLod lod;
+  if (level == 0) {
+    lod.min_lod_pixels.set(0);
+    lod.max_lod_pixels.set(-1);
+  } else {
+    lod.min_lod_pixels.set(min_lod_pixels_);
+    lod.max_lod_pixels.set(max_lod_pixels_);
+  }
+
+  KmlRegion region;
+  region.lat_lon_alt_box.set(lat_lon_alt_box);
+  region.lod.set(lod);
+
+  KmlLink link;
+  link.href.set(MakeFilenamePrefix(level, x, y) + ".kml");
+
+  KmlNetworkLink network_link;
+  network_link.region.set(region);
+  network_link.link.set(link);
+  return network_link;
+}
+
+// The root KML lives above the tile directory.
+bool Mosaic::WriteRootKml(const TileSet &tiles, string *error) const {
+  Kml kml;
+  for (TileSet::const_iterator it = tiles.begin(); it != tiles.end(); ++it) {
+    KmlNetworkLink network_link = MakeNetworkLink(0, it->second, it->first);
+    KmlLink link = network_link.link.get();
+    link.href.set(output_directory_ + "/" + link.href.get());
+    network_link.link.set(link);
+    kml.AddNetworkLink(network_link);
+  }
+
+  FILE *fp = fopen(root_kml_.c_str(), "w");
+  if (!fp) {
+    *error = "Can't open file " + root_kml_ + " for writing";
+    return false;
+  }
+  fprintf(fp, "%s", kml.ToString().c_str());
+  fclose(fp);
+  return true;
+}
+
+}  // namespace google_sky
@@ -0,0 +1,504 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// Defines the Mosaic class for warping many images onto one tile pyramid
+
+#ifndef MOSAIC_H__
+#define MOSAIC_H__
+
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "base.h"
+#include "image.h"
+#include "skyprojection.h"
+#include "tilepyramid.h"
+
+namespace google_sky {
+
+// Forward declarations.
+class ImageCache;
+class Kml;
+class KmlNetworkLink;
+class ThreadPool;
+class WcsProjection;
+
+// Interface for reading the pixels of the images in a Mosaic
+//
+// A mosaic can have far more images than fit in memory, so it only reads
+// the images that overlap the tiles it is working on.
+class MosaicImageReader {
+ public:
+  virtual ~MosaicImageReader() {
+    // Nothing needed.
+  }
+
+  // Reads the image with the given index, counting in the order the images
+  // were added to the mosaic, as RGBA.  Pixels that shouldn't be drawn must
+  // have an alpha of 0.  Returns false with a description of the problem in
+  // error on failure.  This is called from several threads at once.
+  virtual bool ReadImage(int index, Image *image, string *error) = 0;
+};
+
+// Class for warping many images onto a single global tile pyramid
+//
+// Warping each image of a survey separately gives one GroundOverlay per
+// image, each on its own lat-lon grid, which Earth has to draw one by one
+// where they overlap.  A Mosaic instead warps every image directly onto a
+// fixed grid covering the whole sky and writes one regionated pyramid.
+//
+// At level L the grid has 2^(L + 1) columns and 2^L rows of square tiles,
+// each covering 180 / 2^L degrees.  Column 0 starts at ra = 360 and row 0
+// at dec = 90, so as with SkyProjection ra decreases to the right.  Tiles
+// of the finest level (max_level()) are warped from the images that
+// overlap them, which are found from their bounding boxes.  Where images
+// overlap they are alpha blended, with images added later drawn on top, or
+// co-added (see combine()).
+// Each coarser level is then made by downsampling the level below it.
+// Tiles are made in parallel, and only the images overlapping the tiles in
+// progress are kept in memory, up to cache_bytes() of them.  Tiles that no
+// image touches aren't written.
+//
+// The output is laid out like that of a Regionator: every tile has a PNG
+// and a KML file named <filename_prefix>_<level>_<x>_<y> in
+// output_directory(), and root_kml() links to the level 0 tiles.  The grid
+// is that of an XyzPyramid, so the tiles can also be placed in an XYZ
+// pyramid for web map viewers as they are written.
+//
+// Example Usage:
+//
+// // reader reads the pixels of each image when they are needed.
+// Mosaic mosaic(&reader);
+// for (int i = 0; i < num_images; ++i) {
+//   mosaic.AddImage(WcsProjection::FromHeader(headers[i]), widths[i],
+//                   heights[i]);
+// }
+//
+// // Use tiles about as fine as the pixels of the images.
+// mosaic.set_max_level(mosaic.FindNativeLevel());
+// mosaic.set_output_directory("tiles");
+// mosaic.set_root_kml("mosaic.kml");
+//
+// string error;
+// if (!mosaic.Build(&error)) {
+//   fprintf(stderr, "%s\n", error.c_str());
+// }
+
+class Mosaic : public TilePyramidWriter<pair<int, int> > {
+ public:
+  // The finest level allowed, which keeps pixel indexes of the whole grid
+  // within an int for tiles of up to 512 pixels.
+  static const int MAX_LEVEL = 20;
+
+  // Ways of combining images where they overlap.  BLEND draws images added
+  // later on top; the others co-add the images with the Coadd method of the
+  // same name, so that e.g. a satellite trail in one exposure is outvoted
+  // by the others.
+  enum Combine {
+    BLEND = 0,
+    MEAN,
+    MEDIAN,
+    SIGMA_CLIP
+  };
+
+  // Creates an empty mosaic whose images are read with reader, which must
+  // outlive the mosaic.
+  explicit Mosaic(MosaicImageReader *reader);
+
+  // Deletes the WCS of each image.
+  ~Mosaic();
+
+  // Adds an image of the given size placed on the sky by wcs.  The mosaic
+  // takes ownership of wcs.  Images added later are drawn on top of those
+  // added earlier.
+  void AddImage(WcsProjection *wcs, int width, int height);
+
+  // Returns the number of images added.
+  inline int num_images(void) const {
+    return static_cast<int>(images_.size());
+  }
+
+  // Returns the coarsest level whose pixels are no larger than the pixels
+  // of the median image, i.e. the level that keeps the resolution of most
+  // of the images.
+  int FindNativeLevel(void) const;
+
+  // Warps the images onto the tiles of max_level(), builds the coarser
+  // levels, and writes the tiles and the root KML.  Returns false with a
+  // description of the problem in error if an image can't be read or a file
+  // can't be written.
+  bool Build(string *error) const;
+
+  // Updates a pyramid written by Build() in output_directory() after
+  // images first_image and later were added, e.g. for new exposures of a
+  // field that was already mosaicked.  Only the tiles of max_level() that
+  // the new images' bounding boxes overlap are warped again, from every
+  // image overlapping them, and then their ancestors are rebuilt from the
+  // tiles below them.  All other tiles and their KML are left alone, and
+  // the root KML is only rewritten if a new level 0 tile was made.  The
+  // pyramid must have been built with the same max_level(), tile_size(),
+  // and filename_prefix().  Returns false with a description of the
+  // problem in error on failure, as for Build().
+  bool Insert(int first_image, string *error) const;
+
+  // Renders tile (x, y) of max_level() from the images overlapping it.  The
+  // tile is transparent wherever no image covers it.  Returns false with a
+  // description of the problem in error if an image can't be read.
+  bool RenderTile(int x, int y, Image *tile, string *error) const;
+
+  // Returns the ra and dec ranges covered by tile (x, y) of level.
+  static void GetTileBounds(int level, int x, int y, double *ra_min,
+                            double *ra_max, double *dec_min,
+                            double *dec_max);
+
+  // Returns the number of columns of tiles at level.
+  static inline int NumColumns(int level) {
+    return 2 << level;
+  }
+
+  // Returns the number of rows of tiles at level.
+  static inline int NumRows(int level) {
+    return 1 << level;
+  }
+
+  // Returns the name of the files of tile (x, y) of level without the
+  // extension, e.g. "tile_3_10_2".
+  string MakeFilenamePrefix(int level, int x, int y) const;
+
+  // Finds the pixel (m, n) of a width x height image placed on the sky by
+  // wcs to sample at ra, dec, as SkyProjection does.  Returns false if the
+  // point lies outside of the image.
+  static bool FindImagePixel(const WcsProjection &wcs, int width,
+                             int height, SkyProjection::ImageOrigin origin,
+                             double ra, double dec, int *m, int *n);
+
+  // Downsamples an RGBA tile by 2 into the quadrant of the RGBA tile of
+  // the level above it starting at pixel (offset_x, offset_y), averaging
+  // colors weighted by alpha.
+  static void DownsampleInto(const Image &child, int offset_x, int offset_y,
+                             Image *tile);
+
+  // Returns the side length of the tiles in pixels.
+  inline int tile_size(void) const {
+    return tile_size_;
+  }
+
+  // Sets the side length of the tiles in pixels, 256 by default.  The side
+  // length must be even and at most 512.
+  inline void set_tile_size(int tile_size) {
+    CHECK(tile_size > 1 && tile_size <= 512 && tile_size % 2 == 0)
+        << "Bad tile size " << tile_size;
+    tile_size_ = tile_size;
+  }
+
+  // Returns the finest level of the pyramid.
+  inline int max_level(void) const {
+    return max_level_;
+  }
+
+  // Sets the finest level of the pyramid, 0 by default.
+  inline void set_max_level(int max_level) {
+    CHECK(max_level >= 0 && max_level <= MAX_LEVEL)
+        << "Bad mosaic level " << max_level;
+    max_level_ = max_level;
+  }
+
+  // Returns the origin of the pixels of the images.
+  inline SkyProjection::ImageOrigin image_origin(void) const {
+    return image_origin_;
+  }
+
+  // Sets the origin of the pixels of the images, LOWER_LEFT by default as
+  // for FITS images.  See SkyProjection::ImageOrigin.
+  inline void set_image_origin(SkyProjection::ImageOrigin image_origin) {
+    image_origin_ = image_origin;
+  }
+
+  // Returns the number of threads used by Build().
+  inline int num_threads(void) const {
+    return num_threads_;
+  }
+
+  // Sets the number of threads used by Build(), which defaults to
+  // ThreadPool::DefaultNumThreads().
+  inline void set_num_threads(int num_threads) {
+    num_threads_ = num_threads;
+  }
+
+  // Returns how overlapping images are combined.
+  inline Combine combine(void) const {
+    return combine_;
+  }
+
+  // Sets how overlapping images are combined, BLEND by default.
+  inline void set_combine(Combine combine) {
+    combine_ = combine;
+  }
+
+  // Returns the number of standard deviations beyond which SIGMA_CLIP
+  // rejects samples.
+  inline double clip_sigma(void) const {
+    return clip_sigma_;
+  }
+
+  // Sets the number of standard deviations beyond which SIGMA_CLIP rejects
+  // samples, 3 by default.
+  inline void set_clip_sigma(double clip_sigma) {
+    clip_sigma_ = clip_sigma;
+  }
+
+  // Returns the number of times SIGMA_CLIP clips the samples.
+  inline int clip_iterations(void) const {
+    return clip_iterations_;
+  }
+
+  // Sets the number of times SIGMA_CLIP clips the samples, 2 by default.
+  // The images of each tile are read once per iteration plus once more,
+  // so they should fit within cache_bytes().
+  inline void set_clip_iterations(int clip_iterations) {
+    CHECK_GTE(clip_iterations, 0);
+    clip_iterations_ = clip_iterations;
+  }
+
+  // Returns the most memory in bytes used for the images being warped.
+  inline int64 cache_bytes(void) const {
+    return cache_bytes_;
+  }
+
+  // Sets the most memory in bytes used for the images being warped, which
+  // defaults to MemoryBudget::DefaultLimit().  Images needed by the tiles
+  // in progress are kept even if they don't fit.
+  inline void set_cache_bytes(int64 cache_bytes) {
+    cache_bytes_ = cache_bytes;
+  }
+
+  // Returns the prefix of the tile files.
+  inline const string &filename_prefix(void) const {
+    return filename_prefix_;
+  }
+
+  // Sets the prefix of the tile files, "tile" by default.
+  inline void set_filename_prefix(const string &filename_prefix) {
+    filename_prefix_ = filename_prefix;
+  }
+
+  // Returns the directory of the tile files.
+  inline const string &output_directory(void) const {
+    return output_directory_;
+  }
+
+  // Sets the directory of the tile files, "tiles" by default.
+  inline void set_output_directory(const string &output_directory) {
+    output_directory_ = output_directory;
+  }
+
+  // Returns the name of the root KML file.
+  inline const string &root_kml(void) const {
+    return root_kml_;
+  }
+
+  // Sets the name of the root KML file, "root.kml" by default.
+  inline void set_root_kml(const string &root_kml) {
+    root_kml_ = root_kml;
+  }
+
+  // Returns the directory of the XYZ pyramid that the tiles are also
+  // placed in, or "" if there is none.
+  inline const string &xyz_directory(void) const {
+    return xyz_directory_;
+  }
+
+  // Sets a directory to also place every tile in as an XYZ pyramid for web
+  // map viewers, or "" (the default) for none.  Levels are zooms and the
+  // tiles are hard linked to those of output_directory(), so both stay the
+  // same through Insert().  See XyzPyramid::LinkTile().  Web map viewers
+  // expect a tile_size() of 256 or 512.
+  inline void set_xyz_directory(const string &xyz_directory) {
+    xyz_directory_ = xyz_directory;
+  }
+
+  // Returns whether tile borders will be drawn.
+  inline bool draw_tile_borders(void) const {
+    return draw_tile_borders_;
+  }
+
+  // Sets whether to draw tile borders.
+  inline void set_draw_tile_borders(bool draw_tile_borders) {
+    draw_tile_borders_ = draw_tile_borders;
+  }
+
+  // Returns the min_lod_pixel value used by each tile below level 0.
+  inline int min_lod_pixels(void) const {
+    return min_lod_pixels_;
+  }
+
+  // Sets the min_lod_pixel value used by each tile below level 0.
+  inline void set_min_lod_pixels(int min_lod_pixels) {
+    min_lod_pixels_ = min_lod_pixels;
+  }
+
+  // Returns the max_lod_pixel value used by each tile below level 0.
+  inline int max_lod_pixels(void) const {
+    return max_lod_pixels_;
+  }
+
+  // Sets the max_lod_pixel value used by each tile below level 0.
+  inline void set_max_lod_pixels(int max_lod_pixels) {
+    max_lod_pixels_ = max_lod_pixels;
+  }
+
+  // Returns the draw order of the level 0 tiles.
+  inline int top_level_draw_order(void) const {
+    return top_level_draw_order_;
+  }
+
+  // Sets the draw order of the level 0 tiles.  Each finer level is drawn
+  // one higher.
+  inline void set_top_level_draw_order(int top_level_draw_order) {
+    top_level_draw_order_ = top_level_draw_order;
+  }
+
+ private:
+  class LeafTask;
+
+  // Tiles of one level as (y, x) pairs, which orders them by row.
+  typedef set<pair<int, int> > TileSet;
+
+  // Collects the tiles written by a level of Build() and the first error.
+  typedef TileBuildStatus<pair<int, int> > BuildStatus;
+
+  // Images overlapping each tile of max_level_, in the order they were
+  // added, keyed like TileSet.
+  typedef map<pair<int, int>, vector<int> > TileImages;
+
+  // An image of the mosaic and the extent of its bounding box.  ra_max may
+  // be past 360 for images that wrap around.
+  struct Input {
+    WcsProjection *wcs;
+    int width;
+    int height;
+    double ra_min;
+    double ra_max;
+    double dec_min;
+    double dec_max;
+    double pixel_scale;  // Degrees per pixel near the center.
+  };
+
+  MosaicImageReader *reader_;
+  vector<Input> images_;
+
+  int tile_size_;
+  int max_level_;
+  SkyProjection::ImageOrigin image_origin_;
+  int num_threads_;
+  Combine combine_;
+  double clip_sigma_;
+  int clip_iterations_;
+  int64 cache_bytes_;
+
+  string filename_prefix_;
+  string output_directory_;
+  string root_kml_;
+  string xyz_directory_;
+  bool draw_tile_borders_;
+  int min_lod_pixels_;
+  int max_lod_pixels_;
+  int top_level_draw_order_;
+
+  // Finds the tiles of max_level_ that each image overlaps.
+  void FindTileImages(TileImages *tile_images) const;
+
+  // Warps the given tiles of max_level_ and writes them, returning the
+  // ones that weren't empty in tiles.
+  bool BuildLeaves(const TileImages &tile_images, ThreadPool *pool,
+                   TileSet *tiles, string *error) const;
+
+  // Rebuilds the ancestors of tiles, a set of tiles of max_level_, level by
+  // level, returning the level 0 tiles in tiles.  With keep_existing, the
+  // tiles already in output_directory_ beside the rebuilt ones are kept as
+  // children too.
+  bool BuildAncestors(bool keep_existing, ThreadPool *pool, TileSet *tiles,
+                      string *error) const;
+
+  // Finds the range of pixels of tile (x, y) of max_level_ that image
+  // overlaps.  Returns false if there are none.
+  bool FindPixelRange(const Input &image, int x, int y, int *i1, int *i2,
+                      int *j1, int *j2) const;
+
+  // Renders tile (x, y) of max_level_ from the given images, reading them
+  // through cache.
+  bool RenderTileFromImages(int x, int y, const vector<int> &indexes,
+                            ImageCache *cache, Image *tile,
+                            string *error) const;
+
+  // Renders tile (x, y) of max_level_ like RenderTileFromImages(), but
+  // co-adds the images instead of blending them.
+  bool CoaddTileFromImages(int x, int y, const vector<int> &indexes,
+                           ImageCache *cache, Image *tile,
+                           string *error) const;
+
+  // Reads image index through cache and checks its size.  Returns NULL
+  // with a description of the problem in error on failure.  The image must
+  // be released through cache otherwise.
+  const Image *AcquireImage(int index, ImageCache *cache,
+                            string *error) const;
+
+  virtual int GetTileSize(void) const;
+
+  virtual string GetTileFilename(int level,
+                                 const pair<int, int> &key) const;
+
+  // Writes the PNG and KML of tile (x, y) of level, which is keyed by
+  // (y, x).  children holds the tiles of level + 1 that exist below it.
+  virtual bool WriteTile(int level, const pair<int, int> &key,
+                         const TileSet &children, Image *tile,
+                         string *error) const;
+
+  // Makes the KML of tile (x, y) of level, linking to children.
+  void MakeTileKml(int level, int x, int y, const TileSet &children,
+                   Kml *kml) const;
+
+  // Makes a link to tile (x, y) of level, which is always visible at level
+  // 0 and otherwise uses the Lod values.
+  KmlNetworkLink MakeNetworkLink(int level, int x, int y) const;
+
+  // Writes the root KML, which links to the given level 0 tiles.
+  bool WriteRootKml(const TileSet &tiles, string *error) const;
+
+  // A Mosaic must be created with a reader.
+  Mosaic();
+
+  DISALLOW_COPY_AND_ASSIGN(Mosaic);
+};
+
+}  // namespace google_sky
+
+#endif  // MOSAIC_H__
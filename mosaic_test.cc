@@ -0,0 +1,383 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "base.h"
+#include "color.h"
+#include "file_util.h"
+#include "image.h"
+#include "mosaic.h"
+#include "string_util.h"
+#include "test_util.h"
+#include "wcsprojection.h"
+
+namespace google_sky {
+
+// Returns the pixel of tile (x, y) of level containing ra, dec.
+void FindTilePixel(int level, int tile_size, double ra, double dec, int *x,
+                   int *y, int *i, int *j) {
+  double size = 180.0 / Mosaic::NumRows(level);
+  double column = (360.0 - ra) / size;
+  double row = (90.0 - dec) / size;
+  *x = static_cast<int>(floor(column));
+  *y = static_cast<int>(floor(row));
+  *i = static_cast<int>((column - *x) * tile_size);
+  *j = static_cast<int>((row - *y) * tile_size);
+}
+
+int Main(int argc, char **argv) {
+  // Test the tile grid.
+  {
+    cout << "Testing GetTileBounds()... ";
+    ASSERT_EQ(2, Mosaic::NumColumns(0));
+    ASSERT_EQ(1, Mosaic::NumRows(0));
+    ASSERT_EQ(16, Mosaic::NumColumns(3));
+    ASSERT_EQ(8, Mosaic::NumRows(3));
+
+    double ra_min, ra_max, dec_min, dec_max;
+    Mosaic::GetTileBounds(0, 0, 0, &ra_min, &ra_max, &dec_min, &dec_max);
+    ASSERT_TRUE(ra_min == 180.0 && ra_max == 360.0);
+    ASSERT_TRUE(dec_min == -90.0 && dec_max == 90.0);
+    Mosaic::GetTileBounds(2, 7, 3, &ra_min, &ra_max, &dec_min, &dec_max);
+    ASSERT_TRUE(ra_min == 0.0 && ra_max == 45.0);
+    ASSERT_TRUE(dec_min == -90.0 && dec_max == -45.0);
+    cout << "pass\n";
+  }
+
+  // Test FindNativeLevel().
+  {
+    cout << "Testing FindNativeLevel()... ";
+    SolidImageReader reader;
+    Mosaic mosaic(&reader);
+
+    // Level 12 has pixels of 0.63", level 11 of 1.27".
+    double arcsec = 1.0 / 3600.0;
+    mosaic.AddImage(WcsProjection::FromHeader(
+        MakeHeader(10.0, 20.0, 100, 100, arcsec)), 100, 100);
+    ASSERT_EQ(12, mosaic.FindNativeLevel());
+
+    // The median image decides.
+    mosaic.AddImage(WcsProjection::FromHeader(
+        MakeHeader(10.0, 20.0, 100, 100, 2.0 * arcsec)), 100, 100);
+    mosaic.AddImage(WcsProjection::FromHeader(
+        MakeHeader(10.0, 20.0, 100, 100, 2.0 * arcsec)), 100, 100);
+    ASSERT_EQ(11, mosaic.FindNativeLevel());
+    cout << "pass\n";
+  }
+
+  // Test RenderTile() with blending.
+  {
+    cout << "Testing RenderTile()... ";
+    SolidImageReader reader;
+    Mosaic mosaic(&reader);
+    mosaic.set_max_level(6);
+    mosaic.set_num_threads(1);
+
+    // Opaque red under half transparent blue, offset by half a degree.
+    reader.Add(100, 100, 255, 0, 0, 255);
+    mosaic.AddImage(WcsProjection::FromHeader(
+        MakeHeader(10.0, 20.0, 100, 100, 0.01)), 100, 100);
+    reader.Add(100, 100, 0, 0, 255, 128);
+    mosaic.AddImage(WcsProjection::FromHeader(
+        MakeHeader(10.5, 20.0, 100, 100, 0.01)), 100, 100);
+
+    int x, y, i, j;
+    FindTilePixel(6, 256, 9.8, 20.0, &x, &y, &i, &j);
+    Image tile;
+    string error;
+    ASSERT_TRUE(mosaic.RenderTile(x, y, &tile, &error));
+    ASSERT_EQ(256, tile.width());
+    ASSERT_EQ(256, tile.height());
+    ASSERT_TRUE(tile.colorspace() == Image::RGBA);
+
+    // Only the red image.
+    const uint8 *pixel = tile.GetRow(j) + 4 * i;
+    ASSERT_EQ(255, pixel[0]);
+    ASSERT_EQ(0, pixel[2]);
+    ASSERT_EQ(255, pixel[3]);
+
+    // Both images.
+    int overlap_x, overlap_y;
+    FindTilePixel(6, 256, 10.25, 20.0, &overlap_x, &overlap_y, &i, &j);
+    ASSERT_EQ(x, overlap_x);
+    ASSERT_EQ(y, overlap_y);
+    pixel = tile.GetRow(j) + 4 * i;
+    ASSERT_TRUE(abs(pixel[0] - 127) <= 1);
+    ASSERT_TRUE(abs(pixel[2] - 128) <= 1);
+    ASSERT_EQ(255, pixel[3]);
+
+    // Only the blue image.
+    FindTilePixel(6, 256, 10.9, 20.0, &overlap_x, &overlap_y, &i, &j);
+    ASSERT_EQ(x, overlap_x);
+    pixel = tile.GetRow(j) + 4 * i;
+    ASSERT_EQ(0, pixel[0]);
+    ASSERT_EQ(255, pixel[2]);
+    ASSERT_EQ(128, pixel[3]);
+
+    // Neither.
+    FindTilePixel(6, 256, 10.0, 21.0, &overlap_x, &overlap_y, &i, &j);
+    ASSERT_EQ(y, overlap_y);
+    pixel = tile.GetRow(j) + 4 * i;
+    ASSERT_EQ(0, pixel[3]);
+    cout << "pass\n";
+  }
+
+  // Test RenderTile() with co-adding.
+  {
+    cout << "Testing RenderTile() with MEDIAN... ";
+    SolidImageReader reader;
+    Mosaic mosaic(&reader);
+    mosaic.set_max_level(6);
+    mosaic.set_combine(Mosaic::MEDIAN);
+
+    // Three gray exposures of the same field and a bright one, which the
+    // median ignores however it is ordered.
+    int levels[] = { 100, 250, 110, 90 };
+    for (int k = 0; k < 4; ++k) {
+      reader.Add(100, 100, levels[k], levels[k], levels[k], 255);
+      mosaic.AddImage(WcsProjection::FromHeader(
+          MakeHeader(10.0, 20.0, 100, 100, 0.01)), 100, 100);
+    }
+
+    int x, y, i, j;
+    FindTilePixel(6, 256, 10.0, 20.0, &x, &y, &i, &j);
+    Image tile;
+    string error;
+    ASSERT_TRUE(mosaic.RenderTile(x, y, &tile, &error));
+    const uint8 *pixel = tile.GetRow(j) + 4 * i;
+    ASSERT_EQ(105, pixel[0]);
+    ASSERT_EQ(255, pixel[3]);
+
+    // Sigma clipping drops the bright exposure.
+    mosaic.set_combine(Mosaic::SIGMA_CLIP);
+    mosaic.set_clip_sigma(1.5);
+    ASSERT_TRUE(mosaic.RenderTile(x, y, &tile, &error));
+    pixel = tile.GetRow(j) + 4 * i;
+    ASSERT_EQ(100, pixel[0]);
+
+    // Outside the images.
+    FindTilePixel(6, 256, 10.0, 21.0, &x, &y, &i, &j);
+    pixel = tile.GetRow(j) + 4 * i;
+    ASSERT_EQ(0, pixel[3]);
+    cout << "pass\n";
+  }
+
+  // Test Build().
+  {
+    cout << "Testing Build()... ";
+    ASSERT_TRUE(system("rm -rf mosaic_tiles mosaic_test.kml") == 0);
+    SolidImageReader reader;
+    Mosaic mosaic(&reader);
+    mosaic.set_max_level(6);
+    mosaic.set_num_threads(4);
+    mosaic.set_cache_bytes(0);
+    mosaic.set_output_directory("mosaic_tiles");
+    mosaic.set_root_kml("mosaic_test.kml");
+
+    // A green image across ra = 0, which lands in the first and last
+    // columns.
+    reader.Add(100, 100, 0, 255, 0, 255);
+    mosaic.AddImage(WcsProjection::FromHeader(
+        MakeHeader(0.0, 0.0, 100, 100, 0.01)), 100, 100);
+    string error;
+    ASSERT_TRUE(mosaic.Build(&error));
+    ASSERT_TRUE(FileExists("mosaic_test.kml"));
+    ASSERT_TRUE(FileExists("mosaic_tiles/tile_6_0_31.png"));
+    ASSERT_TRUE(FileExists("mosaic_tiles/tile_6_0_31.kml"));
+    ASSERT_TRUE(FileExists("mosaic_tiles/tile_6_127_31.png"));
+    ASSERT_TRUE(FileExists("mosaic_tiles/tile_6_0_32.png"));
+    ASSERT_TRUE(FileExists("mosaic_tiles/tile_6_127_32.png"));
+    ASSERT_FALSE(FileExists("mosaic_tiles/tile_6_1_31.png"));
+    ASSERT_TRUE(FileExists("mosaic_tiles/tile_0_0_0.png"));
+    ASSERT_TRUE(FileExists("mosaic_tiles/tile_0_1_0.png"));
+
+    // Each level is downsampled from the one below it.
+    Image tile;
+    ASSERT_TRUE(tile.Read("mosaic_tiles/tile_5_0_15.png"));
+    ASSERT_TRUE(tile.colorspace() == Image::RGBA);
+    Color pixel(4);
+    tile.GetPixel(0, 255, &pixel);
+    ASSERT_EQ(0, pixel.GetChannel(0));
+    ASSERT_EQ(255, pixel.GetChannel(1));
+    ASSERT_EQ(255, pixel.GetChannel(3));
+    tile.GetPixel(255, 0, &pixel);
+    ASSERT_EQ(0, pixel.GetChannel(3));
+
+    // The root links to the level 0 tiles, which link to the level 1
+    // tiles.
+    string root = ReadFile("mosaic_test.kml");
+    ASSERT_TRUE(StringContains(root, "mosaic_tiles/tile_0_0_0.kml"));
+    ASSERT_TRUE(StringContains(root, "mosaic_tiles/tile_0_1_0.kml"));
+    string kml = ReadFile("mosaic_tiles/tile_0_0_0.kml");
+    ASSERT_TRUE(StringContains(kml, "tile_0_0_0.png"));
+    ASSERT_TRUE(StringContains(kml, "tile_1_0_0.kml"));
+    ASSERT_TRUE(StringContains(kml, "tile_1_0_1.kml"));
+    ASSERT_FALSE(StringContains(kml, "tile_1_1_0.kml"));
+
+    // Inserting a blue image far from the green one only rewrites the
+    // tiles it touches and their ancestors.
+    FILE *fp = fopen("mosaic_tiles/tile_6_0_31.kml", "w");
+    ASSERT_TRUE(fp != NULL);
+    fprintf(fp, "untouched");
+    fclose(fp);
+    fp = fopen("mosaic_test.kml", "w");
+    ASSERT_TRUE(fp != NULL);
+    fprintf(fp, "untouched");
+    fclose(fp);
+    ASSERT_TRUE(mosaic.Insert(1, &error));
+
+    reader.Add(100, 100, 0, 0, 255, 255);
+    mosaic.AddImage(WcsProjection::FromHeader(
+        MakeHeader(90.0, 0.0, 100, 100, 0.01)), 100, 100);
+    ASSERT_TRUE(mosaic.Insert(1, &error));
+    int x, y, i, j;
+    FindTilePixel(6, 256, 90.0, 0.0, &x, &y, &i, &j);
+    ASSERT_TRUE(FileExists(StringPrintf("mosaic_tiles/tile_6_%d_%d.png", x,
+                                        y)));
+    ASSERT_TRUE(ReadFile("mosaic_tiles/tile_6_0_31.kml") == "untouched");
+    ASSERT_TRUE(ReadFile("mosaic_test.kml") == "untouched");
+    kml = ReadFile(StringPrintf("mosaic_tiles/tile_5_%d_%d.kml", x / 2,
+                                y / 2));
+    ASSERT_TRUE(StringContains(kml, StringPrintf("tile_6_%d_%d.kml", x, y)));
+
+    // The level 0 tile holds both images.
+    ASSERT_TRUE(tile.Read("mosaic_tiles/tile_0_1_0.png"));
+    ASSERT_TRUE(tile.ConvertToRGBA());
+    FindTilePixel(0, 256, 90.0, 0.0, &x, &y, &i, &j);
+    tile.GetPixel(i, j, &pixel);
+    ASSERT_EQ(255, pixel.GetChannel(2));
+    ASSERT_TRUE(pixel.GetChannel(3) > 0);
+    FindTilePixel(0, 256, 0.3, 0.0, &x, &y, &i, &j);
+    tile.GetPixel(i, j, &pixel);
+    ASSERT_EQ(255, pixel.GetChannel(1));
+    ASSERT_TRUE(pixel.GetChannel(3) > 0);
+
+    // Failing to read an image fails the build.
+    reader.Add(100, 100, 0, 0, 0, -1);
+    mosaic.AddImage(WcsProjection::FromHeader(
+        MakeHeader(90.0, 0.0, 100, 100, 0.01)), 100, 100);
+    ASSERT_FALSE(mosaic.Build(&error));
+    ASSERT_TRUE(error == "Can't read image 2");
+
+    ASSERT_TRUE(system("rm -rf mosaic_tiles mosaic_test.kml") == 0);
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing Build() with several threads... ";
+    ASSERT_TRUE(system("rm -rf mosaic_serial mosaic_parallel "
+                       "mosaic_test.kml") == 0);
+
+    // Overlapping images make each leaf tile read several of them, and each
+    // image spans several tiles that render at the same time.
+    GradientImageReader reader;
+    vector<string> headers;
+    for (int k = 0; k < 4; ++k) {
+      reader.Add(200, 200);
+      headers.push_back(MakeHeader(30.0 + 0.5 * k, 10.0 + 0.3 * k, 200, 200,
+                                   0.01));
+    }
+    const char *directories[2] = { "mosaic_serial", "mosaic_parallel" };
+    for (int pass = 0; pass < 2; ++pass) {
+      Mosaic mosaic(&reader);
+      mosaic.set_max_level(8);
+      mosaic.set_num_threads(pass == 0 ? 1 : 8);
+      mosaic.set_cache_bytes(0);
+      mosaic.set_output_directory(directories[pass]);
+      mosaic.set_root_kml("mosaic_test.kml");
+      for (size_t k = 0; k < headers.size(); ++k) {
+        mosaic.AddImage(WcsProjection::FromHeader(headers[k]), 200, 200);
+      }
+      string error;
+      ASSERT_TRUE(mosaic.Build(&error));
+    }
+
+    // Every tile matches the one rendered on a single thread.
+    ASSERT_TRUE(system("diff -r mosaic_serial mosaic_parallel > /dev/null") ==
+                0);
+    ASSERT_TRUE(system("rm -rf mosaic_serial mosaic_parallel "
+                       "mosaic_test.kml") == 0);
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing set_xyz_directory()... ";
+    ASSERT_TRUE(system("rm -rf mosaic_tiles mosaic_xyz mosaic_test.kml") ==
+                0);
+    SolidImageReader reader;
+    Mosaic mosaic(&reader);
+    mosaic.set_max_level(3);
+    mosaic.set_num_threads(2);
+    mosaic.set_output_directory("mosaic_tiles");
+    mosaic.set_root_kml("mosaic_test.kml");
+    mosaic.set_xyz_directory("mosaic_xyz");
+    reader.Add(100, 100, 0, 255, 0, 255);
+    mosaic.AddImage(WcsProjection::FromHeader(
+        MakeHeader(100.0, 20.0, 100, 100, 0.01)), 100, 100);
+    string error;
+    ASSERT_TRUE(mosaic.Build(&error));
+
+    // Every tile is also at <level>/<x>/<y>.png.
+    for (int level = 0; level <= 3; ++level) {
+      int x, y, i, j;
+      FindTilePixel(level, 256, 100.0, 20.0, &x, &y, &i, &j);
+      string tile = ReadFile(StringPrintf("mosaic_tiles/tile_%d_%d_%d.png",
+                                          level, x, y));
+      ASSERT_TRUE(ReadFile(StringPrintf("mosaic_xyz/%d/%d/%d.png", level, x,
+                                        y)) == tile);
+    }
+
+    // Inserted images update both pyramids.
+    reader.Add(100, 100, 0, 0, 255, 255);
+    mosaic.AddImage(WcsProjection::FromHeader(
+        MakeHeader(100.2, 20.0, 100, 100, 0.01)), 100, 100);
+    ASSERT_TRUE(mosaic.Insert(1, &error));
+    ASSERT_TRUE(ReadFile("mosaic_xyz/0/1/0.png") ==
+                ReadFile("mosaic_tiles/tile_0_1_0.png"));
+
+    ASSERT_TRUE(system("rm -rf mosaic_tiles mosaic_xyz mosaic_test.kml") ==
+                0);
+    cout << "pass\n";
+  }
+
+  cout << "Passed\n";
+  return 0;
+}
+
+}  // namespace google_sky
+
+int main(int argc, char **argv) {
+  return google_sky::Main(argc, argv);
+}
@@ -0,0 +1,738 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "platesolver.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "base.h"
+#include "catalog.h"
+#include "fits.h"
+#include "fitsimage.h"
+#include "string_util.h"
+#include "threadpool.h"
+
+// findstar.c has no prototype in the libwcs headers.
+extern "C" int FindStars(char *header, char *image, double **xa, double **ya,
+                         double **ba, int **pa, int verbose, int zap);
+
+namespace {
+
+const double DEG_TO_RAD = google_sky::PI / 180.0;
+const double RAD_TO_DEG = 180.0 / google_sky::PI;
+
+const int FITS_CARD_SIZE = 80;
+
+// Image triangles with a shorter longest side in pixels are too distorted
+// by errors in the star positions to be matched.
+const double MIN_TRIANGLE_PIXELS = 10.0;
+
+// The most best voted correspondences whose sets of three are tried.
+const int MAX_SEED_MATCHES = 16;
+
+// The smallest ratio of the scales of a transformation along its two axes.
+// The sky is neither stretched nor sheared across an image.
+const double MIN_CONFORMALITY = 0.95;
+
+// The number of times the matches are refined.
+const int NUM_REFINEMENTS = 3;
+
+// A pair of stars with the number of triangles that voted for it.
+struct Candidate {
+  int votes;
+  int star;
+  int reference;
+};
+
+// Orders candidates by votes, most first, and then by brightness.
+bool HasMoreVotes(const Candidate &a, const Candidate &b) {
+  if (a.votes != b.votes) return a.votes > b.votes;
+  if (a.star != b.star) return a.star < b.star;
+  return a.reference < b.reference;
+}
+
+// Projects ra, dec onto the plane tangent to the sky at center_ra,
+// center_dec, in degrees as for the intermediate world coordinates of a TAN
+// projection.  Returns false for points on the far side of the sky.
+bool Project(double center_ra, double center_dec, double ra, double dec,
+             double *x, double *y) {
+  double delta_ra = (ra - center_ra) * DEG_TO_RAD;
+  double sin_center_dec = sin(center_dec * DEG_TO_RAD);
+  double cos_center_dec = cos(center_dec * DEG_TO_RAD);
+  double sin_dec = sin(dec * DEG_TO_RAD);
+  double cos_dec = cos(dec * DEG_TO_RAD);
+  double cos_distance = sin_center_dec * sin_dec +
+                        cos_center_dec * cos_dec * cos(delta_ra);
+  if (cos_distance <= 0.0) return false;
+  *x = RAD_TO_DEG * cos_dec * sin(delta_ra) / cos_distance;
+  *y = RAD_TO_DEG * (cos_center_dec * sin_dec -
+                     sin_center_dec * cos_dec * cos(delta_ra)) /
+       cos_distance;
+  return true;
+}
+
+// Inverts Project().
+void Deproject(double center_ra, double center_dec, double x, double y,
+               double *ra, double *dec) {
+  double xi = x * DEG_TO_RAD;
+  double eta = y * DEG_TO_RAD;
+  double sin_center_dec = sin(center_dec * DEG_TO_RAD);
+  double cos_center_dec = cos(center_dec * DEG_TO_RAD);
+  double denominator = cos_center_dec - eta * sin_center_dec;
+  *ra = center_ra + RAD_TO_DEG * atan2(xi, denominator);
+  *dec = RAD_TO_DEG * atan2(sin_center_dec + eta * cos_center_dec,
+                            sqrt(xi * xi + denominator * denominator));
+  *ra = fmod(*ra, 360.0);
+  if (*ra < 0.0) *ra += 360.0;
+}
+
+// Returns a FITS card with the given value, which is formatted already.
+string Card(const string &keyword, const string &value,
+            const string &comment) {
+  string card = google_sky::StringPrintf("%-8s= %20s / %-47s",
+                                         keyword.c_str(), value.c_str(),
+                                         comment.c_str());
+  card.resize(FITS_CARD_SIZE, ' ');
+  return card;
+}
+
+// Returns a FITS card with a string value.
+string StringCard(const string &keyword, const string &value,
+                  const string &comment) {
+  string card = google_sky::StringPrintf("%-8s= %-20s / %-47s",
+                                         keyword.c_str(),
+                                         ("'" + value + "'").c_str(),
+                                         comment.c_str());
+  card.resize(FITS_CARD_SIZE, ' ');
+  return card;
+}
+
+// Returns the END card.
+string EndCard(void) {
+  string card("END");
+  card.resize(FITS_CARD_SIZE, ' ');
+  return card;
+}
+
+// Solves the 3 x 3 system m x = b (m in row order) by Cramer's rule.
+// Returns false if m is singular.
+bool Solve3(const double m[9], const double b[3], double x[3]) {
+  double det = m[0] * (m[4] * m[8] - m[5] * m[7]) -
+               m[1] * (m[3] * m[8] - m[5] * m[6]) +
+               m[2] * (m[3] * m[7] - m[4] * m[6]);
+  if (!(fabs(det) > 1e-12 * fabs(m[0] * m[4] * m[8]))) return false;
+  x[0] = (b[0] * (m[4] * m[8] - m[5] * m[7]) -
+          m[1] * (b[1] * m[8] - m[5] * b[2]) +
+          m[2] * (b[1] * m[7] - m[4] * b[2])) / det;
+  x[1] = (m[0] * (b[1] * m[8] - m[5] * b[2]) -
+          b[0] * (m[3] * m[8] - m[5] * m[6]) +
+          m[2] * (m[3] * b[2] - b[1] * m[6])) / det;
+  x[2] = (m[0] * (m[4] * b[2] - b[1] * m[7]) -
+          m[1] * (m[3] * b[2] - b[1] * m[6]) +
+          b[0] * (m[3] * m[7] - m[4] * m[6])) / det;
+  return true;
+}
+
+}  // namespace
+
+namespace google_sky {
+
+// Votes for the correspondences of the stars of a range of image
+// triangles.
+class PlateSolver::VoteTask : public Task {
+ public:
+  VoteTask(const PlateSolver *solver, const vector<Triangle> *triangles,
+           int begin, int end, const vector<Triangle> *reference_triangles,
+           const vector<vector<int> > *grid, int num_cells,
+           int num_references, vector<int> *votes)
+      : solver_(solver),
+        triangles_(triangles),
+        begin_(begin),
+        end_(end),
+        reference_triangles_(reference_triangles),
+        grid_(grid),
+        num_cells_(num_cells),
+        num_references_(num_references),
+        votes_(votes) {
+    // Nothing needed.
+  }
+
+  virtual void Run() {
+    double tolerance = solver_->tolerance();
+    for (int i = begin_; i < end_; ++i) {
+      const Triangle &triangle = (*triangles_)[i];
+      int cell_x = static_cast<int>(triangle.ratio1 / tolerance);
+      int cell_y = static_cast<int>(triangle.ratio2 / tolerance);
+      for (int y = max(0, cell_y - 1); y <= min(num_cells_ - 1, cell_y + 1);
+           ++y) {
+        for (int x = max(0, cell_x - 1);
+             x <= min(num_cells_ - 1, cell_x + 1); ++x) {
+          const vector<int> &cell = (*grid_)[y * num_cells_ + x];
+          for (size_t j = 0; j < cell.size(); ++j) {
+            const Triangle &reference = (*reference_triangles_)[cell[j]];
+            if (fabs(reference.ratio1 - triangle.ratio1) > tolerance ||
+                fabs(reference.ratio2 - triangle.ratio2) > tolerance ||
+                !solver_->IsScaleAllowed(reference.longest /
+                                         triangle.longest)) {
+              continue;
+            }
+            for (int k = 0; k < 3; ++k) {
+              ++(*votes_)[triangle.stars[k] * num_references_ +
+                          reference.stars[k]];
+            }
+          }
+        }
+      }
+    }
+  }
+
+ private:
+  const PlateSolver *solver_;
+  const vector<Triangle> *triangles_;
+  int begin_;
+  int end_;
+  const vector<Triangle> *reference_triangles_;
+  const vector<vector<int> > *grid_;
+  int num_cells_;
+  int num_references_;
+  vector<int> *votes_;
+
+  DISALLOW_COPY_AND_ASSIGN(VoteTask);
+};
+
+PlateSolver::PlateSolver()
+    : width_(0),
+      height_(0),
+      ra_(0.0),
+      dec_(0.0),
+      num_matches_(0),
+      rms_error_(0.0),
+      center_ra_(NAN),
+      center_dec_(NAN),
+      num_stars_(30),
+      num_reference_stars_(60),
+      tolerance_(0.005),
+      match_radius_(3.0),
+      min_matches_(6),
+      min_scale_(0.0),
+      max_scale_(0.0),
+      num_threads_(ThreadPool::DefaultNumThreads()) {
+  for (int i = 0; i < 4; ++i) {
+    cd_[i] = 0.0;
+  }
+}
+
+PlateSolver::~PlateSolver() {
+  // Nothing needed.
+}
+
+bool PlateSolver::FindImageStars(const FitsImage &image,
+                                 vector<ImageStar> *stars, string *error) {
+  stars->clear();
+  int width = image.width();
+  int height = image.height();
+  if (width <= 0 || height <= 0) {
+    *error = "The image is empty";
+    return false;
+  }
+
+  // The star finder reads a copy of the pixels as a floating point FITS
+  // image, with null pixels replaced so they don't upset its estimate of
+  // the background.
+  double median;
+  double unused;
+  image.GetPercentileRange(50.0, 50.0, &median, &unused);
+  size_t num_pixels = static_cast<size_t>(width) * height;
+  vector<float> pixels(image.pixels(), image.pixels() + num_pixels);
+  for (size_t i = 0; i < num_pixels; ++i) {
+    if (isnan(pixels[i])) pixels[i] = median;
+  }
+  string header = Card("SIMPLE", "T", "Conforms to FITS standard") +
+                  Card("BITPIX", "-32", "Bits per pixel") +
+                  Card("NAXIS", "2", "Number of axes") +
+                  Card("NAXIS1", StringPrintf("%d", width), "Image width") +
+                  Card("NAXIS2", StringPrintf("%d", height), "Image height") +
+                  EndCard();
+  vector<char> header_buffer(header.begin(), header.end());
+  header_buffer.push_back('\0');
+
+  double *xs = NULL;
+  double *ys = NULL;
+  double *magnitudes = NULL;
+  int *peaks = NULL;
+  int num_stars = FindStars(&header_buffer[0],
+                            reinterpret_cast<char *>(&pixels[0]), &xs, &ys,
+                            &magnitudes, &peaks, 0, 0);
+  for (int i = 0; i < num_stars; ++i) {
+    ImageStar star;
+    star.x = xs[i];
+    star.y = ys[i];
+    star.magnitude = magnitudes[i];
+    stars->push_back(star);
+  }
+  free(xs);
+  free(ys);
+  free(magnitudes);
+  free(peaks);
+
+  if (num_stars < 0) {
+    *error = "The libwcs star finder failed";
+    return false;
+  }
+  if (stars->empty()) {
+    *error = "No stars found in the image";
+    return false;
+  }
+  return true;
+}
+
+string PlateSolver::MakeHeader(int width, int height, double crpix1,
+                               double crpix2, double ra, double dec,
+                               const double cd[4]) {
+  string header;
+  header.append(Card("NAXIS", "2", "Number of axes"));
+  header.append(Card("NAXIS1", StringPrintf("%d", width), "Image width"));
+  header.append(Card("NAXIS2", StringPrintf("%d", height), "Image height"));
+  header.append(StringCard("CTYPE1", "RA---TAN", "Gnomonic projection"));
+  header.append(StringCard("CTYPE2", "DEC--TAN", "Gnomonic projection"));
+  header.append(Card("EQUINOX", "2000.0", "Equinox of coordinates"));
+  header.append(Card("CRPIX1", StringPrintf("%.8f", crpix1),
+                     "Reference pixel"));
+  header.append(Card("CRPIX2", StringPrintf("%.8f", crpix2),
+                     "Reference pixel"));
+  header.append(Card("CRVAL1", StringPrintf("%.12f", ra),
+                     "Ra at the reference pixel"));
+  header.append(Card("CRVAL2", StringPrintf("%.12f", dec),
+                     "Dec at the reference pixel"));
+  const char *keywords[] = { "CD1_1", "CD1_2", "CD2_1", "CD2_2" };
+  for (int i = 0; i < 4; ++i) {
+    header.append(Card(keywords[i], StringPrintf("%.12E", cd[i]),
+                       "Degrees per pixel"));
+  }
+  header.append(EndCard());
+  return header;
+}
+
+bool PlateSolver::Solve(int width, int height, const vector<ImageStar> &stars,
+                        CatalogReader *reference, string *error) {
+  CHECK(!isnan(center_ra_) && !isnan(center_dec_))
+      << "set_center() must be called before Solve()";
+  CHECK_GT(width, 0);
+  CHECK_GT(height, 0);
+  width_ = width;
+  height_ = height;
+  num_matches_ = 0;
+  rms_error_ = 0.0;
+
+  // The stars are measured from the center of the image, which becomes the
+  // reference pixel of the WCS.
+  double crpix1 = 0.5 * (width + 1);
+  double crpix2 = 0.5 * (height + 1);
+  vector<Point> pixels(stars.size());
+  for (size_t i = 0; i < stars.size(); ++i) {
+    pixels[i].x = stars[i].x - crpix1;
+    pixels[i].y = stars[i].y - crpix2;
+  }
+
+  // The catalog stars are kept in ra, dec so that they can be projected
+  // again as the tangent point moves to the center of the image.
+  vector<double> ras;
+  vector<double> decs;
+  CatalogRecord record;
+  while (reference->Next(&record)) {
+    if (isnan(record.ra) || isnan(record.dec) || record.dec < -90.0 ||
+        record.dec > 90.0) {
+      continue;
+    }
+    ras.push_back(record.ra);
+    decs.push_back(record.dec);
+  }
+  double tangent_ra = center_ra_;
+  double tangent_dec = center_dec_;
+  vector<Point> plane;
+  ProjectAll(tangent_ra, tangent_dec, ras, decs, &plane);
+
+  int num_stars = min(num_stars_, static_cast<int>(pixels.size()));
+  int num_references = min(num_reference_stars_,
+                           static_cast<int>(plane.size()));
+  if (num_stars < 3 || num_references < 3) {
+    *error = StringPrintf("Too few stars to match (%d in the image and %d "
+                          "in the catalog)", static_cast<int>(pixels.size()),
+                          static_cast<int>(plane.size()));
+    return false;
+  }
+
+  vector<Triangle> triangles;
+  vector<Triangle> reference_triangles;
+  FindTriangles(pixels, num_stars, MIN_TRIANGLE_PIXELS, &triangles);
+  FindTriangles(plane, num_references, 0.0, &reference_triangles);
+  vector<int> votes;
+  Vote(triangles, reference_triangles, num_stars, num_references, &votes);
+
+  // Each star is paired with at most one catalog star, best voted first.
+  vector<Candidate> ranked;
+  for (int i = 0; i < num_stars; ++i) {
+    for (int j = 0; j < num_references; ++j) {
+      int count = votes[i * num_references + j];
+      if (count == 0) continue;
+      Candidate candidate;
+      candidate.votes = count;
+      candidate.star = i;
+      candidate.reference = j;
+      ranked.push_back(candidate);
+    }
+  }
+  sort(ranked.begin(), ranked.end(), HasMoreVotes);
+  vector<char> star_used(num_stars, 0);
+  vector<char> reference_used(num_references, 0);
+  vector<Match> candidates;
+  for (size_t i = 0; i < ranked.size(); ++i) {
+    if (star_used[ranked[i].star] || reference_used[ranked[i].reference]) {
+      continue;
+    }
+    star_used[ranked[i].star] = 1;
+    reference_used[ranked[i].reference] = 1;
+    Match match;
+    match.star = ranked[i].star;
+    match.reference = ranked[i].reference;
+    candidates.push_back(match);
+  }
+
+  vector<Match> matches;
+  if (!FindBestTransform(pixels, plane, candidates, &matches)) {
+    *error = "Couldn't match the stars of the image to the catalog";
+    return false;
+  }
+
+  // The tangent point is moved to the center of the image and every star
+  // is matched again under the new transformation.
+  double transform[6];
+  for (int pass = 0; pass < NUM_REFINEMENTS; ++pass) {
+    if (!FitTransform(pixels, plane, matches, transform)) break;
+    double ra;
+    double dec;
+    Deproject(tangent_ra, tangent_dec, transform[2], transform[5], &ra,
+              &dec);
+    tangent_ra = ra;
+    tangent_dec = dec;
+    ProjectAll(tangent_ra, tangent_dec, ras, decs, &plane);
+    if (!FitTransform(pixels, plane, matches, transform)) break;
+
+    vector<Match> all_matches;
+    MatchAll(pixels, plane, transform, &all_matches);
+    if (static_cast<int>(all_matches.size()) < min_matches_) break;
+    matches.swap(all_matches);
+  }
+  if (!FitTransform(pixels, plane, matches, transform)) {
+    *error = "Couldn't fit the matched stars";
+    return false;
+  }
+
+  Deproject(tangent_ra, tangent_dec, transform[2], transform[5], &ra_, &dec_);
+  cd_[0] = transform[0];
+  cd_[1] = transform[1];
+  cd_[2] = transform[3];
+  cd_[3] = transform[4];
+  num_matches_ = static_cast<int>(matches.size());
+  double scale = sqrt(fabs(cd_[0] * cd_[3] - cd_[1] * cd_[2]));
+  double sum_squares = 0.0;
+  for (size_t i = 0; i < matches.size(); ++i) {
+    const Point &pixel = pixels[matches[i].star];
+    const Point &point = plane[matches[i].reference];
+    double dx = transform[0] * pixel.x + transform[1] * pixel.y +
+                transform[2] - point.x;
+    double dy = transform[3] * pixel.x + transform[4] * pixel.y +
+                transform[5] - point.y;
+    sum_squares += dx * dx + dy * dy;
+  }
+  rms_error_ = sqrt(sum_squares / num_matches_) / scale;
+
+  if (num_matches_ < min_matches_) {
+    *error = StringPrintf("Only %d stars matched the catalog (%d needed)",
+                          num_matches_, min_matches_);
+    return false;
+  }
+  if (!IsScaleAllowed(scale)) {
+    *error = StringPrintf("The pixel scale of %.4f arcsec is out of range",
+                          3600.0 * scale);
+    return false;
+  }
+  return true;
+}
+
+string PlateSolver::header(void) const {
+  return MakeHeader(width_, height_, 0.5 * (width_ + 1),
+                    0.5 * (height_ + 1), ra_, dec_, cd_);
+}
+
+void PlateSolver::FindTriangles(const vector<Point> &points, int num_points,
+                                double min_longest,
+                                vector<Triangle> *triangles) const {
+  triangles->clear();
+  for (int i = 0; i < num_points; ++i) {
+    if (isnan(points[i].x)) continue;
+    for (int j = i + 1; j < num_points; ++j) {
+      if (isnan(points[j].x)) continue;
+      for (int k = j + 1; k < num_points; ++k) {
+        if (isnan(points[k].x)) continue;
+
+        // Each side is stored with the star opposite it, longest first.
+        int opposite[3] = { i, j, k };
+        double sides[3] = {
+          hypot(points[j].x - points[k].x, points[j].y - points[k].y),
+          hypot(points[i].x - points[k].x, points[i].y - points[k].y),
+          hypot(points[i].x - points[j].x, points[i].y - points[j].y)
+        };
+        for (int a = 0; a < 2; ++a) {
+          for (int b = a + 1; b < 3; ++b) {
+            if (sides[b] > sides[a]) {
+              swap(sides[a], sides[b]);
+              swap(opposite[a], opposite[b]);
+            }
+          }
+        }
+
+        // Sides of nearly the same length can't be ordered reliably.
+        if (sides[0] < min_longest || sides[0] <= 0.0 ||
+            sides[0] - sides[1] < tolerance_ * sides[0] ||
+            sides[1] - sides[2] < tolerance_ * sides[0]) {
+          continue;
+        }
+        Triangle triangle;
+        for (int a = 0; a < 3; ++a) {
+          triangle.stars[a] = opposite[a];
+        }
+        triangle.ratio1 = sides[1] / sides[0];
+        triangle.ratio2 = sides[2] / sides[0];
+        triangle.longest = sides[0];
+        triangles->push_back(triangle);
+      }
+    }
+  }
+}
+
+void PlateSolver::Vote(const vector<Triangle> &triangles,
+                       const vector<Triangle> &reference_triangles,
+                       int num_stars, int num_references,
+                       vector<int> *votes) const {
+  // The catalog triangles are hashed on a grid of their side ratios with
+  // cells as large as the tolerance, so matching triangles are at most one
+  // cell apart.
+  int num_cells = static_cast<int>(1.0 / tolerance_) + 1;
+  vector<vector<int> > grid(num_cells * num_cells);
+  for (size_t i = 0; i < reference_triangles.size(); ++i) {
+    int x = static_cast<int>(reference_triangles[i].ratio1 / tolerance_);
+    int y = static_cast<int>(reference_triangles[i].ratio2 / tolerance_);
+    grid[y * num_cells + x].push_back(static_cast<int>(i));
+  }
+
+  // Each task votes into its own array, so they need no locking.
+  int num_tasks = max(1, num_threads_);
+  int num_triangles = static_cast<int>(triangles.size());
+  vector<vector<int> > task_votes(num_tasks);
+  {
+    ThreadPool pool(num_tasks);
+    for (int i = 0; i < num_tasks; ++i) {
+      task_votes[i].resize(num_stars * num_references, 0);
+      pool.Add(new VoteTask(this, &triangles, num_triangles * i / num_tasks,
+                            num_triangles * (i + 1) / num_tasks,
+                            &reference_triangles, &grid, num_cells,
+                            num_references, &task_votes[i]));
+    }
+    pool.Wait();
+  }
+
+  votes->assign(num_stars * num_references, 0);
+  for (int i = 0; i < num_tasks; ++i) {
+    for (size_t j = 0; j < task_votes[i].size(); ++j) {
+      (*votes)[j] += task_votes[i][j];
+    }
+  }
+}
+
+bool PlateSolver::FindBestTransform(const vector<Point> &pixels,
+                                    const vector<Point> &plane,
+                                    const vector<Match> &candidates,
+                                    vector<Match> *matches) const {
+  int num_seeds = min(static_cast<int>(candidates.size()), MAX_SEED_MATCHES);
+  int best_agreement = 0;
+  double best_transform[6];
+  for (int a = 0; a < num_seeds; ++a) {
+    for (int b = a + 1; b < num_seeds; ++b) {
+      for (int c = b + 1; c < num_seeds; ++c) {
+        vector<Match> seeds;
+        seeds.push_back(candidates[a]);
+        seeds.push_back(candidates[b]);
+        seeds.push_back(candidates[c]);
+        double transform[6];
+        if (!FitTransform(pixels, plane, seeds, transform)) continue;
+        double det = transform[0] * transform[4] - transform[1] * transform[3];
+        double norm = transform[0] * transform[0] +
+                      transform[1] * transform[1] +
+                      transform[3] * transform[3] +
+                      transform[4] * transform[4];
+        double scale = sqrt(fabs(det));
+        if (!(2.0 * fabs(det) >= MIN_CONFORMALITY * norm) ||
+            !IsScaleAllowed(scale)) {
+          continue;
+        }
+
+        double radius = match_radius_ * scale;
+        int agreement = 0;
+        for (size_t i = 0; i < candidates.size(); ++i) {
+          const Point &pixel = pixels[candidates[i].star];
+          const Point &point = plane[candidates[i].reference];
+          double dx = transform[0] * pixel.x + transform[1] * pixel.y +
+                      transform[2] - point.x;
+          double dy = transform[3] * pixel.x + transform[4] * pixel.y +
+                      transform[5] - point.y;
+          if (dx * dx + dy * dy <= radius * radius) ++agreement;
+        }
+        if (agreement > best_agreement) {
+          best_agreement = agreement;
+          copy(transform, transform + 6, best_transform);
+        }
+      }
+    }
+  }
+
+  // Any three correspondences agree with their own transformation, so a
+  // fourth is needed to confirm it.
+  if (best_agreement < 4) return false;
+  matches->clear();
+  double scale = sqrt(fabs(best_transform[0] * best_transform[4] -
+                           best_transform[1] * best_transform[3]));
+  double radius = match_radius_ * scale;
+  for (size_t i = 0; i < candidates.size(); ++i) {
+    const Point &pixel = pixels[candidates[i].star];
+    const Point &point = plane[candidates[i].reference];
+    double dx = best_transform[0] * pixel.x + best_transform[1] * pixel.y +
+                best_transform[2] - point.x;
+    double dy = best_transform[3] * pixel.x + best_transform[4] * pixel.y +
+                best_transform[5] - point.y;
+    if (dx * dx + dy * dy <= radius * radius) {
+      matches->push_back(candidates[i]);
+    }
+  }
+  return true;
+}
+
+void PlateSolver::MatchAll(const vector<Point> &pixels,
+                           const vector<Point> &plane,
+                           const double transform[6],
+                           vector<Match> *matches) const {
+  double scale = sqrt(fabs(transform[0] * transform[4] -
+                           transform[1] * transform[3]));
+  double radius = match_radius_ * scale;
+
+  // Each catalog star keeps the closest of the stars it is nearest to.
+  vector<int> nearest_star(plane.size(), -1);
+  vector<double> nearest_distance(plane.size(), radius * radius);
+  for (size_t i = 0; i < pixels.size(); ++i) {
+    double x = transform[0] * pixels[i].x + transform[1] * pixels[i].y +
+               transform[2];
+    double y = transform[3] * pixels[i].x + transform[4] * pixels[i].y +
+               transform[5];
+    int nearest = -1;
+    double distance = radius * radius;
+    for (size_t j = 0; j < plane.size(); ++j) {
+      double dx = plane[j].x - x;
+      double dy = plane[j].y - y;
+      double d = dx * dx + dy * dy;
+      if (d <= distance) {
+        distance = d;
+        nearest = static_cast<int>(j);
+      }
+    }
+    if (nearest >= 0 && distance <= nearest_distance[nearest]) {
+      nearest_distance[nearest] = distance;
+      nearest_star[nearest] = static_cast<int>(i);
+    }
+  }
+
+  matches->clear();
+  for (size_t j = 0; j < plane.size(); ++j) {
+    if (nearest_star[j] < 0) continue;
+    Match match;
+    match.star = nearest_star[j];
+    match.reference = static_cast<int>(j);
+    matches->push_back(match);
+  }
+}
+
+void PlateSolver::ProjectAll(double center_ra, double center_dec,
+                             const vector<double> &ras,
+                             const vector<double> &decs,
+                             vector<Point> *plane) {
+  plane->resize(ras.size());
+  for (size_t i = 0; i < ras.size(); ++i) {
+    Point &point = (*plane)[i];
+    if (!Project(center_ra, center_dec, ras[i], decs[i], &point.x,
+                 &point.y)) {
+      point.x = NAN;
+      point.y = NAN;
+    }
+  }
+}
+
+bool PlateSolver::IsScaleAllowed(double scale) const {
+  if (max_scale_ <= 0.0) return true;
+  double arcsec = 3600.0 * scale;
+  return arcsec >= min_scale_ && arcsec <= max_scale_;
+}
+
+bool PlateSolver::FitTransform(const vector<Point> &pixels,
+                               const vector<Point> &plane,
+                               const vector<Match> &matches,
+                               double transform[6]) {
+  if (matches.size() < 3) return false;
+
+  // The normal equations, which share their matrix for x and y.
+  double m[9] = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+  double bx[3] = { 0.0, 0.0, 0.0 };
+  double by[3] = { 0.0, 0.0, 0.0 };
+  for (size_t i = 0; i < matches.size(); ++i) {
+    const Point &pixel = pixels[matches[i].star];
+    const Point &point = plane[matches[i].reference];
+    double v[3] = { pixel.x, pixel.y, 1.0 };
+    for (int r = 0; r < 3; ++r) {
+      for (int c = 0; c < 3; ++c) {
+        m[r * 3 + c] += v[r] * v[c];
+      }
+      bx[r] += v[r] * point.x;
+      by[r] += v[r] * point.y;
+    }
+  }
+  return Solve3(m, bx, transform) && Solve3(m, by, transform + 3);
+}
+
+}  // namespace google_sky
@@ -0,0 +1,341 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// Defines the PlateSolver class for fitting a WCS to the stars of an image
+
+#ifndef PLATESOLVER_H__
+#define PLATESOLVER_H__
+
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "base.h"
+
+namespace google_sky {
+
+// Forward declarations.
+class CatalogReader;
+class FitsImage;
+
+// A star found in an image, at FITS pixel coordinates (1, 1 is the center
+// of the first pixel), with its instrumental magnitude.
+struct ImageStar {
+  double x;
+  double y;
+  double magnitude;
+};
+
+// Class for fitting a WCS to an image without one
+//
+// The stars of the image are found with the libwcs star finder and matched
+// against the stars of a reference catalog around an approximate center
+// given with set_center().  Neither the pixel scale nor the orientation of
+// the image needs to be known.  Triangles are formed from the brightest
+// num_stars() image stars and the brightest num_reference_stars() catalog
+// stars, the latter projected onto the plane tangent to the sky at the
+// center, and are described by the ratios of their sides, which don't
+// change with scale, rotation, or reflection.  The catalog triangles are
+// hashed on a grid of those ratios, and every image triangle votes for the
+// correspondences of its corners with each catalog triangle of the same
+// shape.  The voting is split among num_threads() threads.
+//
+// The best voted correspondences are checked by fitting an affine
+// transformation to each set of three and counting the correspondences it
+// agrees with, and the transformation with the most agreement is then
+// refined by least squares over every image star within match_radius()
+// pixels of a catalog star, recentering the tangent point each time.  The
+// result is a TAN projection with a CD matrix, returned by header() as the
+// cards of a FITS header that can be passed to WcsProjection::FromHeader().
+//
+// Example Usage:
+//
+// FitsImage image;
+// CHECK(image.Read("foo.fits"));
+// vector<ImageStar> stars;
+// string error;
+// CHECK(PlateSolver::FindImageStars(image, &stars, &error)) << error;
+//
+// // catalog is a ReferenceCatalog read around 150.1, 2.2.
+// PlateSolver solver;
+// solver.set_center(150.1, 2.2);
+// if (!solver.Solve(image.width(), image.height(), stars, &catalog,
+//                   &error)) {
+//   fprintf(stderr, "%s\n", error.c_str());
+// }
+// WcsProjection *wcs = WcsProjection::FromHeader(solver.header());
+
+class PlateSolver {
+ public:
+  PlateSolver();
+
+  ~PlateSolver();
+
+  // Finds the stars of image with the libwcs star finder, brightest first.
+  // Null pixels are replaced by the median of the image.  Returns false
+  // with a description of the problem in error on failure.
+  static bool FindImageStars(const FitsImage &image, vector<ImageStar> *stars,
+                             string *error);
+
+  // Returns the cards of a FITS header, including the final END card, for a
+  // width x height image with a TAN projection centered at ra, dec on
+  // pixel crpix1, crpix2 and the given CD matrix (CD1_1, CD1_2, CD2_1,
+  // CD2_2) in degrees per pixel.
+  static string MakeHeader(int width, int height, double crpix1,
+                           double crpix2, double ra, double dec,
+                           const double cd[4]);
+
+  // Fits a WCS to a width x height image with the given stars, which must
+  // be sorted brightest first, using the stars read from reference, which
+  // must also be sorted brightest first and lie around center().  Returns
+  // false with a description of the problem in error if too few stars
+  // match.
+  bool Solve(int width, int height, const vector<ImageStar> &stars,
+             CatalogReader *reference, string *error);
+
+  // Returns the FITS header of the WCS found by the last call to Solve().
+  string header(void) const;
+
+  // Returns the ra and dec of the center of the image found by Solve().
+  inline double ra(void) const {
+    return ra_;
+  }
+
+  inline double dec(void) const {
+    return dec_;
+  }
+
+  // Returns element i of the CD matrix found by Solve() (CD1_1, CD1_2,
+  // CD2_1, and CD2_2).
+  inline double cd(int i) const {
+    CHECK(i >= 0 && i < 4) << "Invalid CD element: " << i;
+    return cd_[i];
+  }
+
+  // Returns the pixel scale found by Solve() in arcseconds per pixel.
+  inline double pixel_scale(void) const {
+    return 3600.0 * sqrt(fabs(cd_[0] * cd_[3] - cd_[1] * cd_[2]));
+  }
+
+  // Returns the number of stars matched by the last call to Solve().
+  inline int num_matches(void) const {
+    return num_matches_;
+  }
+
+  // Returns the root mean square distance in pixels between the matched
+  // stars and their catalog positions.
+  inline double rms_error(void) const {
+    return rms_error_;
+  }
+
+  // Sets the approximate center of the image in degrees, which must be set
+  // before calling Solve().
+  inline void set_center(double ra, double dec) {
+    center_ra_ = ra;
+    center_dec_ = dec;
+  }
+
+  inline double center_ra(void) const {
+    return center_ra_;
+  }
+
+  inline double center_dec(void) const {
+    return center_dec_;
+  }
+
+  // Returns the number of image stars that triangles are formed from.
+  inline int num_stars(void) const {
+    return num_stars_;
+  }
+
+  // Sets the number of image stars that triangles are formed from, 30 by
+  // default.  The number of triangles grows as the cube of this.
+  inline void set_num_stars(int num_stars) {
+    CHECK_GT(num_stars, 2);
+    num_stars_ = num_stars;
+  }
+
+  // Returns the number of catalog stars that triangles are formed from.
+  inline int num_reference_stars(void) const {
+    return num_reference_stars_;
+  }
+
+  // Sets the number of catalog stars that triangles are formed from, 60 by
+  // default.  More are needed when the catalog stars come from a larger
+  // area than the image or go fainter than the image.
+  inline void set_num_reference_stars(int num_reference_stars) {
+    CHECK_GT(num_reference_stars, 2);
+    num_reference_stars_ = num_reference_stars;
+  }
+
+  // Returns the largest difference in side ratios of matching triangles.
+  inline double tolerance(void) const {
+    return tolerance_;
+  }
+
+  // Sets the largest difference in side ratios of matching triangles,
+  // 0.005 by default.
+  inline void set_tolerance(double tolerance) {
+    CHECK(tolerance > 0.0 && tolerance < 0.5);
+    tolerance_ = tolerance;
+  }
+
+  // Returns the farthest in pixels a star may be from its catalog position.
+  inline double match_radius(void) const {
+    return match_radius_;
+  }
+
+  // Sets the farthest in pixels a star may be from its catalog position, 3
+  // by default.
+  inline void set_match_radius(double match_radius) {
+    CHECK_GT(match_radius, 0.0);
+    match_radius_ = match_radius;
+  }
+
+  // Returns the fewest matched stars accepted as a solution.
+  inline int min_matches(void) const {
+    return min_matches_;
+  }
+
+  // Sets the fewest matched stars accepted as a solution, 6 by default.
+  inline void set_min_matches(int min_matches) {
+    CHECK_GT(min_matches, 2);
+    min_matches_ = min_matches;
+  }
+
+  // Limits the pixel scale in arcseconds per pixel to between min_scale and
+  // max_scale.  There is no limit if max_scale is 0, as by default.
+  inline void set_scale_limits(double min_scale, double max_scale) {
+    min_scale_ = min_scale;
+    max_scale_ = max_scale;
+  }
+
+  // Returns the number of threads that match triangles.
+  inline int num_threads(void) const {
+    return num_threads_;
+  }
+
+  // Sets the number of threads that match triangles, which defaults to
+  // ThreadPool::DefaultNumThreads().
+  inline void set_num_threads(int num_threads) {
+    num_threads_ = num_threads;
+  }
+
+ private:
+  // A star in pixel coordinates or in degrees on the tangent plane.
+  struct Point {
+    double x;
+    double y;
+  };
+
+  // Three stars, ordered by the length of the side opposite them from
+  // longest to shortest, and the ratios of the two shorter sides to the
+  // longest.
+  struct Triangle {
+    int stars[3];
+    double ratio1;
+    double ratio2;
+    double longest;
+  };
+
+  // A pair of an image star and a catalog star.
+  struct Match {
+    int star;
+    int reference;
+  };
+
+  class VoteTask;
+
+  int width_;
+  int height_;
+  double ra_;
+  double dec_;
+  double cd_[4];
+  int num_matches_;
+  double rms_error_;
+
+  double center_ra_;
+  double center_dec_;
+  int num_stars_;
+  int num_reference_stars_;
+  double tolerance_;
+  double match_radius_;
+  int min_matches_;
+  double min_scale_;
+  double max_scale_;
+  int num_threads_;
+
+  // Forms the triangles of the first num_points points whose sides differ
+  // enough to be ordered and whose longest side is at least min_longest.
+  void FindTriangles(const vector<Point> &points, int num_points,
+                     double min_longest, vector<Triangle> *triangles) const;
+
+  // Returns the number of votes for each pair of the first num_stars image
+  // stars and num_references catalog stars, indexed by star *
+  // num_references + reference.
+  void Vote(const vector<Triangle> &triangles,
+            const vector<Triangle> &reference_triangles, int num_stars,
+            int num_references, vector<int> *votes) const;
+
+  // Finds the transformation from pixels to the tangent plane that agrees
+  // with the most of candidates, and returns the candidates that agree with
+  // it in matches.
+  bool FindBestTransform(const vector<Point> &pixels,
+                         const vector<Point> &plane,
+                         const vector<Match> &candidates,
+                         vector<Match> *matches) const;
+
+  // Matches every star to the nearest catalog star within match_radius()
+  // under transform.
+  void MatchAll(const vector<Point> &pixels, const vector<Point> &plane,
+                const double transform[6], vector<Match> *matches) const;
+
+  // Projects every star onto the plane tangent to the sky at center_ra,
+  // center_dec.  Stars on the far side of the sky are NaN.
+  static void ProjectAll(double center_ra, double center_dec,
+                         const vector<double> &ras,
+                         const vector<double> &decs, vector<Point> *plane);
+
+  // Returns whether a pixel scale in degrees per pixel is within the scale
+  // limits.
+  bool IsScaleAllowed(double scale) const;
+
+  // Fits transform t to matches by least squares.  It maps the offset dx,
+  // dy of a star from the center of the image, as stored in pixels, to
+  // x = t[0] * dx + t[1] * dy + t[2], y = t[3] * dx + t[4] * dy + t[5] on
+  // the tangent plane.
+  static bool FitTransform(const vector<Point> &pixels,
+                           const vector<Point> &plane,
+                           const vector<Match> &matches, double transform[6]);
+
+  DISALLOW_COPY_AND_ASSIGN(PlateSolver);
+};
+
+}  // namespace google_sky
+
+#endif  // PLATESOLVER_H__
@@ -0,0 +1,321 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "base.h"
+#include "catalog.h"
+#include "fitsimage.h"
+#include "platesolver.h"
+#include "string_util.h"
+#include "wcsprojection.h"
+
+namespace google_sky {
+
+// Returns the sources it is given.
+class VectorReader : public CatalogReader {
+ public:
+  VectorReader() : position_(0) {
+    // Nothing needed.
+  }
+
+  void Add(double ra, double dec) {
+    CatalogRecord record;
+    record.ra = ra;
+    record.dec = dec;
+    records_.push_back(record);
+  }
+
+  void Rewind(void) {
+    position_ = 0;
+  }
+
+  virtual bool Next(CatalogRecord *record) {
+    if (position_ >= records_.size()) return false;
+    *record = records_[position_++];
+    return true;
+  }
+
+ private:
+  vector<CatalogRecord> records_;
+  size_t position_;
+};
+
+// Returns a repeatable pseudo-random number from 0 to 1.
+double Random(unsigned int *state) {
+  *state = *state * 1103515245 + 12345;
+  return ((*state >> 8) & 0xffff) / 65536.0;
+}
+
+// Orders stars brightest first.
+bool IsBrighter(const ImageStar &a, const ImageStar &b) {
+  return a.magnitude < b.magnitude;
+}
+
+// Adds num_stars random stars within half_width degrees of ra, dec to
+// reference, brightest first, and appends the ones that fall in a width x
+// height image with the given WCS to stars with a little noise, also
+// brightest first.
+void MakeStars(double ra, double dec, double half_width, int num_stars,
+               const WcsProjection &wcs, int width, int height,
+               unsigned int seed, VectorReader *reference,
+               vector<ImageStar> *stars) {
+  vector<ImageStar> sky;
+  for (int i = 0; i < num_stars; ++i) {
+    ImageStar star;
+    star.y = dec + half_width * (2.0 * Random(&seed) - 1.0);
+    star.x = ra + half_width * (2.0 * Random(&seed) - 1.0) /
+                  cos(star.y * 3.1415926535897931 / 180.0);
+    star.magnitude = 8.0 + 6.0 * Random(&seed);
+    sky.push_back(star);
+  }
+  sort(sky.begin(), sky.end(), IsBrighter);
+
+  stars->clear();
+  for (size_t i = 0; i < sky.size(); ++i) {
+    reference->Add(sky[i].x, sky[i].y);
+    ImageStar star;
+    if (!wcs.ToPixel(sky[i].x, sky[i].y, &star.x, &star.y)) continue;
+    if (star.x < 1.0 || star.x > width || star.y < 1.0 || star.y > height) {
+      continue;
+    }
+    star.x += 0.4 * (Random(&seed) - 0.5);
+    star.y += 0.4 * (Random(&seed) - 0.5);
+    star.magnitude = sky[i].magnitude + 0.6 * (Random(&seed) - 0.5);
+    stars->push_back(star);
+  }
+
+  // A few stars aren't in the catalog.
+  for (int i = 0; i < 5; ++i) {
+    ImageStar star;
+    star.x = 1.0 + (width - 1) * Random(&seed);
+    star.y = 1.0 + (height - 1) * Random(&seed);
+    star.magnitude = 8.0 + 6.0 * Random(&seed);
+    stars->push_back(star);
+  }
+  sort(stars->begin(), stars->end(), IsBrighter);
+}
+
+// Writes a width x height 32 bit floating point FITS image with a noisy
+// background and compact Gaussian stars at the given FITS pixel
+// coordinates.
+void WriteStarImage(const string &filename, int width, int height,
+                    const double *xs, const double *ys, const double *peaks,
+                    int num_stars) {
+  string header;
+  const char *cards[] = {
+    "SIMPLE  =                    T",
+    "BITPIX  =                  -32",
+    "NAXIS   =                    2"
+  };
+  for (int i = 0; i < 3; ++i) {
+    header.append(cards[i]);
+    header.append(80 - strlen(cards[i]), ' ');
+  }
+  string card = StringPrintf("NAXIS1  = %20d", width);
+  header.append(card).append(80 - card.size(), ' ');
+  card = StringPrintf("NAXIS2  = %20d", height);
+  header.append(card).append(80 - card.size(), ' ');
+  header.append("END").append(77, ' ');
+  header.append((2880 - header.size() % 2880) % 2880, ' ');
+
+  string data;
+  unsigned int seed = 7;
+  for (int y = 1; y <= height; ++y) {
+    for (int x = 1; x <= width; ++x) {
+      double value = 100.0 + 4.0 * (Random(&seed) - 0.5);
+      for (int i = 0; i < num_stars; ++i) {
+        double r2 = (x - xs[i]) * (x - xs[i]) + (y - ys[i]) * (y - ys[i]);
+        value += peaks[i] * exp(-r2 / (2.0 * 0.8 * 0.8));
+      }
+      float pixel = static_cast<float>(value);
+      const char *bytes = reinterpret_cast<const char *>(&pixel);
+      uint16 test = 1;
+      bool little_endian = *reinterpret_cast<uint8 *>(&test) == 1;
+      for (int k = 0; k < 4; ++k) {
+        data.push_back(bytes[little_endian ? 3 - k : k]);
+      }
+    }
+  }
+  data.append((2880 - data.size() % 2880) % 2880, '\0');
+
+  FILE *fp = fopen(filename.c_str(), "wb");
+  CHECK(fp != NULL);
+  CHECK_EQ(header.size(), fwrite(header.data(), 1, header.size(), fp));
+  CHECK_EQ(data.size(), fwrite(data.data(), 1, data.size(), fp));
+  fclose(fp);
+}
+
+int Main(int argc, char **argv) {
+  // A 1024 x 768 image at 2 arcsec per pixel, rotated by 25 degrees, with
+  // east to the left.
+  const int width = 1024;
+  const int height = 768;
+  double scale = 2.0 / 3600.0;
+  double angle = 25.0 * 3.1415926535897931 / 180.0;
+  double cd[4] = { -scale * cos(angle), scale * sin(angle),
+                   scale * sin(angle), scale * cos(angle) };
+  string true_header = PlateSolver::MakeHeader(width, height,
+                                               0.5 * (width + 1),
+                                               0.5 * (height + 1), 150.0,
+                                               30.0, cd);
+  WcsProjection *true_wcs = WcsProjection::FromHeader(true_header);
+
+  {
+    cout << "Testing PlateSolver::MakeHeader()... ";
+    double ra;
+    double dec;
+    true_wcs->ToRaDec(0.5 * (width + 1), 0.5 * (height + 1), &ra, &dec);
+    ASSERT_FLOAT_EQ(150.0, ra, 1e-9);
+    ASSERT_FLOAT_EQ(30.0, dec, 1e-9);
+    ASSERT_EQ(0, static_cast<int>(true_header.size() % 80));
+    cout << "pass\n";
+  }
+
+  VectorReader reference;
+  vector<ImageStar> stars;
+  MakeStars(150.2, 29.9, 0.6, 150, *true_wcs, width, height, 1, &reference,
+            &stars);
+
+  {
+    cout << "Testing PlateSolver::Solve()... ";
+    PlateSolver solver;
+    solver.set_center(150.2, 29.9);
+    solver.set_num_threads(1);
+    string error;
+    ASSERT_TRUE(solver.Solve(width, height, stars, &reference, &error));
+    ASSERT_FLOAT_EQ(150.0, solver.ra(), 1e-4);
+    ASSERT_FLOAT_EQ(30.0, solver.dec(), 1e-4);
+    for (int i = 0; i < 4; ++i) {
+      ASSERT_FLOAT_EQ(cd[i], solver.cd(i), 1e-3 * scale);
+    }
+    ASSERT_FLOAT_EQ(2.0, solver.pixel_scale(), 1e-3);
+    ASSERT_TRUE(solver.num_matches() >= 20);
+    ASSERT_TRUE(solver.rms_error() < 0.5);
+
+    // The header gives the same projection.
+    WcsProjection *wcs = WcsProjection::FromHeader(solver.header());
+    double x[] = { 1.0, width, 1.0, width };
+    double y[] = { 1.0, 1.0, height, height };
+    for (int i = 0; i < 4; ++i) {
+      double ra;
+      double dec;
+      double true_ra;
+      double true_dec;
+      wcs->ToRaDec(x[i], y[i], &ra, &dec);
+      true_wcs->ToRaDec(x[i], y[i], &true_ra, &true_dec);
+      ASSERT_FLOAT_EQ(true_ra, ra, 1e-4);
+      ASSERT_FLOAT_EQ(true_dec, dec, 1e-4);
+    }
+    delete wcs;
+
+    // Matching in parallel gives the same solution.
+    PlateSolver parallel_solver;
+    parallel_solver.set_center(150.2, 29.9);
+    parallel_solver.set_num_threads(4);
+    reference.Rewind();
+    ASSERT_TRUE(parallel_solver.Solve(width, height, stars, &reference,
+                                      &error));
+    ASSERT_EQ(solver.num_matches(), parallel_solver.num_matches());
+    ASSERT_FLOAT_EQ(solver.ra(), parallel_solver.ra(), 1e-12);
+    ASSERT_FLOAT_EQ(solver.cd(0), parallel_solver.cd(0), 1e-15);
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing PlateSolver::Solve() failures... ";
+    string error;
+
+    // The pixel scale is outside the limits.
+    PlateSolver solver;
+    solver.set_center(150.2, 29.9);
+    solver.set_scale_limits(10.0, 20.0);
+    reference.Rewind();
+    ASSERT_FALSE(solver.Solve(width, height, stars, &reference, &error));
+    ASSERT_FALSE(error.empty());
+
+    // The catalog has other stars.
+    VectorReader other_reference;
+    vector<ImageStar> other_stars;
+    MakeStars(150.2, 29.9, 0.6, 150, *true_wcs, width, height, 2,
+              &other_reference, &other_stars);
+    PlateSolver other_solver;
+    other_solver.set_center(150.2, 29.9);
+    error.clear();
+    ASSERT_FALSE(other_solver.Solve(width, height, stars, &other_reference,
+                                    &error));
+    ASSERT_FALSE(error.empty());
+
+    // Too few stars.
+    VectorReader empty_reference;
+    error.clear();
+    ASSERT_FALSE(other_solver.Solve(width, height, stars, &empty_reference,
+                                    &error));
+    ASSERT_TRUE(StringContains(error, "Too few stars"));
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing PlateSolver::FindImageStars()... ";
+    double xs[] = { 120.0, 50.3, 150.5 };
+    double ys[] = { 40.0, 60.7, 110.2 };
+    double peaks[] = { 500.0, 1000.0, 250.0 };
+    WriteStarImage("platesolver_test.fits", 200, 150, xs, ys, peaks, 3);
+    FitsImage image;
+    ASSERT_TRUE(image.Read("platesolver_test.fits"));
+    vector<ImageStar> found;
+    string error;
+    ASSERT_TRUE(PlateSolver::FindImageStars(image, &found, &error));
+    ASSERT_EQ(3, static_cast<int>(found.size()));
+    ASSERT_FLOAT_EQ(50.3, found[0].x, 0.3);
+    ASSERT_FLOAT_EQ(60.7, found[0].y, 0.3);
+    ASSERT_FLOAT_EQ(120.0, found[1].x, 0.3);
+    ASSERT_FLOAT_EQ(40.0, found[1].y, 0.3);
+    ASSERT_FLOAT_EQ(150.5, found[2].x, 0.3);
+    ASSERT_FLOAT_EQ(110.2, found[2].y, 0.3);
+    ASSERT_TRUE(found[0].magnitude < found[1].magnitude);
+    remove("platesolver_test.fits");
+    cout << "pass\n";
+  }
+
+  delete true_wcs;
+  return 0;
+}
+
+}  // namespace google_sky
+
+int main(int argc, char **argv) {
+  return google_sky::Main(argc, argv);
+}
@@ -0,0 +1,258 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "polarcap.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+#include "file_util.h"
+#include "image.h"
+#include "kml.h"
+#include "string_util.h"
+#include "threadpool.h"
+#include "wraparound.h"
+
+namespace {
+
+// Google Earth misplaces GroundOverlays wider than 180 degrees.
+static const double MAX_TILE_RA = 90.0;
+
+// Guards against rounding up sizes that are whole numbers of pixels.
+static const double TINY_PIXELS = 1.0e-9;
+
+// Returns the number of pixels needed to cover degrees, at least 1.
+int CountSpan(double degrees, double pixel_scale) {
+  return max(1, static_cast<int>(ceil(degrees / pixel_scale - TINY_PIXELS)));
+}
+
+}  // namespace
+
+namespace google_sky {
+
+// Compresses and writes one warped tile, taking ownership of it.
+class PolarCapTiler::WriteTileTask : public Task {
+ public:
+  WriteTileTask(Image *tile, const string &filename, FirstError *status)
+      : tile_(tile), filename_(filename), status_(status) {}
+
+  virtual ~WriteTileTask() {
+    delete tile_;
+  }
+
+  virtual void Run() {
+    if (!tile_->Write(filename_)) {
+      status_->Fail("Can't write tile " + filename_);
+    }
+  }
+
+ private:
+  Image *tile_;
+  string filename_;
+  FirstError *status_;
+
+  DISALLOW_COPY_AND_ASSIGN(WriteTileTask);
+};
+
+PolarCapTiler::PolarCapTiler(const SkyProjection &projection)
+    : projection_(&projection),
+      tile_size_(256),
+      cap_dec_(60.0),
+      pixel_scale_(projection.InputPixelScale()),
+      output_directory_("polar"),
+      filename_prefix_("tile"),
+      ground_overlay_name_("Tile"),
+      num_threads_(ThreadPool::DefaultNumThreads()) {
+  CHECK_GT(pixel_scale_, 0.0) << "Bad input pixel scale";
+}
+
+// Bands start at the pole the image crosses, so that the band touching the
+// pole is a whole tile high and only the last band is cut short.  The
+// bounding box only reaches the pole and covers every ra to within
+// rounding, so it is widened to cover the whole cap.
+void PolarCapTiler::FindTiles(vector<Tile> *tiles) const {
+  tiles->clear();
+  const BoundingBox &bounding_box = projection_->bounding_box();
+  double dec_min;
+  double dec_max;
+  bounding_box.GetDecBounds(&dec_min, &dec_max);
+  if (bounding_box.crosses_north_pole()) dec_max = 90.0;
+  if (bounding_box.crosses_south_pole()) dec_min = -90.0;
+  double ra_min;
+  double ra_max;
+  bounding_box.GetMonotonicRaBounds(&ra_min, &ra_max);
+  if (bounding_box.crosses_north_pole() ||
+      bounding_box.crosses_south_pole()) {
+    ra_max = ra_min + 360.0;
+  }
+
+  bool from_south = bounding_box.crosses_south_pole() &&
+                    !bounding_box.crosses_north_pole();
+  double band_height = tile_size_ * pixel_scale_;
+  int num_bands = CountSpan(dec_max - dec_min, band_height);
+  for (int band = 0; band < num_bands; ++band) {
+    if (from_south) {
+      double south = dec_min + band * band_height;
+      AddBand(band, ra_min, ra_max, south, min(dec_max, south + band_height),
+              tiles);
+    } else {
+      double north = dec_max - band * band_height;
+      AddBand(band, ra_min, ra_max, max(dec_min, north - band_height), north,
+              tiles);
+    }
+  }
+}
+
+// A band is shrunk in ra by the cosine of its equatorward edge, where its
+// pixels are widest on the sky, so no part of the band loses resolution.
+void PolarCapTiler::AddBand(int band, double ra_min, double ra_max,
+                            double dec_min, double dec_max,
+                            vector<Tile> *tiles) const {
+  double ra_span = ra_max - ra_min;
+
+  double equatorward = 0.0;
+  if (dec_min >= 0.0 || dec_max <= 0.0) {
+    equatorward = min(fabs(dec_min), fabs(dec_max));
+  }
+  double width_degrees = ra_span;
+  if (equatorward >= cap_dec_) {
+    width_degrees *= cos(equatorward * (PI / 180.0));
+  }
+
+  int band_width = CountSpan(width_degrees, pixel_scale_);
+  int num_tiles = max((band_width + tile_size_ - 1) / tile_size_,
+                      CountSpan(ra_span, MAX_TILE_RA));
+  Tile tile;
+  tile.band = band;
+  tile.dec_min = dec_min;
+  tile.dec_max = dec_max;
+  tile.width = (band_width + num_tiles - 1) / num_tiles;
+  tile.height = CountSpan(dec_max - dec_min, pixel_scale_);
+  for (int i = 0; i < num_tiles; ++i) {
+    tile.index = i;
+    tile.ra_min = ra_min + ra_span * i / num_tiles;
+    tile.ra_max = ra_min + ra_span * (i + 1) / num_tiles;
+    tiles->push_back(tile);
+  }
+}
+
+int64 PolarCapTiler::CountPixels(const vector<Tile> &tiles) {
+  int64 count = 0;
+  for (size_t i = 0; i < tiles.size(); ++i) {
+    count += static_cast<int64>(tiles[i].width) * tiles[i].height;
+  }
+  return count;
+}
+
+string PolarCapTiler::MakeTileFilename(const Tile &tile) const {
+  return StringPrintf("%s_b%d_%d.png", filename_prefix_.c_str(), tile.band,
+                      tile.index);
+}
+
+// The pool only compresses and writes tiles, so it holds at most the
+// tiles warped faster than they can be written.
+bool PolarCapTiler::Write(const string &kmlfile, string *error) const {
+  if (!MakeDirectory(output_directory_)) {
+    *error = "Cannot create output directory " + output_directory_;
+    return false;
+  }
+
+  vector<Tile> tiles;
+  FindTiles(&tiles);
+
+  Kml kml;
+  FirstError status;
+  {
+    ThreadPool pool(num_threads_);
+    for (size_t t = 0; t < tiles.size(); ++t) {
+      const Tile &tile = tiles[t];
+      Image *image = new Image();
+      if (!image->Resize(tile.width, tile.height, Image::RGBA)) {
+        delete image;
+        status.Fail(StringPrintf("Can't allocate a %d x %d tile",
+                                 tile.width, tile.height));
+        break;
+      }
+      projection_->WarpRegion(tile.ra_min, tile.ra_max, tile.dec_min,
+                              tile.dec_max, image);
+      if (image->AlphaIsEverywhere(0)) {
+        delete image;
+        continue;
+      }
+
+      string filename = output_directory_ + "/" + MakeTileFilename(tile);
+      pool.Add(new WriteTileTask(image, filename, &status));
+
+      // The ra of both edges is brought back to 0-360 before converting
+      // to longitude, as Regionator::ComputeBoundingBox() does.
+      double west = tile.ra_min;
+      double east = tile.ra_max;
+      WrapAround::RestoreWrapAround(&west);
+      WrapAround::RestoreWrapAround(&east);
+      west -= 180.0;
+      east -= 180.0;
+      if (east <= west) {
+        west -= 360.0;
+      }
+
+      KmlLatLonBox lat_lon_box;
+      lat_lon_box.north.set(tile.dec_max);
+      lat_lon_box.south.set(tile.dec_min);
+      lat_lon_box.east.set(east);
+      lat_lon_box.west.set(west);
+
+      KmlIcon icon;
+      icon.href.set(filename);
+
+      KmlGroundOverlay ground_overlay;
+      ground_overlay.name.set(StringPrintf("%s %d.%d",
+                                           ground_overlay_name_.c_str(),
+                                           tile.band, tile.index));
+      ground_overlay.icon.set(icon);
+      ground_overlay.lat_lon_box.set(lat_lon_box);
+      kml.AddGroundOverlay(ground_overlay);
+    }
+    pool.Wait();
+  }
+  if (status.failed()) {
+    *error = status.error();
+    return false;
+  }
+
+  FILE *fp = fopen(kmlfile.c_str(), "w");
+  if (!fp) {
+    *error = "Can't open file " + kmlfile + " for writing";
+    return false;
+  }
+  fprintf(fp, "%s", kml.ToString().c_str());
+  fclose(fp);
+  return true;
+}
+
+}  // namespace google_sky
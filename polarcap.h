@@ -0,0 +1,212 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// Defines the PolarCapTiler class for tiling images that cover the poles
+
+#ifndef POLARCAP_H__
+#define POLARCAP_H__
+
+#include <string>
+#include <vector>
+
+#include "base.h"
+#include "skyprojection.h"
+
+namespace google_sky {
+
+// Class for warping images near the celestial poles onto lat-lon tiles
+//
+// BoundingBox stretches the bounding box of an image that crosses a pole to
+// every ra and to a dec of +-90, so the single warped image made by
+// SkyProjection has as many pixels in its row at the pole as in its row at
+// the equator.  Most of them repeat the same few input pixels.
+//
+// PolarCapTiler instead splits the bounding box into bands of dec one tile
+// high, starting from the pole.  Bands that lie entirely poleward of
+// cap_dec() form the polar cap, where each band is only as wide in pixels
+// as the circumference of its equatorward edge, so the tiles grow wider in
+// ra approaching the pole.  The other bands are normal lat-lon tiles at the
+// input pixel scale.  Each tile is warped directly from the input image,
+// so no full size warped image is ever held in memory.  WCS conversions
+// aren't thread safe, so the tiles are warped one at a time and then
+// compressed and written in parallel.  Tiles that the image doesn't reach
+// aren't written.
+//
+// The tiles are written to the output directory as PNG files and the KML
+// file gets one GroundOverlay per tile.  Google Earth misplaces overlays
+// wider than 180 degrees, so no tile spans more than 90 degrees of ra.
+//
+// Example Usage:
+//
+// SkyProjection projection(image, wcs);
+// if (projection.bounding_box().crosses_north_pole()) {
+//   PolarCapTiler tiler(projection);
+//   tiler.set_output_directory("cap");
+//   string error;
+//   if (!tiler.Write("cap.kml", &error)) {
+//     fprintf(stderr, "%s\n", error.c_str());
+//   }
+// }
+
+class PolarCapTiler {
+ public:
+  // One tile of the layout.  Tiles are numbered by the band they lie in,
+  // counting from the pole, and by their index within the band.
+  struct Tile {
+    int band;
+    int index;
+    double ra_min;
+    double ra_max;
+    double dec_min;
+    double dec_max;
+    int width;
+    int height;
+  };
+
+  // Creates a tiler for the image of projection, which must outlive the
+  // tiler.  The input pixel scale is taken from the projection.
+  explicit PolarCapTiler(const SkyProjection &projection);
+
+  ~PolarCapTiler() {
+    // Nothing needed.
+  }
+
+  // Computes the tiles covering the bounding box of the image.
+  void FindTiles(vector<Tile> *tiles) const;
+
+  // Returns the total number of pixels in the tiles.
+  static int64 CountPixels(const vector<Tile> &tiles);
+
+  // Warps the tiles, writes those the image reaches to the output
+  // directory, and writes a KML file with a GroundOverlay for each.
+  // Returns false with a description of the problem in error if a file
+  // can't be written.
+  bool Write(const string &kmlfile, string *error) const;
+
+  // Returns the largest side length of the tiles in pixels.
+  inline int tile_size(void) const {
+    return tile_size_;
+  }
+
+  // Sets the largest side length of the tiles in pixels, 256 by default.
+  inline void set_tile_size(int tile_size) {
+    CHECK_GT(tile_size, 0) << "Bad tile size " << tile_size;
+    tile_size_ = tile_size;
+  }
+
+  // Returns the |dec| beyond which bands use RA-adaptive widths.
+  inline double cap_dec(void) const {
+    return cap_dec_;
+  }
+
+  // Sets the |dec| in degrees beyond which bands use RA-adaptive widths,
+  // 60 by default.
+  inline void set_cap_dec(double cap_dec) {
+    CHECK(cap_dec >= 0.0 && cap_dec < 90.0) << "Bad cap dec " << cap_dec;
+    cap_dec_ = cap_dec;
+  }
+
+  // Returns the size of the output pixels in degrees.
+  inline double pixel_scale(void) const {
+    return pixel_scale_;
+  }
+
+  // Sets the size of the output pixels in degrees, which defaults to the
+  // size of the input pixels.
+  inline void set_pixel_scale(double pixel_scale) {
+    CHECK_GT(pixel_scale, 0.0) << "Bad pixel scale " << pixel_scale;
+    pixel_scale_ = pixel_scale;
+  }
+
+  // Returns the directory the tiles are written to.
+  inline const string &output_directory(void) const {
+    return output_directory_;
+  }
+
+  // Sets the directory the tiles are written to, "polar" by default.
+  inline void set_output_directory(const string &output_directory) {
+    output_directory_ = output_directory;
+  }
+
+  // Returns the prefix of the tile filenames.
+  inline const string &filename_prefix(void) const {
+    return filename_prefix_;
+  }
+
+  // Sets the prefix of the tile filenames, "tile" by default.
+  inline void set_filename_prefix(const string &filename_prefix) {
+    filename_prefix_ = filename_prefix;
+  }
+
+  // Returns the name given to the GroundOverlays.
+  inline const string &ground_overlay_name(void) const {
+    return ground_overlay_name_;
+  }
+
+  // Sets the name given to the GroundOverlays, which is followed by the
+  // band and index of each tile.
+  inline void set_ground_overlay_name(const string &ground_overlay_name) {
+    ground_overlay_name_ = ground_overlay_name;
+  }
+
+  // Returns the number of threads writing tiles in Write().
+  inline int num_threads(void) const {
+    return num_threads_;
+  }
+
+  // Sets the number of threads writing tiles in Write(), which defaults to
+  // ThreadPool::DefaultNumThreads().
+  inline void set_num_threads(int num_threads) {
+    num_threads_ = num_threads;
+  }
+
+  // Returns the name of the file of tile relative to the output directory.
+  string MakeTileFilename(const Tile &tile) const;
+
+ private:
+  class WriteTileTask;
+
+  const SkyProjection *projection_;
+  int tile_size_;
+  double cap_dec_;
+  double pixel_scale_;
+  string output_directory_;
+  string filename_prefix_;
+  string ground_overlay_name_;
+  int num_threads_;
+
+  // Adds the tiles of one band of dec covering the given ra to tiles.
+  void AddBand(int band, double ra_min, double ra_max, double dec_min,
+               double dec_max, vector<Tile> *tiles) const;
+
+  DISALLOW_COPY_AND_ASSIGN(PolarCapTiler);
+};
+
+}  // namespace google_sky
+
+#endif  // POLARCAP_H__
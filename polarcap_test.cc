@@ -0,0 +1,202 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "base.h"
+#include "color.h"
+#include "file_util.h"
+#include "image.h"
+#include "polarcap.h"
+#include "skyprojection.h"
+#include "string_util.h"
+#include "test_util.h"
+#include "wcsprojection.h"
+
+namespace google_sky {
+
+// Returns the number of times pattern occurs in text.
+int CountOccurrences(const string &text, const string &pattern) {
+  int count = 0;
+  for (size_t pos = text.find(pattern); pos != string::npos;
+       pos = text.find(pattern, pos + 1)) {
+    ++count;
+  }
+  return count;
+}
+
+int Main(int argc, char **argv) {
+  // A 200 x 200 image of 0.05 degree pixels centered on the north pole
+  // reaches down to a dec of about 82.9 at its corners.
+  Image image;
+  ASSERT_TRUE(image.Resize(200, 200, Image::RGBA));
+  image.SetAllValuesInChannel(0, 200);
+  image.SetAllValuesInChannel(1, 100);
+  image.SetAllValuesInChannel(2, 50);
+  image.SetAllValuesInChannel(3, 255);
+  WcsProjection *north_wcs =
+      WcsProjection::FromHeader(MakeHeader(0.0, 90.0, 200, 200, 0.05));
+  SkyProjection north(image, *north_wcs);
+  ASSERT_TRUE(north.bounding_box().crosses_north_pole());
+
+  {
+    cout << "Testing FindTiles() at the north pole... ";
+    PolarCapTiler tiler(north);
+    ASSERT_FLOAT_EQ(0.05, tiler.pixel_scale(), 1.0e-6);
+    tiler.set_pixel_scale(0.05);
+    tiler.set_tile_size(64);
+
+    vector<PolarCapTiler::Tile> tiles;
+    tiler.FindTiles(&tiles);
+    ASSERT_TRUE(!tiles.empty());
+
+    // Bands are one tile (3.2 degrees) high counting from the pole and
+    // each band covers every ra without gaps.
+    double ra_min, ra_max, dec_min, dec_max;
+    north.bounding_box().GetMonotonicRaBounds(&ra_min, &ra_max);
+    north.bounding_box().GetDecBounds(&dec_min, &dec_max);
+    int num_bands = tiles.back().band + 1;
+    ASSERT_EQ(static_cast<int>(ceil((dec_max - dec_min) / 3.2)), num_bands);
+    for (size_t t = 0; t < tiles.size(); ++t) {
+      const PolarCapTiler::Tile &tile = tiles[t];
+      ASSERT_FLOAT_EQ(90.0 - 3.2 * tile.band, tile.dec_max, 1.0e-9);
+      ASSERT_TRUE(tile.width <= 64 && tile.height <= 64);
+      if (tile.index == 0) {
+        ASSERT_FLOAT_EQ(ra_min, tile.ra_min, 1.0e-9);
+      } else {
+        ASSERT_FLOAT_EQ(tiles[t - 1].ra_max, tile.ra_min, 1.0e-9);
+      }
+      ASSERT_TRUE(tile.ra_max - tile.ra_min <= 90.0 + 1.0e-9);
+      if (t + 1 == tiles.size() || tiles[t + 1].band != tile.band) {
+        ASSERT_FLOAT_EQ(ra_min + 360.0, tile.ra_max, 1.0e-9);
+      }
+    }
+
+    // The band at the pole is only as wide as the circle at its edge, at
+    // 64 x 64 pixels of 0.05 degrees.
+    int first_band_width = 0;
+    for (size_t t = 0; t < tiles.size() && tiles[t].band == 0; ++t) {
+      ASSERT_EQ(64, tiles[t].height);
+      first_band_width += tiles[t].width;
+    }
+    double circumference = 360.0 * cos((90.0 - 3.2) * PI / 180.0) / 0.05;
+    ASSERT_TRUE(first_band_width >= circumference &&
+                first_band_width < circumference + 8);
+
+    // Far fewer pixels are needed than for lat-lon tiles of every band.
+    int64 cap_pixels = PolarCapTiler::CountPixels(tiles);
+    tiler.set_cap_dec(89.0);
+    tiler.FindTiles(&tiles);
+    int64 lat_lon_pixels = PolarCapTiler::CountPixels(tiles);
+    ASSERT_TRUE(cap_pixels * 5 < lat_lon_pixels);
+    ASSERT_TRUE(lat_lon_pixels >= (360.0 / 0.05) * (dec_max - dec_min) /
+                0.05);
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing FindTiles() at the south pole... ";
+    WcsProjection *south_wcs =
+        WcsProjection::FromHeader(MakeHeader(0.0, -90.0, 200, 200, 0.05));
+    SkyProjection south(image, *south_wcs);
+    ASSERT_TRUE(south.bounding_box().crosses_south_pole());
+    PolarCapTiler tiler(south);
+    tiler.set_pixel_scale(0.05);
+    tiler.set_tile_size(64);
+
+    vector<PolarCapTiler::Tile> tiles;
+    tiler.FindTiles(&tiles);
+    ASSERT_FLOAT_EQ(-90.0, tiles.front().dec_min, 1.0e-9);
+    ASSERT_FLOAT_EQ(-90.0 + 3.2, tiles.front().dec_max, 1.0e-9);
+    delete south_wcs;
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing Write()... ";
+    ASSERT_TRUE(system("rm -rf polarcap_test_tiles") == 0);
+    PolarCapTiler tiler(north);
+    tiler.set_pixel_scale(0.05);
+    tiler.set_tile_size(64);
+    tiler.set_output_directory("polarcap_test_tiles");
+    tiler.set_filename_prefix("cap");
+    tiler.set_num_threads(2);
+    string error;
+    ASSERT_TRUE(tiler.Write("polarcap_test.kml", &error));
+
+    // Every tile of the band at the pole lies inside the image.
+    vector<PolarCapTiler::Tile> tiles;
+    tiler.FindTiles(&tiles);
+    int num_written = 0;
+    for (size_t t = 0; t < tiles.size(); ++t) {
+      string filename = "polarcap_test_tiles/" +
+                        tiler.MakeTileFilename(tiles[t]);
+      if (!FileExists(filename)) continue;
+      ++num_written;
+      if (tiles[t].band == 0) {
+        Image tile;
+        ASSERT_TRUE(tile.Read(filename));
+        ASSERT_TRUE(tile.ConvertToRGBA());
+        ASSERT_EQ(tiles[t].width, tile.width());
+        ASSERT_EQ(200, static_cast<int>(tile.GetValue(0, 0, 0)));
+        ASSERT_EQ(255, static_cast<int>(tile.GetValue(0, 0, 3)));
+      }
+    }
+    ASSERT_TRUE(FileExists("polarcap_test_tiles/cap_b0_0.png"));
+    ASSERT_TRUE(num_written > 0);
+
+    string kml = ReadFile("polarcap_test.kml");
+    ASSERT_EQ(num_written, CountOccurrences(kml, "<GroundOverlay>"));
+    ASSERT_TRUE(kml.find("polarcap_test_tiles/cap_b0_0.png") !=
+                string::npos);
+
+    // A directory that can't be made is reported.
+    tiler.set_output_directory("polarcap_test.kml/tiles");
+    ASSERT_FALSE(tiler.Write("polarcap_test.kml", &error));
+    ASSERT_TRUE(error.find("polarcap_test.kml/tiles") != string::npos);
+
+    ASSERT_TRUE(system("rm -rf polarcap_test_tiles polarcap_test.kml") == 0);
+    cout << "pass\n";
+  }
+
+  delete north_wcs;
+  cout << "Passed\n";
+  return 0;
+}
+
+}  // namespace google_sky
+
+int main(int argc, char **argv) {
+  return google_sky::Main(argc, argv);
+}
@@ -0,0 +1,420 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "referencecatalog.h"
+
+#include <pthread.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "base.h"
+#include "boundingbox.h"
+#include "catalog.h"
+#include "string_util.h"
+#include "threadpool.h"
+#include "wcsprojection.h"
+
+// wcscat.h names an argument "class", which is reserved in C++.
+#define class gsc_class
+#include <wcscat.h>
+#undef class
+
+namespace {
+
+// wcslib.h, included by wcsprojection.h, defines PI.
+const double DEG_TO_RAD = PI / 180.0;
+
+// Degrees added around each zone searched by libwcs.
+const double SEARCH_MARGIN = 1e-6;
+
+// The libwcs catalog readers keep their state in static variables, so only
+// one thread may search a catalog at a time.
+pthread_mutex_t libwcs_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Returns a modifiable copy of value for the libwcs functions, which take
+// char * arguments.
+vector<char> MakeCString(const string &value) {
+  vector<char> c_string(value.begin(), value.end());
+  c_string.push_back('\0');
+  return c_string;
+}
+
+}  // namespace
+
+namespace google_sky {
+
+// SkyFootprint methods.
+SkyFootprint::SkyFootprint(const WcsProjection &wcs, int width, int height,
+                           int points_per_edge) {
+  CHECK_GT(points_per_edge, 0);
+  double center_dec;
+  wcs.ToRaDec(0.5 * (width + 1), 0.5 * (height + 1), &center_ra_,
+              &center_dec);
+  sin_center_dec_ = sin(center_dec * DEG_TO_RAD);
+  cos_center_dec_ = cos(center_dec * DEG_TO_RAD);
+
+  // FITS pixels are centered on whole numbers, so the edges of the image
+  // are at 0.5 and width + 0.5.  The outline runs counterclockwise in pixel
+  // coordinates, one edge at a time.
+  double corners_x[] = { 0.5, width + 0.5, width + 0.5, 0.5 };
+  double corners_y[] = { 0.5, 0.5, height + 0.5, height + 0.5 };
+  xi_min_ = eta_min_ = HUGE_VAL;
+  xi_max_ = eta_max_ = -HUGE_VAL;
+  for (int edge = 0; edge < 4; ++edge) {
+    int next = (edge + 1) % 4;
+    for (int i = 0; i < points_per_edge; ++i) {
+      double t = static_cast<double>(i) / points_per_edge;
+      double x = corners_x[edge] + t * (corners_x[next] - corners_x[edge]);
+      double y = corners_y[edge] + t * (corners_y[next] - corners_y[edge]);
+      double ra;
+      double dec;
+      double xi;
+      double eta;
+      wcs.ToRaDec(x, y, &ra, &dec);
+      if (!Project(ra, dec, &xi, &eta)) continue;
+      xi_.push_back(xi);
+      eta_.push_back(eta);
+      xi_min_ = min(xi_min_, xi);
+      xi_max_ = max(xi_max_, xi);
+      eta_min_ = min(eta_min_, eta);
+      eta_max_ = max(eta_max_, eta);
+    }
+  }
+}
+
+bool SkyFootprint::Contains(double ra, double dec) const {
+  double xi;
+  double eta;
+  if (!Project(ra, dec, &xi, &eta)) return false;
+  if (xi < xi_min_ || xi > xi_max_ || eta < eta_min_ || eta > eta_max_) {
+    return false;
+  }
+
+  // Counts the edges crossed by a ray from the point towards +xi.
+  bool inside = false;
+  size_t n = xi_.size();
+  for (size_t i = 0, j = n - 1; i < n; j = i++) {
+    if ((eta_[i] > eta) != (eta_[j] > eta) &&
+        xi < xi_[j] + (eta - eta_[j]) * (xi_[i] - xi_[j]) /
+                      (eta_[i] - eta_[j])) {
+      inside = !inside;
+    }
+  }
+  return inside;
+}
+
+// The gnomonic projection, which maps great circles to straight lines.
+bool SkyFootprint::Project(double ra, double dec, double *xi,
+                           double *eta) const {
+  double delta_ra = (ra - center_ra_) * DEG_TO_RAD;
+  double sin_dec = sin(dec * DEG_TO_RAD);
+  double cos_dec = cos(dec * DEG_TO_RAD);
+  double cos_delta_ra = cos(delta_ra);
+  double cos_distance = sin_center_dec_ * sin_dec +
+                        cos_center_dec_ * cos_dec * cos_delta_ra;
+  if (cos_distance <= 0.0) return false;
+  *xi = cos_dec * sin(delta_ra) / cos_distance;
+  *eta = (cos_center_dec_ * sin_dec -
+          sin_center_dec_ * cos_dec * cos_delta_ra) / cos_distance;
+  return true;
+}
+
+// Searches one zone of the catalog.
+class ReferenceCatalog::ZoneTask : public Task {
+ public:
+  ZoneTask(const ReferenceCatalog *catalog, double ra_min, double ra_max,
+           double dec_min, double dec_max, bool include_max,
+           const SkyFootprint *footprint, vector<Source> *sources,
+           char *succeeded, char *truncated)
+      : catalog_(catalog),
+        ra_min_(ra_min),
+        ra_max_(ra_max),
+        dec_min_(dec_min),
+        dec_max_(dec_max),
+        include_max_(include_max),
+        footprint_(footprint),
+        sources_(sources),
+        succeeded_(succeeded),
+        truncated_(truncated) {
+    // Nothing needed.
+  }
+
+  virtual void Run() {
+    bool truncated = false;
+    *succeeded_ = catalog_->ReadZone(ra_min_, ra_max_, dec_min_, dec_max_,
+                                     include_max_, *footprint_, sources_,
+                                     &truncated);
+    *truncated_ = truncated;
+  }
+
+ private:
+  const ReferenceCatalog *catalog_;
+  double ra_min_;
+  double ra_max_;
+  double dec_min_;
+  double dec_max_;
+  bool include_max_;
+  const SkyFootprint *footprint_;
+  vector<Source> *sources_;
+  char *succeeded_;
+  char *truncated_;
+
+  DISALLOW_COPY_AND_ASSIGN(ZoneTask);
+};
+
+// ReferenceCatalog methods.
+const int ReferenceCatalog::MAX_MAGNITUDES;
+
+ReferenceCatalog::ReferenceCatalog()
+    : refcat_(0),
+      num_magnitudes_(0),
+      zone_height_(1.0),
+      max_sources_per_zone_(100000),
+      bright_limit_(0.0),
+      faint_limit_(0.0),
+      num_threads_(ThreadPool::DefaultNumThreads()),
+      position_(0),
+      num_truncated_zones_(0) {
+  // Nothing needed.
+}
+
+ReferenceCatalog::~ReferenceCatalog() {
+  // Nothing needed.
+}
+
+bool ReferenceCatalog::Open(const string &catalog) {
+  catalog_ = catalog;
+  sources_.clear();
+  position_ = 0;
+
+  vector<char> name = MakeCString(catalog);
+  char title[1024];
+  title[0] = '\0';
+  int coordinate_system;
+  double equinox;
+  double epoch;
+  int has_proper_motion;
+  int num_magnitudes = 0;
+  pthread_mutex_lock(&libwcs_mutex);
+  refcat_ = RefCat(&name[0], title, &coordinate_system, &equinox, &epoch,
+                   &has_proper_motion, &num_magnitudes);
+  pthread_mutex_unlock(&libwcs_mutex);
+  if (refcat_ == 0) {
+    set_error(StringPrintf("Unknown reference catalog '%s'",
+                           catalog.c_str()));
+    return false;
+  }
+  title_ = title;
+  num_magnitudes_ = max(0, min(num_magnitudes, MAX_MAGNITUDES));
+
+  // Stars of catalog files are named after the file.
+  if (refcat_ == TXTCAT || refcat_ == BINCAT || refcat_ == TABCAT) {
+    name_prefix_ = catalog.substr(catalog.rfind('/') + 1);
+    name_prefix_ = name_prefix_.substr(0, name_prefix_.find('.'));
+  } else {
+    char *catalog_name = CatName(refcat_, &name[0]);
+    name_prefix_ = catalog_name;
+    if (catalog_name != &name[0]) free(catalog_name);
+  }
+
+  vector<string> columns;
+  columns.push_back("Name");
+  columns.push_back("RA");
+  columns.push_back("Dec");
+  magnitude_names_.clear();
+  for (int i = 0; i < num_magnitudes_; ++i) {
+    char magnitude_name[32];
+    CatMagName(i + 1, refcat_, magnitude_name);
+    string column(magnitude_name);
+    if (column == "Mag" && num_magnitudes_ > 1) {
+      column = StringPrintf("Mag%d", i + 1);
+    }
+    magnitude_names_.push_back(column);
+    columns.push_back(column);
+  }
+  set_ra_column("RA");
+  set_dec_column("Dec");
+  set_name_column("Name");
+  return FindColumns(columns);
+}
+
+bool ReferenceCatalog::Read(const BoundingBox &box,
+                            const SkyFootprint &footprint) {
+  CHECK_NE(refcat_, 0) << "Open() must be called before Read()";
+  sources_.clear();
+  position_ = 0;
+  num_truncated_zones_ = 0;
+  set_error("");
+
+  // Images that cross a pole cover every ra up to the pole.
+  double ra_min;
+  double ra_max;
+  double dec_min;
+  double dec_max;
+  box.GetMonotonicRaBounds(&ra_min, &ra_max);
+  box.GetDecBounds(&dec_min, &dec_max);
+  if (box.crosses_north_pole() || box.crosses_south_pole()) {
+    ra_min = 0.0;
+    ra_max = 360.0;
+    if (box.crosses_north_pole()) dec_max = 90.0;
+    if (box.crosses_south_pole()) dec_min = -90.0;
+  }
+
+  int num_zones = max(1, static_cast<int>(
+      ceil((dec_max - dec_min) / zone_height_)));
+  double height = (dec_max - dec_min) / num_zones;
+  vector<vector<Source> > zones(num_zones);
+  vector<char> succeeded(num_zones, 0);
+  vector<char> truncated(num_zones, 0);
+  {
+    ThreadPool pool(num_threads_);
+    for (int i = 0; i < num_zones; ++i) {
+      double south = dec_min + i * height;
+      double north = i + 1 == num_zones ? dec_max
+                                        : dec_min + (i + 1) * height;
+      pool.Add(new ZoneTask(this, ra_min, ra_max, south, north,
+                            i + 1 == num_zones, &footprint, &zones[i],
+                            &succeeded[i], &truncated[i]));
+    }
+    pool.Wait();
+  }
+
+  for (int i = 0; i < num_zones; ++i) {
+    if (!succeeded[i]) {
+      sources_.clear();
+      set_error(StringPrintf("Couldn't search reference catalog '%s'",
+                             catalog_.c_str()));
+      return false;
+    }
+    if (truncated[i]) ++num_truncated_zones_;
+    sources_.insert(sources_.end(), zones[i].begin(), zones[i].end());
+  }
+  stable_sort(sources_.begin(), sources_.end(), IsBrighter);
+  return true;
+}
+
+bool ReferenceCatalog::Next(CatalogRecord *record) {
+  if (position_ >= sources_.size()) return false;
+  *record = sources_[position_++].record;
+  return true;
+}
+
+bool ReferenceCatalog::ReadZone(double ra_min, double ra_max,
+                                double dec_min, double dec_max,
+                                bool include_max,
+                                const SkyFootprint &footprint,
+                                vector<Source> *sources,
+                                bool *truncated) const {
+  // The search is centered on the zone, with half widths in degrees of ra
+  // and dec.  libwcs wraps ra around 360 itself.  The search is a little
+  // larger than the zone so that stars on its border aren't lost to
+  // rounding, and the zone is then cut out exactly below.
+  double ra_center = 0.5 * (ra_min + ra_max);
+  if (ra_center >= 360.0) ra_center -= 360.0;
+  double ra_half_width = min(180.0, 0.5 * (ra_max - ra_min) + SEARCH_MARGIN);
+  double dec_center = 0.5 * (dec_min + dec_max);
+  double dec_half_width = 0.5 * (dec_max - dec_min) + SEARCH_MARGIN;
+
+  int max_sources = max_sources_per_zone_;
+  vector<double> numbers(max_sources);
+  vector<double> ras(max_sources);
+  vector<double> decs(max_sources);
+  vector<double> ra_motions(max_sources);
+  vector<double> dec_motions(max_sources);
+  vector<int> fluxes(max_sources);
+  vector<char *> names(max_sources, static_cast<char *>(NULL));
+  vector<vector<double> > magnitudes(MAX_MAGNITUDES,
+                                     vector<double>(max_sources));
+  double *magnitude_arrays[MAX_MAGNITUDES];
+  for (int i = 0; i < MAX_MAGNITUDES; ++i) {
+    magnitude_arrays[i] = &magnitudes[i][0];
+  }
+
+  // Stars are limited by the first magnitude, and the brightest are kept
+  // when there are too many.  The read holds libwcs_mutex, so the zones are
+  // read one after another; only the filtering below overlaps them.
+  vector<char> catalog = MakeCString(catalog_);
+  struct StarCat *star_catalog = NULL;
+  pthread_mutex_lock(&libwcs_mutex);
+  int num_found = ctgread(&catalog[0], refcat_, 0, ra_center, dec_center,
+                          ra_half_width, dec_half_width, 0.0, 0.0,
+                          WCS_J2000, 2000.0, 0.0, bright_limit_,
+                          faint_limit_, 1, max_sources, &star_catalog,
+                          &numbers[0], &ras[0], &decs[0], &ra_motions[0],
+                          &dec_motions[0], magnitude_arrays, &fluxes[0],
+                          &names[0], 0);
+  if (star_catalog != NULL) ctgclose(star_catalog);
+  pthread_mutex_unlock(&libwcs_mutex);
+  if (num_found < 0) return false;
+  *truncated = num_found > max_sources;
+  int num_read = min(num_found, max_sources);
+
+  // The stars in the footprint are turned into records outside of the
+  // lock.  Stars on the border between zones belong to the northern one.
+  int num_length = CatNumLen(refcat_, 0.0, CatNdec(refcat_));
+  int num_decimals = CatNdec(refcat_);
+  vector<string> values(3 + num_magnitudes_);
+  for (int i = 0; i < num_read; ++i) {
+    double dec = decs[i];
+    if (dec < dec_min || dec > dec_max || (dec == dec_max && !include_max) ||
+        !footprint.Contains(ras[i], dec)) {
+      continue;
+    }
+    if (names[i] != NULL && names[i][0] != '\0') {
+      values[0] = names[i];
+    } else {
+      char number[64];
+      CatNum(refcat_, num_length, num_decimals, numbers[i], number);
+      string formatted(number);
+      StringStripLeadingAndTrailingWhiteSpace(&formatted);
+      values[0] = name_prefix_ + " " + formatted;
+    }
+    for (int k = 0; k < num_magnitudes_; ++k) {
+      values[3 + k] = StringPrintf("%.2f", magnitudes[k][i]);
+    }
+    Source source;
+    source.magnitude = num_magnitudes_ > 0 ? magnitudes[0][i] : NAN;
+    FillRecord(ras[i], dec, values, &source.record);
+    sources->push_back(source);
+  }
+  for (int i = 0; i < max_sources; ++i) {
+    free(names[i]);
+  }
+  return true;
+}
+
+bool ReferenceCatalog::IsBrighter(const Source &a, const Source &b) {
+  if (isnan(b.magnitude)) return !isnan(a.magnitude);
+  return a.magnitude < b.magnitude;
+}
+
+}  // namespace google_sky
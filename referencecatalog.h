@@ -0,0 +1,241 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// Defines the ReferenceCatalog class for reading stars from local catalogs
+
+#ifndef REFERENCECATALOG_H__
+#define REFERENCECATALOG_H__
+
+#include <string>
+#include <vector>
+
+#include "base.h"
+#include "catalog.h"
+
+namespace google_sky {
+
+// Forward declarations.
+class BoundingBox;
+class WcsProjection;
+
+// Class for testing whether points on the sky fall within an image
+//
+// Testing every star of a catalog against an image by converting it to
+// pixel coordinates with the WCS is slow for distorted projections.
+// Instead, the edges of the image are converted to ra, dec once, at
+// points_per_edge points along each edge, and projected onto the plane
+// tangent to the sky at the image center.  A point is then in the image if
+// it projects inside that polygon, which needs only a few multiplications
+// and one cosine for most points.  The test is exact at the sampled points
+// and accurate to the curvature of the edges between them.
+
+class SkyFootprint {
+ public:
+  // Traces the outline of a width x height image with the given WCS.
+  SkyFootprint(const WcsProjection &wcs, int width, int height,
+               int points_per_edge);
+
+  ~SkyFootprint() {
+    // Nothing needed.
+  }
+
+  // Returns whether ra, dec in degrees lies within the image.
+  bool Contains(double ra, double dec) const;
+
+ private:
+  double center_ra_;
+  double sin_center_dec_;
+  double cos_center_dec_;
+
+  // The outline in the tangent plane and its bounds.
+  vector<double> xi_;
+  vector<double> eta_;
+  double xi_min_;
+  double xi_max_;
+  double eta_min_;
+  double eta_max_;
+
+  // Projects ra, dec onto the tangent plane.  Returns false for points on
+  // the far side of the sky.
+  bool Project(double ra, double dec, double *xi, double *eta) const;
+
+  DISALLOW_COPY_AND_ASSIGN(SkyFootprint);
+};
+
+// Class for reading the stars of a reference catalog that fall in an image
+//
+// The catalog is any that the WCS Tools catalog readers in libwcs know,
+// named as for the WCS Tools programs, e.g. "ucac2", "tmc" (2MASS), "ty2"
+// (Tycho-2), "ub1" (USNO-B1.0), or "gsc", with the local copy found through
+// the same environment variables (UCAC2_PATH, TMC_PATH, etc.), or the path
+// of a TDC ASCII, binary, or Starbase catalog file.
+//
+// The declination range of the image's BoundingBox is split into zones of
+// zone_height() degrees, and each zone is searched by a task on a
+// ThreadPool.  The libwcs readers keep their state in static variables, so
+// only one zone is searched by libwcs at a time, but the tasks filter their
+// stars through the image's SkyFootprint and build the records for them
+// in parallel with the searches of other zones.  The stars are then
+// returned by Next(), brightest first, so that they can be passed on to a
+// CatalogRegionator.
+//
+// Example Usage:
+//
+// ReferenceCatalog catalog;
+// if (!catalog.Open("ucac2")) {
+//   fprintf(stderr, "%s\n", catalog.error().c_str());
+// }
+// BoundingBox box(wcs, width, height);
+// SkyFootprint footprint(wcs, width, height, 16);
+// if (!catalog.Read(box, footprint)) {
+//   fprintf(stderr, "%s\n", catalog.error().c_str());
+// }
+// CatalogRegionator regionator;
+// string error;
+// regionator.Regionate(&catalog, &error);
+
+class ReferenceCatalog : public CatalogReader {
+ public:
+  // The most magnitudes a libwcs catalog has.
+  static const int MAX_MAGNITUDES = 11;
+
+  ReferenceCatalog();
+
+  virtual ~ReferenceCatalog();
+
+  // Looks up the catalog with the given name or path.  Returns false with
+  // a description of the problem in error() if libwcs doesn't know it.
+  bool Open(const string &catalog);
+
+  // Reads the stars of the catalog within box that footprint contains.
+  // Returns false with a description of the problem in error() on failure.
+  bool Read(const BoundingBox &box, const SkyFootprint &footprint);
+
+  virtual bool Next(CatalogRecord *record);
+
+  // Returns the title of the catalog from libwcs.
+  inline const string &title(void) const {
+    return title_;
+  }
+
+  // Returns the number of stars found by the last call to Read().
+  inline int num_sources(void) const {
+    return static_cast<int>(sources_.size());
+  }
+
+  // Returns the number of zones that had more than max_sources_per_zone()
+  // stars in the last call to Read(), and so are missing some.
+  inline int num_truncated_zones(void) const {
+    return num_truncated_zones_;
+  }
+
+  // Returns the height of the zones searched in degrees.
+  inline double zone_height(void) const {
+    return zone_height_;
+  }
+
+  // Sets the height of the zones searched in degrees, 1 by default.
+  inline void set_zone_height(double zone_height) {
+    CHECK_GT(zone_height, 0.0);
+    zone_height_ = zone_height;
+  }
+
+  // Returns the most stars read from a zone.
+  inline int max_sources_per_zone(void) const {
+    return max_sources_per_zone_;
+  }
+
+  // Sets the most stars read from a zone, 100000 by default.  The
+  // brightest are kept.
+  inline void set_max_sources_per_zone(int max_sources_per_zone) {
+    CHECK_GT(max_sources_per_zone, 0);
+    max_sources_per_zone_ = max_sources_per_zone;
+  }
+
+  // Limits the stars read to those with magnitudes between bright and
+  // faint.  There is no limit if they are equal, as by default.
+  inline void set_magnitude_limits(double bright, double faint) {
+    bright_limit_ = bright;
+    faint_limit_ = faint;
+  }
+
+  // Returns the number of threads that handle zones.
+  inline int num_threads(void) const {
+    return num_threads_;
+  }
+
+  // Sets the number of threads that handle zones, which defaults to
+  // ThreadPool::DefaultNumThreads().
+  inline void set_num_threads(int num_threads) {
+    num_threads_ = num_threads;
+  }
+
+ private:
+  // A star and the magnitude it is sorted by.
+  struct Source {
+    double magnitude;
+    CatalogRecord record;
+  };
+
+  class ZoneTask;
+
+  string catalog_;
+  string title_;
+  string name_prefix_;      // Starts the name of every star.
+  int refcat_;              // The libwcs catalog code.
+  int num_magnitudes_;
+  vector<string> magnitude_names_;
+  double zone_height_;
+  int max_sources_per_zone_;
+  double bright_limit_;
+  double faint_limit_;
+  int num_threads_;
+
+  // State of the last call to Read().
+  vector<Source> sources_;
+  size_t position_;
+  int num_truncated_zones_;
+
+  // Searches the zone between dec_min and dec_max (inclusive if
+  // include_max) within ra_min to ra_max, where ra_max may exceed 360, and
+  // appends the stars footprint contains to sources.  Returns false on
+  // failure.
+  bool ReadZone(double ra_min, double ra_max, double dec_min,
+                double dec_max, bool include_max,
+                const SkyFootprint &footprint, vector<Source> *sources,
+                bool *truncated) const;
+
+  // Orders sources by magnitude, with missing magnitudes last.
+  static bool IsBrighter(const Source &a, const Source &b);
+
+  DISALLOW_COPY_AND_ASSIGN(ReferenceCatalog);
+};
+
+}  // namespace google_sky
+
+#endif  // REFERENCECATALOG_H__
@@ -0,0 +1,158 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <cmath>
+#include <cstdio>
+
+#include <iostream>
+#include <string>
+
+#include "base.h"
+#include "boundingbox.h"
+#include "catalog.h"
+#include "referencecatalog.h"
+#include "string_util.h"
+#include "test_util.h"
+#include "wcsprojection.h"
+
+namespace google_sky {
+
+int Main(int argc, char **argv) {
+  // A 1 degree square image at 10, 20.
+  WcsProjection *wcs = WcsProjection::FromHeader(
+      MakeHeader(10.0, 20.0, 100, 100, 0.01));
+  CHECK(wcs != NULL);
+
+  {
+    cout << "Testing SkyFootprint::Contains()... ";
+    SkyFootprint footprint(*wcs, 100, 100, 4);
+    ASSERT_TRUE(footprint.Contains(10.0, 20.0));
+    ASSERT_TRUE(footprint.Contains(10.45, 20.45));
+    ASSERT_TRUE(footprint.Contains(9.55, 19.55));
+    ASSERT_FALSE(footprint.Contains(10.0, 20.6));
+    ASSERT_FALSE(footprint.Contains(9.4, 20.0));
+    ASSERT_FALSE(footprint.Contains(12.0, 20.0));
+
+    // The far side of the sky is never contained.
+    ASSERT_FALSE(footprint.Contains(190.0, -20.0));
+
+    // Images around a pole contain it at every ra.
+    WcsProjection *polar_wcs = WcsProjection::FromHeader(
+        MakeHeader(0.0, 90.0, 100, 100, 0.01));
+    CHECK(polar_wcs != NULL);
+    SkyFootprint polar_footprint(*polar_wcs, 100, 100, 4);
+    ASSERT_TRUE(polar_footprint.Contains(0.0, 89.9));
+    ASSERT_TRUE(polar_footprint.Contains(135.0, 89.9));
+    ASSERT_TRUE(polar_footprint.Contains(270.0, 89.9));
+    ASSERT_FALSE(polar_footprint.Contains(135.0, 89.0));
+    delete polar_wcs;
+    cout << "pass\n";
+  }
+
+  WriteFile("referencecatalog_test_stars.cat",
+            "# Test stars /d /j\n"
+            "# Stars around 10, 20\n"
+            "1 10.00 20.00 12.00\n"
+            "2 10.20 20.30 9.50\n"
+            "3 9.80 19.70 14.00\n"
+            "4 10.00 19.90 11.00\n"
+            "5 12.00 20.00 8.00\n"
+            "6 10.00 22.00 7.00\n"
+            "7 10.45 20.00 10.00\n");
+  BoundingBox box(*wcs, 100, 100);
+  SkyFootprint footprint(*wcs, 100, 100, 16);
+
+  {
+    cout << "Testing ReferenceCatalog::Read()... ";
+    ReferenceCatalog catalog;
+    ASSERT_TRUE(catalog.Open("referencecatalog_test_stars.cat"));
+    catalog.set_zone_height(0.25);
+    catalog.set_num_threads(3);
+    ASSERT_TRUE(catalog.Read(box, footprint));
+    ASSERT_EQ(5, catalog.num_sources());
+    ASSERT_EQ(0, catalog.num_truncated_zones());
+
+    // The stars come brightest first.
+    const char *names[] = { "2", "7", "4", "1", "3" };
+    CatalogRecord record;
+    for (int i = 0; i < 5; ++i) {
+      ASSERT_TRUE(catalog.Next(&record));
+      ASSERT_EQ(string("referencecatalog_test_stars ") + names[i],
+                record.name);
+    }
+    ASSERT_FALSE(catalog.Next(&record));
+
+    // Reading again starts over.
+    ASSERT_TRUE(catalog.Read(box, footprint));
+    ASSERT_TRUE(catalog.Next(&record));
+    ASSERT_FLOAT_EQ(10.2, record.ra, 1e-6);
+    ASSERT_FLOAT_EQ(20.3, record.dec, 1e-6);
+    ASSERT_TRUE(StringContains(record.description, "9.50"));
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing ReferenceCatalog magnitude limits... ";
+    ReferenceCatalog catalog;
+    ASSERT_TRUE(catalog.Open("referencecatalog_test_stars.cat"));
+    catalog.set_magnitude_limits(9.0, 11.5);
+    ASSERT_TRUE(catalog.Read(box, footprint));
+    ASSERT_EQ(3, catalog.num_sources());
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing ReferenceCatalog truncated zones... ";
+    ReferenceCatalog catalog;
+    ASSERT_TRUE(catalog.Open("referencecatalog_test_stars.cat"));
+    catalog.set_zone_height(2.0);
+    catalog.set_max_sources_per_zone(2);
+    ASSERT_TRUE(catalog.Read(box, footprint));
+    ASSERT_EQ(1, catalog.num_truncated_zones());
+    ASSERT_TRUE(catalog.num_sources() <= 2);
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing ReferenceCatalog errors... ";
+    ReferenceCatalog catalog;
+    ASSERT_FALSE(catalog.Open("referencecatalog_test_missing.cat"));
+    ASSERT_TRUE(StringContains(catalog.error(), "Unknown reference catalog"));
+    cout << "pass\n";
+  }
+
+  remove("referencecatalog_test_stars.cat");
+  delete wcs;
+  return 0;
+}
+
+}  // namespace google_sky
+
+int main(int argc, char **argv) {
+  return google_sky::Main(argc, argv);
+}
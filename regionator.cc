@@ -36,6 +36,9 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <string>
+#include <vector>
+
 #include "boundingbox.h"
 #include "color.h"
 #include "kml.h"
@@ -145,62 +148,152 @@ void Regionator::SetMaxTileSideLength(int side_length) {
 }
 
 // Splits the image to be regionated into a set of lower resolution tiles.
-void Regionator::Regionate(void) const {
+bool Regionator::Regionate(string *error) const {
+  KmlNetworkLink network_link;
+  if (!Regionate(&network_link, error)) return false;
+
+  FILE *fp = fopen(root_kml_.c_str(), "w");
+  if (!fp) {
+    *error = StringPrintf("Can't open file '%s' for writing",
+                          root_kml_.c_str());
+    return false;
+  }
+  fprintf(fp, "%s", MakeRootKml().c_str());
+  if (fclose(fp) != 0) {
+    *error = StringPrintf("Can't write file '%s'", root_kml_.c_str());
+    return false;
+  }
+  return true;
+}
+
+// Generates the tiles and returns the link to the top level tile.
+bool Regionator::Regionate(KmlNetworkLink *root_link, string *error) const {
   assert(x_tile_size_ > 0);
   assert(y_tile_size_ > 0);
   
   // Create the output directory if it doesn't exist.
   if (!IsDirectory(output_directory_) && !CreateDirectory(output_directory_)) {
-    fprintf(stderr, "\nCannot create output directory '%s'\n",
-            output_directory_.c_str());
-    exit(EXIT_FAILURE);
+    *error = StringPrintf("Cannot create output directory '%s'",
+                          output_directory_.c_str());
+    return false;
   }
 
-  // We pad the input image with transparency so that it is a multiple of the
-  // tile size.
-  int width_padded = image_->width() + Pad(image_->width(), x_tile_size_);
-  int height_padded = image_->height() + Pad(image_->height(), y_tile_size_);
-
   // Recursively generate the tiles.
-  SplitTileRecursively(0, 0, 0, width_padded - 1, height_padded - 1);
+  int width_padded;
+  int height_padded;
+  GetPaddedSize(&width_padded, &height_padded);
+  if (!SplitTileRecursively(0, 0, 0, width_padded - 1, height_padded - 1,
+                            error)) {
+    return false;
+  }
 
-  // Write the root KML.  The root KML is special because its region should
-  // always be visible, so we must alter the default region to always display.
-  KmlNetworkLink network_link = MakeNetworkLink(0, 0, width_padded - 1,
-                                                height_padded - 1);
-  KmlRegion region = network_link.region.get();
-  KmlLod lod = region.lod.get();
-  lod.min_lod_pixels.set(0);
-  lod.max_lod_pixels.set(-1);
-  region.lod.set(lod);
-  network_link.region.set(region);
+  *root_link = MakeRootNetworkLink();
+  return true;
+}
 
-  // The root KML lives above the subtile directory.
-  KmlLink link = network_link.link.get();
-  string href = link.href.get();
-  link.href.set(output_directory_ + "/" + href);
-  network_link.link.set(link);
+// Wraps the link to the top level tile in a document.
+string Regionator::MakeRootKml(void) const {
+  Kml kml;
+  kml.AddNetworkLink(MakeRootNetworkLink());
+  return kml.ToString();
+}
+
+// Insists on the exact name MakeFilenamePrefix() makes, so that no other
+// spelling of a range (or of a path) is accepted.
+bool Regionator::ParseFilenamePrefix(const string &prefix, int *x1, int *y1,
+                                     int *x2, int *y2) const {
+  string start = filename_prefix_ + "_";
+  if (!StringStartsWith(prefix, start)) return false;
+  vector<string> words;
+  StringSplitOnChar(prefix.substr(start.size()), '_', &words);
+  int range[4];
+  if (words.size() != 4) return false;
+  for (int i = 0; i < 4; ++i) {
+    if (!StringToInt(words[i], &range[i])) return false;
+  }
+  if (MakeFilenamePrefix(range[0], range[1], range[2], range[3]) != prefix) {
+    return false;
+  }
+  *x1 = range[0];
+  *y1 = range[1];
+  *x2 = range[2];
+  *y2 = range[3];
+  return true;
+}
 
+// Renders one tile after checking that the hierarchy has a tile for it.
+bool Regionator::RenderTile(const string &prefix, Image *tile,
+                            string *kml) const {
+  int range[4];
+  if (!ParseFilenamePrefix(prefix, &range[0], &range[1], &range[2],
+                           &range[3])) {
+    return false;
+  }
+
+  int level;
+  if (!FindTileLevel(range[0], range[1], range[2], range[3], &level)) {
+    return false;
+  }
+  Kml tile_kml;
+  MakeTile(level, range[0], range[1], range[2], range[3], tile, &tile_kml);
+  *kml = tile_kml.ToString();
+  return true;
+}
+
+// Recursively splits the tiles into sub-quandrants.
+bool Regionator::SplitTileRecursively(int level, int x1, int y1, int x2,
+                                      int y2, string *error) const {
+  Image subimage;
   Kml kml;
-  kml.AddNetworkLink(network_link);
-  
-  string kmlfile = output_directory_ + "/" + root_kml_;
-  FILE *fp = fopen(root_kml_.c_str(), "w");
+  bool is_split = MakeTile(level, x1, y1, x2, y2, &subimage, &kml);
+
+  // Write tile to file.
+  string prefix = MakeFilenamePrefix(x1, y1, x2, y2);
+  string full_filename = output_directory_ + "/" + prefix + ".png";
+  string full_kml_filename = output_directory_ + "/" + prefix + ".kml";
+  if (!subimage.Write(full_filename)) {
+    *error = StringPrintf("Can't write image '%s' to file",
+                          full_filename.c_str());
+    return false;
+  }
+
+  // We no longer need the memory from this tile, so we clean it up now to
+  // avoid recursing with unnecessary memory allocation.
+  subimage.Clear();
+
+  if (is_split) {
+    // Recursively process each quadrant of this quadrant.
+    int xmid = (x1 + x2) / 2;
+    int ymid = (y1 + y2) / 2;
+    if (!SplitTileRecursively(level + 1, x1, y1, xmid, ymid, error) ||
+        !SplitTileRecursively(level + 1, xmid, y1, x2, ymid, error) ||
+        !SplitTileRecursively(level + 1, x1, ymid, xmid, y2, error) ||
+        !SplitTileRecursively(level + 1, xmid, ymid, x2, y2, error)) {
+      return false;
+    }
+  }
+
+  FILE *fp = fopen(full_kml_filename.c_str(), "w");
   if (!fp) {
-    fprintf(stderr, "\nCan't open file '%s' for writing\n", root_kml_.c_str());
-    exit(EXIT_FAILURE);
+    *error = StringPrintf("Can't open file '%s' for writing",
+                          full_kml_filename.c_str());
+    return false;
   }
   fprintf(fp, "%s", kml.ToString().c_str());
-  fclose(fp);
+  if (fclose(fp) != 0) {
+    *error = StringPrintf("Can't write file '%s'",
+                          full_kml_filename.c_str());
+    return false;
+  }
+  return true;
 }
 
-// Recursively splits the tiles into sub-quandrants.
-void Regionator::SplitTileRecursively(int level, int x1, int y1,
-                                      int x2, int y2) const {
+// Makes the image and KML for one tile.
+bool Regionator::MakeTile(int level, int x1, int y1, int x2, int y2,
+                          Image *subimage, Kml *kml) const {
   // Generate an scaled down version of the image over the given bounding
   // box to be of size tile_side_length_ x tile_side_length_.
-  Image subimage;
-  if (!subimage.Resize(x_tile_size_, y_tile_size_, Image::RGBA)) {
+  if (!subimage->Resize(x_tile_size_, y_tile_size_, Image::RGBA)) {
     fprintf(stderr, "\nCan't resize subimage\n");
     exit(EXIT_FAILURE);
   }
@@ -208,25 +301,25 @@ void Regionator::SplitTileRecursively(int level, int x1, int y1,
   // Copy the relevant pixels from the input image for the scaled down version.
   // Use simple point sampling since Earth applies its own filtering.
   double dx = static_cast<double>(x2 - x1) /
-              static_cast<double>(subimage.width() - 1);
+              static_cast<double>(subimage->width() - 1);
   double dy = static_cast<double>(y2 - y1) /
-              static_cast<double>(subimage.height() - 1);
+              static_cast<double>(subimage->height() - 1);
   Color pixel(4);
   Color transparent(4);
   transparent.SetAllChannels(0);
   bool is_transparent = true;
   bool is_opaque = true;
 
-  for (int i = 0; i < subimage.width(); ++i) {
+  for (int i = 0; i < subimage->width(); ++i) {
     int x = Min(static_cast<int>(x1 + i * dx + 0.5), x2);
-    for (int j = 0; j < subimage.height(); ++j) {
+    for (int j = 0; j < subimage->height(); ++j) {
       int y = Min(static_cast<int>(y1 + j * dy + 0.5), y2);
       if (x >= image_->width() || y >= image_->height()) {
-        subimage.SetPixel(i, j, transparent);
+        subimage->SetPixel(i, j, transparent);
         is_opaque = false;
       } else {
         image_->GetPixel(x, y, &pixel);
-        subimage.SetPixel(i, j, pixel);
+        subimage->SetPixel(i, j, pixel);
 
         // We keep track of empty regions so that we don't recurse further
         // than is necessary.
@@ -247,27 +340,13 @@ void Regionator::SplitTileRecursively(int level, int x1, int y1,
   // much), but more importantly it allows us to easily know which tiles we
   // can safely convert to JPEG later.
   if (is_opaque) {
-    if (!subimage.ConvertToRGB()) {
+    if (!subimage->ConvertToRGB()) {
       fprintf(stderr, "\nCan't convert subimage to RGB\n");
       exit(EXIT_FAILURE);
     }
   }
 
-  // Write tile to file.
-  string prefix = MakeFilenamePrefix(x1, y1, x2, y2);
-  string filename = prefix + ".png";
-  string kml_filename = prefix + ".kml";
-  string full_filename = output_directory_ + "/" + filename;
-  string full_kml_filename = output_directory_ + "/" + kml_filename;
-  if (!subimage.Write(full_filename)) {
-    fprintf(stderr, "\nCan't write image '%s' to file\n",
-            full_filename.c_str());
-    exit(EXIT_FAILURE);
-  }
-
-  // We no longer need the memory from this tile, so we clean it up now to
-  // avoid recursing with unnecessary memory allocation.
-  subimage.Clear();
+  string filename = MakeFilenamePrefix(x1, y1, x2, y2) + ".png";
 
   // Compute the bounding box for this image.
   double north;
@@ -310,9 +389,8 @@ void Regionator::SplitTileRecursively(int level, int x1, int y1,
   ground_overlay.icon.set(icon);
   ground_overlay.lat_lon_box.set(lat_lon_alt_box);
 
-  Kml kml;
-  kml.region.set(region);
-  kml.AddGroundOverlay(ground_overlay);
+  kml->region.set(region);
+  kml->AddGroundOverlay(ground_overlay);
 
   // Draw a border around this image.
   if (draw_tile_borders_) {
@@ -326,7 +404,7 @@ void Regionator::SplitTileRecursively(int level, int x1, int y1,
     KmlPlacemark placemark;
     placemark.line_string.set(line_string);
 
-    kml.AddPlacemark(placemark);
+    kml->AddPlacemark(placemark);
   }
 
   if (x2 - x1 <= x_tile_size_ || y2 - y1 <= y_tile_size_ || is_transparent) {
@@ -334,36 +412,82 @@ void Regionator::SplitTileRecursively(int level, int x1, int y1,
     // desired resolution or the current tile is completely transparent.
     // NB: We use x2 - x1 instead of x2 - x1 + 1 (the true tile width) because
     // there is a 1 pixel overlap between adjacent quads.
-  } else {
-    // Recursively process each quadrant of this quadrant.
-    int xmid = (x1 + x2) / 2;
-    int ymid = (y1 + y2) / 2;
-        
-    // Add the 4 subregions to the KML.
-    KmlNetworkLink ul = MakeNetworkLink(x1, y1, xmid, ymid);
-    KmlNetworkLink ur = MakeNetworkLink(xmid, y1, x2, ymid);
-    KmlNetworkLink ll = MakeNetworkLink(x1, ymid, xmid, y2);
-    KmlNetworkLink lr = MakeNetworkLink(xmid, ymid, x2, y2);
-
-    kml.AddNetworkLink(ul);
-    kml.AddNetworkLink(ur);
-    kml.AddNetworkLink(ll);
-    kml.AddNetworkLink(lr);
-
-    SplitTileRecursively(level + 1, x1, y1, xmid, ymid);  // Upper left quad
-    SplitTileRecursively(level + 1, xmid, y1, x2, ymid);  // Upper right quad
-    SplitTileRecursively(level + 1, x1, ymid, xmid, y2);  // Lower left quad
-    SplitTileRecursively(level + 1, xmid, ymid, x2, y2);  // Lower right quad
+    return false;
   }
 
-  FILE *fp = fopen(full_kml_filename.c_str(), "w");
-  if (!fp) {
-    fprintf(stderr, "Can't open file '%s' for writing\n",
-            full_kml_filename.c_str());
-    exit(EXIT_FAILURE);
+  // Add the 4 subregions to the KML.
+  int xmid = (x1 + x2) / 2;
+  int ymid = (y1 + y2) / 2;
+  kml->AddNetworkLink(MakeNetworkLink(x1, y1, xmid, ymid));
+  kml->AddNetworkLink(MakeNetworkLink(xmid, y1, x2, ymid));
+  kml->AddNetworkLink(MakeNetworkLink(x1, ymid, xmid, y2));
+  kml->AddNetworkLink(MakeNetworkLink(xmid, ymid, x2, y2));
+  return true;
+}
+
+// We pad the input image with transparency so that it is a multiple of the
+// tile size.
+void Regionator::GetPaddedSize(int *width_padded, int *height_padded) const {
+  *width_padded = image_->width() + Pad(image_->width(), x_tile_size_);
+  *height_padded = image_->height() + Pad(image_->height(), y_tile_size_);
+}
+
+// Follows the quadrants containing the range down from the top level tile.
+// Tiles that are entirely transparent aren't split by Regionate(), but
+// nothing links to their subtiles, so they are treated like any other.
+bool Regionator::FindTileLevel(int x1, int y1, int x2, int y2,
+                               int *level) const {
+  int width_padded;
+  int height_padded;
+  GetPaddedSize(&width_padded, &height_padded);
+  int tile_x1 = 0;
+  int tile_y1 = 0;
+  int tile_x2 = width_padded - 1;
+  int tile_y2 = height_padded - 1;
+  for (*level = 0; ; ++*level) {
+    if (x1 == tile_x1 && y1 == tile_y1 && x2 == tile_x2 && y2 == tile_y2) {
+      return true;
+    }
+    if (tile_x2 - tile_x1 <= x_tile_size_ ||
+        tile_y2 - tile_y1 <= y_tile_size_) {
+      return false;
+    }
+    int xmid = (tile_x1 + tile_x2) / 2;
+    int ymid = (tile_y1 + tile_y2) / 2;
+    if (x1 < xmid) {
+      tile_x2 = xmid;
+    } else {
+      tile_x1 = xmid;
+    }
+    if (y1 < ymid) {
+      tile_y2 = ymid;
+    } else {
+      tile_y1 = ymid;
+    }
   }
-  fprintf(fp, "%s", kml.ToString().c_str());
-  fclose(fp);
+}
+
+// The root link is special because its region should always be visible,
+// so we must alter the default region to always display.
+KmlNetworkLink Regionator::MakeRootNetworkLink(void) const {
+  int width_padded;
+  int height_padded;
+  GetPaddedSize(&width_padded, &height_padded);
+  KmlNetworkLink network_link = MakeNetworkLink(0, 0, width_padded - 1,
+                                                height_padded - 1);
+  KmlRegion region = network_link.region.get();
+  KmlLod lod = region.lod.get();
+  lod.min_lod_pixels.set(0);
+  lod.max_lod_pixels.set(-1);
+  region.lod.set(lod);
+  network_link.region.set(region);
+
+  // The root KML lives above the subtile directory.
+  KmlLink link = network_link.link.get();
+  string href = link.href.get();
+  link.href.set(output_directory_ + "/" + href);
+  network_link.link.set(link);
+  return network_link;
 }
 
 // Generates a filename prefix given the range of the image it copies from.
@@ -38,6 +38,7 @@ namespace google_sky {
 
 // Forward declarations.
 class BoundingBox;
+class Kml;
 class KmlNetworkLink;
 
 // Class for regionating an input image and bounding box
@@ -107,7 +108,10 @@ class KmlNetworkLink;
 // regionator.set_draw_tile_borders(true);
 //
 // // Creates the tile hierarchy.
-// regionator.Regionate();
+// string error;
+// if (!regionator.Regionate(&error)) {
+//   // Report error.
+// }
 
 class Regionator {
  public:
@@ -120,8 +124,31 @@ class Regionator {
   }
 
   // Generates a series of output images in the given directory with the
-  // given filename prefixes.
-  void Regionate(void) const;
+  // given filename prefixes.  Returns false with a message in error if the
+  // directory or a file can't be written.
+  bool Regionate(string *error) const;
+
+  // Like Regionate(), but instead of writing the root KML this returns the
+  // network link that it would contain in root_link.  The link's href is
+  // relative to the directory containing output_directory().  This allows
+  // several regionated images to share a single root KML.
+  bool Regionate(KmlNetworkLink *root_link, string *error) const;
+
+  // Returns the text of the root KML that Regionate() writes.
+  string MakeRootKml(void) const;
+
+  // Renders a single tile as Regionate() would write it, without writing
+  // any files.  prefix names the tile the way its files are named, without
+  // the extension (e.g. "tile_0_0_511_511").  The tile image is returned in
+  // tile and the text of its KML in kml.  Returns false if prefix isn't a
+  // tile of the hierarchy.  This is safe to call from several threads at
+  // once.
+  bool RenderTile(const string &prefix, Image *tile, string *kml) const;
+
+  // Parses the pixel range out of a tile filename prefix made by
+  // MakeFilenamePrefix().  Returns false for any other name.
+  bool ParseFilenamePrefix(const string &prefix, int *x1, int *y1, int *x2,
+                           int *y2) const;
 
   // Set the maximum tile side length.
   void SetMaxTileSideLength(int side_length);
@@ -250,8 +277,26 @@ class Regionator {
   // A Regionator must be created with a BoundingBox and Image.
   Regionator();
   
-  // Recursively splits the tiles into sub-quandrants.
-  void SplitTileRecursively(int level, int x1, int y1, int x2, int y2) const;
+  // Recursively splits the tiles into sub-quandrants.  Returns false with a
+  // message in error if a file can't be written.
+  bool SplitTileRecursively(int level, int x1, int y1, int x2, int y2,
+                            string *error) const;
+
+  // Makes the image and KML of the tile covering the given range of pixels
+  // at the given level of the hierarchy.  Returns whether the tile is split
+  // into subtiles, which the KML links to.
+  bool MakeTile(int level, int x1, int y1, int x2, int y2, Image *subimage,
+                Kml *kml) const;
+
+  // Returns the size of the image padded to a multiple of the tile size.
+  void GetPaddedSize(int *width_padded, int *height_padded) const;
+
+  // Finds the level of the tile covering the given range of pixels by
+  // walking down the hierarchy.  Returns false if no tile covers the range.
+  bool FindTileLevel(int x1, int y1, int x2, int y2, int *level) const;
+
+  // Makes the link to the top level tile.
+  KmlNetworkLink MakeRootNetworkLink(void) const;
   
   // Generates a filename prefix for an output tile given the limits of the
   // image that it copies from.
@@ -26,6 +26,8 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
+#include <cstdio>
+
 #include <iostream>
 #include <string>
 
@@ -99,7 +101,8 @@ int Main(int argc, char **argv) {
     regionator.set_output_directory("tiles");
     regionator.set_root_kml("root.kml");
     regionator.set_draw_tile_borders(true);
-    regionator.Regionate();
+    string error;
+    ASSERT_TRUE(regionator.Regionate(&error));
     
     // Read the output tiles and compare them.  We know the name of the
     // output tiles for this cooked example that is a multiple of the tile
@@ -109,7 +112,51 @@ int Main(int argc, char **argv) {
     ASSERT_TRUE(CompareTile("tile_0_255_190_511.png"));
     ASSERT_TRUE(CompareTile("tile_190_0_381_255.png"));
     ASSERT_TRUE(CompareTile("tile_190_255_381_511.png"));
+
+    // Rendering a single tile gives the same image and KML as Regionate().
+    const char *prefixes[] = { "tile_0_0_381_511", "tile_0_0_190_255",
+                               "tile_190_255_381_511" };
+    for (int i = 0; i < 3; ++i) {
+      Image tile;
+      string kml;
+      ASSERT_TRUE(regionator.RenderTile(prefixes[i], &tile, &kml));
+      Image true_tile;
+      ASSERT_TRUE(true_tile.Read(StringPrintf("tiles/%s.png", prefixes[i])));
+      ASSERT_TRUE(tile.ConvertToRGBA());
+      ASSERT_TRUE(tile.Equals(true_tile));
+
+      FILE *fp = fopen(StringPrintf("tiles/%s.kml", prefixes[i]).c_str(),
+                       "r");
+      ASSERT_TRUE(fp != NULL);
+      string true_kml;
+      char buffer[1024];
+      size_t n;
+      while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+        true_kml.append(buffer, n);
+      }
+      fclose(fp);
+      ASSERT_TRUE(kml == true_kml);
+    }
+
+    // Names that aren't tiles of the hierarchy are rejected.
+    const char *bad_prefixes[] = { "tile_0_0_381_510", "tile_0_0_95_127",
+                                   "tile_0_0_190", "tile_00_0_190_255",
+                                   "tiles_0_0_190_255", "tile_0_0_190_255_" };
+    for (int i = 0; i < 6; ++i) {
+      Image tile;
+      string kml;
+      ASSERT_FALSE(regionator.RenderTile(bad_prefixes[i], &tile, &kml));
+    }
     
+    // Files that can't be written are reported rather than exiting.
+    regionator.set_root_kml("tiles/missing/root.kml");
+    ASSERT_FALSE(regionator.Regionate(&error));
+    ASSERT_TRUE(error ==
+                "Can't open file 'tiles/missing/root.kml' for writing");
+    regionator.set_output_directory("root.kml/tiles");
+    ASSERT_FALSE(regionator.Regionate(&error));
+    ASSERT_TRUE(error == "Cannot create output directory 'root.kml/tiles'");
+
     // Clean up.
     ASSERT_TRUE(system("rm root.kml") == 0);
     ASSERT_TRUE(system("rm -rf tiles/") == 0);
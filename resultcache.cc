@@ -0,0 +1,320 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+#include "resultcache.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <utime.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include "file_util.h"
+#include "string_util.h"
+
+namespace google_sky {
+
+namespace {
+
+// Name of the file listing the sizes and paths of an entry's files.  The
+// files themselves are named by their position in the list.
+const char *MANIFEST_NAME = "MANIFEST";
+
+// Prefix of the names of entries that are being created or removed.
+const char *TEMPORARY_PREFIX = ".tmp.";
+
+// Age in seconds after which temporary entries are assumed to have been
+// left by a process that died.
+const int STALE_TEMPORARY_SECONDS = 24 * 60 * 60;
+
+// An entry as seen by Evict().
+struct EntryInfo {
+  time_t last_used;
+  string name;
+  int64 size;
+
+  bool operator<(const EntryInfo &other) const {
+    if (last_used != other.last_used) return last_used < other.last_used;
+    return name < other.name;
+  }
+};
+
+// Returns the size of a file, or -1 if it doesn't exist.
+int64 FileSize(const string &path) {
+  struct stat info;
+  if (stat(path.c_str(), &info) != 0) return -1;
+  return info.st_size;
+}
+
+// Reads the manifest of the entry in directory.
+bool ReadEntryManifest(const string &directory, vector<int64> *sizes,
+                       vector<string> *paths) {
+  FILE *fp = fopen((directory + "/" + MANIFEST_NAME).c_str(), "r");
+  if (!fp) return false;
+  sizes->clear();
+  paths->clear();
+  bool success = true;
+  char buffer[4096];
+  while (success && fgets(buffer, sizeof(buffer), fp)) {
+    string line(buffer);
+    size_t tab = line.find('\t');
+    if (tab == string::npos || line[line.size() - 1] != '\n') {
+      success = false;
+      break;
+    }
+    char *end;
+    int64 size = strtoll(line.c_str(), &end, 10);
+    if (end != line.c_str() + tab || size < 0) success = false;
+    sizes->push_back(size);
+    paths->push_back(line.substr(tab + 1, line.size() - tab - 2));
+  }
+  if (ferror(fp)) success = false;
+  fclose(fp);
+  return success;
+}
+
+// Hard links from to to, replacing to, or copies it if it can't be linked
+// (e.g. because the two are on different file systems).
+bool LinkOrCopy(const string &from, const string &to) {
+  if (unlink(to.c_str()) != 0 && errno != ENOENT) return false;
+  if (link(from.c_str(), to.c_str()) == 0) return true;
+  return CopyFile(from, to);
+}
+
+// Creates the directories leading up to path.
+void MakeParentDirectories(const string &path) {
+  for (size_t slash = path.find('/', 1); slash != string::npos;
+       slash = path.find('/', slash + 1)) {
+    mkdir(path.substr(0, slash).c_str(),
+          S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH);
+  }
+}
+
+// Removes a directory and the files in it.
+void RemoveDirectory(const string &directory) {
+  DIR *dir = opendir(directory.c_str());
+  if (dir != NULL) {
+    struct dirent *file;
+    while ((file = readdir(dir)) != NULL) {
+      string name = file->d_name;
+      if (name != "." && name != "..") {
+        unlink((directory + "/" + name).c_str());
+      }
+    }
+    closedir(dir);
+  }
+  rmdir(directory.c_str());
+}
+
+// Lists the entries in a cache directory, removing temporary entries that
+// were abandoned long ago.
+void ListEntries(const string &directory, vector<EntryInfo> *entries) {
+  entries->clear();
+  DIR *dir = opendir(directory.c_str());
+  if (dir == NULL) return;
+  time_t now = time(NULL);
+  struct dirent *file;
+  while ((file = readdir(dir)) != NULL) {
+    string name = file->d_name;
+    string path = directory + "/" + name;
+    if (name == "." || name == "..") continue;
+    if (StringStartsWith(name, TEMPORARY_PREFIX)) {
+      struct stat info;
+      if (stat(path.c_str(), &info) == 0 &&
+          now - info.st_mtime > STALE_TEMPORARY_SECONDS) {
+        RemoveDirectory(path);
+      }
+      continue;
+    }
+
+    // The manifest is touched whenever the entry is used.
+    struct stat info;
+    vector<int64> sizes;
+    vector<string> paths;
+    if (stat((path + "/" + MANIFEST_NAME).c_str(), &info) != 0 ||
+        !ReadEntryManifest(path, &sizes, &paths)) {
+      continue;
+    }
+    EntryInfo entry;
+    entry.last_used = info.st_mtime;
+    entry.name = name;
+    entry.size = 0;
+    for (size_t i = 0; i < sizes.size(); ++i) {
+      entry.size += sizes[i];
+    }
+    entries->push_back(entry);
+  }
+  closedir(dir);
+}
+
+}  // namespace
+
+ResultCache::ResultCache(const string &directory, int64 max_bytes)
+    : directory_(directory), max_bytes_(max_bytes),
+      num_temporary_entries_(0) {
+  CHECK(!directory.empty());
+  CHECK_GTE(max_bytes, 0);
+  CHECK_EQ(pthread_mutex_init(&mutex_, NULL), 0);
+  CHECK_EQ(pthread_mutex_init(&eviction_mutex_, NULL), 0);
+}
+
+ResultCache::~ResultCache() {
+  pthread_mutex_destroy(&eviction_mutex_);
+  pthread_mutex_destroy(&mutex_);
+}
+
+// Checks every stored file before replacing any outputs.
+bool ResultCache::Restore(const string &key) {
+  CHECK(!key.empty() && key[0] != '.' && key.find('/') == string::npos)
+      << "Bad cache key '" << key << "'";
+  string entry = directory_ + "/" + key;
+  vector<int64> sizes;
+  vector<string> paths;
+  if (!ReadEntryManifest(entry, &sizes, &paths)) return false;
+  for (size_t i = 0; i < paths.size(); ++i) {
+    if (FileSize(StringPrintf("%s/%d", entry.c_str(), static_cast<int>(i))) !=
+        sizes[i]) {
+      string removed = directory_ + "/" + MakeTemporaryName();
+      if (rename(entry.c_str(), removed.c_str()) == 0) {
+        RemoveDirectory(removed);
+      }
+      return false;
+    }
+  }
+
+  for (size_t i = 0; i < paths.size(); ++i) {
+    MakeParentDirectories(paths[i]);
+    if (!LinkOrCopy(StringPrintf("%s/%d", entry.c_str(), static_cast<int>(i)),
+                    paths[i])) {
+      return false;
+    }
+  }
+  utime((entry + "/" + MANIFEST_NAME).c_str(), NULL);
+  return true;
+}
+
+// Builds the entry under a temporary name and then renames it into place.
+bool ResultCache::Store(const string &key, const vector<string> &paths) {
+  CHECK(!key.empty() && key[0] != '.' && key.find('/') == string::npos)
+      << "Bad cache key '" << key << "'";
+  mkdir(directory_.c_str(), S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH);
+  string temporary = directory_ + "/" + MakeTemporaryName();
+  if (mkdir(temporary.c_str(), S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH |
+            S_IXOTH) != 0) {
+    return false;
+  }
+
+  string manifest;
+  bool success = true;
+  for (size_t i = 0; success && i < paths.size(); ++i) {
+    int64 size = FileSize(paths[i]);
+    success = size >= 0 && paths[i].find('\n') == string::npos &&
+              LinkOrCopy(paths[i], StringPrintf("%s/%d", temporary.c_str(),
+                                                static_cast<int>(i)));
+    StringAppendF(&manifest, "%lld\t%s\n", size, paths[i].c_str());
+  }
+  if (success) {
+    FILE *fp = fopen((temporary + "/" + MANIFEST_NAME).c_str(), "w");
+    success = fp != NULL &&
+              fwrite(manifest.data(), 1, manifest.size(), fp) ==
+              manifest.size();
+    if (fp != NULL && fclose(fp) != 0) success = false;
+  }
+
+  // An existing entry is moved aside first because directories can only be
+  // renamed over empty ones.
+  string entry = directory_ + "/" + key;
+  if (success) {
+    string replaced = directory_ + "/" + MakeTemporaryName();
+    if (rename(entry.c_str(), replaced.c_str()) == 0) {
+      RemoveDirectory(replaced);
+    }
+    success = rename(temporary.c_str(), entry.c_str()) == 0;
+  }
+  if (!success) {
+    RemoveDirectory(temporary);
+    return false;
+  }
+  Evict();
+  return true;
+}
+
+void ResultCache::Evict(void) {
+  pthread_mutex_lock(&eviction_mutex_);
+  vector<EntryInfo> entries;
+  ListEntries(directory_, &entries);
+  sort(entries.begin(), entries.end());
+  int64 total = 0;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    total += entries[i].size;
+  }
+  for (size_t i = 0; i < entries.size() && total > max_bytes_; ++i) {
+    string entry = directory_ + "/" + entries[i].name;
+    string removed = directory_ + "/" + MakeTemporaryName();
+    if (rename(entry.c_str(), removed.c_str()) == 0) {
+      RemoveDirectory(removed);
+      total -= entries[i].size;
+    }
+  }
+  pthread_mutex_unlock(&eviction_mutex_);
+}
+
+int64 ResultCache::SizeInBytes(void) {
+  vector<EntryInfo> entries;
+  ListEntries(directory_, &entries);
+  int64 total = 0;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    total += entries[i].size;
+  }
+  return total;
+}
+
+void ResultCache::RemoveFiles(const vector<string> &paths) {
+  for (size_t i = 0; i < paths.size(); ++i) {
+    unlink(paths[i].c_str());
+  }
+}
+
+// Combines the process id with a counter so that processes sharing the
+// cache don't collide.
+string ResultCache::MakeTemporaryName(void) {
+  pthread_mutex_lock(&mutex_);
+  int serial = num_temporary_entries_++;
+  pthread_mutex_unlock(&mutex_);
+  return StringPrintf("%s%d.%d", TEMPORARY_PREFIX,
+                      static_cast<int>(getpid()), serial);
+}
+
+}  // namespace google_sky
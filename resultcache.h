@@ -0,0 +1,139 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+// Defines the ResultCache class for reusing the outputs of earlier runs
+
+#ifndef RESULTCACHE_H__
+#define RESULTCACHE_H__
+
+#include <pthread.h>
+
+#include <string>
+#include <vector>
+
+#include "base.h"
+
+namespace google_sky {
+
+// Class for caching the output files of whole runs
+//
+// Each entry holds the output files of one run under a key that the caller
+// derives from everything that affects the outputs (typically a Sha256 of
+// the input files and options).  Restoring an entry puts the files back at
+// the paths they were stored from, so a run with the same key can skip all
+// of its work.
+//
+// Files are hard linked into and out of the cache when possible and copied
+// otherwise, so restored outputs may share storage with the cache.  Replace
+// such files rather than modifying them in place; RemoveFiles() does this
+// for outputs that are about to be rewritten.  An entry whose files have
+// changed size is treated as missing.
+//
+// The cache is a directory with one subdirectory per entry.  When the
+// entries add up to more than the size limit the least recently stored or
+// restored ones are removed.  Entries are created under temporary names and
+// renamed into place, so several processes can share a cache.  All methods
+// are thread safe.
+//
+// Example Usage:
+//
+// ResultCache cache("result_cache", 1 << 30);
+// string key = ...;  // Digest of the inputs and options.
+// if (!cache.Restore(key)) {
+//   vector<string> outputs;
+//   outputs.push_back("warped_image.png");
+//   outputs.push_back("doc.kml");
+//   ResultCache::RemoveFiles(outputs);
+//   // ... write the outputs ...
+//   cache.Store(key, outputs);
+// }
+
+class ResultCache {
+ public:
+  // Creates a cache in directory (created when first needed) holding at
+  // most max_bytes of files.
+  ResultCache(const string &directory, int64 max_bytes);
+
+  ~ResultCache();
+
+  // Restores the files stored under key.  Returns false if there is no
+  // usable entry for key, in which case some of the files may have been
+  // replaced.
+  bool Restore(const string &key);
+
+  // Stores the files at paths under key, replacing any entry it already
+  // has, and then evicts entries to stay within the size limit.  Returns
+  // false if the files couldn't be stored.  The files themselves are left
+  // as they are either way.
+  bool Store(const string &key, const vector<string> &paths);
+
+  // Removes least recently used entries until the cache fits within its
+  // size limit.
+  void Evict(void);
+
+  // Returns the total size in bytes of the files in the cache.
+  int64 SizeInBytes(void);
+
+  // Returns the cache directory.
+  inline const string &directory(void) const {
+    return directory_;
+  }
+
+  // Returns the size limit in bytes.
+  inline int64 max_bytes(void) const {
+    return max_bytes_;
+  }
+
+  // Removes the given files if they exist, so that writing new outputs
+  // can't change files shared with the cache.
+  static void RemoveFiles(const vector<string> &paths);
+
+ private:
+  string directory_;
+  int64 max_bytes_;
+
+  // Number of temporary entries created so far, for naming them.
+  int num_temporary_entries_;
+
+  // Guards num_temporary_entries_.
+  pthread_mutex_t mutex_;
+
+  // Serializes evictions.
+  pthread_mutex_t eviction_mutex_;
+
+  // Returns a unique name for a temporary entry.
+  string MakeTemporaryName(void);
+
+  // A ResultCache must be created with a directory.
+  ResultCache();
+
+  DISALLOW_COPY_AND_ASSIGN(ResultCache);
+};
+
+}  // namespace google_sky
+
+#endif  // RESULTCACHE_H__
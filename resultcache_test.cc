@@ -0,0 +1,167 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <utime.h>
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "base.h"
+#include "file_util.h"
+#include "resultcache.h"
+#include "string_util.h"
+#include "test_util.h"
+
+static const char *CACHE_DIRECTORY = "resultcache_test_cache";
+
+namespace google_sky {
+
+// Sets the last use of a cache entry to the given time.
+void SetLastUsed(const string &key, time_t when) {
+  struct utimbuf times;
+  times.actime = when;
+  times.modtime = when;
+  string manifest = StringPrintf("%s/%s/MANIFEST", CACHE_DIRECTORY,
+                                 key.c_str());
+  ASSERT_TRUE(utime(manifest.c_str(), &times) == 0);
+}
+
+int Main(int argc, char **argv) {
+  {
+    cout << "Testing Store() and Restore()... ";
+
+    vector<string> paths;
+    paths.push_back("resultcache_test_a.txt");
+    paths.push_back("resultcache_test_dir/b.txt");
+    ASSERT_TRUE(mkdir("resultcache_test_dir", S_IRWXU) == 0);
+    WriteFile(paths[0], "first output");
+    WriteFile(paths[1], "second");
+
+    ResultCache cache(CACHE_DIRECTORY, 1000);
+    ASSERT_FALSE(cache.Restore("key1"));
+    ASSERT_TRUE(cache.Store("key1", paths));
+    ASSERT_EQ(18, static_cast<int>(cache.SizeInBytes()));
+
+    // Outputs are replaced rather than modified, so the cache keeps the
+    // original files.
+    ResultCache::RemoveFiles(paths);
+    ASSERT_FALSE(FileExists(paths[0]));
+    WriteFile(paths[0], "something else");
+    ASSERT_TRUE(system("rm -rf resultcache_test_dir") == 0);
+
+    ASSERT_TRUE(cache.Restore("key1"));
+    ASSERT_TRUE(ReadFile(paths[0]) == "first output");
+    ASSERT_TRUE(ReadFile(paths[1]) == "second");
+
+    // Storing under the same key replaces the entry.
+    ResultCache::RemoveFiles(paths);
+    WriteFile(paths[0], "new");
+    WriteFile(paths[1], "files");
+    ASSERT_TRUE(cache.Store("key1", paths));
+    ResultCache::RemoveFiles(paths);
+    ASSERT_TRUE(cache.Restore("key1"));
+    ASSERT_TRUE(ReadFile(paths[0]) == "new");
+    ASSERT_TRUE(ReadFile(paths[1]) == "files");
+    ASSERT_EQ(8, static_cast<int>(cache.SizeInBytes()));
+
+    // Entries whose files were changed in place are dropped.
+    WriteFile(paths[0], "modified in place");
+    ASSERT_FALSE(cache.Restore("key1"));
+    ASSERT_EQ(0, static_cast<int>(cache.SizeInBytes()));
+
+    // Missing outputs can't be stored.
+    vector<string> missing(1, "resultcache_test_missing.txt");
+    ASSERT_FALSE(cache.Store("key2", missing));
+    ASSERT_FALSE(cache.Restore("key2"));
+
+    // Clean up.
+    ResultCache::RemoveFiles(paths);
+    ASSERT_TRUE(system("rm -rf resultcache_test_dir") == 0);
+    ASSERT_TRUE(system("rm -rf resultcache_test_cache") == 0);
+
+    cout << "pass\n";
+  }
+  {
+    cout << "Testing Evict()... ";
+
+    // Each entry is 100 bytes and the cache holds 250.
+    ResultCache cache(CACHE_DIRECTORY, 250);
+    vector<string> paths(1, "resultcache_test_a.txt");
+    WriteFile(paths[0], string(100, 'a'));
+    ASSERT_TRUE(cache.Store("k0", paths));
+    ResultCache::RemoveFiles(paths);
+    SetLastUsed("k0", 1000000);
+    WriteFile(paths[0], string(100, 'b'));
+    ASSERT_TRUE(cache.Store("k1", paths));
+    ResultCache::RemoveFiles(paths);
+    SetLastUsed("k1", 1000001);
+    ASSERT_EQ(200, static_cast<int>(cache.SizeInBytes()));
+
+    // Restoring k0 makes k1 the least recently used entry, so storing a
+    // third entry evicts k1.
+    ASSERT_TRUE(cache.Restore("k0"));
+    ResultCache::RemoveFiles(paths);
+    WriteFile(paths[0], string(100, 'c'));
+    ASSERT_TRUE(cache.Store("k2", paths));
+    ResultCache::RemoveFiles(paths);
+    ASSERT_EQ(200, static_cast<int>(cache.SizeInBytes()));
+    ASSERT_FALSE(cache.Restore("k1"));
+    ASSERT_TRUE(cache.Restore("k0"));
+    ASSERT_TRUE(ReadFile(paths[0]) == string(100, 'a'));
+    ASSERT_TRUE(cache.Restore("k2"));
+    ASSERT_TRUE(ReadFile(paths[0]) == string(100, 'c'));
+
+    // Entries bigger than the whole cache aren't kept.
+    ResultCache::RemoveFiles(paths);
+    WriteFile(paths[0], string(300, 'd'));
+    ASSERT_TRUE(cache.Store("k3", paths));
+    ASSERT_FALSE(cache.Restore("k3"));
+    ASSERT_EQ(0, static_cast<int>(cache.SizeInBytes()));
+
+    // Clean up.
+    ResultCache::RemoveFiles(paths);
+    ASSERT_TRUE(system("rm -rf resultcache_test_cache") == 0);
+
+    cout << "pass\n";
+  }
+
+  cout << "Passed\n";
+  return 0;
+}
+
+}  // namespace google_sky
+
+int main(int argc, char **argv) {
+  return google_sky::Main(argc, argv);
+}
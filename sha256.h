@@ -0,0 +1,92 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+// Defines the Sha256 class for computing SHA-256 digests
+
+#ifndef SHA256_H__
+#define SHA256_H__
+
+#include <string>
+
+#include "base.h"
+
+namespace google_sky {
+
+// Class for computing SHA-256 digests (FIPS 180-4)
+//
+// This is used to name cached results by their inputs, so it favors
+// simplicity over speed.
+//
+// Example Usage:
+//
+// Sha256 sha;
+// sha.Update("some ");
+// sha.Update("data");
+// string digest = sha.HexDigest();  // 64 lowercase hex digits.
+
+class Sha256 {
+ public:
+  Sha256();
+
+  ~Sha256() {
+    // Nothing needed.
+  }
+
+  // Adds data to the message.
+  void Update(const void *data, size_t length);
+  void Update(const string &data);
+
+  // Adds the contents of a file to the message.  Returns false if the file
+  // can't be read.
+  bool UpdateFromFile(const string &filename);
+
+  // Finishes the message and returns its digest as lowercase hex.  Nothing
+  // can be added afterwards.
+  string HexDigest(void);
+
+ private:
+  // Current hash value.
+  uint state_[8];
+
+  // Partial block waiting for more data.
+  uint8 block_[64];
+  size_t block_length_;
+
+  // Total message length in bytes.
+  uint64 length_;
+
+  bool finished_;
+
+  // Mixes a full block into the state.
+  void ProcessBlock(const uint8 *block);
+
+  DISALLOW_COPY_AND_ASSIGN(Sha256);
+};
+
+}  // namespace google_sky
+
+#endif  // SHA256_H__
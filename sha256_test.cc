@@ -0,0 +1,115 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+#include <cstdio>
+
+#include <iostream>
+#include <string>
+
+#include "base.h"
+#include "sha256.h"
+
+namespace google_sky {
+
+// Returns the digest of data.
+string Digest(const string &data) {
+  Sha256 sha;
+  sha.Update(data);
+  return sha.HexDigest();
+}
+
+int Main(int argc, char **argv) {
+  {
+    cout << "Testing HexDigest()... ";
+
+    // Test vectors from FIPS 180-4.
+    ASSERT_TRUE(Digest("") ==
+                "e3b0c44298fc1c149afbf4c8996fb924"
+                "27ae41e4649b934ca495991b7852b855");
+    ASSERT_TRUE(Digest("abc") ==
+                "ba7816bf8f01cfea414140de5dae2223"
+                "b00361a396177a9cb410ff61f20015ad");
+    ASSERT_TRUE(Digest("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnop"
+                       "nopq") ==
+                "248d6a61d20638b8e5c026930c3e6039"
+                "a33ce45964ff2167f6ecedd419db06c1");
+
+    // A million a's, added in pieces that straddle block boundaries.
+    Sha256 sha;
+    string piece(997, 'a');
+    int remaining = 1000000;
+    while (remaining > 0) {
+      int n = remaining < 997 ? remaining : 997;
+      sha.Update(piece.data(), n);
+      remaining -= n;
+    }
+    ASSERT_TRUE(sha.HexDigest() ==
+                "cdc76e5c9914fb9281a1c7e284d73e67"
+                "f1809a48a497200e046d39ccc7112cd0");
+
+    // Every length around the padding boundary.
+    for (int length = 50; length < 70; ++length) {
+      string data(length, 'x');
+      Sha256 split;
+      split.Update(data.substr(0, length / 3));
+      split.Update(data.substr(length / 3));
+      ASSERT_TRUE(split.HexDigest() == Digest(data));
+    }
+
+    cout << "pass\n";
+  }
+  {
+    cout << "Testing UpdateFromFile()... ";
+
+    const char *tmp_file = "sha256_test_tmp.txt";
+    FILE *fp = fopen(tmp_file, "wb");
+    ASSERT_TRUE(fp != NULL);
+    fputs("abc", fp);
+    fclose(fp);
+
+    Sha256 sha;
+    ASSERT_TRUE(sha.UpdateFromFile(tmp_file));
+    ASSERT_TRUE(sha.HexDigest() == Digest("abc"));
+
+    Sha256 missing;
+    ASSERT_FALSE(missing.UpdateFromFile("sha256_test_missing.txt"));
+
+    // Clean up.
+    ASSERT_TRUE(remove(tmp_file) == 0);
+
+    cout << "pass\n";
+  }
+
+  cout << "Passed\n";
+  return 0;
+}
+
+}  // namespace google_sky
+
+int main(int argc, char **argv) {
+  return google_sky::Main(argc, argv);
+}
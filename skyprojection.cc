@@ -28,6 +28,7 @@
 
 #include "skyprojection.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 
@@ -46,11 +47,6 @@ static const int MAX_SIDE_LENGTH_DEFAULT = 10000;
 static const double TINY_THETA_VALUE = 0.1;
 static const double TINY_FLOAT_VALUE = 1.0e-8;
 
-// Rounds a double to the nearest int.
-inline int Round(double value) {
-  return static_cast<int>(value + 0.5);
-}
-
 }  // namespace
 
 namespace google_sky {
@@ -59,6 +55,10 @@ namespace google_sky {
 // box used for the projection later.
 SkyProjection::SkyProjection(const Image &image, const WcsProjection &wcs)
     : bounding_box_(),
+      mask_(NULL),
+      mask_image_(NULL),
+      mask_color_(4),
+      use_mask_color_(false),
       bg_color_(4),
       projected_width_(0),
       projected_height_(0) {
@@ -160,26 +160,8 @@ void SkyProjection::WarpImage(Image *projected_image) const {
 
   projected_image->Resize(projected_width_, projected_height_, Image::RGBA);
 
-  double ra_min;
-  double ra_max;
-  bounding_box_.GetMonotonicRaBounds(&ra_min, &ra_max);
-  
-  double dec_min;
-  double dec_max;
-  bounding_box_.GetDecBounds(&dec_min, &dec_max);
-
-  // Scale factors for converting ra, dec to x, y in projected image.
-  double xscale = (ra_max - ra_min) /
-                  static_cast<double>(projected_image->width() - 1);
-  double yscale = (dec_max - dec_min) /
-                  static_cast<double>(projected_image->height() - 1);
-
-  // Alter the loop to run from max ra to min ra for <GroundOverlay> elements.
-  double ra_start = ra_min;
-  if (!FLAGS_align_with_base_imagery) {
-    xscale = -xscale;
-    ra_start = ra_max;
-  }
+  double ra_start, ra_step, dec_max, dec_step;
+  GetProjectedGrid(&ra_start, &ra_step, &dec_max, &dec_step);
 
   // For each pixel in the new image, compute ra, dec then x, y in the original
   // image and copy the pixel values.
@@ -190,42 +172,213 @@ void SkyProjection::WarpImage(Image *projected_image) const {
   Color pixel(4);
 
   for (int i = 0; i < projected_image->width(); ++i) {
-    double ra = ra_start + i * xscale;
+    double ra = ra_start + i * ra_step;
     for (int j = 0; j < projected_image->height(); ++j) {
-      double dec = dec_max - j * yscale;
-      // Coordinates in original FITS image start at (1, 1) in the lower left
-      // corner.  Here we convert them so that point (0, 0) is in the upper
-      // left corner if needed.
-      double x;
-      double y;
-      bool inside = wcs_->ToPixel(ra, dec, &x, &y);
-
-      x -= 1.0;
-      if (input_image_origin_ == LOWER_LEFT) {
-        y = image_->height() - y;
-      } else {
-        y -= 1.0;
-      }
-
-      if (!inside) {
+      double dec = dec_max - j * dec_step;
+      int m;
+      int n;
+      if (!FindInputPixel(ra, dec, &m, &n) ||
+          !SampleInputPixel(*image_, m, n, &pixel)) {
         // Draw a pixel of the background color for points that lie outside of
-        // the original image.
+        // the original image or are masked out.
         projected_image->SetPixel(i, j, bg_color_);
       } else {
         // Copy the input pixel and preserve its alpha channel.  We use
         // point sampling because the Earth client applies its own filtering.
-        int m = Round(x);
-        if (m >= image_->width()) m = image_->width() - 1;
-        int n = Round(y);
-        if (n >= image_->height()) n = image_->height() - 1;
+        projected_image->SetPixel(i, j, pixel);
+      }
+    }
+  }
+}
+
+// Unlike WarpImage(), which places its outer pixels on the edges of the
+// bounding box, the pixels here are centered in equal cells of the box
+// because the edges of a region are shared with its neighbours.
+void SkyProjection::WarpRegion(double ra_min, double ra_max, double dec_min,
+                               double dec_max, Image *region) const {
+  assert(image_ != NULL);
+  assert(image_->width() == original_width_);
+  assert(image_->height() == original_height_);
+  CHECK_EQ(region->colorspace(), Image::RGBA);
+  CHECK_GT(region->width(), 0);
+  CHECK_GT(region->height(), 0);
+
+  double ra_step = (ra_max - ra_min) / static_cast<double>(region->width());
+  double dec_step = (dec_max - dec_min) /
+                    static_cast<double>(region->height());
+  double ra_start = ra_min + 0.5 * ra_step;
+  if (!FLAGS_align_with_base_imagery) {
+    ra_step = -ra_step;
+    ra_start = ra_max + 0.5 * ra_step;
+  }
+  double dec_start = dec_max - 0.5 * dec_step;
+
+  Color pixel(4);
+  for (int i = 0; i < region->width(); ++i) {
+    double ra = ra_start + i * ra_step;
+    for (int j = 0; j < region->height(); ++j) {
+      double dec = dec_start - j * dec_step;
+      int m;
+      int n;
+      if (!FindInputPixel(ra, dec, &m, &n) ||
+          !SampleInputPixel(*image_, m, n, &pixel)) {
+        region->SetPixel(i, j, bg_color_);
+      } else {
+        region->SetPixel(i, j, pixel);
+      }
+    }
+  }
+}
+
+// The scale is taken from the diagonal neighbour of the central pixel,
+// using the haversine formula so that it stays accurate for tiny pixels.
+double SkyProjection::InputPixelScale(void) const {
+  double x = 0.5 * original_width_;
+  double y = 0.5 * original_height_;
+  double ra1, dec1, ra2, dec2;
+  wcs_->ToRaDec(x, y, &ra1, &dec1);
+  wcs_->ToRaDec(x + 1.0, y + 1.0, &ra2, &dec2);
+
+  double to_radians = PI / 180.0;
+  double sin_ddec = sin(0.5 * (dec2 - dec1) * to_radians);
+  double sin_dra = sin(0.5 * (ra2 - ra1) * to_radians);
+  double h = sin_ddec * sin_ddec + cos(dec1 * to_radians) *
+             cos(dec2 * to_radians) * sin_dra * sin_dra;
+  double distance = 2.0 * asin(sqrt(min(1.0, h))) / to_radians;
+  return distance / sqrt(2.0);
+}
+
+// Stores the input pixel index for every projected pixel, visiting the
+// projected pixels in the same order as WarpImage().
+void SkyProjection::ComputeWarpMap(vector<int> *warp_map) const {
+  assert(projected_width_ > 0);
+  assert(projected_height_ > 0);
+  CHECK_LT(static_cast<double>(original_width_) * original_height_,
+           2147483647.0) << "Image is too large for a warp map";
+
+  warp_map->resize(static_cast<size_t>(projected_width_) * projected_height_);
+
+  double ra_start, ra_step, dec_max, dec_step;
+  GetProjectedGrid(&ra_start, &ra_step, &dec_max, &dec_step);
+
+  for (int i = 0; i < projected_width_; ++i) {
+    double ra = ra_start + i * ra_step;
+    for (int j = 0; j < projected_height_; ++j) {
+      double dec = dec_max - j * dec_step;
+      int m;
+      int n;
+      int index = -1;
+      if (FindInputPixel(ra, dec, &m, &n)) {
+        index = n * original_width_ + m;
+      }
+      (*warp_map)[static_cast<size_t>(j) * projected_width_ + i] = index;
+    }
+  }
+}
+
+// Copies pixels through the map, so no coordinates are converted.
+void SkyProjection::WarpImageWithMap(const Image &image,
+                                     const vector<int> &warp_map,
+                                     Image *projected_image) const {
+  CHECK_EQ(image.width(), original_width_);
+  CHECK_EQ(image.height(), original_height_);
+  CHECK(image.colorspace() == Image::RGBA) << "Image must be RGBA";
+  CHECK_EQ(static_cast<double>(warp_map.size()),
+           static_cast<double>(projected_width_) * projected_height_);
+
+  projected_image->Resize(projected_width_, projected_height_, Image::RGBA);
 
-        image_->GetPixel(m, n, &pixel);
+  Color pixel(4);
+  for (int j = 0; j < projected_height_; ++j) {
+    const int *row = &warp_map[static_cast<size_t>(j) * projected_width_];
+    for (int i = 0; i < projected_width_; ++i) {
+      if (row[i] < 0 ||
+          !SampleInputPixel(image, row[i] % original_width_,
+                            row[i] / original_width_, &pixel)) {
+        projected_image->SetPixel(i, j, bg_color_);
+      } else {
         projected_image->SetPixel(i, j, pixel);
       }
     }
   }
 }
 
+// The projected image spans the bounding box with ra decreasing to the
+// right (unless aligning with base imagery) and dec decreasing downwards.
+void SkyProjection::GetProjectedGrid(double *ra_start, double *ra_step,
+                                     double *dec_max,
+                                     double *dec_step) const {
+  double ra_min;
+  double ra_max;
+  bounding_box_.GetMonotonicRaBounds(&ra_min, &ra_max);
+
+  double dec_min;
+  bounding_box_.GetDecBounds(&dec_min, dec_max);
+
+  // Scale factors for converting ra, dec to x, y in projected image.
+  *ra_step = (ra_max - ra_min) / static_cast<double>(projected_width_ - 1);
+  *dec_step = (*dec_max - dec_min) /
+              static_cast<double>(projected_height_ - 1);
+
+  // Alter the loop to run from max ra to min ra for <GroundOverlay> elements.
+  *ra_start = ra_min;
+  if (!FLAGS_align_with_base_imagery) {
+    *ra_step = -*ra_step;
+    *ra_start = ra_max;
+  }
+}
+
+bool SkyProjection::FindInputPixel(double ra, double dec, int *m,
+                                   int *n) const {
+  // Coordinates in original FITS image start at (1, 1) in the lower left
+  // corner.  Here we convert them so that point (0, 0) is in the upper
+  // left corner if needed.
+  double x;
+  double y;
+  bool inside = wcs_->ToPixel(ra, dec, &x, &y);
+  if (!inside) {
+    return false;
+  }
+
+  x -= 1.0;
+  if (input_image_origin_ == LOWER_LEFT) {
+    y = original_height_ - y;
+  } else {
+    y -= 1.0;
+  }
+
+  *m = Round(x);
+  if (*m >= original_width_) *m = original_width_ - 1;
+  *n = Round(y);
+  if (*n >= original_height_) *n = original_height_ - 1;
+  return *m >= 0 && *n >= 0;
+}
+
+// The cheapest masks are checked first so that masked out pixels of the
+// input image are never read.
+bool SkyProjection::SampleInputPixel(const Image &image, int m, int n,
+                                     Color *pixel) const {
+  if (mask_ && !mask_->Get(m, n)) {
+    return false;
+  }
+  uint8 alpha = 255;
+  if (mask_image_) {
+    alpha = mask_image_->GetValue(m, n, 0);
+    if (alpha == 0) {
+      return false;
+    }
+  }
+
+  image.GetPixel(m, n, pixel);
+  if (use_mask_color_ && pixel->EqualsIgnoringAlpha(mask_color_)) {
+    return false;
+  }
+  if (mask_image_) {
+    pixel->SetChannel(3, alpha);
+  }
+  return true;
+}
+
 // Writes a KML representation of the bounding box to string kml_string.  The
 // filename imagefile points to the image to include in the <GroundOverlay>
 // element and ground_overlay_name gives the <name> element of the overlay.
@@ -248,7 +401,9 @@ void SkyProjection::CreateKmlGroundOverlay(
 
 // Writes a World File representation to world_file_string.  Similar to KML
 // coordinates, a World File expects the coordinates to be between 0 and 180.
-void SkyProjection::CreateWorldFile(string *world_file_string) const {
+void SkyProjection::GetWorldTransform(double *x_scale, double *y_scale,
+                                      double *x_origin,
+                                      double *y_origin) const {
   // We need to ensure that ra increases monotonically from ra_min.ra to
   // ra_max.ra so that the pixel scale calculation is correct.
   double ra_min_monotonic;
@@ -264,15 +419,26 @@ void SkyProjection::CreateWorldFile(string *world_file_string) const {
   double dec_max;
   bounding_box_.GetDecBounds(&dec_min, &dec_max);
 
-  // Convert wrapped coordinates to -180, 180 range for normal longitude
-  // coordinates.
-  ra_min_wrapped -= 180.0;
-  ra_max_wrapped -= 180.0;
+  // Coordinates in the interior of the image are attained by
+  // corner + i * scale, so we must negate the ra pixel scale because ra max
+  // is at point (0, 0).  The wrapped coordinates are converted to the
+  // -180, 180 range for normal longitude coordinates.
+  //
+  // Also note that the pixel indexes referred to by the WCS refer to the
+  // pixel centers, so no 1/2 pixel adjustment is needed for the corners.
+  *x_scale = -(ra_max_monotonic - ra_min_monotonic) /
+             static_cast<double>(projected_width_);
+  *y_scale = -(dec_max - dec_min) / static_cast<double>(projected_height_);
+  *x_origin = ra_max_wrapped - 180.0;
+  *y_origin = dec_max;
+}
 
-  double ra_pixel_scale = (ra_max_monotonic - ra_min_monotonic) /
-                           static_cast<double>(projected_width_);
-  double dec_pixel_scale = (dec_max - dec_min) /
-                           static_cast<double>(projected_height_);
+void SkyProjection::CreateWorldFile(string *world_file_string) const {
+  double x_scale;
+  double y_scale;
+  double x_origin;
+  double y_origin;
+  GetWorldTransform(&x_scale, &y_scale, &x_origin, &y_origin);
 
   // A world file contains 6 lines describing the coordinate system.  They are:
   // Line 1: pixel size in the x-direction in map units/pixel
@@ -283,20 +449,13 @@ void SkyProjection::CreateWorldFile(string *world_file_string) const {
   //         upper left corner (for our outputs it's negative)
   // Line 5: x-coordinate of the center of the upper left pixel
   // Line 6: y-coordinate of the center of the upper left pixel
-  //
-  // Coordinates in the interior of the image are attained by
-  // corner + i * scale, so we must negate the ra pixel scale because ra max
-  // is at point (0, 0).
-  //
-  // Also note that the pixel indexes referred to by the WCS refer to the
-  // pixel centers, so no 1/2 pixel adjustment is needed for the corners.
   world_file_string->clear();
-  StringAppendF(world_file_string, "%.14f\n", -ra_pixel_scale);
+  StringAppendF(world_file_string, "%.14f\n", x_scale);
   StringAppendF(world_file_string, "%.14f\n", 0.0);
   StringAppendF(world_file_string, "%.14f\n", 0.0);
-  StringAppendF(world_file_string, "%.14f\n", -dec_pixel_scale);
-  StringAppendF(world_file_string, "%.14f\n", ra_max_wrapped);
-  StringAppendF(world_file_string, "%.14f\n", dec_max);
+  StringAppendF(world_file_string, "%.14f\n", y_scale);
+  StringAppendF(world_file_string, "%.14f\n", x_origin);
+  StringAppendF(world_file_string, "%.14f\n", y_origin);
 }
 
 }  // namespace google_sky
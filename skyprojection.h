@@ -34,8 +34,10 @@
 #include <cmath>
 
 #include <string>
+#include <vector>
 
 #include "base.h"
+#include "bitmask.h"
 #include "boundingbox.h"
 #include "color.h"
 #include "image.h"
@@ -150,15 +152,87 @@ class SkyProjection {
     }
   }
 
+  // Sets a mask for the input image, or NULL to use no mask.  Input pixels
+  // that are masked out are drawn with the background color when warping,
+  // just like points outside of the input image, so the mask never has to
+  // be copied into the alpha channel of the input image.  The mask must
+  // have the same dimensions and orientation as the input image.  Only a
+  // pointer is saved, so the mask must outlive the warping.
+  inline void set_mask(const BitMask *mask) {
+    if (mask) {
+      CHECK_EQ(mask->width(), original_width_);
+      CHECK_EQ(mask->height(), original_height_);
+    }
+    mask_ = mask;
+  }
+
+  // Sets a grayscale mask image for the input image, or NULL to use no mask
+  // image.  The mask value is used as the alpha of each sampled pixel, as
+  // with Mask::SetAlphaChannelFromMask(), and pixels with a mask value of 0
+  // are drawn with the background color.  Like set_mask(), only a pointer
+  // is saved and the mask image must match the input image.
+  inline void set_mask_image(const Image *mask_image) {
+    if (mask_image) {
+      CHECK_EQ(mask_image->width(), original_width_);
+      CHECK_EQ(mask_image->height(), original_height_);
+      CHECK_EQ(mask_image->channels(), 1);
+    }
+    mask_image_ = mask_image;
+  }
+
+  // Masks out every input pixel whose color channels equal those of color,
+  // ignoring alpha.  Matching pixels are drawn with the background color.
+  // The input color must have 4 channels or this method dies.
+  inline void SetMaskColor(const Color &color) {
+    CHECK_EQ(color.channels(), 4);
+    mask_color_.CopyChannels(color, 0, color.channels());
+    use_mask_color_ = true;
+  }
+
+  // Stops masking out pixels by color.
+  inline void ClearMaskColor(void) {
+    use_mask_color_ = false;
+  }
+
   // Returns the current input image origin.
   inline ImageOrigin input_image_origin(void) const {
     return input_image_origin_;
   }
  
   // Warps the underlying image.  The alpha channel of the input image is
-  // preserved.
+  // preserved.  Any masks are checked only for the input pixels that are
+  // sampled.
   void WarpImage(Image *projected_image) const;
 
+  // Warps the part of the underlying image inside the given ra, dec box into
+  // region, which must already be sized and in colorspace RGBA.  The pixel
+  // centers are spread evenly over the box, with ra running in the same
+  // direction as in WarpImage(), so that regions sharing an edge line up.
+  // Any masks are applied just as in WarpImage().  The projected size isn't
+  // used, so many regions of different sizes may be warped at once.
+  void WarpRegion(double ra_min, double ra_max, double dec_min,
+                  double dec_max, Image *region) const;
+
+  // Returns the size in degrees of the input pixels at the center of the
+  // input image, averaged over the two axes.
+  double InputPixelScale(void) const;
+
+  // Computes which input image pixel each projected pixel is copied from.
+  // The map is indexed by j * projected_width() + i for projected pixel
+  // (i, j) and holds n * width + m for input pixel (m, n), or -1 where the
+  // background color is used.  The projected size and input image origin
+  // must be set before calling this.
+  void ComputeWarpMap(vector<int> *warp_map) const;
+
+  // Warps image using a map from ComputeWarpMap().  The image must be RGBA
+  // and have the same dimensions as the image given to the constructor.
+  // Any masks are applied just as in WarpImage().
+  // No coordinates are converted, so warping many images that share a WCS
+  // (such as the planes of a data cube) this way costs one WCS inversion
+  // per projected pixel in total rather than per image.
+  void WarpImageWithMap(const Image &image, const vector<int> &warp_map,
+                        Image *projected_image) const;
+
   // Generates a KML representation of the bounding box.  The KML
   // representation includes a <GroundOverlay> element which describes the
   // bounding box of the file named imagefile and with a <name> tag given by
@@ -173,6 +247,13 @@ class SkyProjection {
   // A world file simple is a 6 line affine transformation description.
   void CreateWorldFile(string *world_file_string) const;
 
+  // Returns the affine transformation of the world file made by
+  // CreateWorldFile(): the pixel sizes in degrees along x and y (both
+  // negative, since ra and dec decrease away from pixel (0, 0)) and the
+  // longitude (ra - 180) and latitude of pixel (0, 0).
+  void GetWorldTransform(double *x_scale, double *y_scale, double *x_origin,
+                         double *y_origin) const;
+
   // Returns the width of the output projection image.
   inline int projected_width(void) const {
     return projected_width_;
@@ -198,6 +279,16 @@ class SkyProjection {
   // The bounding box of the output projected image.
   BoundingBox bounding_box_;
   
+  // Optional mask of input pixels to keep, or NULL.
+  const BitMask *mask_;
+
+  // Optional grayscale mask image giving the alpha of input pixels, or NULL.
+  const Image *mask_image_;
+
+  // Color of input pixels to mask out, used if use_mask_color_ is set.
+  Color mask_color_;
+  bool use_mask_color_;
+
   // The color used for the area outside of the original image.
   Color bg_color_;
   
@@ -218,6 +309,20 @@ class SkyProjection {
   // image should fit within the projected image with minimal resizing.
   void DetermineProjectedSize(void);
 
+  // Returns the ra of the first column and the ra step between columns of
+  // the projected image, and likewise the dec of the first row and the
+  // (positive) dec step between rows.
+  void GetProjectedGrid(double *ra_start, double *ra_step, double *dec_max,
+                        double *dec_step) const;
+
+  // Finds the input pixel (m, n) to sample for the given ra, dec.  Returns
+  // false if the point lies outside of the input image.
+  bool FindInputPixel(double ra, double dec, int *m, int *n) const;
+
+  // Copies input pixel (m, n) of image to pixel, applying the masks.
+  // Returns false without reading the image if the pixel is masked out.
+  bool SampleInputPixel(const Image &image, int m, int n, Color *pixel) const;
+
   DISALLOW_COPY_AND_ASSIGN(SkyProjection);
 };
 
@@ -27,10 +27,14 @@
 // POSSIBILITY OF SUCH DAMAGE.
 
 #include <iostream>
+#include <string>
+#include <vector>
 
 #include "base.h"
+#include "bitmask.h"
 #include "mask.h"
 #include "skyprojection.h"
+#include "string_util.h"
 
 // These files are for a downsampled SDSS frame with a black border to test
 // automasking that is known to properly project.
@@ -41,6 +45,17 @@ static const char *WARPED_PNG_FILENAME =
 
 namespace google_sky {
 
+// Returns the number of pixels of an RGBA image with an alpha of 0.
+int CountTransparent(const Image &image) {
+  int count = 0;
+  for (int j = 0; j < image.height(); ++j) {
+    for (int i = 0; i < image.width(); ++i) {
+      if (image.GetValue(i, j, 3) == 0) ++count;
+    }
+  }
+  return count;
+}
+
 int Main(int argc, char **argv) {
   {
     cout << "Testing WarpImage() with masking... ";
@@ -75,6 +90,269 @@ int Main(int argc, char **argv) {
     cout << "pass\n";
   }
 
+  {
+    cout << "Testing WarpImage() with set_mask()... ";
+
+    Image image;
+    ASSERT_TRUE(image.Read(PNG_FILENAME));
+    WcsProjection wcs(FITS_FILENAME, image.width(), image.height());
+    Color bg_color(4);  // transparent
+    SkyProjection projection(image, wcs);
+    projection.SetBackgroundColor(bg_color);
+    projection.set_input_image_origin(SkyProjection::LOWER_LEFT);
+    projection.SetMaxSideLength(400);
+
+    Color black(4);
+    black.SetChannels(0, 3, 0);
+    black.SetChannel(3, 255);
+    Image mask;
+    Mask::CreateMask(image, black, &mask);
+    BitMask bitmask;
+    bitmask.FromImage(mask);
+    projection.set_mask(&bitmask);
+
+    Image warped_image;
+    projection.WarpImage(&warped_image);
+
+    // The same pixels are transparent as when masking through the alpha
+    // channel, but masked pixels take the background color.
+    Image true_warped_image;
+    ASSERT_TRUE(true_warped_image.Read(WARPED_PNG_FILENAME));
+    ASSERT_EQ(true_warped_image.width(), warped_image.width());
+    ASSERT_EQ(true_warped_image.height(), warped_image.height());
+    Color pixel(4);
+    Color true_pixel(4);
+    for (int j = 0; j < warped_image.height(); ++j) {
+      for (int i = 0; i < warped_image.width(); ++i) {
+        warped_image.GetPixel(i, j, &pixel);
+        true_warped_image.GetPixel(i, j, &true_pixel);
+        if (true_pixel.GetChannel(3) == 0) {
+          ASSERT_TRUE(pixel.Equals(bg_color));
+        } else {
+          ASSERT_TRUE(pixel.Equals(true_pixel));
+        }
+      }
+    }
+
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing WarpImage() with set_mask_image()... ";
+
+    Image image;
+    ASSERT_TRUE(image.Read(PNG_FILENAME));
+    WcsProjection wcs(FITS_FILENAME, image.width(), image.height());
+    Color bg_color(4);  // transparent
+    SkyProjection projection(image, wcs);
+    projection.SetBackgroundColor(bg_color);
+    projection.set_input_image_origin(SkyProjection::LOWER_LEFT);
+    projection.SetMaxSideLength(400);
+
+    Color black(4);
+    black.SetChannels(0, 3, 0);
+    black.SetChannel(3, 255);
+    Image mask;
+    Mask::CreateMask(image, black, &mask);
+    projection.set_mask_image(&mask);
+
+    // This matches setting the alpha channel of the input image.
+    Image warped_image;
+    projection.WarpImage(&warped_image);
+    Image true_warped_image;
+    ASSERT_TRUE(true_warped_image.Read(WARPED_PNG_FILENAME));
+    ASSERT_TRUE(warped_image.Equals(true_warped_image));
+
+    // The input image is untouched and warps the same through a warp map.
+    ASSERT_EQ(0, CountTransparent(image));
+    vector<int> warp_map;
+    projection.ComputeWarpMap(&warp_map);
+    Image mapped_image;
+    projection.WarpImageWithMap(image, warp_map, &mapped_image);
+    ASSERT_TRUE(mapped_image.Equals(true_warped_image));
+
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing WarpImage() with SetMaskColor()... ";
+
+    Image image;
+    ASSERT_TRUE(image.Read(PNG_FILENAME));
+    WcsProjection wcs(FITS_FILENAME, image.width(), image.height());
+    Color bg_color(4);  // transparent
+    SkyProjection projection(image, wcs);
+    projection.SetBackgroundColor(bg_color);
+    projection.set_input_image_origin(SkyProjection::LOWER_LEFT);
+    projection.SetMaxSideLength(400);
+
+    Image unmasked_image;
+    projection.WarpImage(&unmasked_image);
+
+    Color black(4);
+    black.SetChannels(0, 3, 0);
+    black.SetChannel(3, 255);
+    projection.SetMaskColor(black);
+    Image warped_image;
+    projection.WarpImage(&warped_image);
+
+    // Every black pixel is masked, including any inside the image, and
+    // nothing else changes.
+    Color pixel(4);
+    Color unmasked_pixel(4);
+    int num_masked = 0;
+    for (int j = 0; j < warped_image.height(); ++j) {
+      for (int i = 0; i < warped_image.width(); ++i) {
+        warped_image.GetPixel(i, j, &pixel);
+        unmasked_image.GetPixel(i, j, &unmasked_pixel);
+        if (unmasked_pixel.Equals(black)) {
+          ASSERT_TRUE(pixel.Equals(bg_color));
+          ++num_masked;
+        } else {
+          ASSERT_TRUE(pixel.Equals(unmasked_pixel));
+        }
+      }
+    }
+    ASSERT_TRUE(num_masked > 0);
+
+    projection.ClearMaskColor();
+    projection.WarpImage(&warped_image);
+    ASSERT_TRUE(warped_image.Equals(unmasked_image));
+
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing WarpImageWithMap()... ";
+
+    Image image;
+    ASSERT_TRUE(image.Read(PNG_FILENAME));
+    WcsProjection wcs(FITS_FILENAME, image.width(), image.height());
+    Color bg_color(4);  // transparent
+    SkyProjection projection(image, wcs);
+    projection.SetBackgroundColor(bg_color);
+    projection.set_input_image_origin(SkyProjection::LOWER_LEFT);
+    projection.SetMaxSideLength(400);
+
+    vector<int> warp_map;
+    projection.ComputeWarpMap(&warp_map);
+    ASSERT_EQ(projection.projected_width() * projection.projected_height(),
+              static_cast<int>(warp_map.size()));
+
+    // Warping the same image through the map matches WarpImage().
+    Image warped_image;
+    projection.WarpImage(&warped_image);
+    Image mapped_image;
+    projection.WarpImageWithMap(image, warp_map, &mapped_image);
+    ASSERT_TRUE(mapped_image.Equals(warped_image));
+
+    // A different image of the same size uses the same map.
+    Image other_image;
+    ASSERT_TRUE(other_image.Read(PNG_FILENAME));
+    Color black(4);
+    black.SetChannels(0, 3, 0);
+    black.SetChannel(3, 255);
+    Image mask;
+    Mask::CreateMask(other_image, black, &mask);
+    Mask::SetAlphaChannelFromMask(mask, &other_image);
+    projection.WarpImageWithMap(other_image, warp_map, &mapped_image);
+
+    Image true_warped_image;
+    ASSERT_TRUE(true_warped_image.Read(WARPED_PNG_FILENAME));
+    ASSERT_TRUE(mapped_image.Equals(true_warped_image));
+
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing WarpRegion()... ";
+
+    Image image;
+    ASSERT_TRUE(image.Read(PNG_FILENAME));
+    WcsProjection wcs(FITS_FILENAME, image.width(), image.height());
+    Color bg_color(4);  // transparent
+    SkyProjection projection(image, wcs);
+    projection.SetBackgroundColor(bg_color);
+    projection.set_input_image_origin(SkyProjection::LOWER_LEFT);
+
+    double ra_min, ra_max, dec_min, dec_max;
+    projection.bounding_box().GetMonotonicRaBounds(&ra_min, &ra_max);
+    projection.bounding_box().GetDecBounds(&dec_min, &dec_max);
+
+    Image region;
+    ASSERT_TRUE(region.Resize(200, 100, Image::RGBA));
+    projection.WarpRegion(ra_min, ra_max, dec_min, dec_max, &region);
+    ASSERT_TRUE(CountTransparent(region) < 200 * 100);
+
+    // The two halves of the box in ra make up the whole region, with the
+    // half of larger ra on the left.
+    double ra_mid = 0.5 * (ra_min + ra_max);
+    Image left;
+    ASSERT_TRUE(left.Resize(100, 100, Image::RGBA));
+    projection.WarpRegion(ra_mid, ra_max, dec_min, dec_max, &left);
+    Image right;
+    ASSERT_TRUE(right.Resize(100, 100, Image::RGBA));
+    projection.WarpRegion(ra_min, ra_mid, dec_min, dec_max, &right);
+    int num_different = 0;
+    for (int j = 0; j < 100; ++j) {
+      for (int i = 0; i < 100; ++i) {
+        for (int c = 0; c < 4; ++c) {
+          if (left.GetValue(i, j, c) != region.GetValue(i, j, c) ||
+              right.GetValue(i, j, c) != region.GetValue(i + 100, j, c)) {
+            ++num_different;
+          }
+        }
+      }
+    }
+    ASSERT_EQ(0, num_different);
+
+    // Regions outside of the image are left transparent.
+    projection.WarpRegion(ra_max + 1.0, ra_max + 2.0, dec_min, dec_max,
+                          &left);
+    ASSERT_EQ(100 * 100, CountTransparent(left));
+
+    // The test image has pixels of about 1.6 arcseconds.
+    double scale = projection.InputPixelScale() * 3600.0;
+    ASSERT_TRUE(scale > 1.0 && scale < 2.5);
+
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing GetWorldTransform()... ";
+
+    Image image;
+    ASSERT_TRUE(image.Read(PNG_FILENAME));
+    WcsProjection wcs(FITS_FILENAME, image.width(), image.height());
+    SkyProjection projection(image, wcs);
+    projection.set_input_image_origin(SkyProjection::LOWER_LEFT);
+    projection.SetMaxSideLength(400);
+    Image warped_image;
+    projection.WarpImage(&warped_image);
+
+    double x_scale, y_scale, x_origin, y_origin;
+    projection.GetWorldTransform(&x_scale, &y_scale, &x_origin, &y_origin);
+    ASSERT_TRUE(x_scale < 0.0);
+    ASSERT_TRUE(y_scale < 0.0);
+    double ra_min, ra_max, dec_min, dec_max;
+    projection.bounding_box().GetWrappedRaBounds(&ra_min, &ra_max);
+    projection.bounding_box().GetDecBounds(&dec_min, &dec_max);
+    ASSERT_FLOAT_EQ(ra_max - 180.0, x_origin, 1.0e-12);
+    ASSERT_FLOAT_EQ(dec_max, y_origin, 1.0e-12);
+    ASSERT_FLOAT_EQ(dec_min, dec_max + y_scale * warped_image.height(),
+                    1.0e-12);
+
+    // The world file holds the same transformation.
+    string world_file;
+    projection.CreateWorldFile(&world_file);
+    ASSERT_TRUE(world_file == StringPrintf("%.14f\n%.14f\n%.14f\n%.14f\n"
+                                           "%.14f\n%.14f\n", x_scale, 0.0,
+                                           0.0, y_scale, x_origin,
+                                           y_origin));
+
+    cout << "pass\n";
+  }
+
   cout << "Passed\n";
   return 0;
 }
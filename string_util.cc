@@ -343,4 +343,18 @@ void StringSplitExtension(const string &file_name, string *prefix,
   }
 }
 
+string StringEscapeXml(const string &str) {
+  string escaped;
+  for (size_t i = 0; i < str.size(); ++i) {
+    switch (str[i]) {
+      case '&': escaped += "&amp;"; break;
+      case '<': escaped += "&lt;"; break;
+      case '>': escaped += "&gt;"; break;
+      case '"': escaped += "&quot;"; break;
+      default: escaped += str[i];
+    }
+  }
+  return escaped;
+}
+
 }  // namespace google_sky
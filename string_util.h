@@ -103,6 +103,10 @@ void StringStripLeadingAndTrailingWhiteSpace(string *str);
 void StringSplitExtension(const string &file_name, string *prefix,
                           string *extension);
 
+// Returns str with the characters that are special in XML and HTML (&, <, >
+// and ") replaced by their entity references.
+string StringEscapeXml(const string &str);
+
 }  // namespace google_sky
 
 #endif  // STRING_UTIL_H__
@@ -327,6 +327,15 @@ int Main(int argc, char **argv) {
     cout << "pass\n";
   }
 
+  {
+    cout << "Testing StringEscapeXml... ";
+    ASSERT_EQ(StringEscapeXml(""), string(""));
+    ASSERT_EQ(StringEscapeXml("M 31"), string("M 31"));
+    ASSERT_EQ(StringEscapeXml("<a href=\"x\">A & B</a>"),
+              string("&lt;a href=&quot;x&quot;&gt;A &amp; B&lt;/a&gt;"));
+    cout << "pass\n";
+  }
+
   cout << "Passed\n";
   return 0;
 }
@@ -0,0 +1,131 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "test_util.h"
+
+#include <cstdio>
+
+#include "string_util.h"
+
+namespace google_sky {
+
+string ReadFile(const string &filename) {
+  FILE *fp = fopen(filename.c_str(), "rb");
+  CHECK(fp != NULL) << "Can't open " << filename;
+  string contents;
+  char buffer[4096];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+    contents.append(buffer, n);
+  }
+  fclose(fp);
+  return contents;
+}
+
+void WriteFile(const string &filename, const string &contents) {
+  FILE *fp = fopen(filename.c_str(), "wb");
+  CHECK(fp != NULL) << "Can't open " << filename;
+  CHECK_EQ(contents.size(), fwrite(contents.data(), 1, contents.size(), fp));
+  CHECK_EQ(0, fclose(fp));
+}
+
+void AppendBigEndian(const void *value, int size, string *data) {
+  const char *bytes = reinterpret_cast<const char *>(value);
+  uint16 test = 1;
+  bool little_endian = *reinterpret_cast<uint8 *>(&test) == 1;
+  for (int i = 0; i < size; ++i) {
+    data->push_back(bytes[little_endian ? size - 1 - i : i]);
+  }
+}
+
+string MakeHeader(double ra, double dec, int width, int height,
+                  double scale) {
+  vector<string> cards;
+  cards.push_back(StringPrintf("NAXIS   = %20d", 2));
+  cards.push_back(StringPrintf("NAXIS1  = %20d", width));
+  cards.push_back(StringPrintf("NAXIS2  = %20d", height));
+  cards.push_back("CTYPE1  = 'RA---TAN'");
+  cards.push_back("CTYPE2  = 'DEC--TAN'");
+  cards.push_back(StringPrintf("EQUINOX = %20.1f", 2000.0));
+  cards.push_back(StringPrintf("CRPIX1  = %20.6f", 0.5 * (width + 1)));
+  cards.push_back(StringPrintf("CRPIX2  = %20.6f", 0.5 * (height + 1)));
+  cards.push_back(StringPrintf("CRVAL1  = %20.10f", ra));
+  cards.push_back(StringPrintf("CRVAL2  = %20.10f", dec));
+  cards.push_back(StringPrintf("CD1_1   = %20.12g", -scale));
+  cards.push_back(StringPrintf("CD1_2   = %20.12g", 0.0));
+  cards.push_back(StringPrintf("CD2_1   = %20.12g", 0.0));
+  cards.push_back(StringPrintf("CD2_2   = %20.12g", scale));
+  cards.push_back("END");
+
+  string header;
+  for (size_t i = 0; i < cards.size(); ++i) {
+    header += cards[i];
+    header.append(80 - cards[i].size(), ' ');
+  }
+  return header;
+}
+
+void SolidImageReader::Add(int width, int height, int red, int green,
+                           int blue, int alpha) {
+  int color[6] = { width, height, red, green, blue, alpha };
+  colors_.push_back(vector<int>(color, color + 6));
+}
+
+bool SolidImageReader::ReadImage(int index, Image *image, string *error) {
+  const vector<int> &color = colors_[index];
+  if (color[5] < 0) {
+    *error = StringPrintf("Can't read image %d", index);
+    return false;
+  }
+  image->Resize(color[0], color[1], Image::RGBA);
+  for (int c = 0; c < 4; ++c) {
+    image->SetAllValuesInChannel(c, color[2 + c]);
+  }
+  return true;
+}
+
+void GradientImageReader::Add(int width, int height) {
+  sizes_.push_back(make_pair(width, height));
+}
+
+bool GradientImageReader::ReadImage(int index, Image *image, string *error) {
+  int width = sizes_[index].first;
+  int height = sizes_[index].second;
+  image->Resize(width, height, Image::RGBA);
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      image->SetValue(x, y, 0, x % 256);
+      image->SetValue(x, y, 1, y % 256);
+      image->SetValue(x, y, 2, (64 * index) % 256);
+      image->SetValue(x, y, 3, 255);
+    }
+  }
+  return true;
+}
+
+}  // namespace google_sky
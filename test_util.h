@@ -0,0 +1,96 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// Defines fixtures shared by the unit tests
+//
+// These are linked into the test programs but not into the library.
+
+#ifndef TEST_UTIL_H__
+#define TEST_UTIL_H__
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "base.h"
+#include "image.h"
+#include "mosaic.h"
+
+namespace google_sky {
+
+// Returns the contents of a file.  Dies if it can't be read.
+string ReadFile(const string &filename);
+
+// Writes contents to a file.  Dies on failure.
+void WriteFile(const string &filename, const string &contents);
+
+// Appends the size bytes of value to data in big endian order, as FITS
+// stores them.
+void AppendBigEndian(const void *value, int size, string *data);
+
+// Makes the header of a width x height image with a TAN projection centered
+// on ra, dec with square pixels of the given size in degrees.
+string MakeHeader(double ra, double dec, int width, int height, double scale);
+
+// Reads images of a single color, or fails for images without one.
+class SolidImageReader : public MosaicImageReader {
+ public:
+  SolidImageReader() : colors_() {}
+
+  // Adds an image of the given size and color.  Images with an alpha of
+  // -1 can't be read.
+  void Add(int width, int height, int red, int green, int blue, int alpha);
+
+  virtual bool ReadImage(int index, Image *image, string *error);
+
+ private:
+  vector<vector<int> > colors_;
+
+  DISALLOW_COPY_AND_ASSIGN(SolidImageReader);
+};
+
+// Reads opaque images whose pixels vary with position, so that a pixel
+// mapped through the wrong WCS shows up in the output.
+class GradientImageReader : public MosaicImageReader {
+ public:
+  GradientImageReader() : sizes_() {}
+
+  // Adds a width x height image.
+  void Add(int width, int height);
+
+  virtual bool ReadImage(int index, Image *image, string *error);
+
+ private:
+  vector<pair<int, int> > sizes_;
+
+  DISALLOW_COPY_AND_ASSIGN(GradientImageReader);
+};
+
+}  // namespace google_sky
+
+#endif  // TEST_UTIL_H__
@@ -0,0 +1,221 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "threadpool.h"
+
+#include <unistd.h>
+
+#include <google/gflags.h>
+
+DEFINE_int32(num_threads, 0,
+             "number of worker threads (0 means one per processor)");
+
+namespace google_sky {
+
+// Starts num_threads worker threads.
+ThreadPool::ThreadPool(int num_threads)
+    : num_threads_(num_threads < 1 ? 1 : num_threads),
+      threads_(),
+      queue_(),
+      num_unfinished_(0),
+      shutting_down_(false) {
+  CHECK_EQ(pthread_mutex_init(&mutex_, NULL), 0);
+  CHECK_EQ(pthread_cond_init(&task_available_, NULL), 0);
+  CHECK_EQ(pthread_cond_init(&all_finished_, NULL), 0);
+
+  // A single threaded pool runs tasks inline.
+  if (num_threads_ == 1) return;
+
+  threads_.resize(num_threads_);
+  for (int i = 0; i < num_threads_; ++i) {
+    CHECK_EQ(pthread_create(&threads_[i], NULL, &ThreadPool::WorkerMain,
+                            this), 0)
+        << "Can't create worker thread " << i;
+  }
+}
+
+// Finishes all outstanding work and joins the worker threads.
+ThreadPool::~ThreadPool() {
+  Wait();
+
+  pthread_mutex_lock(&mutex_);
+  shutting_down_ = true;
+  pthread_cond_broadcast(&task_available_);
+  pthread_mutex_unlock(&mutex_);
+
+  for (int i = 0; i < static_cast<int>(threads_.size()); ++i) {
+    pthread_join(threads_[i], NULL);
+  }
+
+  pthread_cond_destroy(&all_finished_);
+  pthread_cond_destroy(&task_available_);
+  pthread_mutex_destroy(&mutex_);
+}
+
+// Queues a task, or runs it immediately for single threaded pools.
+void ThreadPool::Add(Task *task) {
+  CHECK(task != NULL) << "Can't add a NULL task";
+  if (threads_.empty()) {
+    task->Run();
+    delete task;
+    return;
+  }
+
+  pthread_mutex_lock(&mutex_);
+  queue_.push_back(task);
+  ++num_unfinished_;
+  pthread_cond_signal(&task_available_);
+  pthread_mutex_unlock(&mutex_);
+}
+
+// Waits until the queue has drained and every running task has finished.
+void ThreadPool::Wait() {
+  pthread_mutex_lock(&mutex_);
+  while (num_unfinished_ > 0) {
+    pthread_cond_wait(&all_finished_, &mutex_);
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+// Returns --num_threads if set or else the number of online processors.
+int ThreadPool::DefaultNumThreads(void) {
+  if (FLAGS_num_threads > 0) {
+    return FLAGS_num_threads;
+  }
+  long num_processors = sysconf(_SC_NPROCESSORS_ONLN);
+  if (num_processors < 1) {
+    return 1;
+  }
+  return static_cast<int>(num_processors);
+}
+
+// Trampoline from pthreads into the member function.
+void *ThreadPool::WorkerMain(void *arg) {
+  ThreadPool *pool = static_cast<ThreadPool *>(arg);
+  pool->WorkerLoop();
+  return NULL;
+}
+
+// Pulls tasks off of the queue until the pool shuts down.
+void ThreadPool::WorkerLoop(void) {
+  while (true) {
+    pthread_mutex_lock(&mutex_);
+    while (queue_.empty() && !shutting_down_) {
+      pthread_cond_wait(&task_available_, &mutex_);
+    }
+    if (queue_.empty()) {
+      // Only reached when shutting down.
+      pthread_mutex_unlock(&mutex_);
+      return;
+    }
+    Task *task = queue_.front();
+    queue_.pop_front();
+    pthread_mutex_unlock(&mutex_);
+
+    task->Run();
+    delete task;
+
+    pthread_mutex_lock(&mutex_);
+    --num_unfinished_;
+    if (num_unfinished_ == 0) {
+      pthread_cond_broadcast(&all_finished_);
+    }
+    pthread_mutex_unlock(&mutex_);
+  }
+}
+
+MemoryBudget::MemoryBudget(int64 limit)
+    : limit_(limit),
+      in_use_(0) {
+  CHECK_EQ(pthread_mutex_init(&mutex_, NULL), 0);
+  CHECK_EQ(pthread_cond_init(&released_, NULL), 0);
+}
+
+MemoryBudget::~MemoryBudget() {
+  pthread_cond_destroy(&released_);
+  pthread_mutex_destroy(&mutex_);
+}
+
+// Oversized requests only need to wait for everything else to finish.
+void MemoryBudget::Acquire(int64 bytes) {
+  pthread_mutex_lock(&mutex_);
+  while (in_use_ > 0 && in_use_ + bytes > limit_) {
+    pthread_cond_wait(&released_, &mutex_);
+  }
+  in_use_ += bytes;
+  pthread_mutex_unlock(&mutex_);
+}
+
+void MemoryBudget::Release(int64 bytes) {
+  pthread_mutex_lock(&mutex_);
+  in_use_ -= bytes;
+  CHECK_GTE(in_use_, 0) << "Released more memory than was acquired";
+  pthread_cond_broadcast(&released_);
+  pthread_mutex_unlock(&mutex_);
+}
+
+int64 MemoryBudget::in_use(void) {
+  pthread_mutex_lock(&mutex_);
+  int64 bytes = in_use_;
+  pthread_mutex_unlock(&mutex_);
+  return bytes;
+}
+
+// Uses half of the physical memory to leave room for the page cache and
+// anything else running on the machine.
+int64 MemoryBudget::DefaultLimit(void) {
+  long num_pages = sysconf(_SC_PHYS_PAGES);
+  long page_size = sysconf(_SC_PAGE_SIZE);
+  if (num_pages <= 0 || page_size <= 0) {
+    return static_cast<int64>(1) << 30;
+  }
+  return static_cast<int64>(num_pages) * page_size / 2;
+}
+
+FirstError::FirstError() : error_() {
+  CHECK_EQ(pthread_mutex_init(&mutex_, NULL), 0);
+}
+
+FirstError::~FirstError() {
+  pthread_mutex_destroy(&mutex_);
+}
+
+void FirstError::Fail(const string &error) {
+  pthread_mutex_lock(&mutex_);
+  if (error_.empty()) error_ = error;
+  pthread_mutex_unlock(&mutex_);
+}
+
+bool FirstError::failed(void) {
+  pthread_mutex_lock(&mutex_);
+  bool failed = !error_.empty();
+  pthread_mutex_unlock(&mutex_);
+  return failed;
+}
+
+}  // namespace google_sky
@@ -0,0 +1,254 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef THREADPOOL_H__
+#define THREADPOOL_H__
+
+#include <pthread.h>
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "base.h"
+
+namespace google_sky {
+
+// Abstract unit of work that can be run by a ThreadPool
+//
+// Subclasses should store all of the state they need to run in member
+// variables and implement Run().  Tasks must not share mutable state unless
+// they protect it themselves.
+class Task {
+ public:
+  virtual ~Task() {
+    // Nothing needed.
+  }
+
+  // Performs the work for this task.
+  virtual void Run() = 0;
+};
+
+// Class for running independent Tasks on a fixed number of threads
+//
+// The pool starts its worker threads on construction and stops them on
+// destruction.  Tasks are run in roughly the order they were added.  The
+// pool takes ownership of each Task and deletes it after it has been run.
+//
+// A pool created with a single thread runs each task immediately inside
+// Add(), which keeps single threaded output deterministic and makes
+// debugging easier.
+//
+// Example Usage:
+//
+// class SquareTask : public Task {
+//  public:
+//   SquareTask(double *value) : value_(value) {}
+//   virtual void Run() { *value_ *= *value_; }
+//  private:
+//   double *value_;
+// };
+//
+// ThreadPool pool(ThreadPool::DefaultNumThreads());
+// for (int i = 0; i < n; ++i) {
+//   pool.Add(new SquareTask(&values[i]));
+// }
+// pool.Wait();
+
+class ThreadPool {
+ public:
+  // Creates a pool with the given number of worker threads.  Values less
+  // than 1 are treated as 1.
+  explicit ThreadPool(int num_threads);
+
+  // Waits for all pending tasks to finish and stops the worker threads.
+  ~ThreadPool();
+
+  // Schedules a task to be run.  The pool takes ownership of task.
+  void Add(Task *task);
+
+  // Blocks until every task added so far has finished running.
+  void Wait();
+
+  // Returns the number of worker threads.
+  inline int num_threads(void) const {
+    return num_threads_;
+  }
+
+  // Returns the number of threads to use by default.  This is the value of
+  // the --num_threads flag if it is positive and the number of online
+  // processors otherwise.
+  static int DefaultNumThreads(void);
+
+ private:
+  // Number of worker threads.
+  int num_threads_;
+
+  // Worker threads (empty if num_threads_ == 1).
+  vector<pthread_t> threads_;
+
+  // Tasks that have been added but not yet started.
+  deque<Task *> queue_;
+
+  // Number of tasks that have been added but not yet finished.
+  int num_unfinished_;
+
+  // Set on destruction to tell the workers to exit.
+  bool shutting_down_;
+
+  // Guards queue_, num_unfinished_, and shutting_down_.
+  pthread_mutex_t mutex_;
+
+  // Signaled when a task is added or the pool is shutting down.
+  pthread_cond_t task_available_;
+
+  // Signaled when num_unfinished_ drops to 0.
+  pthread_cond_t all_finished_;
+
+  // Entry point for the worker threads.  arg is the ThreadPool.
+  static void *WorkerMain(void *arg);
+
+  // Runs tasks until the pool is shut down.
+  void WorkerLoop(void);
+
+  // A ThreadPool must be created with a number of threads.
+  ThreadPool();
+
+  DISALLOW_COPY_AND_ASSIGN(ThreadPool);
+};
+
+// Class for limiting how much memory concurrently running tasks use
+//
+// Callers estimate the memory each task needs and Acquire() it before
+// adding the task to a ThreadPool.  The task Release()s it when it is done,
+// waking callers waiting for room.  This admits as many tasks as fit
+// without running the machine out of memory.  A request larger than the
+// whole budget is admitted once nothing else holds memory, so it runs
+// alone rather than waiting forever.
+//
+// Example Usage:
+//
+// MemoryBudget budget(MemoryBudget::DefaultLimit());
+// ThreadPool pool(ThreadPool::DefaultNumThreads());
+// for (int i = 0; i < n; ++i) {
+//   budget.Acquire(bytes[i]);
+//   pool.Add(new JobTask(&budget, bytes[i]));  // Calls Release() when done.
+// }
+// pool.Wait();
+
+class MemoryBudget {
+ public:
+  // Creates a budget of limit bytes.
+  explicit MemoryBudget(int64 limit);
+
+  ~MemoryBudget();
+
+  // Blocks until bytes fit within the limit alongside the memory already
+  // held, and then holds them.
+  void Acquire(int64 bytes);
+
+  // Returns bytes held by an earlier call to Acquire().
+  void Release(int64 bytes);
+
+  // Returns the number of bytes currently held.
+  int64 in_use(void);
+
+  // Returns the limit in bytes.
+  inline int64 limit(void) const {
+    return limit_;
+  }
+
+  // Returns the limit to use by default, which is half of the physical
+  // memory of the machine (or 1 GB if that can't be determined).
+  static int64 DefaultLimit(void);
+
+ private:
+  int64 limit_;
+  int64 in_use_;
+
+  // Guards in_use_.
+  pthread_mutex_t mutex_;
+
+  // Signaled when memory is released.
+  pthread_cond_t released_;
+
+  // A MemoryBudget must be created with a limit.
+  MemoryBudget();
+
+  DISALLOW_COPY_AND_ASSIGN(MemoryBudget);
+};
+
+// Class for keeping the first error reported by concurrently running tasks
+//
+// Tasks call Fail() when they hit an error and may check failed() to skip
+// their work once another task has failed.  The caller reads error() after
+// the tasks are done.  Later errors are usually consequences of the first,
+// so only the first is kept.
+//
+// Example Usage:
+//
+// FirstError status;
+// for (int i = 0; i < n; ++i) {
+//   pool.Add(new WriteTask(i, &status));  // Calls status->Fail() on error.
+// }
+// pool.Wait();
+// if (status.failed()) {
+//   *error = status.error();
+//   return false;
+// }
+
+class FirstError {
+ public:
+  FirstError();
+
+  ~FirstError();
+
+  // Records an error unless one has already been recorded.
+  void Fail(const string &error);
+
+  // Returns whether an error has been recorded.
+  bool failed(void);
+
+  // Returns the first error, or "" if there was none.  This may only be
+  // called once the tasks are done.
+  inline const string &error(void) const {
+    return error_;
+  }
+
+ private:
+  string error_;
+
+  // Guards error_.
+  pthread_mutex_t mutex_;
+
+  DISALLOW_COPY_AND_ASSIGN(FirstError);
+};
+
+}  // namespace google_sky
+
+#endif  // THREADPOOL_H__
@@ -0,0 +1,210 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <unistd.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "base.h"
+#include "threadpool.h"
+
+namespace google_sky {
+
+// Writes index * index into its own slot of a shared array.
+class SquareTask : public Task {
+ public:
+  SquareTask(int index, vector<int> *values)
+      : index_(index), values_(values) {}
+
+  virtual void Run() {
+    (*values_)[index_] = index_ * index_;
+  }
+
+ private:
+  int index_;
+  vector<int> *values_;
+};
+
+// Holds memory from a MemoryBudget for a moment, recording the most memory
+// held at once.
+class BudgetTask : public Task {
+ public:
+  BudgetTask(MemoryBudget *budget, int64 bytes, pthread_mutex_t *mutex,
+             int64 *max_in_use)
+      : budget_(budget), bytes_(bytes), mutex_(mutex),
+        max_in_use_(max_in_use) {}
+
+  virtual void Run() {
+    int64 in_use = budget_->in_use();
+    pthread_mutex_lock(mutex_);
+    if (in_use > *max_in_use_) *max_in_use_ = in_use;
+    pthread_mutex_unlock(mutex_);
+    usleep(1000);
+    budget_->Release(bytes_);
+  }
+
+ private:
+  MemoryBudget *budget_;
+  int64 bytes_;
+  pthread_mutex_t *mutex_;
+  int64 *max_in_use_;
+};
+
+// Fails with its index if that is odd, unless a task has already failed.
+class FailTask : public Task {
+ public:
+  FailTask(int index, FirstError *status) : index_(index), status_(status) {}
+
+  virtual void Run() {
+    if (status_->failed()) return;
+    if (index_ % 2 == 1) status_->Fail(index_ == 1 ? "first" : "later");
+  }
+
+ private:
+  int index_;
+  FirstError *status_;
+};
+
+static const int NUM_TASKS = 1000;
+
+int Main(int argc, char **argv) {
+  {
+    cout << "Testing single threaded ThreadPool... ";
+    vector<int> values(NUM_TASKS, -1);
+    ThreadPool pool(1);
+    ASSERT_EQ(1, pool.num_threads());
+    for (int i = 0; i < NUM_TASKS; ++i) {
+      pool.Add(new SquareTask(i, &values));
+    }
+    pool.Wait();
+    for (int i = 0; i < NUM_TASKS; ++i) {
+      ASSERT_EQ(i * i, values[i]);
+    }
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing multithreaded ThreadPool... ";
+    vector<int> values(NUM_TASKS, -1);
+    ThreadPool pool(4);
+    ASSERT_EQ(4, pool.num_threads());
+    for (int i = 0; i < NUM_TASKS; ++i) {
+      pool.Add(new SquareTask(i, &values));
+    }
+    pool.Wait();
+    for (int i = 0; i < NUM_TASKS; ++i) {
+      ASSERT_EQ(i * i, values[i]);
+    }
+
+    // The pool must be reusable after Wait().
+    values.assign(NUM_TASKS, -1);
+    for (int i = 0; i < NUM_TASKS; ++i) {
+      pool.Add(new SquareTask(i, &values));
+    }
+    pool.Wait();
+    for (int i = 0; i < NUM_TASKS; ++i) {
+      ASSERT_EQ(i * i, values[i]);
+    }
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing MemoryBudget... ";
+    MemoryBudget budget(100);
+    ASSERT_TRUE(budget.limit() == 100);
+    pthread_mutex_t mutex;
+    pthread_mutex_init(&mutex, NULL);
+    int64 max_in_use = 0;
+    {
+      ThreadPool pool(4);
+      for (int i = 0; i < 50; ++i) {
+        // Every tenth task needs more than the whole budget.
+        int64 bytes = (i % 10 == 9) ? 150 : 40;
+        budget.Acquire(bytes);
+        pool.Add(new BudgetTask(&budget, bytes, &mutex, &max_in_use));
+      }
+      pool.Wait();
+    }
+    pthread_mutex_destroy(&mutex);
+
+    // Two small tasks fit at once, and large tasks run alone.
+    ASSERT_TRUE(budget.in_use() == 0);
+    ASSERT_TRUE(max_in_use <= 100 || max_in_use == 150);
+    ASSERT_TRUE(MemoryBudget::DefaultLimit() > 0);
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing FirstError... ";
+    FirstError status;
+    ASSERT_FALSE(status.failed());
+    ASSERT_TRUE(status.error().empty());
+
+    // Tasks run in order on a single thread, so task 1 fails first.
+    {
+      ThreadPool pool(1);
+      for (int i = 0; i < 10; ++i) {
+        pool.Add(new FailTask(i, &status));
+      }
+      pool.Wait();
+    }
+    ASSERT_TRUE(status.failed());
+    ASSERT_TRUE(status.error() == "first");
+
+    // Some error is kept when tasks fail concurrently.
+    FirstError concurrent;
+    {
+      ThreadPool pool(4);
+      for (int i = 0; i < NUM_TASKS; ++i) {
+        pool.Add(new FailTask(i, &concurrent));
+      }
+      pool.Wait();
+    }
+    ASSERT_TRUE(concurrent.failed());
+    ASSERT_TRUE(concurrent.error() == "first" ||
+                concurrent.error() == "later");
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing DefaultNumThreads()... ";
+    ASSERT_TRUE(ThreadPool::DefaultNumThreads() >= 1);
+    cout << "pass\n";
+  }
+
+  cout << "Passed\n";
+  return 0;
+}
+
+}  // namespace google_sky
+
+int main(int argc, char **argv) {
+  return google_sky::Main(argc, argv);
+}
@@ -0,0 +1,73 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "tilepyramid.h"
+
+#include <string>
+#include <utility>
+
+#include "image.h"
+#include "mosaic.h"
+
+namespace google_sky {
+
+void GetChildQuadrant(const pair<int, int> &parent,
+                      const pair<int, int> &child, int *column, int *row) {
+  *column = child.second - 2 * parent.second;
+  *row = child.first - 2 * parent.first;
+}
+
+void GetChildQuadrant(int64 parent, int64 child, int *column, int *row) {
+  int quadrant = static_cast<int>(child - 4 * parent);
+  *column = quadrant >> 1;
+  *row = quadrant & 1;
+}
+
+bool DownsampleChildTile(const string &filename, int size, int column,
+                         int row, Image *tile, string *error) {
+  Image child;
+  if (!child.Read(filename) || !child.ConvertToRGBA() ||
+      child.width() != size || child.height() != size) {
+    *error = "Can't read tile " + filename;
+    return false;
+  }
+  int half = size / 2;
+  Mosaic::DownsampleInto(child, column * half, row * half, tile);
+  return true;
+}
+
+bool WriteTileImage(const string &filename, Image *tile, string *error) {
+  if (tile->AlphaIsEverywhere(255)) tile->ConvertToRGB();
+  if (!tile->Write(filename)) {
+    *error = "Can't write tile " + filename;
+    return false;
+  }
+  return true;
+}
+
+}  // namespace google_sky
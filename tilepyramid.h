@@ -0,0 +1,200 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// Defines the pieces shared by the tile pyramids that Mosaic, XyzPyramid,
+// and Hips build: the status of one level of tiles, the task that makes a
+// tile from the tiles below it, and writing a tile image.
+
+#ifndef TILEPYRAMID_H__
+#define TILEPYRAMID_H__
+
+#include <pthread.h>
+
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+
+#include "base.h"
+#include "image.h"
+#include "threadpool.h"
+
+namespace google_sky {
+
+// Class for collecting the tiles written by one level of a pyramid
+//
+// Mosaic and XyzPyramid key their tiles by (y, x) pairs and Hips by
+// HEALPix pixel number.  The tasks of a level call AddTile() for each tile
+// they write and Fail() for the first error.
+template<class Key>
+class TileBuildStatus : public FirstError {
+ public:
+  TileBuildStatus() : tiles_() {
+    CHECK_EQ(pthread_mutex_init(&mutex_, NULL), 0);
+  }
+
+  ~TileBuildStatus() {
+    pthread_mutex_destroy(&mutex_);
+  }
+
+  // Records that tile key was written.
+  void AddTile(const Key &key) {
+    pthread_mutex_lock(&mutex_);
+    tiles_.insert(key);
+    pthread_mutex_unlock(&mutex_);
+  }
+
+  // This may only be called once the tasks are done.
+  const set<Key> &tiles(void) const {
+    return tiles_;
+  }
+
+ private:
+  set<Key> tiles_;
+
+  // Guards tiles_.
+  pthread_mutex_t mutex_;
+
+  DISALLOW_COPY_AND_ASSIGN(TileBuildStatus);
+};
+
+// Interface for the pyramids whose coarser levels are made by
+// BuildParentTiles()
+//
+// Each tile is made by downsampling the (up to) four tiles of the level
+// below it, which are read back from the files they were written to.
+template<class Key>
+class TilePyramidWriter {
+ public:
+  virtual ~TilePyramidWriter() {
+    // Nothing needed.
+  }
+
+  // Returns the side length of the square tiles.
+  virtual int GetTileSize(void) const = 0;
+
+  // Returns the file that tile key of level is written to.
+  virtual string GetTileFilename(int level, const Key &key) const = 0;
+
+  // Writes tile key of level.  children holds the tiles of level + 1 that
+  // exist below it.  tile may be modified.
+  virtual bool WriteTile(int level, const Key &key, const set<Key> &children,
+                         Image *tile, string *error) const = 0;
+};
+
+// Finds the quadrant of tile parent that tile child of the level below it
+// covers, as a column and row of 0 or 1.  Tile (x, y) is keyed by (y, x),
+// and its children are (2 x + column, 2 y + row).
+void GetChildQuadrant(const pair<int, int> &parent,
+                      const pair<int, int> &child, int *column, int *row);
+
+// Like the above for HEALPix pixels.  The children of pixel npix are
+// 4 npix + c, where bit 1 of c gives the column and bit 0 the row.
+void GetChildQuadrant(int64 parent, int64 child, int *column, int *row);
+
+// Reads a tile of the level below and downsamples it into its quadrant of
+// tile, an RGBA image of the given size.  Returns false if the tile can't
+// be read or isn't size x size.
+bool DownsampleChildTile(const string &filename, int size, int column,
+                         int row, Image *tile, string *error);
+
+// Writes a tile as PNG.  Opaque tiles are converted to RGB first, like
+// Regionator does, since they compress better.
+bool WriteTileImage(const string &filename, Image *tile, string *error);
+
+// Makes one tile by downsampling the tiles below it.
+template<class Key>
+class ParentTileTask : public Task {
+ public:
+  ParentTileTask(const TilePyramidWriter<Key> *writer, int level,
+                 const Key &key, const set<Key> &children,
+                 TileBuildStatus<Key> *status)
+      : writer_(writer), level_(level), key_(key), children_(children),
+        status_(status) {}
+
+  virtual void Run() {
+    if (status_->failed()) return;
+    int size = writer_->GetTileSize();
+    Image tile;
+    tile.Resize(size, size, Image::RGBA);
+    tile.SetAllValues(0);
+
+    string error;
+    for (typename set<Key>::const_iterator it = children_.begin();
+         it != children_.end(); ++it) {
+      int column, row;
+      GetChildQuadrant(key_, *it, &column, &row);
+      if (!DownsampleChildTile(writer_->GetTileFilename(level_ + 1, *it),
+                               size, column, row, &tile, &error)) {
+        status_->Fail(error);
+        return;
+      }
+    }
+
+    if (!writer_->WriteTile(level_, key_, children_, &tile, &error)) {
+      status_->Fail(error);
+      return;
+    }
+    status_->AddTile(key_);
+  }
+
+ private:
+  const TilePyramidWriter<Key> *writer_;
+  int level_;
+  Key key_;
+  set<Key> children_;
+  TileBuildStatus<Key> *status_;
+
+  DISALLOW_COPY_AND_ASSIGN(ParentTileTask);
+};
+
+// Makes each tile of level in parents from its children on pool, and
+// returns the tiles written in tiles.  Returns false with the first error
+// if any tile fails.
+template<class Key>
+bool BuildParentTiles(const TilePyramidWriter<Key> *writer, int level,
+                      const map<Key, set<Key> > &parents, ThreadPool *pool,
+                      set<Key> *tiles, string *error) {
+  TileBuildStatus<Key> status;
+  for (typename map<Key, set<Key> >::const_iterator it = parents.begin();
+       it != parents.end(); ++it) {
+    pool->Add(new ParentTileTask<Key>(writer, level, it->first, it->second,
+                                      &status));
+  }
+  pool->Wait();
+  if (status.failed()) {
+    *error = status.error();
+    return false;
+  }
+  *tiles = status.tiles();
+  return true;
+}
+
+}  // namespace google_sky
+
+#endif  // TILEPYRAMID_H__
@@ -0,0 +1,211 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+
+#include "base.h"
+#include "color.h"
+#include "file_util.h"
+#include "image.h"
+#include "string_util.h"
+#include "threadpool.h"
+#include "tilepyramid.h"
+
+static const char *TILE_DIRECTORY = "tilepyramid_test_tiles";
+
+namespace google_sky {
+
+// Writes 4 x 4 tiles named <level>_<x>_<y>.png to TILE_DIRECTORY.
+class GridWriter : public TilePyramidWriter<pair<int, int> > {
+ public:
+  GridWriter() {
+    // Nothing needed.
+  }
+
+  virtual ~GridWriter() {
+    // Nothing needed.
+  }
+
+  virtual int GetTileSize(void) const {
+    return 4;
+  }
+
+  virtual string GetTileFilename(int level,
+                                 const pair<int, int> &key) const {
+    return StringPrintf("%s/%d_%d_%d.png", TILE_DIRECTORY, level,
+                        key.second, key.first);
+  }
+
+  virtual bool WriteTile(int level, const pair<int, int> &key,
+                         const set<pair<int, int> > &children, Image *tile,
+                         string *error) const {
+    return WriteTileImage(GetTileFilename(level, key), tile, error);
+  }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(GridWriter);
+};
+
+// Writes a solid opaque tile of the given gray level.
+void WriteSolidTile(const GridWriter &writer, int level, int x, int y,
+                    uint8 value) {
+  Image tile;
+  ASSERT_TRUE(tile.Resize(4, 4, Image::RGBA));
+  tile.SetAllValues(value);
+  tile.SetAllValuesInChannel(3, 255);
+  string error;
+  ASSERT_TRUE(writer.WriteTile(level, make_pair(y, x),
+                               set<pair<int, int> >(), &tile, &error));
+}
+
+// Returns the PNG color type of a file, e.g. 2 for RGB and 6 for RGBA.
+int ReadPngColorType(const string &filename) {
+  FILE *fp = fopen(filename.c_str(), "rb");
+  ASSERT_TRUE(fp != NULL);
+  unsigned char header[26];
+  size_t num_read = fread(header, 1, sizeof(header), fp);
+  fclose(fp);
+  ASSERT_TRUE(num_read == sizeof(header));
+  return header[25];
+}
+
+int Main(int argc, char **argv) {
+  ASSERT_TRUE(system("rm -rf tilepyramid_test_tiles") == 0);
+  ASSERT_TRUE(MakeDirectory(TILE_DIRECTORY));
+  GridWriter writer;
+
+  {
+    cout << "Testing GetChildQuadrant()... ";
+    int column, row;
+    GetChildQuadrant(make_pair(3, 5), make_pair(7, 10), &column, &row);
+    ASSERT_EQ(0, column);
+    ASSERT_EQ(1, row);
+    GetChildQuadrant(make_pair(3, 5), make_pair(6, 11), &column, &row);
+    ASSERT_EQ(1, column);
+    ASSERT_EQ(0, row);
+
+    // HEALPix children put bit 1 in the column and bit 0 in the row.
+    int64 npix = 12345;
+    GetChildQuadrant(npix, 4 * npix + 1, &column, &row);
+    ASSERT_EQ(0, column);
+    ASSERT_EQ(1, row);
+    GetChildQuadrant(npix, 4 * npix + 2, &column, &row);
+    ASSERT_EQ(1, column);
+    ASSERT_EQ(0, row);
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing WriteTileImage()... ";
+
+    // Opaque tiles are written as RGB and others as RGBA.
+    WriteSolidTile(writer, 2, 0, 0, 100);
+    ASSERT_EQ(2, ReadPngColorType(writer.GetTileFilename(2,
+                                                         make_pair(0, 0))));
+    Image tile;
+    ASSERT_TRUE(tile.Resize(4, 4, Image::RGBA));
+    tile.SetAllValues(100);
+    string filename = writer.GetTileFilename(2, make_pair(0, 1));
+    string error;
+    ASSERT_TRUE(WriteTileImage(filename, &tile, &error));
+    ASSERT_EQ(6, ReadPngColorType(filename));
+
+    ASSERT_FALSE(WriteTileImage("tilepyramid_test_tiles/missing/0.png",
+                                &tile, &error));
+    ASSERT_TRUE(error == "Can't write tile "
+                         "tilepyramid_test_tiles/missing/0.png");
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing BuildParentTiles()... ";
+
+    // Three children of tile (0, 0) and one of tile (1, 0).
+    WriteSolidTile(writer, 1, 0, 0, 10);
+    WriteSolidTile(writer, 1, 1, 0, 20);
+    WriteSolidTile(writer, 1, 0, 1, 30);
+    WriteSolidTile(writer, 1, 2, 1, 40);
+    map<pair<int, int>, set<pair<int, int> > > parents;
+    parents[make_pair(0, 0)].insert(make_pair(0, 0));
+    parents[make_pair(0, 0)].insert(make_pair(0, 1));
+    parents[make_pair(0, 0)].insert(make_pair(1, 0));
+    parents[make_pair(0, 1)].insert(make_pair(1, 2));
+
+    ThreadPool pool(2);
+    set<pair<int, int> > tiles;
+    string error;
+    ASSERT_TRUE(BuildParentTiles(&writer, 0, parents, &pool, &tiles,
+                                 &error));
+    ASSERT_EQ(2, static_cast<int>(tiles.size()));
+    ASSERT_TRUE(tiles.count(make_pair(0, 0)) == 1);
+    ASSERT_TRUE(tiles.count(make_pair(0, 1)) == 1);
+
+    // Each child fills its quadrant and the missing one stays clear.
+    Image tile;
+    ASSERT_TRUE(tile.Read(writer.GetTileFilename(0, make_pair(0, 0))));
+    Color pixel(4);
+    tile.GetPixel(0, 0, &pixel);
+    ASSERT_EQ(10, pixel.GetChannel(0));
+    ASSERT_EQ(255, pixel.GetChannel(3));
+    tile.GetPixel(3, 1, &pixel);
+    ASSERT_EQ(20, pixel.GetChannel(0));
+    tile.GetPixel(1, 3, &pixel);
+    ASSERT_EQ(30, pixel.GetChannel(0));
+    tile.GetPixel(3, 3, &pixel);
+    ASSERT_EQ(0, pixel.GetChannel(3));
+    ASSERT_TRUE(tile.Read(writer.GetTileFilename(0, make_pair(0, 1))));
+    tile.GetPixel(0, 3, &pixel);
+    ASSERT_EQ(40, pixel.GetChannel(0));
+
+    // A missing child fails the level.
+    parents[make_pair(1, 1)].insert(make_pair(3, 3));
+    ASSERT_FALSE(BuildParentTiles(&writer, 0, parents, &pool, &tiles,
+                                  &error));
+    ASSERT_TRUE(error == "Can't read tile tilepyramid_test_tiles/1_3_3.png");
+    cout << "pass\n";
+  }
+
+  // Clean up.
+  ASSERT_TRUE(system("rm -rf tilepyramid_test_tiles") == 0);
+
+  cout << "Passed\n";
+  return 0;
+}
+
+}  // namespace google_sky
+
+int main(int argc, char **argv) {
+  return google_sky::Main(argc, argv);
+}
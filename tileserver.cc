@@ -0,0 +1,420 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+#include "tileserver.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "image.h"
+#include "regionator.h"
+#include "string_util.h"
+#include "threadpool.h"
+
+namespace google_sky {
+
+namespace {
+
+// How long Serve() waits for a connection before checking for Stop().
+const int POLL_TIMEOUT_MS = 200;
+
+// How long a client has to send its request.
+const int RECEIVE_TIMEOUT_SECONDS = 10;
+
+// Largest request accepted.  Tile requests are a line and a few headers.
+const size_t MAX_REQUEST_SIZE = 16384;
+
+// Number of clients that can wait to connect.
+const int LISTEN_BACKLOG = 64;
+
+// Default limit on the memory used for cached tiles.
+const int64 DEFAULT_CACHE_BYTES = static_cast<int64>(64) << 20;
+
+// Keeps writes to a closed connection from raising SIGPIPE where possible.
+#ifdef MSG_NOSIGNAL
+const int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+const int SEND_FLAGS = 0;
+#endif
+
+// Sends all of data, returning false if the client went away.
+bool SendAll(int fd, const string &data) {
+  size_t sent = 0;
+  while (sent < data.size()) {
+    ssize_t n = send(fd, data.data() + sent, data.size() - sent, SEND_FLAGS);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    sent += n;
+  }
+  return true;
+}
+
+// Returns the value of an HTTP header in request, or "" if it is missing.
+string GetHeader(const string &request, const string &name) {
+  string lower_request = request;
+  string lower_name = "\r\n" + name + ":";
+  for (size_t i = 0; i < lower_request.size(); ++i) {
+    lower_request[i] = tolower(lower_request[i]);
+  }
+  for (size_t i = 0; i < lower_name.size(); ++i) {
+    lower_name[i] = tolower(lower_name[i]);
+  }
+  size_t start = lower_request.find(lower_name);
+  if (start == string::npos) return "";
+  start += lower_name.size();
+  size_t end = request.find("\r\n", start);
+  string value = request.substr(start, end - start);
+  StringStripLeadingAndTrailingWhiteSpace(&value);
+  return value;
+}
+
+// Returns whether an If-None-Match header value lists etag.
+bool MatchesETag(const string &if_none_match, const string &etag) {
+  if (if_none_match == "*") return true;
+  vector<string> tags;
+  StringSplitOnChar(if_none_match, ',', &tags);
+  for (size_t i = 0; i < tags.size(); ++i) {
+    string tag = tags[i];
+    StringStripLeadingAndTrailingWhiteSpace(&tag);
+    if (StringStartsWith(tag, "W/")) tag.erase(0, 2);
+    if (tag == etag) return true;
+  }
+  return false;
+}
+
+// Reads a whole file into contents.
+bool ReadFile(const string &filename, string *contents) {
+  FILE *fp = fopen(filename.c_str(), "rb");
+  if (!fp) return false;
+  contents->clear();
+  char buffer[65536];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+    contents->append(buffer, n);
+  }
+  bool success = !ferror(fp);
+  fclose(fp);
+  return success;
+}
+
+}  // namespace
+
+// Handles one client connection.
+class TileServer::ConnectionTask : public Task {
+ public:
+  ConnectionTask(TileServer *server, int fd) : server_(server), fd_(fd) {}
+
+  virtual void Run() {
+    server_->HandleConnection(fd_);
+  }
+
+ private:
+  TileServer *server_;
+  int fd_;
+
+  DISALLOW_COPY_AND_ASSIGN(ConnectionTask);
+};
+
+TileServer::TileServer(const Regionator &regionator)
+    : regionator_(regionator),
+      listen_fd_(-1),
+      port_(0),
+      stopping_(0),
+      cache_limit_(DEFAULT_CACHE_BYTES),
+      disk_cache_directory_(),
+      cache_(),
+      cache_size_(0),
+      lru_(),
+      num_tiles_rendered_(0),
+      num_temporary_files_(0) {
+  CHECK_EQ(pthread_mutex_init(&mutex_, NULL), 0);
+}
+
+TileServer::~TileServer() {
+  if (listen_fd_ >= 0) close(listen_fd_);
+  pthread_mutex_destroy(&mutex_);
+}
+
+// Binds to 127.0.0.1 so that the tiles are only visible on this machine.
+bool TileServer::Listen(int port) {
+  CHECK_LT(listen_fd_, 0) << "Already listening";
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) return false;
+  int on = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = htons(port);
+  socklen_t length = sizeof(address);
+  if (bind(fd, reinterpret_cast<struct sockaddr *>(&address),
+           sizeof(address)) != 0 ||
+      listen(fd, LISTEN_BACKLOG) != 0 ||
+      getsockname(fd, reinterpret_cast<struct sockaddr *>(&address),
+                  &length) != 0) {
+    close(fd);
+    return false;
+  }
+  listen_fd_ = fd;
+  port_ = ntohs(address.sin_port);
+  return true;
+}
+
+// Accepts connections and hands each one to the pool.  Polling with a
+// timeout lets Stop() be a plain flag.
+void TileServer::Serve(int num_threads) {
+  CHECK_GTE(listen_fd_, 0) << "Listen() must be called first";
+  ThreadPool pool(num_threads);
+  while (!stopping_) {
+    struct pollfd poll_fd;
+    poll_fd.fd = listen_fd_;
+    poll_fd.events = POLLIN;
+    poll_fd.revents = 0;
+    if (poll(&poll_fd, 1, POLL_TIMEOUT_MS) <= 0) continue;
+    int fd = accept(listen_fd_, NULL, NULL);
+    if (fd < 0) continue;
+#ifdef SO_NOSIGPIPE
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+    pool.Add(new ConnectionTask(this, fd));
+  }
+  pool.Wait();
+  stopping_ = 0;
+}
+
+// Maps the path to the root KML or to a tile named like Regionate() names
+// them.
+bool TileServer::GetResource(const string &path, string *content_type,
+                             string *body, string *etag) {
+  if (path == "/" || path == "/" + regionator_.root_kml()) {
+    *content_type = "application/vnd.google-earth.kml+xml";
+    *body = regionator_.MakeRootKml();
+    *etag = MakeETag(*body);
+    return true;
+  }
+
+  string directory = "/" + regionator_.output_directory() + "/";
+  if (!StringStartsWith(path, directory)) return false;
+  string filename = path.substr(directory.size());
+  string prefix, extension;
+  StringSplitExtension(filename, &prefix, &extension);
+  if (extension == ".png") {
+    *content_type = "image/png";
+  } else if (extension == ".kml") {
+    *content_type = "application/vnd.google-earth.kml+xml";
+  } else {
+    return false;
+  }
+
+  // The name is checked before it goes near the caches, since it becomes a
+  // path in the disk cache directory.
+  int x1, y1, x2, y2;
+  if (filename.find('/') != string::npos ||
+      filename.find("..") != string::npos ||
+      !regionator_.ParseFilenamePrefix(prefix, &x1, &y1, &x2, &y2)) {
+    return false;
+  }
+  if (LookUpTile(filename, body, etag)) return true;
+
+  // Both files of the tile come from one render, so both are cached.
+  Image tile;
+  string kml;
+  if (!regionator_.RenderTile(prefix, &tile, &kml)) return false;
+  string png;
+  if (!tile.WriteToString(&png)) return false;
+  tile.Clear();
+
+  pthread_mutex_lock(&mutex_);
+  ++num_tiles_rendered_;
+  CacheFile(prefix + ".png", png);
+  CacheFile(prefix + ".kml", kml);
+  pthread_mutex_unlock(&mutex_);
+  SaveFile(prefix + ".png", png);
+  SaveFile(prefix + ".kml", kml);
+
+  *body = (extension == ".png") ? png : kml;
+  *etag = MakeETag(*body);
+  return true;
+}
+
+int TileServer::num_tiles_rendered(void) {
+  pthread_mutex_lock(&mutex_);
+  int num_tiles_rendered = num_tiles_rendered_;
+  pthread_mutex_unlock(&mutex_);
+  return num_tiles_rendered;
+}
+
+// Uses a 64 bit FNV-1a hash, which is plenty to tell tiles apart.
+string TileServer::MakeETag(const string &content) {
+  uint64 hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < content.size(); ++i) {
+    hash ^= static_cast<uint8>(content[i]);
+    hash *= 1099511628211ULL;
+  }
+  return StringPrintf("\"%08x%08x\"", static_cast<uint>(hash >> 32),
+                      static_cast<uint>(hash & 0xffffffff));
+}
+
+// Answers one GET or HEAD request and closes the connection.
+void TileServer::HandleConnection(int fd) {
+  struct timeval timeout;
+  timeout.tv_sec = RECEIVE_TIMEOUT_SECONDS;
+  timeout.tv_usec = 0;
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  string request;
+  char buffer[4096];
+  while (request.find("\r\n\r\n") == string::npos &&
+         request.size() < MAX_REQUEST_SIZE) {
+    ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) break;
+    request.append(buffer, n);
+  }
+
+  vector<string> words;
+  StringSplitOnWhiteSpace(request.substr(0, request.find("\r\n")), &words);
+  string status;
+  string headers;
+  string body;
+  if (words.size() != 3 || !StringStartsWith(words[2], "HTTP/")) {
+    status = "400 Bad Request";
+  } else if (words[0] != "GET" && words[0] != "HEAD") {
+    status = "405 Method Not Allowed";
+    headers = "Allow: GET, HEAD\r\n";
+  } else {
+    string path = words[1].substr(0, words[1].find('?'));
+    string content_type;
+    string etag;
+    if (!GetResource(path, &content_type, &body, &etag)) {
+      status = "404 Not Found";
+    } else {
+      headers = "ETag: " + etag + "\r\n";
+      if (MatchesETag(GetHeader(request, "If-None-Match"), etag)) {
+        status = "304 Not Modified";
+        body.clear();
+      } else {
+        status = "200 OK";
+        headers += "Content-Type: " + content_type + "\r\n";
+      }
+    }
+  }
+
+  string response = "HTTP/1.1 " + status + "\r\n" + headers;
+  StringAppendF(&response, "Content-Length: %d\r\n",
+                static_cast<int>(body.size()));
+  response += "Connection: close\r\n\r\n";
+  if (words.empty() || words[0] != "HEAD") response += body;
+  SendAll(fd, response);
+  close(fd);
+}
+
+bool TileServer::LookUpTile(const string &filename, string *body,
+                            string *etag) {
+  pthread_mutex_lock(&mutex_);
+  map<string, CacheEntry>::iterator it = cache_.find(filename);
+  bool found = it != cache_.end();
+  if (found) {
+    lru_.splice(lru_.end(), lru_, it->second.position);
+    *body = it->second.body;
+    *etag = it->second.etag;
+  }
+  pthread_mutex_unlock(&mutex_);
+  if (found) return true;
+
+  if (disk_cache_directory_.empty() ||
+      !ReadFile(disk_cache_directory_ + "/" + filename, body)) {
+    return false;
+  }
+  *etag = MakeETag(*body);
+  pthread_mutex_lock(&mutex_);
+  CacheFile(filename, *body);
+  pthread_mutex_unlock(&mutex_);
+  return true;
+}
+
+void TileServer::CacheFile(const string &filename, const string &body) {
+  map<string, CacheEntry>::iterator it = cache_.find(filename);
+  if (it != cache_.end()) {
+    cache_size_ -= it->second.body.size();
+    lru_.erase(it->second.position);
+    cache_.erase(it);
+  }
+  int64 size = body.size();
+  if (size > cache_limit_) return;
+  while (cache_size_ + size > cache_limit_) {
+    map<string, CacheEntry>::iterator oldest = cache_.find(lru_.front());
+    cache_size_ -= oldest->second.body.size();
+    cache_.erase(oldest);
+    lru_.pop_front();
+  }
+  CacheEntry &entry = cache_[filename];
+  entry.body = body;
+  entry.etag = MakeETag(body);
+  entry.position = lru_.insert(lru_.end(), filename);
+  cache_size_ += size;
+}
+
+// Writes to a temporary file first so that other servers sharing the
+// directory never read a partial tile.
+void TileServer::SaveFile(const string &filename, const string &body) {
+  if (disk_cache_directory_.empty()) return;
+  pthread_mutex_lock(&mutex_);
+  int serial = num_temporary_files_++;
+  pthread_mutex_unlock(&mutex_);
+
+  string path = disk_cache_directory_ + "/" + filename;
+  string temporary_path = StringPrintf("%s.%d.%d.tmp", path.c_str(),
+                                       static_cast<int>(getpid()), serial);
+  FILE *fp = fopen(temporary_path.c_str(), "wb");
+  if (!fp) return;
+  bool success = fwrite(body.data(), 1, body.size(), fp) == body.size();
+  if (fclose(fp) != 0) success = false;
+  if (!success || rename(temporary_path.c_str(), path.c_str()) != 0) {
+    remove(temporary_path.c_str());
+  }
+}
+
+}  // namespace google_sky
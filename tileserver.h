@@ -0,0 +1,192 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+// Defines the TileServer class for serving regionated tiles over HTTP
+
+#ifndef TILESERVER_H__
+#define TILESERVER_H__
+
+#include <pthread.h>
+#include <signal.h>
+
+#include <list>
+#include <map>
+#include <string>
+
+#include "base.h"
+
+namespace google_sky {
+
+// Forward declarations.
+class Regionator;
+
+// Class for serving regionated tiles on demand
+//
+// Regionating writes every tile of the hierarchy up front, even though most
+// of them are never looked at.  A TileServer instead answers HTTP requests
+// for the root KML and for tiles, rendering each tile's PNG and KML with
+// Regionator::RenderTile() the first time it is asked for.  Rendered tiles
+// are kept in an in-memory cache of bounded size, evicting the least
+// recently used tiles first, and can also be saved to a directory so that
+// they survive the cache and the server.  Every response has an ETag
+// derived from a hash of its content, and requests with a matching
+// If-None-Match header get a 304 Not Modified.
+//
+// The server only listens on the loopback interface.  The URLs are the
+// paths Regionate() would write relative to the directory holding the root
+// KML: /<root_kml> (or just /) for the root KML and
+// /<output_directory>/<tile>.png or .kml for the tiles.
+//
+// The disk cache isn't checked against the image, so each image needs its
+// own cache directory.
+//
+// Example Usage:
+//
+// Regionator regionator(projected_image, bounding_box);
+// TileServer server(regionator);
+// server.set_cache_bytes(64 << 20);
+// server.set_disk_cache_directory("tile_cache");
+// if (!server.Listen(8080)) {
+//   // Report error.
+// }
+// server.Serve(4);  // Returns after Stop() is called.
+
+class TileServer {
+ public:
+  // Serves the tiles of regionator, which must outlive the server.
+  explicit TileServer(const Regionator &regionator);
+
+  // Closes the listening socket.
+  ~TileServer();
+
+  // Starts listening on the loopback interface at the given port, or at a
+  // free port if port is 0.  Returns false if the port can't be used.
+  bool Listen(int port);
+
+  // Handles requests on num_threads threads until Stop() is called.
+  // Listen() must have succeeded first.
+  void Serve(int num_threads);
+
+  // Makes Serve() return within a fraction of a second.  This only sets a
+  // flag, so it can be called from a signal handler.
+  inline void Stop(void) {
+    stopping_ = 1;
+  }
+
+  // Looks up the resource at an URL path, rendering and caching it if
+  // needed.  Returns false if there is no such resource.
+  bool GetResource(const string &path, string *content_type, string *body,
+                   string *etag);
+
+  // Returns the port being listened on.
+  inline int port(void) const {
+    return port_;
+  }
+
+  // Returns the most memory in bytes used for cached tiles.
+  inline int64 cache_bytes(void) const {
+    return cache_limit_;
+  }
+
+  // Sets the most memory in bytes used for cached tiles, 64 MB by default.
+  inline void set_cache_bytes(int64 cache_bytes) {
+    cache_limit_ = cache_bytes;
+  }
+
+  // Returns the directory that rendered tiles are saved to.
+  inline const string &disk_cache_directory(void) const {
+    return disk_cache_directory_;
+  }
+
+  // Sets the directory that rendered tiles are saved to and read back from,
+  // which must exist.  Tiles aren't saved if this is empty (the default).
+  inline void set_disk_cache_directory(const string &directory) {
+    disk_cache_directory_ = directory;
+  }
+
+  // Returns the number of tiles rendered so far.
+  int num_tiles_rendered(void);
+
+  // Returns an ETag for the given content.
+  static string MakeETag(const string &content);
+
+ private:
+  class ConnectionTask;
+
+  // A cached PNG or KML file.
+  struct CacheEntry {
+    string body;
+    string etag;
+    list<string>::iterator position;  // Position in lru_.
+  };
+
+  const Regionator &regionator_;
+
+  int listen_fd_;
+  int port_;
+  volatile sig_atomic_t stopping_;
+
+  int64 cache_limit_;
+  string disk_cache_directory_;
+
+  // Cached files keyed by file name, and their total size in bytes.
+  map<string, CacheEntry> cache_;
+  int64 cache_size_;
+
+  // File names from least to most recently used.
+  list<string> lru_;
+
+  int num_tiles_rendered_;
+  int num_temporary_files_;
+
+  // Guards cache_, cache_size_, lru_, num_tiles_rendered_, and
+  // num_temporary_files_.
+  pthread_mutex_t mutex_;
+
+  // Reads a request from a client, writes the response, and closes the
+  // connection.
+  void HandleConnection(int fd);
+
+  // Looks up a tile file in the memory and disk caches.
+  bool LookUpTile(const string &filename, string *body, string *etag);
+
+  // Adds a file to the memory cache, evicting old files to make room.  The
+  // caller must hold mutex_.
+  void CacheFile(const string &filename, const string &body);
+
+  // Saves a file to the disk cache.  Failures only cost a later render.
+  void SaveFile(const string &filename, const string &body);
+
+  // A TileServer must be created with a Regionator.
+  TileServer();
+
+  DISALLOW_COPY_AND_ASSIGN(TileServer);
+};
+
+}  // namespace google_sky
+
+#endif  // TILESERVER_H__
@@ -0,0 +1,322 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <iostream>
+#include <string>
+
+#include "base.h"
+#include "image.h"
+#include "mask.h"
+#include "regionator.h"
+#include "skyprojection.h"
+#include "string_util.h"
+#include "tileserver.h"
+
+// These files are for a downsampled SDSS frame with a black border, which
+// regionates into 1 top level tile and 4 subtiles.
+static const char *FITS_FILENAME = "testdata/fpC-001478-g3-0022_small.fits";
+static const char *PNG_FILENAME = "testdata/fpC-001478-g3-0022_small.png";
+
+namespace google_sky {
+
+// Runs TileServer::Serve() on its own thread.
+void *ServeTiles(void *server) {
+  static_cast<TileServer *>(server)->Serve(2);
+  return NULL;
+}
+
+// Sends an HTTP request to the server on localhost at port and splits the
+// response into its status code, headers, and body.
+void Fetch(int port, const string &request, int *status, string *headers,
+           string *body) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  ASSERT_TRUE(fd >= 0);
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = htons(port);
+  ASSERT_TRUE(connect(fd, reinterpret_cast<struct sockaddr *>(&address),
+                      sizeof(address)) == 0);
+  ASSERT_TRUE(send(fd, request.data(), request.size(), 0) ==
+              static_cast<ssize_t>(request.size()));
+
+  string response;
+  char buffer[4096];
+  ssize_t n;
+  while ((n = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+    response.append(buffer, n);
+  }
+  close(fd);
+
+  size_t end_of_headers = response.find("\r\n\r\n");
+  ASSERT_TRUE(end_of_headers != string::npos);
+  *headers = response.substr(0, end_of_headers + 2);
+  *body = response.substr(end_of_headers + 4);
+  ASSERT_TRUE(sscanf(headers->c_str(), "HTTP/1.1 %d", status) == 1);
+}
+
+// Sends a GET request for path.
+void Get(int port, const string &path, int *status, string *headers,
+         string *body) {
+  Fetch(port, "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n\r\n", status,
+        headers, body);
+}
+
+// Returns the value of a header in the response headers.
+string GetHeader(const string &headers, const string &name) {
+  size_t start = headers.find("\r\n" + name + ": ");
+  if (start == string::npos) return "";
+  start += name.size() + 4;
+  return headers.substr(start, headers.find("\r\n", start) - start);
+}
+
+// Returns whether png decodes to the same pixels as the tile in testdata.
+bool MatchesTile(const string &png, const char *filename) {
+  const char *tmp_png = "tileserver_test_tmp.png";
+  FILE *fp = fopen(tmp_png, "wb");
+  if (!fp) return false;
+  fwrite(png.data(), 1, png.size(), fp);
+  fclose(fp);
+  Image tile;
+  Image true_tile;
+  bool matches = tile.Read(tmp_png) &&
+                 true_tile.Read(StringPrintf("testdata/%s", filename)) &&
+                 tile.Equals(true_tile);
+  remove(tmp_png);
+  return matches;
+}
+
+int Main(int argc, char **argv) {
+  // Warp the test image like regionator_test does.
+  Image image;
+  ASSERT_TRUE(image.Read(PNG_FILENAME));
+  WcsProjection wcs(FITS_FILENAME, image.width(), image.height());
+  Color bg_color(4);
+  SkyProjection projection(image, wcs);
+  projection.SetBackgroundColor(bg_color);
+  projection.set_input_image_origin(SkyProjection::LOWER_LEFT);
+  projection.SetMaxSideLength(512);
+  Color black(4);
+  black.SetChannels(0, 3, 0);
+  black.SetChannel(3, 255);
+  Image mask;
+  Mask::CreateMask(image, black, &mask);
+  Mask::SetAlphaChannelFromMask(mask, &image);
+  Image warped_image;
+  projection.WarpImage(&warped_image);
+
+  Regionator regionator(warped_image, projection.bounding_box());
+  regionator.SetMaxTileSideLength(256);
+  regionator.set_draw_tile_borders(true);
+
+  {
+    cout << "Testing serving tiles... ";
+
+    TileServer server(regionator);
+    ASSERT_TRUE(server.Listen(0));
+    ASSERT_TRUE(server.port() > 0);
+    pthread_t thread;
+    ASSERT_TRUE(pthread_create(&thread, NULL, ServeTiles, &server) == 0);
+
+    int status;
+    string headers;
+    string body;
+    Get(server.port(), "/root.kml", &status, &headers, &body);
+    ASSERT_EQ(200, status);
+    ASSERT_TRUE(body == regionator.MakeRootKml());
+    ASSERT_TRUE(StringContains(body, "tiles/tile_0_0_381_511.kml"));
+    ASSERT_TRUE(GetHeader(headers, "Content-Type") ==
+                "application/vnd.google-earth.kml+xml");
+    Get(server.port(), "/", &status, &headers, &body);
+    ASSERT_EQ(200, status);
+    ASSERT_EQ(0, server.num_tiles_rendered());
+
+    // The first request for a tile renders it.
+    Get(server.port(), "/tiles/tile_0_0_190_255.png", &status, &headers,
+        &body);
+    ASSERT_EQ(200, status);
+    ASSERT_TRUE(GetHeader(headers, "Content-Type") == "image/png");
+    ASSERT_TRUE(GetHeader(headers, "Content-Length") ==
+                StringPrintf("%d", static_cast<int>(body.size())));
+    ASSERT_TRUE(MatchesTile(body, "tile_0_0_190_255.png"));
+    string etag = GetHeader(headers, "ETag");
+    ASSERT_TRUE(etag == TileServer::MakeETag(body));
+    ASSERT_EQ(1, server.num_tiles_rendered());
+
+    // The tile's KML came from the same render, and the PNG is cached.
+    Get(server.port(), "/tiles/tile_0_0_190_255.kml?x=1", &status, &headers,
+        &body);
+    ASSERT_EQ(200, status);
+    ASSERT_TRUE(StringContains(body, "<href>tile_0_0_190_255.png</href>"));
+    Get(server.port(), "/tiles/tile_0_0_190_255.png", &status, &headers,
+        &body);
+    ASSERT_TRUE(GetHeader(headers, "ETag") == etag);
+    ASSERT_EQ(1, server.num_tiles_rendered());
+
+    // Clients holding the current ETag get an empty 304 response.
+    Fetch(server.port(),
+          "GET /tiles/tile_0_0_190_255.png HTTP/1.1\r\n"
+          "If-None-Match: \"0\", " + etag + "\r\n\r\n",
+          &status, &headers, &body);
+    ASSERT_EQ(304, status);
+    ASSERT_TRUE(body.empty());
+    ASSERT_TRUE(GetHeader(headers, "ETag") == etag);
+
+    // HEAD gets the headers alone.
+    Fetch(server.port(),
+          "HEAD /tiles/tile_190_255_381_511.png HTTP/1.1\r\n\r\n",
+          &status, &headers, &body);
+    ASSERT_EQ(200, status);
+    ASSERT_TRUE(body.empty());
+    ASSERT_TRUE(GetHeader(headers, "Content-Length") != "0");
+
+    // Missing resources and bad requests.
+    Get(server.port(), "/tiles/tile_0_0_95_127.png", &status, &headers,
+        &body);
+    ASSERT_EQ(404, status);
+    Get(server.port(), "/tiles/tile_0_0_190_255.jpg", &status, &headers,
+        &body);
+    ASSERT_EQ(404, status);
+    Get(server.port(), "/tile_0_0_190_255.png", &status, &headers, &body);
+    ASSERT_EQ(404, status);
+    Fetch(server.port(), "POST / HTTP/1.1\r\n\r\n", &status, &headers, &body);
+    ASSERT_EQ(405, status);
+    Fetch(server.port(), "nonsense\r\n\r\n", &status, &headers, &body);
+    ASSERT_EQ(400, status);
+
+    server.Stop();
+    ASSERT_TRUE(pthread_join(thread, NULL) == 0);
+
+    cout << "pass\n";
+  }
+  {
+    cout << "Testing the tile caches... ";
+
+    // Without a memory cache each request renders the tile again.
+    TileServer uncached_server(regionator);
+    uncached_server.set_cache_bytes(0);
+    string content_type;
+    string body;
+    string etag;
+    ASSERT_TRUE(uncached_server.GetResource("/tiles/tile_0_0_190_255.png",
+                                            &content_type, &body, &etag));
+    ASSERT_TRUE(uncached_server.GetResource("/tiles/tile_0_0_190_255.png",
+                                            &content_type, &body, &etag));
+    ASSERT_EQ(2, uncached_server.num_tiles_rendered());
+
+    // Fill a cache exactly with one tile.  Adding another file evicts the
+    // least recently used one.
+    string kml;
+    ASSERT_TRUE(uncached_server.GetResource("/tiles/tile_0_0_190_255.kml",
+                                            &content_type, &kml, &etag));
+    TileServer small_server(regionator);
+    small_server.set_cache_bytes(body.size() + kml.size());
+    ASSERT_TRUE(small_server.GetResource("/tiles/tile_0_0_190_255.png",
+                                         &content_type, &body, &etag));
+    ASSERT_TRUE(small_server.GetResource("/tiles/tile_0_0_190_255.kml",
+                                         &content_type, &body, &etag));
+    ASSERT_EQ(1, small_server.num_tiles_rendered());
+    ASSERT_TRUE(small_server.GetResource("/tiles/tile_0_0_381_511.kml",
+                                         &content_type, &body, &etag));
+    ASSERT_EQ(2, small_server.num_tiles_rendered());
+    ASSERT_TRUE(small_server.GetResource("/tiles/tile_0_0_190_255.kml",
+                                         &content_type, &body, &etag));
+    ASSERT_EQ(2, small_server.num_tiles_rendered());
+    ASSERT_TRUE(small_server.GetResource("/tiles/tile_0_0_190_255.png",
+                                         &content_type, &body, &etag));
+    ASSERT_EQ(3, small_server.num_tiles_rendered());
+
+    // Tiles saved to disk are read back instead of being rendered.
+    const char *cache_directory = "tileserver_test_cache";
+    ASSERT_TRUE(mkdir(cache_directory, S_IRWXU) == 0);
+    TileServer disk_server(regionator);
+    disk_server.set_cache_bytes(0);
+    disk_server.set_disk_cache_directory(cache_directory);
+    ASSERT_TRUE(disk_server.GetResource("/tiles/tile_0_0_190_255.png",
+                                        &content_type, &body, &etag));
+    string saved_body;
+    string saved_etag;
+    ASSERT_TRUE(disk_server.GetResource("/tiles/tile_0_0_190_255.png",
+                                        &content_type, &saved_body,
+                                        &saved_etag));
+    ASSERT_TRUE(disk_server.GetResource("/tiles/tile_0_0_190_255.kml",
+                                        &content_type, &body, &etag));
+    ASSERT_EQ(1, disk_server.num_tiles_rendered());
+    ASSERT_TRUE(MatchesTile(saved_body, "tile_0_0_190_255.png"));
+    ASSERT_TRUE(saved_etag == TileServer::MakeETag(saved_body));
+
+    // Only tile names reach the disk cache, so no other file can be read
+    // through it, either inside the directory or outside it.
+    const char *secret_files[] = {"tileserver_test_secret.kml",
+                                  "tileserver_test_cache/secret.kml"};
+    for (int i = 0; i < 2; ++i) {
+      FILE *fp = fopen(secret_files[i], "w");
+      ASSERT_TRUE(fp != NULL);
+      fputs("secret", fp);
+      ASSERT_TRUE(fclose(fp) == 0);
+    }
+    const char *bad_paths[] = {
+      "/tiles/../tileserver_test_secret.kml",
+      "/tiles/tile_0_0_190_255/../../tileserver_test_secret.kml",
+      "/tiles/secret.kml",
+      "/tiles/tile_00_0_190_255.kml",
+    };
+    for (int i = 0; i < 4; ++i) {
+      ASSERT_FALSE(disk_server.GetResource(bad_paths[i], &content_type,
+                                           &body, &etag));
+    }
+    ASSERT_EQ(1, disk_server.num_tiles_rendered());
+
+    // Clean up.
+    ASSERT_TRUE(remove("tileserver_test_secret.kml") == 0);
+    ASSERT_TRUE(system("rm -rf tileserver_test_cache") == 0);
+
+    cout << "pass\n";
+  }
+
+  cout << "Passed\n";
+  return 0;
+}
+
+}  // namespace google_sky
+
+int main(int argc, char **argv) {
+  return google_sky::Main(argc, argv);
+}
@@ -26,94 +26,1738 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
+#include <dirent.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <cerrno>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <google/gflags.h>
+
+#include "base.h"
+#include "batch.h"
+#include "bitmask.h"
+#include "boundingbox.h"
+#include "catalog.h"
+#include "catalogregionator.h"
+#include "color.h"
+#include "daemon.h"
+#include "fits.h"
+#include "fitscompression.h"
+#include "fitsimage.h"
+#include "fitstime.h"
+#include "geotiff.h"
+#include "hips.h"
+#include "kml.h"
+#include "mask.h"
+#include "image.h"
+#include "mosaic.h"
+#include "platesolver.h"
+#include "polarcap.h"
+#include "referencecatalog.h"
+#include "regionator.h"
+#include "resultcache.h"
+#include "sha256.h"
+#include "skyprojection.h"
+#include "string_util.h"
+#include "threadpool.h"
+#include "tileserver.h"
+#include "wcsprojection.h"
+#include "wraparound.h"
+#include "xyzpyramid.h"
+
+// Commandline flags.
+DEFINE_bool(all_extensions, false,
+            "warp every image extension of --fitsfile that has its own WCS");
+DEFINE_bool(automask, false, "automatically create a mask");
+DEFINE_int32(automask_red, 0, "red channel to mask out with automasking");
+DEFINE_int32(automask_green, 0, "green channel to mask out with automasking");
+DEFINE_int32(automask_blue, 0, "blue channel to mask out with automasking");
+DEFINE_string(automask_mode, "edges",
+              "'edges' masks runs of the color reaching in from each edge, "
+              "'flood' masks all background connected to the edges, "
+              "'color' masks every pixel of the color while warping");
+DEFINE_string(automask_morphology, "",
+              "'erode', 'dilate', 'open', or 'close' the automask, where "
+              "eroding grows the masked out area");
+DEFINE_string(automask_morphology_element, "disk",
+              "'disk' or 'rectangle' structuring element for "
+              "--automask_morphology");
+DEFINE_int32(automask_morphology_radius, 1,
+             "radius in pixels of the --automask_morphology element");
+DEFINE_int32(automask_tolerance, 0,
+             "maximum difference per channel from the automask color for "
+             "--automask_mode=flood");
+DEFINE_string(automaskfile, "auto_generated_mask",
+              "prefix name of auto-generated mask");
+DEFINE_string(batch, "",
+              "manifest of jobs to run in one process, one per line");
+DEFINE_int64(batch_memory_mb, 0,
+             "memory in MB that concurrent --batch jobs may use (0 means "
+             "half of physical memory)");
+DEFINE_string(catalog, "",
+              "FITS table or CSV catalog of sources to regionate into KML "
+              "Placemarks instead of warping an image");
+DEFINE_string(catalog_dec_column, "",
+              "column of --catalog holding dec in degrees (found by name "
+              "by default)");
+DEFINE_int32(catalog_max_sources_per_node, 100,
+             "most --catalog sources shown by each regionated node");
+DEFINE_string(catalog_name, "", "name of the --catalog overlay");
+DEFINE_string(catalog_name_column, "",
+              "column of --catalog holding source names (IAU style names "
+              "by default)");
+DEFINE_string(catalog_ra_column, "",
+              "column of --catalog holding ra in degrees (found by name by "
+              "default)");
+DEFINE_string(catalog_survey, "",
+              "survey name starting the IAU style names of --catalog "
+              "sources");
+DEFINE_bool(copy_input_size, false,
+            "set output image size to be identical to the input image?");
+DEFINE_string(daemon, "",
+              "serve JSON job requests from standard input ('-') or from "
+              "a Unix domain socket at this path");
+DEFINE_string(fitsfile, "", "name of input FITS file containing WCS");
+DEFINE_int64(fits_dq_bits, -1,
+             "data quality bits that flag bad pixels (default all bits)");
+DEFINE_string(fits_dq_extension, "",
+              "EXTNAME of a data quality extension of --fitsfile whose "
+              "flagged pixels are made transparent");
+DEFINE_bool(fits_null_transparent, false,
+            "make null (NaN or BLANK) pixels read from --fitsfile "
+            "transparent");
+DEFINE_double(fits_percentile_max, 99.5,
+              "percentile mapped to white when reading pixels from FITS");
+DEFINE_double(fits_percentile_min, 3.0,
+              "percentile mapped to black when reading pixels from FITS");
+DEFINE_string(ground_overlay_name, "Your registered image",
+              "name of <GroundOverlay> element in KML");
+DEFINE_string(hips_creator_did, "ivo://unknown/wcs2kml",
+              "IVOA identifier (creator_did) of the --hips_dir survey");
+DEFINE_string(hips_dir, "",
+              "directory to also write the --mosaic images to as HiPS "
+              "tiles");
+DEFINE_int32(hips_order, -1,
+             "finest tile order of --hips_dir (-1 means about the "
+             "resolution of the images)");
+DEFINE_int32(hips_tile_width, 512, "pixel size of --hips_dir tiles");
+DEFINE_string(hips_title, "", "title of the --hips_dir survey");
+DEFINE_string(imagefile, "",
+              "name of input image (PNG format); if empty the pixels are "
+              "read from --fitsfile");
+DEFINE_bool(input_image_origin_is_upper_left, false,
+            "flip the input image about y axis?");
+DEFINE_string(kmlfile, "doc.kml", "name of output KML file");
+DEFINE_string(maskfile, "", "name of input mask image (PNG format)");
+DEFINE_int32(max_side_length, 10000, "maximum output side length");
+DEFINE_string(mosaic, "",
+              "manifest of images to warp onto one global tile pyramid");
+DEFINE_double(mosaic_clip_sigma, 3.0,
+              "standard deviations beyond which "
+              "--mosaic_combine=sigma_clip rejects samples");
+DEFINE_int32(mosaic_clip_iterations, 2,
+             "number of times --mosaic_combine=sigma_clip clips samples");
+DEFINE_string(mosaic_combine, "blend",
+              "'blend' draws later --mosaic images on top, 'mean', "
+              "'median', or 'sigma_clip' co-add overlapping images");
+DEFINE_string(mosaic_insert, "",
+              "manifest of new images to insert into the pyramid already "
+              "built from --mosaic");
+DEFINE_int32(mosaic_level, -1,
+             "finest level of the --mosaic pyramid (-1 means about the "
+             "resolution of the images)");
+DEFINE_int64(mosaic_memory_mb, 0,
+             "memory in MB for the images being warped by --mosaic (0 "
+             "means half of physical memory)");
+DEFINE_string(outfile, "warped_image.png", "name out output file");
+DEFINE_int32(output_height, -1, "output height of projected image");
+DEFINE_int32(output_width, -1, "output width of projected image");
+DEFINE_bool(polar_caps, false,
+            "tile images that cross a celestial pole with RA-adaptive "
+            "widths instead of warping them to one image");
+DEFINE_double(polar_cap_dec, 60.0,
+              "|dec| beyond which --polar_caps tiles shrink in ra");
+DEFINE_string(reference_catalog, "",
+              "libwcs catalog (e.g. ucac2, tmc, ty2) or TDC catalog file of "
+              "stars to overlay on the image");
+DEFINE_string(reference_catalog_dir, "reference_stars",
+              "directory for the regionated --reference_catalog stars");
+DEFINE_string(reference_catalog_kml, "reference_stars.kml",
+              "name of the root KML file of the --reference_catalog stars");
+DEFINE_double(reference_catalog_mag_limit, 0.0,
+              "faintest magnitude of --reference_catalog stars (no limit if "
+              "0)");
+DEFINE_bool(regionate, false,
+            "subdivide output image into a hierarchy of tiles?");
+DEFINE_string(regionate_dir, "tiles",
+              "directory to output regionated tiles into");
+DEFINE_string(regionate_prefix, "tile", "filename prefix of regionated tiles");
+DEFINE_bool(regionate_draw_tile_borders, false,
+            "draw borders for each regionated tile?");
+DEFINE_int32(regionate_min_lod_pixels, 128,
+             "value of minLodPixels to use in the region for each tile");
+DEFINE_int32(regionate_max_lod_pixels, -1,
+             "value of maxLodPixels to use in the region for each tile");
+DEFINE_int32(regionate_tile_size, 256, "pixel size of regionated tiles");
+DEFINE_int32(regionate_top_level_draw_order, 0,
+             "<drawOrder> value of the top level tile");
+DEFINE_string(result_cache, "",
+              "directory of cached outputs to reuse for identical runs");
+DEFINE_int64(result_cache_mb, 1024,
+             "most MB of outputs to keep in --result_cache");
+DEFINE_int32(serve_port, -1,
+             "serve regionated tiles on demand over HTTP on this localhost "
+             "port instead of writing them (0 picks a free port)");
+DEFINE_int32(serve_cache_mb, 64,
+             "memory in MB for caching tiles rendered by --serve_port");
+DEFINE_string(serve_disk_cache, "",
+              "directory to save tiles rendered by --serve_port in");
+DEFINE_string(solve_catalog, "",
+              "libwcs catalog or TDC catalog file of reference stars for "
+              "--solve_wcs");
+DEFINE_double(solve_dec, -100.0,
+              "approximate dec of the image center in degrees for "
+              "--solve_wcs");
+DEFINE_int32(solve_num_stars, 30,
+             "number of the brightest image stars matched by --solve_wcs");
+DEFINE_double(solve_ra, -1.0,
+              "approximate ra of the image center in degrees for "
+              "--solve_wcs");
+DEFINE_double(solve_radius, 0.5,
+              "radius in degrees around --solve_ra, --solve_dec from which "
+              "reference stars are read");
+DEFINE_bool(solve_wcs, false,
+            "fit the WCS of --fitsfile to its stars and --solve_catalog "
+            "instead of reading it from the header");
+DEFINE_bool(time_series, false,
+            "warp every plane of a FITS data cube as a time stamped overlay");
+DEFINE_string(time_series_start, "",
+              "time of the first plane (YYYY-MM-DDThh:mm:ss) if the header "
+              "has no time axis");
+DEFINE_double(time_series_step, 0.0,
+              "seconds between planes if the header has no time axis");
+DEFINE_string(wldfile, "", "name of output WLD file (not written by default)");
+DEFINE_string(geotiff, "",
+              "name of output tiled GeoTIFF file with overviews (not "
+              "written by default)");
+DEFINE_int32(geotiff_tile_size, 256,
+             "pixel size of --geotiff tiles (a multiple of 16)");
+DEFINE_string(xyz_dir, "",
+              "directory to also write z/x/y tiles and tiles.json for web "
+              "map viewers to");
+DEFINE_int32(xyz_max_zoom, -1,
+             "finest zoom of --xyz_dir (-1 means about the resolution of "
+             "the warped image)");
+DEFINE_int32(xyz_tile_size, 256, "pixel size of --xyz_dir tiles");
+
+namespace google_sky {
+
+// The cache of outputs given by --result_cache, or NULL.
+static ResultCache *result_cache = NULL;
+
+// The server started by --serve_port, for stopping it from signal handlers.
+static TileServer *tile_server = NULL;
+
+// Stops the tile server so that wcs2kml can finish normally.
+static void StopTileServer(int signal_number) {
+  if (tile_server != NULL) tile_server->Stop();
+}
+
+// Writes a KML GroundOverlay describing this image on the sky.
+void WriteKmlBox(const string &kmlfile, const string &imagefile,
+                 const string &ground_overlay_name,
+                 const SkyProjection &projection) {
+  string kml_string;
+  projection.CreateKmlGroundOverlay(imagefile, ground_overlay_name,
+                                    &kml_string);
+
+  FILE *fp = fopen(kmlfile.c_str(), "w");
+  if (!fp) {
+    fprintf(stderr, "Couldn't open file '%s' for writing\n", kmlfile.c_str());
+    exit(EXIT_FAILURE);
+  }
+
+  fprintf(fp, "%s", kml_string.c_str());
+  fclose(fp);
+}
+
+// Writes a world file describing the bounding box.
+void WriteWorldFile(const string &wldfile,
+                    const SkyProjection &projection) {
+  string wld_string;
+  projection.CreateWorldFile(&wld_string);
+
+  FILE *fp = fopen(wldfile.c_str(), "w");
+  if (!fp) {
+    fprintf(stderr, "Couldn't open file '%s' for writing\n", wldfile.c_str());
+    exit(EXIT_FAILURE);
+  }
+
+  fprintf(fp, "%s", wld_string.c_str());
+  fclose(fp);
+}
+
+// Writes a KML document to file.
+void WriteKml(const string &kmlfile, const Kml &kml) {
+  FILE *fp = fopen(kmlfile.c_str(), "w");
+  if (!fp) {
+    fprintf(stderr, "Couldn't open file '%s' for writing\n", kmlfile.c_str());
+    exit(EXIT_FAILURE);
+  }
+
+  fprintf(fp, "%s", kml.ToString().c_str());
+  fclose(fp);
+}
+
+// Returns the color to mask out with --automask.
+void GetAutomaskColor(Color *mask_out_color) {
+  mask_out_color->SetChannel(0, FLAGS_automask_red);
+  mask_out_color->SetChannel(1, FLAGS_automask_green);
+  mask_out_color->SetChannel(2, FLAGS_automask_blue);
+  mask_out_color->SetChannel(3, 255);
+}
+
+// Creates a mask for the --automask color using --automask_mode, which must
+// be 'edges' or 'flood'.
+void CreateAutomask(const Image &image, Image *mask) {
+  // Determine the color to search for when building the mask.
+  Color mask_out_color(4);
+  GetAutomaskColor(&mask_out_color);
+
+  if (FLAGS_automask_mode == "flood") {
+    Mask::CreateFloodMask(image, mask_out_color, FLAGS_automask_tolerance,
+                          mask);
+  } else {
+    Mask::CreateMask(image, mask_out_color, mask);
+  }
+
+  if (FLAGS_automask_morphology.empty()) return;
+  Mask::StructuringElement element = Mask::DISK;
+  if (FLAGS_automask_morphology_element == "rectangle") {
+    element = Mask::RECTANGLE;
+  }
+  int radius = FLAGS_automask_morphology_radius;
+  if (FLAGS_automask_morphology == "erode") {
+    Mask::Erode(element, radius, radius, mask);
+  } else if (FLAGS_automask_morphology == "dilate") {
+    Mask::Dilate(element, radius, radius, mask);
+  } else if (FLAGS_automask_morphology == "open") {
+    Mask::Open(element, radius, radius, mask);
+  } else {
+    Mask::Close(element, radius, radius, mask);
+  }
+}
+
+// Makes the pixels matching the --automask color transparent.
+void ApplyAutomask(Image *image) {
+  Image mask;
+  CreateAutomask(*image, &mask);
+  Mask::SetAlphaChannelFromMask(mask, image);
+}
+
+// Sets up --automask for warping image with projection.  With
+// --automask_mode=color the color is only checked for sampled pixels, and
+// otherwise the mask is created in bitmask, which must outlive the warping.
+void SetUpAutomask(const Image &image, BitMask *bitmask,
+                   SkyProjection *projection) {
+  if (FLAGS_automask_mode == "color") {
+    Color mask_out_color(4);
+    GetAutomaskColor(&mask_out_color);
+    projection->SetMaskColor(mask_out_color);
+  } else {
+    Image mask;
+    CreateAutomask(image, &mask);
+    bitmask->FromImage(mask);
+    projection->set_mask(bitmask);
+  }
+}
+
+// Receives the rows of a --maskfile (or the maskfile of a batch job), which
+// must be the same size as its image.  Binary masks are read into a BitMask
+// and others into a grayscale image, whose values are the alpha of the input
+// pixels so that graded masks can feather the edges of an image.  The values
+// can instead be written straight into the alpha channel of the image.
+class MaskFileSink : public GrayscaleRowSink {
+ public:
+  // Reads the mask of a width x height image into bitmask if it's binary
+  // and into mask otherwise.
+  MaskFileSink(int width, int height, BitMask *bitmask, Image *mask)
+      : width_(width), height_(height), mask_width_(0), mask_height_(0),
+        bitmask_(bitmask), mask_(mask), image_(NULL), is_binary_(false) {
+    // Nothing needed.
+  }
+
+  // Reads the mask into the alpha channel of image, which must have one.
+  explicit MaskFileSink(Image *image)
+      : width_(image->width()), height_(image->height()), mask_width_(0),
+        mask_height_(0), bitmask_(NULL), mask_(NULL), image_(image),
+        is_binary_(false) {
+    // Nothing needed.
+  }
+
+  virtual ~MaskFileSink() {
+    // Nothing needed.
+  }
+
+  virtual bool Start(int width, int height, bool is_binary) {
+    mask_width_ = width;
+    mask_height_ = height;
+    if (width != width_ || height != height_) return false;
+    if (image_) return true;
+    is_binary_ = is_binary;
+    if (is_binary_) {
+      bitmask_->Resize(width, height);
+      return true;
+    }
+    return mask_->Resize(width, height, Image::GRAYSCALE);
+  }
+
+  virtual void SetRow(int j, const uint8 *gray) {
+    if (image_) {
+      int channels = image_->channels();
+      uint8 *alpha = image_->GetMutableRow(j) + channels - 1;
+      for (int i = 0; i < width_; ++i) {
+        alpha[i * channels] = gray[i];
+      }
+    } else if (is_binary_) {
+      bitmask_->SetRowFromBytes(j, gray);
+    } else {
+      memcpy(mask_->GetMutableRow(j), gray, width_);
+    }
+  }
+
+  // Returns whether the mask was read into the BitMask.
+  bool is_binary() const {
+    return is_binary_;
+  }
+
+  // Returns the error for a failed read of filename.
+  string GetError(const string &filename) const {
+    if (mask_width_ > 0 && (mask_width_ != width_ ||
+                            mask_height_ != height_)) {
+      return StringPrintf("Mask %s is %d x %d but the image is %d x %d",
+                          filename.c_str(), mask_width_, mask_height_,
+                          width_, height_);
+    }
+    return "Couldn't read mask file " + filename;
+  }
+
+ private:
+  int width_;
+  int height_;
+  int mask_width_;
+  int mask_height_;
+  BitMask *bitmask_;
+  Image *mask_;
+  Image *image_;
+  bool is_binary_;
+
+  DISALLOW_COPY_AND_ASSIGN(MaskFileSink);
+};
+
+// Sets up a --maskfile (or the maskfile of a batch job) for warping a width
+// x height image with projection.  The mask is read into bitmask or mask,
+// which must outlive the warping.  Returns false if it can't be read or
+// isn't width x height.
+bool SetUpMaskFile(const string &filename, int width, int height,
+                   BitMask *bitmask, Image *mask, SkyProjection *projection,
+                   string *error) {
+  MaskFileSink sink(width, height, bitmask, mask);
+  if (!ReadGrayscaleRows(filename, &sink)) {
+    *error = sink.GetError(filename);
+    return false;
+  }
+  if (sink.is_binary()) {
+    projection->set_mask(bitmask);
+  } else {
+    projection->set_mask_image(mask);
+  }
+  return true;
+}
+
+// Reads a mask file straight into the alpha channel of image, adding one to
+// images without it.  Returns false if it can't be read or isn't the size of
+// the image.
+bool ReadMaskIntoAlpha(const string &filename, Image *image, string *error) {
+  if (image->channels() != 2 && image->channels() != 4 &&
+      !image->ConvertToRGBA()) {
+    *error = "Couldn't add an alpha channel for mask file " + filename;
+    return false;
+  }
+  MaskFileSink sink(image);
+  if (!ReadGrayscaleRows(filename, &sink)) {
+    *error = sink.GetError(filename);
+    return false;
+  }
+  return true;
+}
+
+// Finds the --fits_dq_extension HDU for the image with the given header.  If
+// the image has an EXTVER, the DQ extension must have the same one, as in
+// files holding several SCI and DQ pairs.  Returns false if there is none.
+bool FindQualityHdu(const string &image_header, long *offset,
+                    string *header) {
+  vector<long> offsets;
+  vector<string> headers;
+  Fits::FindImageHdus(FLAGS_fitsfile, &offsets, &headers);
+
+  bool has_extver = Fits::HeaderHasKeyword(image_header, "EXTVER");
+  int extver = Fits::HeaderReadKeywordInt(image_header, "EXTVER", 1);
+  for (size_t i = 0; i < headers.size(); ++i) {
+    if (Fits::HeaderReadKeywordString(headers[i], "EXTNAME", "") ==
+            FLAGS_fits_dq_extension &&
+        (!has_extver ||
+         Fits::HeaderReadKeywordInt(headers[i], "EXTVER", 1) == extver)) {
+      *offset = offsets[i];
+      *header = headers[i];
+      return true;
+    }
+  }
+  return false;
+}
+
+// Creates a GroundOverlay for a warped image covering bounding_box.
+void CreateGroundOverlay(const string &imagefile, const string &name,
+                         const BoundingBox &bounding_box,
+                         KmlGroundOverlay *ground_overlay) {
+  KmlIcon icon;
+  icon.href.set(imagefile);
+  ground_overlay->FromBoundingBox(bounding_box);
+  ground_overlay->name.set(name);
+  ground_overlay->icon.set(icon);
+}
+
+// Result of warping one extension of a multi-extension FITS file.
+struct ExtensionResult {
+  ExtensionResult() : success(false) {}
+
+  bool success;
+  KmlGroundOverlay ground_overlay;  // Used when not regionating.
+  KmlNetworkLink network_link;      // Used when regionating.
+};
+
+// Reads, warps, and writes one image extension
+//
+// Each task reads the pixels of its extension directly from the FITS file
+// using the header that was cached when the extensions were enumerated.
+// Since several tasks run at once, decompression within a task is single
+// threaded.
+class WarpExtensionTask : public Task {
+ public:
+  WarpExtensionTask(const string &fits_filename, long offset,
+                    const string &hdu_header, const string &name,
+                    const string &suffix, const WcsProjection *wcs,
+                    ExtensionResult *result)
+      : fits_filename_(fits_filename), offset_(offset),
+        hdu_header_(hdu_header), name_(name), suffix_(suffix), wcs_(wcs),
+        result_(result) {}
+
+  virtual void Run();
+
+ private:
+  string fits_filename_;
+  long offset_;
+  string hdu_header_;
+  string name_;
+  string suffix_;
+  const WcsProjection *wcs_;
+  ExtensionResult *result_;
+
+  DISALLOW_COPY_AND_ASSIGN(WarpExtensionTask);
+};
+
+void WarpExtensionTask::Run() {
+  // The floating point pixels are released as soon as they are scaled.
+  Image image;
+  {
+    FitsImage fits_image;
+    fits_image.set_num_threads(1);
+    fits_image.set_null_transparent(FLAGS_fits_null_transparent);
+    if (!fits_image.ReadHdu(fits_filename_, offset_, hdu_header_)) {
+      fprintf(stderr, "Unable to read extension %s\n", name_.c_str());
+      return;
+    }
+
+    double zmin, zmax;
+    fits_image.GetPercentileRange(FLAGS_fits_percentile_min,
+                                  FLAGS_fits_percentile_max, &zmin, &zmax);
+    fits_image.ToImage(zmin, zmax, &image);
+  }
+
+  Color bg_color(4);
+  bg_color.SetAllChannels(0);
+  SkyProjection projection(image, *wcs_);
+  projection.SetBackgroundColor(bg_color);
+  if (FLAGS_input_image_origin_is_upper_left) {
+    projection.set_input_image_origin(SkyProjection::UPPER_LEFT);
+  } else {
+    projection.set_input_image_origin(SkyProjection::LOWER_LEFT);
+  }
+  projection.SetMaxSideLength(FLAGS_max_side_length);
+
+  BitMask bitmask;
+  if (FLAGS_automask) {
+    SetUpAutomask(image, &bitmask, &projection);
+  }
+
+  Image projected_image;
+  projection.WarpImage(&projected_image);
+  image.Clear();
+
+  if (!FLAGS_regionate) {
+    string prefix, extension;
+    StringSplitExtension(FLAGS_outfile, &prefix, &extension);
+    string outfile = prefix + suffix_ + extension;
+    if (!projected_image.Write(outfile)) {
+      fprintf(stderr, "Couldn't write image to file '%s'\n",
+              outfile.c_str());
+      return;
+    }
+
+    CreateGroundOverlay(outfile, FLAGS_ground_overlay_name + " " + name_,
+                        projection.bounding_box(), &result_->ground_overlay);
+  } else {
+    Regionator regionator(projected_image, projection.bounding_box());
+    regionator.SetMaxTileSideLength(FLAGS_regionate_tile_size);
+    regionator.set_filename_prefix(FLAGS_regionate_prefix + suffix_);
+    regionator.set_output_directory(FLAGS_regionate_dir);
+    regionator.set_min_lod_pixels(FLAGS_regionate_min_lod_pixels);
+    regionator.set_max_lod_pixels(FLAGS_regionate_max_lod_pixels);
+    regionator.set_top_level_draw_order(FLAGS_regionate_top_level_draw_order);
+    regionator.set_draw_tile_borders(FLAGS_regionate_draw_tile_borders);
+    string error;
+    if (!regionator.Regionate(&result_->network_link, &error)) {
+      fprintf(stderr, "%s\n", error.c_str());
+      return;
+    }
+    result_->network_link.name.set(name_);
+  }
+
+  printf("Finished extension %s\n", name_.c_str());
+  result_->success = true;
+}
+
+// Warps every image extension in a multi-extension FITS file that has its
+// own WCS and writes a single KML document (or regionated hierarchy) for the
+// whole file.  All headers are read in one pass and shared by the tasks.
+// Since wcstools can't parse headers from several threads at once, every
+// WcsProjection is created up front.
+int WarpAllExtensions(void) {
+  printf("Reading headers from FITS file %s...\n", FLAGS_fitsfile.c_str());
+  vector<long> offsets;
+  vector<string> headers;
+  Fits::FindImageHdus(FLAGS_fitsfile, &offsets, &headers);
+
+  vector<int> indexes;
+  vector<WcsProjection *> projections;
+  for (int i = 0; i < static_cast<int>(headers.size()); ++i) {
+    string image_header = headers[i];
+    if (FitsCompression::IsCompressedImage(headers[i])) {
+      FitsCompression::ConvertHeader(headers[i], &image_header);
+    }
+
+    string problem;
+    if (!WcsProjection::HeaderHasWcs(image_header, &problem)) {
+      printf("Skipping image %d: %s\n", i + 1, problem.c_str());
+      continue;
+    }
+    indexes.push_back(i);
+    projections.push_back(WcsProjection::FromHeader(image_header));
+  }
+
+  if (projections.empty()) {
+    fprintf(stderr, "No images with a WCS found in '%s'\n",
+            FLAGS_fitsfile.c_str());
+    exit(EXIT_FAILURE);
+  }
+  printf("Warping %d images...\n", static_cast<int>(projections.size()));
+
+  // The regionated output directory is shared, so create it before any of
+  // the tasks try to.
+  if (FLAGS_regionate &&
+      mkdir(FLAGS_regionate_dir.c_str(),
+            S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) != 0 &&
+      errno != EEXIST) {
+    fprintf(stderr, "Cannot create output directory '%s'\n",
+            FLAGS_regionate_dir.c_str());
+    exit(EXIT_FAILURE);
+  }
+
+  vector<ExtensionResult> results(projections.size());
+  {
+    ThreadPool pool(ThreadPool::DefaultNumThreads());
+    for (int k = 0; k < static_cast<int>(projections.size()); ++k) {
+      int i = indexes[k];
+      string suffix = StringPrintf("_ext%d", i + 1);
+      string name = Fits::HeaderReadKeywordString(headers[i], "EXTNAME",
+                                                  suffix.substr(1));
+      pool.Add(new WarpExtensionTask(FLAGS_fitsfile, offsets[i], headers[i],
+                                     name, suffix, projections[k],
+                                     &results[k]));
+    }
+    pool.Wait();
+  }
+
+  for (int k = 0; k < static_cast<int>(projections.size()); ++k) {
+    delete projections[k];
+  }
+
+  // Combine the overlays into a single document.
+  Kml kml;
+  int num_failed = 0;
+  for (int k = 0; k < static_cast<int>(results.size()); ++k) {
+    if (!results[k].success) {
+      ++num_failed;
+    } else if (FLAGS_regionate) {
+      kml.AddNetworkLink(results[k].network_link);
+    } else {
+      kml.AddGroundOverlay(results[k].ground_overlay);
+    }
+  }
+
+  printf("Writing KML to '%s'...\n", FLAGS_kmlfile.c_str());
+  WriteKml(FLAGS_kmlfile, kml);
+
+  if (num_failed > 0) {
+    fprintf(stderr, "%d images failed\n", num_failed);
+    return EXIT_FAILURE;
+  }
+  printf("All done\n");
+  return 0;
+}
+
+// Reads, warps, and writes one plane of a data cube
+//
+// All planes share the projection and warp map, so each task only reads,
+// scales, and gathers its plane.
+class WarpPlaneTask : public Task {
+ public:
+  WarpPlaneTask(long offset, const string &hdu_header, int plane,
+                double zmin, double zmax, const SkyProjection *projection,
+                const vector<int> *warp_map, const string &outfile,
+                KmlGroundOverlay *ground_overlay, bool *success)
+      : offset_(offset), hdu_header_(hdu_header), plane_(plane),
+        zmin_(zmin), zmax_(zmax), projection_(projection),
+        warp_map_(warp_map), outfile_(outfile),
+        ground_overlay_(ground_overlay), success_(success) {
+    *success_ = false;
+  }
+
+  virtual void Run();
+
+ private:
+  long offset_;
+  string hdu_header_;
+  int plane_;
+  double zmin_;
+  double zmax_;
+  const SkyProjection *projection_;
+  const vector<int> *warp_map_;
+  string outfile_;
+  KmlGroundOverlay *ground_overlay_;
+  bool *success_;
+
+  DISALLOW_COPY_AND_ASSIGN(WarpPlaneTask);
+};
+
+void WarpPlaneTask::Run() {
+  Image image;
+  {
+    FitsImage fits_image;
+    fits_image.set_num_threads(1);
+    fits_image.set_null_transparent(FLAGS_fits_null_transparent);
+    fits_image.set_plane(plane_);
+    if (!fits_image.ReadHdu(FLAGS_fitsfile, offset_, hdu_header_)) {
+      fprintf(stderr, "Unable to read plane %d\n", plane_ + 1);
+      return;
+    }
+    fits_image.ToImage(zmin_, zmax_, &image);
+  }
+
+  // The projection is shared, so per-plane masks go in the alpha channel.
+  // Masking by color is set up on the projection instead.
+  if (FLAGS_automask && FLAGS_automask_mode != "color") {
+    ApplyAutomask(&image);
+  }
+
+  Image projected_image;
+  projection_->WarpImageWithMap(image, *warp_map_, &projected_image);
+  image.Clear();
+
+  if (!projected_image.Write(outfile_)) {
+    fprintf(stderr, "Couldn't write image to file '%s'\n", outfile_.c_str());
+    return;
+  }
+
+  CreateGroundOverlay(outfile_, StringPrintf("%s %d",
+                                             FLAGS_ground_overlay_name.c_str(),
+                                             plane_ + 1),
+                      projection_->bounding_box(), ground_overlay_);
+  *success_ = true;
+}
+
+// Warps every plane of a data cube and writes a KML document with one
+// GroundOverlay per plane, each with a TimeSpan lasting until the next
+// plane so that Earth can animate them.  The WCS is inverted once for the
+// whole cube and the map is reused for every plane.  Every plane is scaled
+// with the percentile cut of the first one so that brightness is
+// consistent across frames.
+int WarpTimeSeries(void) {
+  printf("Reading header from FITS file %s...\n", FLAGS_fitsfile.c_str());
+  long offset;
+  string hdu_header;
+  if (!Fits::FindImageHdu(FLAGS_fitsfile, &offset, &hdu_header)) {
+    fprintf(stderr, "No image found in FITS file '%s'\n",
+            FLAGS_fitsfile.c_str());
+    exit(EXIT_FAILURE);
+  }
+
+  string image_header = hdu_header;
+  if (FitsCompression::IsCompressedImage(hdu_header)) {
+    FitsCompression::ConvertHeader(hdu_header, &image_header);
+  }
+  int num_planes = FitsImage::NumPlanes(image_header);
+  printf("Image has %d planes\n", num_planes);
+
+  // Times from the flags take precedence over the header.
+  vector<double> mjds;
+  if (!FLAGS_time_series_start.empty()) {
+    double start;
+    if (!FitsTime::DateTimeToMjd(FLAGS_time_series_start, &start) ||
+        FLAGS_time_series_step <= 0.0) {
+      fprintf(stderr, "--time_series_start must be YYYY-MM-DDThh:mm:ss and "
+                      "--time_series_step must be positive\n");
+      exit(EXIT_FAILURE);
+    }
+    for (int k = 0; k <= num_planes; ++k) {
+      mjds.push_back(start + k * FLAGS_time_series_step / 86400.0);
+    }
+  } else if (FitsTime::GetPlaneTimes(image_header, num_planes + 1, &mjds)) {
+    if (num_planes > 1 && mjds[1] <= mjds[0]) {
+      fprintf(stderr, "Plane times must increase along the third axis\n");
+      exit(EXIT_FAILURE);
+    }
+  } else {
+    fprintf(stderr, "The header has no time axis, so use "
+                    "--time_series_start and --time_series_step\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // The first plane sets the scaling and the projection.
+  Image first_image;
+  double zmin, zmax;
+  {
+    FitsImage fits_image;
+    fits_image.set_null_transparent(FLAGS_fits_null_transparent);
+    if (!fits_image.ReadHdu(FLAGS_fitsfile, offset, hdu_header)) {
+      fprintf(stderr, "Unable to read image from FITS file '%s'\n",
+              FLAGS_fitsfile.c_str());
+      exit(EXIT_FAILURE);
+    }
+    fits_image.GetPercentileRange(FLAGS_fits_percentile_min,
+                                  FLAGS_fits_percentile_max, &zmin, &zmax);
+    fits_image.ToImage(zmin, zmax, &first_image);
+  }
+  printf("Scaling FITS values from %g to %g\n", zmin, zmax);
+
+  WcsProjection wcs(FLAGS_fitsfile, first_image.width(),
+                    first_image.height());
+  Color bg_color(4);
+  bg_color.SetAllChannels(0);
+  SkyProjection projection(first_image, wcs);
+  projection.SetBackgroundColor(bg_color);
+  if (FLAGS_input_image_origin_is_upper_left) {
+    projection.set_input_image_origin(SkyProjection::UPPER_LEFT);
+  } else {
+    projection.set_input_image_origin(SkyProjection::LOWER_LEFT);
+  }
+  if (FLAGS_output_width > 0 && FLAGS_output_height > 0) {
+    projection.SetProjectedSize(FLAGS_output_width, FLAGS_output_height);
+  }
+  if (FLAGS_copy_input_size) {
+    projection.SetProjectedSize(first_image.width(), first_image.height());
+  }
+  projection.SetMaxSideLength(FLAGS_max_side_length);
+  printf("Projected image size will be %d x %d\n",
+         projection.projected_width(), projection.projected_height());
+  if (FLAGS_automask && FLAGS_automask_mode == "color") {
+    Color mask_out_color(4);
+    GetAutomaskColor(&mask_out_color);
+    projection.SetMaskColor(mask_out_color);
+  }
+
+  printf("Computing warp map...\n");
+  vector<int> warp_map;
+  projection.ComputeWarpMap(&warp_map);
+
+  // Planes are numbered from 1 in the output filenames, padded so that they
+  // sort in order.
+  string prefix, extension;
+  StringSplitExtension(FLAGS_outfile, &prefix, &extension);
+  int num_digits = StringPrintf("%d", num_planes).size();
+
+  printf("Warping %d planes...\n", num_planes);
+  vector<KmlGroundOverlay> ground_overlays(num_planes);
+  bool *success = new bool[num_planes];
+  {
+    ThreadPool pool(ThreadPool::DefaultNumThreads());
+    for (int k = 0; k < num_planes; ++k) {
+      string outfile = StringPrintf("%s_%0*d%s", prefix.c_str(), num_digits,
+                                    k + 1, extension.c_str());
+      pool.Add(new WarpPlaneTask(offset, hdu_header, k, zmin, zmax,
+                                 &projection, &warp_map, outfile,
+                                 &ground_overlays[k], &success[k]));
+    }
+    pool.Wait();
+  }
+
+  Kml kml;
+  int num_failed = 0;
+  for (int k = 0; k < num_planes; ++k) {
+    if (!success[k]) {
+      ++num_failed;
+      continue;
+    }
+    KmlTimeSpan time_span;
+    time_span.begin.set(FitsTime::MjdToDateTime(mjds[k]));
+    time_span.end.set(FitsTime::MjdToDateTime(mjds[k + 1]));
+    ground_overlays[k].time_span.set(time_span);
+    kml.AddGroundOverlay(ground_overlays[k]);
+  }
+  delete[] success;
+
+  printf("Writing KML to '%s'...\n", FLAGS_kmlfile.c_str());
+  WriteKml(FLAGS_kmlfile, kml);
+
+  if (num_failed > 0) {
+    fprintf(stderr, "%d planes failed\n", num_failed);
+    return EXIT_FAILURE;
+  }
+  printf("All done\n");
+  return 0;
+}
+
+// Adds a named value to a digest, with its length so that values can't run
+// together.
+void AddKeyField(const string &name, const string &value, Sha256 *sha) {
+  sha->Update(StringPrintf("%s %d\n", name.c_str(),
+                           static_cast<int>(value.size())));
+  sha->Update(value);
+}
+
+// Adds the digest of a file's contents (or an empty value if filename is
+// empty) to a digest.  Returns false if the file can't be read.
+bool AddKeyFile(const string &name, const string &filename, Sha256 *sha) {
+  if (filename.empty()) {
+    AddKeyField(name, "", sha);
+    return true;
+  }
+  Sha256 file_sha;
+  if (!file_sha.UpdateFromFile(filename)) return false;
+  AddKeyField(name, file_sha.HexDigest(), sha);
+  return true;
+}
+
+// Adds a catalog to a digest.  A catalog file (e.g. a TDC catalog) is keyed
+// on its name, size, and modification time rather than its contents, which
+// can be large; anything else is a libwcs catalog name and is keyed on the
+// name alone.
+void AddKeyCatalog(const string &name, const string &catalog, Sha256 *sha) {
+  struct stat info;
+  if (stat(catalog.c_str(), &info) == 0 && S_ISREG(info.st_mode)) {
+    AddKeyField(name, StringPrintf(
+        "%s %lld %lld", catalog.c_str(),
+        static_cast<long long>(info.st_size),
+        static_cast<long long>(info.st_mtime)), sha);
+  } else {
+    AddKeyField(name, catalog, sha);
+  }
+}
+
+// Computes the --result_cache key of a job: a digest of its input files
+// (the whole FITS file, so both the WCS and the pixels) and of every option
+// that affects its outputs, including the output names that the KML refers
+// to.  A --solve_catalog file is keyed on its size and modification time
+// (see AddKeyCatalog()), not its contents.  tile_directory is where
+// --regionate writes the tiles.  Returns false if an input can't be read, in
+// which case the job shouldn't be cached.
+bool MakeResultKey(const BatchJob &job, const string &tile_directory,
+                   string *key) {
+  Sha256 sha;
+  AddKeyField("version", "wcs2kml results 1", &sha);
+  if (!AddKeyFile("fitsfile", job.fitsfile, &sha) ||
+      !AddKeyFile("imagefile", job.imagefile, &sha) ||
+      !AddKeyFile("maskfile", job.maskfile, &sha)) {
+    return false;
+  }
+  AddKeyField("outfile", job.outfile, &sha);
+  AddKeyField("kmlfile", job.kmlfile, &sha);
+  AddKeyField("name", job.name, &sha);
+  AddKeyField("tile_directory", tile_directory, &sha);
+  AddKeyField("wldfile", FLAGS_wldfile, &sha);
+  AddKeyField("geotiff", StringPrintf("%s %d", FLAGS_geotiff.c_str(),
+                                      FLAGS_geotiff_tile_size), &sha);
+  AddKeyField("automask", StringPrintf(
+      "%d %d %d %d %s %s %s %d %d %s", FLAGS_automask, FLAGS_automask_red,
+      FLAGS_automask_green, FLAGS_automask_blue, FLAGS_automask_mode.c_str(),
+      FLAGS_automask_morphology.c_str(),
+      FLAGS_automask_morphology_element.c_str(),
+      FLAGS_automask_morphology_radius, FLAGS_automask_tolerance,
+      FLAGS_automaskfile.c_str()), &sha);
+  AddKeyField("fits", StringPrintf(
+      "%lld %s %d %.17g %.17g", static_cast<long long>(FLAGS_fits_dq_bits),
+      FLAGS_fits_dq_extension.c_str(), FLAGS_fits_null_transparent,
+      FLAGS_fits_percentile_min, FLAGS_fits_percentile_max), &sha);
+  if (FLAGS_solve_wcs) {
+    AddKeyCatalog("solve_catalog", FLAGS_solve_catalog, &sha);
+    AddKeyField("solve", StringPrintf(
+        "%.17g %.17g %.17g %d", FLAGS_solve_ra, FLAGS_solve_dec,
+        FLAGS_solve_radius, FLAGS_solve_num_stars), &sha);
+  }
+  AddKeyField("projection", StringPrintf(
+      "%d %d %d %d %d", FLAGS_input_image_origin_is_upper_left,
+      FLAGS_copy_input_size, FLAGS_output_width, FLAGS_output_height,
+      FLAGS_max_side_length), &sha);
+  AddKeyField("regionate", StringPrintf(
+      "%d %s %d %d %d %d %d", FLAGS_regionate,
+      FLAGS_regionate_prefix.c_str(), FLAGS_regionate_draw_tile_borders,
+      FLAGS_regionate_min_lod_pixels, FLAGS_regionate_max_lod_pixels,
+      FLAGS_regionate_tile_size, FLAGS_regionate_top_level_draw_order), &sha);
+  *key = sha.HexDigest();
+  return true;
+}
+
+// Lists the files that a job writes, or has written: the warped image and
+// KML, or the root KML and the tiles in tile_directory with --regionate.
+void ListJobOutputs(const BatchJob &job, const string &tile_directory,
+                    vector<string> *paths) {
+  paths->clear();
+  paths->push_back(job.kmlfile);
+  if (!FLAGS_regionate) {
+    paths->push_back(job.outfile);
+    return;
+  }
+  DIR *dir = opendir(tile_directory.c_str());
+  if (dir == NULL) return;
+  string start = FLAGS_regionate_prefix + "_";
+  struct dirent *file;
+  while ((file = readdir(dir)) != NULL) {
+    string name = file->d_name;
+    if (StringStartsWith(name, start) &&
+        (StringEndsWith(name, ".png") || StringEndsWith(name, ".kml"))) {
+      paths->push_back(tile_directory + "/" + name);
+    }
+  }
+  closedir(dir);
+}
+
+// Lists the files written by a run without --batch or --daemon: those of
+// ListJobOutputs() plus the world file, GeoTIFF and automask.
+void ListMainOutputs(const BatchJob &run, vector<string> *paths) {
+  ListJobOutputs(run, FLAGS_regionate_dir, paths);
+  if (!FLAGS_wldfile.empty()) paths->push_back(FLAGS_wldfile);
+  if (!FLAGS_geotiff.empty()) paths->push_back(FLAGS_geotiff);
+  if (FLAGS_automask && FLAGS_automask_mode != "color") {
+    paths->push_back(FLAGS_automaskfile + ".png");
+  }
+}
+
+// Estimates the most memory a batch job of the given input size holds at
+// once: the RGBA input image, the floats read from the FITS file, the
+// mask, and the projected image, which can be up to twice the size of a
+// rotated input.  Regionating holds another copy of the projected image.
+int64 EstimateJobMemory(const BatchJob &job, int width, int height) {
+  int64 num_pixels = static_cast<int64>(width) * height;
+  int64 bytes = 4 * num_pixels;
+  if (job.imagefile.empty()) bytes += 4 * num_pixels;
+  if (FLAGS_automask) {
+    bytes += num_pixels;
+  } else if (!job.maskfile.empty()) {
+    // Mask files are read a row at a time into a grayscale image, or into
+    // a BitMask for binary masks.
+    bytes += num_pixels;
+  }
+
+  int64 projected_pixels = 2 * num_pixels;
+  if (FLAGS_output_width > 0 && FLAGS_output_height > 0) {
+    projected_pixels = static_cast<int64>(FLAGS_output_width) *
+                       FLAGS_output_height;
+  }
+  projected_pixels = min(projected_pixels,
+                         static_cast<int64>(FLAGS_max_side_length) *
+                         FLAGS_max_side_length);
+  bytes += (FLAGS_regionate ? 8 : 4) * projected_pixels;
+  return bytes;
+}
+
+// Runs the jobs of --batch and --daemon: restores their outputs from
+// --result_cache when possible and otherwise warps their images with the
+// options given by the flags.
+class WarpJobRunner : public JobRunner {
+ public:
+  WarpJobRunner() {
+    // Nothing needed.
+  }
+
+  virtual ~WarpJobRunner() {
+    // Nothing needed.
+  }
+
+  virtual int64 EstimateMemory(const BatchJob &job, int width,
+                               int height) const {
+    return EstimateJobMemory(job, width, height);
+  }
+
+  virtual bool Run(const BatchJob &job, const WcsProjection &wcs, int width,
+                   int height, string *error);
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(WarpJobRunner);
+};
+
+// Reads the image of a job from its PNG file, or from its FITS file scaled
+// with --fits_percentile_min and --fits_percentile_max, and checks that it
+// is width x height.  Returns false with a description of the problem in
+// error on failure.
+bool ReadJobImage(const BatchJob &job, int width, int height, Image *image,
+                  string *error) {
+  if (!job.imagefile.empty()) {
+    if (!image->Read(job.imagefile)) {
+      *error = "Unable to read image file " + job.imagefile;
+      return false;
+    }
+  } else {
+    FitsImage fits_image;
+    fits_image.set_num_threads(1);
+    fits_image.set_null_transparent(FLAGS_fits_null_transparent);
+    if (!fits_image.Read(job.fitsfile)) {
+      *error = "Unable to read image from FITS file " + job.fitsfile;
+      return false;
+    }
+    double zmin, zmax;
+    fits_image.GetPercentileRange(FLAGS_fits_percentile_min,
+                                  FLAGS_fits_percentile_max, &zmin, &zmax);
+    fits_image.ToImage(zmin, zmax, image);
+  }
+  if (image->width() != width || image->height() != height) {
+    *error = StringPrintf("Image is %d x %d but FITS header says %d x %d",
+                          image->width(), image->height(), width, height);
+    return false;
+  }
+  return true;
+}
+
+// Warps the image of a job and writes its outputs.  Returns false with a
+// description of the problem in error on failure.
+bool WarpJob(const BatchJob &job, const WcsProjection &wcs, int width,
+             int height, string *error) {
+  Image image;
+  if (!ReadJobImage(job, width, height, &image, error)) {
+    return false;
+  }
+
+  Color bg_color(4);
+  bg_color.SetAllChannels(0);
+  SkyProjection projection(image, wcs);
+  projection.SetBackgroundColor(bg_color);
+  if (FLAGS_input_image_origin_is_upper_left) {
+    projection.set_input_image_origin(SkyProjection::UPPER_LEFT);
+  } else {
+    projection.set_input_image_origin(SkyProjection::LOWER_LEFT);
+  }
+  if (FLAGS_output_width > 0 && FLAGS_output_height > 0) {
+    projection.SetProjectedSize(FLAGS_output_width, FLAGS_output_height);
+  }
+  if (FLAGS_copy_input_size) {
+    projection.SetProjectedSize(image.width(), image.height());
+  }
+  projection.SetMaxSideLength(FLAGS_max_side_length);
+
+  BitMask bitmask;
+  Image mask;
+  if (FLAGS_automask) {
+    SetUpAutomask(image, &bitmask, &projection);
+  } else if (!job.maskfile.empty()) {
+    if (!SetUpMaskFile(job.maskfile, image.width(), image.height(),
+                       &bitmask, &mask, &projection, error)) {
+      return false;
+    }
+  }
+
+  Image projected_image;
+  projection.WarpImage(&projected_image);
+  image.Clear();
+
+  if (!FLAGS_regionate) {
+    if (!projected_image.Write(job.outfile)) {
+      *error = "Couldn't write image to file " + job.outfile;
+      return false;
+    }
+    string kml_string;
+    projection.CreateKmlGroundOverlay(job.outfile, job.name, &kml_string);
+    FILE *fp = fopen(job.kmlfile.c_str(), "w");
+    if (!fp) {
+      *error = "Couldn't open file " + job.kmlfile + " for writing";
+      return false;
+    }
+    fprintf(fp, "%s", kml_string.c_str());
+    fclose(fp);
+  } else {
+    // Each job regionates into its own directory named after --outfile.
+    string directory = JobTileDirectory(job);
+    if (mkdir(directory.c_str(),
+              S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) != 0 &&
+        errno != EEXIST) {
+      *error = "Cannot create output directory " + directory;
+      return false;
+    }
+    Regionator regionator(projected_image, projection.bounding_box());
+    regionator.SetMaxTileSideLength(FLAGS_regionate_tile_size);
+    regionator.set_filename_prefix(FLAGS_regionate_prefix);
+    regionator.set_output_directory(directory);
+    regionator.set_root_kml(job.kmlfile);
+    regionator.set_min_lod_pixels(FLAGS_regionate_min_lod_pixels);
+    regionator.set_max_lod_pixels(FLAGS_regionate_max_lod_pixels);
+    regionator.set_top_level_draw_order(FLAGS_regionate_top_level_draw_order);
+    regionator.set_draw_tile_borders(FLAGS_regionate_draw_tile_borders);
+    if (!regionator.Regionate(error)) return false;
+  }
+  return true;
+}
+
+bool WarpJobRunner::Run(const BatchJob &job, const WcsProjection &wcs,
+                        int width, int height, string *error) {
+  string key;
+  string tile_directory = JobTileDirectory(job);
+  if (result_cache != NULL && MakeResultKey(job, tile_directory, &key) &&
+      result_cache->Restore(key)) {
+    return true;
+  }
+
+  // Outputs are replaced so that files shared with the cache stay intact.
+  vector<string> outputs;
+  if (!key.empty()) {
+    ListJobOutputs(job, tile_directory, &outputs);
+    ResultCache::RemoveFiles(outputs);
+  }
+  if (!WarpJob(job, wcs, width, height, error)) return false;
+  if (!key.empty()) {
+    ListJobOutputs(job, tile_directory, &outputs);
+    result_cache->Store(key, outputs);
+  }
+  return true;
+}
+
+// Prints the progress of --batch jobs and records the ones that failed.
+class BatchReporter : public JobObserver {
+ public:
+  BatchReporter() : failures_() {
+    pthread_mutex_init(&mutex_, NULL);
+  }
+
+  virtual ~BatchReporter() {
+    pthread_mutex_destroy(&mutex_);
+  }
+
+  virtual void JobQueued(const BatchJob &job) {
+    // Nothing needed.
+  }
+
+  virtual void JobStarted(const BatchJob &job) {
+    // Nothing needed.
+  }
+
+  virtual void JobFinished(const BatchJob &job, const string &error) {
+    pthread_mutex_lock(&mutex_);
+    if (error.empty()) {
+      printf("Finished job on line %d\n", job.line);
+    } else {
+      printf("Failed job on line %d: %s\n", job.line, error.c_str());
+      failures_[job.line] = error;
+    }
+    pthread_mutex_unlock(&mutex_);
+  }
+
+  // Returns the errors of the failed jobs keyed by manifest line.  Only
+  // call this once the jobs are done.
+  const map<int, string> &failures(void) const {
+    return failures_;
+  }
+
+ private:
+  map<int, string> failures_;
+
+  // Guards failures_ and keeps lines of output whole.
+  pthread_mutex_t mutex_;
+
+  DISALLOW_COPY_AND_ASSIGN(BatchReporter);
+};
+
+// Returns the memory budget of --batch and --daemon jobs in bytes.
+int64 BatchMemoryLimit(void) {
+  if (FLAGS_batch_memory_mb > 0) {
+    return FLAGS_batch_memory_mb * (static_cast<int64>(1) << 20);
+  }
+  return MemoryBudget::DefaultLimit();
+}
+
+// Runs every job in the --batch manifest with a BatchScheduler, whose
+// memory budget is --batch_memory_mb.  Failed jobs, including bad lines of
+// the manifest, are reported at the end and don't stop the other jobs.
+int RunBatch(void) {
+  vector<BatchJob> jobs;
+  string error;
+  if (!ReadManifest(FLAGS_batch, &jobs, &error)) {
+    fprintf(stderr, "%s\n", error.c_str());
+    return EXIT_FAILURE;
+  }
+
+  int64 limit = BatchMemoryLimit();
+  printf("Running %d jobs using up to %d MB...\n",
+         static_cast<int>(jobs.size()), static_cast<int>(limit >> 20));
+
+  BatchReporter reporter;
+  WarpJobRunner runner;
+  {
+    BatchScheduler scheduler(&runner, ThreadPool::DefaultNumThreads(), limit,
+                             NULL);
+    for (size_t i = 0; i < jobs.size(); ++i) {
+      scheduler.Add(jobs[i], &reporter);
+    }
+    scheduler.Wait();
+  }
+
+  const map<int, string> &failures = reporter.failures();
+  int num_failed = 0;
+  for (size_t i = 0; i < jobs.size(); ++i) {
+    map<int, string>::const_iterator it = failures.find(jobs[i].line);
+    if (it == failures.end()) continue;
+    if (num_failed == 0) printf("Failed jobs:\n");
+    ++num_failed;
+    printf("Line %d (%s): %s\n", jobs[i].line, jobs[i].fitsfile.c_str(),
+           it->second.c_str());
+  }
+  printf("%d of %d jobs succeeded\n",
+         static_cast<int>(jobs.size()) - num_failed,
+         static_cast<int>(jobs.size()));
+  return num_failed == 0 ? 0 : EXIT_FAILURE;
+}
+
+// Makes the pixels that mask leaves out transparent, keeping any alpha the
+// other pixels already have.
+void ClearMaskedPixels(const BitMask &mask, Image *image) {
+  for (int j = 0; j < image->height(); ++j) {
+    uint8 *row = image->GetMutableRow(j);
+    for (int i = 0; i < image->width(); ++i) {
+      if (!mask.Get(i, j)) row[4 * i + 3] = 0;
+    }
+  }
+}
+
+// Reads the images of --mosaic jobs with their masks (the job's maskfile or
+// --automask) applied to the alpha channel, since the mosaic samples each
+// image many times over.
+class JobImageReader : public MosaicImageReader {
+ public:
+  JobImageReader() : jobs_(), widths_(), heights_() {}
+
+  virtual ~JobImageReader() {
+    // Nothing needed.
+  }
+
+  // Adds a job whose image is width x height.
+  void AddJob(const BatchJob &job, int width, int height) {
+    jobs_.push_back(job);
+    widths_.push_back(width);
+    heights_.push_back(height);
+  }
+
+  virtual bool ReadImage(int index, Image *image, string *error) {
+    const BatchJob &job = jobs_[index];
+    if (!ReadJobImage(job, widths_[index], heights_[index], image, error)) {
+      return false;
+    }
+
+    BitMask bitmask;
+    if (FLAGS_automask && FLAGS_automask_mode == "color") {
+      Color mask_out_color(4);
+      GetAutomaskColor(&mask_out_color);
+      Color pixel(4);
+      for (int j = 0; j < image->height(); ++j) {
+        for (int i = 0; i < image->width(); ++i) {
+          image->GetPixel(i, j, &pixel);
+          if (pixel.EqualsIgnoringAlpha(mask_out_color)) {
+            image->SetValue(i, j, 3, 0);
+          }
+        }
+      }
+    } else if (FLAGS_automask) {
+      Image mask;
+      CreateAutomask(*image, &mask);
+      bitmask.FromImage(mask);
+      ClearMaskedPixels(bitmask, image);
+    } else if (!job.maskfile.empty()) {
+      if (!ReadMaskIntoAlpha(job.maskfile, image, error)) return false;
+    }
+    return true;
+  }
+
+ private:
+  vector<BatchJob> jobs_;
+  vector<int> widths_;
+  vector<int> heights_;
+
+  DISALLOW_COPY_AND_ASSIGN(JobImageReader);
+};
+
+// Adds the images of a manifest to a mosaic, and to hips unless it is
+// NULL.  Returns false after printing the problem if a line can't be read.
+bool AddMosaicImages(const string &manifest, JobImageReader *reader,
+                     Mosaic *mosaic, Hips *hips) {
+  vector<BatchJob> jobs;
+  string error;
+  if (!ReadManifest(manifest, &jobs, &error)) {
+    fprintf(stderr, "%s\n", error.c_str());
+    return false;
+  }
+  for (size_t i = 0; i < jobs.size(); ++i) {
+    string header;
+    int width, height;
+    if (!ReadJobHeader(jobs[i], &header, &width, &height, &error)) {
+      fprintf(stderr, "%s line %d (%s): %s\n", manifest.c_str(),
+              jobs[i].line, jobs[i].fitsfile.c_str(), error.c_str());
+      return false;
+    }
+    reader->AddJob(jobs[i], width, height);
+    mosaic->AddImage(WcsProjection::FromHeader(header), width, height);
+    if (hips != NULL) {
+      hips->AddImage(WcsProjection::FromHeader(header), width, height);
+    }
+  }
+  return true;
+}
+
+// Writes the tiles.json of the --xyz_dir pyramid that a mosaic with tiles of
+// tile_size pixels and finest level zoom places its tiles in.
+bool WriteMosaicXyzManifest(int tile_size, int zoom, string *error) {
+  XyzPyramid pyramid;
+  pyramid.set_tile_size(tile_size);
+  pyramid.set_max_zoom(zoom);
+  pyramid.set_output_directory(FLAGS_xyz_dir);
+  pyramid.set_name(FLAGS_mosaic);
+  return pyramid.WriteManifest(error);
+}
+
+// Warps every image in the --mosaic manifest onto one global tile pyramid
+// written to --regionate_dir with the root KML in --kmlfile.  Unlike
+// --batch, a bad image stops the run, since the mosaic would be missing it.
+// With --mosaic_insert, the pyramid was already built from --mosaic and
+// only the tiles touched by the new images are updated.
+int RunMosaic(void) {
+  JobImageReader reader;
+  Mosaic mosaic(&reader);
+  Hips hips(&reader);
+  if (!AddMosaicImages(FLAGS_mosaic, &reader, &mosaic,
+                       FLAGS_hips_dir.empty() ? NULL : &hips)) {
+    return EXIT_FAILURE;
+  }
+  if (mosaic.num_images() == 0) {
+    fprintf(stderr, "No images in manifest '%s'\n", FLAGS_mosaic.c_str());
+    return EXIT_FAILURE;
+  }
+
+  // The level comes from the images the pyramid was first built from.
+  int level = FLAGS_mosaic_level;
+  if (level < 0) level = mosaic.FindNativeLevel();
+  mosaic.set_max_level(level);
+  int first_new_image = mosaic.num_images();
+  if (!FLAGS_mosaic_insert.empty() &&
+      !AddMosaicImages(FLAGS_mosaic_insert, &reader, &mosaic, NULL)) {
+    return EXIT_FAILURE;
+  }
+  mosaic.set_tile_size(FLAGS_regionate_tile_size);
+  if (FLAGS_mosaic_combine == "mean") {
+    mosaic.set_combine(Mosaic::MEAN);
+  } else if (FLAGS_mosaic_combine == "median") {
+    mosaic.set_combine(Mosaic::MEDIAN);
+  } else if (FLAGS_mosaic_combine == "sigma_clip") {
+    mosaic.set_combine(Mosaic::SIGMA_CLIP);
+  }
+  mosaic.set_clip_sigma(FLAGS_mosaic_clip_sigma);
+  mosaic.set_clip_iterations(FLAGS_mosaic_clip_iterations);
+  if (FLAGS_input_image_origin_is_upper_left) {
+    mosaic.set_image_origin(SkyProjection::UPPER_LEFT);
+  }
+  if (FLAGS_mosaic_memory_mb > 0) {
+    mosaic.set_cache_bytes(FLAGS_mosaic_memory_mb *
+                           (static_cast<int64>(1) << 20));
+  }
+  mosaic.set_filename_prefix(FLAGS_regionate_prefix);
+  mosaic.set_output_directory(FLAGS_regionate_dir);
+  mosaic.set_root_kml(FLAGS_kmlfile);
+  mosaic.set_min_lod_pixels(FLAGS_regionate_min_lod_pixels);
+  mosaic.set_max_lod_pixels(FLAGS_regionate_max_lod_pixels);
+  mosaic.set_top_level_draw_order(FLAGS_regionate_top_level_draw_order);
+  mosaic.set_draw_tile_borders(FLAGS_regionate_draw_tile_borders);
+  mosaic.set_xyz_directory(FLAGS_xyz_dir);
+
+  string error;
+  if (!FLAGS_mosaic_insert.empty()) {
+    printf("Inserting %d images into the level %d tiles in %s...\n",
+           mosaic.num_images() - first_new_image, level,
+           FLAGS_regionate_dir.c_str());
+    if (!mosaic.Insert(first_new_image, &error) ||
+        (!FLAGS_xyz_dir.empty() &&
+         !WriteMosaicXyzManifest(mosaic.tile_size(), level, &error))) {
+      fprintf(stderr, "%s\n", error.c_str());
+      return EXIT_FAILURE;
+    }
+    printf("All done\n");
+    return 0;
+  }
+
+  printf("Warping %d images onto level %d tiles in %s...\n",
+         mosaic.num_images(), level, FLAGS_regionate_dir.c_str());
+  if (!mosaic.Build(&error)) {
+    fprintf(stderr, "%s\n", error.c_str());
+    return EXIT_FAILURE;
+  }
+  printf("Writing root KML to %s\n", FLAGS_kmlfile.c_str());
+  if (!FLAGS_xyz_dir.empty()) {
+    printf("Linked the tiles into XYZ pyramid %s\n", FLAGS_xyz_dir.c_str());
+    if (!WriteMosaicXyzManifest(mosaic.tile_size(), level, &error)) {
+      fprintf(stderr, "%s\n", error.c_str());
+      return EXIT_FAILURE;
+    }
+  }
 
-#include <string>
+  if (!FLAGS_hips_dir.empty()) {
+    hips.set_tile_width(FLAGS_hips_tile_width);
+    int order = FLAGS_hips_order;
+    if (order < 0) order = hips.FindNativeOrder();
+    hips.set_max_order(order);
+    if (FLAGS_input_image_origin_is_upper_left) {
+      hips.set_image_origin(SkyProjection::UPPER_LEFT);
+    }
+    hips.set_cache_bytes(mosaic.cache_bytes());
+    hips.set_output_directory(FLAGS_hips_dir);
+    hips.set_title(FLAGS_hips_title.empty() ? FLAGS_mosaic
+                                            : FLAGS_hips_title);
+    hips.set_creator_did(FLAGS_hips_creator_did);
+    printf("Warping %d images onto order %d HiPS tiles in %s...\n",
+           hips.num_images(), order, FLAGS_hips_dir.c_str());
+    if (!hips.Build(&error)) {
+      fprintf(stderr, "%s\n", error.c_str());
+      return EXIT_FAILURE;
+    }
+  }
+  printf("All done\n");
+  return 0;
+}
 
-#include <google/gflags.h>
+// Runs as a long-lived daemon taking jobs as JSON requests, one per line,
+// from standard input (--daemon=-) or from clients of a Unix domain socket
+// (--daemon=<path>), which are served one at a time.  The thread pool,
+// memory budget, and recently read headers are kept between jobs, so a
+// request is dispatched without paying for process startup.
+int RunDaemon(void) {
+  // Responses go to a closed client rather than killing the daemon.
+  signal(SIGPIPE, SIG_IGN);
 
-#include "base.h"
-#include "boundingbox.h"
-#include "color.h"
-#include "mask.h"
-#include "image.h"
-#include "regionator.h"
-#include "skyprojection.h"
-#include "wcsprojection.h"
-#include "wraparound.h"
+  WarpJobRunner runner;
+  HeaderCache cache;
+  BatchScheduler scheduler(&runner, ThreadPool::DefaultNumThreads(),
+                           BatchMemoryLimit(), &cache);
 
-// Commandline flags.
-DEFINE_bool(automask, false, "automatically create a mask");
-DEFINE_int32(automask_red, 0, "red channel to mask out with automasking");
-DEFINE_int32(automask_green, 0, "green channel to mask out with automasking");
-DEFINE_int32(automask_blue, 0, "blue channel to mask out with automasking");
-DEFINE_string(automaskfile, "auto_generated_mask",
-              "prefix name of auto-generated mask");
-DEFINE_bool(copy_input_size, false,
-            "set output image size to be identical to the input image?");
-DEFINE_string(fitsfile, "", "name of input FITS file containing WCS");
-DEFINE_string(ground_overlay_name, "Your registered image",
-              "name of <GroundOverlay> element in KML");
-DEFINE_string(imagefile, "", "name of input image (PNG format)");
-DEFINE_bool(input_image_origin_is_upper_left, false,
-            "flip the input image about y axis?");
-DEFINE_string(kmlfile, "doc.kml", "name of output KML file");
-DEFINE_string(maskfile, "", "name of input mask image (PNG format)");
-DEFINE_int32(max_side_length, 10000, "maximum output side length");
-DEFINE_string(outfile, "warped_image.png", "name out output file");
-DEFINE_int32(output_height, -1, "output height of projected image");
-DEFINE_int32(output_width, -1, "output width of projected image");
-DEFINE_bool(regionate, false,
-            "subdivide output image into a hierarchy of tiles?");
-DEFINE_string(regionate_dir, "tiles",
-              "directory to output regionated tiles into");
-DEFINE_string(regionate_prefix, "tile", "filename prefix of regionated tiles");
-DEFINE_bool(regionate_draw_tile_borders, false,
-            "draw borders for each regionated tile?");
-DEFINE_int32(regionate_min_lod_pixels, 128,
-             "value of minLodPixels to use in the region for each tile");
-DEFINE_int32(regionate_max_lod_pixels, -1,
-             "value of maxLodPixels to use in the region for each tile");
-DEFINE_int32(regionate_tile_size, 256, "pixel size of regionated tiles");
-DEFINE_int32(regionate_top_level_draw_order, 0,
-             "<drawOrder> value of the top level tile");
-DEFINE_string(wldfile, "", "name of output WLD file (not written by default)");
+  if (FLAGS_daemon == "-") {
+    // Responses get their own copy of standard output, and anything else
+    // printed goes to standard error so it can't corrupt them.
+    fflush(stdout);
+    int fd = dup(STDOUT_FILENO);
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+    DaemonResponder responder(fd, FLAGS_regionate);
+    ServeDaemonRequests(stdin, &responder, &scheduler);
+    close(fd);
+    return 0;
+  }
 
-namespace google_sky {
+  string error;
+  int listen_fd = ListenOnSocket(FLAGS_daemon, &error);
+  if (listen_fd < 0) {
+    fprintf(stderr, "%s\n", error.c_str());
+    return EXIT_FAILURE;
+  }
+  printf("Listening on %s\n", FLAGS_daemon.c_str());
+  fflush(stdout);
+  bool shut_down = ServeDaemonClients(listen_fd, FLAGS_regionate, &scheduler,
+                                      &error);
+  if (!shut_down) fprintf(stderr, "%s\n", error.c_str());
+  close(listen_fd);
+  unlink(FLAGS_daemon.c_str());
+  return shut_down ? 0 : EXIT_FAILURE;
+}
 
-// Writes a KML GroundOverlay describing this image on the sky.
-void WriteKmlBox(const string &kmlfile, const string &imagefile,
-                 const string &ground_overlay_name,
-                 const SkyProjection &projection) {
-  string kml_string;
-  projection.CreateKmlGroundOverlay(imagefile, ground_overlay_name,
-                                    &kml_string);
+// Regionates the sources of --catalog into a hierarchy of Placemarks
+// written to --regionate_dir with the root KML in --kmlfile.  FITS tables
+// are recognized by their extension and anything else is read as CSV.
+int RunCatalog(void) {
+  FitsCatalogReader fits_reader;
+  CsvCatalogReader csv_reader;
+  bool is_fits = StringEndsWith(FLAGS_catalog, ".fits") ||
+                 StringEndsWith(FLAGS_catalog, ".fits.gz") ||
+                 StringEndsWith(FLAGS_catalog, ".fit") ||
+                 StringEndsWith(FLAGS_catalog, ".fts");
+  CatalogReader *reader = &csv_reader;
+  if (is_fits) reader = &fits_reader;
+  reader->set_ra_column(FLAGS_catalog_ra_column);
+  reader->set_dec_column(FLAGS_catalog_dec_column);
+  reader->set_name_column(FLAGS_catalog_name_column);
+  reader->set_survey_name(FLAGS_catalog_survey);
+  bool opened = is_fits ? fits_reader.Open(FLAGS_catalog)
+                        : csv_reader.Open(FLAGS_catalog);
+  if (!opened) {
+    fprintf(stderr, "%s\n", reader->error().c_str());
+    return EXIT_FAILURE;
+  }
 
-  FILE *fp = fopen(kmlfile.c_str(), "w");
-  if (!fp) {
-    fprintf(stderr, "Couldn't open file '%s' for writing\n", kmlfile.c_str());
+  CatalogRegionator regionator;
+  regionator.set_max_sources_per_node(FLAGS_catalog_max_sources_per_node);
+  regionator.set_min_lod_pixels(FLAGS_regionate_min_lod_pixels);
+  regionator.set_max_lod_pixels(FLAGS_regionate_max_lod_pixels);
+  regionator.set_output_directory(FLAGS_regionate_dir);
+  regionator.set_root_kml(FLAGS_kmlfile);
+  regionator.set_name(FLAGS_catalog_name.empty() ? FLAGS_catalog
+                                                 : FLAGS_catalog_name);
+
+  printf("Regionating %s into %s...\n", FLAGS_catalog.c_str(),
+         FLAGS_regionate_dir.c_str());
+  string error;
+  if (!regionator.Regionate(reader, &error)) {
+    fprintf(stderr, "%s\n", error.c_str());
+    return EXIT_FAILURE;
+  }
+  if (regionator.num_skipped() > 0) {
+    printf("Skipped %lld sources with invalid coordinates\n",
+           regionator.num_skipped());
+  }
+  printf("Wrote %lld sources to %d nodes with root KML %s\n",
+         regionator.num_sources(), regionator.num_nodes(),
+         FLAGS_kmlfile.c_str());
+  return 0;
+}
+
+// Fits a WCS to the stars found in fits_image, the pixels of --fitsfile for
+// a width x height image, by matching them with the stars of
+// --solve_catalog around --solve_ra, --solve_dec.  The caller takes
+// ownership of the returned projection.
+WcsProjection *SolveWcs(const FitsImage &fits_image, int width, int height) {
+  printf("Finding stars in %s...\n", FLAGS_fitsfile.c_str());
+  if (fits_image.width() != width || fits_image.height() != height) {
+    fprintf(stderr, "FITS image is %d x %d but image is %d x %d\n",
+            fits_image.width(), fits_image.height(), width, height);
     exit(EXIT_FAILURE);
   }
+  vector<ImageStar> stars;
+  string error;
+  if (!PlateSolver::FindImageStars(fits_image, &stars, &error)) {
+    fprintf(stderr, "%s\n", error.c_str());
+    exit(EXIT_FAILURE);
+  }
+  printf("Found %d stars\n", static_cast<int>(stars.size()));
 
-  fprintf(fp, "%s", kml_string.c_str());
-  fclose(fp);
-}
+  // The reference stars are read from a square around the center, which is
+  // described by a WCS of its own.
+  ReferenceCatalog catalog;
+  if (!catalog.Open(FLAGS_solve_catalog)) {
+    fprintf(stderr, "%s\n", catalog.error().c_str());
+    exit(EXIT_FAILURE);
+  }
+  const int search_size = 1000;
+  double search_scale = 2.0 * FLAGS_solve_radius / search_size;
+  double search_cd[4] = { -search_scale, 0.0, 0.0, search_scale };
+  WcsProjection *search_wcs = WcsProjection::FromHeader(
+      PlateSolver::MakeHeader(search_size, search_size,
+                              0.5 * (search_size + 1),
+                              0.5 * (search_size + 1), FLAGS_solve_ra,
+                              FLAGS_solve_dec, search_cd));
+  BoundingBox search_box(*search_wcs, search_size, search_size);
+  SkyFootprint footprint(*search_wcs, search_size, search_size, 4);
+  delete search_wcs;
+  if (!catalog.Read(search_box, footprint)) {
+    fprintf(stderr, "%s\n", catalog.error().c_str());
+    exit(EXIT_FAILURE);
+  }
+  printf("Matching against %d %s stars...\n", catalog.num_sources(),
+         catalog.title().c_str());
 
-// Writes a world file describing the bounding box.
-void WriteWorldFile(const string &wldfile,
-                    const SkyProjection &projection) {
-  string wld_string;
-  projection.CreateWorldFile(&wld_string);
+  PlateSolver solver;
+  solver.set_center(FLAGS_solve_ra, FLAGS_solve_dec);
+  solver.set_num_stars(FLAGS_solve_num_stars);
+  solver.set_num_reference_stars(2 * FLAGS_solve_num_stars);
+  if (!solver.Solve(width, height, stars, &catalog, &error)) {
+    fprintf(stderr, "%s\n", error.c_str());
+    exit(EXIT_FAILURE);
+  }
+  printf("Matched %d stars with an rms error of %.2f pixels\n",
+         solver.num_matches(), solver.rms_error());
+  printf("Image center is %.8f, %.8f at %.4f arcsec per pixel\n",
+         solver.ra(), solver.dec(), solver.pixel_scale());
+  return WcsProjection::FromHeader(solver.header());
+}
 
-  FILE *fp = fopen(wldfile.c_str(), "w");
-  if (!fp) {
-    fprintf(stderr, "Couldn't open file '%s' for writing\n", wldfile.c_str());
+// Regionates the stars of --reference_catalog within the image into a
+// hierarchy of Placemarks written to --reference_catalog_dir with the root
+// KML in --reference_catalog_kml.
+void WriteReferenceStars(const WcsProjection &wcs, int width, int height,
+                         const BoundingBox &bounding_box) {
+  ReferenceCatalog catalog;
+  if (!catalog.Open(FLAGS_reference_catalog)) {
+    fprintf(stderr, "%s\n", catalog.error().c_str());
     exit(EXIT_FAILURE);
   }
+  if (FLAGS_reference_catalog_mag_limit != 0.0) {
+    catalog.set_magnitude_limits(-100.0, FLAGS_reference_catalog_mag_limit);
+  }
+  printf("Reading %s stars within the image...\n", catalog.title().c_str());
+  SkyFootprint footprint(wcs, width, height, 16);
+  if (!catalog.Read(bounding_box, footprint)) {
+    fprintf(stderr, "%s\n", catalog.error().c_str());
+    exit(EXIT_FAILURE);
+  }
+  if (catalog.num_truncated_zones() > 0) {
+    printf("Only the first %d stars of %d zones were read\n",
+           catalog.max_sources_per_zone(), catalog.num_truncated_zones());
+  }
+  if (catalog.num_sources() == 0) {
+    printf("No %s stars within the image\n", catalog.title().c_str());
+    return;
+  }
 
-  fprintf(fp, "%s", wld_string.c_str());
-  fclose(fp);
+  CatalogRegionator regionator;
+  regionator.set_max_sources_per_node(FLAGS_catalog_max_sources_per_node);
+  regionator.set_min_lod_pixels(FLAGS_regionate_min_lod_pixels);
+  regionator.set_max_lod_pixels(FLAGS_regionate_max_lod_pixels);
+  regionator.set_output_directory(FLAGS_reference_catalog_dir);
+  regionator.set_root_kml(FLAGS_reference_catalog_kml);
+  regionator.set_name(catalog.title());
+  string error;
+  if (!regionator.Regionate(&catalog, &error)) {
+    fprintf(stderr, "%s\n", error.c_str());
+    exit(EXIT_FAILURE);
+  }
+  printf("Wrote %lld reference stars with root KML %s\n",
+         regionator.num_sources(), FLAGS_reference_catalog_kml.c_str());
 }
 
 // The real main is defined here inside of the namespace to reduce the amount
@@ -121,29 +1765,389 @@ void WriteWorldFile(const string &wldfile,
 int Main(int argc, char **argv) {
   string usage = "Usage: ";
   usage += argv[0];
-  usage += " --imagefile=<PNG image> --fitsfile=<FITS file with WCS>";
+  usage += " [--imagefile=<PNG image>] --fitsfile=<FITS file with WCS>";
+  usage += "\n       ";
+  usage += argv[0];
+  usage += " --batch=<manifest>";
+  usage += "\n       ";
+  usage += argv[0];
+  usage += " --daemon=<- or socket path>";
+  usage += "\n       ";
+  usage += argv[0];
+  usage += " --mosaic=<manifest>";
+  usage += "\n       ";
+  usage += argv[0];
+  usage += " --catalog=<FITS table or CSV file>";
   google::SetUsageMessage(usage);
   google::ParseCommandLineFlags(&argc, &argv, true);
 
-  if (FLAGS_imagefile.empty() || FLAGS_fitsfile.empty()) {
+  if (!FLAGS_catalog.empty()) {
+    if (!FLAGS_batch.empty() || !FLAGS_daemon.empty() ||
+        !FLAGS_mosaic.empty() || !FLAGS_fitsfile.empty() ||
+        !FLAGS_imagefile.empty()) {
+      fprintf(stderr, "--catalog can't be used with --batch, --daemon, "
+                      "--mosaic, --fitsfile, or --imagefile\n");
+      exit(EXIT_FAILURE);
+    }
+    if (FLAGS_catalog_max_sources_per_node <= 0) {
+      fprintf(stderr, "--catalog_max_sources_per_node must be positive\n");
+      exit(EXIT_FAILURE);
+    }
+    return RunCatalog();
+  }
+
+  int num_modes = !FLAGS_batch.empty() + !FLAGS_daemon.empty() +
+                  !FLAGS_mosaic.empty();
+  if (num_modes > 0) {
+    const char *mode = !FLAGS_batch.empty() ? "--batch" :
+                       !FLAGS_daemon.empty() ? "--daemon" : "--mosaic";
+    const char *source = FLAGS_daemon.empty() ? "manifest" : "requests";
+    if (num_modes > 1) {
+      fprintf(stderr, "Only one of --batch, --daemon, and --mosaic can be "
+                      "used\n");
+      exit(EXIT_FAILURE);
+    }
+    if (!FLAGS_fitsfile.empty() || !FLAGS_imagefile.empty() ||
+        !FLAGS_maskfile.empty() || FLAGS_all_extensions ||
+        FLAGS_time_series || !FLAGS_fits_dq_extension.empty() ||
+        !FLAGS_wldfile.empty()) {
+      fprintf(stderr, "%s takes the files for each job from the %s and "
+                      "can't be used with --fitsfile, --imagefile, "
+                      "--maskfile, --all_extensions, --time_series, "
+                      "--fits_dq_extension, or --wldfile\n", mode, source);
+      exit(EXIT_FAILURE);
+    }
+  } else if (FLAGS_fitsfile.empty()) {
     fprintf(stderr, "%s\n", usage.c_str());
     fprintf(stderr, "Type '%s --help' for list of options\n", argv[0]);
     exit(EXIT_FAILURE);
   }
 
-  // Read the image file into memory.
-  printf("Reading image %s...\n", FLAGS_imagefile.c_str());
-  Image image;
-  if (!image.Read(FLAGS_imagefile)) {
-    fprintf(stderr, "Unable to read image file '%s'\n",
-            FLAGS_imagefile.c_str());
+  if (FLAGS_automask_mode != "edges" && FLAGS_automask_mode != "flood" &&
+      FLAGS_automask_mode != "color") {
+    fprintf(stderr, "--automask_mode must be 'edges', 'flood', or 'color'\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (!FLAGS_automask_morphology.empty()) {
+    if (FLAGS_automask_morphology != "erode" &&
+        FLAGS_automask_morphology != "dilate" &&
+        FLAGS_automask_morphology != "open" &&
+        FLAGS_automask_morphology != "close") {
+      fprintf(stderr, "--automask_morphology must be 'erode', 'dilate', "
+                      "'open', or 'close'\n");
+      exit(EXIT_FAILURE);
+    }
+    if (FLAGS_automask_morphology_element != "disk" &&
+        FLAGS_automask_morphology_element != "rectangle") {
+      fprintf(stderr, "--automask_morphology_element must be 'disk' or "
+                      "'rectangle'\n");
+      exit(EXIT_FAILURE);
+    }
+    if (FLAGS_automask_morphology_radius < 0) {
+      fprintf(stderr, "--automask_morphology_radius can't be negative\n");
+      exit(EXIT_FAILURE);
+    }
+    if (FLAGS_automask_mode == "color") {
+      fprintf(stderr, "--automask_morphology needs a mask, so it can't be "
+                      "used with --automask_mode=color\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  if (!FLAGS_fits_dq_extension.empty() &&
+      (!FLAGS_imagefile.empty() || FLAGS_all_extensions ||
+       FLAGS_time_series)) {
+    fprintf(stderr, "--fits_dq_extension can't be used with --imagefile, "
+                    "--all_extensions, or --time_series\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (FLAGS_serve_port >= 0 &&
+      (num_modes > 0 || FLAGS_all_extensions || FLAGS_time_series)) {
+    fprintf(stderr, "--serve_port can't be used with --batch, --daemon, "
+                    "--mosaic, --all_extensions, or --time_series\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (!FLAGS_result_cache.empty() &&
+      (FLAGS_serve_port >= 0 || !FLAGS_mosaic.empty() ||
+       FLAGS_all_extensions || FLAGS_time_series)) {
+    fprintf(stderr, "--result_cache can't be used with --serve_port, "
+                    "--mosaic, --all_extensions, or --time_series\n");
+    exit(EXIT_FAILURE);
+  }
+  if (FLAGS_result_cache_mb < 0) {
+    fprintf(stderr, "--result_cache_mb can't be negative\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (!FLAGS_hips_dir.empty()) {
+    if (FLAGS_mosaic.empty() || !FLAGS_mosaic_insert.empty()) {
+      fprintf(stderr, "--hips_dir can only be used with --mosaic and "
+                      "without --mosaic_insert\n");
+      exit(EXIT_FAILURE);
+    }
+    if (FLAGS_hips_order > Hips::MAX_ORDER) {
+      fprintf(stderr, "--hips_order can't be more than %d\n",
+              Hips::MAX_ORDER);
+      exit(EXIT_FAILURE);
+    }
+    if (FLAGS_hips_tile_width < 2 || FLAGS_hips_tile_width > 512 ||
+        (FLAGS_hips_tile_width & (FLAGS_hips_tile_width - 1)) != 0) {
+      fprintf(stderr, "--hips_tile_width must be a power of 2 of at most "
+                      "512\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (FLAGS_polar_caps &&
+      (num_modes > 0 || FLAGS_all_extensions || FLAGS_time_series ||
+       FLAGS_serve_port >= 0 || !FLAGS_result_cache.empty())) {
+    fprintf(stderr, "--polar_caps can't be used with --batch, --daemon, "
+                    "--mosaic, --all_extensions, --time_series, "
+                    "--serve_port, or --result_cache\n");
+    exit(EXIT_FAILURE);
+  }
+  if (FLAGS_polar_cap_dec < 0.0 || FLAGS_polar_cap_dec >= 90.0) {
+    fprintf(stderr, "--polar_cap_dec must be at least 0 and less than 90\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (!FLAGS_geotiff.empty()) {
+    if (num_modes > 0 || FLAGS_all_extensions || FLAGS_time_series ||
+        FLAGS_polar_caps) {
+      fprintf(stderr, "--geotiff can't be used with --batch, --daemon, "
+                      "--mosaic, --all_extensions, --time_series, or "
+                      "--polar_caps\n");
+      exit(EXIT_FAILURE);
+    }
+    if (FLAGS_geotiff_tile_size <= 0 || FLAGS_geotiff_tile_size % 16 != 0) {
+      fprintf(stderr, "--geotiff_tile_size must be a positive multiple of "
+                      "16\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  if (FLAGS_solve_wcs) {
+    if (num_modes > 0 || FLAGS_all_extensions || FLAGS_time_series) {
+      fprintf(stderr, "--solve_wcs can't be used with --batch, --daemon, "
+                      "--mosaic, --all_extensions, or --time_series\n");
+      exit(EXIT_FAILURE);
+    }
+    if (FLAGS_solve_catalog.empty()) {
+      fprintf(stderr, "--solve_wcs needs --solve_catalog\n");
+      exit(EXIT_FAILURE);
+    }
+    if (FLAGS_solve_ra < 0.0 || FLAGS_solve_ra >= 360.0 ||
+        FLAGS_solve_dec < -90.0 || FLAGS_solve_dec > 90.0) {
+      fprintf(stderr, "--solve_wcs needs --solve_ra from 0 to 360 and "
+                      "--solve_dec from -90 to 90\n");
+      exit(EXIT_FAILURE);
+    }
+    if (FLAGS_solve_radius <= 0.0 || FLAGS_solve_radius > 10.0) {
+      fprintf(stderr, "--solve_radius must be positive and at most 10\n");
+      exit(EXIT_FAILURE);
+    }
+    if (FLAGS_solve_num_stars < 3) {
+      fprintf(stderr, "--solve_num_stars must be at least 3\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  if (!FLAGS_reference_catalog.empty()) {
+    if (num_modes > 0 || FLAGS_all_extensions || FLAGS_time_series ||
+        !FLAGS_result_cache.empty()) {
+      fprintf(stderr, "--reference_catalog can't be used with --batch, "
+                      "--daemon, --mosaic, --all_extensions, --time_series, "
+                      "or --result_cache\n");
+      exit(EXIT_FAILURE);
+    }
+    if (FLAGS_catalog_max_sources_per_node <= 0) {
+      fprintf(stderr, "--catalog_max_sources_per_node must be positive\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  if (!FLAGS_xyz_dir.empty()) {
+    if ((num_modes > 0 && FLAGS_mosaic.empty()) || FLAGS_all_extensions ||
+        FLAGS_time_series || FLAGS_polar_caps ||
+        !FLAGS_result_cache.empty()) {
+      fprintf(stderr, "--xyz_dir can't be used with --batch, --daemon, "
+                      "--all_extensions, --time_series, --polar_caps, or "
+                      "--result_cache\n");
+      exit(EXIT_FAILURE);
+    }
+    if (FLAGS_xyz_max_zoom > XyzPyramid::MAX_ZOOM) {
+      fprintf(stderr, "--xyz_max_zoom can't be more than %d\n",
+              XyzPyramid::MAX_ZOOM);
+      exit(EXIT_FAILURE);
+    }
+    int tile_size = FLAGS_mosaic.empty() ? FLAGS_xyz_tile_size
+                                         : FLAGS_regionate_tile_size;
+    if (tile_size != 256 && tile_size != 512) {
+      fprintf(stderr, "--xyz_dir needs tiles of 256 or 512 pixels, set "
+                      "with --xyz_tile_size (or --regionate_tile_size for "
+                      "--mosaic)\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  if (!FLAGS_mosaic_insert.empty() && FLAGS_mosaic.empty()) {
+    fprintf(stderr, "--mosaic_insert needs the --mosaic manifest the "
+                    "pyramid was built from\n");
     exit(EXIT_FAILURE);
   }
+  if (!FLAGS_mosaic.empty()) {
+    if (FLAGS_mosaic_level > Mosaic::MAX_LEVEL) {
+      fprintf(stderr, "--mosaic_level can't be more than %d\n",
+              Mosaic::MAX_LEVEL);
+      exit(EXIT_FAILURE);
+    }
+    if (FLAGS_regionate_tile_size < 2 || FLAGS_regionate_tile_size > 512 ||
+        FLAGS_regionate_tile_size % 2 != 0) {
+      fprintf(stderr, "--mosaic needs an even --regionate_tile_size of at "
+                      "most 512\n");
+      exit(EXIT_FAILURE);
+    }
+    if (FLAGS_mosaic_combine != "blend" && FLAGS_mosaic_combine != "mean" &&
+        FLAGS_mosaic_combine != "median" &&
+        FLAGS_mosaic_combine != "sigma_clip") {
+      fprintf(stderr, "--mosaic_combine must be 'blend', 'mean', 'median', "
+                      "or 'sigma_clip'\n");
+      exit(EXIT_FAILURE);
+    }
+    if (FLAGS_mosaic_clip_sigma <= 0.0 || FLAGS_mosaic_clip_iterations < 0) {
+      fprintf(stderr, "--mosaic_clip_sigma must be positive and "
+                      "--mosaic_clip_iterations can't be negative\n");
+      exit(EXIT_FAILURE);
+    }
+    return RunMosaic();
+  }
+
+  if (FLAGS_all_extensions) {
+    if (!FLAGS_imagefile.empty() || !FLAGS_maskfile.empty()) {
+      fprintf(stderr, "--all_extensions reads pixels from --fitsfile and "
+                      "can't be used with --imagefile or --maskfile\n");
+      exit(EXIT_FAILURE);
+    }
+    return WarpAllExtensions();
+  }
+
+  if (FLAGS_time_series) {
+    if (!FLAGS_imagefile.empty() || !FLAGS_maskfile.empty() ||
+        FLAGS_regionate) {
+      fprintf(stderr, "--time_series reads pixels from --fitsfile and "
+                      "can't be used with --imagefile, --maskfile, or "
+                      "--regionate\n");
+      exit(EXIT_FAILURE);
+    }
+    return WarpTimeSeries();
+  }
+
+  // The cache lasts until wcs2kml exits.
+  if (!FLAGS_result_cache.empty()) {
+    result_cache = new ResultCache(FLAGS_result_cache,
+                                   FLAGS_result_cache_mb *
+                                   (static_cast<int64>(1) << 20));
+  }
+
+  if (!FLAGS_batch.empty()) {
+    return RunBatch();
+  }
+
+  if (!FLAGS_daemon.empty()) {
+    return RunDaemon();
+  }
+
+  // Reuse the outputs of an identical earlier run if there was one.
+  BatchJob run;
+  run.fitsfile = FLAGS_fitsfile;
+  run.imagefile = FLAGS_imagefile;
+  run.maskfile = FLAGS_maskfile;
+  run.outfile = FLAGS_outfile;
+  run.kmlfile = FLAGS_kmlfile;
+  run.name = FLAGS_ground_overlay_name;
+  string result_key;
+  if (result_cache != NULL &&
+      MakeResultKey(run, FLAGS_regionate_dir, &result_key)) {
+    if (result_cache->Restore(result_key)) {
+      printf("Restored outputs from result cache '%s'\n",
+             FLAGS_result_cache.c_str());
+      printf("All done\n");
+      return 0;
+    }
+    vector<string> outputs;
+    ListMainOutputs(run, &outputs);
+    ResultCache::RemoveFiles(outputs);
+  }
+
+  // Read the image file into memory.  Without a PNG image the pixels are
+  // read directly from the FITS file, which may be tile-compressed, and
+  // scaled to 8 bits using a percentile cut like fits2png.py.
+  // --solve_wcs finds stars in the FITS pixels, so they are read then even
+  // with a PNG image.
+  Image image;
+  FitsImage fits_image;
+  if (!FLAGS_imagefile.empty()) {
+    printf("Reading image %s...\n", FLAGS_imagefile.c_str());
+    if (!image.Read(FLAGS_imagefile)) {
+      fprintf(stderr, "Unable to read image file '%s'\n",
+              FLAGS_imagefile.c_str());
+      exit(EXIT_FAILURE);
+    }
+    if (FLAGS_solve_wcs && !fits_image.Read(FLAGS_fitsfile)) {
+      fprintf(stderr, "Unable to read image from FITS file '%s'\n",
+              FLAGS_fitsfile.c_str());
+      exit(EXIT_FAILURE);
+    }
+  } else {
+    printf("Reading image from FITS file %s...\n", FLAGS_fitsfile.c_str());
+    fits_image.set_null_transparent(FLAGS_fits_null_transparent);
+    if (!fits_image.Read(FLAGS_fitsfile)) {
+      fprintf(stderr, "Unable to read image from FITS file '%s'\n",
+              FLAGS_fitsfile.c_str());
+      exit(EXIT_FAILURE);
+    }
+
+    // Flagged pixels become null, so they are left out of the scaling and
+    // made transparent as the image is scaled.
+    if (!FLAGS_fits_dq_extension.empty()) {
+      long dq_offset;
+      string dq_header;
+      if (!FindQualityHdu(fits_image.header(), &dq_offset, &dq_header)) {
+        fprintf(stderr, "No data quality extension '%s' in '%s'\n",
+                FLAGS_fits_dq_extension.c_str(), FLAGS_fitsfile.c_str());
+        exit(EXIT_FAILURE);
+      }
+      printf("Masking pixels flagged in extension %s\n",
+             FLAGS_fits_dq_extension.c_str());
+      if (!fits_image.ApplyQualityHdu(FLAGS_fitsfile, dq_offset, dq_header,
+                                      FLAGS_fits_dq_bits)) {
+        exit(EXIT_FAILURE);
+      }
+      fits_image.set_null_transparent(true);
+    }
+
+    double zmin, zmax;
+    fits_image.GetPercentileRange(FLAGS_fits_percentile_min,
+                                  FLAGS_fits_percentile_max, &zmin, &zmax);
+    printf("Scaling FITS values from %g to %g\n", zmin, zmax);
+    fits_image.ToImage(zmin, zmax, &image);
+  }
   printf("Input image is size %d x %d\n", image.width(), image.height());
 
-  // Read the WCS from the input FITS file.
-  printf("Reading FITS file %s...\n", FLAGS_fitsfile.c_str());
-  WcsProjection wcs(FLAGS_fitsfile, image.width(), image.height());
+  // Read the WCS from the input FITS file, or fit one to its stars.  The
+  // pixels aren't needed after that.
+  WcsProjection *wcs_owner;
+  if (FLAGS_solve_wcs) {
+    wcs_owner = SolveWcs(fits_image, image.width(), image.height());
+  } else {
+    printf("Reading FITS file %s...\n", FLAGS_fitsfile.c_str());
+    wcs_owner = new WcsProjection(FLAGS_fitsfile, image.width(),
+                                  image.height());
+  }
+  fits_image.Clear();
+  const WcsProjection &wcs = *wcs_owner;
 
   // The background color for the image is transparent so that we don't
   // black out imagery below the overlay.
@@ -186,6 +2190,11 @@ int Main(int argc, char **argv) {
   printf("Range in ra is %.8f to %.8f\n", ra_min, ra_max);
   printf("Range in dec is %.8f to %.8f\n", dec_min, dec_max);
   
+  // The stars are overlaid as Placemarks on top of the image.
+  if (!FLAGS_reference_catalog.empty()) {
+    WriteReferenceStars(wcs, image.width(), image.height(), bounding_box);
+  }
+
   // FITS files have their origin at (1, 1) in the lower left corner, while
   // most raster formats have (0, 0) in the upper left corner.  Depending on
   // how the FITS image was converted to PNG, you may have to correct for
@@ -213,49 +2222,64 @@ int Main(int argc, char **argv) {
          projection.projected_width(), projection.projected_height());
 
   // Set up the masking.
+  BitMask bitmask;
+  Image mask;
   if (FLAGS_automask) {
     printf("Using automasking for color:\n");
     printf("Red: %d\n", FLAGS_automask_red);
     printf("Green: %d\n", FLAGS_automask_green);
     printf("Blue: %d\n", FLAGS_automask_blue);
+    printf("Mode: %s\n", FLAGS_automask_mode.c_str());
 
-    // Determine the color to search for when building the mask.
-    Color mask_out_color(4);
-    mask_out_color.SetChannel(0, FLAGS_automask_red);
-    mask_out_color.SetChannel(1, FLAGS_automask_green);
-    mask_out_color.SetChannel(2, FLAGS_automask_blue);
-    mask_out_color.SetChannel(3, 255);
-
-    // NB: We are modifying the original image, but projection keeps a pointer
-    // to this image so it sees the changes too.
-    Image mask;
-    Mask::CreateMask(image, mask_out_color, &mask);
-    Mask::SetAlphaChannelFromMask(mask, &image);
-
-    printf("Writing mask to file %s.png...\n", FLAGS_automaskfile.c_str());
-    if (!mask.Write(FLAGS_automaskfile + ".png")) {
-      fprintf(stderr, "Couldn't write mask to file\n");
-      exit(EXIT_FAILURE);
+    // The mask is applied while warping rather than being copied into the
+    // alpha channel of the image.  Masking by color needs no mask image.
+    SetUpAutomask(image, &bitmask, &projection);
+    if (FLAGS_automask_mode != "color") {
+      printf("Writing mask to file %s.png...\n", FLAGS_automaskfile.c_str());
+      if (!bitmask.Write(FLAGS_automaskfile + ".png")) {
+        fprintf(stderr, "Couldn't write mask to file\n");
+        exit(EXIT_FAILURE);
+      }
     }
   } else if (!FLAGS_maskfile.empty()) {
-    // Use masking from file.
+    // Use masking from file.  The mask values become the alpha of the
+    // sampled pixels while warping, so the image itself isn't modified.
     printf("Using masking from %s\n", FLAGS_maskfile.c_str());
-
-    // The image mask will be RGBA after being read.
-    Image mask;
-    if (!mask.Read(FLAGS_maskfile)) {
-      fprintf(stderr, "Couldn't read mask file\n");
+    string error;
+    if (!SetUpMaskFile(FLAGS_maskfile, image.width(), image.height(),
+                       &bitmask, &mask, &projection, &error)) {
+      fprintf(stderr, "%s\n", error.c_str());
       exit(EXIT_FAILURE);
     }
+  }
 
-    if (!mask.ConvertToGrayscale()) {
-      fprintf(stderr, "Couldn't convert mask to grayscale\n");
+  // The tiles of an image crossing a pole are warped straight from the
+  // input image, so the huge lat-lon image of the whole cap is never made.
+  if (FLAGS_polar_caps && (bounding_box.crosses_north_pole() ||
+                           bounding_box.crosses_south_pole())) {
+    PolarCapTiler tiler(projection);
+    tiler.set_tile_size(FLAGS_regionate_tile_size);
+    tiler.set_cap_dec(FLAGS_polar_cap_dec);
+    tiler.set_output_directory(FLAGS_regionate_dir);
+    tiler.set_filename_prefix(FLAGS_regionate_prefix);
+    tiler.set_ground_overlay_name(FLAGS_ground_overlay_name);
+    vector<PolarCapTiler::Tile> tiles;
+    tiler.FindTiles(&tiles);
+    printf("Warping %d polar cap tiles (%lld pixels) into directory "
+           "'%s'...\n", static_cast<int>(tiles.size()),
+           PolarCapTiler::CountPixels(tiles), FLAGS_regionate_dir.c_str());
+    string error;
+    if (!tiler.Write(FLAGS_kmlfile, &error)) {
+      fprintf(stderr, "%s\n", error.c_str());
       exit(EXIT_FAILURE);
     }
-
-    // NB: We are modifying the original image, but projection keeps a pointer
-    // to this image so it sees the changes too.
-    Mask::SetAlphaChannelFromMask(mask, &image);
+    printf("Wrote KML to '%s'\n", FLAGS_kmlfile.c_str());
+    if (!FLAGS_wldfile.empty()) {
+      printf("No world file is written for polar cap tiles\n");
+    }
+    delete wcs_owner;
+    printf("All done\n");
+    return 0;
   }
 
   // Warp the image.  We can only warp once because the internal copy is
@@ -267,8 +2291,42 @@ int Main(int argc, char **argv) {
   // We no longer need the original image.
   image.Clear();
 
+  // The web map tiles are cut from the same warped image as the KML output.
+  if (!FLAGS_xyz_dir.empty()) {
+    XyzPyramid pyramid;
+    pyramid.set_tile_size(FLAGS_xyz_tile_size);
+    int zoom = FLAGS_xyz_max_zoom;
+    if (zoom < 0) zoom = pyramid.FindNativeZoom(projected_image, bounding_box);
+    pyramid.set_max_zoom(zoom);
+    pyramid.set_output_directory(FLAGS_xyz_dir);
+    pyramid.set_name(FLAGS_ground_overlay_name);
+    printf("Writing zoom 0 to %d XYZ tiles to '%s'...\n", zoom,
+           FLAGS_xyz_dir.c_str());
+    string error;
+    if (!pyramid.WriteImage(projected_image, bounding_box, &error) ||
+        !pyramid.WriteManifest(bounding_box, &error)) {
+      fprintf(stderr, "%s\n", error.c_str());
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  // The GeoTIFF has the same georeferencing as the world file.
+  if (!FLAGS_geotiff.empty()) {
+    printf("Writing GeoTIFF to '%s'...\n", FLAGS_geotiff.c_str());
+    double x_scale, y_scale, x_origin, y_origin;
+    projection.GetWorldTransform(&x_scale, &y_scale, &x_origin, &y_origin);
+    GeoTiffWriter writer;
+    writer.set_tile_size(FLAGS_geotiff_tile_size);
+    writer.SetWorldTransform(x_scale, y_scale, x_origin, y_origin);
+    string error;
+    if (!writer.Write(projected_image, FLAGS_geotiff, &error)) {
+      fprintf(stderr, "%s\n", error.c_str());
+      exit(EXIT_FAILURE);
+    }
+  }
+
   // Write to file.
-  if (!FLAGS_regionate) {
+  if (!FLAGS_regionate && FLAGS_serve_port < 0) {
     // Write a single warped file and accompanying KML.
     printf("Writing warped image to '%s'...\n", FLAGS_outfile.c_str());
     if (!projected_image.Write(FLAGS_outfile)) {
@@ -282,10 +2340,13 @@ int Main(int argc, char **argv) {
   } else {
     // Regionate output warped image into a series of tiles and KML documents
     // that loads more effciently than a single image.
-    printf("Root KML will be written to '%s'...\n",
-           FLAGS_kmlfile.c_str());
-    printf("Regionating warped image in directory '%s'...\n",
-           FLAGS_regionate_dir.c_str());
+    // With --serve_port the tiles are served rather than written.
+    if (FLAGS_serve_port < 0) {
+      printf("Root KML will be written to '%s'...\n",
+             FLAGS_kmlfile.c_str());
+      printf("Regionating warped image in directory '%s'...\n",
+             FLAGS_regionate_dir.c_str());
+    }
     Regionator regionator(projected_image, bounding_box);
     regionator.SetMaxTileSideLength(FLAGS_regionate_tile_size);
     regionator.set_filename_prefix(FLAGS_regionate_prefix);
@@ -295,7 +2356,40 @@ int Main(int argc, char **argv) {
     regionator.set_max_lod_pixels(FLAGS_regionate_max_lod_pixels);
     regionator.set_top_level_draw_order(FLAGS_regionate_top_level_draw_order);
     regionator.set_draw_tile_borders(FLAGS_regionate_draw_tile_borders);
-    regionator.Regionate();
+    if (FLAGS_serve_port < 0) {
+      string error;
+      if (!regionator.Regionate(&error)) {
+        fprintf(stderr, "%s\n", error.c_str());
+        exit(EXIT_FAILURE);
+      }
+    } else {
+      // Render tiles only when they are asked for.
+      TileServer server(regionator);
+      server.set_cache_bytes(static_cast<int64>(FLAGS_serve_cache_mb) << 20);
+      if (!FLAGS_serve_disk_cache.empty() &&
+          mkdir(FLAGS_serve_disk_cache.c_str(),
+                S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) != 0 &&
+          errno != EEXIST) {
+        fprintf(stderr, "Cannot create directory '%s'\n",
+                FLAGS_serve_disk_cache.c_str());
+        exit(EXIT_FAILURE);
+      }
+      server.set_disk_cache_directory(FLAGS_serve_disk_cache);
+      if (!server.Listen(FLAGS_serve_port)) {
+        fprintf(stderr, "Can't listen on port %d\n", FLAGS_serve_port);
+        exit(EXIT_FAILURE);
+      }
+      printf("Serving tiles at http://localhost:%d/%s until interrupted...\n",
+             server.port(), FLAGS_kmlfile.c_str());
+      fflush(stdout);
+      tile_server = &server;
+      signal(SIGINT, StopTileServer);
+      signal(SIGTERM, StopTileServer);
+      server.Serve(ThreadPool::DefaultNumThreads());
+      signal(SIGINT, SIG_DFL);
+      signal(SIGTERM, SIG_DFL);
+      tile_server = NULL;
+    }
   }
 
   // Write world file.
@@ -304,6 +2398,17 @@ int Main(int argc, char **argv) {
     WriteWorldFile(FLAGS_wldfile, projection);
   }
 
+  if (!result_key.empty()) {
+    vector<string> outputs;
+    ListMainOutputs(run, &outputs);
+    if (!result_cache->Store(result_key, outputs)) {
+      fprintf(stderr, "Couldn't store outputs in result cache '%s'\n",
+              FLAGS_result_cache.c_str());
+    }
+  }
+
+  // Nothing uses the projection past here.
+  delete wcs_owner;
   printf("All done\n");
   return 0;
 }
@@ -32,7 +32,10 @@
 #include <cstdio>
 #include <cstdlib>
 
+#include <pthread.h>
+
 #include "fits.h"
+#include "string_util.h"
 
 namespace {
 
@@ -47,6 +50,10 @@ static const int WCS_CD_KEYWORDS_LEN = 8;
 static const char *WCS_CDELT_KEYWORDS[2] = {"CDELT1", "CDELT2"};
 static const int WCS_CDELT_KEYWORDS_LEN = 2;
 
+// wcstools keeps state in static variables while parsing a header, so only
+// one thread may parse at a time.
+pthread_mutex_t parse_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 }  // namespace
 
 namespace google_sky {
@@ -56,7 +63,7 @@ namespace google_sky {
 WcsProjection::WcsProjection(const string &fits_filename) {
   // Read FITS header and check for WCS.
   string header;
-  Fits::ReadHeader(fits_filename, 0, &header);
+  Fits::ReadImageHeader(fits_filename, &header);
   WcsProjection::DieIfBadWcs(header);
 
   // Check that NAXIS1 and NAXIS2 are present.
@@ -68,12 +75,7 @@ WcsProjection::WcsProjection(const string &fits_filename) {
     exit(EXIT_FAILURE);
   }
 
-  // Parse WCS.
-  wcs_ = wcsninit(header.c_str(), header.size());
-  
-  // Set output and input coordinate system to J2000.
-  wcsininit(wcs_, const_cast<char *>("J2000"));
-  wcsoutinit(wcs_, const_cast<char *>("J2000"));
+  ParseWcs(header);
 }
 
 // Similar to the 1 arg ctor, but this function will add NAXIS1 and NAXIS2
@@ -87,7 +89,7 @@ WcsProjection::WcsProjection(const string &fits_filename, int width,
 
   // Read FITS header and check for WCS.
   string header;
-  Fits::ReadHeader(fits_filename, 0, &header);
+  Fits::ReadImageHeader(fits_filename, &header);
   WcsProjection::DieIfBadWcs(header);
 
   // Add the image dimensions to the header if they aren't present to please
@@ -108,16 +110,52 @@ WcsProjection::WcsProjection(const string &fits_filename, int width,
     exit(EXIT_FAILURE);
   }
 
-  // Parse WCS.
+  ParseWcs(header);
+}
+
+WcsProjection::WcsProjection()
+    : wcs_(NULL) {
+  // Nothing needed.
+}
+
+WcsProjection::~WcsProjection() {
+  if (wcs_ != NULL) {
+    wcsfree(wcs_);
+  }
+}
+
+// Like the 1 arg ctor, but the header has already been read.
+WcsProjection *WcsProjection::FromHeader(const string &header) {
+  WcsProjection::DieIfBadWcs(header);
+  if (!Fits::HeaderHasKeyword(header, "NAXIS1") ||
+      !Fits::HeaderHasKeyword(header, "NAXIS2")) {
+    fprintf(stderr, "\nNAXIS1 or NAXIS2 keyword not present in header.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  WcsProjection *projection = new WcsProjection();
+  projection->ParseWcs(header);
+  return projection;
+}
+
+// The copy parses the same header again, which is the only way wcstools
+// offers to duplicate a WorldCoor.
+WcsProjection *WcsProjection::Copy() const {
+  WcsProjection *copy = new WcsProjection();
+  copy->ParseWcs(header_);
+  return copy;
+}
+
+// Parses the WCS using wcstools.
+void WcsProjection::ParseWcs(const string &header) {
+  header_ = header;
+  pthread_mutex_lock(&parse_mutex);
   wcs_ = wcsninit(header.c_str(), header.size());
 
   // Set output and input coordinate system to J2000.
   wcsininit(wcs_, const_cast<char *>("J2000"));
   wcsoutinit(wcs_, const_cast<char *>("J2000"));
-}
-
-WcsProjection::~WcsProjection() {
-  wcsfree(wcs_);
+  pthread_mutex_unlock(&parse_mutex);
 }
 
 // Checks for a variety of WCS keywords and dies if the header lacks a proper
@@ -139,11 +177,26 @@ WcsProjection::~WcsProjection() {
 // LONPOLE.  It would also be good to check for illegal values, but that's
 // a lot of work.
 void WcsProjection::DieIfBadWcs(const string &header) {
+  string problem;
+  if (!HeaderHasWcs(header, &problem)) {
+    fprintf(stderr, "%s\n", problem.c_str());
+    exit(EXIT_FAILURE);
+  }
+}
+
+// Performs the checks described above, returning a description of the first
+// problem found.
+bool WcsProjection::HeaderHasWcs(const string &header, string *problem) {
+  string unused_problem;
+  if (problem == NULL) {
+    problem = &unused_problem;
+  }
+
   // Every header must have these keywords.
   for (int i = 0; i < WCS_KEYWORDS_LEN; ++i) {
     if (!Fits::HeaderHasKeyword(header, WCS_KEYWORDS[i])) {
-      fprintf(stderr, "Missing keyword %s\n", WCS_KEYWORDS[i]);
-      exit(EXIT_FAILURE);
+      *problem = StringPrintf("Missing keyword %s", WCS_KEYWORDS[i]);
+      return false;
     }
   }
 
@@ -156,8 +209,8 @@ void WcsProjection::DieIfBadWcs(const string &header) {
   }
 
   if (!has_equinox) {
-    fprintf(stderr, "Missing equinox or epoch keyword\n");
-    exit(EXIT_FAILURE);
+    *problem = "Missing equinox or epoch keyword";
+    return false;
   }
 
   // Check if the WCS is given by a CD matrix.  All keywords must be present.
@@ -180,11 +233,24 @@ void WcsProjection::DieIfBadWcs(const string &header) {
     }
 
     if (!has_cdelt) {
-      fprintf(stderr, "Couldn't find a complete set of CD matrix or CDELT "
-                      "keywords\n");
-      exit(EXIT_FAILURE);
+      *problem = "Couldn't find a complete set of CD matrix or CDELT "
+                 "keywords";
+      return false;
     }
   }
+
+  return true;
+}
+
+WcsProjectionCopies::~WcsProjectionCopies() {
+  for (size_t k = 0; k < copies_.size(); ++k) {
+    delete copies_[k];
+  }
+}
+
+const WcsProjection &WcsProjectionCopies::Add(const WcsProjection &wcs) {
+  copies_.push_back(wcs.Copy());
+  return *copies_.back();
 }
 
 }  // namespace google_sky
@@ -33,6 +33,7 @@
 #define WCSPROJECTION_H__
 
 #include <string>
+#include <vector>
 
 #include "base.h"
 #include "wraparound.h"
@@ -90,6 +91,27 @@ class WcsProjection {
 
   ~WcsProjection();
 
+  // Returns a new WcsProjection for the WCS in the given header, which must
+  // contain NAXIS1 and NAXIS2.  This is useful for headers that have already
+  // been read, e.g. by Fits::FindImageHdus().  The caller takes ownership of
+  // the returned object.  Dies if the WCS isn't fully specified.
+  //
+  // Note that wcstools isn't thread safe when parsing headers, so headers
+  // are parsed one at a time behind a lock.  Every conversion writes its
+  // result into the wcstools structure, so an object may only be used by
+  // one thread at a time; see Copy().
+  static WcsProjection *FromHeader(const string &header);
+
+  // Returns a new WcsProjection with the same WCS, e.g. for each of several
+  // threads converting coordinates of the same image.  The caller takes
+  // ownership of the returned object.
+  WcsProjection *Copy() const;
+
+  // Returns whether the given header contains a fully specified WCS.  If
+  // not, a description of the problem is returned in problem (which may be
+  // NULL).
+  static bool HeaderHasWcs(const string &header, string *problem);
+
   // Converts the given pixel coordinates to ra, dec.  The returned ra value
   // is guaranteed to lie within 0 to 360.
   inline void ToRaDec(double px, double py, double *ra, double *dec) const {
@@ -121,9 +143,16 @@ class WcsProjection {
   // WCS structure from wcstools.
   struct WorldCoor *wcs_;
 
-  // Can only read a WCS, not create a new one.
+  // Header the WCS was parsed from, kept for Copy().
+  string header_;
+
+  // Can only read a WCS, not create a new one.  This is used by
+  // FromHeader().
   WcsProjection();
 
+  // Parses the WCS in the given header into wcs_.
+  void ParseWcs(const string &header);
+
   // Checks the input header for WCS keywords and dies if the WCS is not
   // fully specified.  This function doesn't catch every error but should
   // cover the majority of common options we will see.
@@ -132,6 +161,39 @@ class WcsProjection {
   DISALLOW_COPY_AND_ASSIGN(WcsProjection);
 };
 
+// Class that owns copies of WcsProjection objects for the lifetime of a scope
+//
+// Tasks that sample images shared with other tasks convert coordinates with
+// their own copies of the images' WCS, since conversions write into the
+// wcstools structure.
+//
+// Example usage:
+//
+// WcsProjectionCopies copies;
+// const WcsProjection &wcs = copies.Add(*shared_wcs);
+// wcs.ToPixel(ra, dec, &x, &y);
+
+class WcsProjectionCopies {
+ public:
+  WcsProjectionCopies() : copies_() {}
+
+  // Deletes the copies.
+  ~WcsProjectionCopies();
+
+  // Adds a copy of wcs and returns it.
+  const WcsProjection &Add(const WcsProjection &wcs);
+
+  // Returns the copy added k-th.
+  inline const WcsProjection &operator[](size_t k) const {
+    return *copies_[k];
+  }
+
+ private:
+  vector<WcsProjection *> copies_;
+
+  DISALLOW_COPY_AND_ASSIGN(WcsProjectionCopies);
+};
+
 }  // namespace google_sky
 
 #endif  // WCSPROJECTION_H__
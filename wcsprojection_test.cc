@@ -30,7 +30,12 @@
 #include <cmath>
 #include <cstdio>
 
+#include <string>
+#include <vector>
+
 #include "base.h"
+#include "fits.h"
+#include "string_util.h"
 #include "wcsprojection.h"
 
 // This is a downsampled SDSS frame.
@@ -39,8 +44,69 @@ static const int WIDTH = 512;
 static const int HEIGHT = 372;
 static const double TINY = 1.0e-10;
 
+// A multi-extension file with two images that have a WCS and one that
+// doesn't.
+static const char *FITS_MEF_FILENAME = "testdata/fitsimage_test_mef.fits";
+
+// A multi-extension file written by the test with the WCS of FITS_FILENAME
+// in its primary header and an image extension without a WCS.
+static const char *FITS_PRIMARY_WCS_FILENAME =
+    "/tmp/wcsprojection_test_primary_wcs.fits";
+
 namespace google_sky {
 
+// Returns a card with the given keyword and value.
+string Card(const string &keyword, const string &value) {
+  string card = StringPrintf("%-8s= %20s", keyword.c_str(), value.c_str());
+  card.resize(80, ' ');
+  return card;
+}
+
+// Pads data to a multiple of the FITS block size with the given character.
+void PadToBlock(char c, string *data) {
+  data->resize((data->size() + 2879) / 2880 * 2880, c);
+}
+
+// Writes FITS_PRIMARY_WCS_FILENAME by moving the image dimensions of the
+// header in FITS_FILENAME into an IMAGE extension.
+void WritePrimaryWcsFile() {
+  string header;
+  Fits::ReadHeader(FITS_FILENAME, 0, &header);
+
+  string primary;
+  for (size_t i = 0; i + 80 <= header.size(); i += 80) {
+    string card = header.substr(i, 80);
+    if (card.compare(0, 8, "NAXIS   ") == 0) {
+      primary.append(Card("NAXIS", "0"));
+    } else if (card.compare(0, 5, "NAXIS") != 0) {
+      primary.append(card);
+    }
+  }
+  PadToBlock(' ', &primary);
+
+  string extension = Card("XTENSION", "'IMAGE   '");
+  extension.append(Card("BITPIX", "16"));
+  extension.append(Card("NAXIS", "2"));
+  extension.append(Card("NAXIS1", StringPrintf("%d", WIDTH)));
+  extension.append(Card("NAXIS2", StringPrintf("%d", HEIGHT)));
+  extension.append(Card("PCOUNT", "0"));
+  extension.append(Card("GCOUNT", "1"));
+  string end("END");
+  end.resize(80, ' ');
+  extension.append(end);
+  PadToBlock(' ', &extension);
+
+  string data(2 * WIDTH * HEIGHT, '\0');
+  PadToBlock('\0', &data);
+
+  FILE *fp = fopen(FITS_PRIMARY_WCS_FILENAME, "wb");
+  ASSERT_TRUE(fp != NULL);
+  fwrite(primary.data(), 1, primary.size(), fp);
+  fwrite(extension.data(), 1, extension.size(), fp);
+  fwrite(data.data(), 1, data.size(), fp);
+  fclose(fp);
+}
+
 int Main(int argc, char **argv) {
   {
     cout << "Testing ToRaDec()... ";
@@ -126,6 +192,55 @@ int Main(int argc, char **argv) {
     cout << "pass\n";
   }
 
+  {
+    cout << "Testing FromHeader()... ";
+    vector<long> offsets;
+    vector<string> headers;
+    Fits::FindImageHdus(FITS_MEF_FILENAME, &offsets, &headers);
+
+    string problem;
+    ASSERT_TRUE(WcsProjection::HeaderHasWcs(headers[0], &problem));
+    ASSERT_FALSE(WcsProjection::HeaderHasWcs(headers[1], &problem));
+    ASSERT_FALSE(problem.empty());
+    ASSERT_TRUE(WcsProjection::HeaderHasWcs(headers[2], NULL));
+
+    // The two extensions differ only by 0.3 degrees in CRVAL1.
+    WcsProjection *first = WcsProjection::FromHeader(headers[0]);
+    WcsProjection *last = WcsProjection::FromHeader(headers[2]);
+    double ra1, dec1, ra2, dec2;
+    first->ToRaDec(20.5, 15.5, &ra1, &dec1);
+    last->ToRaDec(20.5, 15.5, &ra2, &dec2);
+    ASSERT_TRUE(fabs(ra1 - 211.319380457) < TINY);
+    ASSERT_TRUE(fabs(dec1 - 4.16492607409) < TINY);
+    ASSERT_TRUE(fabs(ra2 - ra1 - 0.3) < TINY);
+    ASSERT_TRUE(fabs(dec2 - dec1) < TINY);
+    delete first;
+    delete last;
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing WCS inherited from the primary header... ";
+    WritePrimaryWcsFile();
+
+    string header;
+    Fits::ReadImageHeader(FITS_PRIMARY_WCS_FILENAME, &header);
+    ASSERT_EQ(WIDTH, Fits::HeaderReadKeywordInt(header, "NAXIS1", 0));
+    ASSERT_EQ(16, Fits::HeaderReadKeywordInt(header, "BITPIX", 0));
+    ASSERT_TRUE(WcsProjection::HeaderHasWcs(header, NULL));
+
+    // The inherited WCS must match the one read from the original file.
+    WcsProjection original(FITS_FILENAME, WIDTH, HEIGHT);
+    WcsProjection inherited(FITS_PRIMARY_WCS_FILENAME, WIDTH, HEIGHT);
+    double ra1, dec1, ra2, dec2;
+    original.ToRaDec(100.0, 200.0, &ra1, &dec1);
+    inherited.ToRaDec(100.0, 200.0, &ra2, &dec2);
+    ASSERT_TRUE(fabs(ra1 - ra2) < TINY);
+    ASSERT_TRUE(fabs(dec1 - dec2) < TINY);
+    remove(FITS_PRIMARY_WCS_FILENAME);
+    cout << "pass\n";
+  }
+
   cout << "Passed\n";
   return 0;
 }
@@ -0,0 +1,350 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "xyzpyramid.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <map>
+
+#include "boundingbox.h"
+#include "file_util.h"
+#include "json.h"
+#include "mosaic.h"
+#include "string_util.h"
+#include "threadpool.h"
+
+namespace {
+
+// Makes the directories of tile (x, y) of zoom below directory.
+bool MakeTileDirectories(const string &directory, int zoom, int x) {
+  string zoom_directory = google_sky::StringPrintf("%s/%d", directory.c_str(),
+                                                   zoom);
+  return google_sky::MakeDirectory(zoom_directory) &&
+         google_sky::MakeDirectory(
+             google_sky::StringPrintf("%s/%d", zoom_directory.c_str(), x));
+}
+
+// Where the pixels of a warped image lie on the sky.  Pixel (i, j) is at
+// ra = ra_max - i * ra_step, dec = dec_max - j * dec_step, as for a
+// Regionator.
+struct WarpedImage {
+  const google_sky::Image *image;
+  double ra_min;
+  double ra_max;
+  double ra_step;
+  double dec_max;
+  double dec_step;
+};
+
+}  // namespace
+
+namespace google_sky {
+
+// Cuts one tile of the finest zoom out of the warped image.
+class XyzPyramid::LeafTask : public Task {
+ public:
+  LeafTask(const XyzPyramid *pyramid, const WarpedImage *warped, int x,
+           int y, BuildStatus *status)
+      : pyramid_(pyramid), warped_(warped), x_(x), y_(y), status_(status) {}
+
+  // Each tile pixel center is point sampled, with ra moved past 360 where
+  // the image wraps around.
+  virtual void Run() {
+    if (status_->failed()) return;
+    const Image &image = *warped_->image;
+    int size = pyramid_->tile_size_;
+    double ra_min, ra_max, dec_min, dec_max;
+    Mosaic::GetTileBounds(pyramid_->max_zoom_, x_, y_, &ra_min, &ra_max,
+                          &dec_min, &dec_max);
+    double pixel = (ra_max - ra_min) / size;
+
+    vector<int> columns(size);
+    for (int p = 0; p < size; ++p) {
+      double ra = ra_max - (p + 0.5) * pixel;
+      if (ra < warped_->ra_min - 0.5 * fabs(warped_->ra_step)) ra += 360.0;
+      columns[p] = Round((warped_->ra_max - ra) / warped_->ra_step);
+    }
+
+    Image tile;
+    tile.Resize(size, size, Image::RGBA);
+    tile.SetAllValues(0);
+    for (int q = 0; q < size; ++q) {
+      double dec = dec_max - (q + 0.5) * pixel;
+      int j = Round((warped_->dec_max - dec) / warped_->dec_step);
+      if (j < 0 || j >= image.height()) continue;
+      const uint8 *row = image.GetRow(j);
+      uint8 *out = tile.GetMutableRow(q);
+      for (int p = 0; p < size; ++p) {
+        int i = columns[p];
+        if (i < 0 || i >= image.width()) continue;
+        for (int c = 0; c < 4; ++c) {
+          out[4 * p + c] = row[4 * i + c];
+        }
+      }
+    }
+
+    if (tile.AlphaIsEverywhere(0)) return;
+    string error;
+    pair<int, int> key(y_, x_);
+    if (!pyramid_->WriteTile(pyramid_->max_zoom_, key, TileSet(), &tile,
+                             &error)) {
+      status_->Fail(error);
+      return;
+    }
+    status_->AddTile(key);
+  }
+
+ private:
+  const XyzPyramid *pyramid_;
+  const WarpedImage *warped_;
+  int x_;
+  int y_;
+  BuildStatus *status_;
+
+  DISALLOW_COPY_AND_ASSIGN(LeafTask);
+};
+
+const int XyzPyramid::MAX_ZOOM;
+
+XyzPyramid::XyzPyramid()
+    : tile_size_(256),
+      max_zoom_(0),
+      num_threads_(ThreadPool::DefaultNumThreads()),
+      output_directory_("xyz"),
+      name_("wcs2kml tiles") {
+  // Nothing needed.
+}
+
+// The dec pixel scale is used because the ra scale of a warped image
+// stretches with dec.
+int XyzPyramid::FindNativeZoom(const Image &image,
+                               const BoundingBox &bounding_box) const {
+  double dec_min, dec_max;
+  bounding_box.GetDecBounds(&dec_min, &dec_max);
+  double scale = (dec_max - dec_min) / max(1, image.height() - 1);
+  if (!(scale > 0.0)) return 0;
+
+  double zoom = log(180.0 / (tile_size_ * scale)) / log(2.0);
+  return Clamp(static_cast<int>(ceil(zoom - 1.0e-9)), 0, MAX_ZOOM);
+}
+
+bool XyzPyramid::WriteImage(const Image &image,
+                            const BoundingBox &bounding_box,
+                            string *error) const {
+  CHECK_EQ(image.colorspace(), Image::RGBA);
+  CHECK(image.width() > 1 && image.height() > 1);
+  if (!MakeDirectory(output_directory_)) {
+    *error = "Cannot create output directory " + output_directory_;
+    return false;
+  }
+
+  WarpedImage warped;
+  warped.image = &image;
+  double dec_min;
+  bounding_box.GetMonotonicRaBounds(&warped.ra_min, &warped.ra_max);
+  bounding_box.GetDecBounds(&dec_min, &warped.dec_max);
+  warped.ra_step = (warped.ra_max - warped.ra_min) / (image.width() - 1);
+  warped.dec_step = (warped.dec_max - dec_min) / (image.height() - 1);
+
+  TileSet tiles;
+  FindLeafTiles(bounding_box, &tiles);
+
+  ThreadPool pool(num_threads_);
+  BuildStatus status;
+  for (TileSet::const_iterator it = tiles.begin(); it != tiles.end(); ++it) {
+    pool.Add(new LeafTask(this, &warped, it->second, it->first, &status));
+  }
+  pool.Wait();
+  if (status.failed()) {
+    *error = status.error();
+    return false;
+  }
+  tiles = status.tiles();
+  return BuildAncestors(&pool, &tiles, error);
+}
+
+bool XyzPyramid::WriteManifest(const BoundingBox &bounding_box,
+                               string *error) const {
+  double ra_min, ra_max, dec_min, dec_max;
+  bounding_box.GetMonotonicRaBounds(&ra_min, &ra_max);
+  bounding_box.GetDecBounds(&dec_min, &dec_max);
+
+  // TileJSON bounds can't wrap around, so images crossing ra = 0 (which
+  // is longitude 180) are given every longitude.
+  if (ra_max > 360.0) {
+    return WriteManifest(-180.0, dec_min, 180.0, dec_max, error);
+  }
+  return WriteManifest(180.0 - ra_max, dec_min, 180.0 - ra_min, dec_max,
+                       error);
+}
+
+bool XyzPyramid::WriteManifest(string *error) const {
+  return WriteManifest(-180.0, -90.0, 180.0, 90.0, error);
+}
+
+// The keys beyond those of TileJSON 2.2.0 tell the viewer to use the
+// geographic grid and how longitude relates to ra.
+bool XyzPyramid::WriteManifest(double west, double south, double east,
+                               double north, string *error) const {
+  JsonObject manifest;
+  manifest.SetString("tilejson", "2.2.0");
+  manifest.SetString("name", name_);
+  manifest.SetString("description",
+                     "Sky tiles on the EPSG:4326 grid with longitude = "
+                     "180 - ra");
+  manifest.SetString("scheme", "xyz");
+  manifest.SetRaw("tiles", "[\"{z}/{x}/{y}.png\"]");
+  manifest.SetNumber("minzoom", 0);
+  manifest.SetNumber("maxzoom", max_zoom_);
+  manifest.SetRaw("bounds", StringPrintf("[%.10g,%.10g,%.10g,%.10g]", west,
+                                         south, east, north));
+  manifest.SetNumber("tileSize", tile_size_);
+  manifest.SetString("crs", "EPSG:4326");
+
+  if (!MakeDirectory(output_directory_)) {
+    *error = "Cannot create output directory " + output_directory_;
+    return false;
+  }
+  string filename = output_directory_ + "/tiles.json";
+  FILE *fp = fopen(filename.c_str(), "w");
+  if (!fp) {
+    *error = "Can't open file " + filename + " for writing";
+    return false;
+  }
+  fprintf(fp, "%s\n", manifest.ToString().c_str());
+  fclose(fp);
+  return true;
+}
+
+// A hard link shares the tile with the KML pyramid for free.  The old
+// tile is removed first because link() won't replace a file.
+bool XyzPyramid::LinkTile(const string &filename, const string &directory,
+                          int zoom, int x, int y, string *error) {
+  if (!MakeDirectory(directory) || !MakeTileDirectories(directory, zoom, x)) {
+    *error = "Cannot create tile directories in " + directory;
+    return false;
+  }
+  string path = directory + "/" + MakeTilePath(zoom, x, y);
+  if (unlink(path.c_str()) != 0 && errno != ENOENT) {
+    *error = "Can't replace tile " + path;
+    return false;
+  }
+  if (link(filename.c_str(), path.c_str()) != 0 &&
+      !CopyFile(filename, path)) {
+    *error = "Can't link tile " + filename + " to " + path;
+    return false;
+  }
+  return true;
+}
+
+string XyzPyramid::MakeTilePath(int zoom, int x, int y) {
+  return StringPrintf("%d/%d/%d.png", zoom, x, y);
+}
+
+// A bounding box that passes ra = 360 is split into the part before 360 and
+// the part after 0, as Mosaic does.
+void XyzPyramid::FindLeafTiles(const BoundingBox &bounding_box,
+                               TileSet *tiles) const {
+  int num_columns = Mosaic::NumColumns(max_zoom_);
+  int num_rows = Mosaic::NumRows(max_zoom_);
+  double size = 180.0 / num_rows;
+  double ra_min, ra_max, dec_min, dec_max;
+  bounding_box.GetMonotonicRaBounds(&ra_min, &ra_max);
+  bounding_box.GetDecBounds(&dec_min, &dec_max);
+
+  int y1 = Clamp(static_cast<int>(floor((90.0 - dec_max) / size)), 0,
+                 num_rows - 1);
+  int y2 = Clamp(static_cast<int>(floor((90.0 - dec_min) / size)), 0,
+                 num_rows - 1);
+  vector<pair<int, int> > column_ranges;
+  column_ranges.push_back(make_pair(
+      Clamp(static_cast<int>(floor((360.0 - min(ra_max, 360.0)) / size)), 0,
+            num_columns - 1),
+      Clamp(static_cast<int>(floor((360.0 - ra_min) / size)), 0,
+            num_columns - 1)));
+  if (ra_max > 360.0) {
+    column_ranges.push_back(make_pair(
+        Clamp(static_cast<int>(floor((720.0 - ra_max) / size)), 0,
+              num_columns - 1),
+        num_columns - 1));
+  }
+
+  tiles->clear();
+  for (size_t r = 0; r < column_ranges.size(); ++r) {
+    for (int y = y1; y <= y2; ++y) {
+      for (int x = column_ranges[r].first; x <= column_ranges[r].second;
+           ++x) {
+        tiles->insert(make_pair(y, x));
+      }
+    }
+  }
+}
+
+// Each tile of a zoom is the parent of the tiles of the zoom below whose
+// coordinates halve to its own.
+bool XyzPyramid::BuildAncestors(ThreadPool *pool, TileSet *tiles,
+                                string *error) const {
+  for (int zoom = max_zoom_ - 1; zoom >= 0; --zoom) {
+    map<pair<int, int>, TileSet> parents;
+    for (TileSet::const_iterator it = tiles->begin(); it != tiles->end();
+         ++it) {
+      parents[make_pair(it->first / 2, it->second / 2)].insert(*it);
+    }
+
+    if (!BuildParentTiles(this, zoom, parents, pool, tiles, error)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+int XyzPyramid::GetTileSize(void) const {
+  return tile_size_;
+}
+
+string XyzPyramid::GetTileFilename(int zoom,
+                                   const pair<int, int> &key) const {
+  return output_directory_ + "/" + MakeTilePath(zoom, key.second, key.first);
+}
+
+bool XyzPyramid::WriteTile(int zoom, const pair<int, int> &key,
+                           const TileSet &children, Image *tile,
+                           string *error) const {
+  if (!MakeTileDirectories(output_directory_, zoom, key.second)) {
+    *error = "Cannot create tile directories in " + output_directory_;
+    return false;
+  }
+  return WriteTileImage(GetTileFilename(zoom, key), tile, error);
+}
+
+}  // namespace google_sky
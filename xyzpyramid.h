@@ -0,0 +1,223 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// Defines the XyzPyramid class for writing z/x/y tiles for web map viewers
+
+#ifndef XYZPYRAMID_H__
+#define XYZPYRAMID_H__
+
+#include <set>
+#include <string>
+#include <utility>
+
+#include "base.h"
+#include "image.h"
+#include "tilepyramid.h"
+
+namespace google_sky {
+
+// Forward declarations.
+class BoundingBox;
+class ThreadPool;
+
+// Class for writing the sky as an XYZ tile pyramid for web map viewers
+//
+// Browser map libraries such as Leaflet and OpenLayers load tiles named
+// <z>/<x>/<y>.png.  XyzPyramid uses the same global equirectangular grid
+// as a Mosaic, which is the geographic (EPSG:4326) grid those libraries
+// support: zoom z has 2^(z + 1) columns and 2^z rows of square tiles, each
+// covering 180 / 2^z degrees.  Column 0 starts at ra = 360 and row 0 at
+// dec = 90, so as in Earth's sky mode ra decreases to the right and a
+// viewer's longitude is 180 - ra.
+//
+// WriteImage() cuts a warped lat-lon image, as made by SkyProjection, into
+// the tiles of max_zoom() by point sampling, like a Regionator, and then
+// makes each coarser zoom by downsampling the zoom below it, like a
+// Mosaic.  Tiles are made in parallel and tiles the image doesn't reach
+// aren't written.  A Mosaic writes its own tiles into the pyramid through
+// LinkTile() as it builds them (see Mosaic::set_xyz_directory()), so one
+// pass feeds both Earth and the web viewer.
+//
+// WriteManifest() writes tiles.json, a TileJSON description of the pyramid
+// giving its URL template, zoom range, bounds and tile size, for the web
+// viewer to configure itself from.
+//
+// Example Usage:
+//
+// XyzPyramid pyramid;
+// pyramid.set_output_directory("web");
+// pyramid.set_max_zoom(pyramid.FindNativeZoom(warped_image, bounding_box));
+// string error;
+// if (!pyramid.WriteImage(warped_image, bounding_box, &error) ||
+//     !pyramid.WriteManifest(bounding_box, &error)) {
+//   fprintf(stderr, "%s\n", error.c_str());
+// }
+
+class XyzPyramid : public TilePyramidWriter<pair<int, int> > {
+ public:
+  // The finest zoom allowed, the same as Mosaic::MAX_LEVEL.
+  static const int MAX_ZOOM = 20;
+
+  // Creates a pyramid of 256 pixel tiles writing to "xyz".
+  XyzPyramid();
+
+  ~XyzPyramid() {
+    // Nothing needed.
+  }
+
+  // Returns the coarsest zoom whose pixels are no larger than those of an
+  // image warped to lat-lon with the given bounding box.
+  int FindNativeZoom(const Image &image,
+                     const BoundingBox &bounding_box) const;
+
+  // Writes the tiles of every zoom up to max_zoom() for an RGBA image
+  // warped to lat-lon with the given bounding box, with ra decreasing to
+  // the right as SkyProjection makes it.  Returns false with a description
+  // of the problem in error if a tile can't be written.
+  bool WriteImage(const Image &image, const BoundingBox &bounding_box,
+                  string *error) const;
+
+  // Writes tiles.json to the output directory for a pyramid covering the
+  // given bounding box.  Returns false with a description of the problem
+  // in error if the file can't be written.
+  bool WriteManifest(const BoundingBox &bounding_box, string *error) const;
+
+  // Writes tiles.json for a pyramid covering the whole sky, as for a
+  // Mosaic.
+  bool WriteManifest(string *error) const;
+
+  // Places the tile image filename at tile (x, y) of zoom in the pyramid in
+  // directory, replacing any tile already there.  The file is hard linked
+  // where possible and copied otherwise.  Returns false with a description
+  // of the problem in error on failure.  This is safe to call from several
+  // threads at once.
+  static bool LinkTile(const string &filename, const string &directory,
+                       int zoom, int x, int y, string *error);
+
+  // Returns the name of the file of tile (x, y) of zoom relative to the
+  // output directory, e.g. "3/10/2.png".
+  static string MakeTilePath(int zoom, int x, int y);
+
+  // Returns the side length of the tiles in pixels.
+  inline int tile_size(void) const {
+    return tile_size_;
+  }
+
+  // Sets the side length of the tiles in pixels, 256 by default.  Web map
+  // viewers expect 256 or 512.
+  inline void set_tile_size(int tile_size) {
+    CHECK(tile_size == 256 || tile_size == 512)
+        << "Bad tile size " << tile_size;
+    tile_size_ = tile_size;
+  }
+
+  // Returns the finest zoom of the pyramid.
+  inline int max_zoom(void) const {
+    return max_zoom_;
+  }
+
+  // Sets the finest zoom of the pyramid, 0 by default.
+  inline void set_max_zoom(int max_zoom) {
+    CHECK(max_zoom >= 0 && max_zoom <= MAX_ZOOM)
+        << "Bad zoom " << max_zoom;
+    max_zoom_ = max_zoom;
+  }
+
+  // Returns the number of threads used by WriteImage().
+  inline int num_threads(void) const {
+    return num_threads_;
+  }
+
+  // Sets the number of threads used by WriteImage(), which defaults to
+  // ThreadPool::DefaultNumThreads().
+  inline void set_num_threads(int num_threads) {
+    num_threads_ = num_threads;
+  }
+
+  // Returns the directory of the pyramid.
+  inline const string &output_directory(void) const {
+    return output_directory_;
+  }
+
+  // Sets the directory of the pyramid, "xyz" by default.
+  inline void set_output_directory(const string &output_directory) {
+    output_directory_ = output_directory;
+  }
+
+  // Returns the name given in tiles.json.
+  inline const string &name(void) const {
+    return name_;
+  }
+
+  // Sets the name given in tiles.json, "wcs2kml tiles" by default.
+  inline void set_name(const string &name) {
+    name_ = name;
+  }
+
+ private:
+  // Tiles of one zoom as (y, x) pairs.
+  typedef set<pair<int, int> > TileSet;
+
+  // Collects the tiles written by a zoom of Build() and the first error.
+  typedef TileBuildStatus<pair<int, int> > BuildStatus;
+
+  class LeafTask;
+
+  int tile_size_;
+  int max_zoom_;
+  int num_threads_;
+  string output_directory_;
+  string name_;
+
+  // Finds the tiles of max_zoom() that the bounding box overlaps.
+  void FindLeafTiles(const BoundingBox &bounding_box, TileSet *tiles) const;
+
+  // Makes each coarser zoom from the tiles of the zoom below, which are
+  // given in tiles.
+  bool BuildAncestors(ThreadPool *pool, TileSet *tiles, string *error) const;
+
+  virtual int GetTileSize(void) const;
+
+  virtual string GetTileFilename(int zoom, const pair<int, int> &key) const;
+
+  // Writes tile (x, y) of zoom, which is keyed by (y, x).  The children
+  // aren't needed.
+  virtual bool WriteTile(int zoom, const pair<int, int> &key,
+                         const TileSet &children, Image *tile,
+                         string *error) const;
+
+  // Writes tiles.json with the given bounds in longitude and latitude.
+  bool WriteManifest(double west, double south, double east, double north,
+                     string *error) const;
+
+  DISALLOW_COPY_AND_ASSIGN(XyzPyramid);
+};
+
+}  // namespace google_sky
+
+#endif  // XYZPYRAMID_H__
@@ -0,0 +1,205 @@
+// Copyright (c) 2007-2009, Google Inc.
+// Author: Jeremy Brewer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name of Google Inc. nor the names of its contributors may be
+//     used to endorse or promote products derived from this software without
+//     specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "base.h"
+#include "boundingbox.h"
+#include "color.h"
+#include "file_util.h"
+#include "image.h"
+#include "skyprojection.h"
+#include "string_util.h"
+#include "test_util.h"
+#include "wcsprojection.h"
+#include "xyzpyramid.h"
+
+namespace google_sky {
+
+// Warps a solid red width x height image with pixels of scale degrees
+// centered on ra, dec.
+void WarpSolidImage(double ra, double dec, int width, int height,
+                    double scale, Image *warped, BoundingBox *bounding_box) {
+  Image image;
+  ASSERT_TRUE(image.Resize(width, height, Image::RGBA));
+  image.SetAllValuesInChannel(0, 255);
+  image.SetAllValuesInChannel(3, 255);
+  WcsProjection *wcs = WcsProjection::FromHeader(
+      MakeHeader(ra, dec, width, height, scale));
+  SkyProjection projection(image, *wcs);
+  projection.WarpImage(warped);
+  bounding_box->FindBoundingBox(*wcs, width, height);
+  delete wcs;
+}
+
+int Main(int argc, char **argv) {
+  {
+    cout << "Testing MakeTilePath()... ";
+    ASSERT_TRUE(XyzPyramid::MakeTilePath(3, 10, 2) == "3/10/2.png");
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing WriteImage()... ";
+    ASSERT_TRUE(system("rm -rf xyz_test_tiles") == 0);
+
+    // A 2 x 2 degree image centered on ra = 100, dec = 20.
+    Image warped;
+    BoundingBox bounding_box;
+    WarpSolidImage(100.0, 20.0, 200, 200, 0.01, &warped, &bounding_box);
+
+    XyzPyramid pyramid;
+    pyramid.set_output_directory("xyz_test_tiles");
+    pyramid.set_num_threads(2);
+    int zoom = pyramid.FindNativeZoom(warped, bounding_box);
+    ASSERT_TRUE(zoom >= 6 && zoom <= 7);
+    pyramid.set_max_zoom(4);
+    string error;
+    ASSERT_TRUE(pyramid.WriteImage(warped, bounding_box, &error));
+
+    // At zoom 4 tiles are 11.25 degrees, so the image is in column
+    // (360 - 100) / 11.25 and row (90 - 20) / 11.25.
+    Image tile;
+    ASSERT_TRUE(tile.Read("xyz_test_tiles/4/23/6.png"));
+    ASSERT_TRUE(tile.ConvertToRGBA());
+    ASSERT_EQ(256, tile.width());
+    int i = static_cast<int>((101.25 - 100.0) / 11.25 * 256);
+    int j = static_cast<int>((22.5 - 20.0) / 11.25 * 256);
+    ASSERT_EQ(255, static_cast<int>(tile.GetValue(i, j, 0)));
+    ASSERT_EQ(255, static_cast<int>(tile.GetValue(i, j, 3)));
+    ASSERT_EQ(0, static_cast<int>(tile.GetValue(0, 0, 3)));
+    ASSERT_FALSE(FileExists("xyz_test_tiles/4/22/6.png"));
+
+    // Each coarser zoom is downsampled from the one below it.
+    ASSERT_TRUE(FileExists("xyz_test_tiles/3/11/3.png"));
+    ASSERT_TRUE(FileExists("xyz_test_tiles/0/1/0.png"));
+    ASSERT_FALSE(FileExists("xyz_test_tiles/0/0/0.png"));
+    ASSERT_TRUE(tile.Read("xyz_test_tiles/3/11/3.png"));
+    ASSERT_TRUE(tile.ConvertToRGBA());
+    ASSERT_EQ(255, static_cast<int>(tile.GetValue(128 + i / 2, j / 2, 0)));
+    ASSERT_TRUE(tile.GetValue(128 + i / 2, j / 2, 3) > 0);
+
+    // The manifest gives the bounds with longitude = 180 - ra.
+    ASSERT_TRUE(pyramid.WriteManifest(bounding_box, &error));
+    // JsonObject only parses flat objects, so look for the members in the
+    // text.
+    string manifest = ReadFile("xyz_test_tiles/tiles.json");
+    ASSERT_TRUE(manifest.find("\"maxzoom\":4") != string::npos);
+    ASSERT_TRUE(manifest.find("\"tileSize\":256") != string::npos);
+    ASSERT_TRUE(manifest.find("\"scheme\":\"xyz\"") != string::npos);
+    ASSERT_TRUE(manifest.find("\"tiles\":[\"{z}/{x}/{y}.png\"]") !=
+                string::npos);
+    ASSERT_TRUE(manifest.find("\"bounds\":[78.9") != string::npos);
+
+    ASSERT_TRUE(system("rm -rf xyz_test_tiles") == 0);
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing WriteImage() across ra = 0... ";
+    ASSERT_TRUE(system("rm -rf xyz_test_tiles") == 0);
+    Image warped;
+    BoundingBox bounding_box;
+    WarpSolidImage(0.0, 0.0, 100, 100, 0.01, &warped, &bounding_box);
+
+    XyzPyramid pyramid;
+    pyramid.set_output_directory("xyz_test_tiles");
+    pyramid.set_tile_size(512);
+    pyramid.set_max_zoom(2);
+    string error;
+    ASSERT_TRUE(pyramid.WriteImage(warped, bounding_box, &error));
+
+    // The image lands in the first and last columns on both sides of the
+    // equator.
+    ASSERT_TRUE(FileExists("xyz_test_tiles/2/0/1.png"));
+    ASSERT_TRUE(FileExists("xyz_test_tiles/2/7/1.png"));
+    ASSERT_TRUE(FileExists("xyz_test_tiles/2/0/2.png"));
+    ASSERT_TRUE(FileExists("xyz_test_tiles/2/7/2.png"));
+    ASSERT_FALSE(FileExists("xyz_test_tiles/2/1/1.png"));
+    Image tile;
+    ASSERT_TRUE(tile.Read("xyz_test_tiles/2/0/1.png"));
+    ASSERT_TRUE(tile.ConvertToRGBA());
+    ASSERT_EQ(512, tile.width());
+    ASSERT_EQ(255, static_cast<int>(tile.GetValue(0, 511, 3)));
+    ASSERT_TRUE(tile.Read("xyz_test_tiles/2/7/1.png"));
+    ASSERT_TRUE(tile.ConvertToRGBA());
+    ASSERT_EQ(255, static_cast<int>(tile.GetValue(511, 511, 3)));
+
+    ASSERT_TRUE(pyramid.WriteManifest(bounding_box, &error));
+    string manifest = ReadFile("xyz_test_tiles/tiles.json");
+    ASSERT_TRUE(manifest.find("\"bounds\":[-180,") != string::npos);
+
+    ASSERT_TRUE(system("rm -rf xyz_test_tiles") == 0);
+    cout << "pass\n";
+  }
+
+  {
+    cout << "Testing LinkTile()... ";
+    ASSERT_TRUE(system("rm -rf xyz_test_tiles xyz_test.png") == 0);
+    FILE *fp = fopen("xyz_test.png", "w");
+    ASSERT_TRUE(fp != NULL);
+    fprintf(fp, "first");
+    fclose(fp);
+    string error;
+    ASSERT_TRUE(XyzPyramid::LinkTile("xyz_test.png", "xyz_test_tiles", 2, 3,
+                                     1, &error));
+    ASSERT_TRUE(ReadFile("xyz_test_tiles/2/3/1.png") == "first");
+
+    // An existing tile is replaced.
+    ASSERT_TRUE(system("rm -f xyz_test.png") == 0);
+    fp = fopen("xyz_test.png", "w");
+    ASSERT_TRUE(fp != NULL);
+    fprintf(fp, "second");
+    fclose(fp);
+    ASSERT_TRUE(XyzPyramid::LinkTile("xyz_test.png", "xyz_test_tiles", 2, 3,
+                                     1, &error));
+    ASSERT_TRUE(ReadFile("xyz_test_tiles/2/3/1.png") == "second");
+
+    ASSERT_FALSE(XyzPyramid::LinkTile("xyz_missing.png", "xyz_test_tiles",
+                                      2, 3, 1, &error));
+    ASSERT_TRUE(StringContains(error, "xyz_missing.png"));
+
+    ASSERT_TRUE(system("rm -rf xyz_test_tiles xyz_test.png") == 0);
+    cout << "pass\n";
+  }
+
+  cout << "Passed\n";
+  return 0;
+}
+
+}  // namespace google_sky
+
+int main(int argc, char **argv) {
+  return google_sky::Main(argc, argv);
+}